@@ -44,9 +44,9 @@ private:
 
 public:
 
-  /// constructs a basic_partitioner
+  /// constructs a modulo_partitioner
   /// @param num_buckets the number of buckets to partition into.
-  basic_partitioner(size_t num_buckets)
+  modulo_partitioner(size_t num_buckets)
   : partitioner<T>(num_buckets)
   {
   }
@@ -54,7 +54,7 @@ public:
   /// return a bucket for the given key
   size_t partition(const T & key) const
   {
-    return m_hasher(key) % this->getNumBuckets();
+    return m_hasher(key) % this->num_buckets();
   }
 };
 
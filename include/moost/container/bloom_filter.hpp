@@ -0,0 +1,515 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_CONTAINER_BLOOM_FILTER_HPP_
+#define MOOST_CONTAINER_BLOOM_FILTER_HPP_
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+
+#include <boost/cstdint.hpp>
+
+#include "detail/filter_support.hpp"
+
+namespace moost { namespace container {
+
+/*!
+ * Cache-line blocked Bloom filter
+ *
+ * This is a drop-in alternative to bit_filter that offers a much better
+ * false positive rate for the same amount of memory. Each item is hashed
+ * once to 64 bits; this hash selects one 512-bit block and k bits within
+ * that block. A lookup thus touches exactly one cache line.
+ *
+ * The filter is sized from the number of items it is expected to hold
+ * and the desired false positive rate:
+ *
+\code
+moost::container::blocked_bloom_filter<int> bf(1000000, 0.001);
+bf.insert(42);
+if (bf.find(42)) { ... }
+\endcode
+ *
+ * Bulk lookups should use find_batch(), which hashes a group of items
+ * up front and prefetches their blocks before testing them.
+ */
+template <typename itemT, typename hashT = filter_types::default_hash>
+class blocked_bloom_filter
+{
+private:
+   typedef detail::blocked_bloom probe_type;
+
+   static const boost::uint32_t SERIAL_MAGIC = 0x4642424D; // "MBBF"
+   static const boost::uint32_t SERIAL_VERSION = 1;
+   static const size_t BATCH_SIZE = 16;
+
+public:
+   typedef itemT item_type;
+   typedef hashT hash_type;
+   typedef blocked_bloom_filter<item_type, hash_type> this_type;
+   typedef filter_types::serial_buffer_t serial_buffer_t;
+
+   /*!
+    * c_tor; sizes the filter for the expected number of items at the
+    * requested false positive rate
+    */
+   blocked_bloom_filter(
+      size_t const expected_items,
+      double const fpr,
+      hash_type const & ht = hash_type()
+      ) : ht_(ht)
+   {
+      size_t blocks;
+      unsigned k;
+      probe_type::dimension(expected_items, fpr, blocks, k);
+      init(blocks, k);
+   }
+
+   /*!
+    * c_tor; sizes the filter for the expected number of items at the
+    * requested false positive rate and inserts the items
+    */
+   template <typename inputIteratorT>
+   blocked_bloom_filter(
+      size_t const expected_items,
+      double const fpr,
+      inputIteratorT beg,
+      inputIteratorT end,
+      hash_type const & ht = hash_type()
+      ) : ht_(ht)
+   {
+      size_t blocks;
+      unsigned k;
+      probe_type::dimension(expected_items, fpr, blocks, k);
+      init(blocks, k);
+      insert(beg, end);
+   }
+
+   /*!
+    * cc_tor
+    */
+   blocked_bloom_filter(blocked_bloom_filter const & rhs)
+      : ht_(rhs.ht_)
+   {
+      assign(rhs);
+   }
+
+   /*!
+    * Assignment
+    */
+   blocked_bloom_filter & operator = (blocked_bloom_filter const & rhs)
+   {
+      if (this != &rhs)
+      {
+         ht_ = rhs.ht_;
+         assign(rhs);
+      }
+
+      return *this;
+   }
+
+   /*!
+    * Insert an item in to the filter
+    *
+    * The boptimise argument is only present for interface compatibility
+    * with bit_filter; the representation of this filter is always optimal.
+    */
+   void insert(item_type const & t, bool boptimise = false)
+   {
+      (void) boptimise;
+      boost::uint64_t const h = hash(t);
+      probe_type::mask m;
+      probe_type::make_mask(h, k_, m);
+      probe_type::set(block(probe_type::block_index(h, num_blocks_)), m);
+   }
+
+   /*!
+    * Insert items in to the filter using iterators of a container, finding items are preserved
+    */
+   template <typename inputIteratorT>
+   void insert(inputIteratorT beg, inputIteratorT end, bool boptimise = false)
+   {
+      (void) boptimise;
+
+      while (beg != end)
+      {
+         insert(*beg);
+         ++beg;
+      }
+   }
+
+   /*!
+    * Insert items in to the filter using iterators of a container, finding items are cleared first
+    */
+   template <typename inputIteratorT>
+   void replace(inputIteratorT beg, inputIteratorT end)
+   {
+      clear();
+      insert(beg, end);
+   }
+
+   /*!
+    * Unset all the bits in the filter
+    */
+   void clear()
+   {
+      std::fill(words_.begin(), words_.end(), 0);
+   }
+
+   /*!
+    * The size (number of bits) of the filter
+    */
+   size_t size() const
+   {
+      return num_blocks_*probe_type::BITS_PER_BLOCK;
+   }
+
+   /*!
+    * The number of 512-bit blocks in the filter
+    */
+   size_t num_blocks() const
+   {
+      return num_blocks_;
+   }
+
+   /*!
+    * The number of bits set per item
+    */
+   unsigned num_hashes() const
+   {
+      return k_;
+   }
+
+   /*!
+    * The false positive rate to be expected after inserting the given
+    * number of distinct items
+    */
+   double expected_fpr(size_t items) const
+   {
+      return probe_type::estimate_fpr(items, num_blocks_, k_);
+   }
+
+   /*!
+    * Checks for the presence of a single item
+    */
+   bool find(item_type const & t) const
+   {
+      boost::uint64_t const h = hash(t);
+      probe_type::mask m;
+      probe_type::make_mask(h, k_, m);
+      return probe_type::test(block(probe_type::block_index(h, num_blocks_)), m);
+   }
+
+   /*!
+    * Checks for the presence of multiple items in a container, returning a
+    * count of the number of items that match
+    */
+   template <typename inputIteratorT>
+   size_t find(inputIteratorT beg, inputIteratorT end) const
+   {
+      size_t cnt = 0;
+
+      while (beg != end)
+      {
+         if (find(*beg))
+         {
+            ++cnt;
+         }
+
+         ++beg;
+      }
+
+      return cnt;
+   }
+
+   /*!
+    * Checks for the presence of multiple items in a container, returning a
+    * count of the number of items that match as well as adding all matching
+    * items to an output container using the output iterator
+    */
+   template <typename inputIteratorT, typename outputIteratorT>
+   size_t find(inputIteratorT beg, inputIteratorT end, outputIteratorT out) const
+   {
+      size_t cnt = 0;
+
+      while (beg != end)
+      {
+         if (find(*beg))
+         {
+            ++cnt;
+            *out = *beg;
+            ++out;
+         }
+
+         ++beg;
+      }
+
+      return cnt;
+   }
+
+   /*!
+    * Batched membership test; result[i] is set to the outcome of find(items[i]).
+    * Hashing and block prefetching are done for a group of items before any
+    * of them is tested, so the cache misses overlap. Returns the number of
+    * matching items.
+    */
+   size_t find_batch(item_type const * items, size_t count, bool * result) const
+   {
+      size_t cnt = 0;
+      boost::uint64_t h[BATCH_SIZE];
+      boost::uint64_t const * b[BATCH_SIZE];
+
+      for (size_t base = 0; base < count; base += BATCH_SIZE)
+      {
+         size_t const n = count - base < BATCH_SIZE ? count - base : BATCH_SIZE;
+
+         for (size_t i = 0; i < n; ++i)
+         {
+            h[i] = hash(items[base + i]);
+            b[i] = block(probe_type::block_index(h[i], num_blocks_));
+            probe_type::prefetch(b[i]);
+         }
+
+         for (size_t i = 0; i < n; ++i)
+         {
+            probe_type::mask m;
+            probe_type::make_mask(h[i], k_, m);
+            bool const hit = probe_type::test(b[i], m);
+            result[base + i] = hit;
+            cnt += hit;
+         }
+      }
+
+      return cnt;
+   }
+
+   /*!
+    * Does nothing; present for interface compatibility with bit_filter
+    */
+   void optimize()
+   {
+   }
+
+   /*!
+    * Serialise the filter to a vector of bytes.
+    * Returns the number of bytes used by serialisation.
+    */
+   size_t serialize(serial_buffer_t & buf, bool boptimise = true) const
+   {
+      (void) boptimise;
+
+      detail::filter_header hdr;
+      std::memset(&hdr, 0, sizeof(hdr));
+      hdr.magic = SERIAL_MAGIC;
+      hdr.version = SERIAL_VERSION;
+      hdr.param[0] = num_blocks_;
+      hdr.param[1] = k_;
+
+      detail::write_filter(buf, hdr, data(), num_blocks_*sizeof(block_type));
+
+      return buf.size();
+   }
+
+   /*!
+    * Deserialise the filter from a vector of bytes.
+    * If bclear is false, the deserialised filter is merged into the
+    * current one, which requires both filters to have the same geometry.
+    */
+   void deserialize(serial_buffer_t const & buf, bool bclear = true)
+   {
+      detail::filter_header const & hdr = detail::read_filter_header(buf, SERIAL_MAGIC, SERIAL_VERSION);
+      size_t const blocks = static_cast<size_t>(hdr.param[0]);
+      unsigned const k = static_cast<unsigned>(hdr.param[1]);
+
+      if (buf.size() != sizeof(hdr) + blocks*sizeof(block_type))
+      {
+         throw std::runtime_error("bloom filter buffer size mismatch");
+      }
+
+      boost::uint64_t const * src = reinterpret_cast<boost::uint64_t const *>(&buf[sizeof(hdr)]);
+
+      if (bclear)
+      {
+         init(blocks, k);
+         std::memcpy(aligned_words(), src, blocks*sizeof(block_type));
+      }
+      else
+      {
+         if (blocks != num_blocks_ || k != k_)
+         {
+            throw std::runtime_error("cannot merge bloom filters of different geometry");
+         }
+
+         boost::uint64_t * dst = aligned_words();
+
+         for (size_t i = 0; i < blocks*probe_type::WORDS_PER_BLOCK; ++i)
+         {
+            dst[i] |= src[i];
+         }
+      }
+   }
+
+   /*!
+    * Equality operator for the filter
+    */
+   bool operator == (this_type const & rhs) const
+   {
+      return num_blocks_ == rhs.num_blocks_ && k_ == rhs.k_ &&
+             std::memcmp(data(), rhs.data(), num_blocks_*sizeof(block_type)) == 0;
+   }
+
+   /*!
+    * Inequality operator for the filter
+    */
+   bool operator != (this_type const & rhs) const
+   {
+      return !(*this == rhs);
+   }
+
+   /*!
+    * The amount of memory being used by the internal filter (in bytes).
+    */
+   size_t memory() const
+   {
+      return words_.capacity()*sizeof(boost::uint64_t);
+   }
+
+   /*!
+    * Gets the count of the number of bits actually set.
+    */
+   size_t count() const
+   {
+      size_t cnt = 0;
+      boost::uint64_t const * p = data();
+
+      for (size_t i = 0; i < num_blocks_*probe_type::WORDS_PER_BLOCK; ++i)
+      {
+         cnt += popcount(p[i]);
+      }
+
+      return cnt;
+   }
+
+   /*!
+    * Raw access to the (cache-line aligned) block array
+    */
+   boost::uint64_t const * data() const
+   {
+      return const_cast<this_type *>(this)->aligned_words();
+   }
+
+private:
+   struct block_type
+   {
+      boost::uint64_t w[probe_type::WORDS_PER_BLOCK];
+   };
+
+   void init(size_t blocks, unsigned k)
+   {
+      if (blocks == 0 || k == 0 || k > probe_type::MAX_HASHES)
+      {
+         throw std::runtime_error("invalid bloom filter geometry");
+      }
+
+      num_blocks_ = blocks;
+      k_ = k;
+
+      // over-allocate so the blocks can be aligned to a cache line
+      words_.assign(blocks*probe_type::WORDS_PER_BLOCK + probe_type::WORDS_PER_BLOCK - 1, 0);
+   }
+
+   void assign(this_type const & rhs)
+   {
+      // the alignment offset may differ between the two buffers,
+      // so only the aligned block area can be copied
+      init(rhs.num_blocks_, rhs.k_);
+      std::memcpy(aligned_words(), rhs.data(), num_blocks_*sizeof(block_type));
+   }
+
+   boost::uint64_t hash(item_type const & t) const
+   {
+      return filter_types::mix64(static_cast<boost::uint64_t>(ht_(t)));
+   }
+
+   boost::uint64_t * aligned_words()
+   {
+      size_t const p = reinterpret_cast<size_t>(&words_[0]);
+      return reinterpret_cast<boost::uint64_t *>((p + probe_type::BLOCK_ALIGNMENT - 1) & ~(probe_type::BLOCK_ALIGNMENT - 1));
+   }
+
+   boost::uint64_t * block(size_t ix)
+   {
+      return aligned_words() + ix*probe_type::WORDS_PER_BLOCK;
+   }
+
+   boost::uint64_t const * block(size_t ix) const
+   {
+      return data() + ix*probe_type::WORDS_PER_BLOCK;
+   }
+
+   static size_t popcount(boost::uint64_t v)
+   {
+#if defined(__GNUC__)
+      return __builtin_popcountll(v);
+#else
+      size_t c = 0;
+      for (; v; ++c) { v &= v - 1; }
+      return c;
+#endif
+   }
+
+   size_t num_blocks_;
+   unsigned k_;
+   std::vector<boost::uint64_t> words_;
+   hash_type ht_;
+};
+
+template <typename itemT, typename hashT>
+blocked_bloom_filter<itemT, hashT> & operator >> (
+   blocked_bloom_filter<itemT, hashT> & bf,
+   typename blocked_bloom_filter<itemT, hashT>::serial_buffer_t & buf
+   )
+{
+   bf.serialize(buf);
+   return bf;
+}
+
+template <typename itemT, typename hashT>
+blocked_bloom_filter<itemT, hashT> & operator << (
+   blocked_bloom_filter<itemT, hashT> & bf,
+   typename blocked_bloom_filter<itemT, hashT>::serial_buffer_t const & buf
+   )
+{
+   bf.deserialize(buf);
+   return bf;
+}
+
+}}
+
+#endif
@@ -0,0 +1,585 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_CONTAINER_CUCKOO_FILTER_HPP_
+#define MOOST_CONTAINER_CUCKOO_FILTER_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+
+#include <boost/cstdint.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/is_unsigned.hpp>
+
+#include "detail/filter_support.hpp"
+
+namespace moost { namespace container {
+
+/*!
+ * Cuckoo filter
+ *
+ * An approximate set membership filter that, unlike Bloom filters,
+ * supports removal of items. Each item is represented by a short
+ * fingerprint stored in one of two candidate buckets of four slots.
+ *
+ * The filter behaves like a multiset of fingerprints: inserting an item
+ * twice stores two fingerprints and erase() removes one of them. Only
+ * items that have actually been inserted must be erased, otherwise a
+ * colliding item may be removed.
+ *
+ * Sizing is driven by the expected number of items and the target false
+ * positive rate, which determines how many bits of each fingerprint are
+ * used (at most the width of fingerprintT). Inserting considerably more
+ * items than the filter was sized for will eventually make insert()
+ * fail.
+ */
+template <typename itemT, typename hashT = filter_types::default_hash, typename fingerprintT = boost::uint16_t>
+class cuckoo_filter
+{
+   BOOST_STATIC_ASSERT(boost::is_unsigned<fingerprintT>::value);
+   BOOST_STATIC_ASSERT(sizeof(fingerprintT) <= 2);
+
+private:
+   static const boost::uint32_t SERIAL_MAGIC = 0x4643464D; // "MFCF"
+   static const boost::uint32_t SERIAL_VERSION = 1;
+   static const size_t MAX_KICKS = 500;
+
+public:
+   static const size_t SLOTS_PER_BUCKET = 4;
+
+   typedef itemT item_type;
+   typedef hashT hash_type;
+   typedef fingerprintT fingerprint_type;
+   typedef cuckoo_filter<item_type, hash_type, fingerprint_type> this_type;
+   typedef filter_types::serial_buffer_t serial_buffer_t;
+
+   static double MAX_LOAD_FACTOR()
+   {
+      // achievable load with four slots per bucket
+      return 0.95;
+   }
+
+   /*!
+    * c_tor; sizes the filter for the expected number of items at the
+    * requested false positive rate
+    */
+   cuckoo_filter(
+      size_t const expected_items,
+      double const fpr,
+      hash_type const & ht = hash_type()
+      ) : ht_(ht)
+   {
+      if (!(fpr > 0.0 && fpr < 1.0))
+      {
+         throw std::invalid_argument("false positive rate must be in (0, 1)");
+      }
+
+      // a lookup compares against 2*SLOTS_PER_BUCKET fingerprints
+      unsigned bits = static_cast<unsigned>(std::ceil(std::log(2.0*SLOTS_PER_BUCKET/fpr)/std::log(2.0)));
+      unsigned const max_bits = 8*sizeof(fingerprint_type);
+
+      if (bits > max_bits)
+      {
+         throw std::invalid_argument("false positive rate too low for fingerprint type");
+      }
+
+      size_t const min_buckets = static_cast<size_t>(std::ceil(
+         static_cast<double>(std::max<size_t>(expected_items, 1))/(SLOTS_PER_BUCKET*MAX_LOAD_FACTOR())));
+      size_t buckets = 1;
+
+      while (buckets < min_buckets)
+      {
+         buckets <<= 1;
+      }
+
+      init(buckets, std::max(bits, 2U));
+   }
+
+   /*!
+    * Insert an item in to the filter
+    *
+    * Returns false if the filter is too full to accept the item.
+    * The boptimise argument is only present for interface compatibility
+    * with bit_filter.
+    */
+   bool insert(item_type const & t, bool boptimise = false)
+   {
+      (void) boptimise;
+
+      if (victim_.used)
+      {
+         return false;
+      }
+
+      fingerprint_type fp;
+      size_t i1, i2;
+      locate(t, fp, i1, i2);
+
+      if (add_to_bucket(i1, fp) || add_to_bucket(i2, fp))
+      {
+         ++count_;
+         return true;
+      }
+
+      // relocate existing fingerprints until we find a free slot
+      size_t ix = (rng() & 1) ? i1 : i2;
+
+      for (size_t kick = 0; kick < MAX_KICKS; ++kick)
+      {
+         std::swap(fp, slots_[ix*SLOTS_PER_BUCKET + (rng() % SLOTS_PER_BUCKET)]);
+         ix = alt_index(ix, fp);
+
+         if (add_to_bucket(ix, fp))
+         {
+            ++count_;
+            return true;
+         }
+      }
+
+      // the item itself is in, but the last evicted fingerprint has
+      // nowhere to go; keep it aside and refuse further inserts
+      victim_.used = true;
+      victim_.index = ix;
+      victim_.fp = fp;
+      ++count_;
+
+      return true;
+   }
+
+   /*!
+    * Insert items in to the filter using iterators of a container.
+    * Returns the number of items that could be inserted.
+    */
+   template <typename inputIteratorT>
+   size_t insert(inputIteratorT beg, inputIteratorT end, bool boptimise = false)
+   {
+      (void) boptimise;
+      size_t cnt = 0;
+
+      while (beg != end)
+      {
+         if (insert(*beg))
+         {
+            ++cnt;
+         }
+
+         ++beg;
+      }
+
+      return cnt;
+   }
+
+   /*!
+    * Insert items in to the filter using iterators of a container, finding items are cleared first
+    */
+   template <typename inputIteratorT>
+   size_t replace(inputIteratorT beg, inputIteratorT end)
+   {
+      clear();
+      return insert(beg, end);
+   }
+
+   /*!
+    * Remove one instance of a previously inserted item. Returns false if
+    * the item could not be found.
+    */
+   bool erase(item_type const & t)
+   {
+      fingerprint_type fp;
+      size_t i1, i2;
+      locate(t, fp, i1, i2);
+
+      if (remove_from_bucket(i1, fp) || remove_from_bucket(i2, fp))
+      {
+         --count_;
+
+         if (victim_.used)
+         {
+            // there is room now, so try to place the stashed fingerprint
+            victim_.used = false;
+            --count_;
+            reinsert(victim_.index, victim_.fp);
+         }
+
+         return true;
+      }
+
+      if (victim_.used && victim_.fp == fp && (victim_.index == i1 || victim_.index == i2))
+      {
+         victim_.used = false;
+         --count_;
+         return true;
+      }
+
+      return false;
+   }
+
+   /*!
+    * Remove all items from the filter
+    */
+   void clear()
+   {
+      std::fill(slots_.begin(), slots_.end(), 0);
+      victim_.used = false;
+      count_ = 0;
+   }
+
+   /*!
+    * The capacity (number of fingerprint slots) of the filter
+    */
+   size_t size() const
+   {
+      return slots_.size();
+   }
+
+   /*!
+    * The number of fingerprint bits used
+    */
+   unsigned fingerprint_bits() const
+   {
+      return fp_bits_;
+   }
+
+   /*!
+    * The fraction of slots in use
+    */
+   double load_factor() const
+   {
+      return static_cast<double>(count_)/slots_.size();
+   }
+
+   /*!
+    * Upper bound of the false positive rate at the current load
+    */
+   double expected_fpr() const
+   {
+      return 2.0*SLOTS_PER_BUCKET*load_factor()/(static_cast<double>(fp_mask_) + 1.0);
+   }
+
+   /*!
+    * Checks for the presence of a single item
+    */
+   bool find(item_type const & t) const
+   {
+      fingerprint_type fp;
+      size_t i1, i2;
+      locate(t, fp, i1, i2);
+
+      return bucket_contains(i1, fp) || bucket_contains(i2, fp) ||
+             (victim_.used && victim_.fp == fp && (victim_.index == i1 || victim_.index == i2));
+   }
+
+   /*!
+    * Checks for the presence of multiple items in a container, returning a
+    * count of the number of items that match
+    */
+   template <typename inputIteratorT>
+   size_t find(inputIteratorT beg, inputIteratorT end) const
+   {
+      size_t cnt = 0;
+
+      while (beg != end)
+      {
+         if (find(*beg))
+         {
+            ++cnt;
+         }
+
+         ++beg;
+      }
+
+      return cnt;
+   }
+
+   /*!
+    * Checks for the presence of multiple items in a container, returning a
+    * count of the number of items that match as well as adding all matching
+    * items to an output container using the output iterator
+    */
+   template <typename inputIteratorT, typename outputIteratorT>
+   size_t find(inputIteratorT beg, inputIteratorT end, outputIteratorT out) const
+   {
+      size_t cnt = 0;
+
+      while (beg != end)
+      {
+         if (find(*beg))
+         {
+            ++cnt;
+            *out = *beg;
+            ++out;
+         }
+
+         ++beg;
+      }
+
+      return cnt;
+   }
+
+   /*!
+    * Does nothing; present for interface compatibility with bit_filter
+    */
+   void optimize()
+   {
+   }
+
+   /*!
+    * Serialise the filter to a vector of bytes.
+    * Returns the number of bytes used by serialisation.
+    */
+   size_t serialize(serial_buffer_t & buf, bool boptimise = true) const
+   {
+      (void) boptimise;
+
+      detail::filter_header hdr;
+      std::memset(&hdr, 0, sizeof(hdr));
+      hdr.magic = SERIAL_MAGIC;
+      hdr.version = SERIAL_VERSION;
+      hdr.param[0] = num_buckets_;
+      hdr.param[1] = fp_bits_ | (sizeof(fingerprint_type) << 8) | (victim_.used ? 0x10000 : 0);
+      hdr.param[2] = count_;
+      hdr.param[3] = victim_.used ? ((static_cast<boost::uint64_t>(victim_.index) << 16) | victim_.fp) : 0;
+
+      detail::write_filter(buf, hdr, &slots_[0], slots_.size()*sizeof(fingerprint_type));
+
+      return buf.size();
+   }
+
+   /*!
+    * Deserialise the filter from a vector of bytes.
+    * Merging (bclear == false) is not supported by cuckoo filters.
+    */
+   void deserialize(serial_buffer_t const & buf, bool bclear = true)
+   {
+      if (!bclear)
+      {
+         throw std::logic_error("cuckoo filters cannot be merged");
+      }
+
+      detail::filter_header const & hdr = detail::read_filter_header(buf, SERIAL_MAGIC, SERIAL_VERSION);
+      size_t const buckets = static_cast<size_t>(hdr.param[0]);
+
+      if (((hdr.param[1] >> 8) & 0xFF) != sizeof(fingerprint_type))
+      {
+         throw std::runtime_error("cuckoo filter fingerprint size mismatch");
+      }
+
+      if (buf.size() != sizeof(hdr) + buckets*SLOTS_PER_BUCKET*sizeof(fingerprint_type))
+      {
+         throw std::runtime_error("cuckoo filter buffer size mismatch");
+      }
+
+      init(buckets, static_cast<unsigned>(hdr.param[1] & 0xFF));
+      std::memcpy(&slots_[0], &buf[sizeof(hdr)], slots_.size()*sizeof(fingerprint_type));
+      count_ = static_cast<size_t>(hdr.param[2]);
+      victim_.used = (hdr.param[1] & 0x10000) != 0;
+      victim_.index = static_cast<size_t>(hdr.param[3] >> 16);
+      victim_.fp = static_cast<fingerprint_type>(hdr.param[3] & 0xFFFF);
+   }
+
+   /*!
+    * Equality operator for the filter
+    */
+   bool operator == (this_type const & rhs) const
+   {
+      return fp_bits_ == rhs.fp_bits_ && count_ == rhs.count_ && slots_ == rhs.slots_ &&
+             victim_.used == rhs.victim_.used &&
+             (!victim_.used || (victim_.index == rhs.victim_.index && victim_.fp == rhs.victim_.fp));
+   }
+
+   /*!
+    * Inequality operator for the filter
+    */
+   bool operator != (this_type const & rhs) const
+   {
+      return !(*this == rhs);
+   }
+
+   /*!
+    * The amount of memory being used by the internal filter (in bytes).
+    */
+   size_t memory() const
+   {
+      return slots_.capacity()*sizeof(fingerprint_type);
+   }
+
+   /*!
+    * Gets the number of items currently stored.
+    */
+   size_t count() const
+   {
+      return count_;
+   }
+
+private:
+   struct victim
+   {
+      bool used;
+      size_t index;
+      fingerprint_type fp;
+   };
+
+   void init(size_t buckets, unsigned bits)
+   {
+      if (buckets == 0 || (buckets & (buckets - 1)) != 0 || bits == 0 || bits > 8*sizeof(fingerprint_type))
+      {
+         throw std::runtime_error("invalid cuckoo filter geometry");
+      }
+
+      num_buckets_ = buckets;
+      fp_bits_ = bits;
+      fp_mask_ = static_cast<fingerprint_type>((boost::uint64_t(1) << bits) - 1);
+      slots_.assign(buckets*SLOTS_PER_BUCKET, 0);
+      victim_.used = false;
+      count_ = 0;
+      rng_ = 0x2545f4914f6cdd1dULL;
+   }
+
+   void locate(item_type const & t, fingerprint_type & fp, size_t & i1, size_t & i2) const
+   {
+      boost::uint64_t const h = filter_types::mix64(static_cast<boost::uint64_t>(ht_(t)));
+
+      // zero marks an empty slot, so it can't be a fingerprint
+      fp = static_cast<fingerprint_type>(h & fp_mask_);
+      if (fp == 0)
+      {
+         fp = 1;
+      }
+
+      i1 = static_cast<size_t>(h >> 32) & (num_buckets_ - 1);
+      i2 = alt_index(i1, fp);
+   }
+
+   size_t alt_index(size_t ix, fingerprint_type fp) const
+   {
+      return (ix ^ static_cast<size_t>(filter_types::mix64(fp))) & (num_buckets_ - 1);
+   }
+
+   bool bucket_contains(size_t ix, fingerprint_type fp) const
+   {
+      fingerprint_type const * b = &slots_[ix*SLOTS_PER_BUCKET];
+      return (b[0] == fp) | (b[1] == fp) | (b[2] == fp) | (b[3] == fp);
+   }
+
+   bool add_to_bucket(size_t ix, fingerprint_type fp)
+   {
+      fingerprint_type * b = &slots_[ix*SLOTS_PER_BUCKET];
+
+      for (size_t i = 0; i < SLOTS_PER_BUCKET; ++i)
+      {
+         if (b[i] == 0)
+         {
+            b[i] = fp;
+            return true;
+         }
+      }
+
+      return false;
+   }
+
+   bool remove_from_bucket(size_t ix, fingerprint_type fp)
+   {
+      fingerprint_type * b = &slots_[ix*SLOTS_PER_BUCKET];
+
+      for (size_t i = 0; i < SLOTS_PER_BUCKET; ++i)
+      {
+         if (b[i] == fp)
+         {
+            b[i] = 0;
+            return true;
+         }
+      }
+
+      return false;
+   }
+
+   void reinsert(size_t ix, fingerprint_type fp)
+   {
+      for (size_t kick = 0; kick < MAX_KICKS; ++kick)
+      {
+         if (add_to_bucket(ix, fp))
+         {
+            ++count_;
+            return;
+         }
+
+         std::swap(fp, slots_[ix*SLOTS_PER_BUCKET + (rng() % SLOTS_PER_BUCKET)]);
+         ix = alt_index(ix, fp);
+      }
+
+      victim_.used = true;
+      victim_.index = ix;
+      victim_.fp = fp;
+      ++count_;
+   }
+
+   boost::uint64_t rng()
+   {
+      // xorshift64*, deterministic so that filters built from the
+      // same input are identical
+      rng_ ^= rng_ >> 12;
+      rng_ ^= rng_ << 25;
+      rng_ ^= rng_ >> 27;
+      return rng_*0x2545f4914f6cdd1dULL;
+   }
+
+   size_t num_buckets_;
+   unsigned fp_bits_;
+   fingerprint_type fp_mask_;
+   size_t count_;
+   std::vector<fingerprint_type> slots_;
+   victim victim_;
+   boost::uint64_t rng_;
+   hash_type ht_;
+};
+
+template <typename itemT, typename hashT, typename fingerprintT>
+cuckoo_filter<itemT, hashT, fingerprintT> & operator >> (
+   cuckoo_filter<itemT, hashT, fingerprintT> & cf,
+   typename cuckoo_filter<itemT, hashT, fingerprintT>::serial_buffer_t & buf
+   )
+{
+   cf.serialize(buf);
+   return cf;
+}
+
+template <typename itemT, typename hashT, typename fingerprintT>
+cuckoo_filter<itemT, hashT, fingerprintT> & operator << (
+   cuckoo_filter<itemT, hashT, fingerprintT> & cf,
+   typename cuckoo_filter<itemT, hashT, fingerprintT>::serial_buffer_t const & buf
+   )
+{
+   cf.deserialize(buf);
+   return cf;
+}
+
+}}
+
+#endif
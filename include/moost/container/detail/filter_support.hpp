@@ -0,0 +1,340 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_CONTAINER_DETAIL_FILTER_SUPPORT_HPP__
+#define MOOST_CONTAINER_DETAIL_FILTER_SUPPORT_HPP__
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+
+#include <boost/cstdint.hpp>
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+# include <immintrin.h>
+#elif defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+namespace moost { namespace container {
+
+namespace filter_types
+{
+
+/*!
+ * Used as the default hash function when no other is provided. The value
+ * returned is run through mix64() by the filters, so an identity hash is
+ * perfectly fine for integral item types.
+ */
+struct default_hash
+{
+   template <typename itemT>
+   size_t operator()(itemT const & t) const
+   {
+      return t;
+   }
+};
+
+/*!
+ * Represents a buffer for serialisation and deserialisation of a filter
+ */
+typedef std::vector<unsigned char> serial_buffer_t;
+
+/*!
+ * 64-bit finaliser from murmur3; spreads the entropy of a (possibly very
+ * poor) user supplied hash over all 64 bits.
+ */
+inline boost::uint64_t mix64(boost::uint64_t h)
+{
+   h ^= h >> 33;
+   h *= 0xff51afd7ed558ccdULL;
+   h ^= h >> 33;
+   h *= 0xc4ceb9fe1a85ec53ULL;
+   h ^= h >> 33;
+
+   return h;
+}
+
+}
+
+namespace detail {
+
+/*!
+ * Serialisation header shared by the filter family
+ */
+struct filter_header
+{
+   boost::uint32_t magic;
+   boost::uint32_t version;
+   boost::uint64_t param[4];
+};
+
+inline void write_filter(filter_types::serial_buffer_t & buf, filter_header const & hdr,
+                         void const * data, size_t size)
+{
+   buf.resize(sizeof(hdr) + size);
+   std::memcpy(&buf[0], &hdr, sizeof(hdr));
+   if (size > 0)
+   {
+      std::memcpy(&buf[sizeof(hdr)], data, size);
+   }
+}
+
+inline filter_header const & read_filter_header(filter_types::serial_buffer_t const & buf,
+                                                boost::uint32_t magic, boost::uint32_t version)
+{
+   if (buf.size() < sizeof(filter_header))
+   {
+      throw std::runtime_error("filter buffer too small");
+   }
+
+   filter_header const & hdr = *reinterpret_cast<filter_header const *>(&buf[0]);
+
+   if (hdr.magic != magic)
+   {
+      throw std::runtime_error("invalid filter magic");
+   }
+
+   if (hdr.version != version)
+   {
+      throw std::runtime_error("unsupported filter version");
+   }
+
+   return hdr;
+}
+
+/*!
+ * Probing logic of a cache-line blocked Bloom filter
+ *
+ * Each item maps to exactly one 512-bit block (one cache line on all
+ * platforms we care about), and all k bits for that item are set within
+ * this block. Lookups thus cost a single cache miss, regardless of k.
+ *
+ * The block index is taken from the upper 32 bits of the mixed hash,
+ * the bit positions are derived from a second round of mixing, 9 bits
+ * at a time.
+ *
+ * This is kept separate from the container so that the memory mapped
+ * dataset section can probe a mapped block array in exactly the same way.
+ */
+struct blocked_bloom
+{
+   static const size_t WORDS_PER_BLOCK = 8;
+   static const size_t BITS_PER_BLOCK = 512;
+   static const size_t BLOCK_ALIGNMENT = 64;
+   static const unsigned MAX_HASHES = 16;
+
+   struct mask
+   {
+      boost::uint64_t w[WORDS_PER_BLOCK];
+   };
+
+   static size_t block_index(boost::uint64_t h, size_t num_blocks)
+   {
+      return static_cast<size_t>(((h >> 32)*static_cast<boost::uint64_t>(num_blocks)) >> 32);
+   }
+
+   static void make_mask(boost::uint64_t h, unsigned k, mask & m)
+   {
+      std::memset(&m, 0, sizeof(m));
+
+      boost::uint64_t bits = filter_types::mix64(h + 0x9e3779b97f4a7c15ULL);
+
+      for (unsigned i = 0; i < k; ++i)
+      {
+         if (i > 0 && i % 7 == 0)
+         {
+            bits = filter_types::mix64(bits);
+         }
+
+         unsigned const pos = static_cast<unsigned>(bits & (BITS_PER_BLOCK - 1));
+         m.w[pos >> 6] |= boost::uint64_t(1) << (pos & 63);
+         bits >>= 9;
+      }
+   }
+
+   static void set(boost::uint64_t * block, mask const & m)
+   {
+      for (size_t i = 0; i < WORDS_PER_BLOCK; ++i)
+      {
+         block[i] |= m.w[i];
+      }
+   }
+
+   static bool test(boost::uint64_t const * block, mask const & m)
+   {
+#if defined(__AVX2__)
+      __m256i const b0 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(block));
+      __m256i const b1 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(block + 4));
+      __m256i const m0 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(m.w));
+      __m256i const m1 = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(m.w + 4));
+      return _mm256_testc_si256(b0, m0) & _mm256_testc_si256(b1, m1);
+#elif defined(__SSE4_1__)
+      int rv = 1;
+      for (size_t i = 0; i < WORDS_PER_BLOCK; i += 2)
+      {
+         __m128i const b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(block + i));
+         __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(m.w + i));
+         rv &= _mm_testc_si128(b, v);
+      }
+      return rv != 0;
+#elif defined(__SSE2__)
+      int rv = 0xFFFF;
+      for (size_t i = 0; i < WORDS_PER_BLOCK; i += 2)
+      {
+         __m128i const b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(block + i));
+         __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(m.w + i));
+         rv &= _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(b, v), v));
+      }
+      return rv == 0xFFFF;
+#else
+      boost::uint64_t miss = 0;
+      for (size_t i = 0; i < WORDS_PER_BLOCK; ++i)
+      {
+         miss |= m.w[i] & ~block[i];
+      }
+      return miss == 0;
+#endif
+   }
+
+   static void prefetch(void const * p)
+   {
+#if defined(__GNUC__)
+      __builtin_prefetch(p);
+#else
+      (void) p;
+#endif
+   }
+
+   /*!
+    * Expected false positive rate of a blocked filter with num_blocks
+    * blocks and k hashes holding the given number of items. The item count
+    * per block is Poisson distributed, so we average the classic Bloom
+    * formula for a 512-bit filter over that distribution.
+    */
+   static double estimate_fpr(size_t items, size_t num_blocks, unsigned k)
+   {
+      if (num_blocks == 0)
+      {
+         return 1.0;
+      }
+
+      double const lambda = static_cast<double>(items)/num_blocks;
+
+      if (lambda <= 0.0)
+      {
+         return 0.0;
+      }
+
+      double const p_unset = 1.0 - 1.0/BITS_PER_BLOCK;
+      double const log_lambda = std::log(lambda);
+      size_t const max_j = static_cast<size_t>(lambda + 12.0*std::sqrt(lambda) + 12.0);
+
+      double fpr = 0.0;
+      double log_fact = 0.0;
+
+      for (size_t j = 0; j <= max_j; ++j)
+      {
+         if (j > 0)
+         {
+            log_fact += std::log(static_cast<double>(j));
+         }
+
+         double const p_j = std::exp(-lambda + j*log_lambda - log_fact);
+         double const p_bit = 1.0 - std::pow(p_unset, static_cast<double>(k*j));
+         fpr += p_j*std::pow(p_bit, static_cast<double>(k));
+      }
+
+      return fpr;
+   }
+
+   /*!
+    * Finds the smallest number of blocks (and the best number of hashes
+    * for that size) that keeps the expected false positive rate of a
+    * filter holding the given number of items at or below fpr.
+    */
+   static void dimension(size_t items, double fpr, size_t & num_blocks, unsigned & k)
+   {
+      if (!(fpr > 0.0 && fpr < 1.0))
+      {
+         throw std::invalid_argument("false positive rate must be in (0, 1)");
+      }
+
+      if (items == 0)
+      {
+         items = 1;
+      }
+
+      // start with the size of a classic Bloom filter, which is a lower bound
+      double const ln2 = std::log(2.0);
+      double bits = -static_cast<double>(items)*std::log(fpr)/(ln2*ln2);
+      size_t blocks = static_cast<size_t>(std::ceil(bits/BITS_PER_BLOCK));
+
+      if (blocks == 0)
+      {
+         blocks = 1;
+      }
+
+      for (;;)
+      {
+         if (blocks > 0xFFFFFFFFULL)
+         {
+            throw std::runtime_error("bloom filter too large");
+         }
+
+         unsigned best_k = 1;
+         double best_fpr = 1.0;
+
+         for (unsigned kk = 1; kk <= MAX_HASHES; ++kk)
+         {
+            double const f = estimate_fpr(items, blocks, kk);
+
+            if (f < best_fpr)
+            {
+               best_fpr = f;
+               best_k = kk;
+            }
+         }
+
+         if (best_fpr <= fpr)
+         {
+            num_blocks = blocks;
+            k = best_k;
+            return;
+         }
+
+         blocks += blocks/50 + 1;
+      }
+   }
+};
+
+}
+
+}}
+
+#endif
@@ -34,8 +34,9 @@
  * The moost::container::memory_mapped_dataset class help constructing
  * custom datasets that can be easily mapped into memory.
  *
- * There is currently support for vectors of POD types and collections
- * of serialiseable types through the help of boost::archive.
+ * There is currently support for vectors of POD types, hash maps of
+ * POD types, blocked Bloom filters and collections of serialiseable
+ * types through the help of boost::archive.
  *
  * Each vector or collection is represented by its own section in the
  * dataset and each dataset can contain an arbitrary number of sections.
@@ -47,5 +48,6 @@
 #include "memory_mapped_dataset/archive.hpp"
 #include "memory_mapped_dataset/hash_multimap.hpp"
 #include "memory_mapped_dataset/dense_hash_map.hpp"
+#include "memory_mapped_dataset/bloom_filter.hpp"
 
 #endif
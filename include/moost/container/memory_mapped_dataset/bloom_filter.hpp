@@ -0,0 +1,184 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_CONTAINER_MEMORY_MAPPED_DATASET_BLOOM_FILTER_HPP__
+#define MOOST_CONTAINER_MEMORY_MAPPED_DATASET_BLOOM_FILTER_HPP__
+
+#include <string>
+#include <stdexcept>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "section_writer_base.hpp"
+#include "../bloom_filter.hpp"
+
+namespace moost { namespace container {
+
+/**
+ * Memory-mapped dataset section representing a blocked Bloom filter
+ *
+ * The filter is built in memory by the writer and written to the
+ * dataset as a raw, cache-line aligned block array. Lookups probe the
+ * mapped blocks directly and use the same hashing as an in-memory
+ * blocked_bloom_filter with the same hash function, so e.g. a filter
+ * of the keys of an mmd_dense_hash_map can be used to avoid probing
+ * the map for keys that are not present.
+ */
+template <typename Key, class HashFcn = MMD_DEFAULT_HASH_FCN<Key> >
+class mmd_bloom_filter : public boost::noncopyable
+{
+private:
+   typedef detail::blocked_bloom probe_type;
+
+public:
+   static const size_t MMD_BLOOM_ALIGNMENT = probe_type::BLOCK_ALIGNMENT;
+
+   typedef Key key_type;
+   typedef size_t size_type;
+   typedef blocked_bloom_filter<Key, HashFcn> filter_type;
+
+   class writer : public mmd_section_writer_base
+   {
+   public:
+      writer(memory_mapped_dataset::writer& wr, const std::string& name, size_type expected_items, double fpr, size_t alignment = MMD_BLOOM_ALIGNMENT)
+         : mmd_section_writer_base(wr, name, "mmd_bloom_filter", alignment)
+         , m_filter(expected_items, fpr)
+         , m_population(0)
+      {
+         if (alignment % probe_type::BLOCK_ALIGNMENT)
+         {
+            rollback();
+            throw std::runtime_error("bloom filter sections must be aligned to a cache line");
+         }
+      }
+
+      writer& operator<< (const key_type& key)
+      {
+         insert(key);
+         return *this;
+      }
+
+      void insert(const key_type& key)
+      {
+         m_filter.insert(key);
+         ++m_population;
+      }
+
+      size_type size() const
+      {
+         return m_population;
+      }
+
+   protected:
+      void pre_commit()
+      {
+         setattr("population", m_population);
+         setattr("blocks", m_filter.num_blocks());
+         setattr("hashes", m_filter.num_hashes());
+
+         write(reinterpret_cast<const char *>(m_filter.data()), m_filter.size()/8);
+      }
+
+   private:
+      filter_type m_filter;
+      size_type m_population;
+   };
+
+   mmd_bloom_filter()
+      : m_blocks(0)
+      , m_hashes(0)
+      , m_population(0)
+      , m_data(0)
+   {
+   }
+
+   mmd_bloom_filter(const memory_mapped_dataset& mmd, const std::string& name)
+   {
+      set(mmd, name);
+   }
+
+   void set(const memory_mapped_dataset& mmd, const std::string& name)
+   {
+      const memory_mapped_dataset::section_info& info = mmd.find(name, "mmd_bloom_filter");
+
+      m_blocks = info.getattr<size_type>("blocks");
+      m_hashes = info.getattr<unsigned>("hashes");
+      m_population = info.getattr<size_type>("population");
+
+      if (m_blocks == 0 || m_hashes == 0 || m_hashes > probe_type::MAX_HASHES)
+      {
+         throw std::runtime_error("invalid geometry for bloom filter " + name + " in dataset " + mmd.description());
+      }
+
+      m_data = mmd.data<boost::uint64_t>(info.offset(), m_blocks*probe_type::WORDS_PER_BLOCK);
+   }
+
+   void warm_cache() const
+   {
+      memory_mapped_dataset::warm_cache(m_data, m_data + m_blocks*probe_type::WORDS_PER_BLOCK);
+   }
+
+   /**
+    * Number of keys written to the filter
+    */
+   size_type size() const
+   {
+      return m_population;
+   }
+
+   bool empty() const
+   {
+      return size() == 0;
+   }
+
+   double expected_fpr() const
+   {
+      return probe_type::estimate_fpr(m_population, m_blocks, m_hashes);
+   }
+
+   /**
+    * Returns false if the key is definitely not in the set
+    */
+   bool find(const key_type& key) const
+   {
+      boost::uint64_t const h = filter_types::mix64(static_cast<boost::uint64_t>(HashFcn()(key)));
+      probe_type::mask m;
+      probe_type::make_mask(h, m_hashes, m);
+      return probe_type::test(m_data + probe_type::block_index(h, m_blocks)*probe_type::WORDS_PER_BLOCK, m);
+   }
+
+private:
+   size_type m_blocks;
+   unsigned m_hashes;
+   size_type m_population;
+   const boost::uint64_t *m_data;
+};
+
+}}
+
+#endif
@@ -38,6 +38,7 @@
 
 #include "section_writer_base.hpp"
 #include "pod_pair.hpp"
+#include "lookup_metrics.hpp"
 
 namespace moost { namespace container {
 
@@ -378,6 +379,14 @@ public:
       memory_mapped_dataset::warm_cache(m_begin, m_begin + m_size);
    }
 
+   /**
+    * Count lookups and misses as "mmd.<name>.lookups" / "mmd.<name>.misses"
+    */
+   void enable_metrics(const std::string& name)
+   {
+      m_metrics.enable(name);
+   }
+
    const_iterator begin() const
    {
       return const_iterator(*this, m_begin, m_begin + m_size);
@@ -410,12 +419,15 @@ public:
 
    const_iterator find(const key_type& key) const
    {
-      return const_iterator(*this, m_begin + find(key, m_begin, m_size), m_begin + m_size);
+      size_type index = find(key, m_begin, m_size);
+      m_metrics.lookup(index < m_size);
+      return const_iterator(*this, m_begin + index, m_begin + m_size);
    }
 
    const mapped_type& operator[] (const key_type& key) const
    {
       size_type index = find(key, m_begin, m_size);
+      m_metrics.lookup(index < m_size);
 
       if (index < m_size)
       {
@@ -454,6 +466,7 @@ private:
    size_type m_population;
    const value_type *m_begin;
    key_type m_empty_key;
+   mmd_lookup_metrics m_metrics;
 };
 
 }}
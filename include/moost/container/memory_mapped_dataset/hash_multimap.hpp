@@ -39,6 +39,7 @@
 
 #include "section_writer_base.hpp"
 #include "pod_pair.hpp"
+#include "lookup_metrics.hpp"
 
 namespace moost { namespace container {
 
@@ -207,6 +208,14 @@ public:
       memory_mapped_dataset::warm_cache(m_begin, m_end);
    }
 
+   /**
+    * Count lookups and misses as "mmd.<name>.lookups" / "mmd.<name>.misses"
+    */
+   void enable_metrics(const std::string& name)
+   {
+      m_metrics.enable(name);
+   }
+
    const_iterator begin() const
    {
       return m_begin;
@@ -234,10 +243,14 @@ public:
          size_t hash = HashFcn()(x) & m_hash_mask;
          value_type search;
          search.first = x;
-         return std::lower_bound(&m_begin[m_index[hash]], &m_begin[m_index[hash + 1]], search, compare);
+         const_iterator end = &m_begin[m_index[hash + 1]];
+         const_iterator it = std::lower_bound(&m_begin[m_index[hash]], end, search, compare);
+         m_metrics.lookup(it != end && it->first == x);
+         return it;
       }
       else
       {
+         m_metrics.lookup(false);
          return m_end;
       }
    }
@@ -250,6 +263,7 @@ private:
    const_iterator m_begin;
    const_iterator m_end;
    size_type m_hash_bits;
+   mmd_lookup_metrics m_metrics;
 };
 
 }}
@@ -0,0 +1,82 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_CONTAINER_MEMORY_MAPPED_DATASET_LOOKUP_METRICS_HPP__
+#define MOOST_CONTAINER_MEMORY_MAPPED_DATASET_LOOKUP_METRICS_HPP__
+
+#include <string>
+
+#include "../../metrics/registry.hpp"
+
+namespace moost { namespace container {
+
+/**
+ * Optional lookup counters for memory-mapped map sections
+ *
+ * Lookups into memory-mapped maps take only a few dozen nanoseconds, so
+ * counting them isn't free. Counting is therefore off until a section's
+ * enable_metrics() is called, which registers "mmd.<name>.lookups" and
+ * "mmd.<name>.misses" with moost::metrics. Until then, recording a lookup
+ * is a single, well predicted branch.
+ */
+class mmd_lookup_metrics
+{
+public:
+   mmd_lookup_metrics()
+      : m_lookups(0)
+      , m_misses(0)
+   {
+   }
+
+   void enable(const std::string& name)
+   {
+      std::string prefix = moost::metrics::make_name("mmd", name);
+      m_lookups = &moost::metrics::get_counter(prefix + ".lookups");
+      m_misses = &moost::metrics::get_counter(prefix + ".misses");
+   }
+
+   void lookup(bool found) const
+   {
+      if (m_lookups)
+      {
+         ++*m_lookups;
+
+         if (!found)
+         {
+            ++*m_misses;
+         }
+      }
+   }
+
+private:
+   moost::metrics::counter *m_lookups;
+   moost::metrics::counter *m_misses;
+};
+
+}}
+
+#endif
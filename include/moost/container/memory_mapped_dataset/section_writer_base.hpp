@@ -110,7 +110,11 @@ protected:
    void write(const std::vector<T>& vec)
    {
       BOOST_STATIC_ASSERT_MSG(boost::is_pod<T>::value, "only POD types can be written to a dataset");
-      write(reinterpret_cast<const char *>(&vec[0]), vec.size()*sizeof(T));
+
+      if (!vec.empty())
+      {
+         write(reinterpret_cast<const char *>(&vec[0]), vec.size()*sizeof(T));
+      }
    }
 
    template <typename T>
@@ -0,0 +1,487 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_CONTAINER_RESOURCE_POOL_HPP__
+#define MOOST_CONTAINER_RESOURCE_POOL_HPP__
+
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "resource_stack.hpp"
+
+namespace moost { namespace container {
+
+/** @brief Statistics of a resource_pool
+ */
+struct resource_pool_stats
+{
+   size_t          total;          ///< number of resources added to the pool
+   size_t          in_use;         ///< number of resources currently handed out
+   boost::uint64_t acquisitions;   ///< number of successful acquisitions
+   boost::uint64_t cache_hits;     ///< acquisitions served from the caller's affinity slot
+   boost::uint64_t steals;         ///< acquisitions served from another thread's affinity slot
+   boost::uint64_t waits;          ///< acquisitions that had to wait for a resource
+   boost::uint64_t timeouts;       ///< acquisitions that failed because no resource became available
+   boost::uint64_t total_wait_us;  ///< accumulated time spent waiting
+   boost::uint64_t max_wait_us;    ///< longest time spent waiting
+
+   double utilisation() const
+   {
+      return total > 0 ? static_cast<double>(in_use)/total : 0.0;
+   }
+
+   double avg_wait_us() const
+   {
+      return waits > 0 ? static_cast<double>(total_wait_us)/waits : 0.0;
+   }
+};
+
+/** @brief a resource_pool is a lock-free, drop-in replacement for resource_stack.
+ *
+ * Resources live on a lock-free (Treiber) stack. In addition, each thread
+ * is assigned an affinity slot based on its id; a released resource is
+ * parked in the releasing thread's slot, so a thread that repeatedly
+ * acquires and releases a resource usually gets the very same one back
+ * without touching any shared state. Parked resources are still available
+ * to other threads, which steal them if the shared stack runs empty.
+ *
+ * Threads waiting for a resource spin, yield and then sleep with
+ * exponential backoff (up to MAX_BACKOFF_US) rather than blocking on a
+ * condition variable. Exhausting the pool is expected to be rare; if it
+ * isn't, the pool is too small.
+ *
+ * Resources can be added at any time, but never removed. At most
+ * MAX_RESOURCES resources can be added.
+ */
+template<typename T>
+class resource_pool : public boost::noncopyable
+{
+public:
+   typedef T resource_type;
+
+   static const size_t MAX_RESOURCES = 65536;
+   static const size_t MAX_BACKOFF_US = 1000;
+
+private:
+   static const size_t CHUNK_BITS = 6;
+   static const size_t CHUNK_SIZE = 1 << CHUNK_BITS;
+   static const size_t MAX_CHUNKS = MAX_RESOURCES/CHUNK_SIZE;
+   static const size_t CACHE_LINE = 64;
+
+   struct node
+   {
+      boost::shared_ptr<T>           resource;
+      boost::atomic<boost::uint32_t> next;
+   };
+
+   // per-slot counters keep statistics from becoming a contention point
+   struct slot
+   {
+      boost::atomic<boost::uint32_t> parked;
+      boost::atomic<boost::uint64_t> acquisitions;
+      boost::atomic<boost::uint64_t> releases;
+      boost::atomic<boost::uint64_t> cache_hits;
+      boost::atomic<boost::uint64_t> steals;
+      boost::atomic<boost::uint64_t> waits;
+      boost::atomic<boost::uint64_t> timeouts;
+      boost::atomic<boost::uint64_t> total_wait_us;
+      boost::atomic<boost::uint64_t> max_wait_us;
+      char pad[CACHE_LINE];
+   };
+
+   // indices are stored off by one, so that zero means "none"
+   typedef boost::uint32_t index_type;
+
+   node *                         m_chunks[MAX_CHUNKS];
+   boost::mutex                   m_add_mutex;
+   boost::atomic<boost::uint32_t> m_total_size;
+   char                           m_pad[CACHE_LINE];
+   boost::atomic<boost::uint64_t> m_head;   // (tag << 32) | index
+   boost::scoped_array<slot>      m_slots;
+   size_t                         m_num_slots;
+   std::string                    m_resource_name;
+
+public:
+
+   /// Use a scoped_resource to get a resource from the resource_pool
+   class scoped_resource : public boost::noncopyable
+   {
+   private:
+      resource_pool & m_pool;
+      slot &          m_slot;
+      index_type      m_index;
+      T *             m_resource;
+
+   public:
+      scoped_resource(resource_pool & pool, bool wait_on_empty = true)
+         : m_pool(pool)
+         , m_slot(pool.my_slot())
+         , m_index(pool.acquire(m_slot, wait_on_empty, -1))
+         , m_resource(pool.get(m_index))
+      {
+      }
+
+      scoped_resource(resource_pool & pool, int timeout_ms, bool wait_on_empty = true)
+         : m_pool(pool)
+         , m_slot(pool.my_slot())
+         , m_index(pool.acquire(m_slot, wait_on_empty, timeout_ms))
+         , m_resource(pool.get(m_index))
+      {
+      }
+
+      ~scoped_resource()
+      {
+         m_pool.release(m_slot, m_index);
+      }
+
+      T & operator* ()
+      {
+         return *m_resource;
+      }
+
+      T * operator->()
+      {
+         return m_resource;
+      }
+   };
+
+   /// Constructs a pool; num_slots defaults to twice the number of cores
+   resource_pool(size_t num_slots = 0)
+      : m_resource_name("undef")
+   {
+      init(num_slots);
+   }
+
+   resource_pool(const std::string& resource_name, size_t num_slots = 0)
+      : m_resource_name(resource_name)
+   {
+      init(num_slots);
+   }
+
+   ~resource_pool()
+   {
+      for (size_t i = 0; i < MAX_CHUNKS && m_chunks[i]; ++i)
+      {
+         delete[] m_chunks[i];
+      }
+   }
+
+   /// Sets the name of the resource.
+   void set_resource_name(const std::string& resource_name)
+   { m_resource_name = resource_name; }
+
+   /// Adds a resource to the pool.
+   void add_resource(boost::shared_ptr<T> spresource)
+   {
+      index_type ix;
+
+      {
+         boost::mutex::scoped_lock lock(m_add_mutex);
+
+         size_t const pos = m_total_size.load(boost::memory_order_relaxed);
+
+         if (pos >= MAX_RESOURCES)
+         {
+            throw std::runtime_error("too many resources for " + m_resource_name);
+         }
+
+         if (!m_chunks[pos >> CHUNK_BITS])
+         {
+            m_chunks[pos >> CHUNK_BITS] = new node[CHUNK_SIZE];
+         }
+
+         ix = static_cast<index_type>(pos + 1);
+         get_node(ix).resource = spresource;
+         m_total_size.store(ix, boost::memory_order_release);
+      }
+
+      push(ix);
+   }
+
+   /// Gets the number of available resources.
+   size_t size() const
+   {
+      resource_pool_stats st;
+      stats(st);
+      return st.total - st.in_use;
+   }
+
+   /// Gets the total size of the pool (the number of resources added via add_resource)
+   size_t total_size() const
+   {
+      return m_total_size.load(boost::memory_order_acquire);
+   }
+
+   /// Gets a snapshot of the pool statistics. Counters are updated without
+   /// synchronisation between threads, so the snapshot is only approximate
+   /// while the pool is in use.
+   void stats(resource_pool_stats& st) const
+   {
+      boost::uint64_t acq = 0, rel = 0;
+
+      st.total = total_size();
+      st.acquisitions = st.cache_hits = st.steals = st.waits = st.timeouts = 0;
+      st.total_wait_us = st.max_wait_us = 0;
+
+      for (size_t i = 0; i < m_num_slots; ++i)
+      {
+         const slot& s = m_slots[i];
+         acq += s.acquisitions.load(boost::memory_order_relaxed);
+         rel += s.releases.load(boost::memory_order_relaxed);
+         st.cache_hits += s.cache_hits.load(boost::memory_order_relaxed);
+         st.steals += s.steals.load(boost::memory_order_relaxed);
+         st.waits += s.waits.load(boost::memory_order_relaxed);
+         st.timeouts += s.timeouts.load(boost::memory_order_relaxed);
+         st.total_wait_us += s.total_wait_us.load(boost::memory_order_relaxed);
+         st.max_wait_us = (std::max)(st.max_wait_us, s.max_wait_us.load(boost::memory_order_relaxed));
+      }
+
+      st.acquisitions = acq;
+      st.in_use = acq > rel ? static_cast<size_t>(acq - rel) : 0;
+   }
+
+   /// Resets the statistics counters (except for the number of resources in use)
+   void reset_stats()
+   {
+      for (size_t i = 0; i < m_num_slots; ++i)
+      {
+         slot& s = m_slots[i];
+         s.cache_hits.store(0, boost::memory_order_relaxed);
+         s.steals.store(0, boost::memory_order_relaxed);
+         s.waits.store(0, boost::memory_order_relaxed);
+         s.timeouts.store(0, boost::memory_order_relaxed);
+         s.total_wait_us.store(0, boost::memory_order_relaxed);
+         s.max_wait_us.store(0, boost::memory_order_relaxed);
+      }
+   }
+
+private:
+   void init(size_t num_slots)
+   {
+      if (num_slots == 0)
+      {
+         num_slots = 2*(std::max)(boost::thread::hardware_concurrency(), 1U);
+      }
+
+      std::fill(m_chunks, m_chunks + MAX_CHUNKS, static_cast<node *>(0));
+      m_total_size.store(0);
+      m_head.store(0);
+      m_num_slots = num_slots;
+      m_slots.reset(new slot[num_slots]);
+
+      for (size_t i = 0; i < num_slots; ++i)
+      {
+         slot& s = m_slots[i];
+         s.parked.store(0);
+         s.acquisitions.store(0);
+         s.releases.store(0);
+         s.cache_hits.store(0);
+         s.steals.store(0);
+         s.waits.store(0);
+         s.timeouts.store(0);
+         s.total_wait_us.store(0);
+         s.max_wait_us.store(0);
+      }
+   }
+
+   node & get_node(index_type ix) const
+   {
+      return m_chunks[(ix - 1) >> CHUNK_BITS][(ix - 1) & (CHUNK_SIZE - 1)];
+   }
+
+   T * get(index_type ix) const
+   {
+      return get_node(ix).resource.get();
+   }
+
+   slot & my_slot()
+   {
+      boost::hash<boost::thread::id> hasher;
+      return m_slots[hasher(boost::this_thread::get_id()) % m_num_slots];
+   }
+
+   void push(index_type ix)
+   {
+      node & n = get_node(ix);
+      boost::uint64_t head = m_head.load(boost::memory_order_relaxed);
+
+      for (;;)
+      {
+         n.next.store(static_cast<index_type>(head), boost::memory_order_relaxed);
+         boost::uint64_t const next = (((head >> 32) + 1) << 32) | ix;
+
+         if (m_head.compare_exchange_weak(head, next, boost::memory_order_release, boost::memory_order_relaxed))
+         {
+            return;
+         }
+      }
+   }
+
+   index_type pop()
+   {
+      boost::uint64_t head = m_head.load(boost::memory_order_acquire);
+
+      for (;;)
+      {
+         index_type const top = static_cast<index_type>(head);
+
+         if (top == 0)
+         {
+            return 0;
+         }
+
+         // the tag in the upper half protects against ABA; nodes are never
+         // freed, so reading next of a node popped by someone else is safe
+         boost::uint64_t const next = (((head >> 32) + 1) << 32) | get_node(top).next.load(boost::memory_order_relaxed);
+
+         if (m_head.compare_exchange_weak(head, next, boost::memory_order_acquire, boost::memory_order_acquire))
+         {
+            return top;
+         }
+      }
+   }
+
+   index_type try_acquire(slot & mine)
+   {
+      index_type ix = mine.parked.exchange(0, boost::memory_order_acquire);
+
+      if (ix)
+      {
+         mine.cache_hits.fetch_add(1, boost::memory_order_relaxed);
+         return ix;
+      }
+
+      ix = pop();
+
+      if (ix)
+      {
+         return ix;
+      }
+
+      for (size_t i = 0; i < m_num_slots; ++i)
+      {
+         slot & other = m_slots[i];
+
+         if (other.parked.load(boost::memory_order_relaxed) &&
+             (ix = other.parked.exchange(0, boost::memory_order_acquire)) != 0)
+         {
+            mine.steals.fetch_add(1, boost::memory_order_relaxed);
+            return ix;
+         }
+      }
+
+      return 0;
+   }
+
+   index_type acquire(slot & mine, bool wait_on_empty, int timeout_ms)
+   {
+      index_type ix = try_acquire(mine);
+
+      if (!ix)
+      {
+         if (!wait_on_empty)
+         {
+            throw no_resource_available(m_resource_name);
+         }
+
+         ix = wait(mine, timeout_ms);
+      }
+
+      mine.acquisitions.fetch_add(1, boost::memory_order_relaxed);
+
+      return ix;
+   }
+
+   index_type wait(slot & mine, int timeout_ms)
+   {
+      using namespace boost::posix_time;
+
+      ptime const start = microsec_clock::universal_time();
+      size_t backoff_us = 0;
+      index_type ix;
+
+      for (size_t round = 0; (ix = try_acquire(mine)) == 0; ++round)
+      {
+         boost::uint64_t const waited = (microsec_clock::universal_time() - start).total_microseconds();
+
+         if (timeout_ms >= 0 && waited >= static_cast<boost::uint64_t>(timeout_ms)*1000)
+         {
+            mine.timeouts.fetch_add(1, boost::memory_order_relaxed);
+            throw no_resource_available(m_resource_name);
+         }
+
+         if (round < 16)
+         {
+            boost::this_thread::yield();
+         }
+         else
+         {
+            backoff_us = (std::min)(backoff_us ? 2*backoff_us : 10, static_cast<size_t>(MAX_BACKOFF_US));
+            boost::this_thread::sleep(microseconds(backoff_us));
+         }
+      }
+
+      boost::uint64_t const waited = (microsec_clock::universal_time() - start).total_microseconds();
+      boost::uint64_t max = mine.max_wait_us.load(boost::memory_order_relaxed);
+
+      mine.waits.fetch_add(1, boost::memory_order_relaxed);
+      mine.total_wait_us.fetch_add(waited, boost::memory_order_relaxed);
+
+      while (waited > max && !mine.max_wait_us.compare_exchange_weak(max, waited, boost::memory_order_relaxed))
+      {
+      }
+
+      return ix;
+   }
+
+   void release(slot & mine, index_type ix)
+   {
+      index_type empty = 0;
+
+      mine.releases.fetch_add(1, boost::memory_order_relaxed);
+
+      if (!mine.parked.compare_exchange_strong(empty, ix, boost::memory_order_release, boost::memory_order_relaxed))
+      {
+         push(ix);
+      }
+   }
+};
+
+}} // moost::container
+
+#endif // MOOST_CONTAINER_RESOURCE_POOL_HPP__
@@ -48,6 +48,7 @@ public:
 
 /** @brief a resource_stack is a thread-safe collection of resources.
  * Threads can get resources from the stack by using a scoped_resource.
+ * See resource_pool for a lock-free alternative with the same interface.
  */
 template<typename T>
 class resource_stack
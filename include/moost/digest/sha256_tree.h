@@ -0,0 +1,88 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_DIGEST_SHA256_TREE_H__
+#define MOOST_DIGEST_SHA256_TREE_H__
+
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+
+#include "base.h"
+
+namespace moost { namespace digest {
+
+class sha256_tree_impl;
+
+/**
+ * A tree hash built from SHA-256 that can be computed in parallel
+ *
+ * The input is split into chunks of chunk_size bytes (the last chunk may be
+ * shorter). The chunks are hashed independently on up to num_threads threads,
+ * and the resulting leaf hashes are combined into a single root hash:
+ *
+ *    leaf[i] = SHA-256(0x00 || chunk[i])
+ *    digest  = SHA-256(0x01 || chunk_size as 64 bit big endian || leaf[0] || leaf[1] || ...)
+ *
+ * Empty input is treated as a single, empty chunk. SHA extensions are used
+ * for hashing where the CPU supports them.
+ *
+ * \b Note that this is \b not SHA-256 of the input, and that the digest
+ * depends on the chunk size. Digests can only be compared if they were
+ * computed with the same chunk size.
+ *
+ * Large blocks of data passed to add_raw() are hashed in place. Small ones
+ * are buffered until there's enough data to keep all threads busy.
+ */
+class sha256_tree : public base
+{
+public:
+   enum { default_chunk_size = 1 << 20 };
+
+   /**
+    * \param chunk_size     Size of the independently hashed chunks
+    * \param num_threads    Maximum number of threads used for hashing,
+    *                       0 uses one thread per core
+    */
+   explicit sha256_tree(size_t chunk_size = default_chunk_size, size_t num_threads = 0);
+
+   virtual void reset();
+   virtual void add_raw(const void *data, size_t size);
+   virtual std::string digest() const;
+
+   /**
+    * Adds the contents of a file, which is memory mapped rather than read
+    */
+   void add_file(const std::string& path);
+
+private:
+   boost::shared_ptr<sha256_tree_impl> m_impl;
+};
+
+}}
+
+#endif
@@ -67,6 +67,17 @@ public:
     return (m_rollover != 0 && (m_count++ % m_rollover == 0));
   }
 
+  /** returns true if it's time to roll over before writing a batch of items
+   * (i.e. if the single-item check would have fired for any of them) */
+  bool operator()(size_t items)
+  {
+    size_t first = m_count;
+    m_count += items;
+    if (m_rollover == 0 || items == 0)
+      return false;
+    return first % m_rollover == 0 || first / m_rollover != (m_count - 1) / m_rollover;
+  }
+
   // returns an pathname related to the type of rollover
   std::string get_path(const std::string & base_path)
   {
@@ -116,6 +127,12 @@ public:
     return false;
   }
 
+  /// returns true if it's time to roll over before writing a batch of items
+  bool operator()(size_t /* items */)
+  {
+    return (*this)();
+  }
+
   // returns an pathname related to the type of rollover
   std::string get_path(const std::string & base_path, boost::gregorian::date * path_date = NULL)
   {
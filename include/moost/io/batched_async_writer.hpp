@@ -0,0 +1,421 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_IO_BATCHED_ASYNC_WRITER_HPP__
+#define MOOST_IO_BATCHED_ASYNC_WRITER_HPP__
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <ostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "async_writer.hpp"
+#include "detail/append_streambuf.hpp"
+#include "../thread/async_worker.hpp"
+
+namespace moost { namespace io {
+
+/** writes batches to the file unchanged
+ */
+class raw_framing
+{
+public:
+   static const bool passthrough = true;
+   std::string extension() const { return std::string(); }
+   void begin() {}
+   void encode(const char *, size_t, std::vector<char> &) {}
+   void end(std::vector<char> &) {}
+};
+
+/** @brief batched_async_writer writes work items to a file asynchronously, many at a time.
+ *
+ * It's a drop-in alternative to async_writer for high volume streams, e.g.
+ * event logs. Producers only append to a queue under a short lock; the
+ * writer thread swaps out the whole queue at once, serialises every item
+ * into one reusable buffer and writes it with a few large write() calls on
+ * a file opened with O_APPEND.
+ *
+ * As with async_writer, the template type must implement the method:
+ * write(std::ostream & out)
+ *
+ * The rollover policy is consulted once per batch, via operator()(size_t items),
+ * so files are always switched between batches. With count_rollover a file
+ * may therefore hold up to a batch more than the rollover count.
+ *
+ * The framing policy may transform each batch before it's written (see
+ * gzip_framing); raw_framing writes it as is.
+ *
+ * Data is handed to the kernel after every batch. For durability, pass a
+ * sync interval: 0 calls fdatasync() after every batch, a positive value
+ * groups the syncs so that at most one happens per interval (and one is
+ * still done once the writer goes idle).
+ */
+template<typename TWork, class TRolloverPolicy = count_rollover, class TFraming = raw_framing>
+class batched_async_writer : public boost::noncopyable
+{
+private:
+
+   std::string     m_base_path;
+   TRolloverPolicy m_rollover_policy;
+   TFraming        m_framing;
+
+   size_t          m_max_queue;
+   size_t          m_enqueue_timeout_ms;
+   int             m_sync_interval_ms;
+   size_t          m_flush_bytes;
+
+   std::vector<TWork> m_pending;
+   std::vector<TWork> m_batch;
+   bool               m_working;
+   boost::mutex       m_work_mutex;
+   boost::condition   m_work_to_do;
+   boost::condition   m_work_done;
+   boost::shared_ptr<boost::thread> m_pthread;
+
+   // only touched by the writer thread (or after it has been joined)
+   int                         m_fd;
+   bool                        m_dirty;
+   boost::posix_time::ptime    m_last_sync;
+   std::vector<char>           m_buffer;
+   std::vector<char>           m_encoded;
+   detail::append_streambuf    m_streambuf;
+   std::ostream                m_stream;
+
+   boost::atomic<size_t> m_batches_written;
+   boost::atomic<size_t> m_items_written;
+
+   /// @brief open a new file to write
+   void reload_out()
+   {
+      close_out();
+
+      // get a suitable filename
+      boost::filesystem::path p;
+      std::string path_name = m_rollover_policy.get_path(m_base_path) + m_framing.extension();
+
+      for (int i = 0; ;++i)
+      {
+         std::ostringstream oss;
+         oss << path_name;
+         if (i != 0)
+            oss << '.' << i;
+         p = boost::filesystem::path(oss.str());
+         if (!boost::filesystem::exists(p))
+            break;
+      }
+
+      m_fd = ::open(p.string().c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+      if (m_fd < 0)
+         throw std::runtime_error("batched_async_writer: cannot open " + p.string() + ": " + strerror(errno));
+
+      m_framing.begin();
+   }
+
+   void close_out()
+   {
+      if (m_fd < 0)
+         return;
+
+      m_encoded.clear();
+      m_framing.end(m_encoded);
+      if (!m_encoded.empty())
+         write_all(&m_encoded[0], m_encoded.size());
+
+      if (m_sync_interval_ms >= 0 && m_dirty)
+         sync_out();
+
+      ::close(m_fd);
+      m_fd = -1;
+   }
+
+   void write_all(const char * data, size_t len)
+   {
+      while (len > 0)
+      {
+         ssize_t rv = ::write(m_fd, data, len);
+         if (rv < 0)
+         {
+            if (errno == EINTR)
+               continue;
+            throw std::runtime_error(std::string("batched_async_writer: write failed: ") + strerror(errno));
+         }
+         data += rv;
+         len -= static_cast<size_t>(rv);
+      }
+      m_dirty = true;
+   }
+
+   void flush_buffer()
+   {
+      if (m_buffer.empty())
+         return;
+
+      if (TFraming::passthrough)
+         write_all(&m_buffer[0], m_buffer.size());
+      else
+      {
+         m_encoded.clear();
+         m_framing.encode(&m_buffer[0], m_buffer.size(), m_encoded);
+         if (!m_encoded.empty())
+            write_all(&m_encoded[0], m_encoded.size());
+      }
+
+      m_buffer.clear();
+   }
+
+   void sync_out()
+   {
+#if defined(__APPLE__)
+      ::fsync(m_fd);
+#else
+      ::fdatasync(m_fd);
+#endif
+      m_dirty = false;
+      m_last_sync = boost::posix_time::microsec_clock::universal_time();
+   }
+
+   bool sync_due() const
+   {
+      if (m_fd < 0 || !m_dirty || m_sync_interval_ms < 0)
+         return false;
+      return boost::posix_time::microsec_clock::universal_time() - m_last_sync >= boost::posix_time::milliseconds(m_sync_interval_ms);
+   }
+
+   void write_batch(std::vector<TWork> & batch)
+   {
+      if (m_rollover_policy(batch.size()) || m_fd < 0)
+         reload_out();
+
+      m_buffer.clear();
+      for (typename std::vector<TWork>::iterator it = batch.begin(); it != batch.end(); ++it)
+      {
+         it->write(m_stream);
+         if (m_buffer.size() >= m_flush_bytes)
+            flush_buffer();
+      }
+      m_stream.clear();
+      flush_buffer();
+
+      m_batches_written.fetch_add(1, boost::memory_order_relaxed);
+      m_items_written.fetch_add(batch.size(), boost::memory_order_release);
+   }
+
+   /// @brief Entry point for the writer thread.
+   void work_loop()
+   {
+      for (;;)
+      {
+         {
+            boost::mutex::scoped_lock lock(m_work_mutex);
+
+            while (m_pending.empty() && m_working)
+            {
+               if (m_dirty && m_sync_interval_ms > 0)
+               {
+                  // idle with unsynced data, sync once the interval is up
+                  boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(m_sync_interval_ms);
+                  if (!m_work_to_do.timed_wait(lock, deadline) && m_pending.empty())
+                     break;
+               }
+               else
+                  m_work_to_do.wait(lock);
+            }
+
+            if (m_pending.empty() && !m_working)
+               break;
+
+            m_batch.swap(m_pending);
+
+            // inform anyone waiting to enqueue that the queue has drained
+            m_work_done.notify_all();
+         }
+
+         try
+         {
+            if (!m_batch.empty())
+               write_batch(m_batch);
+            if (sync_due() || (m_sync_interval_ms > 0 && m_dirty && m_batch.empty()))
+               sync_out();
+         }
+         catch (const std::exception & e)
+         {
+            report_error(e);
+         }
+         catch (...)
+         {
+            report_error(std::runtime_error("batched_async_writer: unknown exception in writer"));
+         }
+
+         m_batch.clear();
+      }
+
+      try
+      {
+         close_out();
+      }
+      catch (const std::exception & e)
+      {
+         report_error(e);
+      }
+   }
+
+protected:
+
+   /// @brief Optionally override this method for custom error logging.
+   virtual void report_error(const std::exception &) {}
+
+public:
+
+   /** @brief Constructs a batched_async_writer.
+    * @param base_path the base path name for file creation
+    * @param rollover_policy decides when to start a new file
+    * @param framing transforms batches before they're written, e.g. gzip_framing
+    * @param max_queue the maximum length the queue may grow before further enqueue's begin to wait (0 means don't wait)
+    * @param enqueue_timeout_ms the longest amount of time (ms) an enqueue may wait (0 means wait forever)
+    * @param sync_interval_ms how often to fdatasync() (-1 never, 0 after every batch)
+    * @param flush_bytes how much serialised data to buffer before writing it out within a batch
+    */
+   batched_async_writer(const std::string & base_path,
+                        const TRolloverPolicy & rollover_policy = TRolloverPolicy(),
+                        const TFraming & framing = TFraming(),
+                        size_t max_queue = 0,
+                        size_t enqueue_timeout_ms = 0,
+                        int sync_interval_ms = -1,
+                        size_t flush_bytes = 1 << 20)
+   : m_base_path(base_path),
+     m_rollover_policy(rollover_policy),
+     m_framing(framing),
+     m_max_queue(max_queue),
+     m_enqueue_timeout_ms(enqueue_timeout_ms),
+     m_sync_interval_ms(sync_interval_ms),
+     m_flush_bytes(flush_bytes),
+     m_working(false),
+     m_fd(-1),
+     m_dirty(false),
+     m_last_sync(boost::posix_time::microsec_clock::universal_time()),
+     m_streambuf(m_buffer),
+     m_stream(&m_streambuf),
+     m_batches_written(0),
+     m_items_written(0)
+   {
+      m_buffer.reserve(m_flush_bytes + m_flush_bytes / 4);
+      start();
+   }
+
+   /** Destroys the batched_async_writer
+    *
+    * It's safe to destroy the batched_async_writer without first calling stop().  It will shut down cleanly.
+    */
+   virtual ~batched_async_writer()
+   {
+      stop();
+   }
+
+   /**
+    * @brief Enqueues some work, and wakes up the writer thread if necessary.
+    * @param work is the work to be written
+    */
+   void enqueue(const TWork & work)
+   {
+      boost::mutex::scoped_lock lock(m_work_mutex);
+
+      if (!m_working)
+         throw std::runtime_error("can't enqueue when not working");
+
+      while (m_max_queue > 0 && m_pending.size() >= m_max_queue)
+      {
+         if (m_enqueue_timeout_ms == 0)
+            m_work_done.wait(lock);
+         else
+         {
+            if (!m_work_done.timed_wait(lock, moost::thread::xtime_util::add_ms(moost::thread::xtime_util::now(), m_enqueue_timeout_ms)))
+               throw moost::thread::enqueue_timeout();
+         }
+      }
+
+      m_pending.push_back(work);
+
+      // the writer only ever waits for an empty queue
+      if (m_pending.size() == 1)
+         m_work_to_do.notify_one();
+   }
+
+   /// @brief starts the writer thread
+   void start()
+   {
+      boost::mutex::scoped_lock lock(m_work_mutex);
+      if (m_working)
+         return;
+      m_working = true;
+      m_pthread.reset(new boost::thread(boost::bind(&batched_async_writer::work_loop, this)));
+   }
+
+   /// @brief stops the writer thread after it has written all enqueued work, and closes the file
+   void stop()
+   {
+      {
+         boost::mutex::scoped_lock lock(m_work_mutex);
+         if (!m_working)
+            return;
+         m_working = false;
+      }
+      m_work_to_do.notify_all();
+      m_pthread->join();
+   }
+
+   /// number of batches handed to the kernel so far
+   size_t batches_written() const
+   {
+      return m_batches_written.load(boost::memory_order_relaxed);
+   }
+
+   /// number of items handed to the kernel so far
+   size_t items_written() const
+   {
+      return m_items_written.load(boost::memory_order_acquire);
+   }
+};
+
+}} // moost::io
+
+#endif // MOOST_IO_BATCHED_ASYNC_WRITER_HPP__
@@ -28,150 +28,124 @@
 #ifndef MOOST_IO_BLOCK_STORE_HPP__
 #define MOOST_IO_BLOCK_STORE_HPP__
 
-#include <algorithm>
 #include <string>
-#include <fstream>
+#include <vector>
+#include <iostream>
 #include <stdexcept>
 
-#include <boost/filesystem/path.hpp>
-#include <boost/filesystem/operations.hpp>
-
-#include <boost/scoped_array.hpp>
-#include <boost/thread/mutex.hpp>
-
-#include "../container/resource_stack.hpp"
+#include "positional_file.hpp"
+#include "detail/block_streambuf.hpp"
+#include "detail/block_allocator.hpp"
 
 namespace moost { namespace io {
 
-/** @brief block_store provides block-level storage by presenting a thread-safe pool of streams, for allocing, reading/writing, freeing
+/** @brief block_store provides thread-safe block-level storage for allocing, reading/writing, freeing
 *
+* All blocks are accessed through a single file handle using positional i/o,
+* so any number of threads can read and write blocks concurrently without
+* taking any locks. Each scoped_block gets its own stream buffer confined to
+* the block.
 */
 class block_store
 {
 private:
-   moost::container::resource_stack< std::fstream > m_rstreams;
-   size_t                                           m_block_size;
-   size_t                                           m_allocated;
-   std::vector<size_t>                              m_free_list;
-   boost::mutex                                     m_mutex;
+   positional_file          m_file;
+   size_t                   m_block_size;
+   detail::block_allocator  m_allocator;
 
    /** free a block at a given index, and don't whine if the index is invalid
    * (don't want to throw on dtors) */
    void free(size_t index)
    {
-      boost::mutex::scoped_lock lock(m_mutex);
-      if (index >= m_allocated)
-         return; // weird
-      if (index == m_allocated - 1)
-         --m_allocated;
-      else
-      {
-         std::vector<size_t>::iterator it = std::lower_bound(m_free_list.begin(), m_free_list.end(), index);
-         if (it == m_free_list.end() || *it != index)
-            m_free_list.insert(it, index);
-      }
+      m_allocator.free(index);
    }
 
    /** alloc an index and return it */
    size_t alloc()
    {
-      size_t ret_val;
-      boost::mutex::scoped_lock lock(m_mutex);
-      if (m_free_list.empty())
-         ret_val = m_allocated++;
-      else
-      {
-         ret_val = m_free_list.back();
-         m_free_list.pop_back();
-      }
-      return ret_val;
+      return m_allocator.alloc();
    }
 
-   /** given an index, find the associated index within the stream */
-   std::streampos getpos(size_t index)
+   /** given an index, find the associated offset within the file */
+   positional_file::offset_t getpos(size_t index)
    {
-      return static_cast<std::streampos>(sizeof(size_t)) + static_cast<std::streampos>( m_block_size ) * static_cast<std::streampos>( index );
+      return static_cast<positional_file::offset_t>(sizeof(size_t)) + static_cast<positional_file::offset_t>(m_block_size) * index;
    }
 
 public:
 
-   /** scoped_block secures a block from the block store, and exposes read/write functionality */
+   /** scoped_block secures a block from the block store, and exposes read/write functionality
+   *
+   * Stream positions are relative to the start of the block, and the stream
+   * cannot read or write past the end of the block.
+   */
    class scoped_block
    {
    private:
-      block_store &                                                     m_block_store;
-      moost::container::resource_stack< std::fstream >::scoped_resource m_rstream;
-      size_t                                                            m_index;
-      bool                                                              m_free;
+      block_store &           m_block_store;
+      size_t                  m_index;
+      bool                    m_free;
+      detail::block_streambuf m_buf;
+      std::iostream           m_stream;
+
+      scoped_block(const scoped_block&);
+      scoped_block& operator=(const scoped_block&);
+
    public:
       /** alloc a new block */
       scoped_block(block_store & block_store_)
          : m_block_store(block_store_),
-           m_rstream(block_store_.m_rstreams),
-           m_free(false)
+           m_index(block_store_.alloc()),
+           m_free(false),
+           m_buf(block_store_.m_file, block_store_.getpos(m_index), block_store_.m_block_size),
+           m_stream(&m_buf)
       {
-         m_index = m_block_store.alloc();
-         std::streampos newPos = m_block_store.getpos(m_index);
-         m_rstream->seekg( newPos );
-         m_rstream->seekp( newPos );
       }
       /** grab a preexisting block */
       scoped_block(block_store & block_store_, size_t index)
          : m_block_store(block_store_),
-           m_rstream(block_store_.m_rstreams),
            m_index(index),
-           m_free(false)
+           m_free(false),
+           m_buf(block_store_.m_file, block_store_.getpos(m_index), block_store_.m_block_size),
+           m_stream(&m_buf)
       {
-         std::streampos newPos = m_block_store.getpos(m_index);
-         m_rstream->seekg( newPos );
-         m_rstream->seekp( newPos );
       }
       ~scoped_block()
       {
          if (m_free)
             m_block_store.free(m_index);
          else
-            m_rstream->rdbuf()->pubsync();
+            m_buf.pubsync();
       }
-      void free()                  { m_free = true; }
-      std::fstream & operator * () { return m_rstream.operator* (); }
-      std::fstream * operator ->() { return m_rstream.operator->(); }
-      size_t index()               { return m_index; }
-      size_t block_size()          { return m_block_store.block_size(); }
+      void free()                   { m_free = true; }
+      std::iostream & operator * () { return m_stream; }
+      std::iostream * operator ->() { return &m_stream; }
+      size_t index()                { return m_index; }
+      size_t block_size()           { return m_block_store.block_size(); }
    };
 
-   /** construct a new block store */
+   /** construct a new block store
+   *
+   * num_streams is ignored; it is only kept for source compatibility with
+   * earlier versions that used a pool of streams */
    block_store(const std::string & path,
       size_t block_size,
-      size_t num_streams = 8  /* the number of concurrent streams accessing this blocks store */ )
-      : m_block_size(block_size),
-        m_allocated(0)
+      size_t num_streams = 8)
+      : m_file(path),
+        m_block_size(block_size)
    {
-      if (!boost::filesystem::exists(boost::filesystem::path(path)))
-         std::fstream(path.c_str(), std::ios::binary | std::ios::out | std::ios::app); // poor man's touch
-      else
+      (void) num_streams;
+
+      size_t allocated = 0;
+
+      if (m_file.read_at(0, &allocated, sizeof(size_t)) == sizeof(size_t))
       {
-         std::fstream in(path.c_str(), std::ios::binary | std::ios::out | std::ios::in);
-         in.read(reinterpret_cast<char *>(&m_allocated), sizeof(size_t));
-         in.seekg(getpos(m_allocated));
          size_t free_list_size = 0;
-         in.read(reinterpret_cast<char *>(&free_list_size), sizeof(size_t));
-         m_free_list.resize(free_list_size);
+         m_file.read_at(getpos(allocated), &free_list_size, sizeof(size_t));
+         std::vector<size_t> free_list(free_list_size);
          if (free_list_size > 0)
-            in.read(reinterpret_cast<char *>(&m_free_list[0]), free_list_size * sizeof(size_t));
-      }
-      while (num_streams-- != 0)
-      {
-         boost::shared_ptr<std::fstream> pTmpStream( new std::fstream(
-                  path.c_str(),
-                  std::ios::binary | std::ios::out | std::ios::in));
-
-         if ( ! *pTmpStream )
-         {
-            throw std::runtime_error("Cannot open output stream for <" + path + ">!");
-         }
-
-         m_rstreams.add_resource(pTmpStream);
+            m_file.read_at(getpos(allocated) + sizeof(size_t), &free_list[0], free_list_size * sizeof(size_t));
+         m_allocator.load(allocated, free_list);
       }
    }
 
@@ -179,22 +153,27 @@ public:
    ** n.b. everyone must have their hands off the block_store before you destroy it */
    ~block_store()
    {
-      moost::container::resource_stack< std::fstream >::scoped_resource rstream(m_rstreams);
-      rstream->seekp(0);
-      rstream->write(reinterpret_cast<const char *>(&m_allocated), sizeof(size_t));
-      rstream->seekp(getpos(m_allocated));
-      size_t free_list_size = m_free_list.size();
-      rstream->write(reinterpret_cast<const char *>(&free_list_size), sizeof(size_t));
-      if (free_list_size > 0)
-         rstream->write(reinterpret_cast<const char *>(&m_free_list[0]), free_list_size * sizeof(size_t));
-      rstream->rdbuf()->pubsync();
+      try
+      {
+         size_t allocated = m_allocator.allocated();
+         std::vector<size_t> free_list;
+         m_allocator.free_list(free_list);
+         m_file.write_at(0, &allocated, sizeof(size_t));
+         std::vector<size_t> trailer(1, free_list.size());
+         trailer.insert(trailer.end(), free_list.begin(), free_list.end());
+         m_file.write_at(getpos(allocated), &trailer[0], trailer.size() * sizeof(size_t));
+      }
+      catch (const std::exception& e)
+      {
+         std::cerr << "ERROR: " << e.what() << std::endl;
+      }
    }
 
    /** returns how many blocks have been allocated, including empty blocks
    * that are in the free list */
    size_t allocated()
    {
-      return m_allocated;
+      return m_allocator.allocated();
    }
 
    /** returns the block size of this block store */
@@ -0,0 +1,73 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_IO_DETAIL_APPEND_STREAMBUF_HPP__
+#define MOOST_IO_DETAIL_APPEND_STREAMBUF_HPP__
+
+#include <streambuf>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace moost { namespace io { namespace detail {
+
+/**
+ * An output stream buffer that appends everything to a std::vector<char>
+ *
+ * The vector is owned by the caller and can be cleared and reused between
+ * uses, so a single stream can serialise any number of batches without
+ * reallocating once the vector has grown to its working size.
+ */
+class append_streambuf : public std::streambuf, public boost::noncopyable
+{
+public:
+   explicit append_streambuf(std::vector<char>& buffer)
+      : m_buffer(buffer)
+   {
+   }
+
+protected:
+   virtual int_type overflow(int_type c)
+   {
+      if (!traits_type::eq_int_type(c, traits_type::eof()))
+         m_buffer.push_back(traits_type::to_char_type(c));
+      return traits_type::not_eof(c);
+   }
+
+   virtual std::streamsize xsputn(const char_type* s, std::streamsize n)
+   {
+      m_buffer.insert(m_buffer.end(), s, s + n);
+      return n;
+   }
+
+private:
+   std::vector<char>& m_buffer;
+};
+
+}}} // moost::io::detail
+
+#endif // MOOST_IO_DETAIL_APPEND_STREAMBUF_HPP__
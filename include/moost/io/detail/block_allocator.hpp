@@ -0,0 +1,168 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_IO_DETAIL_BLOCK_ALLOCATOR_HPP__
+#define MOOST_IO_DETAIL_BLOCK_ALLOCATOR_HPP__
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace moost { namespace io { namespace detail {
+
+/**
+ * Allocator for block indices
+ *
+ * Fresh blocks are handed out by atomically bumping the number of
+ * allocated blocks. Freed blocks go to one of NUM_SHARDS free lists
+ * (chosen by index), each with its own mutex; alloc() starts looking in
+ * the shard associated with the calling thread. Freeing the last block
+ * shrinks the allocated range instead.
+ */
+class block_allocator : public boost::noncopyable
+{
+public:
+   static const size_t NUM_SHARDS = 16;
+
+   block_allocator()
+      : m_allocated(0)
+      , m_free_count(0)
+   {
+   }
+
+   size_t alloc()
+   {
+      if (m_free_count.load(boost::memory_order_acquire) > 0)
+      {
+         boost::hash<boost::thread::id> hasher;
+         size_t const start = hasher(boost::this_thread::get_id());
+
+         for (size_t i = 0; i < NUM_SHARDS; ++i)
+         {
+            shard& s = m_shards[(start + i) % NUM_SHARDS];
+            boost::mutex::scoped_lock lock(s.mutex);
+
+            if (!s.free.empty())
+            {
+               std::set<size_t>::iterator it = s.free.end();
+               size_t const index = *--it;
+               s.free.erase(it);
+               m_free_count.fetch_sub(1, boost::memory_order_relaxed);
+               return index;
+            }
+         }
+      }
+
+      return m_allocated.fetch_add(1, boost::memory_order_relaxed);
+   }
+
+   /** free a block at a given index, and don't whine if the index is invalid
+   * (don't want to throw on dtors) */
+   void free(size_t index)
+   {
+      size_t last = index + 1;
+
+      if (m_allocated.compare_exchange_strong(last, index, boost::memory_order_relaxed))
+      {
+         return;
+      }
+
+      if (index >= last)
+      {
+         return; // weird
+      }
+
+      shard& s = m_shards[index % NUM_SHARDS];
+      boost::mutex::scoped_lock lock(s.mutex);
+
+      if (s.free.insert(index).second)
+      {
+         m_free_count.fetch_add(1, boost::memory_order_release);
+      }
+   }
+
+   /** returns how many blocks have been allocated, including free blocks */
+   size_t allocated() const
+   {
+      return m_allocated.load(boost::memory_order_relaxed);
+   }
+
+   /** restores the allocator state; must not be called concurrently */
+   void load(size_t allocated, const std::vector<size_t>& free_list)
+   {
+      m_allocated.store(allocated);
+      m_free_count.store(0);
+
+      for (size_t i = 0; i < NUM_SHARDS; ++i)
+      {
+         m_shards[i].free.clear();
+      }
+
+      for (std::vector<size_t>::const_iterator it = free_list.begin(); it != free_list.end(); ++it)
+      {
+         if (*it < allocated && m_shards[*it % NUM_SHARDS].free.insert(*it).second)
+         {
+            m_free_count.fetch_add(1);
+         }
+      }
+   }
+
+   /** gets a sorted copy of the free list */
+   void free_list(std::vector<size_t>& free_list)
+   {
+      free_list.clear();
+
+      for (size_t i = 0; i < NUM_SHARDS; ++i)
+      {
+         boost::mutex::scoped_lock lock(m_shards[i].mutex);
+         free_list.insert(free_list.end(), m_shards[i].free.begin(), m_shards[i].free.end());
+      }
+
+      std::sort(free_list.begin(), free_list.end());
+   }
+
+private:
+   struct shard
+   {
+      boost::mutex mutex;
+      std::set<size_t> free;
+   };
+
+   boost::atomic<size_t> m_allocated;
+   boost::atomic<size_t> m_free_count;
+   shard m_shards[NUM_SHARDS];
+};
+
+} } }
+
+#endif
@@ -0,0 +1,228 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_IO_DETAIL_BLOCK_STREAMBUF_HPP__
+#define MOOST_IO_DETAIL_BLOCK_STREAMBUF_HPP__
+
+#include <algorithm>
+#include <streambuf>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "../positional_file.hpp"
+
+namespace moost { namespace io { namespace detail {
+
+/**
+ * A stream buffer confined to a single block of a positional_file
+ *
+ * All positions are relative to the start of the block, and reads and
+ * writes never go past its end. The buffer does not share any state with
+ * other block_streambufs on the same file, so each of them can be used
+ * from a different thread without synchronisation.
+ */
+class block_streambuf : public std::streambuf, public boost::noncopyable
+{
+public:
+   typedef positional_file::offset_t offset_t;
+
+   static const size_t MAX_BUFFER_SIZE = 4096;
+
+   block_streambuf(positional_file& file, offset_t base, size_t size)
+      : m_file(file)
+      , m_base(base)
+      , m_size(size)
+      , m_buffer((std::max)((std::min)(size, static_cast<size_t>(MAX_BUFFER_SIZE)), static_cast<size_t>(1)))
+      , m_bufpos(0)
+   {
+      setg(0, 0, 0);
+      setp(0, 0);
+   }
+
+   ~block_streambuf()
+   {
+      try
+      {
+         flush();
+      }
+      catch (...)
+      {
+      }
+   }
+
+protected:
+   int_type underflow()
+   {
+      size_t const cur = pos();
+
+      if (!flush())
+      {
+         return traits_type::eof();
+      }
+
+      m_bufpos = cur;
+
+      if (cur >= m_size)
+      {
+         setg(0, 0, 0);
+         return traits_type::eof();
+      }
+
+      char *b = &m_buffer[0];
+      size_t const got = m_file.read_at(m_base + cur, b, (std::min)(m_buffer.size(), m_size - cur));
+
+      if (got == 0)
+      {
+         setg(0, 0, 0);
+         return traits_type::eof();
+      }
+
+      setg(b, b, b + got);
+
+      return traits_type::to_int_type(*gptr());
+   }
+
+   int_type overflow(int_type c)
+   {
+      size_t const cur = pos();
+
+      if (!flush())
+      {
+         return traits_type::eof();
+      }
+
+      setg(0, 0, 0);
+      m_bufpos = cur;
+
+      if (cur >= m_size)
+      {
+         return traits_type::eof();
+      }
+
+      char *b = &m_buffer[0];
+      setp(b, b + (std::min)(m_buffer.size(), m_size - cur));
+
+      if (!traits_type::eq_int_type(c, traits_type::eof()))
+      {
+         *pptr() = traits_type::to_char_type(c);
+         pbump(1);
+         return c;
+      }
+
+      return traits_type::not_eof(c);
+   }
+
+   int sync()
+   {
+      return flush() ? 0 : -1;
+   }
+
+   pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+   {
+      off_type target = off;
+
+      if (dir == std::ios_base::cur)
+      {
+         target += static_cast<off_type>(pos());
+      }
+      else if (dir == std::ios_base::end)
+      {
+         target += static_cast<off_type>(m_size);
+      }
+
+      return seekpos(pos_type(target), which);
+   }
+
+   pos_type seekpos(pos_type sp, std::ios_base::openmode)
+   {
+      off_type const target = static_cast<off_type>(sp);
+
+      if (target < 0 || target > static_cast<off_type>(m_size) || !flush())
+      {
+         return pos_type(off_type(-1));
+      }
+
+      setg(0, 0, 0);
+      m_bufpos = static_cast<size_t>(target);
+
+      return sp;
+   }
+
+private:
+   size_t pos() const
+   {
+      if (pptr())
+      {
+         return m_bufpos + (pptr() - pbase());
+      }
+
+      if (gptr())
+      {
+         return m_bufpos + (gptr() - eback());
+      }
+
+      return m_bufpos;
+   }
+
+   bool flush()
+   {
+      if (pptr() && pptr() > pbase())
+      {
+         size_t const n = pptr() - pbase();
+
+         try
+         {
+            m_file.write_at(m_base + m_bufpos, pbase(), n);
+         }
+         catch (...)
+         {
+            return false;
+         }
+
+         m_bufpos += n;
+      }
+      else if (pptr())
+      {
+         m_bufpos += pptr() - pbase();
+      }
+
+      setp(0, 0);
+
+      return true;
+   }
+
+   positional_file& m_file;
+   const offset_t m_base;
+   const size_t m_size;
+   std::vector<char> m_buffer;
+   size_t m_bufpos;   // block relative position of m_buffer[0]
+};
+
+} } }
+
+#endif
@@ -0,0 +1,170 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_IO_DETAIL_POSITIONAL_FILE_POSIX_HPP__
+#define MOOST_IO_DETAIL_POSITIONAL_FILE_POSIX_HPP__
+
+#include <string>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace moost { namespace io { namespace detail {
+
+class positional_file : public boost::noncopyable
+{
+public:
+   typedef boost::uint64_t offset_t;
+
+   positional_file(const std::string& path, bool create = true)
+      : m_path(path)
+      , m_fd(::open(path.c_str(), O_RDWR | (create ? O_CREAT : 0), 0644))
+   {
+      if (m_fd == -1)
+      {
+         fail("cannot open");
+      }
+   }
+
+   ~positional_file()
+   {
+      ::close(m_fd);
+   }
+
+   /**
+    * Reads up to length bytes at the given offset. Returns the number of
+    * bytes read, which is only less than length at the end of the file.
+    */
+   size_t read_at(offset_t offset, void *data, size_t length) const
+   {
+      char *p = static_cast<char *>(data);
+      size_t done = 0;
+
+      while (done < length)
+      {
+         ssize_t rv = ::pread(m_fd, p + done, length - done, static_cast<off_t>(offset + done));
+
+         if (rv == 0)
+         {
+            break;
+         }
+
+         if (rv < 0)
+         {
+            if (errno == EINTR)
+            {
+               continue;
+            }
+
+            fail("cannot read from");
+         }
+
+         done += static_cast<size_t>(rv);
+      }
+
+      return done;
+   }
+
+   /**
+    * Writes length bytes at the given offset, growing the file if needed.
+    */
+   void write_at(offset_t offset, const void *data, size_t length)
+   {
+      const char *p = static_cast<const char *>(data);
+      size_t done = 0;
+
+      while (done < length)
+      {
+         ssize_t rv = ::pwrite(m_fd, p + done, length - done, static_cast<off_t>(offset + done));
+
+         if (rv < 0)
+         {
+            if (errno == EINTR)
+            {
+               continue;
+            }
+
+            fail("cannot write to");
+         }
+
+         done += static_cast<size_t>(rv);
+      }
+   }
+
+   /**
+    * Flushes file data to the storage device.
+    */
+   void sync()
+   {
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+      if (::fdatasync(m_fd) != 0)
+#else
+      if (::fsync(m_fd) != 0)
+#endif
+      {
+         fail("cannot sync");
+      }
+   }
+
+   offset_t size() const
+   {
+      struct stat st;
+
+      if (::fstat(m_fd, &st) != 0)
+      {
+         fail("cannot stat");
+      }
+
+      return static_cast<offset_t>(st.st_size);
+   }
+
+   const std::string& path() const
+   {
+      return m_path;
+   }
+
+private:
+   void fail(const char *what) const
+   {
+      throw std::runtime_error(std::string(what) + " <" + m_path + ">: " + std::strerror(errno));
+   }
+
+   const std::string m_path;
+   const int m_fd;
+};
+
+} } }
+
+#endif
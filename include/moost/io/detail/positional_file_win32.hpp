@@ -0,0 +1,159 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_IO_DETAIL_POSITIONAL_FILE_WIN32_HPP__
+#define MOOST_IO_DETAIL_POSITIONAL_FILE_WIN32_HPP__
+
+#include <string>
+#include <stdexcept>
+#include <cstring>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <windows.h>
+
+namespace moost { namespace io { namespace detail {
+
+class positional_file : public boost::noncopyable
+{
+public:
+   typedef boost::uint64_t offset_t;
+
+   positional_file(const std::string& path, bool create = true)
+      : m_path(path)
+      , m_handle(CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                             create ? OPEN_ALWAYS : OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL, NULL))
+   {
+      if (m_handle == INVALID_HANDLE_VALUE)
+      {
+         fail("cannot open");
+      }
+   }
+
+   ~positional_file()
+   {
+      CloseHandle(m_handle);
+   }
+
+   size_t read_at(offset_t offset, void *data, size_t length) const
+   {
+      char *p = static_cast<char *>(data);
+      size_t done = 0;
+
+      while (done < length)
+      {
+         OVERLAPPED ov;
+         DWORD rv = 0;
+         std::memset(&ov, 0, sizeof(ov));
+         ov.Offset = static_cast<DWORD>(offset + done);
+         ov.OffsetHigh = static_cast<DWORD>((offset + done) >> 32);
+
+         if (!ReadFile(m_handle, p + done, static_cast<DWORD>(length - done), &rv, &ov))
+         {
+            if (GetLastError() == ERROR_HANDLE_EOF)
+            {
+               break;
+            }
+
+            fail("cannot read from");
+         }
+
+         if (rv == 0)
+         {
+            break;
+         }
+
+         done += rv;
+      }
+
+      return done;
+   }
+
+   void write_at(offset_t offset, const void *data, size_t length)
+   {
+      const char *p = static_cast<const char *>(data);
+      size_t done = 0;
+
+      while (done < length)
+      {
+         OVERLAPPED ov;
+         DWORD rv = 0;
+         std::memset(&ov, 0, sizeof(ov));
+         ov.Offset = static_cast<DWORD>(offset + done);
+         ov.OffsetHigh = static_cast<DWORD>((offset + done) >> 32);
+
+         if (!WriteFile(m_handle, p + done, static_cast<DWORD>(length - done), &rv, &ov))
+         {
+            fail("cannot write to");
+         }
+
+         done += rv;
+      }
+   }
+
+   void sync()
+   {
+      if (!FlushFileBuffers(m_handle))
+      {
+         fail("cannot sync");
+      }
+   }
+
+   offset_t size() const
+   {
+      LARGE_INTEGER sz;
+
+      if (!GetFileSizeEx(m_handle, &sz))
+      {
+         fail("cannot stat");
+      }
+
+      return static_cast<offset_t>(sz.QuadPart);
+   }
+
+   const std::string& path() const
+   {
+      return m_path;
+   }
+
+private:
+   void fail(const char *what) const
+   {
+      throw std::runtime_error(std::string(what) + " <" + m_path + ">: error " + boost::lexical_cast<std::string>(GetLastError()));
+   }
+
+   const std::string m_path;
+   const HANDLE m_handle;
+};
+
+} } }
+
+#endif
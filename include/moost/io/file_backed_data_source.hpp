@@ -43,13 +43,31 @@
  *    <MinSecsSinceLastLoad>30</MinSecsSinceLastLoad>
  *    <ThrowOnFirstLoadFail>true</ThrowOnFirstLoadFail>
  *    <MinProportionOfLastLoad>0.5</MinProportionOfLastLoad>
+ *    <UseInotify>false</UseInotify>
+ *    <ParallelReload>false</ParallelReload>
  * </FileBackedDataSource>
  *
+ * The file is polled unless UseInotify is set, in which case it's watched
+ * with inotify where available, so a reload starts as soon as the writer
+ * closes the file or a new file is renamed into place.
+ *
+ * New data is published as an immutable snapshot: readers calling
+ * get_shared_ptr() never block, not even while a reload is publishing.
+ * With ParallelReload, registered loadables that reload together with this
+ * source are loaded concurrently rather than one after the other, by the
+ * reloading thread and a small pool of the source's own. If any of them
+ * throws, the first such exception is rethrown once all of them are done.
+ *
  *
  * file_backed_data_source logs info and warnings related to data loading with
  * moost::logging. You must therefore initialiase moost::logging in your code
  * in the usual way before using a file_backed_data_source.
  *
+ * Reloads are also counted in moost::metrics under "io.source.<name>.", where
+ * <name> is the DataPolicy's getName(): reloads (published), failures (load
+ * threw), rejected (too small), load_us (time to load) and size (of the data
+ * currently published).
+ *
  *
  * Synopsis:
  *
@@ -94,17 +112,26 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <algorithm>
 #include <stdexcept>
 
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/exception_ptr.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
 
-#include "../safe_shared_ptr.hpp"
+#include "../thread/snapshot_ptr.hpp"
+#include "../thread/worker_group.hpp"
 #include "file_watcher.hpp"
 #include "../terminal_format.hpp"
-#include "../xml/simple_parser.hpp"
+#include "../xml/pull_parser.hpp"
 #include "../logging/class_logger.hpp"
+#include "../metrics/registry.hpp"
 
 namespace moost { namespace io {
 
@@ -150,17 +177,20 @@ public:
    int minSecsSinceLastLoad;        // reject reload sooner than this
    bool throwOnFirstLoadFail;       // if true, throw an exception if the initial load fails
    double minProportionOfLastLoad;  //  reject reload smaller than this
+   bool useInotify;                 // watch the file with inotify rather than polling, if available
+   bool parallelReload;             // load registered loadables concurrently
 
    // some possible default values, you still need to set the filepath!
    file_backed_data_source_config() :
-   minSecsSinceLastLoad(30), throwOnFirstLoadFail(true), minProportionOfLastLoad(0.5)
+   minSecsSinceLastLoad(30), throwOnFirstLoadFail(true), minProportionOfLastLoad(0.5),
+   useInotify(false), parallelReload(false)
    {
    }
 
    file_backed_data_source_config(const std::string& path, int minSecs, bool throwOnFirst,
-      double minProportion) :
+      double minProportion, bool inotify = false, bool parallel = false) :
    filepath(path), minSecsSinceLastLoad(minSecs), throwOnFirstLoadFail(throwOnFirst),
-   minProportionOfLastLoad(minProportion)
+   minProportionOfLastLoad(minProportion), useInotify(inotify), parallelReload(parallel)
    {
    }
 };
@@ -177,6 +207,8 @@ public:
       setAndRemove(conf.minSecsSinceLastLoad, "MinSecsSinceLastLoad", tagMap);
       setAndRemove(conf.throwOnFirstLoadFail, "ThrowOnFirstLoadFail", tagMap);
       setAndRemove(conf.minProportionOfLastLoad, "MinProportionOfLastLoad", tagMap);
+      setAndRemove(conf.useInotify, "UseInotify", tagMap);
+      setAndRemove(conf.parallelReload, "ParallelReload", tagMap);
       if (!tagMap.empty())
          throw std::runtime_error("Unexpected xml tag: " + tagMap.begin()->first);
       return conf;
@@ -187,15 +219,24 @@ private:
 
    void xmlToMap(std::map<std::string, std::string>& tagMap, const std::string& xmlFilepath)
    {
-      moost::xml::simple_parser xmlParser;
-      xmlParser.load(xmlFilepath);
-      const moost::xml::simple_parser::tree_branch_t& root = xmlParser.get_root();
-      if (!root.front())
+      moost::xml::file_pull_parser xml(xmlFilepath);
+      if (xml.next() != moost::xml::pull_parser::START_TAG)
          throw std::runtime_error("No xml root tag");
-      std::string rootTag(root.front()->header);
-      if (rootTag != "FileBackedDataSource")
-         throw std::runtime_error("Unexpected xml root tag: " + rootTag);
-      root.front()->leaves2map(tagMap);
+      if (xml.name() != "FileBackedDataSource")
+         throw std::runtime_error("Unexpected xml root tag: " + xml.name().str());
+      std::string* value = 0;
+      while (xml.next() != moost::xml::pull_parser::END_DOCUMENT)
+      {
+         if (xml.depth() != 2)
+            continue;
+         if (xml.event() == moost::xml::pull_parser::START_TAG)
+         {
+            value = &tagMap[xml.name().str()];
+            value->clear();
+         }
+         else if (xml.event() == moost::xml::pull_parser::TEXT)
+            value->assign(xml.text().begin(), xml.text().end());
+      }
    }
 
    template <typename T>
@@ -232,7 +273,7 @@ public:
    typedef typename DataPolicy::data_type data_type;
 
    file_backed_data_source(const DataPolicy& dataPolicy) : m_dataPolicy(dataPolicy),
-      m_firstLoad(true), m_lastLoadTime(-1) { }
+      m_firstLoad(true), m_lastLoadTime(-1), m_metrics(dataPolicy.getName()) { }
 
    void configure(file_backed_data_source_config conf)
    {
@@ -270,12 +311,14 @@ public:
 
    void load()
    {
-      if (m_firstLoad)
+      boost::mutex::scoped_lock lock(m_reloadMutex);
+      if (m_firstLoad && !m_pFileWatcher)
       {
-         m_fileWatcher.start();
-         m_fileWatcher.insert(m_conf.filepath, boost::bind(&file_backed_data_source<DataPolicy>::reload, this, _1, _2));
+         m_pFileWatcher.reset(new file_watcher(500, m_conf.useInotify ? file_watcher::INOTIFY : file_watcher::POLL));
+         m_pFileWatcher->start();
+         m_pFileWatcher->insert(m_conf.filepath, boost::bind(&file_backed_data_source<DataPolicy>::reload, this, _1, _2));
       }
-      reload(file_watcher::CHANGED, m_conf.filepath);
+      doReload(m_conf.filepath);
       if (m_firstLoad)
       {
          m_firstLoad = false;
@@ -289,47 +332,172 @@ private:
    bool m_firstLoad;
    int m_lastLoadTime;
 
-   file_watcher m_fileWatcher;
+   struct reload_metrics
+   {
+      explicit reload_metrics(const std::string& name)
+         : reloads(moost::metrics::get_counter(moost::metrics::make_name("io.source", name) + ".reloads"))
+         , failures(moost::metrics::get_counter(moost::metrics::make_name("io.source", name) + ".failures"))
+         , rejected(moost::metrics::get_counter(moost::metrics::make_name("io.source", name) + ".rejected"))
+         , load_us(moost::metrics::get_histogram(moost::metrics::make_name("io.source", name) + ".load_us"))
+         , size(moost::metrics::get_gauge(moost::metrics::make_name("io.source", name) + ".size"))
+      {
+      }
+
+      moost::metrics::counter& reloads;
+      moost::metrics::counter& failures;
+      moost::metrics::counter& rejected;
+      moost::metrics::histogram& load_us;
+      moost::metrics::gauge& size;
+   };
 
-   moost::safe_shared_ptr<data_type> m_pData;
+   reload_metrics m_metrics;
+
+   moost::thread::snapshot_ptr<data_type> m_pData;
+
+   // serialises reloads of this source, readers never take it
+   boost::mutex m_reloadMutex;
 
    typedef std::vector<boost::shared_ptr<loadable> > registered_t;
    registered_t m_preRegistered;
    registered_t m_postRegistered;
 
+   // the loadables of one parallel reload, shared by everyone loading them
+   struct parallel_load
+   {
+      explicit parallel_load(const registered_t& loadables)
+         : loadables(loadables)
+         , next(0)
+         , active(0)
+         , errors(loadables.size())
+      {
+      }
+
+      const registered_t loadables;
+      size_t next;
+      size_t active;
+      std::vector<boost::exception_ptr> errors;
+      boost::mutex mx;
+      boost::condition_variable done;
+   };
+
+   typedef boost::shared_ptr<parallel_load> parallel_load_ptr;
+
+   // helps with parallel reloads, created on the first one
+   boost::scoped_ptr<moost::thread::worker_group> m_pLoaders;
+
+   // declared last so that the watcher thread is stopped before anything
+   // it might call back into is destroyed
+   boost::scoped_ptr<file_watcher> m_pFileWatcher;
+
    void reload(file_watcher::file_action action, const std::string& filepath)
    {
       if (action != file_watcher::CHANGED)
          return;
 
+      boost::mutex::scoped_lock lock(m_reloadMutex);
+      doReload(filepath);
+   }
+
+   void doReload(const std::string& filepath)
+   {
       // abandon reload if it's too soon after previous one
       int timeNow = static_cast<int>(time(NULL));
       if (!m_firstLoad && timeNow < m_lastLoadTime + m_conf.minSecsSinceLastLoad)
          return;
 
       // force pre-registered sources to reload first
-      for (registered_t::iterator it = m_preRegistered.begin(); it != m_preRegistered.end(); ++it)
-         (*it)->load();
+      loadRegistered(m_preRegistered);
 
       MLOG_CLASS_INFO("Updating " << m_dataPolicy.getName() << "..");
 
       boost::shared_ptr<data_type> pData;
-      loadWithErrorHandling(pData, filepath);
+      {
+         moost::metrics::scoped_timer timer(m_metrics.load_us);
+         loadWithErrorHandling(pData, filepath);
+      }
 
       // abandon new dataset if it looks too small
       size_t newSize = m_dataPolicy.size(pData);
       if (!m_firstLoad && newSize < size() * m_conf.minProportionOfLastLoad)
+      {
+         ++m_metrics.rejected;
          return;
+      }
 
       MLOG_CLASS_INFO(moost::terminal_format::getOkay() << ": Loaded " << newSize);
 
-      m_pData = pData;
+      m_pData.publish(pData);
       m_lastLoadTime = static_cast<int>(time(NULL));
+      ++m_metrics.reloads;
+      m_metrics.size.set(static_cast<moost::metrics::gauge::value_type>(newSize));
 
       // force post-registered sources to reload afterwards
-      for (registered_t::iterator it = m_postRegistered.begin(); it != m_postRegistered.end(); ++it)
-         (*it)->load();
+      loadRegistered(m_postRegistered);
+
+   }
+
+   // the reloading thread loads too, and any of the pool's workers that
+   // are free join in
+   void loadRegistered(registered_t& registered)
+   {
+      if (!m_conf.parallelReload || registered.size() < 2)
+      {
+         for (registered_t::iterator it = registered.begin(); it != registered.end(); ++it)
+            (*it)->load();
+         return;
+      }
+
+      if (!m_pLoaders)
+      {
+         size_t workers = std::max(m_preRegistered.size(), m_postRegistered.size());
+         workers = std::min<size_t>(workers, std::max(boost::thread::hardware_concurrency(), 2u));
+         m_pLoaders.reset(new moost::thread::worker_group(workers - 1));
+      }
+
+      parallel_load_ptr job(new parallel_load(registered));
+
+      size_t helpers = std::min(registered.size(), m_pLoaders->size() + 1) - 1;
+      for (size_t i = 0; i < helpers; ++i)
+         m_pLoaders->add_job(boost::bind(&file_backed_data_source<DataPolicy>::loadParallel, job));
+
+      loadParallel(job);
+
+      boost::mutex::scoped_lock lock(job->mx);
+      while (job->active > 0)
+         job->done.wait(lock);
+
+      for (std::vector<boost::exception_ptr>::const_iterator it = job->errors.begin(); it != job->errors.end(); ++it)
+      {
+         if (*it)
+            boost::rethrow_exception(*it);
+      }
+   }
+
+   // takes loadables until there are none left
+   static void loadParallel(parallel_load_ptr job)
+   {
+      boost::mutex::scoped_lock lock(job->mx);
+      ++job->active;
+
+      while (job->next < job->loadables.size())
+      {
+         size_t i = job->next++;
+         lock.unlock();
+
+         try
+         {
+            job->loadables[i]->load();
+         }
+         catch (...)
+         {
+            job->errors[i] = boost::current_exception();
+         }
+
+         lock.lock();
+      }
 
+      if (--job->active == 0)
+         job->done.notify_all();
    }
 
    void loadWithErrorHandling(boost::shared_ptr<data_type>& pData, const std::string& filepath)
@@ -340,6 +508,7 @@ private:
       }
       catch (std::runtime_error& ex)
       {
+         ++m_metrics.failures;
          MLOG_CLASS_WARN(ex.what() << " loading " << m_dataPolicy.getName()
             << " from " << filepath);
          if (m_firstLoad && m_conf.throwOnFirstLoadFail)
@@ -349,6 +518,7 @@ private:
       }
       catch (...)
       {
+         ++m_metrics.failures;
          MLOG_CLASS_WARN("exception loading " << m_dataPolicy.getName()
             << " from " << filepath);
          if (m_firstLoad && m_conf.throwOnFirstLoadFail)
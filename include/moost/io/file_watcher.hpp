@@ -29,8 +29,11 @@
 #define MOOST_IO_FILE_WATCHER_HPP__
 
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 #include <limits>
+#include <stdexcept>
 #include <functional>
 
 #include <boost/thread.hpp>
@@ -46,6 +49,16 @@
 
 #include "../thread/xtime_util.hpp"
 
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#define MOOST_IO_FILE_WATCHER_HAS_INOTIFY
+#endif
+
 /**
  * \namespace moost::io
  * \brief IO-related routines used commonly everywhere
@@ -60,6 +73,15 @@ namespace moost { namespace io {
  *
  * After a file_watcher is instantiated, you must call file_watcher::start() to
  * start up the asynchronous thread.
+ *
+ * By default files are polled for their modification time, which means a
+ * change is only reported once the file has stopped changing for a whole
+ * polling interval. In \c INOTIFY mode (Linux only) the parent directory of
+ * each path is watched instead, and a change is reported as soon as a writer
+ * closes the file (\c IN_CLOSE_WRITE) or a new file is renamed onto the path
+ * (\c IN_MOVED_TO). Paths whose directory can't be watched, e.g. because it
+ * doesn't exist yet, are polled until the watch can be set up. If inotify
+ * isn't available the watcher silently falls back to polling.
  */
 class file_watcher
 {
@@ -73,10 +95,19 @@ public:
     DELETED = 2  ///< File deletion
   };
 
+  /// How file_watcher detects changes
+  enum watch_mode
+  {
+    POLL = 0,   ///< Poll modification times every sleep_ms milliseconds
+    INOTIFY = 1 ///< Wait for inotify events on the parent directories
+  };
+
   typedef boost::function<void(file_action action, const std::string & path)> callback_t;
 
 private:
 
+  typedef std::pair< callback_t , std::pair< file_action, std::string> > notification;
+
   /// The map that associates watched files to the callbacks that should be launched
   std::map<std::string, callback_t > m_file_callback;
   /// The map that associates watched files with their last known modification times
@@ -115,6 +146,25 @@ private:
 
   int m_sleep_ms;
 
+  watch_mode m_mode;
+
+#ifdef MOOST_IO_FILE_WATCHER_HAS_INOTIFY
+  /// inotify instance, and a pipe used to wake up the watcher thread
+  int m_inotify_fd;
+  int m_wake_pipe[2];
+
+  typedef std::multimap<std::string, std::string> name_path_map_t;
+
+  /// Watch descriptors of the directories we are watching
+  std::map<std::string, int> m_dir_wd;
+  /// For each watch descriptor, maps file names to the watched paths
+  std::map<int, name_path_map_t> m_wd_files;
+  /// Paths that are polled because their directory couldn't be watched
+  std::set<std::string> m_polled;
+
+  static const uint32_t INOTIFY_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF;
+#endif
+
   /// we cannot assume that if a file exists, it will exist in the following moment that we check its file size
   std::time_t last_write_time(const boost::filesystem::path & p)
   {
@@ -139,9 +189,15 @@ public:
   /** Constructs an empty file_watcher that is not running and not watching anything
    * @param sleep_ms: the number of milliseconds to sleep in between checking files
    */
-  file_watcher(int sleep_ms = 500) :
-    m_run(false), m_sleep_ms(sleep_ms)
+  file_watcher(int sleep_ms = 500, watch_mode mode = POLL) :
+    m_run(false), m_sleep_ms(sleep_ms), m_mode(POLL)
   {
+#ifdef MOOST_IO_FILE_WATCHER_HAS_INOTIFY
+    m_inotify_fd = -1;
+    m_wake_pipe[0] = m_wake_pipe[1] = -1;
+    if (mode == INOTIFY)
+      init_inotify();
+#endif
   }
 
   /// Destructor.
@@ -153,6 +209,20 @@ public:
   ~file_watcher()
   {
     stop();
+#ifdef MOOST_IO_FILE_WATCHER_HAS_INOTIFY
+    if (m_inotify_fd >= 0)
+    {
+      ::close(m_inotify_fd);
+      ::close(m_wake_pipe[0]);
+      ::close(m_wake_pipe[1]);
+    }
+#endif
+  }
+
+  /// Returns the mode the watcher is actually running in
+  watch_mode mode() const
+  {
+    return m_mode;
   }
 
   /// Adds \a path to the list of monitored paths.
@@ -166,6 +236,11 @@ public:
   {
     boost::mutex::scoped_lock lock(m_file_mutex);
 
+#ifdef MOOST_IO_FILE_WATCHER_HAS_INOTIFY
+    if (m_mode == INOTIFY && m_file_callback.find(path) == m_file_callback.end() && !add_watch(path))
+      wake(); // so the watcher thread starts polling the path
+#endif
+
     m_file_callback[path] = callback;
 
     boost::filesystem::path p(path);
@@ -191,6 +266,10 @@ public:
   void erase(const std::string & path)
   {
     boost::mutex::scoped_lock lock(m_file_mutex);
+#ifdef MOOST_IO_FILE_WATCHER_HAS_INOTIFY
+    if (m_mode == INOTIFY && m_file_callback.find(path) != m_file_callback.end())
+      remove_watch(path);
+#endif
     m_file_callback.erase(path);
     m_file_modified.erase(path);
   }
@@ -222,6 +301,9 @@ public:
       // Notify the asynchronous monitor thread that it should wake up
       // if it's currently waiting on m_run_mutex
       m_run_cond.notify_one();
+#ifdef MOOST_IO_FILE_WATCHER_HAS_INOTIFY
+      wake();
+#endif
     }
     // can only join once we've released the mutex, so run() loop can finish up
     m_pthread->join();
@@ -231,9 +313,88 @@ private:
 
   /// Entry point for the asynchronous monitor thread
   void run()
+  {
+#ifdef MOOST_IO_FILE_WATCHER_HAS_INOTIFY
+    if (m_mode == INOTIFY)
+    {
+      run_inotify();
+      return;
+    }
+#endif
+    run_poll();
+  }
+
+  /// Checks the modification time of a single path, queueing notifications
+  /** m_file_mutex must be held. */
+  void check_path(const std::string & path, const callback_t & callback, std::vector<notification> & notifications)
+  {
+    boost::filesystem::path p(path);
+
+    // Does the path exist?
+    std::time_t lw = last_write_time(p);
+    if (lw != 0)
+    {
+      // Check its last modification time and compare it with what we had earlier
+      std::map< std::string, std::pair<time_t, time_t> >::iterator it_mod = m_file_modified.find(path);
+
+      if (it_mod == m_file_modified.end())
+      {
+        // We haven't seen this file so far, so insert it into the
+        // map and add a creation event that will be fired
+        m_file_modified[path] = std::make_pair(lw, lw);
+        notifications.push_back(std::make_pair(callback, std::make_pair(CREATED, path)));
+      }
+      else
+      {
+        // only case we consider a real modification: prev prev mod != prev mod,
+        // but this mod == prev mod
+        // the idea is that we want to capture a write to a file,
+        // but only notify when the write is finished
+
+        /**
+         * \todo This could cause problems with frequent writing.
+         *       We should really use boost.interprocess file locking
+         *       instead (when we get 1.36 everywhere)
+         */
+        if (lw == it_mod->second.second && it_mod->second.first != it_mod->second.second)
+          notifications.push_back(std::make_pair(callback, std::make_pair(CHANGED, path)));
+        it_mod->second.first = it_mod->second.second;
+        it_mod->second.second = lw;
+      }
+    }
+    else
+    {
+      // The path does not exist. Did we have it before? If so, fire
+      // a deletion event.
+      std::map< std::string, std::pair<time_t, time_t> >::iterator it_mod = m_file_modified.find(path);
+      if (it_mod != m_file_modified.end())
+      {
+        m_file_modified.erase(it_mod);
+        notifications.push_back(std::make_pair(callback, std::make_pair(DELETED, path)));
+      }
+    }
+  }
+
+  /// Fires the collected notifications, must be called without holding m_file_mutex
+  void notify(const std::vector<notification> & notifications)
+  {
+    for (std::vector<notification>::const_iterator it = notifications.begin(); it != notifications.end(); ++it)
+    {
+      try
+      {
+        it->first(it->second.first, it->second.second);
+      }
+      catch (...)
+      {
+        // \todo  can we do better here than silently ignoring the exception?
+      }
+    }
+  }
+
+  /// Polling loop, checks all files every m_sleep_ms milliseconds
+  void run_poll()
   {
     bool run = true;
-    typedef std::pair< callback_t , std::pair< file_action, std::string> > notification;
     std::vector< notification> notifications;
 
     for (;;)
@@ -258,70 +419,308 @@ private:
         // Lock m_file_mutex while we are working on m_file_callback
         boost::mutex::scoped_lock lock(m_file_mutex);
         for (std::map<std::string, callback_t>::iterator it = m_file_callback.begin(); it != m_file_callback.end(); ++it)
-        {
-          boost::filesystem::path p(it->first);
+          check_path(it->first, it->second, notifications);
+      }
 
-          // Does the path exist?
-          std::time_t lw = last_write_time(p);
-          if (lw != 0)
-          {
-            // Check its last modification time and compare it with what we had earlier
-            std::map< std::string, std::pair<time_t, time_t> >::iterator it_mod = m_file_modified.find(it->first);
+      // okay!  we've released our lock on m_file_callback and m_file_modified
+      // so it's time to send off our notifications
+      notify(notifications);
+    }
+  }
 
-            if (it_mod == m_file_modified.end())
-            {
-              // We haven't seen this file so far, so insert it into the
-              // map and add a creation event that will be fired
-              m_file_modified[it->first] = std::make_pair(lw, lw);
-              notifications.push_back(std::make_pair(it->second, std::make_pair(CREATED, it->first)));
-            }
-            else
-            {
-              // only case we consider a real modification: prev prev mod != prev mod,
-              // but this mod == prev mod
-              // the idea is that we want to capture a write to a file,
-              // but only notify when the write is finished
-
-              /**
-               * \todo This could cause problems with frequent writing.
-               *       We should really use boost.interprocess file locking
-               *       instead (when we get 1.36 everywhere)
-               */
-              if (lw == it_mod->second.second && it_mod->second.first != it_mod->second.second)
-                notifications.push_back(std::make_pair(it->second, std::make_pair(CHANGED, it->first)));
-              it_mod->second.first = it_mod->second.second;
-              it_mod->second.second = lw;
-            }
-          }
-          else
+#ifdef MOOST_IO_FILE_WATCHER_HAS_INOTIFY
+
+  void init_inotify()
+  {
+    m_inotify_fd = ::inotify_init();
+    if (m_inotify_fd < 0)
+      return; // fall back to polling
+
+    if (::pipe(m_wake_pipe) != 0)
+    {
+      ::close(m_inotify_fd);
+      m_inotify_fd = -1;
+      return;
+    }
+
+    ::fcntl(m_inotify_fd, F_SETFL, ::fcntl(m_inotify_fd, F_GETFL) | O_NONBLOCK);
+    ::fcntl(m_wake_pipe[0], F_SETFL, ::fcntl(m_wake_pipe[0], F_GETFL) | O_NONBLOCK);
+    ::fcntl(m_wake_pipe[1], F_SETFL, ::fcntl(m_wake_pipe[1], F_GETFL) | O_NONBLOCK);
+    ::fcntl(m_inotify_fd, F_SETFD, FD_CLOEXEC);
+    ::fcntl(m_wake_pipe[0], F_SETFD, FD_CLOEXEC);
+    ::fcntl(m_wake_pipe[1], F_SETFD, FD_CLOEXEC);
+
+    m_mode = INOTIFY;
+  }
+
+  /// Wakes up the watcher thread if it's waiting for events
+  void wake()
+  {
+    if (m_mode == INOTIFY)
+    {
+      char c = 0;
+      ssize_t rv = ::write(m_wake_pipe[1], &c, 1);
+      (void) rv; // if the pipe is full, the thread is going to wake up anyway
+    }
+  }
+
+  static void split_path(const std::string & path, std::string & dir, std::string & name)
+  {
+    boost::filesystem::path p(path);
+    dir = p.parent_path().string();
+    if (dir.empty())
+      dir = ".";
+    name = boost::filesystem::path(p.filename()).string();
+  }
+
+  /// Watches the directory of a path, or polls the path if that fails
+  /** m_file_mutex must be held. Returns false if the path is being polled. */
+  bool add_watch(const std::string & path)
+  {
+    std::string dir, name;
+    split_path(path, dir, name);
+
+    int wd;
+    std::map<std::string, int>::const_iterator it = m_dir_wd.find(dir);
+    if (it != m_dir_wd.end())
+      wd = it->second;
+    else
+    {
+      wd = ::inotify_add_watch(m_inotify_fd, dir.c_str(), INOTIFY_MASK);
+      if (wd < 0)
+      {
+        m_polled.insert(path);
+        return false;
+      }
+      m_dir_wd[dir] = wd;
+    }
+
+    m_wd_files[wd].insert(std::make_pair(name, path));
+    m_polled.erase(path);
+    return true;
+  }
+
+  /// Stops watching a path, dropping the directory watch if it was the last one
+  /** m_file_mutex must be held. */
+  void remove_watch(const std::string & path)
+  {
+    if (m_polled.erase(path))
+      return;
+
+    std::string dir, name;
+    split_path(path, dir, name);
+
+    std::map<std::string, int>::iterator it = m_dir_wd.find(dir);
+    if (it == m_dir_wd.end())
+      return;
+
+    name_path_map_t & files = m_wd_files[it->second];
+    std::pair<name_path_map_t::iterator, name_path_map_t::iterator> range = files.equal_range(name);
+    for (name_path_map_t::iterator fit = range.first; fit != range.second; ++fit)
+    {
+      if (fit->second == path)
+      {
+        files.erase(fit);
+        break;
+      }
+    }
+
+    if (files.empty())
+    {
+      ::inotify_rm_watch(m_inotify_fd, it->second);
+      m_wd_files.erase(it->second);
+      m_dir_wd.erase(it);
+    }
+  }
+
+  /// Queues a notification, unless it repeats the last one queued for the same path
+  static void queue(std::vector<notification> & notifications, const callback_t & callback, file_action action, const std::string & path)
+  {
+    for (std::vector<notification>::reverse_iterator it = notifications.rbegin(); it != notifications.rend(); ++it)
+    {
+      if (it->second.second == path)
+      {
+        if (it->second.first == action)
+          return;
+        break;
+      }
+    }
+    notifications.push_back(std::make_pair(callback, std::make_pair(action, path)));
+  }
+
+  /// Translates a single inotify event into notifications
+  /** m_file_mutex must be held. */
+  void handle_event(const inotify_event & ev, std::vector<notification> & notifications)
+  {
+    if (ev.mask & IN_Q_OVERFLOW)
+    {
+      // we lost events, so go and look at every file we're watching
+      for (std::map<int, name_path_map_t>::const_iterator wit = m_wd_files.begin(); wit != m_wd_files.end(); ++wit)
+      {
+        for (name_path_map_t::const_iterator fit = wit->second.begin(); fit != wit->second.end(); ++fit)
+        {
+          const std::string & path = fit->second;
+          const callback_t & callback = m_file_callback[path];
+          if (last_write_time(boost::filesystem::path(path)) != 0)
           {
-            // The path does not exist. Did we have it before? If so, fire
-            // a deletion event.
-            std::map< std::string, std::pair<time_t, time_t> >::iterator it_mod = m_file_modified.find(it->first);
-            if (it_mod != m_file_modified.end())
-            {
-              m_file_modified.erase(it_mod);
-              notifications.push_back(std::make_pair(it->second, std::make_pair(DELETED, it->first)));
-            }
+            bool known = m_file_modified.find(path) != m_file_modified.end();
+            m_file_modified[path] = std::make_pair(0, 0);
+            queue(notifications, callback, known ? CHANGED : CREATED, path);
           }
+          else if (m_file_modified.erase(path))
+            queue(notifications, callback, DELETED, path);
         }
       }
+      return;
+    }
+
+    std::map<int, name_path_map_t>::iterator wit = m_wd_files.find(ev.wd);
+    if (wit == m_wd_files.end())
+      return;
+
+    if (ev.mask & IN_IGNORED)
+    {
+      // the directory went away, fall back to polling its files until it
+      // comes back
+      for (name_path_map_t::const_iterator fit = wit->second.begin(); fit != wit->second.end(); ++fit)
+        m_polled.insert(fit->second);
+      for (std::map<std::string, int>::iterator dit = m_dir_wd.begin(); dit != m_dir_wd.end(); ++dit)
+      {
+        if (dit->second == ev.wd)
+        {
+          m_dir_wd.erase(dit);
+          break;
+        }
+      }
+      m_wd_files.erase(wit);
+      return;
+    }
+
+    if (ev.len == 0)
+      return;
+
+    std::pair<name_path_map_t::iterator, name_path_map_t::iterator> range = wit->second.equal_range(std::string(ev.name));
+    for (name_path_map_t::iterator fit = range.first; fit != range.second; ++fit)
+    {
+      const std::string & path = fit->second;
+      const callback_t & callback = m_file_callback[path];
+
+      if (ev.mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+      {
+        // the file has been completely written or atomically replaced
+        bool known = m_file_modified.find(path) != m_file_modified.end();
+        if (!known)
+        {
+          std::time_t lw = last_write_time(boost::filesystem::path(path));
+          m_file_modified[path] = std::make_pair(lw, lw);
+        }
+        queue(notifications, callback, known ? CHANGED : CREATED, path);
+      }
+      else if (ev.mask & (IN_DELETE | IN_MOVED_FROM))
+      {
+        if (m_file_modified.erase(path))
+          queue(notifications, callback, DELETED, path);
+      }
+    }
+  }
+
+  /// Event loop, waits for inotify events and polls paths that can't be watched
+  void run_inotify()
+  {
+    std::vector<char> buf(256 * (sizeof(inotify_event) + NAME_MAX + 1));
+    std::vector< notification> notifications;
+
+    for (;;)
+    {
+      int timeout;
+      {
+        boost::mutex::scoped_lock lock(m_run_mutex);
+        if (!m_run)
+          return;
+      }
+      {
+        boost::mutex::scoped_lock lock(m_file_mutex);
+        timeout = m_polled.empty() ? -1 : m_sleep_ms;
+      }
+
+      struct pollfd pfd[2];
+      pfd[0].fd = m_inotify_fd;
+      pfd[0].events = POLLIN;
+      pfd[0].revents = 0;
+      pfd[1].fd = m_wake_pipe[0];
+      pfd[1].events = POLLIN;
+      pfd[1].revents = 0;
+
+      int rv = ::poll(pfd, 2, timeout);
 
-      // okay!  we've released our lock on m_file_callback and m_file_modified
-      // so it's time to send off our notifications
-      for (std::vector<notification>::iterator it = notifications.begin(); it != notifications.end(); ++it)
       {
-        try
+        boost::mutex::scoped_lock lock(m_run_mutex);
+        if (!m_run)
+          return;
+      }
+
+      if (rv < 0)
+        continue; // EINTR
+
+      if (pfd[1].revents & POLLIN)
+      {
+        char drain[64];
+        while (::read(m_wake_pipe[0], drain, sizeof(drain)) > 0)
+          ;
+      }
+
+      notifications.clear();
+      {
+        boost::mutex::scoped_lock lock(m_file_mutex);
+
+        if (pfd[0].revents & POLLIN)
         {
-          it->first(it->second.first, it->second.second);
+          ssize_t len;
+          while ((len = ::read(m_inotify_fd, &buf[0], buf.size())) > 0)
+          {
+            for (ssize_t off = 0; off < len; )
+            {
+              const inotify_event * ev = reinterpret_cast<const inotify_event *>(&buf[off]);
+              off += sizeof(inotify_event) + ev->len;
+              handle_event(*ev, notifications);
+            }
+          }
         }
-        catch (...)
+
+        if (!m_polled.empty())
         {
-          // \todo  can we do better here than silently ignoring the exception?
+          // try to watch the polled paths again, and poll those that still
+          // can't be watched
+          std::vector<std::string> polled(m_polled.begin(), m_polled.end());
+          for (std::vector<std::string>::const_iterator it = polled.begin(); it != polled.end(); ++it)
+          {
+            if (add_watch(*it))
+            {
+              // now watched, so catch up with anything that happened before
+              bool exists = last_write_time(boost::filesystem::path(*it)) != 0;
+              bool known = m_file_modified.find(*it) != m_file_modified.end();
+              if (exists && !known)
+              {
+                m_file_modified[*it] = std::make_pair(0, 0);
+                queue(notifications, m_file_callback[*it], CREATED, *it);
+              }
+              else if (!exists && known)
+              {
+                m_file_modified.erase(*it);
+                queue(notifications, m_file_callback[*it], DELETED, *it);
+              }
+            }
+            else
+              check_path(*it, m_file_callback[*it], notifications);
+          }
         }
       }
+
+      notify(notifications);
     }
   }
+
+#endif
 };
 
 }} // moost::io
@@ -0,0 +1,146 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_IO_GZIP_FRAMING_HPP__
+#define MOOST_IO_GZIP_FRAMING_HPP__
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+#include <zlib.h>
+
+namespace moost { namespace io {
+
+/** @brief gzip_framing compresses the output of a batched_async_writer as a gzip stream
+ *
+ * Every batch is followed by a sync flush, so everything up to the last
+ * completed batch can be decompressed even while the file is still being
+ * written, or if the writer dies before finishing the stream. The files are
+ * regular gzip files and can be read with zcat, gzopen() etc.
+ *
+ * Needs to be linked against zlib.
+ */
+class gzip_framing
+{
+public:
+
+   /** @param level zlib compression level (1 = fastest, 9 = best) */
+   explicit gzip_framing(int level = Z_BEST_SPEED)
+     : m_level(level), m_init(false)
+   {
+   }
+
+   gzip_framing(const gzip_framing & other)
+     : m_level(other.m_level), m_init(false)
+   {
+   }
+
+   ~gzip_framing()
+   {
+      if (m_init)
+         deflateEnd(&m_zs);
+   }
+
+   /// the framing can't be written out without encoding
+   static const bool passthrough = false;
+
+   /// suffix appended to file names
+   std::string extension() const
+   {
+      return ".gz";
+   }
+
+   /// starts a new stream, called whenever a new file is opened
+   void begin()
+   {
+      if (m_init)
+      {
+         deflateReset(&m_zs);
+         return;
+      }
+
+      m_zs.zalloc = Z_NULL;
+      m_zs.zfree = Z_NULL;
+      m_zs.opaque = Z_NULL;
+
+      // 15 + 16: maximum window size, with a gzip header and trailer
+      if (deflateInit2(&m_zs, m_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+         throw std::runtime_error("gzip_framing: failed to initialise zlib");
+
+      m_init = true;
+   }
+
+   /// compresses a batch, appending the result to out
+   void encode(const char * data, size_t len, std::vector<char> & out)
+   {
+      m_zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+      m_zs.avail_in = static_cast<uInt>(len);
+      deflate_all(Z_SYNC_FLUSH, out);
+   }
+
+   /// finishes the stream, called before a file is closed
+   void end(std::vector<char> & out)
+   {
+      m_zs.next_in = Z_NULL;
+      m_zs.avail_in = 0;
+      deflate_all(Z_FINISH, out);
+   }
+
+private:
+
+   gzip_framing & operator=(const gzip_framing &);
+
+   void deflate_all(int flush, std::vector<char> & out)
+   {
+      for (;;)
+      {
+         size_t used = out.size();
+         size_t avail = deflateBound(&m_zs, m_zs.avail_in) + 64;
+         out.resize(used + avail);
+
+         m_zs.next_out = reinterpret_cast<Bytef *>(&out[used]);
+         m_zs.avail_out = static_cast<uInt>(avail);
+
+         int rv = deflate(&m_zs, flush);
+         out.resize(used + avail - m_zs.avail_out);
+
+         if (rv == Z_STREAM_END || (rv == Z_OK && m_zs.avail_out != 0 && m_zs.avail_in == 0 && flush != Z_FINISH))
+            return;
+         if (rv != Z_OK && rv != Z_BUF_ERROR)
+            throw std::runtime_error("gzip_framing: compression failed");
+      }
+   }
+
+   int m_level;
+   bool m_init;
+   z_stream m_zs;
+};
+
+}} // moost::io
+
+#endif // MOOST_IO_GZIP_FRAMING_HPP__
@@ -37,7 +37,9 @@
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/functional/hash.hpp>
-#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/scoped_ptr.hpp>
 
 #include "../container/sparse_hash_map.hpp"
@@ -63,24 +65,48 @@ private:
 
   typedef moost::container::sparse_hash_map<Key, location, HashFcn > hm_key_location;
 
+  /** the key index is split into shards so that lookups on different keys
+   ** don't all serialise on a single lock */
+  enum { SHARD_BITS = 4, NUM_SHARDS = 1 << SHARD_BITS };
+
+  struct shard
+  {
+    hm_key_location    key_location;
+    boost::shared_mutex mutex;
+  };
+
   std::string     m_key_location_path;
   variable_store  m_variable_store;
-  hm_key_location m_key_location;
-  boost::mutex    m_mutex;
+  HashFcn         m_hash;
+  shard           m_shards[NUM_SHARDS];
+
+  /** picks a shard using fibonacci hashing, so that the shard doesn't
+   ** correlate with the bucket the key lands in within the shard */
+  shard & shard_for(const Key & key)
+  {
+    boost::uint64_t h = static_cast<boost::uint64_t>(m_hash(key));
+    return m_shards[static_cast<size_t>((h * 0x9E3779B97F4A7C15ULL) >> (64 - SHARD_BITS))];
+  }
 
   /** gets a scoped_block given a key, or leaves empty
    ** if the key is not found */
   void get(boost::scoped_ptr< variable_store::scoped_block > & p,
            const Key & key)
   {
-    boost::mutex::scoped_lock lock(m_mutex);
-    // if key is found, loads index into the scoped block
-    typename hm_key_location::const_iterator it = m_key_location.find(key);
+    location loc;
+    {
+      shard & s = shard_for(key);
+      boost::shared_lock<boost::shared_mutex> lock(s.mutex);
+      // if key is found, loads index into the scoped block
+      typename hm_key_location::const_iterator it = s.key_location.find(key);
 
-    if (it == m_key_location.end())
-      return;
+      if (it == s.key_location.end())
+        return;
+
+      loc = it->second;
+    }
 
-    p.reset( new variable_store::scoped_block(m_variable_store, it->second.block_size, it->second.index) );
+    p.reset( new variable_store::scoped_block(m_variable_store, loc.block_size, loc.index) );
   }
 
   /** allocs a scoped_block for a new key
@@ -89,22 +115,24 @@ private:
              const Key & key,
              size_t block_size)
   {
-    boost::mutex::scoped_lock lock(m_mutex);
+    shard & s = shard_for(key);
+    boost::unique_lock<boost::shared_mutex> lock(s.mutex);
     // don't support reallocing for now
-    typename hm_key_location::const_iterator it = m_key_location.find(key);
+    typename hm_key_location::const_iterator it = s.key_location.find(key);
 
-    if (it != m_key_location.end())
+    if (it != s.key_location.end())
       throw std::invalid_argument("realloc not supported");
 
     p.reset( new variable_store::scoped_block(m_variable_store, block_size) );
-    m_key_location[key] = location(p->block_size(), p->index());
+    s.key_location[key] = location(p->block_size(), p->index());
   }
 
   /** frees a key */
   void free(const Key & key)
   {
-    boost::mutex::scoped_lock lock(m_mutex);
-    m_key_location.erase(key);
+    shard & s = shard_for(key);
+    boost::unique_lock<boost::shared_mutex> lock(s.mutex);
+    s.key_location.erase(key);
   }
 
 public:
@@ -147,8 +175,8 @@ public:
       m_pscoped_block->free();
       m_free = true;
     }
-    std::fstream & operator * () { return m_pscoped_block->operator * (); }
-    std::fstream * operator ->() { return m_pscoped_block->operator ->(); }
+    std::iostream & operator * () { return m_pscoped_block->operator * (); }
+    std::iostream * operator ->() { return m_pscoped_block->operator ->(); }
     size_t index()               { return m_pscoped_block->index(); }
     size_t block_size()          { return m_pscoped_block->block_size(); }
     operator bool () const       { return m_pscoped_block; }
@@ -156,6 +184,8 @@ public:
   };
 
   /** @brief Constructs a map_store.
+   *
+   * streams_per_block_size is no longer used, see variable_store.
    */
   map_store(const std::string & base_path,
             size_t min_block_size = 64,
@@ -179,7 +209,7 @@ public:
       ia >> key;
       ia >> loc.block_size;
       ia >> loc.index;
-      m_key_location[key] = loc;
+      shard_for(key).key_location[key] = loc;
     }
   }
 
@@ -187,7 +217,9 @@ public:
    */
   ~map_store()
   {
-     size_t size = m_key_location.size();
+     size_t size = 0;
+     for (size_t i = 0; i < NUM_SHARDS; ++i)
+        size += m_shards[i].key_location.size();
      if ( size <= 0 )
         return;
 
@@ -198,11 +230,15 @@ public:
            throw std::runtime_error("Cannot open file <" + m_key_location_path + "> for output!");
         boost::archive::binary_oarchive oa(out, boost::archive::no_header);
         oa << size;
-        for (typename hm_key_location::const_iterator it = m_key_location.begin(); it != m_key_location.end(); ++it)
+        for (size_t i = 0; i < NUM_SHARDS; ++i)
         {
-           oa << it->first;
-           oa << it->second.block_size;
-           oa << it->second.index;
+           const hm_key_location & kl = m_shards[i].key_location;
+           for (typename hm_key_location::const_iterator it = kl.begin(); it != kl.end(); ++it)
+           {
+              oa << it->first;
+              oa << it->second.block_size;
+              oa << it->second.index;
+           }
         }
      }
      catch (const std::exception& e)
@@ -216,7 +252,8 @@ public:
    */
   void set_deleted_key(const Key & key)
   {
-    m_key_location.set_deleted_key(key);
+    for (size_t i = 0; i < NUM_SHARDS; ++i)
+      m_shards[i].key_location.set_deleted_key(key);
   }
 };
 
@@ -83,13 +83,16 @@ public:
     {
     }
     void free() { m_scoped_block.free(); }
-    std::fstream & operator * () { return m_scoped_block.operator* (); }
-    std::fstream * operator ->() { return m_scoped_block.operator->(); }
+    std::iostream & operator * () { return m_scoped_block.operator* (); }
+    std::iostream * operator ->() { return m_scoped_block.operator->(); }
     size_t index()               { return m_scoped_block.index(); }
     size_t block_size()          { return m_scoped_block.block_size(); }
   };
 
   /** @brief Constructs a block_store.
+   *
+   * streams_per_block_size is no longer used, as block stores share a
+   * single file handle between all readers and writers.
    */
   variable_store(const std::string & base_path,
                  size_t min_block_size = 64,
@@ -39,5 +39,6 @@
 #include "kvds/kvds_kch.hpp"
 #include "kvds/kvds_bdb.hpp"
 #include "kvds/kvds_page_store.hpp"
+#include "kvds/kvds_metrics.hpp"
 
 #endif // MOOST_KVDS_HPP__
@@ -41,13 +41,18 @@
 #include <stdexcept>
 #include <sstream>
 #include <limits>
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #include <db_cxx.h>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include "../../compiler/attributes/unused.hpp"
 #include "../ikvds.hpp"
+#include "../ikvds_cursor.hpp"
 
 /// Depending on how it was built DBD can either return an error code
 /// or throw a DbException object. To ensure we can handle both all
@@ -135,11 +140,220 @@ namespace moost { namespace kvds {
       void set_data(void const * data);
    };
 
+   /// Dbd (re)allocated memory that can also be used to pass data in
+   struct ReallocDbt : Dbt
+   {
+      ReallocDbt()
+      {
+         set_flags(DB_DBT_REALLOC);
+      }
+
+      ~ReallocDbt()
+      {
+         free(get_data());
+      }
+
+      void assign(byte_array_t const & data)
+      {
+         void * p = realloc(get_data(), std::max<size_t>(data.size(), 1));
+         if(!p) { throw std::bad_alloc(); }
+
+         if(!data.empty())
+         {
+            memcpy(p, &data[0], data.size());
+         }
+
+         set_data(p);
+         set_size(data.size());
+      }
+   };
+
+   /// A cursor over the keys in [lower, upper) of a btree, or over all of any
+   /// store if the bounds are empty. It reads through a read only handle of
+   /// its own, so that cursors on the same file can be used by different threads.
+   /// Records are fetched from the file many at a time (DB_MULTIPLE_KEY), so
+   /// read() costs one call into BDB per bulk buffer rather than per record.
+
+   /// *** This class is NOT thread safe ***
+
+   class KvdsBdbCursor : public IKvdsCursor
+   {
+   public:
+      KvdsBdbCursor(std::string const & fname, byte_array_t const & lower, byte_array_t const & upper) :
+         fname_(fname), lower_(lower), upper_(upper), pitr_(0), bulk_(initial_bulk_words),
+         started_(false), done_(false)
+      {
+      }
+
+      ~KvdsBdbCursor()
+      {
+         try
+         {
+            close();
+         }
+         catch(...) { /* ignore */ }
+      }
+
+      bool next(byte_array_t & key, byte_array_t & val)
+      {
+         char const * pk = 0;
+         char const * pv = 0;
+         size_t ksize = 0;
+         size_t vsize = 0;
+
+         if(!fetch(pk, ksize, pv, vsize)) { return false; }
+
+         key.assign(pk, pk + ksize);
+         val.assign(pv, pv + vsize);
+
+         return true;
+      }
+
+      size_t read(KvdsBatch & batch, size_t const max_records, size_t const max_bytes = 0)
+      {
+         char const * pk = 0;
+         char const * pv = 0;
+         size_t ksize = 0;
+         size_t vsize = 0;
+
+         batch.clear();
+
+         while(batch.size() < max_records && (max_bytes == 0 || batch.bytes() < max_bytes) &&
+               fetch(pk, ksize, pv, vsize))
+         {
+            batch.append(pk, ksize, pv, vsize);
+         }
+
+         return batch.size();
+      }
+
+   private:
+      enum { initial_bulk_words = 64 * 1024 / sizeof(u_int32_t) };
+
+      /// the next record, pointing into the bulk buffer
+      bool fetch(char const * & pk, size_t & ksize, char const * & pv, size_t & vsize)
+      {
+         if(done_) { return false; }
+
+         Dbt kt;
+         Dbt vt;
+
+         while(!pmulti_ || !pmulti_->next(kt, vt))
+         {
+            if(!fill())
+            {
+               close();
+               return false;
+            }
+         }
+
+         pk = static_cast<char const *>(kt.get_data());
+         ksize = kt.get_size();
+
+         if(!upper_.empty() && kvds_compare_keys(pk, ksize, upper_) >= 0)
+         {
+            close();
+            return false;
+         }
+
+         pv = static_cast<char const *>(vt.get_data());
+         vsize = vt.get_size();
+
+         return true;
+      }
+
+      /// reads the next lot of records into the bulk buffer
+      bool fill()
+      {
+         u_int32_t flags = DB_NEXT;
+
+         if(!started_)
+         {
+            open();
+            started_ = true;
+            flags = lower_.empty() ? DB_FIRST : DB_SET_RANGE;
+         }
+
+         pmulti_.reset();
+
+         for(;;)
+         {
+            if(flags == DB_SET_RANGE) { kt_.assign(lower_); }
+
+            u_int32_t const ulen = static_cast<u_int32_t>(bulk_.size() * sizeof(u_int32_t));
+            bulkt_.set_data(&bulk_[0]);
+            bulkt_.set_ulen(ulen);
+
+            int rval = -1;
+            KVDSDBDX__(rval, pitr_->get(&kt_, &bulkt_, flags | DB_MULTIPLE_KEY));
+
+            if(rval == DB_BUFFER_SMALL)
+            {
+               // a record that doesn't fit on its own, make room and try again
+               // (BDB wants bulk buffers in multiples of 1k)
+               size_t const needed = std::max<size_t>(bulkt_.get_size(), 2 * ulen);
+               bulk_.resize((needed + 1023) / 1024 * (1024 / sizeof(u_int32_t)));
+               continue;
+            }
+
+            if(rval == DB_NOTFOUND) { return false; }
+            if(rval != 0) { throw std::runtime_error("Unable to read from DB cursor"); }
+
+            pmulti_.reset(new DbMultipleKeyDataIterator(bulkt_));
+            return true;
+         }
+      }
+
+      void open()
+      {
+         pdb_.reset(new Db(0, 0));
+
+         int rval = -1;
+         KVDSDBDX__(rval, pdb_->open(0, fname_.c_str(), 0, DB_UNKNOWN, DB_RDONLY, 0));
+         if(rval != 0) { throw std::runtime_error("Failed to open DBD file for reading: " + fname_); }
+
+         KVDSDBDX__(rval, pdb_->cursor(0, &pitr_, 0));
+         if(rval != 0) { throw std::runtime_error("Unable to create DB cursor"); }
+      }
+
+      void close()
+      {
+         int rval unused__ = -1;
+
+         done_ = true;
+         pmulti_.reset();
+
+         if(pitr_)
+         {
+            KVDSDBDX__(rval, pitr_->close());
+            pitr_ = 0;
+         }
+
+         if(pdb_)
+         {
+            KVDSDBDX__(rval, pdb_->close(0));
+            pdb_.reset();
+         }
+      }
+
+      std::string const fname_;
+      byte_array_t const lower_;
+      byte_array_t const upper_;
+      boost::shared_ptr<Db> pdb_;
+      Dbc * pitr_;
+      ReallocDbt kt_;
+      std::vector<u_int32_t> bulk_; // u_int32_t for the alignment BDB wants
+      UsermemDbt bulkt_;
+      boost::scoped_ptr<DbMultipleKeyDataIterator> pmulti_;
+      bool started_;
+      bool done_;
+   };
+
    /// *** This class is NOT thread safe ***
 
    /// Only HASH and BTREE are supported, trying to use another type will generate a link error
    template <DBTYPE dbtypeT>
-   class KvdsBdb : public IKvds
+   class KvdsBdb : public IKvds, public IKvdsPartitioned, public IKvdsOrdered
    {
    public:
       typedef boost::shared_ptr<Db> store_type;
@@ -169,6 +383,8 @@ namespace moost { namespace kvds {
          KVDSDBDX__(rval, pdb_->open(0, dsname, 0, dbtypeT, OMODE, 0));
 
          if(rval != 0) { throw std::runtime_error("Failed to open DBD file"); }
+
+         dsname_ = dsname;
       }
 
       void save() { /* nothing to do, fully persisted storage */ }
@@ -496,8 +712,61 @@ namespace moost { namespace kvds {
          return ok;
       }
 
+   public: // IKvdsPartitioned interface implementation
+
+      /// A btree is split into key ranges of roughly equal size, a hash table
+      /// can't be split and is returned as a single partition. The cursors read
+      /// the file through their own handles, so everything is synced first.
+      void partition(size_t const max_partitions, std::vector<kvds_cursor_ptr_t> & cursors)
+      {
+         assert_data_store_open();
+         sync();
+
+         std::vector<byte_array_t> bounds;
+         split_points(std::max<size_t>(max_partitions, 1), bounds);
+
+         byte_array_t lower;
+
+         for(size_t i = 0 ; i < bounds.size() ; ++i)
+         {
+            cursors.push_back(kvds_cursor_ptr_t(new KvdsBdbCursor(dsname_, lower, bounds[i])));
+            lower = bounds[i];
+         }
+
+         cursors.push_back(kvds_cursor_ptr_t(new KvdsBdbCursor(dsname_, lower, byte_array_t())));
+      }
+
+   public: // IKvdsOrdered interface implementation
+
+      /// Only a btree has its keys in order, a hash table returns no cursor
+      kvds_cursor_ptr_t range(byte_array_t const & lower, byte_array_t const & upper);
+
 private:
 
+   /// the keys that split the store into the given number of partitions
+   void split_points(size_t const partitions, std::vector<byte_array_t> & bounds);
+
+   /// flushes everything to the file, for cursors reading through their own handles
+   void sync()
+   {
+      int rval = -1;
+      KVDSDBDX__(rval, pdb_->sync(0));
+      if(rval != 0) { throw std::runtime_error("Failed to sync DBD file"); }
+   }
+
+   /// estimated fraction of keys less than key
+   double fraction_less(byte_array_t const & key)
+   {
+      ConstDbt kt(&key[0], key.size());
+      DB_KEY_RANGE range;
+
+      int rval = -1;
+      KVDSDBDX__(rval, pdb_->key_range(0, &kt, &range, 0));
+      if(rval != 0) { throw std::runtime_error("Unable to estimate DB key range"); }
+
+      return range.less;
+   }
+
    int get(Dbt & kt, Dbt & vt)
    {
       int rval = -1;
@@ -507,6 +776,7 @@ private:
 
    store_type pdb_;
       Dbc * pitr_;
+      std::string dsname_;
    };
 
    // Stats for HASH and BTREE are obtained differently, hence the specialisation
@@ -546,6 +816,68 @@ private:
       return 0 == rval;
    }
 
+   template<>
+   inline void KvdsBdb<DB_HASH>::split_points(size_t const /*partitions*/, std::vector<byte_array_t> & /*bounds*/)
+   {
+      // records in a hash table are in no useful order
+   }
+
+   template<>
+   inline void KvdsBdb<DB_BTREE>::split_points(size_t const partitions, std::vector<byte_array_t> & bounds)
+   {
+      // key_range() estimates where a key falls from the shape of the tree, without
+      // reading any records, so the split keys can be searched for a byte at a time
+      size_t const split_key_bytes = 4;
+
+      for(size_t i = 1 ; i < partitions ; ++i)
+      {
+         double const target = double(i) / partitions;
+         byte_array_t key;
+
+         for(size_t pos = 0 ; pos < split_key_bytes ; ++pos)
+         {
+            // the largest byte that doesn't put more than target keys before us
+            int lo = 0;
+            int hi = 0xFF;
+            key.push_back(0);
+
+            while(lo < hi)
+            {
+               int const mid = (lo + hi + 1) / 2;
+               key.back() = static_cast<char>(mid);
+
+               if(fraction_less(key) <= target) { lo = mid; }
+               else { hi = mid - 1; }
+            }
+
+            key.back() = static_cast<char>(lo);
+         }
+
+         // small or skewed stores can give the same split more than once
+         if(bounds.empty() || kvds_compare_keys(&key[0], key.size(), bounds.back()) > 0)
+         {
+            bounds.push_back(key);
+         }
+      }
+   }
+
+   template<>
+   inline kvds_cursor_ptr_t KvdsBdb<DB_HASH>::range(byte_array_t const & /*lower*/, byte_array_t const & /*upper*/)
+   {
+      return kvds_cursor_ptr_t();
+   }
+
+   template<>
+   inline kvds_cursor_ptr_t KvdsBdb<DB_BTREE>::range(byte_array_t const & lower, byte_array_t const & upper)
+   {
+      assert_data_store_open();
+
+      // the cursor reads through its own handle
+      sync();
+
+      return kvds_cursor_ptr_t(new KvdsBdbCursor(dsname_, lower, upper));
+   }
+
    typedef KvdsBdb<DB_HASH>  KvdsBht; /// Berkeley DB Hash Table
    typedef KvdsBdb<DB_BTREE> KvdsBbt; /// Berkeley DB B-Tree
 
@@ -0,0 +1,186 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/// \file
+/// Optional interfaces for stores that can hand out cursors of their own,
+/// independent of the single beg()/nxt() iteration built into IKvds.
+///
+/// A store that implements IKvdsPartitioned can be split into partitions
+/// that are scanned in parallel, each through its own cursor. See
+/// kvds_parallel_scan.hpp for a driver that works with any IKvds and makes
+/// use of this when it's there.
+///
+/// A store that implements IKvdsOrdered keeps its keys in order and can
+/// hand out a cursor over a range of keys. See kvds_range.hpp for seek,
+/// range and prefix queries that work with any IKvds.
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "ikvds.hpp"
+
+#ifndef MOOST_KVDS_IKVDS_CURSOR_HPP__
+#define MOOST_KVDS_IKVDS_CURSOR_HPP__
+
+namespace moost { namespace kvds {
+
+   typedef std::vector<char> byte_array_t;
+
+   /// Compares keys the way ordered stores sort them: as unsigned bytes,
+   /// with a key that is a prefix of another sorting first
+   inline int kvds_compare_keys(void const * pa, size_t const asize, void const * pb, size_t const bsize)
+   {
+      size_t const size = std::min(asize, bsize);
+      int const rval = size > 0 ? memcmp(pa, pb, size) : 0;
+      return rval != 0 ? rval : (asize < bsize ? -1 : (asize > bsize ? 1 : 0));
+   }
+
+   inline int kvds_compare_keys(void const * pa, size_t const asize, byte_array_t const & b)
+   {
+      return kvds_compare_keys(pa, asize, b.empty() ? 0 : &b[0], b.size());
+   }
+
+   /// Records read in one go by IKvdsCursor::read(). Keys and values are
+   /// stored back to back in a single buffer, which is kept across calls to
+   /// clear(), so a batch that's reused doesn't allocate once it's grown.
+
+   class KvdsBatch
+   {
+   public:
+      size_t size() const { return records_.size(); }
+      bool empty() const { return records_.empty(); }
+
+      /// bytes of keys and values held
+      size_t bytes() const { return data_.size(); }
+
+      char const * key(size_t const i) const { return ptr(records_[i].key); }
+      size_t key_size(size_t const i) const { return records_[i].key_size; }
+
+      char const * val(size_t const i) const { return ptr(records_[i].val); }
+      size_t val_size(size_t const i) const { return records_[i].val_size; }
+
+      void clear()
+      {
+         data_.clear();
+         records_.clear();
+      }
+
+      void append(void const * pkey, size_t const ksize, void const * pval, size_t const vsize)
+      {
+         record r;
+         r.key = data_.size();
+         r.key_size = ksize;
+         r.val = r.key + ksize;
+         r.val_size = vsize;
+
+         data_.insert(data_.end(), static_cast<char const *>(pkey), static_cast<char const *>(pkey) + ksize);
+         data_.insert(data_.end(), static_cast<char const *>(pval), static_cast<char const *>(pval) + vsize);
+         records_.push_back(r);
+      }
+
+   private:
+      struct record
+      {
+         size_t key;
+         size_t key_size;
+         size_t val;
+         size_t val_size;
+      };
+
+      char const * ptr(size_t const offset) const
+      {
+         return data_.empty() ? 0 : &data_[0] + offset;
+      }
+
+      std::vector<char> data_;
+      std::vector<record> records_;
+   };
+
+   /// A forward only cursor over (part of) a store.
+   ///
+   /// *** This class is NOT thread safe ***
+   /// (but different cursors over the same store can be used by different threads)
+
+   struct IKvdsCursor : boost::noncopyable
+   {
+      /// reads the next record, returns false when there are no more
+      virtual bool next(byte_array_t & key, byte_array_t & val) = 0;
+
+      /// Replaces the contents of batch with the next max_records records, or
+      /// fewer once max_bytes (if not 0) have been read, and returns how many
+      /// were read; 0 when there are no more. Cursors that can read many
+      /// records at once from their store override this.
+      virtual size_t read(KvdsBatch & batch, size_t const max_records, size_t const max_bytes = 0)
+      {
+         batch.clear();
+
+         while(batch.size() < max_records && (max_bytes == 0 || batch.bytes() < max_bytes) && next(key_, val_))
+         {
+            batch.append(key_.empty() ? 0 : &key_[0], key_.size(), val_.empty() ? 0 : &val_[0], val_.size());
+         }
+
+         return batch.size();
+      }
+
+      virtual ~IKvdsCursor() {}
+
+   private:
+      byte_array_t key_;
+      byte_array_t val_;
+   };
+
+   typedef boost::shared_ptr<IKvdsCursor> kvds_cursor_ptr_t;
+
+   struct IKvdsPartitioned
+   {
+      /// Splits the store into at most max_partitions disjoint partitions
+      /// that together cover every record, and appends a cursor for each
+      /// partition to cursors. The store must not be modified while any of
+      /// the cursors are in use.
+      virtual void partition(size_t const max_partitions, std::vector<kvds_cursor_ptr_t> & cursors) = 0;
+
+      virtual ~IKvdsPartitioned() {}
+   };
+
+   struct IKvdsOrdered
+   {
+      /// Returns a cursor over the keys in [lower, upper) in key order (see
+      /// kvds_compare_keys), where an empty bound means no bound. Returns an
+      /// empty pointer if this particular store has no key order. The store
+      /// must not be modified while the cursor is in use.
+      virtual kvds_cursor_ptr_t range(byte_array_t const & lower, byte_array_t const & upper) = 0;
+
+      virtual ~IKvdsOrdered() {}
+   };
+
+}}
+
+#endif // MOOST_KVDS_IKVDS_CURSOR_HPP__
@@ -0,0 +1,842 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/// \file
+/// Decorates any ikvds so that values are stored compressed. Values are
+/// transparently decompressed on the way out, so get(), all(), siz() and
+/// add() behave exactly as they do on the decorated store, partial reads
+/// included.
+///
+/// Values shorter than the threshold are stored as they are. Longer values
+/// are deflated (zlib, raw deflate) at the configured level, optionally
+/// primed with a preset dictionary so that small records that share a lot
+/// of structure still compress well. Values that are lists of 32 bit
+/// integers (integer_values) are first delta encoded and written as
+/// variable length integers, which makes long sorted id lists a fraction
+/// of their raw size even before they're deflated.
+///
+///    KvdsCompress::options opt;
+///    opt.integer_values = true;
+///    opt.threshold = 32;
+///    ikvds_ptr_t store(new KvdsCompress(ikvds_ptr_t(new KvdsTch), "user_tags", opt));
+///
+/// A dictionary can be built from a sample of typical values and must then
+/// be used for every store that reads these values:
+///
+///    opt.dictionary = KvdsCompress::train_dictionary(samples);
+///
+/// Every value written through this class carries a small header (a flag
+/// byte, the uncompressed size and the dictionary checksum if one was used),
+/// so a store must always be accessed through it. add() has to decompress,
+/// append and recompress the whole value.
+///
+/// Metrics, registered under "kvds.<name>.compress.":
+///
+///    raw_bytes / stored_bytes     bytes written before and after compression
+///    encodes / decodes            values run through the compressor and decompressor
+///    encode_ns / decode_ns        time spent in the codecs
+///    skipped                      values stored uncompressed (too small or
+///                                 incompressible)
+///
+/// stats() reads them back and works out the compression ratio and the
+/// cost per value.
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <ostream>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+
+#include <zlib.h>
+
+#include "ikvds.hpp"
+#include "../metrics/registry.hpp"
+#include "../utils/benchmark_clock.hpp"
+#include "../algorithm/variable_length_encoding.hpp"
+
+#ifndef MOOST_KVDS_KVDS_COMPRESS_HPP__
+#define MOOST_KVDS_KVDS_COMPRESS_HPP__
+
+namespace moost { namespace kvds {
+
+   /// *** This class is NOT thread safe ***
+
+   class KvdsCompress : public IKvds
+   {
+   public:
+      typedef boost::shared_ptr<IKvds> store_ptr_t;
+
+      struct options
+      {
+         options()
+            : threshold(64)
+            , level(Z_DEFAULT_COMPRESSION)
+            , integer_values(false)
+         {
+         }
+
+         /// values shorter than this many bytes are stored uncompressed
+         size_t threshold;
+
+         /// zlib compression level, 1 (fast) to 9 (small), 0 disables deflate
+         int level;
+
+         /// delta-varint encode values whose size is a multiple of 4 bytes
+         bool integer_values;
+
+         /// preset dictionary, see train_dictionary()
+         std::string dictionary;
+      };
+
+      struct compress_stats
+      {
+         compress_stats()
+            : raw_bytes(0), stored_bytes(0), encodes(0), decodes(0)
+            , encode_ns(0), decode_ns(0), skipped(0)
+         {
+         }
+
+         /// raw bytes per stored byte, 0 if nothing has been written yet
+         double ratio() const
+         {
+            return stored_bytes > 0 ? double(raw_bytes)/stored_bytes : 0.0;
+         }
+
+         double encode_ns_per_value() const { return encodes > 0 ? double(encode_ns)/encodes : 0.0; }
+         double decode_ns_per_value() const { return decodes > 0 ? double(decode_ns)/decodes : 0.0; }
+
+         /// throughput of the compressor in raw MB/s
+         double encode_mb_per_sec() const
+         {
+            return encode_ns > 0 ? 1e3*raw_bytes/encode_ns : 0.0;
+         }
+
+         void write(std::ostream & os) const
+         {
+            os << "ratio " << ratio()
+               << " raw_bytes " << raw_bytes
+               << " stored_bytes " << stored_bytes
+               << " skipped " << skipped
+               << " encode_ns/value " << encode_ns_per_value()
+               << " decode_ns/value " << decode_ns_per_value()
+               << " encode_mb/s " << encode_mb_per_sec()
+               << "\n";
+         }
+
+         boost::int64_t raw_bytes;
+         boost::int64_t stored_bytes;
+         boost::int64_t encodes;
+         boost::int64_t decodes;
+         boost::int64_t encode_ns;
+         boost::int64_t decode_ns;
+         boost::int64_t skipped;
+      };
+
+      KvdsCompress(store_ptr_t store, std::string const & name, options const & opt = options())
+         : store_(store)
+         , opt_(opt)
+         , dict_id_(0)
+         , deflate_ready_(false)
+         , inflate_ready_(false)
+         , raw_bytes_(metric_counter(name, "raw_bytes"))
+         , stored_bytes_(metric_counter(name, "stored_bytes"))
+         , encodes_(metric_counter(name, "encodes"))
+         , decodes_(metric_counter(name, "decodes"))
+         , encode_ns_(metric_counter(name, "encode_ns"))
+         , decode_ns_(metric_counter(name, "decode_ns"))
+         , skipped_(metric_counter(name, "skipped"))
+      {
+         if(!store_) { throw std::runtime_error("KvdsCompress cannot decorate a null ikvds"); }
+         if(opt_.level < Z_DEFAULT_COMPRESSION || opt_.level > Z_BEST_COMPRESSION)
+         {
+            throw std::runtime_error("KvdsCompress: invalid compression level");
+         }
+
+         if(has_dictionary())
+         {
+            dict_id_ = adler32(adler32(0L, Z_NULL, 0), dict_data(), static_cast<uInt>(opt_.dictionary.size()));
+         }
+
+         memset(&deflate_, 0, sizeof(deflate_));
+         memset(&inflate_, 0, sizeof(inflate_));
+      }
+
+      ~KvdsCompress()
+      {
+         if(deflate_ready_) { deflateEnd(&deflate_); }
+         if(inflate_ready_) { inflateEnd(&inflate_); }
+      }
+
+      /// the decorated store
+      IKvds & get_store() { return *store_; }
+
+      options const & get_options() const { return opt_; }
+
+      /// the compression figures of all stores using this name
+      compress_stats stats() const
+      {
+         compress_stats s;
+         s.raw_bytes = raw_bytes_.value();
+         s.stored_bytes = stored_bytes_.value();
+         s.encodes = encodes_.value();
+         s.decodes = decodes_.value();
+         s.encode_ns = encode_ns_.value();
+         s.decode_ns = decode_ns_.value();
+         s.skipped = skipped_.value();
+         return s;
+      }
+
+      /// Builds a preset dictionary from sample values. Substrings that are
+      /// common across the samples are collected, and the most common ones
+      /// end up at the end of the dictionary, where deflate finds them with
+      /// the shortest distances.
+      static std::string train_dictionary(
+         std::vector<std::string> const & samples, size_t const max_size = 16384,
+         size_t const ngram = 8
+         )
+      {
+         typedef std::map<std::string, size_t> count_map_t;
+         count_map_t counts;
+
+         for(size_t i = 0; i < samples.size(); ++i)
+         {
+            std::string const & s = samples[i];
+
+            for(size_t pos = 0; pos + ngram <= s.size(); ++pos)
+            {
+               ++counts[s.substr(pos, ngram)];
+            }
+         }
+
+         std::vector< std::pair<size_t, std::string> > ranked;
+
+         for(count_map_t::const_iterator it = counts.begin(); it != counts.end(); ++it)
+         {
+            if(it->second > 1)
+            {
+               ranked.push_back(std::make_pair(it->second, it->first));
+            }
+         }
+
+         // most common first, so we keep those if we run out of space
+         std::sort(ranked.rbegin(), ranked.rend());
+
+         std::vector<std::string const *> chosen;
+         size_t size = 0;
+
+         for(size_t i = 0; i < ranked.size() && size + ngram <= max_size; ++i)
+         {
+            chosen.push_back(&ranked[i].second);
+            size += ngram;
+         }
+
+         std::string dict;
+         dict.reserve(size);
+
+         for(size_t i = chosen.size(); i-- > 0; )
+         {
+            dict += *chosen[i];
+         }
+
+         return dict;
+      }
+
+   public:
+      // IKvds interface implementation
+
+      bool put(
+         void const * pkey, size_t const ksize,
+         void const * pval, size_t const vsize
+         )
+      {
+         encode(static_cast<char const *>(pval), vsize);
+         return store_->put(pkey, ksize, stored_.empty() ? 0 : &stored_[0], stored_.size());
+      }
+
+      bool get(
+         void const * pkey, size_t const ksize,
+         void * pval, size_t & vsize
+         )
+      {
+         if(!fetch(pkey, ksize))
+         {
+            vsize = 0;
+            return false;
+         }
+
+         decode();
+
+         vsize = std::min(vsize, raw_.size());
+
+         if(vsize > 0)
+         {
+            memcpy(pval, &raw_[0], vsize);
+         }
+
+         return true;
+      }
+
+      bool add(
+         void const * pkey, size_t const ksize,
+         void const * pval, size_t const vsize
+         )
+      {
+         if(fetch(pkey, ksize))
+         {
+            decode();
+         }
+         else
+         {
+            raw_.clear();
+         }
+
+         raw_.insert(raw_.end(), static_cast<char const *>(pval), static_cast<char const *>(pval) + vsize);
+         encode(raw_.empty() ? 0 : &raw_[0], raw_.size());
+
+         return store_->put(pkey, ksize, stored_.empty() ? 0 : &stored_[0], stored_.size());
+      }
+
+      bool all(
+         void const * pkey, size_t const ksize,
+         void * pval, size_t & vsize
+         )
+      {
+         if(!fetch(pkey, ksize))
+         {
+            vsize = 0;
+            return false;
+         }
+
+         decode();
+
+         bool const fits = raw_.size() <= vsize;
+
+         if(fits && !raw_.empty())
+         {
+            memcpy(pval, &raw_[0], raw_.size());
+         }
+
+         vsize = raw_.size();
+
+         return fits;
+      }
+
+      bool xst(
+         void const * pkey, size_t const ksize
+         )
+      {
+         return store_->xst(pkey, ksize);
+      }
+
+      bool del(
+         void const * pkey, size_t const ksize
+         )
+      {
+         return store_->del(pkey, ksize);
+      }
+
+      bool clr()
+      {
+         return store_->clr();
+      }
+
+      bool beg()
+      {
+         return store_->beg();
+      }
+
+      bool nxt(
+         void * pkey, size_t & ksize
+         )
+      {
+         return store_->nxt(pkey, ksize);
+      }
+
+      bool end()
+      {
+         return store_->end();
+      }
+
+      bool siz(
+         void const * pkey, size_t const ksize,
+         size_t & vsize
+         )
+      {
+         // the uncompressed size is in the header, so there's no need to
+         // read (let alone decompress) the whole value
+         char head[max_size_header + vle_slack] = { 0 };
+         size_t hsize = max_size_header;
+
+         if(!store_->get(pkey, ksize, head, hsize))
+         {
+            return false;
+         }
+
+         char const * p = head;
+         read_header(p, head + hsize, vsize);
+
+         return true;
+      }
+
+      bool cnt(boost::uint64_t & cnt)
+      {
+         return store_->cnt(cnt);
+      }
+
+      bool nil(bool & isnil)
+      {
+         return store_->nil(isnil);
+      }
+
+   private:
+      enum
+      {
+         flag_deflate = 0x01,
+         flag_delta_varint = 0x02,
+         flag_dictionary = 0x04,
+         known_flags = 0x07
+      };
+
+      enum
+      {
+         max_size_header = 1 + 5,   // flags, varint raw size
+         max_header = max_size_header + 4,   // dictionary checksum
+         vle_slack = 5,   // a varint never reads more than this past its start
+         initial_fetch = 256
+      };
+
+      static metrics::counter & metric_counter(std::string const & name, char const * what)
+      {
+         return metrics::get_counter(metrics::make_name("kvds", name) + ".compress." + what);
+      }
+
+      bool has_dictionary() const
+      {
+         return !opt_.dictionary.empty();
+      }
+
+      Bytef const * dict_data() const
+      {
+         return reinterpret_cast<Bytef const *>(opt_.dictionary.data());
+      }
+
+      /// reads the flag byte and raw size, returns the flags
+      static int read_header(char const * & p, char const * end, size_t & raw_size)
+      {
+         if(end - p < 2)
+         {
+            throw std::runtime_error("KvdsCompress: value header is truncated");
+         }
+
+         int const flags = static_cast<unsigned char>(*p++);
+
+         if(flags & ~known_flags)
+         {
+            throw std::runtime_error("KvdsCompress: value was not written by KvdsCompress");
+         }
+
+         // callers leave vle_slack zero bytes after end, so this can't overrun
+         raw_size = static_cast<boost::uint32_t>(algorithm::variable_length_encoding::read(p));
+
+         if(p > end)
+         {
+            throw std::runtime_error("KvdsCompress: value header is truncated");
+         }
+
+         return flags;
+      }
+
+      /// reads the whole stored value of a key into stored_
+      bool fetch(void const * pkey, size_t const ksize)
+      {
+         // most values fit into the buffer we've already got, so try a
+         // single partial read first and only ask for the size if it's full
+         stored_.resize(std::max<size_t>(stored_.capacity(), initial_fetch));
+         size_t vsize = stored_.size();
+
+         if(!store_->get(pkey, ksize, &stored_[0], vsize))
+         {
+            return false;
+         }
+
+         if(vsize == stored_.size())
+         {
+            size_t full = 0;
+
+            if(!store_->siz(pkey, ksize, full))
+            {
+               return false;
+            }
+
+            if(full > vsize)
+            {
+               stored_.resize(full);
+               vsize = full;
+
+               if(!store_->all(pkey, ksize, &stored_[0], vsize))
+               {
+                  return false;
+               }
+            }
+         }
+
+         stored_.resize(vsize);
+
+         return true;
+      }
+
+      /// compresses [p, p + size) into stored_
+      void encode(char const * p, size_t const size)
+      {
+         if(size > 0xFFFFFFFFUL)
+         {
+            throw std::runtime_error("KvdsCompress: values must be smaller than 4GB");
+         }
+
+         raw_bytes_ += size;
+
+         int flags = 0;
+
+         stored_.clear();
+         stored_.reserve(max_header + size);
+         std::back_insert_iterator< std::vector<char> > out(stored_);
+
+         // an empty value can't get any smaller, so it never reaches the codecs
+         if(size > 0 && size >= opt_.threshold && (opt_.level != 0 || (opt_.integer_values && size % 4 == 0)))
+         {
+            ++encodes_;
+            boost::uint64_t const start = utils::monotonic_clock::now_ns();
+
+            char const * payload = p;
+            size_t payload_size = size;
+
+            if(opt_.integer_values && size % 4 == 0)
+            {
+               delta_varint_encode(p, size, varint_);
+               flags |= flag_delta_varint;
+               payload = varint_.empty() ? 0 : &varint_[0];
+               payload_size = varint_.size();
+            }
+
+            bool const use_deflate = opt_.level != 0 && payload_size >= opt_.threshold;
+
+            if(use_deflate && deflate_value(payload, payload_size, deflated_))
+            {
+               flags |= flag_deflate;
+               payload = &deflated_[0];
+               payload_size = deflated_.size();
+
+               if(has_dictionary())
+               {
+                  flags |= flag_dictionary;
+               }
+            }
+
+            if(payload_size < size)
+            {
+               encode_ns_ += utils::monotonic_clock::now_ns() - start;
+
+               *out++ = static_cast<char>(flags);
+               algorithm::variable_length_encoding::write(static_cast<boost::int32_t>(size), out);
+
+               if(flags & flag_dictionary)
+               {
+                  for(int shift = 0; shift < 32; shift += 8)
+                  {
+                     *out++ = static_cast<char>(dict_id_ >> shift);
+                  }
+               }
+
+               stored_.insert(stored_.end(), payload, payload + payload_size);
+               stored_bytes_ += stored_.size();
+
+               return;
+            }
+
+            encode_ns_ += utils::monotonic_clock::now_ns() - start;
+         }
+
+         // too small to bother, or didn't get any smaller
+         ++skipped_;
+
+         *out++ = 0;
+         algorithm::variable_length_encoding::write(static_cast<boost::int32_t>(size), out);
+
+         if(size > 0)
+         {
+            stored_.insert(stored_.end(), p, p + size);
+         }
+
+         stored_bytes_ += stored_.size();
+      }
+
+      /// decompresses stored_ into raw_
+      void decode()
+      {
+         size_t const stored_size = stored_.size();
+         stored_.resize(stored_size + vle_slack, 0);
+
+         char const * p = &stored_[0];
+         char const * end = p + stored_size;
+
+         size_t raw_size = 0;
+         int const flags = read_header(p, end, raw_size);
+
+         if(flags == 0)
+         {
+            if(size_t(end - p) != raw_size)
+            {
+               throw std::runtime_error("KvdsCompress: stored value has the wrong size");
+            }
+
+            raw_.assign(p, end);
+            stored_.resize(stored_size);
+
+            return;
+         }
+
+         boost::uint64_t const start = utils::monotonic_clock::now_ns();
+
+         if(flags & flag_dictionary)
+         {
+            if(end - p < 4)
+            {
+               throw std::runtime_error("KvdsCompress: value header is truncated");
+            }
+
+            uLong id = 0;
+
+            for(int shift = 0; shift < 32; shift += 8)
+            {
+               id |= uLong(static_cast<unsigned char>(*p++)) << shift;
+            }
+
+            if(id != dict_id_)
+            {
+               throw std::runtime_error("KvdsCompress: value was compressed with a different dictionary");
+            }
+         }
+
+         if(flags & flag_delta_varint)
+         {
+            if(flags & flag_deflate)
+            {
+               // the varint stream is at most 5 bytes per integer
+               inflate_value(p, end - p, (raw_size/4)*5, flags & flag_dictionary, varint_);
+               varint_.resize(varint_.size() + vle_slack, 0);
+               delta_varint_decode(&varint_[0], &varint_[0] + varint_.size() - vle_slack, raw_size, raw_);
+            }
+            else
+            {
+               delta_varint_decode(p, end, raw_size, raw_);
+            }
+         }
+         else
+         {
+            inflate_value(p, end - p, raw_size, flags & flag_dictionary, raw_);
+
+            if(raw_.size() != raw_size)
+            {
+               throw std::runtime_error("KvdsCompress: stored value has the wrong size");
+            }
+         }
+
+         stored_.resize(stored_size);
+
+         ++decodes_;
+         decode_ns_ += utils::monotonic_clock::now_ns() - start;
+      }
+
+      static void delta_varint_encode(char const * p, size_t const size, std::vector<char> & out)
+      {
+         out.clear();
+         out.reserve(size + size/4);
+         std::back_insert_iterator< std::vector<char> > it(out);
+
+         boost::uint32_t prev = 0;
+
+         for(char const * end = p + size; p != end; p += 4)
+         {
+            boost::uint32_t v;
+            memcpy(&v, p, 4);
+
+            // zigzag the difference so that small negative steps stay small
+            boost::uint32_t const delta = v - prev;
+            boost::uint32_t const zz = (delta << 1) ^ (0U - (delta >> 31));
+            algorithm::variable_length_encoding::write(static_cast<boost::int32_t>(zz), it);
+
+            prev = v;
+         }
+      }
+
+      /// [p, end) must be followed by vle_slack readable bytes
+      static void delta_varint_decode(char const * p, char const * end, size_t const raw_size, std::vector<char> & out)
+      {
+         out.resize(raw_size);
+
+         boost::uint32_t prev = 0;
+
+         for(size_t i = 0; i < raw_size; i += 4)
+         {
+            if(p >= end)
+            {
+               throw std::runtime_error("KvdsCompress: integer list is truncated");
+            }
+
+            boost::uint32_t const zz = static_cast<boost::uint32_t>(algorithm::variable_length_encoding::read(p));
+            boost::uint32_t const delta = (zz >> 1) ^ (0U - (zz & 1));
+
+            prev += delta;
+            memcpy(&out[i], &prev, 4);
+         }
+
+         if(p != end)
+         {
+            throw std::runtime_error("KvdsCompress: integer list has the wrong size");
+         }
+      }
+
+      /// returns false if the value didn't get any smaller
+      bool deflate_value(char const * p, size_t const size, std::vector<char> & out)
+      {
+         if(size == 0)
+         {
+            return false;
+         }
+
+         if(!deflate_ready_)
+         {
+            if(deflateInit2(&deflate_, opt_.level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            {
+               throw std::runtime_error("KvdsCompress: deflateInit2 failed");
+            }
+
+            deflate_ready_ = true;
+         }
+         else if(deflateReset(&deflate_) != Z_OK)
+         {
+            throw std::runtime_error("KvdsCompress: deflateReset failed");
+         }
+
+         if(has_dictionary() &&
+            deflateSetDictionary(&deflate_, dict_data(), static_cast<uInt>(opt_.dictionary.size())) != Z_OK)
+         {
+            throw std::runtime_error("KvdsCompress: deflateSetDictionary failed");
+         }
+
+         // no point in producing more than we started with
+         out.resize(size);
+
+         deflate_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(p));
+         deflate_.avail_in = static_cast<uInt>(size);
+         deflate_.next_out = reinterpret_cast<Bytef *>(&out[0]);
+         deflate_.avail_out = static_cast<uInt>(out.size());
+
+         int const rv = deflate(&deflate_, Z_FINISH);
+
+         if(rv == Z_STREAM_END)
+         {
+            out.resize(out.size() - deflate_.avail_out);
+            return true;
+         }
+
+         if(rv == Z_OK || rv == Z_BUF_ERROR)
+         {
+            return false;
+         }
+
+         throw std::runtime_error("KvdsCompress: deflate failed");
+      }
+
+      void inflate_value(char const * p, size_t const size, size_t const max_size, bool with_dict, std::vector<char> & out)
+      {
+         if(!inflate_ready_)
+         {
+            if(inflateInit2(&inflate_, -15) != Z_OK)
+            {
+               throw std::runtime_error("KvdsCompress: inflateInit2 failed");
+            }
+
+            inflate_ready_ = true;
+         }
+         else if(inflateReset(&inflate_) != Z_OK)
+         {
+            throw std::runtime_error("KvdsCompress: inflateReset failed");
+         }
+
+         if(with_dict &&
+            inflateSetDictionary(&inflate_, dict_data(), static_cast<uInt>(opt_.dictionary.size())) != Z_OK)
+         {
+            throw std::runtime_error("KvdsCompress: inflateSetDictionary failed");
+         }
+
+         out.resize(std::max<size_t>(max_size, 1));
+
+         inflate_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(p));
+         inflate_.avail_in = static_cast<uInt>(size);
+         inflate_.next_out = reinterpret_cast<Bytef *>(&out[0]);
+         inflate_.avail_out = static_cast<uInt>(out.size());
+
+         if(inflate(&inflate_, Z_FINISH) != Z_STREAM_END)
+         {
+            throw std::runtime_error("KvdsCompress: stored value is corrupt");
+         }
+
+         out.resize(out.size() - inflate_.avail_out);
+      }
+
+      store_ptr_t store_;
+      options const opt_;
+      uLong dict_id_;
+
+      z_stream deflate_;
+      z_stream inflate_;
+      bool deflate_ready_;
+      bool inflate_ready_;
+
+      std::vector<char> stored_;
+      std::vector<char> raw_;
+      std::vector<char> varint_;
+      std::vector<char> deflated_;
+
+      metrics::counter & raw_bytes_;
+      metrics::counter & stored_bytes_;
+      metrics::counter & encodes_;
+      metrics::counter & decodes_;
+      metrics::counter & encode_ns_;
+      metrics::counter & decode_ns_;
+      metrics::counter & skipped_;
+   };
+
+}}
+
+#endif /// MOOST_KVDS_KVDS_COMPRESS_HPP__
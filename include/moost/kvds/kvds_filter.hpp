@@ -0,0 +1,651 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/// \file
+/// Decorates any ikvds with an in-memory filter of the keys it holds, so
+/// that lookups for keys that aren't there are answered without touching
+/// the store. get(), all(), siz() and xst() only reach the decorated store
+/// if the filter says the key may be present.
+///
+/// The filter is a cuckoo filter (see container/cuckoo_filter.hpp) of key
+/// hashes; unlike a Bloom filter it supports removal, so it's kept exact
+/// across put() and del() rather than slowly filling up with deleted keys.
+/// It's built by scanning all keys of the store when the decorator is
+/// created, or loaded from a sidecar file written by a previous instance:
+///
+///    KvdsFilter::options opt;
+///    opt.sidecar = "/data/user_tags.kvds.filter";
+///    ikvds_ptr_t store(new KvdsFilter(ikvds_ptr_t(new KvdsTch(...)), "user_tags", opt));
+///
+/// The sidecar is written by save() and when the decorator is destroyed,
+/// and removed by the first put(), add(), del() or clr() after that (or
+/// after the decorator was created), so a process that dies with writes
+/// the sidecar doesn't know about leaves none behind. A sidecar is also
+/// only trusted if the number of keys it holds matches the cnt() of the
+/// store; otherwise (or if it can't be read) the filter is rebuilt. That
+/// can't spot writes made without the decorator that leave the count as
+/// it was, so whatever writes to the store behind its back must remove
+/// the sidecar.
+///
+/// Every lookup that gets past the filter but misses in the store is a
+/// false positive. Once the observed false positive rate over the last
+/// min_samples misses exceeds max_fpr, the filter is rebuilt with twice
+/// as much room, which roughly halves its false positive rate. It's also
+/// rebuilt (and grown) if it runs out of room for new keys. A rebuild
+/// scans the store, so one that's due while an iteration (beg()/nxt()) is
+/// in progress waits until the iteration is over.
+///
+/// put() and del() of keys the filter may already hold cost an extra
+/// xst() on the store, so that each key is in the filter exactly once.
+///
+/// Metrics, registered under "kvds.<name>.filter.":
+///
+///    negatives         lookups answered from the filter alone
+///    false_positives   lookups that got past the filter but missed
+///    rebuilds          times the filter was (re)built from a key scan
+///    keys / bytes      keys in the filter, memory used by the filter
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cerrno>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/cstdint.hpp>
+
+#include "ikvds.hpp"
+#include "../container/cuckoo_filter.hpp"
+#include "../hash/murmur3.hpp"
+#include "../metrics/registry.hpp"
+
+#ifndef MOOST_KVDS_KVDS_FILTER_HPP__
+#define MOOST_KVDS_KVDS_FILTER_HPP__
+
+namespace moost { namespace kvds {
+
+   /// *** This class is NOT thread safe ***
+
+   class KvdsFilter : public IKvds
+   {
+   public:
+      typedef boost::shared_ptr<IKvds> store_ptr_t;
+      typedef moost::container::cuckoo_filter<boost::uint64_t> filter_t;
+
+      struct options
+      {
+         options()
+            : expected_items(1024)
+            , fpr(0.01)
+            , max_fpr(0.05)
+            , min_samples(10000)
+            , headroom(1.5)
+         {
+         }
+
+         /// keys to size the filter for at least; it's made larger if the
+         /// store holds more when it's built
+         size_t expected_items;
+
+         /// target false positive rate of a freshly built filter
+         double fpr;
+
+         /// rebuild once the observed false positive rate exceeds this
+         double max_fpr;
+
+         /// misses to observe before the false positive rate is judged
+         size_t min_samples;
+
+         /// room for growth when the filter is sized for the keys in the store
+         double headroom;
+
+         /// file to load the filter from and save it to, empty for none
+         std::string sidecar;
+      };
+
+      KvdsFilter(store_ptr_t store, std::string const & name, options const & opt = options())
+         : store_(store)
+         , opt_(opt)
+         , iterating_(false)
+         , bypass_(false)
+         , grow_(false)
+         , sidecar_written_(!opt.sidecar.empty())
+         , window_negatives_(0)
+         , window_false_positives_(0)
+         , negatives_(metric_counter(name, "negatives"))
+         , false_positives_(metric_counter(name, "false_positives"))
+         , rebuilds_(metric_counter(name, "rebuilds"))
+         , keys_gauge_(metrics::get_gauge(metric_name(name, "keys")))
+         , bytes_gauge_(metrics::get_gauge(metric_name(name, "bytes")))
+      {
+         if(!store_) { throw std::runtime_error("KvdsFilter cannot decorate a null ikvds"); }
+         if(!(opt_.fpr > 0.0 && opt_.fpr < 1.0)) { throw std::runtime_error("KvdsFilter: fpr must be in (0, 1)"); }
+         if(opt_.headroom < 1.0) { throw std::runtime_error("KvdsFilter: headroom must be at least 1"); }
+
+         if(!load())
+         {
+            rebuild();
+         }
+      }
+
+      ~KvdsFilter()
+      {
+         try
+         {
+            save();
+         }
+         catch(...)
+         {
+         }
+      }
+
+      /// the decorated store
+      IKvds & get_store() { return *store_; }
+
+      options const & get_options() const { return opt_; }
+
+      /// the filter, for inspection
+      filter_t const & get_filter() const { return *filter_; }
+
+      /// false positive rate observed since the filter was last (re)built
+      double observed_fpr() const
+      {
+         boost::uint64_t const misses = window_negatives_ + window_false_positives_;
+         return misses > 0 ? double(window_false_positives_)/misses : 0.0;
+      }
+
+      /// Rebuilds the filter from a scan of all keys in the store. This is
+      /// needed if the store was modified other than through this class.
+      void rebuild()
+      {
+         size_t items = opt_.expected_items;
+         boost::uint64_t count = 0;
+
+         if(store_->cnt(count))
+         {
+            items = std::max(items, static_cast<size_t>(count*opt_.headroom));
+         }
+
+         if(filter_ && grow_)
+         {
+            items = std::max(items, doubled(*filter_));
+         }
+
+         for(;;)
+         {
+            boost::scoped_ptr<filter_t> filter(new filter_t(items, opt_.fpr));
+
+            if(fill(*filter))
+            {
+               filter_.swap(filter);
+               break;
+            }
+
+            // more keys than cnt() let on
+            items = doubled(*filter);
+         }
+
+         bypass_ = false;
+         grow_ = false;
+         window_negatives_ = 0;
+         window_false_positives_ = 0;
+         ++rebuilds_;
+         update_gauges();
+      }
+
+      /// Writes the filter to the sidecar file, if there is one. The file
+      /// is replaced atomically.
+      void save()
+      {
+         if(opt_.sidecar.empty() || bypass_)
+         {
+            return;
+         }
+
+         filter_t::serial_buffer_t buf;
+         filter_->serialize(buf);
+
+         std::string const tmp = opt_.sidecar + ".tmp";
+
+         {
+            std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<char const *>(&buf[0]), buf.size());
+
+            if(!out)
+            {
+               throw std::runtime_error("KvdsFilter: cannot write " + tmp);
+            }
+         }
+
+         if(std::rename(tmp.c_str(), opt_.sidecar.c_str()) != 0)
+         {
+            throw std::runtime_error("KvdsFilter: cannot rename " + tmp);
+         }
+
+         sidecar_written_ = true;
+      }
+
+   public:
+      // IKvds interface implementation
+
+      bool put(
+         void const * pkey, size_t const ksize,
+         void const * pval, size_t const vsize
+         )
+      {
+         iterating_ = false;
+         invalidate_sidecar();
+         bool const known = may_exist(pkey, ksize) && store_->xst(pkey, ksize);
+
+         if(!store_->put(pkey, ksize, pval, vsize))
+         {
+            return false;
+         }
+
+         if(!known)
+         {
+            insert(pkey, ksize);
+         }
+
+         return true;
+      }
+
+      bool get(
+         void const * pkey, size_t const ksize,
+         void * pval, size_t & vsize
+         )
+      {
+         if(!lookup(pkey, ksize))
+         {
+            vsize = 0;
+            return false;
+         }
+
+         return observe(store_->get(pkey, ksize, pval, vsize));
+      }
+
+      bool add(
+         void const * pkey, size_t const ksize,
+         void const * pval, size_t const vsize
+         )
+      {
+         iterating_ = false;
+         invalidate_sidecar();
+         bool const known = may_exist(pkey, ksize) && store_->xst(pkey, ksize);
+
+         if(!store_->add(pkey, ksize, pval, vsize))
+         {
+            return false;
+         }
+
+         if(!known)
+         {
+            insert(pkey, ksize);
+         }
+
+         return true;
+      }
+
+      bool all(
+         void const * pkey, size_t const ksize,
+         void * pval, size_t & vsize
+         )
+      {
+         if(!lookup(pkey, ksize))
+         {
+            vsize = 0;
+            return false;
+         }
+
+         // a value that doesn't fit fails too, but the key was there
+         size_t const capacity = vsize;
+         bool const found = store_->all(pkey, ksize, pval, vsize);
+         observe(found || vsize > capacity);
+
+         return found;
+      }
+
+      bool xst(
+         void const * pkey, size_t const ksize
+         )
+      {
+         return lookup(pkey, ksize) && observe(store_->xst(pkey, ksize));
+      }
+
+      bool del(
+         void const * pkey, size_t const ksize
+         )
+      {
+         iterating_ = false;
+
+         if(!lookup(pkey, ksize))
+         {
+            return false;
+         }
+
+         invalidate_sidecar();
+
+         // only keys known to be in the store may come out of the filter,
+         // or we'd remove the fingerprint of some other key
+         bool const known = store_->xst(pkey, ksize);
+
+         if(!store_->del(pkey, ksize))
+         {
+            return false;
+         }
+
+         if(known && !bypass_)
+         {
+            filter_->erase(key_hash(pkey, ksize));
+            update_gauges();
+         }
+
+         return true;
+      }
+
+      bool clr()
+      {
+         iterating_ = false;
+         invalidate_sidecar();
+
+         if(!store_->clr())
+         {
+            return false;
+         }
+
+         filter_->clear();
+         bypass_ = false;
+         update_gauges();
+
+         return true;
+      }
+
+      bool beg()
+      {
+         iterating_ = store_->beg();
+         return iterating_;
+      }
+
+      bool nxt(
+         void * pkey, size_t & ksize
+         )
+      {
+         size_t const capacity = ksize;
+         bool const ok = store_->nxt(pkey, ksize);
+
+         // a short buffer doesn't end the iteration
+         if(!ok && ksize <= capacity)
+         {
+            iterating_ = false;
+            maybe_rebuild();
+         }
+
+         return ok;
+      }
+
+      bool end()
+      {
+         return store_->end();
+      }
+
+      bool siz(
+         void const * pkey, size_t const ksize,
+         size_t & vsize
+         )
+      {
+         return lookup(pkey, ksize) && observe(store_->siz(pkey, ksize, vsize));
+      }
+
+      bool cnt(boost::uint64_t & cnt)
+      {
+         return store_->cnt(cnt);
+      }
+
+      bool nil(bool & isnil)
+      {
+         return store_->nil(isnil);
+      }
+
+   private:
+      static std::string metric_name(std::string const & name, char const * what)
+      {
+         return metrics::make_name("kvds", name) + ".filter." + what;
+      }
+
+      static metrics::counter & metric_counter(std::string const & name, char const * what)
+      {
+         return metrics::get_counter(metric_name(name, what));
+      }
+
+      static boost::uint64_t key_hash(void const * pkey, size_t const ksize)
+      {
+         // the filter needs more than 32 bits: the upper half picks the
+         // bucket, the lower half the fingerprint
+         return (boost::uint64_t(moost::hash::murmur3::compute32(pkey, ksize, 0x9747b28c)) << 32) |
+                moost::hash::murmur3::compute32(pkey, ksize, 0x5bd1e995);
+      }
+
+      /// items that fit in twice the room of the given filter
+      static size_t doubled(filter_t const & filter)
+      {
+         return static_cast<size_t>(2*filter.size()*filter_t::MAX_LOAD_FACTOR());
+      }
+
+      bool may_exist(void const * pkey, size_t const ksize) const
+      {
+         return bypass_ || filter_->find(key_hash(pkey, ksize));
+      }
+
+      /// false if the key definitely isn't in the store
+      bool lookup(void const * pkey, size_t const ksize)
+      {
+         if(may_exist(pkey, ksize))
+         {
+            return true;
+         }
+
+         ++negatives_;
+         ++window_negatives_;
+
+         return false;
+      }
+
+      /// records the outcome of a lookup that got past the filter
+      bool observe(bool const found)
+      {
+         if(!found && !bypass_)
+         {
+            ++false_positives_;
+            ++window_false_positives_;
+
+            if(window_negatives_ + window_false_positives_ >= opt_.min_samples)
+            {
+               if(observed_fpr() > opt_.max_fpr)
+               {
+                  grow_ = true;
+                  maybe_rebuild();
+               }
+               else
+               {
+                  window_negatives_ = 0;
+                  window_false_positives_ = 0;
+               }
+            }
+         }
+
+         return found;
+      }
+
+      void insert(void const * pkey, size_t const ksize)
+      {
+         if(bypass_)
+         {
+            return;
+         }
+
+         if(!filter_->insert(key_hash(pkey, ksize)))
+         {
+            // the key isn't in the filter, so it can't be trusted until
+            // it's been rebuilt
+            bypass_ = true;
+            grow_ = true;
+            maybe_rebuild();
+         }
+
+         update_gauges();
+      }
+
+      void maybe_rebuild()
+      {
+         if(grow_ && !iterating_)
+         {
+            rebuild();
+         }
+      }
+
+      /// adds all keys in the store to the filter, false if it got full
+      bool fill(filter_t & filter)
+      {
+         std::vector<char> key(256);
+
+         if(!store_->beg())
+         {
+            return true;
+         }
+
+         for(;;)
+         {
+            size_t ksize = key.size();
+
+            if(!store_->nxt(&key[0], ksize))
+            {
+               if(ksize <= key.size())
+               {
+                  break;
+               }
+
+               key.resize(ksize);
+               continue;
+            }
+
+            if(!filter.insert(key_hash(&key[0], ksize)))
+            {
+               return false;
+            }
+         }
+
+         return true;
+      }
+
+      bool load()
+      {
+         if(opt_.sidecar.empty())
+         {
+            return false;
+         }
+
+         std::ifstream in(opt_.sidecar.c_str(), std::ios::binary);
+
+         if(!in)
+         {
+            return false;
+         }
+
+         filter_t::serial_buffer_t buf(
+            (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+         boost::scoped_ptr<filter_t> filter(new filter_t(1, opt_.fpr));
+
+         try
+         {
+            filter->deserialize(buf);
+         }
+         catch(std::exception const &)
+         {
+            return false;
+         }
+
+         // stale if the store was written to without us
+         boost::uint64_t count = 0;
+
+         if(!store_->cnt(count) || count != filter->count())
+         {
+            return false;
+         }
+
+         filter_.swap(filter);
+         update_gauges();
+
+         return true;
+      }
+
+      /// removes the sidecar before the store is first written to, as it
+      /// wouldn't know about the write if we died before the next save()
+      void invalidate_sidecar()
+      {
+         if(!sidecar_written_)
+         {
+            return;
+         }
+
+         if(std::remove(opt_.sidecar.c_str()) != 0 && errno != ENOENT)
+         {
+            throw std::runtime_error("KvdsFilter: cannot remove " + opt_.sidecar);
+         }
+
+         sidecar_written_ = false;
+      }
+
+      void update_gauges()
+      {
+         keys_gauge_.set(static_cast<boost::int64_t>(filter_->count()));
+         bytes_gauge_.set(static_cast<boost::int64_t>(filter_->memory()));
+      }
+
+   private:
+      store_ptr_t store_;
+      options const opt_;
+      boost::scoped_ptr<filter_t> filter_;
+      bool iterating_;
+      bool bypass_;
+      bool grow_;
+      bool sidecar_written_;   // the sidecar on disk may need removing before a write
+      boost::uint64_t window_negatives_;
+      boost::uint64_t window_false_positives_;
+      metrics::counter & negatives_;
+      metrics::counter & false_positives_;
+      metrics::counter & rebuilds_;
+      metrics::gauge & keys_gauge_;
+      metrics::gauge & bytes_gauge_;
+   };
+
+}}
+
+#endif /// MOOST_KVDS_KVDS_FILTER_HPP__
@@ -0,0 +1,257 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/// \file
+/// Decorates any ikvds with metrics: the number of calls to each operation,
+/// hits and misses for lookups and the latency of reads and writes. The
+/// metrics are registered with moost::metrics under "kvds.<name>." so they
+/// can be looked at from the remote shell with "metrics dump kvds.<name>".
+///
+/// Stores decorated with the same name share their metrics.
+///
+///    ikvds_ptr_t store(new KvdsMetrics(ikvds_ptr_t(new KvdsTch), "users"));
+///
+/// Metrics:
+///
+///    kvds.<name>.get.hits / .misses     get(), all(), xst() and siz() results
+///    kvds.<name>.put / .add / .del      write operations
+///    kvds.<name>.errors                 operations that threw
+///    kvds.<name>.read_us / .write_us    latency histograms
+
+#include <string>
+#include <stdexcept>
+
+#include <boost/shared_ptr.hpp>
+
+#include "ikvds.hpp"
+#include "../metrics/registry.hpp"
+
+#ifndef MOOST_KVDS_KVDS_METRICS_HPP__
+#define MOOST_KVDS_KVDS_METRICS_HPP__
+
+namespace moost { namespace kvds {
+
+   /// *** This class is as thread safe as the store it decorates ***
+
+   class KvdsMetrics : public IKvds
+   {
+   public:
+      typedef boost::shared_ptr<IKvds> store_ptr_t;
+
+      KvdsMetrics(store_ptr_t store, std::string const & name)
+         : store_(store)
+         , hits_(metric_counter(name, "get.hits"))
+         , misses_(metric_counter(name, "get.misses"))
+         , puts_(metric_counter(name, "put"))
+         , adds_(metric_counter(name, "add"))
+         , dels_(metric_counter(name, "del"))
+         , errors_(metric_counter(name, "errors"))
+         , read_us_(metrics::get_histogram(metrics::make_name("kvds", name) + ".read_us"))
+         , write_us_(metrics::get_histogram(metrics::make_name("kvds", name) + ".write_us"))
+      {
+         if(!store_) { throw std::runtime_error("KvdsMetrics cannot decorate a null ikvds"); }
+      }
+
+      /// the decorated store
+      IKvds & get_store() { return *store_; }
+
+   public:
+      // IKvds interface implementation
+
+      bool put(
+         void const * pkey, size_t const ksize,
+         void const * pval, size_t const vsize
+         )
+      {
+         write_op op(*this, puts_);
+         return op.done(store_->put(pkey, ksize, pval, vsize));
+      }
+
+      bool get(
+         void const * pkey, size_t const ksize,
+         void * pval, size_t & vsize
+         )
+      {
+         read_op op(*this);
+         return op.done(store_->get(pkey, ksize, pval, vsize));
+      }
+
+      bool add(
+         void const * pkey, size_t const ksize,
+         void const * pval, size_t const vsize
+         )
+      {
+         write_op op(*this, adds_);
+         return op.done(store_->add(pkey, ksize, pval, vsize));
+      }
+
+      bool all(
+         void const * pkey, size_t const ksize,
+         void * pval, size_t & vsize
+         )
+      {
+         read_op op(*this);
+         return op.done(store_->all(pkey, ksize, pval, vsize));
+      }
+
+      bool xst(
+         void const * pkey, size_t const ksize
+         )
+      {
+         read_op op(*this);
+         return op.done(store_->xst(pkey, ksize));
+      }
+
+      bool del(
+         void const * pkey, size_t const ksize
+         )
+      {
+         write_op op(*this, dels_);
+         return op.done(store_->del(pkey, ksize));
+      }
+
+      bool clr()
+      {
+         return store_->clr();
+      }
+
+      bool beg()
+      {
+         return store_->beg();
+      }
+
+      bool nxt(
+         void * pkey, size_t & ksize
+         )
+      {
+         return store_->nxt(pkey, ksize);
+      }
+
+      bool end()
+      {
+         return store_->end();
+      }
+
+      bool siz(
+         void const * pkey, size_t const ksize,
+         size_t & vsize
+         )
+      {
+         read_op op(*this);
+         return op.done(store_->siz(pkey, ksize, vsize));
+      }
+
+      bool cnt(boost::uint64_t & cnt)
+      {
+         return store_->cnt(cnt);
+      }
+
+      bool nil(bool & isnil)
+      {
+         return store_->nil(isnil);
+      }
+
+   private:
+      static metrics::counter & metric_counter(std::string const & name, char const * what)
+      {
+         return metrics::get_counter(metrics::make_name("kvds", name) + "." + what);
+      }
+
+      /// times an operation and counts it as an error unless done() is called
+      class timed_op
+      {
+      public:
+         timed_op(KvdsMetrics & kvds, metrics::histogram & latency)
+            : kvds_(kvds), latency_(latency), start_(metrics::monotonic_us()), done_(false)
+         {
+         }
+
+         ~timed_op()
+         {
+            latency_.record(metrics::monotonic_us() - start_);
+
+            if(!done_)
+            {
+               ++kvds_.errors_;
+            }
+         }
+
+      protected:
+         void set_done() { done_ = true; }
+
+         KvdsMetrics & kvds_;
+
+      private:
+         metrics::histogram & latency_;
+         boost::uint64_t const start_;
+         bool done_;
+      };
+
+      class read_op : public timed_op
+      {
+      public:
+         explicit read_op(KvdsMetrics & kvds) : timed_op(kvds, kvds.read_us_) {}
+
+         bool done(bool found)
+         {
+            set_done();
+            ++(found ? kvds_.hits_ : kvds_.misses_);
+            return found;
+         }
+      };
+
+      class write_op : public timed_op
+      {
+      public:
+         write_op(KvdsMetrics & kvds, metrics::counter & calls) : timed_op(kvds, kvds.write_us_), calls_(calls) {}
+
+         bool done(bool ok)
+         {
+            set_done();
+            ++calls_;
+            return ok;
+         }
+
+      private:
+         metrics::counter & calls_;
+      };
+
+      store_ptr_t store_;
+
+      metrics::counter & hits_;
+      metrics::counter & misses_;
+      metrics::counter & puts_;
+      metrics::counter & adds_;
+      metrics::counter & dels_;
+      metrics::counter & errors_;
+      metrics::histogram & read_us_;
+      metrics::histogram & write_us_;
+   };
+
+}}
+
+#endif /// MOOST_KVDS_KVDS_METRICS_HPP__
@@ -34,6 +34,7 @@
 /// If the value being store is smaller than the page size padding is added to ensure the page persisted is complete.
 
 #include <vector>
+#include <map>
 #include <sstream>
 #include <fstream>
 #include <cassert>
@@ -59,8 +60,10 @@
 
 #include "../serialization/hashmap_serializer.hpp"
 #include "../serialization/hashset_serializer.hpp"
+#include "../serialization/hashmap_snapshot.hpp"
 
 #include "ikvds.hpp"
+#include "ikvds_cursor.hpp"
 
 /// In debug flush the stream so we can see what's happening (in release this is a noop)
 #ifndef NDEBUG
@@ -438,19 +441,15 @@ namespace moost { namespace kvds {
          // only try to load it if it exists
          if(boost::filesystem::exists(fname))
          {
-            // archive takes care of any io problems for us
-            std::ifstream in(fname.c_str(), std::ios::binary);
-            boost::archive::binary_iarchive ar(in);
-            ar >> storage_;
+            // snapshots are checked and loaded in parallel, older page
+            // maps saved through boost::archive are still understood
+            moost::serialization::load_hash_map_snapshot(storage_, fname);
          }
       }
 
       void save(std::string const & fname)
       {
-         // archive takes care of any io problems for us
-         std::ofstream out(fname.c_str(), std::ios::binary);
-         boost::archive::binary_oarchive ar(out);
-         ar << storage_;
+         moost::serialization::save_hash_map_snapshot(storage_, fname);
       }
 
    private:
@@ -644,7 +643,7 @@ namespace moost { namespace kvds {
    template <
       typename PageMapT // Either intrinsic (built-in integer types such as int or long) or non-instrinsic key.
    >
-   class KvdsPageStore : public IKvds
+   class KvdsPageStore : public IKvds, public IKvdsPartitioned
    {
    private:
       typedef size_t page_size_t;
@@ -921,6 +920,54 @@ namespace moost { namespace kvds {
                return itemid;
             }
 
+            std::string const & get_fname() const { return store_fname_; }
+
+            /// One past the highest item id in use
+            itemid_t get_id_limit() const
+            {
+               return boost::numeric_cast<itemid_t>(free_list_.size() + item_cnt_);
+            }
+
+            /// Makes sure pending writes can be seen through other streams
+            void flush()
+            {
+               if(store_.is_open())
+               {
+                  store_.flush();
+               }
+            }
+
+            /// Reads a whole item through another stream opened on the store file, so that
+            /// several threads can read the same store at once. The item must exist.
+            void read_page(std::istream & in, itemid_t itemid, byte_array_t & val) const
+            {
+               if(page_size_ <= std::numeric_limits<boost::uint8_t>::max())
+               {
+                  read_pageT<boost::uint8_t>(in, itemid, val);
+               }
+               else
+               if(page_size_ <= std::numeric_limits<boost::uint16_t>::max())
+               {
+                  read_pageT<boost::uint16_t>(in, itemid, val);
+               }
+               else
+               if(page_size_ <= std::numeric_limits<boost::uint32_t>::max())
+               {
+                  read_pageT<boost::uint32_t>(in, itemid, val);
+               }
+#ifndef WIN32 // 32 bit Windows will barf at this :(
+               else
+               if(page_size_ <= std::numeric_limits<boost::uint64_t>::max())
+               {
+                  read_pageT<boost::uint64_t>(in, itemid, val);
+               }
+#endif
+               else
+               {
+                  throw std::runtime_error("read_page failed, size is unsupported");
+               }
+            }
+
             std::streampos get_item_pos(itemid_t itemid) const
             {
                std::streampos pos;
@@ -1137,6 +1184,23 @@ namespace moost { namespace kvds {
             return boost::numeric_cast<std::streampos>(itemid * (sizeof(valsizeT) + page_size_));
          }
 
+         template <typename valsizeT>
+         void read_pageT(std::istream & in, itemid_t itemid, byte_array_t & val) const
+         {
+            in.seekg(get_item_posT<valsizeT>(itemid));
+
+            valsizeT esize = 0;
+            in.read(reinterpret_cast<char *>(&esize), sizeof(esize));
+            if(esize > page_size_) { throw std::runtime_error(std::string("Invalid value size in store: ") + store_fname_); }
+
+            val.resize(esize);
+
+            if(esize > 0)
+            {
+               in.read(&val[0], esize);
+            }
+         }
+
       private:
          enum { PADSIZE = 0xFF };
          static char const * GetPadding()
@@ -1178,6 +1242,133 @@ namespace moost { namespace kvds {
       typedef boost::shared_ptr<Store> store_t;
       typedef moost::container::sparse_hash_map<storeid_t, store_t> store_index_t;
       typedef std::bitset<sizeof(page_size_t) * 8> store_inventory_t;
+      typedef typename pagemap_t::storage_t storage_t;
+
+      typedef std::map<storeid_t, itemid_t> id_limits_t;
+
+      /// Reads the items of one partition of the stores. Partition i of n
+      /// covers the i-th n-th of the pagemap. The cursor walks its range
+      /// as it goes, a batch of keys at a time, and reads the items of each
+      /// batch in file order through a stream of its own.
+
+      /// *** This class is NOT thread safe ***
+
+      class PartitionCursor : public IKvdsCursor
+      {
+      public:
+         typedef typename storage_t::const_iterator storage_itr_t;
+
+         PartitionCursor(
+            pagemap_t const & pagemap, store_index_t const & stores, id_limits_t const & limits,
+            storage_itr_t const & beg, storage_itr_t const & end
+            ) :
+            pagemap_(pagemap), stores_(stores), limits_(limits), itr_(beg), end_(end), pos_(0)
+         {
+         }
+
+         bool next(byte_array_t & key, byte_array_t & val)
+         {
+            if(pos_ >= items_.size() && !fill())
+            {
+               // done, the scan may hold on to the cursor for a while
+               streams_.clear();
+               return false;
+            }
+
+            item const & it = items_[pos_++];
+
+            key.assign(keys_.begin() + it.key_offset, keys_.begin() + it.key_offset + it.key_size);
+
+            typename store_index_t::const_iterator sitr = stores_.find(it.storeid);
+            if(sitr == stores_.end()) { throw std::runtime_error("error retrieving store"); }
+
+            sitr->second->read_page(stream(it.storeid, *sitr->second), it.itemid, val);
+
+            return true;
+         }
+
+      private:
+         enum { BATCH_SIZE = 4096 };
+
+         struct item
+         {
+            storeid_t storeid;
+            itemid_t itemid;
+            size_t key_offset;
+            size_t key_size;
+
+            bool operator < (item const & rhs) const
+            {
+               return storeid != rhs.storeid ? storeid < rhs.storeid : itemid < rhs.itemid;
+            }
+         };
+
+         /// takes the next batch of keys from the range, false once it's exhausted
+         bool fill()
+         {
+            items_.clear();
+            keys_.clear();
+            pos_ = 0;
+
+            byte_array_t key(64);
+
+            for( ; itr_ != end_ && items_.size() < BATCH_SIZE ; ++itr_)
+            {
+               // items added since the partitioning aren't part of the scan
+               typename id_limits_t::const_iterator limit = limits_.find(itr_->second.first);
+
+               if(limit == limits_.end() || itr_->second.second >= limit->second)
+               {
+                  continue;
+               }
+
+               size_t ksize = key.size();
+
+               if(!pagemap_.itr2key(itr_, &key[0], ksize))
+               {
+                  key.resize(ksize);
+                  pagemap_.itr2key(itr_, &key[0], ksize);
+               }
+
+               item it;
+               it.storeid = itr_->second.first;
+               it.itemid = itr_->second.second;
+               it.key_offset = keys_.size();
+               it.key_size = ksize;
+               items_.push_back(it);
+
+               keys_.insert(keys_.end(), key.begin(), key.begin() + ksize);
+            }
+
+            std::sort(items_.begin(), items_.end());
+
+            return !items_.empty();
+         }
+
+         std::istream & stream(storeid_t const storeid, Store const & store)
+         {
+            boost::shared_ptr<std::ifstream> & in = streams_[storeid];
+
+            if(!in)
+            {
+               in.reset(new std::ifstream(store.get_fname().c_str(), std::ios::binary));
+               if(!*in) { throw std::runtime_error(std::string("Unable to open store: ") + store.get_fname()); }
+               in->exceptions(std::ios::badbit | std::ios::failbit);
+            }
+
+            return *in;
+         }
+
+         pagemap_t const & pagemap_;
+         store_index_t const & stores_;
+         id_limits_t const limits_;
+         storage_itr_t itr_;
+         storage_itr_t const end_;
+         std::vector<item> items_;
+         byte_array_t keys_;
+         size_t pos_;
+         std::map< storeid_t, boost::shared_ptr<std::ifstream> > streams_;
+      };
 
    public:
       typedef pagemap_t store_type;
@@ -1591,6 +1782,44 @@ namespace moost { namespace kvds {
          return true;
       }
 
+   public: // IKvdsPartitioned interface implementation
+
+      /// Partitions by pagemap range, each cursor reads through its own streams.
+      /// The store must outlive the cursors and not be changed while they're used.
+      void partition(size_t const max_partitions, std::vector<kvds_cursor_ptr_t> & cursors)
+      {
+         size_t const parts = std::max<size_t>(max_partitions, 1);
+
+         id_limits_t limits;
+
+         for(typename store_index_t::const_iterator itr = store_index_.begin() ; itr != store_index_.end() ; ++itr)
+         {
+            itr->second->flush();
+            limits[itr->first] = itr->second->get_id_limit();
+         }
+
+         // the pagemap can't be split without walking it, but finding where
+         // the ranges start doesn't need anything more than that
+         storage_t const & storage = pagemap_.get_storage();
+         size_t const size = storage.size();
+         typename storage_t::const_iterator beg = storage.begin();
+         typename storage_t::const_iterator end = beg;
+         size_t pos = 0;
+
+         for(size_t part = 0 ; part < parts ; ++part)
+         {
+            size_t const part_end = part + 1 == parts ? size : size * (part + 1) / parts;
+
+            for( ; pos < part_end ; ++pos)
+            {
+               ++end;
+            }
+
+            cursors.push_back(kvds_cursor_ptr_t(new PartitionCursor(pagemap_, store_index_, limits, beg, end)));
+            beg = end;
+         }
+      }
+
    private:
       std::string dsname_;
       std::string pagemap_fname_;
@@ -0,0 +1,438 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/// \file
+/// Scans a whole store on several threads.
+///
+/// Stores that implement IKvdsPartitioned (the BDB btree and the page
+/// store) are split into partitions, each read through its own cursor by
+/// a pool of threads. Any other IKvds is read through its beg()/nxt()
+/// iteration on a single thread, and the records are handed to the pool in
+/// batches, so at least the visitor runs in parallel.
+///
+///    void rebuild(byte_array_t const & key, byte_array_t const & val);
+///
+///    KvdsParallelScan scan(8);
+///    boost::uint64_t records = scan(store, &rebuild);
+///
+/// The visitor is called from several threads at once and must be thread
+/// safe. The store must not be modified during the scan. If the visitor
+/// or a cursor throws, the scan is stopped and the error rethrown as a
+/// std::runtime_error once all threads have finished.
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/cstdint.hpp>
+
+#include "ikvds.hpp"
+#include "ikvds_cursor.hpp"
+
+#ifndef MOOST_KVDS_KVDS_PARALLEL_SCAN_HPP__
+#define MOOST_KVDS_KVDS_PARALLEL_SCAN_HPP__
+
+namespace moost { namespace kvds {
+
+   /// A cursor over a whole store using its beg()/nxt() iteration, for
+   /// stores that can't be partitioned.
+   ///
+   /// *** This class is NOT thread safe ***
+
+   class KvdsIterationCursor : public IKvdsCursor
+   {
+   public:
+      explicit KvdsIterationCursor(IKvds & store)
+         : store_(store), started_(false), key_buf_(64)
+      {
+      }
+
+      bool next(byte_array_t & key, byte_array_t & val)
+      {
+         if(!started_)
+         {
+            started_ = true;
+
+            if(!store_.beg())
+            {
+               return false;
+            }
+         }
+
+         for(;;)
+         {
+            size_t ksize = key_buf_.size();
+
+            if(store_.nxt(&key_buf_[0], ksize))
+            {
+               key.assign(key_buf_.begin(), key_buf_.begin() + ksize);
+               break;
+            }
+
+            // nxt() fails without moving on if the buffer is too small
+            if(ksize <= key_buf_.size())
+            {
+               return false;
+            }
+
+            key_buf_.resize(ksize);
+         }
+
+         for(;;)
+         {
+            val.resize(std::max<size_t>(val.capacity(), 1));
+            size_t vsize = val.size();
+
+            if(store_.all(&key[0], key.size(), &val[0], vsize))
+            {
+               val.resize(vsize);
+               return true;
+            }
+
+            if(vsize <= val.size())
+            {
+               // gone since we got the key
+               throw std::runtime_error("store was modified during the scan");
+            }
+
+            val.resize(vsize);
+         }
+      }
+
+   private:
+      IKvds & store_;
+      bool started_;
+      byte_array_t key_buf_;
+   };
+
+   /// *** This class is NOT thread safe ***
+   /// (a single scan uses many threads, but don't run two at once on the same object)
+
+   class KvdsParallelScan
+   {
+   public:
+      typedef boost::function<void (byte_array_t const & key, byte_array_t const & val)> visitor_t;
+
+      /// Scans with the given number of threads. Partitioned stores are cut
+      /// into partitions_per_thread partitions for every thread, so that the
+      /// threads are kept busy even if the partitions aren't all the same size.
+      KvdsParallelScan(size_t const threads, size_t const partitions_per_thread = 4, size_t const batch_size = 256)
+         : threads_(threads)
+         , partitions_per_thread_(partitions_per_thread)
+         , batch_size_(batch_size)
+      {
+         if(threads_ == 0 || partitions_per_thread_ == 0 || batch_size_ == 0)
+         {
+            throw std::runtime_error("KvdsParallelScan: threads, partitions and batch size must be positive");
+         }
+      }
+
+      /// Gets the cursors that a scan of the store would use.
+      void partition(IKvds & store, std::vector<kvds_cursor_ptr_t> & cursors) const
+      {
+         IKvdsPartitioned * partitioned = dynamic_cast<IKvdsPartitioned *>(&store);
+
+         if(partitioned)
+         {
+            partitioned->partition(threads_*partitions_per_thread_, cursors);
+         }
+         else
+         {
+            cursors.push_back(kvds_cursor_ptr_t(new KvdsIterationCursor(store)));
+         }
+      }
+
+      /// Calls the visitor for each record in the store and returns the
+      /// number of records visited.
+      boost::uint64_t operator()(IKvds & store, visitor_t const & visitor)
+      {
+         std::vector<kvds_cursor_ptr_t> cursors;
+         partition(store, cursors);
+         return operator()(cursors, visitor);
+      }
+
+      boost::uint64_t operator()(std::vector<kvds_cursor_ptr_t> const & cursors, visitor_t const & visitor)
+      {
+         scan_state state(cursors, visitor);
+         boost::thread_group threads;
+
+         try
+         {
+            if(cursors.size() >= threads_ || threads_ == 1)
+            {
+               // enough partitions to go round, every thread reads its own
+               for(size_t i = 0; i < threads_; ++i)
+               {
+                  threads.create_thread(boost::bind(&KvdsParallelScan::scan_partitions, this, boost::ref(state)));
+               }
+            }
+            else
+            {
+               // a few threads read, all of them visit
+               state.readers = cursors.size();
+
+               for(size_t i = 0; i < cursors.size(); ++i)
+               {
+                  threads.create_thread(boost::bind(&KvdsParallelScan::read_batches, this, boost::ref(state)));
+               }
+
+               for(size_t i = 0; i < threads_; ++i)
+               {
+                  threads.create_thread(boost::bind(&KvdsParallelScan::visit_batches, this, boost::ref(state)));
+               }
+            }
+         }
+         catch(...)
+         {
+            state.fail("unable to start scan threads");
+         }
+
+         threads.join_all();
+
+         if(!state.error.empty())
+         {
+            throw std::runtime_error("parallel scan failed: " + state.error);
+         }
+
+         return state.visited;
+      }
+
+   private:
+      typedef std::vector< std::pair<byte_array_t, byte_array_t> > batch_t;
+      typedef boost::shared_ptr<batch_t> batch_ptr_t;
+
+      struct scan_state
+      {
+         scan_state(std::vector<kvds_cursor_ptr_t> const & c, visitor_t const & v)
+            : cursors(c), visitor(v), next_cursor(0), readers(0), visited(0)
+         {
+         }
+
+         void fail(std::string const & what)
+         {
+            boost::mutex::scoped_lock lock(mutex);
+
+            if(error.empty())
+            {
+               error = what.empty() ? "unknown error" : what;
+            }
+
+            cond.notify_all();
+         }
+
+         bool failed()
+         {
+            boost::mutex::scoped_lock lock(mutex);
+            return !error.empty();
+         }
+
+         std::vector<kvds_cursor_ptr_t> const & cursors;
+         visitor_t const & visitor;
+
+         boost::mutex mutex;
+         boost::condition_variable cond;
+         size_t next_cursor;
+         size_t readers;
+         std::deque<batch_ptr_t> batches;
+         boost::uint64_t visited;
+         std::string error;
+      };
+
+      kvds_cursor_ptr_t take_cursor(scan_state & state) const
+      {
+         boost::mutex::scoped_lock lock(state.mutex);
+
+         if(!state.error.empty() || state.next_cursor >= state.cursors.size())
+         {
+            return kvds_cursor_ptr_t();
+         }
+
+         return state.cursors[state.next_cursor++];
+      }
+
+      void count(scan_state & state, boost::uint64_t n) const
+      {
+         boost::mutex::scoped_lock lock(state.mutex);
+         state.visited += n;
+      }
+
+      void scan_partitions(scan_state & state) const
+      {
+         try
+         {
+            byte_array_t key;
+            byte_array_t val;
+
+            for(kvds_cursor_ptr_t cursor = take_cursor(state); cursor; cursor = take_cursor(state))
+            {
+               boost::uint64_t n = 0;
+
+               while(cursor->next(key, val))
+               {
+                  state.visitor(key, val);
+
+                  if(++n % batch_size_ == 0 && state.failed())
+                  {
+                     break;
+                  }
+               }
+
+               count(state, n);
+            }
+         }
+         catch(std::exception const & e)
+         {
+            state.fail(e.what());
+         }
+         catch(...)
+         {
+            state.fail("");
+         }
+      }
+
+      void read_batches(scan_state & state) const
+      {
+         try
+         {
+            for(kvds_cursor_ptr_t cursor = take_cursor(state); cursor; cursor = take_cursor(state))
+            {
+               bool more = true;
+
+               while(more)
+               {
+                  batch_ptr_t batch(new batch_t(batch_size_));
+                  size_t n = 0;
+
+                  while(n < batch_size_ && (more = cursor->next((*batch)[n].first, (*batch)[n].second)))
+                  {
+                     ++n;
+                  }
+
+                  batch->resize(n);
+
+                  if(n > 0 && !push(state, batch))
+                  {
+                     break;
+                  }
+               }
+            }
+         }
+         catch(std::exception const & e)
+         {
+            state.fail(e.what());
+         }
+         catch(...)
+         {
+            state.fail("");
+         }
+
+         boost::mutex::scoped_lock lock(state.mutex);
+         --state.readers;
+         state.cond.notify_all();
+      }
+
+      /// waits for space in the queue, returns false if the scan failed
+      bool push(scan_state & state, batch_ptr_t const & batch) const
+      {
+         boost::mutex::scoped_lock lock(state.mutex);
+
+         while(state.error.empty() && state.batches.size() >= 2*threads_)
+         {
+            state.cond.wait(lock);
+         }
+
+         if(!state.error.empty())
+         {
+            return false;
+         }
+
+         state.batches.push_back(batch);
+         state.cond.notify_all();
+
+         return true;
+      }
+
+      /// waits for a batch, returns null when there are no more
+      batch_ptr_t pop(scan_state & state) const
+      {
+         boost::mutex::scoped_lock lock(state.mutex);
+
+         while(state.error.empty() && state.batches.empty() && state.readers > 0)
+         {
+            state.cond.wait(lock);
+         }
+
+         if(!state.error.empty() || state.batches.empty())
+         {
+            return batch_ptr_t();
+         }
+
+         batch_ptr_t batch = state.batches.front();
+         state.batches.pop_front();
+         state.cond.notify_all();
+
+         return batch;
+      }
+
+      void visit_batches(scan_state & state) const
+      {
+         try
+         {
+            for(batch_ptr_t batch = pop(state); batch; batch = pop(state))
+            {
+               for(batch_t::const_iterator it = batch->begin(); it != batch->end(); ++it)
+               {
+                  state.visitor(it->first, it->second);
+               }
+
+               count(state, batch->size());
+            }
+         }
+         catch(std::exception const & e)
+         {
+            state.fail(e.what());
+         }
+         catch(...)
+         {
+            state.fail("");
+         }
+      }
+
+      size_t const threads_;
+      size_t const partitions_per_thread_;
+      size_t const batch_size_;
+   };
+
+}}
+
+#endif // MOOST_KVDS_KVDS_PARALLEL_SCAN_HPP__
@@ -0,0 +1,252 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/// \file
+/// Seek, range and prefix queries over any IKvds.
+///
+/// Stores that implement IKvdsOrdered (the BDB btree) answer these from
+/// their own key order, reading only the records in range. The other
+/// stores (BDB hash tables, the Tokyo and Kyoto Cabinet hash databases, the
+/// in-memory maps and the page store) keep their keys in no useful order.
+/// For these a query throws, unless scans were allowed, in which case it's
+/// answered by iterating over all keys and sorting the ones in range.
+///
+///    KvdsRange ranges(store);
+///    kvds_cursor_ptr_t day = ranges.prefix(to_bytes("2013-06-21/"));
+///
+///    KvdsBatch batch;
+///
+///    while(day->read(batch, 1024))
+///    {
+///       for(size_t i = 0; i < batch.size(); ++i)
+///       {
+///          process(batch.key(i), batch.key_size(i), batch.val(i), batch.val_size(i));
+///       }
+///    }
+///
+/// Keys come out in the order of kvds_compare_keys (unsigned bytes, a key
+/// that's a prefix of another first). The store must not be modified while
+/// a cursor is in use.
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "ikvds.hpp"
+#include "ikvds_cursor.hpp"
+
+#ifndef MOOST_KVDS_KVDS_RANGE_HPP__
+#define MOOST_KVDS_KVDS_RANGE_HPP__
+
+namespace moost { namespace kvds {
+
+   struct kvds_key_less
+   {
+      bool operator()(byte_array_t const & a, byte_array_t const & b) const
+      {
+         return kvds_compare_keys(a.empty() ? 0 : &a[0], a.size(), b) < 0;
+      }
+   };
+
+   /// The smallest key that's larger than every key starting with prefix,
+   /// or an empty key (no bound) if there isn't one
+   inline byte_array_t kvds_prefix_end(byte_array_t prefix)
+   {
+      while(!prefix.empty())
+      {
+         unsigned char & last = reinterpret_cast<unsigned char &>(prefix.back());
+
+         if(last != 0xFF)
+         {
+            ++last;
+            break;
+         }
+
+         prefix.pop_back();
+      }
+
+      return prefix;
+   }
+
+   /// A cursor over the keys in [lower, upper) of a store that has no key
+   /// order. On the first call all keys of the store are iterated, the ones in
+   /// range are kept and sorted; values are read as the cursor gets to them.
+   ///
+   /// *** This class is NOT thread safe ***
+
+   class KvdsSortedScanCursor : public IKvdsCursor
+   {
+   public:
+      KvdsSortedScanCursor(IKvds & store, byte_array_t const & lower, byte_array_t const & upper)
+         : store_(store), lower_(lower), upper_(upper), started_(false), pos_(0)
+      {
+      }
+
+      bool next(byte_array_t & key, byte_array_t & val)
+      {
+         if(!started_)
+         {
+            collect();
+            started_ = true;
+         }
+
+         if(pos_ >= keys_.size())
+         {
+            return false;
+         }
+
+         key.swap(keys_[pos_++]);
+
+         for(;;)
+         {
+            val.resize(std::max<size_t>(val.capacity(), 1));
+            size_t vsize = val.size();
+
+            if(store_.all(key.empty() ? 0 : &key[0], key.size(), &val[0], vsize))
+            {
+               val.resize(vsize);
+               return true;
+            }
+
+            if(vsize <= val.size())
+            {
+               throw std::runtime_error("store was modified during the scan");
+            }
+
+            val.resize(vsize);
+         }
+      }
+
+   private:
+      bool in_range(byte_array_t const & key) const
+      {
+         kvds_key_less less;
+         return !less(key, lower_) && (upper_.empty() || less(key, upper_));
+      }
+
+      void collect()
+      {
+         byte_array_t key(64);
+
+         if(store_.beg())
+         {
+            for(;;)
+            {
+               size_t ksize = key.size();
+
+               if(!store_.nxt(&key[0], ksize))
+               {
+                  if(ksize <= key.size())
+                  {
+                     break;
+                  }
+
+                  key.resize(ksize);
+                  continue;
+               }
+
+               byte_array_t k(key.begin(), key.begin() + ksize);
+
+               if(in_range(k))
+               {
+                  keys_.push_back(byte_array_t());
+                  keys_.back().swap(k);
+               }
+            }
+         }
+
+         std::sort(keys_.begin(), keys_.end(), kvds_key_less());
+      }
+
+      IKvds & store_;
+      byte_array_t const lower_;
+      byte_array_t const upper_;
+      bool started_;
+      size_t pos_;
+      std::vector<byte_array_t> keys_;
+   };
+
+   /// *** This class is NOT thread safe ***
+
+   class KvdsRange
+   {
+   public:
+      enum unordered_mode
+      {
+         unordered_throw,   ///< queries on stores without key order throw
+         unordered_scan     ///< ... or scan and sort the whole store
+      };
+
+      explicit KvdsRange(IKvds & store, unordered_mode const mode = unordered_throw)
+         : store_(store), mode_(mode)
+      {
+      }
+
+      /// all keys from key onwards
+      kvds_cursor_ptr_t seek(byte_array_t const & key)
+      {
+         return range(key, byte_array_t());
+      }
+
+      /// all keys starting with prefix
+      kvds_cursor_ptr_t prefix(byte_array_t const & prefix)
+      {
+         return range(prefix, kvds_prefix_end(prefix));
+      }
+
+      /// all keys in [lower, upper), an empty upper bound meaning no bound
+      kvds_cursor_ptr_t range(byte_array_t const & lower, byte_array_t const & upper)
+      {
+         kvds_cursor_ptr_t cursor;
+         IKvdsOrdered * ordered = dynamic_cast<IKvdsOrdered *>(&store_);
+
+         if(ordered)
+         {
+            cursor = ordered->range(lower, upper);
+         }
+
+         if(!cursor)
+         {
+            if(mode_ != unordered_scan)
+            {
+               throw std::runtime_error("store has no key order, range queries need a full scan");
+            }
+
+            cursor.reset(new KvdsSortedScanCursor(store_, lower, upper));
+         }
+
+         return cursor;
+      }
+
+   private:
+      IKvds & store_;
+      unordered_mode const mode_;
+   };
+
+}}
+
+#endif /// MOOST_KVDS_KVDS_RANGE_HPP__
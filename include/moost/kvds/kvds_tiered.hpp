@@ -0,0 +1,937 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/// \file
+/// A two tier ikvds: a bounded in-memory hot set in front of a persistent
+/// (cold) store. Reads are served from the hot set and go through to the
+/// cold store on a miss, caching what they find. When the hot set is full,
+/// entries are evicted with a CLOCK sweep over per-entry use counters
+/// (GCLOCK): the hand decrements the counters it passes and evicts the first
+/// entry that's down to zero. Counters saturate at a small value, so one
+/// eviction never sweeps the hot set more than a few times. New entries
+/// start at zero, so a scan over
+/// keys that are only used once doesn't push the frequently used ones out,
+/// while keys that were hot a while ago still age out.
+///
+/// Writes are either passed straight to the cold store (write_through) or
+/// only marked dirty in the hot set (write_back). Dirty entries are written
+/// out by a background thread every flush_interval_ms, or sooner when more
+/// than max_dirty are pending, in sorted key order so that ordered backends
+/// (BDB btree, KC tree, the page store) see mostly sequential writes. Dirty
+/// entries that get evicted are written out on the spot.
+///
+///    KvdsTiered::options opt;
+///    opt.max_items = 1000000;
+///    opt.mode = KvdsTiered::write_back;
+///    boost::shared_ptr<KvdsTiered> store(new KvdsTiered(ikvds_ptr_t(new KvdsBbt(...)), "users", opt));
+///    store->warm_up_from_file("users.hot");
+///    ...
+///    store->save_hot_keys("users.hot");
+///
+/// In write_back mode the cold store lags behind, so cnt(), nil(), beg()
+/// and clr() flush all pending writes first, and the destructor flushes
+/// whatever is left.
+///
+/// Metrics, registered under "kvds.<name>.tier.":
+///
+///    hits / misses            lookups answered from memory or the cold store
+///    evictions / flushed      entries dropped from the hot set, dirty entries written out
+///    errors                   background flushes that failed (and will be retried)
+///    hot_items / hot_bytes    gauges, size of the hot set
+///    dirty                    gauge, writes not yet in the cold store
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/cast.hpp>
+
+#include "ikvds.hpp"
+#include "kvds_mem.hpp"
+#include "../metrics/registry.hpp"
+
+#ifndef MOOST_KVDS_KVDS_TIERED_HPP__
+#define MOOST_KVDS_KVDS_TIERED_HPP__
+
+namespace moost { namespace kvds {
+
+   /// *** This class is NOT thread safe ***
+   /// (only the background flushing is synchronised with the other calls)
+
+   class KvdsTiered : public IKvds
+   {
+   public:
+      typedef boost::shared_ptr<IKvds> store_ptr_t;
+
+      enum write_mode
+      {
+         write_through,
+         write_back
+      };
+
+      struct options
+      {
+         options()
+            : max_items(100000)
+            , max_bytes(0)
+            , mode(write_through)
+            , flush_interval_ms(1000)
+            , flush_batch(1024)
+            , max_dirty(10000)
+         {
+         }
+
+         /// maximum number of entries in the hot set, 0 for no limit
+         size_t max_items;
+
+         /// maximum size of the hot set in bytes (keys, values and a
+         /// per-entry overhead), 0 for no limit
+         size_t max_bytes;
+
+         write_mode mode;
+
+         /// how often the background thread flushes dirty entries, 0 for
+         /// no background thread (flushing only happens when max_dirty is
+         /// exceeded or flush() is called)
+         size_t flush_interval_ms;
+
+         /// dirty entries written per lock hold while flushing
+         size_t flush_batch;
+
+         /// flush as soon as this many entries are dirty
+         size_t max_dirty;
+      };
+
+      KvdsTiered(store_ptr_t cold, std::string const & name, options const & opt = options())
+         : cold_(cold)
+         , opt_(opt)
+         , hand_(hot_.end())
+         , hot_bytes_(0)
+         , stop_(false)
+         , hits_(metrics::get_counter(metric_name(name, "hits")))
+         , misses_(metrics::get_counter(metric_name(name, "misses")))
+         , evictions_(metrics::get_counter(metric_name(name, "evictions")))
+         , flushed_(metrics::get_counter(metric_name(name, "flushed")))
+         , errors_(metrics::get_counter(metric_name(name, "errors")))
+         , hot_items_gauge_(metrics::get_gauge(metric_name(name, "hot_items")))
+         , hot_bytes_gauge_(metrics::get_gauge(metric_name(name, "hot_bytes")))
+         , dirty_gauge_(metrics::get_gauge(metric_name(name, "dirty")))
+      {
+         if(!cold_) { throw std::runtime_error("KvdsTiered cannot decorate a null ikvds"); }
+         if(opt_.flush_batch == 0) { throw std::runtime_error("KvdsTiered: flush_batch must be positive"); }
+
+         if(opt_.mode == write_back && opt_.flush_interval_ms > 0)
+         {
+            flusher_.reset(new boost::thread(boost::bind(&KvdsTiered::flush_loop, this)));
+         }
+      }
+
+      ~KvdsTiered()
+      {
+         if(flusher_)
+         {
+            {
+               boost::mutex::scoped_lock lock(mutex_);
+               stop_ = true;
+            }
+
+            cond_.notify_all();
+            flusher_->join();
+         }
+
+         try
+         {
+            flush();
+         }
+         catch(...) { }
+      }
+
+      /// the cold store
+      IKvds & get_store() { return *cold_; }
+
+      /// writes all dirty entries to the cold store
+      void flush()
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         flush_all(lock);
+      }
+
+      size_t hot_items() const
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         return hot_.size();
+      }
+
+      size_t hot_bytes() const
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         return hot_bytes_;
+      }
+
+      size_t dirty_items() const
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         return dirty_.size();
+      }
+
+      /// Loads the given keys from the cold store into the hot set, stopping
+      /// when the hot set is full. Returns the number of keys loaded.
+      size_t warm_up(std::vector<byte_array_t> const & keys)
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         size_t loaded = 0;
+
+         for(size_t i = 0; i < keys.size() && !full(); ++i)
+         {
+            byte_array_t const & key = keys[i];
+
+            if(key.empty() || hot_.find(key) != hot_.end())
+            {
+               continue;
+            }
+
+            hot_map_t::iterator it;
+
+            if(load(key, it) && it != hot_.end())
+            {
+               ++loaded;
+            }
+         }
+
+         update_gauges();
+
+         return loaded;
+      }
+
+      size_t warm_up_from_file(std::string const & path)
+      {
+         std::vector<byte_array_t> keys;
+         load_hot_keys(path, keys);
+         return warm_up(keys);
+      }
+
+      /// Writes the keys in the hot set to a file, most frequently used
+      /// first, so they can be passed to warm_up_from_file() after a restart.
+      void save_hot_keys(std::string const & path) const
+      {
+         std::vector< std::pair<int, byte_array_t const *> > ranked;
+
+         boost::mutex::scoped_lock lock(mutex_);
+
+         for(hot_map_t::const_iterator it = hot_.begin(); it != hot_.end(); ++it)
+         {
+            if(!it->second.deleted)
+            {
+               ranked.push_back(std::make_pair(-int(it->second.freq), &it->first));
+            }
+         }
+
+         std::stable_sort(ranked.begin(), ranked.end(), compare_rank);
+
+         std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+
+         if(!out)
+         {
+            throw std::runtime_error("KvdsTiered: cannot write " + path);
+         }
+
+         for(size_t i = 0; i < ranked.size(); ++i)
+         {
+            byte_array_t const & key = *ranked[i].second;
+            size_t const key_size = key.size();
+            out.write(reinterpret_cast<char const *>(&key_size), sizeof(key_size));
+            out.write(&key[0], boost::numeric_cast<std::streamsize>(key_size));
+         }
+
+         if(!out)
+         {
+            throw std::runtime_error("KvdsTiered: error writing " + path);
+         }
+      }
+
+      static void load_hot_keys(std::string const & path, std::vector<byte_array_t> & keys)
+      {
+         std::ifstream in(path.c_str(), std::ios::binary);
+
+         if(!in)
+         {
+            throw std::runtime_error("KvdsTiered: cannot read " + path);
+         }
+
+         size_t key_size = 0;
+
+         while(in.read(reinterpret_cast<char *>(&key_size), sizeof(key_size)))
+         {
+            if(key_size == 0 || key_size > max_key_file_entry)
+            {
+               throw std::runtime_error("KvdsTiered: corrupt hot key file " + path);
+            }
+
+            keys.push_back(byte_array_t(key_size));
+
+            if(!in.read(&keys.back()[0], boost::numeric_cast<std::streamsize>(key_size)))
+            {
+               throw std::runtime_error("KvdsTiered: truncated hot key file " + path);
+            }
+         }
+      }
+
+   public:
+      // IKvds interface implementation
+
+      bool put(
+         void const * pkey, size_t const ksize,
+         void const * pval, size_t const vsize
+         )
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         byte_array_t key(make_key(pkey, ksize));
+         char const * p = static_cast<char const *>(pval);
+         return store(lock, key, p, p + vsize);
+      }
+
+      bool get(
+         void const * pkey, size_t const ksize,
+         void * pval, size_t & vsize
+         )
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         byte_array_t const * val = read(make_key(pkey, ksize));
+
+         if(!val)
+         {
+            vsize = 0;
+            return false;
+         }
+
+         vsize = std::min(vsize, val->size());
+
+         if(vsize > 0)
+         {
+            memcpy(pval, &(*val)[0], vsize);
+         }
+
+         return true;
+      }
+
+      bool add(
+         void const * pkey, size_t const ksize,
+         void const * pval, size_t const vsize
+         )
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         byte_array_t key(make_key(pkey, ksize));
+         byte_array_t const * val = read(key);
+
+         byte_array_t appended;
+         appended.reserve((val ? val->size() : 0) + vsize);
+
+         if(val)
+         {
+            appended.assign(val->begin(), val->end());
+         }
+
+         char const * p = static_cast<char const *>(pval);
+         appended.insert(appended.end(), p, p + vsize);
+
+         return store(lock, key, appended.empty() ? 0 : &appended[0], appended.empty() ? 0 : &appended[0] + appended.size());
+      }
+
+      bool all(
+         void const * pkey, size_t const ksize,
+         void * pval, size_t & vsize
+         )
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         byte_array_t const * val = read(make_key(pkey, ksize));
+
+         if(!val)
+         {
+            vsize = 0;
+            return false;
+         }
+
+         bool const fits = val->size() <= vsize;
+
+         if(fits && !val->empty())
+         {
+            memcpy(pval, &(*val)[0], val->size());
+         }
+
+         vsize = val->size();
+
+         return fits;
+      }
+
+      bool xst(
+         void const * pkey, size_t const ksize
+         )
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         hot_map_t::iterator it = hot_.find(make_key(pkey, ksize));
+
+         if(it != hot_.end())
+         {
+            touch(it->second);
+            ++hits_;
+            return !it->second.deleted;
+         }
+
+         ++misses_;
+         return cold_->xst(pkey, ksize);
+      }
+
+      bool del(
+         void const * pkey, size_t const ksize
+         )
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         byte_array_t key(make_key(pkey, ksize));
+         hot_map_t::iterator it = hot_.find(key);
+
+         if(opt_.mode == write_through)
+         {
+            if(it != hot_.end())
+            {
+               erase(it);
+               update_gauges();
+            }
+
+            return cold_->del(pkey, ksize);
+         }
+
+         bool existed = false;
+
+         if(it != hot_.end())
+         {
+            existed = !it->second.deleted;
+         }
+         else
+         {
+            existed = cold_->xst(pkey, ksize);
+
+            if(!existed)
+            {
+               return false;
+            }
+
+            make_room(key.size());
+            it = insert(key);
+         }
+
+         // keep a tombstone around until the delete has been flushed
+         hot_bytes_ -= it->second.value.size();
+         byte_array_t().swap(it->second.value);
+         it->second.deleted = true;
+         mark_dirty(lock, it);
+
+         return existed;
+      }
+
+      bool clr()
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+
+         hot_.clear();
+         dirty_.clear();
+         hand_ = hot_.end();
+         hot_bytes_ = 0;
+         update_gauges();
+
+         return cold_->clr();
+      }
+
+      bool beg()
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         flush_all(lock);
+         return cold_->beg();
+      }
+
+      bool nxt(
+         void * pkey, size_t & ksize
+         )
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         return cold_->nxt(pkey, ksize);
+      }
+
+      bool end()
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         return cold_->end();
+      }
+
+      bool siz(
+         void const * pkey, size_t const ksize,
+         size_t & vsize
+         )
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         hot_map_t::iterator it = hot_.find(make_key(pkey, ksize));
+
+         if(it != hot_.end())
+         {
+            touch(it->second);
+            ++hits_;
+
+            if(it->second.deleted)
+            {
+               return false;
+            }
+
+            vsize = it->second.value.size();
+            return true;
+         }
+
+         ++misses_;
+         return cold_->siz(pkey, ksize, vsize);
+      }
+
+      bool cnt(boost::uint64_t & cnt)
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         flush_all(lock);
+         return cold_->cnt(cnt);
+      }
+
+      bool nil(bool & isnil)
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         flush_all(lock);
+         return cold_->nil(isnil);
+      }
+
+   private:
+      enum
+      {
+         entry_overhead = 64,   // rough cost of a map node and its bookkeeping
+         max_freq = 3,          // bounds an eviction to max_freq + 1 sweeps
+         max_key_file_entry = 1 << 20
+      };
+
+      struct entry
+      {
+         entry() : freq(0), dirty(false), deleted(false) {}
+
+         byte_array_t value;
+         boost::uint8_t freq;
+         bool dirty;
+         bool deleted;
+      };
+
+      typedef std::map<byte_array_t, entry> hot_map_t;
+      typedef std::set<byte_array_t> dirty_set_t;
+
+      static std::string metric_name(std::string const & name, char const * what)
+      {
+         return metrics::make_name("kvds", name) + ".tier." + what;
+      }
+
+      static bool compare_rank(std::pair<int, byte_array_t const *> const & a,
+                               std::pair<int, byte_array_t const *> const & b)
+      {
+         return a.first < b.first;
+      }
+
+      static byte_array_t make_key(void const * pkey, size_t const ksize)
+      {
+         char const * p = static_cast<char const *>(pkey);
+         return byte_array_t(p, p + ksize);
+      }
+
+      static size_t cost(byte_array_t const & key, byte_array_t const & value)
+      {
+         return key.size() + value.size() + entry_overhead;
+      }
+
+      static void touch(entry & e)
+      {
+         if(e.freq < max_freq)
+         {
+            ++e.freq;
+         }
+      }
+
+      bool full() const
+      {
+         return (opt_.max_items > 0 && hot_.size() >= opt_.max_items) ||
+                (opt_.max_bytes > 0 && hot_bytes_ + entry_overhead > opt_.max_bytes);
+      }
+
+      /// true if a value of this size can be kept in the hot set at all
+      bool cacheable(size_t const size) const
+      {
+         return opt_.max_bytes == 0 || size + entry_overhead <= opt_.max_bytes;
+      }
+
+      hot_map_t::iterator insert(byte_array_t const & key)
+      {
+         hot_map_t::iterator it = hot_.insert(std::make_pair(key, entry())).first;
+         hot_bytes_ += cost(key, it->second.value);
+         return it;
+      }
+
+      void erase(hot_map_t::iterator it)
+      {
+         if(it == hand_)
+         {
+            ++hand_;
+         }
+
+         if(it->second.dirty)
+         {
+            dirty_.erase(it->first);
+         }
+
+         hot_bytes_ -= cost(it->first, it->second.value);
+         hot_.erase(it);
+      }
+
+      /// evicts entries until there's space for a new one of the given size
+      void make_room(size_t const size)
+      {
+         evict(1, size + entry_overhead, hot_.end());
+      }
+
+      /// evicts entries other than keep until there's space for items more
+      /// entries and bytes more bytes
+      void evict(size_t const items, size_t const bytes, hot_map_t::iterator keep)
+      {
+         size_t const kept = keep == hot_.end() ? 0 : 1;
+
+         while(hot_.size() > kept &&
+               ((opt_.max_items > 0 && hot_.size() + items > opt_.max_items) ||
+                (opt_.max_bytes > 0 && hot_bytes_ + bytes > opt_.max_bytes)))
+         {
+            if(hand_ == hot_.end())
+            {
+               hand_ = hot_.begin();
+            }
+
+            if(hand_ == keep)
+            {
+               ++hand_;
+               continue;
+            }
+
+            entry & e = hand_->second;
+
+            if(e.freq > 0)
+            {
+               --e.freq;
+               ++hand_;
+               continue;
+            }
+
+            if(e.dirty)
+            {
+               write_cold(hand_);
+            }
+
+            erase(hand_++);
+            ++evictions_;
+         }
+      }
+
+      /// Reads a key from the cold store into the hot set. Values that are
+      /// too big to be cached are left in scratch_ and it is set to end.
+      bool load(byte_array_t const & key, hot_map_t::iterator & it)
+      {
+         it = hot_.end();
+         size_t size = 0;
+
+         if(!cold_->siz(&key[0], key.size(), size))
+         {
+            return false;
+         }
+
+         byte_array_t value(size);
+         size_t vsize = size;
+
+         if(!cold_->all(&key[0], key.size(), value.empty() ? 0 : &value[0], vsize))
+         {
+            return false;
+         }
+
+         value.resize(vsize);
+
+         if(!cacheable(key.size() + value.size()))
+         {
+            scratch_.swap(value);
+            return true;
+         }
+
+         make_room(key.size() + value.size());
+
+         it = insert(key);
+         it->second.value.swap(value);
+         hot_bytes_ += it->second.value.size();
+         update_gauges();
+
+         return true;
+      }
+
+      /// returns the current value of a key or null if it doesn't exist,
+      /// the pointer is valid until the next call
+      byte_array_t const * read(byte_array_t const & key)
+      {
+         hot_map_t::iterator it = hot_.find(key);
+
+         if(it != hot_.end())
+         {
+            touch(it->second);
+            ++hits_;
+            return it->second.deleted ? 0 : &it->second.value;
+         }
+
+         ++misses_;
+
+         if(!load(key, it))
+         {
+            return 0;
+         }
+
+         return it != hot_.end() ? &it->second.value : &scratch_;
+      }
+
+      bool store(boost::mutex::scoped_lock & lock, byte_array_t const & key, char const * begin, char const * end)
+      {
+         size_t const size = end - begin;
+         hot_map_t::iterator it = hot_.find(key);
+
+         if(opt_.mode == write_through || !cacheable(key.size() + size))
+         {
+            if(!cold_->put(&key[0], key.size(), begin, size))
+            {
+               return false;
+            }
+
+            if(!cacheable(key.size() + size))
+            {
+               if(it != hot_.end())
+               {
+                  erase(it);
+                  update_gauges();
+               }
+
+               return true;
+            }
+         }
+
+         if(it == hot_.end())
+         {
+            make_room(key.size() + size);
+            it = insert(key);
+         }
+         else
+         {
+            touch(it->second);
+
+            // a value that grows in place needs room too
+            if(size > it->second.value.size())
+            {
+               evict(0, size - it->second.value.size(), it);
+            }
+         }
+
+         hot_bytes_ -= it->second.value.size();
+         it->second.value.assign(begin, end);
+         hot_bytes_ += size;
+         it->second.deleted = false;
+
+         if(opt_.mode == write_back)
+         {
+            mark_dirty(lock, it);
+         }
+         else
+         {
+            update_gauges();
+         }
+
+         return true;
+      }
+
+      void mark_dirty(boost::mutex::scoped_lock & lock, hot_map_t::iterator it)
+      {
+         if(!it->second.dirty)
+         {
+            it->second.dirty = true;
+            dirty_.insert(it->first);
+         }
+
+         update_gauges();
+
+         if(dirty_.size() >= opt_.max_dirty)
+         {
+            if(flusher_)
+            {
+               cond_.notify_all();
+            }
+            else
+            {
+               flush_all(lock);
+            }
+         }
+      }
+
+      /// writes a dirty entry to the cold store, throws if that fails since
+      /// the write would otherwise be lost
+      void write_cold(hot_map_t::iterator it)
+      {
+         byte_array_t const & key = it->first;
+         entry & e = it->second;
+
+         bool ok = e.deleted
+            ? (cold_->del(&key[0], key.size()) || !cold_->xst(&key[0], key.size()))
+            : cold_->put(&key[0], key.size(), e.value.empty() ? 0 : &e.value[0], e.value.size());
+
+         if(!ok)
+         {
+            throw std::runtime_error("KvdsTiered: failed to write back to the cold store");
+         }
+
+         e.dirty = false;
+         dirty_.erase(key);
+         ++flushed_;
+      }
+
+      /// Writes out up to flush_batch dirty entries, in key order, starting
+      /// after the last key written. Returns the number written.
+      size_t flush_some()
+      {
+         size_t written = 0;
+         dirty_set_t::iterator dit = dirty_.upper_bound(flush_cursor_);
+
+         if(dit == dirty_.end())
+         {
+            dit = dirty_.begin();
+         }
+
+         while(dit != dirty_.end() && written < opt_.flush_batch)
+         {
+            byte_array_t const key = *dit++;
+            hot_map_t::iterator it = hot_.find(key);
+
+            write_cold(it);
+            ++written;
+            flush_cursor_ = key;
+
+            if(it->second.deleted)
+            {
+               erase(it);
+            }
+         }
+
+         update_gauges();
+
+         return written;
+      }
+
+      /// flushes everything, letting other callers in between batches
+      void flush_all(boost::mutex::scoped_lock & lock)
+      {
+         flush_cursor_.clear();
+
+         while(!dirty_.empty())
+         {
+            flush_some();
+
+            if(!dirty_.empty())
+            {
+               lock.unlock();
+               boost::this_thread::yield();
+               lock.lock();
+            }
+         }
+      }
+
+      void flush_loop()
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+
+         while(!stop_)
+         {
+            cond_.timed_wait(lock, boost::posix_time::milliseconds(opt_.flush_interval_ms));
+
+            try
+            {
+               flush_all(lock);
+            }
+            catch(...)
+            {
+               // the entries stay dirty and will be retried next time
+               ++errors_;
+            }
+         }
+      }
+
+      void update_gauges()
+      {
+         hot_items_gauge_.set(hot_.size());
+         hot_bytes_gauge_.set(hot_bytes_);
+         dirty_gauge_.set(dirty_.size());
+      }
+
+      store_ptr_t cold_;
+      options const opt_;
+
+      mutable boost::mutex mutex_;
+      boost::condition_variable cond_;
+
+      hot_map_t hot_;
+      hot_map_t::iterator hand_;
+      size_t hot_bytes_;
+      dirty_set_t dirty_;
+      byte_array_t flush_cursor_;
+      byte_array_t scratch_;
+
+      bool stop_;
+      boost::shared_ptr<boost::thread> flusher_;
+
+      metrics::counter & hits_;
+      metrics::counter & misses_;
+      metrics::counter & evictions_;
+      metrics::counter & flushed_;
+      metrics::counter & errors_;
+      metrics::gauge & hot_items_gauge_;
+      metrics::gauge & hot_bytes_gauge_;
+      metrics::gauge & dirty_gauge_;
+   };
+
+}}
+
+#endif /// MOOST_KVDS_KVDS_TIERED_HPP__
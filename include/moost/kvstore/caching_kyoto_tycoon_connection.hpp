@@ -0,0 +1,190 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/// \file
+/// Connection decorator that reads through and writes through a local
+/// KyotoTycoonCache, so hot keys are served from memory. Use it wherever
+/// a connection is expected, e.g. with KyotoTycoonClient:
+///
+/// KyotoTycoonCache cache(100000);
+/// CachingKyotoTycoonConnection conn(remoteConn, cache);
+/// KyotoTycoonClient(conn).get(key, val);
+///
+/// Connections aren't thread safe, but a single cache can (and should) be
+/// shared by the caching connections of all threads.
+
+#ifndef MOOST_KVSTORE_CACHING_KYOTO_TYCOON_CONNECTION_HPP
+#define MOOST_KVSTORE_CACHING_KYOTO_TYCOON_CONNECTION_HPP
+
+#include <string>
+#include <cstring>
+#include <ctime>
+
+#include "i_kyoto_tycoon_connection.h"
+#include "kyoto_tycoon_cache.hpp"
+
+namespace moost { namespace kvstore {
+
+class CachingKyotoTycoonConnection : public IKyotoTycoonConnection
+{
+public:
+
+   CachingKyotoTycoonConnection(IKyotoTycoonConnection& conn, KyotoTycoonCache& cache)
+     : m_conn(conn)
+     , m_cache(cache)
+   {
+   }
+
+   void open(const std::string& host, int port, int timeoutMs)
+   {
+      m_conn.open(host, port, timeoutMs);
+   }
+
+   void close()
+   {
+      m_conn.close();
+   }
+
+public:
+
+   boost::shared_array<char> get(const void* pkey, size_t ksize, size_t& vsize) const
+   {
+      return m_cache.get(m_conn, std::string(reinterpret_cast<const char *>(pkey), ksize), vsize);
+   }
+
+   // not cached, the cache doesn't keep the expiry time
+   boost::shared_array<char> get_with_expiry(const void* pkey, size_t ksize, size_t& vsize, boost::int64_t& expiryTime) const
+   {
+      return m_conn.get_with_expiry(pkey, ksize, vsize, expiryTime);
+   }
+
+   void set(const void* pkey, size_t ksize, const void* pval, size_t vsize) const
+   {
+      m_conn.set(pkey, ksize, pval, vsize);
+      m_cache.put(std::string(reinterpret_cast<const char *>(pkey), ksize), copy(pval, vsize), vsize);
+   }
+
+   void cache(const void* pkey, size_t ksize, const void* pval, size_t vsize, boost::int64_t expirySecs) const
+   {
+      m_conn.cache(pkey, ksize, pval, vsize, expirySecs);
+      m_cache.put(std::string(reinterpret_cast<const char *>(pkey), ksize), copy(pval, vsize), vsize, time(0) + expirySecs);
+   }
+
+   bool remove(const void* pkey, size_t ksize) const
+   {
+      bool removed = m_conn.remove(pkey, ksize);
+      m_cache.invalidate(std::string(reinterpret_cast<const char *>(pkey), ksize));
+      return removed;
+   }
+
+   // only the keys that aren't cached are fetched, in a single bulk call that
+   // also returns their expiry times, so that they aren't cached for longer
+   size_t get_bulk(const key_list_t& keys, record_map_t& recs) const
+   {
+      key_list_t misses;
+      size_t found = 0;
+
+      for (key_list_t::const_iterator it = keys.begin(); it != keys.end(); ++it)
+      {
+         boost::shared_array<char> val;
+         size_t vsize;
+         if (!m_cache.peek(*it, val, vsize))
+            misses.push_back(*it);
+         else if (val)
+         {
+            recs[*it].assign(val.get(), vsize);
+            ++found;
+         }
+      }
+
+      if (!misses.empty())
+      {
+         record_map_t fetched;
+         expiry_map_t expiryTimes;
+         m_conn.get_bulk_with_expiry(misses, fetched, expiryTimes);
+
+         for (key_list_t::const_iterator it = misses.begin(); it != misses.end(); ++it)
+         {
+            record_map_t::const_iterator rec = fetched.find(*it);
+            if (rec == fetched.end())
+               m_cache.put(*it, boost::shared_array<char>(), 0);
+            else
+            {
+               expiry_map_t::const_iterator xt = expiryTimes.find(*it);
+               m_cache.put(*it, copy(rec->second.data(), rec->second.size()), rec->second.size(),
+                           xt == expiryTimes.end() ? -1 : xt->second);
+               recs[*it] = rec->second;
+               ++found;
+            }
+         }
+      }
+
+      return found;
+   }
+
+   void set_bulk(const record_map_t& recs, boost::int64_t expirySecs = -1) const
+   {
+      m_conn.set_bulk(recs, expirySecs);
+
+      boost::int64_t expiryTime = expirySecs < 0 ? -1 : time(0) + expirySecs;
+      for (record_map_t::const_iterator it = recs.begin(); it != recs.end(); ++it)
+         m_cache.put(it->first, copy(it->second.data(), it->second.size()), it->second.size(), expiryTime);
+   }
+
+   size_t remove_bulk(const key_list_t& keys) const
+   {
+      size_t removed = m_conn.remove_bulk(keys);
+      for (key_list_t::const_iterator it = keys.begin(); it != keys.end(); ++it)
+         m_cache.invalidate(*it);
+      return removed;
+   }
+
+   bool ping() const
+   {
+      return m_conn.ping();
+   }
+
+private:
+
+   // null terminated, like the values returned by get
+   static boost::shared_array<char> copy(const void* pval, size_t vsize)
+   {
+      boost::shared_array<char> val(new char[vsize + 1]);
+      if (vsize > 0)
+         std::memcpy(val.get(), pval, vsize);
+      val[vsize] = 0;
+      return val;
+   }
+
+private:
+   IKyotoTycoonConnection& m_conn;
+   KyotoTycoonCache& m_cache;
+};
+
+}}  // end namespace
+
+#endif
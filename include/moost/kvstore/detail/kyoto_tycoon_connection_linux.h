@@ -69,6 +69,23 @@ public:
    // throws on failure
    virtual void cache(const void* pkey, size_t ksize, const void* pval, size_t vsize, boost::int64_t expirySecs) const;
 
+   virtual bool remove(const void* pkey, size_t ksize) const;
+
+   // bulk methods, each is a single round trip
+
+   virtual size_t get_bulk(const key_list_t& keys, record_map_t& recs) const;
+
+   virtual void set_bulk(const record_map_t& recs, boost::int64_t expirySecs = -1) const;
+
+   virtual size_t remove_bulk(const key_list_t& keys) const;
+
+   virtual boost::shared_array<char> get_with_expiry(const void* pkey, size_t ksize, size_t& vsize, boost::int64_t& expiryTime) const;
+
+   // a single round trip using the binary protocol
+   virtual size_t get_bulk_with_expiry(const key_list_t& keys, record_map_t& recs, expiry_map_t& expiryTimes) const;
+
+   virtual bool ping() const;
+
 private:
 
    void throw_kt_exception(const std::string& msg) const;
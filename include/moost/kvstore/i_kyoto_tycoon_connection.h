@@ -31,6 +31,11 @@
 #ifndef MOOST_KVSTORE_KYOTO_TYCOON_CONNECTION_INTERFACE_H
 #define MOOST_KVSTORE_KYOTO_TYCOON_CONNECTION_INTERFACE_H
 
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+
 #include <boost/shared_array.hpp>
 #include <boost/cstdint.hpp>
 
@@ -57,6 +62,96 @@ namespace moost { namespace kvstore {
 
       // throws on failure
       virtual void cache(const void* pkey, size_t ksize, const void* pval, size_t vsize, boost::int64_t expirySecs) const = 0;
+
+   public:
+
+      // bulk methods, each of these is a single round trip on connections
+      // that support it; the defaults below fall back to one call per key
+
+      typedef std::vector<std::string> key_list_t;
+      typedef std::map<std::string, std::string> record_map_t;
+      typedef std::map<std::string, boost::int64_t> expiry_map_t;
+
+      // returns true if the key was removed, false if it wasn't found, throws on failure
+      virtual bool remove(const void* /*pkey*/, size_t /*ksize*/) const
+      {
+         throw std::runtime_error("remove is not supported by this connection");
+      }
+
+      // adds the records found for keys to recs and returns how many were found, throws on failure
+      virtual size_t get_bulk(const key_list_t& keys, record_map_t& recs) const
+      {
+         size_t found = 0;
+         for (key_list_t::const_iterator it = keys.begin(); it != keys.end(); ++it)
+         {
+            size_t vsize;
+            boost::shared_array<char> val = get(it->data(), it->size(), vsize);
+            if (val)
+            {
+               recs[*it].assign(val.get(), vsize);
+               ++found;
+            }
+         }
+         return found;
+      }
+
+      // stores all records, a negative expiry means they never expire, throws on failure
+      virtual void set_bulk(const record_map_t& recs, boost::int64_t expirySecs = -1) const
+      {
+         for (record_map_t::const_iterator it = recs.begin(); it != recs.end(); ++it)
+         {
+            if (expirySecs < 0)
+               set(it->first.data(), it->first.size(), it->second.data(), it->second.size());
+            else
+               cache(it->first.data(), it->first.size(), it->second.data(), it->second.size(), expirySecs);
+         }
+      }
+
+      // returns how many of the keys were removed, throws on failure
+      virtual size_t remove_bulk(const key_list_t& keys) const
+      {
+         size_t removed = 0;
+         for (key_list_t::const_iterator it = keys.begin(); it != keys.end(); ++it)
+         {
+            if (remove(it->data(), it->size()))
+               ++removed;
+         }
+         return removed;
+      }
+
+      // like get, but also returns the absolute expiry time of the record in
+      // seconds since the epoch, or -1 if it never expires or isn't known
+      virtual boost::shared_array<char> get_with_expiry(const void* pkey, size_t ksize, size_t& vsize, boost::int64_t& expiryTime) const
+      {
+         expiryTime = -1;
+         return get(pkey, ksize, vsize);
+      }
+
+      // like get_bulk, but also sets the expiry time of each record found as
+      // get_with_expiry does, throws on failure
+      virtual size_t get_bulk_with_expiry(const key_list_t& keys, record_map_t& recs, expiry_map_t& expiryTimes) const
+      {
+         size_t found = 0;
+         for (key_list_t::const_iterator it = keys.begin(); it != keys.end(); ++it)
+         {
+            size_t vsize;
+            boost::int64_t expiryTime;
+            boost::shared_array<char> val = get_with_expiry(it->data(), it->size(), vsize, expiryTime);
+            if (val)
+            {
+               recs[*it].assign(val.get(), vsize);
+               expiryTimes[*it] = expiryTime;
+               ++found;
+            }
+         }
+         return found;
+      }
+
+      // returns false if the connection is no longer usable
+      virtual bool ping() const
+      {
+         return true;
+      }
    };
 
 }}  // end namespace
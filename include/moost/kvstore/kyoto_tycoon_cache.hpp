@@ -0,0 +1,356 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/// \file
+/// Size-bounded, thread-safe local cache for values read from a Kyoto
+/// Tycoon store. Values are cached until the earlier of their server-side
+/// expiry time and a maximum TTL, which bounds how stale a value can get
+/// when other clients write to the store. Keys that weren't found are
+/// cached for a (short) negative TTL. Concurrent misses on the same key
+/// are coalesced into a single fetch from the store.
+///
+/// The cache is split into shards, each an LRU with its own mutex, so
+/// threads looking up different keys rarely contend.
+///
+/// Values are shared between the cache and its callers and must not be
+/// modified. See CachingKyotoTycoonConnection for a connection that reads
+/// through and writes through a cache.
+
+#ifndef MOOST_KVSTORE_KYOTO_TYCOON_CACHE_HPP
+#define MOOST_KVSTORE_KYOTO_TYCOON_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/cstdint.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "i_kyoto_tycoon_connection.h"
+#include "../container/lru.hpp"
+
+namespace moost { namespace kvstore {
+
+/** @brief Statistics of a KyotoTycoonCache
+ */
+struct KyotoTycoonCacheStats
+{
+   boost::uint64_t hits;           ///< lookups served from a cached value
+   boost::uint64_t negative_hits;  ///< lookups served from a cached "not found"
+   boost::uint64_t misses;         ///< lookups that fetched from the store
+   boost::uint64_t coalesced;      ///< lookups that waited for another thread's fetch of the same key
+   boost::uint64_t evictions;      ///< entries pushed out by the size bound
+   boost::uint64_t expirations;    ///< entries found expired on lookup
+   size_t          entries;        ///< number of entries currently cached
+
+   boost::uint64_t lookups() const
+   {
+      return hits + negative_hits + misses + coalesced;
+   }
+
+   /// fraction of lookups that didn't need their own fetch from the store
+   double hit_rate() const
+   {
+      return lookups() > 0 ? static_cast<double>(lookups() - misses)/lookups() : 0.0;
+   }
+};
+
+class KyotoTycoonCache : public boost::noncopyable
+{
+private:
+
+   struct entry
+   {
+      entry() : vsize(0), expires(0) { }
+      entry(const boost::shared_array<char>& v, size_t vs, boost::int64_t e) : val(v), vsize(vs), expires(e) { }
+
+      boost::shared_array<char> val;   // null for keys that weren't found
+      size_t vsize;
+      boost::int64_t expires;          // milliseconds since the epoch
+   };
+
+   // a fetch in progress, other threads missing on the same key wait for it
+   struct pending
+   {
+      pending() : vsize(0), done(false), stale(false) { }
+
+      boost::condition_variable cond;
+      boost::shared_array<char> val;
+      size_t vsize;
+      std::string error;
+      bool done;
+      bool stale;   // key was written while fetching, so the result isn't cached
+   };
+
+   typedef moost::container::lru<std::string, entry> lru_t;
+   typedef std::map<std::string, boost::shared_ptr<pending> > inflight_t;
+
+   struct shard
+   {
+      shard(size_t maxEntries)
+        : lru(maxEntries)
+        , hits(0), negative_hits(0), misses(0), coalesced(0), evictions(0), expirations(0)
+      {
+         // the default deleted key would make the empty key uncacheable
+         lru.set_deleted_key(std::string(1, '\0') + "moost-kvstore-deleted");
+      }
+
+      boost::mutex mutex;
+      lru_t lru;
+      inflight_t inflight;
+
+      boost::uint64_t hits;
+      boost::uint64_t negative_hits;
+      boost::uint64_t misses;
+      boost::uint64_t coalesced;
+      boost::uint64_t evictions;
+      boost::uint64_t expirations;
+   };
+
+public:
+
+   // maxEntries: bound on the number of cached keys, spread evenly over the shards
+   // maxTtlMs: longest time a value is cached, even if it doesn't expire in the store
+   // negativeTtlMs: how long keys that weren't found are cached, 0 disables negative caching
+   KyotoTycoonCache(size_t maxEntries, int maxTtlMs = 60000, int negativeTtlMs = 1000, size_t numShards = 16)
+     : m_maxTtlMs(maxTtlMs)
+     , m_negativeTtlMs(negativeTtlMs)
+   {
+      if (numShards == 0)
+         throw std::runtime_error("cache needs at least one shard");
+
+      size_t perShard = (std::max)((maxEntries + numShards - 1)/numShards, static_cast<size_t>(1));
+      for (size_t i = 0; i < numShards; ++i)
+         m_shards.push_back(boost::shared_ptr<shard>(new shard(perShard)));
+   }
+
+   // returns the value for key, from the cache or else fetched from conn,
+   // throws if the fetch fails
+   boost::shared_array<char> get(const IKyotoTycoonConnection& conn, const std::string& key, size_t& vsize)
+   {
+      shard& s = shard_for(key);
+      boost::mutex::scoped_lock lock(s.mutex);
+
+      boost::shared_array<char> val;
+      if (lookup(s, key, val, vsize))
+         return val;
+
+      inflight_t::iterator it = s.inflight.find(key);
+      if (it != s.inflight.end())
+      {
+         boost::shared_ptr<pending> p = it->second;
+         ++s.coalesced;
+         while (!p->done)
+            p->cond.wait(lock);
+         if (!p->error.empty())
+            throw std::runtime_error(p->error);
+         vsize = p->vsize;
+         return p->val;
+      }
+
+      boost::shared_ptr<pending> p(new pending);
+      s.inflight[key] = p;
+      ++s.misses;
+      lock.unlock();
+
+      boost::int64_t expiryTime = -1;
+      try
+      {
+         p->val = conn.get_with_expiry(key.data(), key.size(), p->vsize, expiryTime);
+      }
+      catch (const std::exception& ex)
+      {
+         p->error = ex.what();
+      }
+      catch (...)
+      {
+         p->error = "unknown exception";
+      }
+
+      lock.lock();
+      s.inflight.erase(key);
+      if (p->error.empty() && !p->stale)
+         store(s, key, p->val, p->vsize, expiryTime);
+      p->done = true;
+      p->cond.notify_all();
+
+      if (!p->error.empty())
+         throw std::runtime_error(p->error);
+
+      vsize = p->vsize;
+      return p->val;
+   }
+
+   // looks up key without going to the store, returns false if it isn't cached;
+   // a cached "not found" returns true with a null val
+   bool peek(const std::string& key, boost::shared_array<char>& val, size_t& vsize)
+   {
+      shard& s = shard_for(key);
+      boost::mutex::scoped_lock lock(s.mutex);
+      return lookup(s, key, val, vsize);
+   }
+
+   // caches val for key, a null val caches "not found";
+   // expiryTime is in seconds since the epoch, -1 if the value doesn't expire
+   void put(const std::string& key, const boost::shared_array<char>& val, size_t vsize, boost::int64_t expiryTime = -1)
+   {
+      shard& s = shard_for(key);
+      boost::mutex::scoped_lock lock(s.mutex);
+      mark_stale(s, key);
+      store(s, key, val, vsize, expiryTime);
+   }
+
+   void invalidate(const std::string& key)
+   {
+      shard& s = shard_for(key);
+      boost::mutex::scoped_lock lock(s.mutex);
+      mark_stale(s, key);
+      s.lru.erase(key);
+   }
+
+   void clear()
+   {
+      for (size_t i = 0; i < m_shards.size(); ++i)
+      {
+         shard& s = *m_shards[i];
+         boost::mutex::scoped_lock lock(s.mutex);
+         for (inflight_t::iterator it = s.inflight.begin(); it != s.inflight.end(); ++it)
+            it->second->stale = true;
+         s.lru.clear();
+      }
+   }
+
+   void stats(KyotoTycoonCacheStats& st) const
+   {
+      st.hits = st.negative_hits = st.misses = st.coalesced = st.evictions = st.expirations = 0;
+      st.entries = 0;
+
+      for (size_t i = 0; i < m_shards.size(); ++i)
+      {
+         shard& s = *m_shards[i];
+         boost::mutex::scoped_lock lock(s.mutex);
+         st.hits += s.hits;
+         st.negative_hits += s.negative_hits;
+         st.misses += s.misses;
+         st.coalesced += s.coalesced;
+         st.evictions += s.evictions;
+         st.expirations += s.expirations;
+         st.entries += s.lru.size();
+      }
+   }
+
+   void reset_stats()
+   {
+      for (size_t i = 0; i < m_shards.size(); ++i)
+      {
+         shard& s = *m_shards[i];
+         boost::mutex::scoped_lock lock(s.mutex);
+         s.hits = s.negative_hits = s.misses = s.coalesced = s.evictions = s.expirations = 0;
+      }
+   }
+
+private:
+
+   static boost::int64_t now_ms()
+   {
+      static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+      return (boost::posix_time::microsec_clock::universal_time() - epoch).total_milliseconds();
+   }
+
+   shard& shard_for(const std::string& key) const
+   {
+      return *m_shards[boost::hash<std::string>()(key) % m_shards.size()];
+   }
+
+   // must hold the shard's mutex
+   bool lookup(shard& s, const std::string& key, boost::shared_array<char>& val, size_t& vsize)
+   {
+      lru_t::iterator it = s.lru.find(key);
+      if (it == s.lru.end())
+         return false;
+
+      if (it->second.expires <= now_ms())
+      {
+         ++s.expirations;
+         s.lru.erase(it);
+         return false;
+      }
+
+      s.lru.bump(it);
+      val = it->second.val;
+      vsize = it->second.vsize;
+      if (val)
+         ++s.hits;
+      else
+         ++s.negative_hits;
+      return true;
+   }
+
+   // must hold the shard's mutex
+   void store(shard& s, const std::string& key, const boost::shared_array<char>& val, size_t vsize, boost::int64_t expiryTime)
+   {
+      boost::int64_t now = now_ms();
+      boost::int64_t expires = now + (val ? m_maxTtlMs : m_negativeTtlMs);
+      if (val && expiryTime >= 0)
+         expires = (std::min)(expires, expiryTime*1000);
+
+      if (expires <= now)
+      {
+         s.lru.erase(key);
+         return;
+      }
+
+      if (s.lru.size() >= s.lru.max_size() && !s.lru.exists(key))
+         ++s.evictions;
+      s.lru.put(key, entry(val, vsize, expires));
+   }
+
+   // must hold the shard's mutex
+   void mark_stale(shard& s, const std::string& key)
+   {
+      inflight_t::iterator it = s.inflight.find(key);
+      if (it != s.inflight.end())
+         it->second->stale = true;
+   }
+
+private:
+   const boost::int64_t m_maxTtlMs;
+   const boost::int64_t m_negativeTtlMs;
+   std::vector<boost::shared_ptr<shard> > m_shards;
+};
+
+}}  // end namespace
+
+#endif
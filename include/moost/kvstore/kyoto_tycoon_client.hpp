@@ -48,6 +48,9 @@
 
 #include <stdexcept>
 #include <vector>
+#include <map>
+#include <string>
+#include <cstring>
 
 #include "i_kyoto_tycoon_connection.h"
 
@@ -225,6 +228,153 @@ public:
 
       m_conn.cache(key.data(), key.size(), &val, sizeof(val), expirySecs);
    }
+
+   // returns false if key not found, throws on failure
+   template <typename TKey>
+   bool remove(const TKey& key) const
+   {
+      BOOST_STATIC_ASSERT((boost::is_pod<TKey>::value));
+
+      return m_conn.remove(&key, sizeof(key));
+   }
+
+   // returns false if key not found, throws on failure (std::string key override)
+   bool remove(const std::string& key) const
+   {
+      return m_conn.remove(key.data(), key.size());
+   }
+
+public:
+
+   // bulk methods, each is a single round trip to the store
+   // (keys can be POD types or std::string, values POD types or vectors of PODs)
+
+   // adds the values found to vals and returns how many were found,
+   // throws if a value has the wrong size or data alignment
+   template <typename TKey, typename TVal>
+   size_t get_bulk(const std::vector<TKey>& keys, std::map<TKey, TVal>& vals) const
+   {
+      connection_type::key_list_t rawKeys;
+      rawKeys.reserve(keys.size());
+      for (typename std::vector<TKey>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+         rawKeys.push_back(encode_key(*it));
+
+      connection_type::record_map_t recs;
+      m_conn.get_bulk(rawKeys, recs);
+
+      for (connection_type::record_map_t::const_iterator it = recs.begin(); it != recs.end(); ++it)
+      {
+         TKey key;
+         decode_key(it->first, key);
+         decode_value(it->second, vals[key]);
+      }
+
+      return recs.size();
+   }
+
+   // throws on failure
+   template <typename TKey, typename TVal>
+   void set_bulk(const std::map<TKey, TVal>& vals) const
+   {
+      connection_type::record_map_t recs;
+      encode_records(vals, recs);
+      m_conn.set_bulk(recs);
+   }
+
+   // throws on failure
+   template <typename TKey, typename TVal>
+   void cache_bulk(const std::map<TKey, TVal>& vals, boost::int64_t expirySecs) const
+   {
+      connection_type::record_map_t recs;
+      encode_records(vals, recs);
+      m_conn.set_bulk(recs, expirySecs);
+   }
+
+   // returns how many of the keys were removed, throws on failure
+   template <typename TKey>
+   size_t remove_bulk(const std::vector<TKey>& keys) const
+   {
+      connection_type::key_list_t rawKeys;
+      rawKeys.reserve(keys.size());
+      for (typename std::vector<TKey>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+         rawKeys.push_back(encode_key(*it));
+
+      return m_conn.remove_bulk(rawKeys);
+   }
+
+private:
+
+   template <typename TKey, typename TVal>
+   static void encode_records(const std::map<TKey, TVal>& vals, connection_type::record_map_t& recs)
+   {
+      for (typename std::map<TKey, TVal>::const_iterator it = vals.begin(); it != vals.end(); ++it)
+         encode_value(it->second, recs[encode_key(it->first)]);
+   }
+
+   template <typename TKey>
+   static std::string encode_key(const TKey& key)
+   {
+      BOOST_STATIC_ASSERT((boost::is_pod<TKey>::value));
+
+      return std::string(reinterpret_cast<const char *>(&key), sizeof(key));
+   }
+
+   static const std::string& encode_key(const std::string& key)
+   {
+      return key;
+   }
+
+   template <typename TKey>
+   static void decode_key(const std::string& raw, TKey& key)
+   {
+      if (raw.size() != sizeof(TKey))
+         throw std::runtime_error("Retrieved key has incorrect size");
+
+      std::memcpy(&key, raw.data(), sizeof(TKey));
+   }
+
+   static void decode_key(const std::string& raw, std::string& key)
+   {
+      key = raw;
+   }
+
+   template <typename TVal>
+   static void encode_value(const std::vector<TVal>& val, std::string& raw)
+   {
+      BOOST_STATIC_ASSERT((boost::is_pod<TVal>::value));
+
+      if (!val.empty())
+         raw.assign(reinterpret_cast<const char *>(&val[0]), sizeof(TVal) * val.size());
+   }
+
+   template <typename TVal>
+   static void encode_value(const TVal& val, std::string& raw)
+   {
+      BOOST_STATIC_ASSERT((boost::is_pod<TVal>::value));
+
+      raw.assign(reinterpret_cast<const char *>(&val), sizeof(val));
+   }
+
+   // values are copied rather than cast as std::string makes no alignment guarantees
+   template <typename TVal>
+   static void decode_value(const std::string& raw, std::vector<TVal>& val)
+   {
+      if (raw.size() % sizeof(TVal) != 0)
+         throw std::runtime_error("Retrieved value has incorrect data alignment");
+
+      val.resize(raw.size()/sizeof(TVal));
+      if (!val.empty())
+         std::memcpy(&val[0], raw.data(), raw.size());
+   }
+
+   template <typename TVal>
+   static void decode_value(const std::string& raw, TVal& val)
+   {
+      if (raw.size() != sizeof(TVal))
+         throw std::runtime_error("Retrieved value has incorrect size");
+
+      std::memcpy(&val, raw.data(), sizeof(TVal));
+   }
 };
 
 }}  // end namespace
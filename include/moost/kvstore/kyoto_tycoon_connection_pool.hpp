@@ -0,0 +1,434 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/// \file
+/// A thread-safe pool of connections to a Kyoto Tycoon key value store.
+/// Connections are opened lazily, checked with a ping when they have been
+/// idle for longer than the health check interval and reopened if broken.
+/// Bulk operations on the pool split their keys into batches and issue
+/// the batches concurrently on several pooled connections, so that the
+/// round trips overlap instead of adding up. The batches are shared out
+/// between the calling thread and a fixed set of size - 1 worker threads
+/// owned by the pool; whichever is free first takes the next batch.
+///
+/// KyotoTycoonConnectionPool<KyotoTycoonConnection> pool("kt-host", 1978, 1000, 8);
+/// {
+///    KyotoTycoonConnectionPool<KyotoTycoonConnection>::ScopedConnection conn(pool);
+///    KyotoTycoonClient(*conn).get(key, val);
+/// }
+/// pool.get_bulk(keys, recs);
+
+#ifndef MOOST_KVSTORE_KYOTO_TYCOON_CONNECTION_POOL_HPP
+#define MOOST_KVSTORE_KYOTO_TYCOON_CONNECTION_POOL_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "i_kyoto_tycoon_connection.h"
+#include "../container/resource_pool.hpp"
+#include "../thread/worker_group.hpp"
+
+namespace moost { namespace kvstore {
+
+template <class ConnectionT>
+class KyotoTycoonConnectionPool : public boost::noncopyable
+{
+public:
+   typedef ConnectionT connection_type;
+   typedef IKyotoTycoonConnection::key_list_t key_list_t;
+   typedef IKyotoTycoonConnection::record_map_t record_map_t;
+
+private:
+
+   struct entry
+   {
+      entry() : open(false) { }
+
+      ConnectionT conn;
+      bool open;
+      boost::posix_time::ptime last_used;
+   };
+
+   typedef moost::container::resource_pool<entry> pool_t;
+   typedef boost::function<void (IKyotoTycoonConnection&, size_t)> batch_op_t;
+
+   // the batches of one bulk call, shared by everyone working on them; a
+   // worker that gets to it late finds nothing left and never calls op,
+   // which refers to the caller's stack
+   struct bulk_job
+   {
+      bulk_job(size_t num_batches, const batch_op_t& op)
+        : num_batches(num_batches)
+        , op(op)
+        , next(0)
+        , active(0)
+      {
+      }
+
+      const size_t num_batches;
+      const batch_op_t op;
+      size_t next;
+      size_t active;
+      std::string error;
+      boost::mutex mx;
+      boost::condition_variable done;
+   };
+
+   typedef boost::shared_ptr<bulk_job> bulk_job_ptr;
+
+public:
+
+   /// Use a ScopedConnection to get an open, healthy connection from the pool
+   class ScopedConnection : public boost::noncopyable
+   {
+   private:
+      KyotoTycoonConnectionPool& m_pool;
+      typename pool_t::scoped_resource m_res;
+
+   public:
+      ScopedConnection(KyotoTycoonConnectionPool& pool)
+        : m_pool(pool)
+        , m_res(pool.m_pool, pool.m_acquireTimeoutMs)
+      {
+         m_pool.prepare(*m_res);
+      }
+
+      ~ScopedConnection()
+      {
+         if (m_res->open)
+            m_res->last_used = boost::posix_time::microsec_clock::universal_time();
+      }
+
+      ConnectionT& operator*()
+      {
+         return m_res->conn;
+      }
+
+      ConnectionT* operator->()
+      {
+         return &m_res->conn;
+      }
+
+      // closes the connection, e.g. after an error left it in an unknown state;
+      // it is reopened the next time it is taken from the pool
+      void invalidate()
+      {
+         m_pool.close(*m_res);
+      }
+   };
+
+   // healthCheckIntervalMs: connections idle for longer than this are pinged before use, -1 never pings
+   // batchSize: number of keys per round trip in the bulk methods
+   // acquireTimeoutMs: how long to wait for a free connection, -1 waits forever
+   KyotoTycoonConnectionPool(const std::string& host, int port, int timeoutMs, size_t size,
+                             int healthCheckIntervalMs = 30000, size_t batchSize = 1000,
+                             int acquireTimeoutMs = -1)
+     : m_host(host)
+     , m_port(port)
+     , m_timeoutMs(timeoutMs)
+     , m_healthCheckIntervalMs(healthCheckIntervalMs)
+     , m_batchSize(batchSize > 0 ? batchSize : 1)
+     , m_acquireTimeoutMs(acquireTimeoutMs)
+     , m_pool("kyoto tycoon connection")
+     , m_size(size)
+     , m_connects(0)
+     , m_failedHealthChecks(0)
+   {
+      if (size == 0)
+         throw std::runtime_error("connection pool must not be empty");
+
+      for (size_t i = 0; i < size; ++i)
+         m_pool.add_resource(boost::shared_ptr<entry>(new entry));
+
+      if (size > 1)
+         m_workers.reset(new moost::thread::worker_group(size - 1));
+   }
+
+   size_t size() const
+   {
+      return m_size;
+   }
+
+   // number of times a connection was (re)opened
+   size_t connects() const
+   {
+      return m_connects.load();
+   }
+
+   // number of pings that found a broken connection
+   size_t failed_health_checks() const
+   {
+      return m_failedHealthChecks.load();
+   }
+
+public:
+
+   // pipelined bulk methods, these throw if any of the batches fails
+
+   // adds the records found to recs and returns how many were found
+   size_t get_bulk(const key_list_t& keys, record_map_t& recs)
+   {
+      std::vector<key_list_t> batches;
+      split(keys, batches);
+
+      std::vector<record_map_t> results(batches.size());
+      std::vector<size_t> counts(batches.size(), 0);
+      run(batches.size(), boost::bind(&KyotoTycoonConnectionPool::get_batch, _1, _2,
+                                      boost::cref(batches), boost::ref(results), boost::ref(counts)));
+
+      size_t found = 0;
+      for (size_t i = 0; i < results.size(); ++i)
+      {
+         recs.insert(results[i].begin(), results[i].end());
+         found += counts[i];
+      }
+      return found;
+   }
+
+   // a negative expiry means the records never expire
+   void set_bulk(const record_map_t& recs, boost::int64_t expirySecs = -1)
+   {
+      std::vector<record_map_t> batches;
+      split(recs, batches);
+
+      run(batches.size(), boost::bind(&KyotoTycoonConnectionPool::set_batch, _1, _2,
+                                      boost::cref(batches), expirySecs));
+   }
+
+   // returns how many of the keys were removed
+   size_t remove_bulk(const key_list_t& keys)
+   {
+      std::vector<key_list_t> batches;
+      split(keys, batches);
+
+      std::vector<size_t> counts(batches.size(), 0);
+      run(batches.size(), boost::bind(&KyotoTycoonConnectionPool::remove_batch, _1, _2,
+                                      boost::cref(batches), boost::ref(counts)));
+
+      size_t removed = 0;
+      for (size_t i = 0; i < counts.size(); ++i)
+         removed += counts[i];
+      return removed;
+   }
+
+private:
+
+   void prepare(entry& e)
+   {
+      if (e.open && m_healthCheckIntervalMs >= 0 &&
+          boost::posix_time::microsec_clock::universal_time() - e.last_used >
+             boost::posix_time::milliseconds(m_healthCheckIntervalMs))
+      {
+         bool healthy = false;
+         try
+         {
+            healthy = e.conn.ping();
+         }
+         catch (...)
+         {
+         }
+
+         if (!healthy)
+         {
+            ++m_failedHealthChecks;
+            close(e);
+         }
+      }
+
+      if (!e.open)
+      {
+         e.conn.open(m_host, m_port, m_timeoutMs);
+         e.open = true;
+         ++m_connects;
+      }
+
+      e.last_used = boost::posix_time::microsec_clock::universal_time();
+   }
+
+   void close(entry& e)
+   {
+      e.open = false;
+      try
+      {
+         e.conn.close();
+      }
+      catch (...)
+      {
+         // ignore, the connection is reopened on next use anyway
+      }
+   }
+
+   template <class ContainerT>
+   void split(const ContainerT& in, std::vector<ContainerT>& batches) const
+   {
+      batches.reserve((in.size() + m_batchSize - 1)/m_batchSize);
+      for (typename ContainerT::const_iterator it = in.begin(); it != in.end(); ++it)
+      {
+         if (batches.empty() || batches.back().size() >= m_batchSize)
+            batches.push_back(ContainerT());
+         batches.back().insert(batches.back().end(), *it);
+      }
+   }
+
+   static void get_batch(IKyotoTycoonConnection& conn, size_t batch, const std::vector<key_list_t>& batches,
+                         std::vector<record_map_t>& results, std::vector<size_t>& counts)
+   {
+      counts[batch] = conn.get_bulk(batches[batch], results[batch]);
+   }
+
+   static void set_batch(IKyotoTycoonConnection& conn, size_t batch, const std::vector<record_map_t>& batches,
+                         boost::int64_t expirySecs)
+   {
+      conn.set_bulk(batches[batch], expirySecs);
+   }
+
+   static void remove_batch(IKyotoTycoonConnection& conn, size_t batch, const std::vector<key_list_t>& batches,
+                            std::vector<size_t>& counts)
+   {
+      counts[batch] = conn.remove_bulk(batches[batch]);
+   }
+
+   // the calling thread works on the batches too, and any of the pool's
+   // workers that are free join in
+   void run(size_t num_batches, const batch_op_t& op)
+   {
+      if (num_batches == 0)
+         return;
+
+      bulk_job_ptr job(new bulk_job(num_batches, op));
+
+      if (m_workers)
+      {
+         size_t helpers = (std::min)(num_batches, m_size) - 1;
+         for (size_t i = 0; i < helpers; ++i)
+            m_workers->add_job(boost::bind(&KyotoTycoonConnectionPool::work, this, job));
+      }
+
+      work(job);
+
+      boost::mutex::scoped_lock lock(job->mx);
+      while (job->active > 0)
+         job->done.wait(lock);
+
+      if (!job->error.empty())
+         throw std::runtime_error(job->error);
+   }
+
+   // takes batches until there are none left, all on one pooled connection
+   void work(bulk_job_ptr job)
+   {
+      {
+         boost::mutex::scoped_lock lock(job->mx);
+         if (job->next >= job->num_batches)
+            return;
+         ++job->active;
+      }
+
+      std::string error;
+
+      try
+      {
+         ScopedConnection conn(*this);
+
+         try
+         {
+            for (;;)
+            {
+               size_t batch;
+
+               {
+                  boost::mutex::scoped_lock lock(job->mx);
+                  if (job->next >= job->num_batches)
+                     break;
+                  batch = job->next++;
+               }
+
+               job->op(*conn, batch);
+            }
+         }
+         catch (...)
+         {
+            conn.invalidate();
+            throw;
+         }
+      }
+      catch (const std::exception& ex)
+      {
+         error = ex.what();
+      }
+      catch (...)
+      {
+         error = "unknown exception";
+      }
+
+      boost::mutex::scoped_lock lock(job->mx);
+
+      if (!error.empty())
+      {
+         // the call fails anyway, don't start any more batches
+         job->next = job->num_batches;
+         if (job->error.empty())
+            job->error = error;
+      }
+
+      if (--job->active == 0)
+         job->done.notify_all();
+   }
+
+private:
+   const std::string m_host;
+   const int m_port;
+   const int m_timeoutMs;
+   const int m_healthCheckIntervalMs;
+   const size_t m_batchSize;
+   const int m_acquireTimeoutMs;
+
+   pool_t m_pool;
+   const size_t m_size;
+
+   boost::atomic<size_t> m_connects;
+   boost::atomic<size_t> m_failedHealthChecks;
+
+   // last, so the workers are stopped before the connections go away
+   boost::scoped_ptr<moost::thread::worker_group> m_workers;
+};
+
+}}  // end namespace
+
+#endif
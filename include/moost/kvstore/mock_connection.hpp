@@ -29,6 +29,9 @@
 /// Mock key value store connections for testing.
 /// Doesn't persist anything but multiple mock connections
 /// will access the same underlying singleton in-memory store.
+/// A network round trip can be simulated with a fixed latency
+/// per call (bulk calls count as a single round trip), which
+/// makes the mock useful for benchmarking batching and pooling.
 
 #ifndef FM_LAST_KVSTORE_MOCK_CONNECTION_HPP
 #define FM_LAST_KVSTORE_MOCK_CONNECTION_HPP
@@ -41,6 +44,8 @@
 #include <ctime>
 
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
 
 namespace moost { namespace kvstore {
 
@@ -64,10 +69,10 @@ public:
 
    // throws on failure, supply key "fail" to force failure
    template <class StoreT>
-   static void cache(StoreT& store, const char* pkey, size_t ksize, const char* pval, size_t vsize, int expiryTime)
+   static void cache(StoreT& store, const char* pkey, size_t ksize, const char* pval, size_t vsize, boost::int64_t expirySecs)
    {
       std::string key(pkey, ksize);
-      store.cache(key, pval, vsize, expiryTime);
+      store.cache(key, pval, vsize, expirySecs);
    }
 };
 
@@ -100,6 +105,7 @@ public:
    boost::shared_array<char> get(const void* pkey, size_t ksize, size_t& vsize) const
    {
       assert_data_store_open();
+      round_trip();
       return AccessPolicy::get(store(), reinterpret_cast<const char *>(pkey), ksize, vsize);
    }
 
@@ -107,6 +113,7 @@ public:
    virtual void set(const void* pkey, size_t ksize, const void* pval, size_t vsize) const
    {
       assert_data_store_open();
+      round_trip();
       AccessPolicy::set(store(), reinterpret_cast<const char *>(pkey), ksize, reinterpret_cast<const char *>(pval), vsize);
    }
 
@@ -114,8 +121,150 @@ public:
    virtual void cache(const void* pkey, size_t ksize, const void* pval, size_t vsize, boost::int64_t expirySecs) const
    {
       assert_data_store_open();
-      boost::int64_t expiryTime = time(0) + expirySecs;
-      AccessPolicy::cache(store(), reinterpret_cast<const char *>(pkey), ksize, reinterpret_cast<const char *>(pval), vsize, expiryTime);
+      round_trip();
+      AccessPolicy::cache(store(), reinterpret_cast<const char *>(pkey), ksize, reinterpret_cast<const char *>(pval), vsize, expirySecs);
+   }
+
+   virtual bool remove(const void* pkey, size_t ksize) const
+   {
+      assert_data_store_open();
+      round_trip();
+      return store().remove(std::string(reinterpret_cast<const char *>(pkey), ksize));
+   }
+
+   virtual size_t get_bulk(const key_list_t& keys, record_map_t& recs) const
+   {
+      assert_data_store_open();
+      round_trip();
+      size_t found = 0;
+      for (key_list_t::const_iterator it = keys.begin(); it != keys.end(); ++it)
+      {
+         size_t vsize;
+         boost::shared_array<char> val = AccessPolicy::get(store(), it->data(), it->size(), vsize);
+         if (val)
+         {
+            recs[*it].assign(val.get(), vsize);
+            ++found;
+         }
+      }
+      return found;
+   }
+
+   // throws on failure, include key "fail" to force failure
+   virtual void set_bulk(const record_map_t& recs, boost::int64_t expirySecs = -1) const
+   {
+      assert_data_store_open();
+      round_trip();
+      for (record_map_t::const_iterator it = recs.begin(); it != recs.end(); ++it)
+      {
+         if (expirySecs < 0)
+            AccessPolicy::set(store(), it->first.data(), it->first.size(), it->second.data(), it->second.size());
+         else
+            AccessPolicy::cache(store(), it->first.data(), it->first.size(), it->second.data(), it->second.size(), expirySecs);
+      }
+   }
+
+   virtual size_t remove_bulk(const key_list_t& keys) const
+   {
+      assert_data_store_open();
+      round_trip();
+      size_t removed = 0;
+      for (key_list_t::const_iterator it = keys.begin(); it != keys.end(); ++it)
+      {
+         if (store().remove(*it))
+            ++removed;
+      }
+      return removed;
+   }
+
+   // bypasses the access policy
+   virtual boost::shared_array<char> get_with_expiry(const void* pkey, size_t ksize, size_t& vsize, boost::int64_t& expiryTime) const
+   {
+      assert_data_store_open();
+      round_trip();
+      return store().get(std::string(reinterpret_cast<const char *>(pkey), ksize), vsize, expiryTime);
+   }
+
+   // bypasses the access policy
+   virtual size_t get_bulk_with_expiry(const key_list_t& keys, record_map_t& recs, expiry_map_t& expiryTimes) const
+   {
+      assert_data_store_open();
+      round_trip();
+      size_t found = 0;
+      for (key_list_t::const_iterator it = keys.begin(); it != keys.end(); ++it)
+      {
+         size_t vsize;
+         boost::int64_t expiryTime;
+         boost::shared_array<char> val = store().get(*it, vsize, expiryTime);
+         if (val)
+         {
+            recs[*it].assign(val.get(), vsize);
+            expiryTimes[*it] = expiryTime;
+            ++found;
+         }
+      }
+      return found;
+   }
+
+   virtual bool ping() const
+   {
+      if (!isOpen_)
+         return false;
+      round_trip();
+      return !unhealthy();
+   }
+
+public:
+
+   // simulated latency of every call to the store, in microseconds
+   static void set_round_trip_latency_us(int latencyUs)
+   {
+      latency_us() = latencyUs;
+   }
+
+   // number of calls made to the store by all mock connections
+   static size_t round_trips()
+   {
+      return round_trip_count().load();
+   }
+
+   static void reset_round_trips()
+   {
+      round_trip_count() = 0;
+   }
+
+   // makes ping() fail on all mock connections, to test health checks
+   static void set_unhealthy(bool bad)
+   {
+      unhealthy() = bad;
+   }
+
+private:
+
+   static boost::atomic<int>& latency_us()
+   {
+      static boost::atomic<int> latency(0);
+      return latency;
+   }
+
+   static boost::atomic<size_t>& round_trip_count()
+   {
+      static boost::atomic<size_t> count(0);
+      return count;
+   }
+
+   static boost::atomic<bool>& unhealthy()
+   {
+      static boost::atomic<bool> bad(false);
+      return bad;
+   }
+
+   static void round_trip()
+   {
+      ++round_trip_count();
+      int us = latency_us().load();
+      if (us > 0)
+         boost::this_thread::sleep(boost::posix_time::microseconds(us));
    }
 
 private:
@@ -146,6 +295,13 @@ private:
       // return a copy of the stored char*
       // or 0 if not found
       boost::shared_array<char> get(const std::string& key, size_t& vsize) const
+      {
+         boost::int64_t expiryTime;
+         return get(key, vsize, expiryTime);
+      }
+
+      // expiryTime is -1 for records that never expire
+      boost::shared_array<char> get(const std::string& key, size_t& vsize, boost::int64_t& expiryTime) const
       {
          boost::shared_array<char> val;
          vsize = 0;
@@ -153,14 +309,18 @@ private:
 
          boost::mutex::scoped_lock lock(mutex_);
 
-         if (!get(key, expiry, expiry_) || expiry >= time(0))
+         bool expires = get(key, expiry, expiry_);
+         expiryTime = expires ? static_cast<boost::int64_t>(expiry) : -1;
+
+         if (!expires || expiry >= time(0))
          {
             entry_t entry;
             if (get(key, entry, db_))
             {
                vsize = entry.size();
                val.reset(new char[vsize+1]);
-               memcpy(val.get(), &entry[0], entry.size());
+               if (vsize > 0)
+                  memcpy(val.get(), &entry[0], vsize);
                val[vsize] = 0;
             }
          }
@@ -185,6 +345,14 @@ private:
          expiry_[key] = time(0) + static_cast<time_t>(expirySecs);
       }
 
+      // returns false if there was no such key
+      bool remove(const std::string& key)
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         expiry_.erase(key);
+         return db_.erase(key) > 0;
+      }
+
    private:
 
       template <typename TKey, typename TVal, typename TMap>
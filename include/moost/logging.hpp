@@ -32,6 +32,7 @@
 
 #include "logging/logger.hpp"
 #include "logging/global.hpp"
+#include "logging/async_logger.hpp"
 #include "logging/function_logger.hpp"
 #include "logging/class_logger.hpp"
 #include "logging/nsca_appender.hpp"
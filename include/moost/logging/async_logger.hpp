@@ -0,0 +1,917 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file async_logger.hpp
+ * @brief An optional asynchronous backend for the MLOG macros
+ *
+ * By default every MLOG call formats its message and runs the log4cxx
+ * appenders on the calling thread, so a slow appender (a file on a busy
+ * disk, a remote socket) slows down whoever is logging. Once the async
+ * logger has been started the MLOG macros instead render the message into
+ * a per-thread lock-free ring and return; a single dispatcher thread takes
+ * records from all the rings and hands them to the logger's appenders.
+ *
+ * \code
+ * moost::logging::async_logger_singleton::instance().start(
+ *    8192, moost::logging::async_overflow_policy::DROP);
+ * \endcode
+ *
+ * Records from one thread are written in the order they were logged;
+ * records from different threads are interleaved in roughly that order.
+ * Because log4cxx takes the timestamp and thread name of an event when the
+ * event is created, those will be the dispatcher's (the timestamp is
+ * usually only microseconds late). FATAL records are waited for before the
+ * MLOG call returns, global::disable() flushes anything still queued and,
+ * unless asked not to, a SIGSEGV, SIGBUS, SIGILL, SIGFPE or SIGABRT gives
+ * the dispatcher a moment to drain before the signal takes its course.
+ *
+ * Records logged with the MLOG_FMT macros (see log_format.hpp) travel in
+ * their captured form and are rendered by the dispatcher instead.
+ *
+ * Defining MLOG_NO_ASYNC before including logger.hpp compiles the MLOG
+ * macros without the asynchronous path at all.
+ */
+
+#ifndef MOOST_LOGGING_ASYNC_LOGGER_HPP__
+#define MOOST_LOGGING_ASYNC_LOGGER_HPP__
+
+#include <csignal>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+#include <poll.h>
+#include <pthread.h>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <log4cxx/logger.h>
+
+#include "../io/detail/append_streambuf.hpp"
+#include "log_format.hpp"
+#include "../utils/singleton.hpp"
+#include "../compiler/branch_expect.hpp"
+
+/**
+ * @brief Log through the async logger if it is running, else synchronously
+ *
+ * This is what the MLOG_LEVEL_* macros expand to. The level check and the
+ * formatting of the message happen on the calling thread, as they always
+ * have; only the appenders run on the dispatcher thread. A message that
+ * logs while it is being formatted is logged synchronously (see
+ * async_logger::producer()), so it can't clobber the outer record.
+ */
+#define MLOG_ASYNC__(logger, message, lvl, sync) \
+   do \
+   { \
+      ::log4cxx::LoggerPtr const & mlog_logger__ = (logger); \
+      if (expect_unlikely__(mlog_logger__->is##lvl##Enabled())) \
+      { \
+         ::moost::logging::detail::async_log_producer * mlog_producer__ = \
+            ::moost::logging::async_logger::producer(); \
+         if (mlog_producer__) \
+         { \
+            ::moost::logging::detail::async_log_producer::scope mlog_scope__(*mlog_producer__); \
+            mlog_scope__.stream() << message; \
+            ::moost::logging::async_logger::commit(*mlog_producer__, \
+               mlog_logger__, ::log4cxx::Level::get##lvl(), LOG4CXX_LOCATION); \
+         } \
+         else \
+         { \
+            sync(mlog_logger__, message); \
+         } \
+      } \
+   } \
+   while (0)
+
+namespace moost { namespace logging {
+
+   /**
+    * @brief What a logging thread does when its ring is full
+    */
+   struct async_overflow_policy
+   {
+      enum type
+      {
+         BLOCK,   // wait for the dispatcher to make room
+         DROP,    // discard the new record
+         SAMPLE   // above half full keep one record in sample_rate, discard when full
+      };
+   };
+
+   /**
+    * @brief Counters summed over all logging threads
+    *
+    * ERROR and FATAL records are never dropped or sampled out, whatever the
+    * policy; when the ring is full they wait just as with BLOCK.
+    */
+   struct async_logger_stats
+   {
+      size_t enqueued;     // records handed to the dispatcher
+      size_t written;      // records passed to the appenders
+      size_t dropped;      // records discarded because a ring was full
+      size_t sampled_out;  // records discarded by the SAMPLE policy
+      size_t blocked;      // times a logging thread had to wait for room
+
+      async_logger_stats()
+         : enqueued(0), written(0), dropped(0), sampled_out(0), blocked(0)
+      {
+      }
+   };
+
+namespace detail {
+
+   /**
+    * @brief A bounded single producer, single consumer ring of log records
+    *
+    * Message bytes are swapped in and out of the slots rather than copied,
+    * so once the buffers have grown to the size of a typical message
+    * neither side allocates.
+    */
+   class async_log_ring : public boost::noncopyable
+   {
+   public:
+      struct record
+      {
+         log4cxx::LoggerPtr logger;
+         log4cxx::LevelPtr level;
+         log4cxx::spi::LocationInfo location;
+         std::vector<char> message;
+         bool encoded;      // message holds a log_format's data()
+      };
+
+      explicit async_log_ring(size_t capacity)
+         : head_(0)
+         , tail_(0)
+      {
+         size_t size = 2;
+         while (size < capacity)
+            size <<= 1;
+         slots_.resize(size);
+         mask_ = size - 1;
+      }
+
+      size_t capacity() const
+      {
+         return slots_.size();
+      }
+
+      size_t size() const
+      {
+         return tail_.load(boost::memory_order_acquire) - head_.load(boost::memory_order_acquire);
+      }
+
+      bool empty() const
+      {
+         return size() == 0;
+      }
+
+      /// producer only; swaps message with the slot's (consumed) buffer
+      bool try_push(log4cxx::LoggerPtr const & logger, log4cxx::LevelPtr const & level,
+                    log4cxx::spi::LocationInfo const & location, std::vector<char> & message,
+                    bool encoded)
+      {
+         size_t tail = tail_.load(boost::memory_order_relaxed);
+         if (tail - head_.load(boost::memory_order_acquire) >= slots_.size())
+            return false;
+         record & r = slots_[tail & mask_];
+         r.logger = logger;
+         r.level = level;
+         r.location = location;
+         r.message.swap(message);
+         r.encoded = encoded;
+         // sequentially consistent so a dispatcher about to sleep can't miss it
+         tail_.store(tail + 1, boost::memory_order_seq_cst);
+         return true;
+      }
+
+      /// consumer only; the oldest record or 0, valid until pop()
+      record * front()
+      {
+         size_t head = head_.load(boost::memory_order_relaxed);
+         if (head == tail_.load(boost::memory_order_acquire))
+            return 0;
+         return &slots_[head & mask_];
+      }
+
+      /// consumer only
+      void pop()
+      {
+         size_t head = head_.load(boost::memory_order_relaxed);
+         record & r = slots_[head & mask_];
+         r.logger = log4cxx::LoggerPtr();
+         r.level = log4cxx::LevelPtr();
+         r.message.clear();   // swapped back to a producer by a later push
+         head_.store(head + 1, boost::memory_order_release);
+      }
+
+   private:
+      std::vector<record> slots_;
+      size_t mask_;
+      boost::atomic<size_t> head_;
+      char pad_[64];
+      boost::atomic<size_t> tail_;
+   };
+
+   /**
+    * @brief The state kept for each thread that logs asynchronously
+    */
+   class async_log_producer : public boost::noncopyable
+   {
+   public:
+      /**
+       * @brief Marks the producer busy while a record is formatted and committed
+       *
+       * While a scope is alive async_logger::producer() returns 0 on this
+       * thread, so a log call made while formatting the message (or from an
+       * appender run by the commit) is logged synchronously instead of
+       * reusing the message buffer.
+       */
+      class scope : public boost::noncopyable
+      {
+      public:
+         explicit scope(async_log_producer & p)
+            : p_(p)
+         {
+            p_.busy = true;
+         }
+
+         ~scope()
+         {
+            p_.busy = false;
+         }
+
+         std::ostream & stream()
+         {
+            return p_.begin();
+         }
+
+      private:
+         async_log_producer & p_;
+      };
+
+      explicit async_log_producer(size_t capacity)
+         : ring(capacity)
+         , encoded(false)
+         , busy(false)
+         , pushing(false)
+         , orphaned(false)
+         , sample_count(0)
+         , enqueued(0)
+         , written(0)
+         , dropped(0)
+         , sampled_out(0)
+         , blocked(0)
+         , buf_(message)
+         , stream_(&buf_)
+      {
+      }
+
+      /// capture a log_format, to be rendered by whoever writes it
+      void capture(log_format const & format)
+      {
+         message.assign(format.data(), format.data() + format.size());
+         encoded = true;
+      }
+
+      /// render message, however it was captured
+      static void render(std::vector<char> const & message, bool encoded, std::string & out)
+      {
+         if (message.empty())
+            out.clear();
+         else if (encoded)
+            log_format::render(&message[0], message.size(), out);
+         else
+            out.assign(message.begin(), message.end());
+      }
+
+      /// an empty stream with default formatting to render a message into
+      std::ostream & begin()
+      {
+         message.clear();
+         encoded = false;
+         stream_.flags(std::ios_base::dec | std::ios_base::skipws);
+         stream_.precision(6);
+         stream_.width(0);
+         stream_.fill(' ');
+         return stream_;
+      }
+
+      async_log_ring ring;
+      std::vector<char> message;
+      bool encoded;
+      bool busy;                     // a scope is alive, owning thread only
+      boost::atomic<bool> pushing;   // set while a record is being committed
+      boost::atomic<bool> orphaned;  // set when the thread has exited
+      size_t sample_count;
+
+      // written by the owning thread (written by the dispatcher) only
+      boost::atomic<size_t> enqueued;
+      boost::atomic<size_t> written;
+      boost::atomic<size_t> dropped;
+      boost::atomic<size_t> sampled_out;
+      boost::atomic<size_t> blocked;
+
+   private:
+      moost::io::detail::append_streambuf buf_;
+      std::ostream stream_;
+   };
+
+}
+
+   /**
+    * @brief The asynchronous logging backend
+    *
+    * This is a singleton (see async_logger_singleton) because the MLOG
+    * macros need to find it without being told where it is. It does
+    * nothing until start() is called and can be stopped and started again
+    * at any time; while it is stopped MLOG logs synchronously as before.
+    */
+   class async_logger : public boost::noncopyable
+   {
+   template <typename T> friend
+      class moost::utils::singleton_default<T>::friend_type;
+
+   private:
+      typedef boost::shared_ptr<detail::async_log_producer> producer_ptr;
+
+      // owned by thread local storage, so we know when a thread exits
+      struct producer_handle
+      {
+         explicit producer_handle(producer_ptr const & p) : producer(p) {}
+
+         ~producer_handle()
+         {
+            if (producer)
+               producer->orphaned.store(true);
+         }
+
+         producer_ptr producer;
+      };
+
+      enum { FATAL_SIGNAL_COUNT = 5 };
+
+      async_logger()
+         : running_(false)
+         , idle_(false)
+         , ring_capacity_(8192)
+         , policy_(async_overflow_policy::BLOCK)
+         , sample_rate_(10)
+         , pending_(0)
+         , dispatcher_id_()
+         , generation_(0)
+      {
+      }
+
+   public:
+      ~async_logger()
+      {
+         stop();
+      }
+
+      /**
+       * @brief Start the dispatcher thread
+       *
+       * @param ring_capacity records each logging thread can have queued
+       * @param policy what to do when a thread's ring is full
+       * @param sample_rate with SAMPLE, keep one in this many records once a
+       *        ring is half full
+       * @param flush_on_fatal_signals give the dispatcher up to 2s to drain
+       *        the rings before a SIGSEGV, SIGBUS, SIGILL, SIGFPE or SIGABRT
+       *        takes effect
+       *
+       * @note Flushing on a fatal signal is best-effort. The handler takes no
+       *       locks and runs no appenders, it only waits for the dispatcher
+       *       thread, which won't get far if the process state it needs has
+       *       been corrupted or if it is the thread that crashed. Records
+       *       still queued when the wait ends are lost.
+       *
+       * @note The ring capacity only applies to threads that log for the
+       *       first time after this call.
+       */
+      void start(size_t ring_capacity = 8192,
+                 async_overflow_policy::type policy = async_overflow_policy::BLOCK,
+                 size_t sample_rate = 10,
+                 bool flush_on_fatal_signals = false)
+      {
+         boost::mutex::scoped_lock lock(control_mutex_);
+
+         if (running_.load())
+            throw std::runtime_error("async logger is already running");
+
+         ring_capacity_ = ring_capacity;
+         policy_ = policy;
+         sample_rate_ = sample_rate > 0 ? sample_rate : 1;
+
+         if (flush_on_fatal_signals)
+            install_fatal_signal_handlers();
+
+         running_.store(true);
+         thread_.reset(new boost::thread(boost::bind(&async_logger::dispatch_loop, this)));
+         dispatcher_id_ = thread_->native_handle();
+      }
+
+      /**
+       * @brief Write out everything queued and stop the dispatcher thread
+       */
+      void stop()
+      {
+         boost::mutex::scoped_lock lock(control_mutex_);
+
+         if (!running_.load())
+            return;
+
+         running_.store(false);
+         wake();
+         thread_->join();
+         thread_.reset();
+
+         // a thread that saw us running may still be committing a record;
+         // once it is done we are the only consumer left
+         std::vector<producer_ptr> producers;
+         snapshot(producers);
+         for (size_t i = 0; i < producers.size(); ++i)
+         {
+            while (producers[i]->pushing.load())
+               boost::this_thread::yield();
+            drain(*producers[i], static_cast<size_t>(-1));
+         }
+      }
+
+      bool is_running() const
+      {
+         return running_.load(boost::memory_order_acquire);
+      }
+
+      /**
+       * @brief Wait until everything logged so far has been written
+       *
+       * @param timeout_ms give up after this long (-1 waits forever)
+       *
+       * @return false if records were still queued when the wait timed out
+       *         (or when called from an appender on the dispatcher thread)
+       */
+      bool flush(int timeout_ms = -1)
+      {
+         if (!is_running())
+            return true;
+
+         if (on_dispatcher())
+            return false;
+
+         return wait_drained(timeout_ms);
+      }
+
+      async_logger_stats stats() const
+      {
+         std::vector<producer_ptr> producers;
+         async_logger_stats s;
+
+         {
+            boost::mutex::scoped_lock lock(registry_mutex_);
+            producers = producers_;
+            s = retired_;
+         }
+
+         for (size_t i = 0; i < producers.size(); ++i)
+            add_stats(s, *producers[i]);
+
+         return s;
+      }
+
+      /**
+       * @brief The calling thread's producer, or 0 if logging should be synchronous
+       *
+       * Used by the MLOG macros; there is no need to call this directly.
+       */
+      static detail::async_log_producer * producer();
+
+      /**
+       * @brief Queue the message rendered into p
+       *
+       * Used by the MLOG macros; there is no need to call this directly. If
+       * the logger has been stopped since producer() was called the record
+       * is written synchronously instead.
+       */
+      static void commit(detail::async_log_producer & p,
+                         log4cxx::LoggerPtr const & logger,
+                         log4cxx::LevelPtr const & level,
+                         log4cxx::spi::LocationInfo const & location);
+
+      /**
+       * @brief Log a log_format, rendering it only when it is written
+       *
+       * Used by the MLOG_FMT macros; synchronous unless the async logger
+       * is running.
+       */
+      static void log(log4cxx::LoggerPtr const & logger,
+                      log4cxx::LevelPtr const & level,
+                      log_format const & format,
+                      log4cxx::spi::LocationInfo const & location);
+
+   private:
+      detail::async_log_producer * local_producer()
+      {
+         producer_handle * h = local_.get();
+
+         if (!h)
+         {
+            producer_ptr p(new detail::async_log_producer(ring_capacity_));
+
+            {
+               boost::mutex::scoped_lock lock(registry_mutex_);
+               producers_.push_back(p);
+               ++generation_;
+            }
+
+            h = new producer_handle(p);
+            local_.reset(h);
+         }
+
+         return h->producer.get();
+      }
+
+      /// the dispatcher has a handle without a producer, it logs synchronously
+      bool on_dispatcher() const
+      {
+         producer_handle const * h = local_.get();
+         return h && !h->producer;
+      }
+
+      void push(detail::async_log_producer & p,
+                log4cxx::LoggerPtr const & logger,
+                log4cxx::LevelPtr const & level,
+                log4cxx::spi::LocationInfo const & location)
+      {
+         bool important = level->toInt() >= log4cxx::Level::ERROR_INT;
+
+         if (!important && policy_ == async_overflow_policy::SAMPLE &&
+               p.ring.size() >= p.ring.capacity() / 2 && (p.sample_count++ % sample_rate_) != 0)
+         {
+            p.sampled_out.store(p.sampled_out.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+            return;
+         }
+
+         // counted before the push so that the dispatcher can't write it first
+         pending_.fetch_add(1, boost::memory_order_relaxed);
+
+         if (!p.ring.try_push(logger, level, location, p.message, p.encoded))
+         {
+            if (!important && policy_ != async_overflow_policy::BLOCK)
+            {
+               p.dropped.store(p.dropped.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+               pending_.fetch_sub(1, boost::memory_order_relaxed);
+               return;
+            }
+
+            p.blocked.store(p.blocked.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+
+            do
+            {
+               wake();
+               if (!running_.load())
+               {
+                  pending_.fetch_sub(1, boost::memory_order_relaxed);
+                  std::string message;
+                  detail::async_log_producer::render(p.message, p.encoded, message);
+                  logger->forcedLog(level, message, location);
+                  return;
+               }
+               boost::this_thread::sleep(boost::posix_time::microseconds(50));
+            }
+            while (!p.ring.try_push(logger, level, location, p.message, p.encoded));
+         }
+
+         p.enqueued.store(p.enqueued.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+
+         if (idle_.load())
+            wake();
+      }
+
+      void wake()
+      {
+         boost::mutex::scoped_lock lock(wake_mutex_);
+         wake_cond_.notify_one();
+      }
+
+      void snapshot(std::vector<producer_ptr> & producers) const
+      {
+         boost::mutex::scoped_lock lock(registry_mutex_);
+         producers = producers_;
+      }
+
+      static void add_stats(async_logger_stats & s, detail::async_log_producer const & p)
+      {
+         s.enqueued += p.enqueued.load(boost::memory_order_relaxed);
+         s.written += p.written.load(boost::memory_order_relaxed);
+         s.dropped += p.dropped.load(boost::memory_order_relaxed);
+         s.sampled_out += p.sampled_out.load(boost::memory_order_relaxed);
+         s.blocked += p.blocked.load(boost::memory_order_relaxed);
+      }
+
+      /// writes up to max records from p, returns how many
+      size_t drain(detail::async_log_producer & p, size_t max)
+      {
+         size_t count = 0;
+
+         for (detail::async_log_ring::record * r; count < max && (r = p.ring.front()) != 0; ++count)
+         {
+            detail::async_log_producer::render(r->message, r->encoded, message_);
+
+            try
+            {
+               r->logger->forcedLog(r->level, message_, r->location);
+            }
+            catch (...)
+            {
+               // a broken appender must not stop the other records
+            }
+
+            p.ring.pop();
+            pending_.fetch_sub(1, boost::memory_order_release);
+            p.written.store(p.written.load(boost::memory_order_relaxed) + 1, boost::memory_order_release);
+         }
+
+         return count;
+      }
+
+      bool all_empty(std::vector<producer_ptr> const & producers) const
+      {
+         for (size_t i = 0; i < producers.size(); ++i)
+            if (!producers[i]->ring.empty())
+               return false;
+         return true;
+      }
+
+      void dispatch_loop()
+      {
+         std::vector<producer_ptr> producers;
+         size_t generation = static_cast<size_t>(-1);
+         int spins = 0;
+
+         local_.reset(new producer_handle(producer_ptr()));
+
+         for (;;)
+         {
+            bool running = running_.load();
+
+            {
+               boost::mutex::scoped_lock lock(registry_mutex_);
+               retire_orphans();
+               if (generation != generation_)
+               {
+                  producers = producers_;
+                  generation = generation_;
+               }
+            }
+
+            // a limited batch from each thread in turn, so that one busy
+            // thread can't hold back everybody else's records
+            size_t written = 0;
+            for (size_t i = 0; i < producers.size(); ++i)
+               written += drain(*producers[i], 256);
+
+            if (written > 0)
+            {
+               spins = 0;
+               continue;
+            }
+
+            if (!running)
+               break;
+
+            // waking us costs a logging thread a system call, so look again
+            // a few times before going to sleep
+            if (spins++ < 64)
+            {
+               boost::this_thread::yield();
+               continue;
+            }
+
+            spins = 0;
+            boost::mutex::scoped_lock lock(wake_mutex_);
+            idle_.store(true);
+            if (all_empty(producers) && running_.load())
+               wake_cond_.timed_wait(lock, boost::posix_time::milliseconds(100));
+            idle_.store(false);
+         }
+      }
+
+      // registry_mutex_ must be held
+      void retire_orphans()
+      {
+         for (size_t i = 0; i < producers_.size(); )
+         {
+            detail::async_log_producer & p = *producers_[i];
+            if (p.orphaned.load() && p.ring.empty())
+            {
+               add_stats(retired_, p);
+               producers_.erase(producers_.begin() + i);
+               ++generation_;
+            }
+            else
+               ++i;
+         }
+      }
+
+      /// polls until every ring is empty
+      bool wait_drained(int timeout_ms)
+      {
+         for (long polls = 0; ; ++polls)
+         {
+            {
+               boost::mutex::scoped_lock lock(registry_mutex_);
+               if (all_empty(producers_))
+                  return true;
+            }
+
+            if (timeout_ms >= 0 && polls >= 10L * timeout_ms)
+               return false;
+
+            wake();
+            boost::this_thread::sleep(boost::posix_time::microseconds(100));
+         }
+      }
+
+      static int fatal_signal(size_t i)
+      {
+         static int const signals[FATAL_SIGNAL_COUNT] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+         return signals[i];
+      }
+
+      static struct sigaction & previous_action(size_t i)
+      {
+         static struct sigaction actions[FATAL_SIGNAL_COUNT];
+         return actions[i];
+      }
+
+      static void on_fatal_signal(int sig);
+
+      // control_mutex_ must be held; leaves alone signals we already handle
+      void install_fatal_signal_handlers()
+      {
+         for (size_t i = 0; i < FATAL_SIGNAL_COUNT; ++i)
+         {
+            struct sigaction current;
+            sigaction(fatal_signal(i), 0, &current);
+
+            if (current.sa_handler != &async_logger::on_fatal_signal)
+            {
+               struct sigaction sa;
+               sa.sa_handler = &async_logger::on_fatal_signal;
+               sigemptyset(&sa.sa_mask);
+               sa.sa_flags = 0;
+               sigaction(fatal_signal(i), &sa, &previous_action(i));
+            }
+         }
+      }
+
+   private:
+      boost::atomic<bool> running_;
+      boost::atomic<bool> idle_;
+      size_t ring_capacity_;
+      async_overflow_policy::type policy_;
+      size_t sample_rate_;
+      boost::atomic<size_t> pending_;     // records queued in all rings, for the signal handler
+      pthread_t dispatcher_id_;
+
+      boost::mutex control_mutex_;        // serialises start() and stop()
+      boost::scoped_ptr<boost::thread> thread_;
+
+      mutable boost::mutex registry_mutex_;
+      std::vector<producer_ptr> producers_;
+      size_t generation_;
+      async_logger_stats retired_;        // counters of threads that have exited
+
+      boost::mutex wake_mutex_;
+      boost::condition_variable wake_cond_;
+
+      boost::thread_specific_ptr<producer_handle> local_;
+      std::string message_;               // dispatcher's reusable message buffer
+   };
+
+   /**
+    * @brief Singleton instance of async_logger
+    *
+    * To log asynchronously:
+    *
+    *    async_logger_singleton::instance().start(...);
+    */
+   typedef moost::utils::singleton_default<async_logger> async_logger_singleton;
+
+   inline detail::async_log_producer * async_logger::producer()
+   {
+      async_logger & self = async_logger_singleton::instance();
+
+      if (!self.is_running())
+         return 0;
+
+      detail::async_log_producer * p = self.local_producer();
+
+      // logging from inside another record's message, do it synchronously
+      return p->busy ? 0 : p;
+   }
+
+   inline void async_logger::commit(detail::async_log_producer & p,
+                                    log4cxx::LoggerPtr const & logger,
+                                    log4cxx::LevelPtr const & level,
+                                    log4cxx::spi::LocationInfo const & location)
+   {
+      async_logger & self = async_logger_singleton::instance();
+
+      // pairs with stop(): either it waits for us or we see it has stopped
+      p.pushing.store(true);
+
+      if (self.running_.load())
+      {
+         self.push(p, logger, level, location);
+         p.pushing.store(false);
+
+         // the application may be about to die, make sure this gets out
+         if (level->toInt() >= log4cxx::Level::FATAL_INT)
+            self.flush();
+      }
+      else
+      {
+         p.pushing.store(false);
+         std::string message;
+         detail::async_log_producer::render(p.message, p.encoded, message);
+         logger->forcedLog(level, message, location);
+      }
+   }
+
+   inline void async_logger::log(log4cxx::LoggerPtr const & logger,
+                                 log4cxx::LevelPtr const & level,
+                                 log_format const & format,
+                                 log4cxx::spi::LocationInfo const & location)
+   {
+      detail::async_log_producer * p = producer();
+
+      if (p)
+      {
+         detail::async_log_producer::scope guard(*p);
+         p->capture(format);
+         commit(*p, logger, level, location);
+      }
+      else
+         logger->forcedLog(level, format.str(), location);
+   }
+
+   inline void async_logger::on_fatal_signal(int sig)
+   {
+      for (size_t i = 0; i < FATAL_SIGNAL_COUNT; ++i)
+      {
+         if (fatal_signal(i) == sig)
+            sigaction(sig, &previous_action(i), 0);
+      }
+
+      async_logger & self = async_logger_singleton::instance();
+
+      // only async-signal-safe calls from here: no locks, no appenders, just
+      // give a dispatcher that is still alive some time to write the records
+      if (self.is_running() && !pthread_equal(pthread_self(), self.dispatcher_id_))
+      {
+         for (int ms = 0; ms < 2000 && self.pending_.load(boost::memory_order_acquire) > 0; ++ms)
+            ::poll(0, 0, 1);
+      }
+
+      // blocked until we return, then handled as it would have been without us
+      raise(sig);
+   }
+
+}}
+
+#endif
@@ -30,6 +30,7 @@
 
 #include <log4cxx/logger.h>
 #include "logger.hpp"
+#include "detail/logger_cache.hpp"
 #include "../utils/demangler.hpp"
 
 #include <typeinfo>
@@ -199,6 +200,10 @@
  * You do not have to use this to log in a class but in doing so you will
  * have control of logging at class level granularity.
  *
+ * The class name is only demangled and looked up the first time a class
+ * logs, after that the logger is found by the address of its type_info
+ * name without taking a lock.
+ *
  * \code
  * MLOG(MLOG_LEVEL_INFO, MLOG_CLASS_LOGGER(), "log this: " << 944534634578UL);
  * \endcode
@@ -206,7 +211,8 @@
  */
 
 #define MLOG_CLASS_LOGGER() \
-   log4cxx::Logger::getLogger( MLOG_CLASS_NAME() )
+   moost::logging::detail::cached_logger( \
+      MLOG_CLASS_MANGLED_NAME(this), &moost::logging::detail::class_logger_name)
 
 /*!
  *
@@ -0,0 +1,168 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file logger_cache.hpp
+ * @brief Remembers the loggers of class and function logging call sites
+ *
+ * MLOG_CLASS_LOGGER() and MLOG_FUNC_LOGGER() used to work out a logger
+ * name (demangling the class name, or shortening the function signature)
+ * and look it up in the log4cxx repository every time they were used.
+ * Both names are derived from a string that lives at a fixed address for
+ * the whole run -- the type_info name of the class and the
+ * BOOST_CURRENT_FUNCTION of the function -- so the logger is looked up
+ * once per address and found again by comparing pointers. Lookups don't
+ * take a lock; only the first use of an address does.
+ */
+
+#ifndef MOOST_LOGGING_DETAIL_LOGGER_CACHE_HPP__
+#define MOOST_LOGGING_DETAIL_LOGGER_CACHE_HPP__
+
+#include <string>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <log4cxx/logger.h>
+
+#include "../../utils/singleton.hpp"
+#include "../../utils/demangler.hpp"
+
+namespace moost { namespace logging { namespace detail {
+
+   /// turns the key of a call site into the name of its logger
+   typedef std::string (*logger_name_fn)(char const * key);
+
+   inline std::string class_logger_name(char const * mangled)
+   {
+      return DEMANGLE_NAME(mangled);
+   }
+
+   inline std::string full_function_logger_name(char const * function)
+   {
+      return function;
+   }
+
+   inline std::string short_function_logger_name(char const * function)
+   {
+      return moost::utils::short_function_name(function);
+   }
+
+   class logger_cache : public boost::noncopyable
+   {
+   template <typename T> friend
+      class moost::utils::singleton_default<T>::friend_type;
+
+   private:
+      enum { BUCKETS = 1024 };
+
+      struct node
+      {
+         node(char const * k, logger_name_fn n, node * nx)
+            : key(k), name(n), logger(log4cxx::Logger::getLogger(n(k))), next(nx)
+         {
+         }
+
+         char const * key;
+         logger_name_fn name;
+         log4cxx::LoggerPtr logger;
+         node * next;
+      };
+
+      logger_cache()
+      {
+         for (size_t i = 0; i < BUCKETS; ++i)
+            buckets_[i].store(0, boost::memory_order_relaxed);
+      }
+
+   public:
+      ~logger_cache()
+      {
+         for (size_t i = 0; i < BUCKETS; ++i)
+         {
+            for (node * n = buckets_[i].load(); n; )
+            {
+               node * next = n->next;
+               delete n;
+               n = next;
+            }
+         }
+      }
+
+      /**
+       * @brief The logger for a call site
+       *
+       * @param key a string with static storage duration
+       * @param name makes the logger name out of key
+       *
+       * @return a reference that stays valid for the life of the cache
+       */
+      log4cxx::LoggerPtr const & get(char const * key, logger_name_fn name)
+      {
+         boost::atomic<node *> & bucket = buckets_[hash(key)];
+
+         for (node * n = bucket.load(boost::memory_order_acquire); n; n = n->next)
+            if (n->key == key && n->name == name)
+               return n->logger;
+
+         boost::mutex::scoped_lock lock(mutex_);
+
+         // somebody may have got here first
+         node * head = bucket.load(boost::memory_order_relaxed);
+         for (node * n = head; n; n = n->next)
+            if (n->key == key && n->name == name)
+               return n->logger;
+
+         node * n = new node(key, name, head);
+         bucket.store(n, boost::memory_order_release);
+         return n->logger;
+      }
+
+   private:
+      static size_t hash(char const * key)
+      {
+         boost::uint64_t h = reinterpret_cast<size_t>(key) * 0x9E3779B97F4A7C15ULL;
+         return static_cast<size_t>(h >> 54) & (BUCKETS - 1);
+      }
+
+   private:
+      boost::atomic<node *> buckets_[BUCKETS];
+      boost::mutex mutex_;
+   };
+
+   typedef moost::utils::singleton_default<logger_cache> logger_cache_singleton;
+
+   inline log4cxx::LoggerPtr const & cached_logger(char const * key, logger_name_fn name)
+   {
+      return logger_cache_singleton::instance().get(key, name);
+   }
+
+}}}
+
+#endif
@@ -31,6 +31,7 @@
 #include <string>
 #include <boost/current_function.hpp>
 #include "logger.hpp"
+#include "detail/logger_cache.hpp"
 #include "../utils/demangler.hpp"
 
 /*!
@@ -67,9 +68,13 @@
 #if defined(NDEBUG) && !defined(MLOG_SHORT_FUNC_NAME_LOGGING)
 #define MLOG_FUNC_NAME() \
    MLOG_FUNC_FULL_NAME()
+#define MLOG_FUNC_NAME_FN__ \
+   &moost::logging::detail::full_function_logger_name
 #else
 #define MLOG_FUNC_NAME() \
    MLOG_FUNC_SHORT_NAME()
+#define MLOG_FUNC_NAME_FN__ \
+   &moost::logging::detail::short_function_logger_name
 #endif
 
 
@@ -86,7 +91,8 @@
  *
  * /note In production builds the full function name will be used unless MLOG_SHORT_FUNC_NAME_LOGGING is defined.
  *       This is to avoid the runtime overhead of converting the long name to a short name unless you specificall
- *       want the shorterned version and your code isn't performance critical.
+ *       want the shorterned version and your code isn't performance critical. Either way the name is only worked
+ *       out the first time a function logs; after that the logger is found by the address of the function name.
  *
  * \param [out] logger: The name of the logger type being created
  *
@@ -98,7 +104,7 @@
  */
 
 #define MLOG_FUNC_LOGGER() \
-   log4cxx::Logger::getLogger(MLOG_FUNC_NAME())
+   moost::logging::detail::cached_logger(MLOG_FUNC_FULL_NAME(), MLOG_FUNC_NAME_FN__)
 
 /*!
  *
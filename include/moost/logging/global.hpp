@@ -45,6 +45,7 @@
 
 #include "../utils/singleton.hpp"
 #include "pseudo_ostream.hpp"
+#include "async_logger.hpp"
 #include "../compiler/attributes.hpp"
 
 /**
@@ -252,11 +253,15 @@ namespace moost { namespace logging {
       /**
        * @brief  Disables the logging framework
        *
+       * Anything still queued by the async logger is written out first.
+       *
        * @note   Once this has been called the logging framework is then
        *         considered configured but not enabled.
        */
       void disable()
       {
+         async_logger_singleton::instance().flush();
+
          log4cxx::LogManager::getLoggerRepository()->setConfigured(true);
          log4cxx::Logger::getRootLogger()->setLevel(log4cxx::Level::getOff());
          enabled_ = false;
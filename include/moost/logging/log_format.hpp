@@ -0,0 +1,353 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file log_format.hpp
+ * @brief Log messages whose arguments are captured now and formatted later
+ *
+ * A log_format holds a format string with {} placeholders and a compact
+ * binary copy of its arguments:
+ *
+ * \code
+ * MLOG_FMT_INFO(logger, moost::logging::log_format("user {} took {}ms") % user % ms);
+ * \endcode
+ *
+ * Capturing an argument is a small copy, whereas rendering it means going
+ * through an ostream. With the async logger running the record travels
+ * to the dispatcher in its captured form and is only rendered if it gets
+ * written, so records discarded by the DROP or SAMPLE policies are never
+ * formatted and the logging thread never formats at all.
+ *
+ * Numbers, bools, chars and strings are captured as they are; any other
+ * type is rendered with operator<< when it is captured. {{ and }} stand
+ * for literal braces, arguments without a placeholder are appended to the
+ * end of the message and placeholders without an argument are left as {}.
+ */
+
+#ifndef MOOST_LOGGING_LOG_FORMAT_HPP__
+#define MOOST_LOGGING_LOG_FORMAT_HPP__
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <ostream>
+
+#include <boost/config.hpp>
+#include <boost/cstdint.hpp>
+
+namespace moost { namespace logging {
+
+   class log_format
+   {
+   private:
+      enum tag
+      {
+         TAG_INT,
+         TAG_UINT,
+         TAG_DOUBLE,
+         TAG_BOOL,
+         TAG_CHAR,
+         TAG_STRING
+      };
+
+      enum { INLINE_BYTES = 240 };
+
+   public:
+      /**
+       * @brief Start a message
+       *
+       * @param format with a {} for each argument; it is copied, so it
+       *        doesn't have to outlive the log_format
+       */
+      explicit log_format(char const * format)
+         : size_(0)
+         , on_heap_(false)
+      {
+         append_string(format, std::strlen(format));
+      }
+
+      log_format(log_format const & rhs)
+         : size_(0)
+         , on_heap_(false)
+      {
+         append(rhs.data(), rhs.size());
+      }
+
+      log_format & operator%(bool value)
+      {
+         append_tag(TAG_BOOL);
+         char c = value ? 1 : 0;
+         append(&c, 1);
+         return *this;
+      }
+
+      log_format & operator%(char value)
+      {
+         append_tag(TAG_CHAR);
+         append(&value, 1);
+         return *this;
+      }
+
+      log_format & operator%(int value) { return append_int(value); }
+      log_format & operator%(long value) { return append_int(value); }
+      log_format & operator%(boost::long_long_type value) { return append_int(value); }
+      log_format & operator%(short value) { return append_int(value); }
+      log_format & operator%(unsigned int value) { return append_uint(value); }
+      log_format & operator%(unsigned long value) { return append_uint(value); }
+      log_format & operator%(boost::ulong_long_type value) { return append_uint(value); }
+      log_format & operator%(unsigned short value) { return append_uint(value); }
+
+      log_format & operator%(double value)
+      {
+         append_tag(TAG_DOUBLE);
+         append(&value, sizeof(value));
+         return *this;
+      }
+
+      log_format & operator%(float value)
+      {
+         return *this % static_cast<double>(value);
+      }
+
+      log_format & operator%(char const * value)
+      {
+         append_tag(TAG_STRING);
+         append_string(value ? value : "(null)", value ? std::strlen(value) : 6);
+         return *this;
+      }
+
+      log_format & operator%(char * value)
+      {
+         return *this % static_cast<char const *>(value);
+      }
+
+      template <size_t N>
+      log_format & operator%(char const (&value)[N])
+      {
+         return *this % static_cast<char const *>(value);
+      }
+
+      log_format & operator%(std::string const & value)
+      {
+         append_tag(TAG_STRING);
+         append_string(value.data(), value.size());
+         return *this;
+      }
+
+      /// anything else is rendered with operator<< straight away
+      template <typename T>
+      log_format & operator%(T const & value)
+      {
+         std::ostringstream oss;
+         oss << value;
+         return *this % oss.str();
+      }
+
+      /// the captured format and arguments
+      char const * data() const
+      {
+         return on_heap_ ? &heap_[0] : inline_;
+      }
+
+      size_t size() const
+      {
+         return size_;
+      }
+
+      /// render the message, replacing the contents of out
+      void render(std::string & out) const
+      {
+         render(data(), size(), out);
+      }
+
+      std::string str() const
+      {
+         std::string out;
+         render(out);
+         return out;
+      }
+
+      /// render a message captured by a log_format from its data()
+      static void render(char const * data, size_t size, std::string & out)
+      {
+         char const * p = data;
+         char const * end = data + size;
+
+         boost::uint32_t len = read<boost::uint32_t>(p);
+         char const * format = p;
+         char const * format_end = p + len;
+         p = format_end;
+
+         out.clear();
+
+         for (char const * f = format; f < format_end; ++f)
+         {
+            if (*f == '{' && f + 1 < format_end && f[1] == '{')
+            {
+               out += '{';
+               ++f;
+            }
+            else if (*f == '}' && f + 1 < format_end && f[1] == '}')
+            {
+               out += '}';
+               ++f;
+            }
+            else if (*f == '{' && f + 1 < format_end && f[1] == '}' && p < end)
+            {
+               render_arg(p, out);
+               ++f;
+            }
+            else
+               out += *f;
+         }
+
+         while (p < end)
+         {
+            out += ' ';
+            render_arg(p, out);
+         }
+      }
+
+   private:
+      template <typename T>
+      log_format & append_int(T value)
+      {
+         append_tag(TAG_INT);
+         boost::int64_t v = value;
+         append(&v, sizeof(v));
+         return *this;
+      }
+
+      template <typename T>
+      log_format & append_uint(T value)
+      {
+         append_tag(TAG_UINT);
+         boost::uint64_t v = value;
+         append(&v, sizeof(v));
+         return *this;
+      }
+
+      void append_tag(tag t)
+      {
+         char c = static_cast<char>(t);
+         append(&c, 1);
+      }
+
+      void append_string(char const * s, size_t len)
+      {
+         boost::uint32_t n = static_cast<boost::uint32_t>(len);
+         append(&n, sizeof(n));
+         append(s, n);
+      }
+
+      void append(void const * src, size_t len)
+      {
+         if (!on_heap_ && size_ + len > sizeof(inline_))
+         {
+            heap_.assign(inline_, inline_ + size_);
+            on_heap_ = true;
+         }
+
+         if (on_heap_)
+         {
+            heap_.resize(size_ + len);
+            std::memcpy(&heap_[size_], src, len);
+         }
+         else
+            std::memcpy(inline_ + size_, src, len);
+
+         size_ += len;
+      }
+
+      template <typename T>
+      static T read(char const * & p)
+      {
+         T value;
+         std::memcpy(&value, p, sizeof(value));
+         p += sizeof(value);
+         return value;
+      }
+
+      static void render_arg(char const * & p, std::string & out)
+      {
+         char buf[32];
+         int n = 0;
+
+         switch (*p++)
+         {
+            case TAG_INT:
+               n = ::snprintf(buf, sizeof(buf), "%lld", static_cast<boost::long_long_type>(read<boost::int64_t>(p)));
+               break;
+
+            case TAG_UINT:
+               n = ::snprintf(buf, sizeof(buf), "%llu", static_cast<boost::ulong_long_type>(read<boost::uint64_t>(p)));
+               break;
+
+            case TAG_DOUBLE:
+               // the same as an ostream with default formatting
+               n = ::snprintf(buf, sizeof(buf), "%g", read<double>(p));
+               break;
+
+            case TAG_BOOL:
+               out += *p++ ? "true" : "false";
+               return;
+
+            case TAG_CHAR:
+               out += *p++;
+               return;
+
+            case TAG_STRING:
+            {
+               boost::uint32_t len = read<boost::uint32_t>(p);
+               out.append(p, len);
+               p += len;
+               return;
+            }
+         }
+
+         out.append(buf, n);
+      }
+
+   private:
+      size_t size_;
+      bool on_heap_;
+      char inline_[INLINE_BYTES];
+      std::vector<char> heap_;
+   };
+
+   inline std::ostream & operator<<(std::ostream & os, log_format const & format)
+   {
+      std::string s;
+      format.render(s);
+      return os << s;
+   }
+
+}}
+
+#endif
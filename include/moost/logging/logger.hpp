@@ -47,6 +47,9 @@
 #include <boost/preprocessor/stringize.hpp>
 
 #include "global.hpp"
+#include "async_logger.hpp"
+#include "log_format.hpp"
+#include "../compiler/branch_expect.hpp"
 
 /*!
  *
@@ -64,20 +67,118 @@
 #define MLOG_PREFIX__(msg) msg
 #endif
 
+/*!
+ *
+ * \brief Compile time logging level
+ *
+ * Statements below MLOG_COMPILE_LEVEL are compiled out altogether: neither
+ * the logger nor the message are evaluated and no code is generated for
+ * them, whatever the runtime configuration. For instance, to leave out
+ * trace and debug logging from a release build:
+ *
+ * \code
+ * -DMLOG_COMPILE_LEVEL=MLOG_COMPILE_LEVEL_INFO
+ * \endcode
+ *
+ * The default is to keep everything.
+ *
+ */
+
+#define MLOG_COMPILE_LEVEL_TRACE 0
+#define MLOG_COMPILE_LEVEL_DEBUG 1
+#define MLOG_COMPILE_LEVEL_INFO  2
+#define MLOG_COMPILE_LEVEL_WARN  3
+#define MLOG_COMPILE_LEVEL_ERROR 4
+#define MLOG_COMPILE_LEVEL_FATAL 5
+#define MLOG_COMPILE_LEVEL_OFF   6
+
+#ifndef MLOG_COMPILE_LEVEL
+#define MLOG_COMPILE_LEVEL MLOG_COMPILE_LEVEL_TRACE
+#endif
+
+/*!
+ *
+ * \brief A compiled out logging statement
+ *
+ * The statement is still type checked, so it doesn't rot and variables only
+ * used for logging don't cause warnings, but the branch is never taken.
+ *
+ */
+
+#define MLOG_ELIDED__(logger, msg) \
+   do \
+   { \
+      if (false) \
+      { \
+         ::log4cxx::LoggerPtr const & mlog_logger__ = (logger); \
+         (void) mlog_logger__; \
+         *static_cast<std::ostream *>(0) << msg; \
+      } \
+   } \
+   while (0)
+
 /*!
  *
  * \brief Loggin macros
  *
  * These macros directly invoke the underlying logging framework and exist to abstact MLOG from the underlying
  *
+ * Unless MLOG_NO_ASYNC is defined they hand the message to the async logger
+ * (see async_logger.hpp) whenever it has been started.
+ *
  */
 
-#define MLOG_LEVEL_TRACE LOG4CXX_TRACE
-#define MLOG_LEVEL_DEBUG LOG4CXX_DEBUG
-#define MLOG_LEVEL_INFO  LOG4CXX_INFO
-#define MLOG_LEVEL_WARN  LOG4CXX_WARN
-#define MLOG_LEVEL_ERROR LOG4CXX_ERROR
-#define MLOG_LEVEL_FATAL LOG4CXX_FATAL
+#ifdef MLOG_NO_ASYNC
+#define MLOG_EMIT_TRACE__ LOG4CXX_TRACE
+#define MLOG_EMIT_DEBUG__ LOG4CXX_DEBUG
+#define MLOG_EMIT_INFO__  LOG4CXX_INFO
+#define MLOG_EMIT_WARN__  LOG4CXX_WARN
+#define MLOG_EMIT_ERROR__ LOG4CXX_ERROR
+#define MLOG_EMIT_FATAL__ LOG4CXX_FATAL
+#else
+#define MLOG_EMIT_TRACE__(logger, msg) MLOG_ASYNC__(logger, msg, Trace, LOG4CXX_TRACE)
+#define MLOG_EMIT_DEBUG__(logger, msg) MLOG_ASYNC__(logger, msg, Debug, LOG4CXX_DEBUG)
+#define MLOG_EMIT_INFO__(logger, msg)  MLOG_ASYNC__(logger, msg, Info, LOG4CXX_INFO)
+#define MLOG_EMIT_WARN__(logger, msg)  MLOG_ASYNC__(logger, msg, Warn, LOG4CXX_WARN)
+#define MLOG_EMIT_ERROR__(logger, msg) MLOG_ASYNC__(logger, msg, Error, LOG4CXX_ERROR)
+#define MLOG_EMIT_FATAL__(logger, msg) MLOG_ASYNC__(logger, msg, Fatal, LOG4CXX_FATAL)
+#endif
+
+#if MLOG_COMPILE_LEVEL > MLOG_COMPILE_LEVEL_TRACE
+#define MLOG_LEVEL_TRACE MLOG_ELIDED__
+#else
+#define MLOG_LEVEL_TRACE MLOG_EMIT_TRACE__
+#endif
+
+#if MLOG_COMPILE_LEVEL > MLOG_COMPILE_LEVEL_DEBUG
+#define MLOG_LEVEL_DEBUG MLOG_ELIDED__
+#else
+#define MLOG_LEVEL_DEBUG MLOG_EMIT_DEBUG__
+#endif
+
+#if MLOG_COMPILE_LEVEL > MLOG_COMPILE_LEVEL_INFO
+#define MLOG_LEVEL_INFO MLOG_ELIDED__
+#else
+#define MLOG_LEVEL_INFO MLOG_EMIT_INFO__
+#endif
+
+#if MLOG_COMPILE_LEVEL > MLOG_COMPILE_LEVEL_WARN
+#define MLOG_LEVEL_WARN MLOG_ELIDED__
+#else
+#define MLOG_LEVEL_WARN MLOG_EMIT_WARN__
+#endif
+
+#if MLOG_COMPILE_LEVEL > MLOG_COMPILE_LEVEL_ERROR
+#define MLOG_LEVEL_ERROR MLOG_ELIDED__
+#else
+#define MLOG_LEVEL_ERROR MLOG_EMIT_ERROR__
+#endif
+
+#if MLOG_COMPILE_LEVEL > MLOG_COMPILE_LEVEL_FATAL
+#define MLOG_LEVEL_FATAL MLOG_ELIDED__
+#else
+#define MLOG_LEVEL_FATAL MLOG_EMIT_FATAL__
+#endif
 
 /*!
  *
@@ -117,6 +218,94 @@
 #define MLOG_ERROR(logger, msg) MLOG(MLOG_LEVEL_ERROR, logger, msg)
 #define MLOG_FATAL(logger, msg) MLOG(MLOG_LEVEL_FATAL, logger, msg)
 
+/*!
+ *
+ * \brief Deferred formatting logging macros
+ *
+ * Like MLOG_TRACE etc but the message is a log_format (see log_format.hpp),
+ * whose arguments are captured rather than formatted. With the async logger
+ * running the message is only rendered, on the dispatcher thread, if it is
+ * actually written.
+ *
+ * \code
+ * MLOG_FMT_INFO(
+ *    MLOG_DEFAULT_LOGGER(),
+ *    moost::logging::log_format("user {} took {}ms") % user % ms
+ * );
+ * \endcode
+ *
+ */
+
+#ifdef MLOG_NO_ASYNC
+#define MLOG_FMT_EMIT__(logger, format, lvl) \
+   do \
+   { \
+      ::log4cxx::LoggerPtr const & mlog_logger__ = (logger); \
+      if (expect_unlikely__(mlog_logger__->is##lvl##Enabled())) \
+         mlog_logger__->forcedLog(::log4cxx::Level::get##lvl(), (format).str(), LOG4CXX_LOCATION); \
+   } \
+   while (0)
+#else
+#define MLOG_FMT_EMIT__(logger, format, lvl) \
+   do \
+   { \
+      ::log4cxx::LoggerPtr const & mlog_logger__ = (logger); \
+      if (expect_unlikely__(mlog_logger__->is##lvl##Enabled())) \
+         ::moost::logging::async_logger::log(mlog_logger__, ::log4cxx::Level::get##lvl(), \
+            (format), LOG4CXX_LOCATION); \
+   } \
+   while (0)
+#endif
+
+#define MLOG_FMT_ELIDED__(logger, format) \
+   do \
+   { \
+      if (false) \
+      { \
+         ::log4cxx::LoggerPtr const & mlog_logger__ = (logger); \
+         ::moost::logging::log_format const & mlog_format__ = (format); \
+         (void) mlog_logger__; \
+         (void) mlog_format__; \
+      } \
+   } \
+   while (0)
+
+#if MLOG_COMPILE_LEVEL > MLOG_COMPILE_LEVEL_TRACE
+#define MLOG_FMT_TRACE(logger, format) MLOG_FMT_ELIDED__(logger, format)
+#else
+#define MLOG_FMT_TRACE(logger, format) MLOG_FMT_EMIT__(logger, format, Trace)
+#endif
+
+#if MLOG_COMPILE_LEVEL > MLOG_COMPILE_LEVEL_DEBUG
+#define MLOG_FMT_DEBUG(logger, format) MLOG_FMT_ELIDED__(logger, format)
+#else
+#define MLOG_FMT_DEBUG(logger, format) MLOG_FMT_EMIT__(logger, format, Debug)
+#endif
+
+#if MLOG_COMPILE_LEVEL > MLOG_COMPILE_LEVEL_INFO
+#define MLOG_FMT_INFO(logger, format) MLOG_FMT_ELIDED__(logger, format)
+#else
+#define MLOG_FMT_INFO(logger, format) MLOG_FMT_EMIT__(logger, format, Info)
+#endif
+
+#if MLOG_COMPILE_LEVEL > MLOG_COMPILE_LEVEL_WARN
+#define MLOG_FMT_WARN(logger, format) MLOG_FMT_ELIDED__(logger, format)
+#else
+#define MLOG_FMT_WARN(logger, format) MLOG_FMT_EMIT__(logger, format, Warn)
+#endif
+
+#if MLOG_COMPILE_LEVEL > MLOG_COMPILE_LEVEL_ERROR
+#define MLOG_FMT_ERROR(logger, format) MLOG_FMT_ELIDED__(logger, format)
+#else
+#define MLOG_FMT_ERROR(logger, format) MLOG_FMT_EMIT__(logger, format, Error)
+#endif
+
+#if MLOG_COMPILE_LEVEL > MLOG_COMPILE_LEVEL_FATAL
+#define MLOG_FMT_FATAL(logger, format) MLOG_FMT_ELIDED__(logger, format)
+#else
+#define MLOG_FMT_FATAL(logger, format) MLOG_FMT_EMIT__(logger, format, Fatal)
+#endif
+
 /*!
  *
  * \brief Gets a named logger
@@ -47,6 +47,7 @@
 namespace moost {
    namespace nagios {
       class nsca_client;
+      class nsca_async_sender;
    }
 
    namespace logging {
@@ -250,6 +251,47 @@ namespace log4cxx
        */
       void setThisHostDesc(std::string const & desc);
 
+      /**
+       * @brief Set whether alerts are sent from a background thread
+       *
+       * When enabled (the default) logging an alert only queues it and
+       * a background thread sends queued alerts to the nsca server,
+       * several per connection. Identical alerts still waiting in the
+       * queue are sent only once.
+       *
+       * @param async : true to send asynchronously
+       */
+      void setAsync(bool async);
+
+      /**
+       * @brief Set the maximum number of queued alerts
+       *
+       * Once the queue is full the oldest alerts are dropped.
+       *
+       * @param max_queue : the queue size to use
+       */
+      void setMaxQueue(size_t max_queue);
+
+      /**
+       * @brief Set the minimum interval between identical alerts
+       *
+       * An alert identical to one sent less than this interval ago is
+       * not sent again. Zero (the default) sends every alert.
+       *
+       * @param interval : the interval to use
+       */
+      void setMinResendIntervalMs(int interval);
+
+      /**
+       * @brief Set how long a connection to the nsca server is reused
+       *
+       * This must be well below the max_packet_age configured on the
+       * server. Zero connects for every batch of alerts.
+       *
+       * @param ttl : the time to live to use
+       */
+      void setConnectionTtlSecs(int ttl);
+
       /**
        * @brief Set an option value by name
        *
@@ -325,6 +367,11 @@ namespace log4cxx
       moost::nagios::nsca_config nsca_config_;
       boost::shared_ptr<moost::nagios::nsca_client> nsca_client_;
       moost::logging::pseudo_ostream & out_;
+      bool async_;
+      size_t max_queue_;
+      int min_resend_interval_ms_;
+      int connection_ttl_secs_;
+      boost::shared_ptr<moost::nagios::nsca_async_sender> nsca_sender_;
    };
 
    LOG4CXX_PTR_DEF(NscaAppender);
@@ -0,0 +1,123 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file counter.hpp
+ * @brief A monotonic event counter that many threads can bump cheaply
+ *
+ * Each thread adds to its own shard with a relaxed atomic increment, so
+ * counting neither takes a lock nor bounces a shared cache line between
+ * cores. Reading the value sums the shards and is meant for the (rare)
+ * occasions somebody looks at the metrics.
+ */
+
+#ifndef MOOST_METRICS_COUNTER_HPP__
+#define MOOST_METRICS_COUNTER_HPP__
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+#include "metric.hpp"
+#include "detail/thread_slot.hpp"
+
+namespace moost { namespace metrics {
+
+   class counter : public metric
+   {
+   public:
+      typedef boost::int64_t value_type;
+
+      counter()
+      {
+         reset();
+      }
+
+      void add(value_type n = 1)
+      {
+         m_shards[detail::thread_slot()].value.fetch_add(n, boost::memory_order_relaxed);
+      }
+
+      counter & operator++ ()
+      {
+         add(1);
+         return *this;
+      }
+
+      counter & operator+= (value_type n)
+      {
+         add(n);
+         return *this;
+      }
+
+      value_type value() const
+      {
+         value_type sum = 0;
+
+         for (size_t i = 0; i < detail::num_shards; ++i)
+         {
+            sum += m_shards[i].value.load(boost::memory_order_relaxed);
+         }
+
+         return sum;
+      }
+
+      char const * type() const
+      {
+         return "counter";
+      }
+
+      void write_text(std::ostream & os) const
+      {
+         os << value();
+      }
+
+      void write_json(std::ostream & os) const
+      {
+         os << "{\"type\":\"counter\",\"value\":" << value() << "}";
+      }
+
+      void reset()
+      {
+         for (size_t i = 0; i < detail::num_shards; ++i)
+         {
+            m_shards[i].value.store(0, boost::memory_order_relaxed);
+         }
+      }
+
+   private:
+      struct shard
+      {
+         boost::atomic<value_type> value;
+         char pad[detail::cache_line_size - sizeof(boost::atomic<value_type>)];
+      };
+
+      shard m_shards[detail::num_shards];
+   };
+
+}}
+
+#endif
@@ -0,0 +1,99 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file thread_slot.hpp
+ * @brief Spreads the threads updating a metric over a fixed set of shards
+ *
+ * Each thread is given a slot number the first time it records a metric.
+ * Counters and histograms keep one shard per slot, so threads that record
+ * concurrently don't fight over the same cache line. With more threads than
+ * shards, threads share shards; the shards are atomic, so that's only
+ * slower, never wrong.
+ */
+
+#ifndef MOOST_METRICS_DETAIL_THREAD_SLOT_HPP__
+#define MOOST_METRICS_DETAIL_THREAD_SLOT_HPP__
+
+#include <cstddef>
+
+#include <boost/atomic.hpp>
+
+#if !defined(__GNUC__)
+#  include <boost/thread/tss.hpp>
+#endif
+
+#include "../../compiler/branch_expect.hpp"
+
+namespace moost { namespace metrics { namespace detail {
+
+   /// number of shards per metric, must be a power of two
+   static const size_t num_shards = 16;
+
+   /// size of the padding that keeps shards on separate cache lines
+   static const size_t cache_line_size = 64;
+
+   inline size_t next_thread_slot()
+   {
+      static boost::atomic<size_t> next(0);
+      return next.fetch_add(1, boost::memory_order_relaxed);
+   }
+
+#if defined(__GNUC__)
+
+   inline size_t thread_slot()
+   {
+      // zero means "not assigned yet", so the slot is stored plus one
+      static __thread size_t slot = 0;
+
+      if (expect_unlikely__(slot == 0))
+      {
+         slot = next_thread_slot() + 1;
+      }
+
+      return (slot - 1) & (num_shards - 1);
+   }
+
+#else
+
+   inline size_t thread_slot()
+   {
+      static boost::thread_specific_ptr<size_t> slot;
+
+      if (expect_unlikely__(slot.get() == 0))
+      {
+         slot.reset(new size_t(next_thread_slot()));
+      }
+
+      return *slot & (num_shards - 1);
+   }
+
+#endif
+
+}}}
+
+#endif
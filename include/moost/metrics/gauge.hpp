@@ -0,0 +1,104 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file gauge.hpp
+ * @brief A value that goes up and down, like a queue length or a data size
+ *
+ * Unlike a counter a gauge can be set, so it is a single atomic rather than
+ * a set of per-thread shards. Use it for values that change at most a few
+ * times per operation; for events use a counter.
+ */
+
+#ifndef MOOST_METRICS_GAUGE_HPP__
+#define MOOST_METRICS_GAUGE_HPP__
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+#include "metric.hpp"
+
+namespace moost { namespace metrics {
+
+   class gauge : public metric
+   {
+   public:
+      typedef boost::int64_t value_type;
+
+      gauge()
+         : m_value(0)
+      {
+      }
+
+      void set(value_type v)
+      {
+         m_value.store(v, boost::memory_order_relaxed);
+      }
+
+      void add(value_type n = 1)
+      {
+         m_value.fetch_add(n, boost::memory_order_relaxed);
+      }
+
+      void sub(value_type n = 1)
+      {
+         m_value.fetch_sub(n, boost::memory_order_relaxed);
+      }
+
+      value_type value() const
+      {
+         return m_value.load(boost::memory_order_relaxed);
+      }
+
+      char const * type() const
+      {
+         return "gauge";
+      }
+
+      void write_text(std::ostream & os) const
+      {
+         os << value();
+      }
+
+      void write_json(std::ostream & os) const
+      {
+         os << "{\"type\":\"gauge\",\"value\":" << value() << "}";
+      }
+
+      /// a gauge describes the current state rather than accumulating
+      /// anything since the last reset, so there is nothing to reset
+      void reset()
+      {
+      }
+
+   private:
+      boost::atomic<value_type> m_value;
+   };
+
+}}
+
+#endif
@@ -0,0 +1,322 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file histogram.hpp
+ * @brief A latency (or size) histogram that many threads can record into
+ *
+ * Values are counted in power-of-two buckets: bucket 0 holds zero and
+ * bucket k holds values from 2^(k-1) to 2^k - 1. That's coarse, but it
+ * covers anything from a nanosecond to years in 65 buckets and finding the
+ * bucket is a single bit scan. Percentiles are interpolated linearly within
+ * a bucket, so expect them to be off by up to a factor of two in the worst
+ * case and much closer for reasonably smooth distributions.
+ *
+ * As with the counter, each thread records into its own shard with relaxed
+ * atomic increments; no locks are taken.
+ *
+ * Timing a block of code is easiest with a scoped_timer:
+
+\code
+static moost::metrics::histogram& lookup_us =
+   moost::metrics::get_histogram("myservice.lookup_us");
+
+{
+   moost::metrics::scoped_timer t(lookup_us);
+   do_lookup();
+}
+\endcode
+ */
+
+#ifndef MOOST_METRICS_HISTOGRAM_HPP__
+#define MOOST_METRICS_HISTOGRAM_HPP__
+
+#include <string>
+#include <vector>
+#include <ctime>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/integer_traits.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "metric.hpp"
+#include "detail/thread_slot.hpp"
+#include "../math/integer/log2.hpp"
+
+namespace moost { namespace metrics {
+
+   /// microseconds from an arbitrary but fixed point in time
+   inline boost::uint64_t monotonic_us()
+   {
+      timespec ts;
+      ::clock_gettime(CLOCK_MONOTONIC, &ts);
+      return static_cast<boost::uint64_t>(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+   }
+
+   /// A consistent-enough copy of a histogram's buckets
+   struct histogram_snapshot
+   {
+      typedef boost::uint64_t value_type;
+
+      static const size_t num_buckets = 65;
+
+      value_type count;
+      value_type sum;
+      std::vector<value_type> buckets;
+
+      histogram_snapshot()
+         : count(0), sum(0), buckets(num_buckets, 0)
+      {
+      }
+
+      static value_type bucket_lower(size_t k)
+      {
+         return k == 0 ? 0 : value_type(1) << (k - 1);
+      }
+
+      static value_type bucket_upper(size_t k)
+      {
+         if (k >= 64)
+         {
+            return boost::integer_traits<value_type>::const_max;
+         }
+
+         return k == 0 ? 0 : (value_type(1) << k) - 1;
+      }
+
+      double mean() const
+      {
+         return count > 0 ? double(sum)/double(count) : 0.0;
+      }
+
+      /// estimated value below which a fraction q (0..1) of the values lie
+      double percentile(double q) const
+      {
+         if (count == 0)
+         {
+            return 0.0;
+         }
+
+         double rank = q*double(count);
+
+         if (rank < 1.0)
+         {
+            rank = 1.0;
+         }
+
+         value_type seen = 0;
+
+         for (size_t k = 0; k < num_buckets; ++k)
+         {
+            if (buckets[k] == 0)
+            {
+               continue;
+            }
+
+            if (double(seen + buckets[k]) >= rank)
+            {
+               double frac = (rank - double(seen))/double(buckets[k]);
+               double lo = double(bucket_lower(k));
+               double hi = double(bucket_upper(k));
+               return lo + frac*(hi - lo);
+            }
+
+            seen += buckets[k];
+         }
+
+         return double(max());
+      }
+
+      /// upper bound of the largest value recorded
+      value_type max() const
+      {
+         for (size_t k = num_buckets; k > 0; --k)
+         {
+            if (buckets[k - 1] > 0)
+            {
+               return bucket_upper(k - 1);
+            }
+         }
+
+         return 0;
+      }
+   };
+
+   class histogram : public metric
+   {
+   public:
+      typedef histogram_snapshot::value_type value_type;
+
+      static const size_t num_buckets = histogram_snapshot::num_buckets;
+
+      /// \p unit is only used for display, e.g. "us" or "bytes"
+      explicit histogram(const std::string& unit = "us")
+         : m_unit(unit)
+      {
+         reset();
+      }
+
+      void record(value_type v)
+      {
+         shard& s = m_shards[detail::thread_slot()];
+         s.buckets[bucket(v)].fetch_add(1, boost::memory_order_relaxed);
+         s.sum.fetch_add(v, boost::memory_order_relaxed);
+      }
+
+      static size_t bucket(value_type v)
+      {
+         return v == 0 ? 0 : moost::math::integer::log2(v) + 1;
+      }
+
+      void snapshot(histogram_snapshot& snap) const
+      {
+         snap = histogram_snapshot();
+
+         for (size_t i = 0; i < detail::num_shards; ++i)
+         {
+            const shard& s = m_shards[i];
+
+            for (size_t k = 0; k < num_buckets; ++k)
+            {
+               value_type n = s.buckets[k].load(boost::memory_order_relaxed);
+               snap.buckets[k] += n;
+               snap.count += n;
+            }
+
+            snap.sum += s.sum.load(boost::memory_order_relaxed);
+         }
+      }
+
+      const std::string& unit() const
+      {
+         return m_unit;
+      }
+
+      char const * type() const
+      {
+         return "histogram";
+      }
+
+      void write_text(std::ostream & os) const
+      {
+         histogram_snapshot snap;
+         snapshot(snap);
+
+         os << "count=" << snap.count
+            << " mean=" << rounded(snap.mean())
+            << " p50=" << rounded(snap.percentile(0.5))
+            << " p90=" << rounded(snap.percentile(0.9))
+            << " p99=" << rounded(snap.percentile(0.99))
+            << " p999=" << rounded(snap.percentile(0.999))
+            << " max<=" << snap.max()
+            << " " << m_unit;
+      }
+
+      void write_json(std::ostream & os) const
+      {
+         histogram_snapshot snap;
+         snapshot(snap);
+
+         os << "{\"type\":\"histogram\",\"unit\":\"" << m_unit << "\""
+            << ",\"count\":" << snap.count
+            << ",\"sum\":" << snap.sum
+            << ",\"mean\":" << rounded(snap.mean())
+            << ",\"p50\":" << rounded(snap.percentile(0.5))
+            << ",\"p90\":" << rounded(snap.percentile(0.9))
+            << ",\"p99\":" << rounded(snap.percentile(0.99))
+            << ",\"p999\":" << rounded(snap.percentile(0.999))
+            << ",\"max\":" << snap.max()
+            << ",\"buckets\":{";
+
+         bool first = true;
+
+         for (size_t k = 0; k < num_buckets; ++k)
+         {
+            if (snap.buckets[k] > 0)
+            {
+               os << (first ? "" : ",") << "\"" << histogram_snapshot::bucket_upper(k) << "\":" << snap.buckets[k];
+               first = false;
+            }
+         }
+
+         os << "}}";
+      }
+
+      void reset()
+      {
+         for (size_t i = 0; i < detail::num_shards; ++i)
+         {
+            for (size_t k = 0; k < num_buckets; ++k)
+            {
+               m_shards[i].buckets[k].store(0, boost::memory_order_relaxed);
+            }
+
+            m_shards[i].sum.store(0, boost::memory_order_relaxed);
+         }
+      }
+
+   private:
+      static value_type rounded(double v)
+      {
+         return static_cast<value_type>(v + 0.5);
+      }
+
+      struct shard
+      {
+         boost::atomic<value_type> buckets[num_buckets];
+         boost::atomic<value_type> sum;
+         char pad[detail::cache_line_size - ((num_buckets + 1)*sizeof(boost::atomic<value_type>)) % detail::cache_line_size];
+      };
+
+      const std::string m_unit;
+      shard m_shards[detail::num_shards];
+   };
+
+   /// Records the microseconds spent in its scope into a histogram
+   class scoped_timer : public boost::noncopyable
+   {
+   public:
+      explicit scoped_timer(histogram& hist)
+         : m_hist(hist)
+         , m_start(monotonic_us())
+      {
+      }
+
+      ~scoped_timer()
+      {
+         m_hist.record(monotonic_us() - m_start);
+      }
+
+   private:
+      histogram& m_hist;
+      const boost::uint64_t m_start;
+   };
+
+}}
+
+#endif
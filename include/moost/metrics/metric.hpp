@@ -0,0 +1,68 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file metric.hpp
+ * @brief Common interface of everything the metrics registry can hold
+ */
+
+#ifndef MOOST_METRICS_METRIC_HPP__
+#define MOOST_METRICS_METRIC_HPP__
+
+#include <ostream>
+
+#include <boost/noncopyable.hpp>
+
+namespace moost { namespace metrics {
+
+   /// A named value in the metrics registry. Metrics are only ever created
+   /// by the registry and live as long as it does, so references to them
+   /// can be kept around (typically in a function local static) and used
+   /// without looking them up again.
+   class metric : public boost::noncopyable
+   {
+   public:
+      virtual ~metric() {}
+
+      /// short name of the kind of metric, e.g. "counter"
+      virtual char const * type() const = 0;
+
+      /// writes the current value as one line of human readable text
+      /// (without the name or a trailing newline)
+      virtual void write_text(std::ostream & os) const = 0;
+
+      /// writes the current value as a JSON object
+      virtual void write_json(std::ostream & os) const = 0;
+
+      /// sets the metric back to its initial state; updates racing with
+      /// a reset may or may not be counted
+      virtual void reset() = 0;
+   };
+
+}}
+
+#endif
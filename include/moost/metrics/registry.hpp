@@ -0,0 +1,285 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file registry.hpp
+ * @brief The process wide collection of named metrics
+ *
+ * Metrics are registered by name the first time they are asked for and
+ * live until the process exits. Asking for the same name again returns
+ * the same metric, so every instance of a component that uses the same
+ * name contributes to the same numbers. Registration and dumping take the
+ * registry's lock; recording into a metric doesn't, so look the metric up
+ * once and keep the reference:
+
+\code
+void my_service::handle(const request& req)
+{
+   static moost::metrics::counter& requests =
+      moost::metrics::get_counter("my_service.requests");
+
+   ++requests;
+   // ...
+}
+\endcode
+
+ * Names are free-form, but by convention they are dot-separated paths
+ * starting with the component, e.g. "kvds.users.get.hits". Use make_name()
+ * to build names from user supplied parts (topics, file names, ...) so that
+ * they don't contain whitespace or quotes.
+ */
+
+#ifndef MOOST_METRICS_REGISTRY_HPP__
+#define MOOST_METRICS_REGISTRY_HPP__
+
+#include <map>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stdexcept>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "metric.hpp"
+#include "counter.hpp"
+#include "gauge.hpp"
+#include "histogram.hpp"
+#include "../utils/singleton.hpp"
+
+namespace moost { namespace metrics {
+
+   /// Joins \p prefix and \p part with a dot, replacing any character of
+   /// \p part that isn't alphanumeric or one of "_-.:/" with an underscore.
+   inline std::string make_name(const std::string& prefix, const std::string& part)
+   {
+      std::string name(prefix);
+
+      if (!name.empty() && !part.empty())
+      {
+         name += '.';
+      }
+
+      for (std::string::const_iterator it = part.begin(); it != part.end(); ++it)
+      {
+         char c = *it;
+         bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                   c == '_' || c == '-' || c == '.' || c == ':' || c == '/';
+         name += ok ? c : '_';
+      }
+
+      return name;
+   }
+
+   class registry : public boost::noncopyable
+   {
+   public:
+      typedef boost::shared_ptr<metric> metric_ptr;
+      typedef std::map<std::string, metric_ptr> metric_map;
+
+      registry()
+      {
+      }
+
+      counter& get_counter(const std::string& name)
+      {
+         boost::mutex::scoped_lock lock(m_mx);
+         return get<counter>(name);
+      }
+
+      gauge& get_gauge(const std::string& name)
+      {
+         boost::mutex::scoped_lock lock(m_mx);
+         return get<gauge>(name);
+      }
+
+      /// \p unit is only honoured by the call that creates the histogram
+      histogram& get_histogram(const std::string& name, const std::string& unit = "us")
+      {
+         boost::mutex::scoped_lock lock(m_mx);
+
+         metric_map::iterator it = m_metrics.find(name);
+
+         if (it == m_metrics.end())
+         {
+            it = m_metrics.insert(metric_map::value_type(name, metric_ptr(new histogram(unit)))).first;
+         }
+
+         return checked_cast<histogram>(name, *it->second);
+      }
+
+      /// returns the metric called \p name, or a null pointer
+      metric_ptr find(const std::string& name) const
+      {
+         boost::mutex::scoped_lock lock(m_mx);
+         metric_map::const_iterator it = m_metrics.find(name);
+         return it != m_metrics.end() ? it->second : metric_ptr();
+      }
+
+      /// all metrics whose names start with \p prefix, ordered by name
+      void select(metric_map& out, const std::string& prefix = "") const
+      {
+         boost::mutex::scoped_lock lock(m_mx);
+
+         for (metric_map::const_iterator it = m_metrics.lower_bound(prefix);
+              it != m_metrics.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+         {
+            out.insert(*it);
+         }
+      }
+
+      /// writes "name type" lines
+      void write_list(std::ostream& os, const std::string& prefix = "") const
+      {
+         metric_map sel;
+         select(sel, prefix);
+
+         for (metric_map::const_iterator it = sel.begin(); it != sel.end(); ++it)
+         {
+            os << it->first << " " << it->second->type() << "\n";
+         }
+      }
+
+      /// writes "name value" lines
+      void write_text(std::ostream& os, const std::string& prefix = "") const
+      {
+         metric_map sel;
+         select(sel, prefix);
+
+         for (metric_map::const_iterator it = sel.begin(); it != sel.end(); ++it)
+         {
+            os << it->first << " ";
+            it->second->write_text(os);
+            os << "\n";
+         }
+      }
+
+      /// writes a single JSON object mapping names to values
+      void write_json(std::ostream& os, const std::string& prefix = "") const
+      {
+         metric_map sel;
+         select(sel, prefix);
+
+         os << "{";
+
+         for (metric_map::const_iterator it = sel.begin(); it != sel.end(); ++it)
+         {
+            os << (it == sel.begin() ? "" : ",") << "\"";
+            write_json_string(os, it->first);
+            os << "\":";
+            it->second->write_json(os);
+         }
+
+         os << "}\n";
+      }
+
+      /// resets all metrics whose names start with \p prefix, returns how many
+      size_t reset(const std::string& prefix = "")
+      {
+         metric_map sel;
+         select(sel, prefix);
+
+         for (metric_map::iterator it = sel.begin(); it != sel.end(); ++it)
+         {
+            it->second->reset();
+         }
+
+         return sel.size();
+      }
+
+   private:
+      // the caller must hold m_mx
+      template <class MetricT>
+      MetricT& get(const std::string& name)
+      {
+         metric_map::iterator it = m_metrics.find(name);
+
+         if (it == m_metrics.end())
+         {
+            it = m_metrics.insert(metric_map::value_type(name, metric_ptr(new MetricT))).first;
+         }
+
+         return checked_cast<MetricT>(name, *it->second);
+      }
+
+      template <class MetricT>
+      static MetricT& checked_cast(const std::string& name, metric& m)
+      {
+         MetricT *p = dynamic_cast<MetricT *>(&m);
+
+         if (!p)
+         {
+            throw std::runtime_error("metric " + name + " is already registered as a " + m.type());
+         }
+
+         return *p;
+      }
+
+      static void write_json_string(std::ostream& os, const std::string& str)
+      {
+         for (std::string::const_iterator it = str.begin(); it != str.end(); ++it)
+         {
+            if (*it == '"' || *it == '\\')
+            {
+               os << '\\' << *it;
+            }
+            else if (static_cast<unsigned char>(*it) < 0x20)
+            {
+               os << ' ';
+            }
+            else
+            {
+               os << *it;
+            }
+         }
+      }
+
+      mutable boost::mutex m_mx;
+      metric_map m_metrics;
+   };
+
+   typedef moost::utils::singleton_default<registry> registry_singleton;
+
+   inline counter& get_counter(const std::string& name)
+   {
+      return registry_singleton::instance().get_counter(name);
+   }
+
+   inline gauge& get_gauge(const std::string& name)
+   {
+      return registry_singleton::instance().get_gauge(name);
+   }
+
+   inline histogram& get_histogram(const std::string& name, const std::string& unit = "us")
+   {
+      return registry_singleton::instance().get_histogram(name, unit);
+   }
+
+}}
+
+#endif
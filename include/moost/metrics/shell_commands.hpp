@@ -0,0 +1,128 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file shell_commands.hpp
+ * @brief Remote shell commands to look at and reset the metrics registry
+ *
+ * Implements the handle_command() / show_help() pair that
+ * moost::service::remote_shell handlers provide, so it can be chained into
+ * any shell handler. moost::process::service does that for every service,
+ * after the service's own handler has had a chance to claim the command.
+ *
+ * Commands:
+ *
+ * - metrics [list] [prefix]   names and types of the metrics
+ * - metrics dump [prefix]     one "name value" line per metric
+ * - metrics json [prefix]     all values as a single JSON object
+ * - metrics reset [prefix]    reset counters and histograms
+ */
+
+#ifndef MOOST_METRICS_SHELL_COMMANDS_HPP__
+#define MOOST_METRICS_SHELL_COMMANDS_HPP__
+
+#include <string>
+#include <sstream>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include "registry.hpp"
+
+namespace moost { namespace metrics {
+
+   class shell_commands
+   {
+   public:
+      shell_commands()
+         : m_registry(registry_singleton::instance())
+      {
+      }
+
+      explicit shell_commands(registry& reg)
+         : m_registry(reg)
+      {
+      }
+
+      std::string show_help() const
+      {
+         return "- metrics [list|dump|json|reset] [prefix]\n"
+                "      list, show or reset metrics [default: list]\n";
+      }
+
+      bool handle_command(std::string& rv, const std::string& cmd, const std::string& args)
+      {
+         if (cmd != "metrics")
+         {
+            return false;
+         }
+
+         std::string sub(boost::trim_copy(args));
+         std::string prefix;
+         std::string::size_type sp = sub.find_first_of(" \t");
+
+         if (sp != std::string::npos)
+         {
+            prefix = boost::trim_copy(sub.substr(sp));
+            sub.erase(sp);
+         }
+
+         std::ostringstream oss;
+
+         if (sub.empty() || sub == "list")
+         {
+            m_registry.write_list(oss, prefix);
+         }
+         else if (sub == "dump")
+         {
+            m_registry.write_text(oss, prefix);
+         }
+         else if (sub == "json")
+         {
+            m_registry.write_json(oss, prefix);
+         }
+         else if (sub == "reset")
+         {
+            oss << "reset " << m_registry.reset(prefix) << " metric(s)\n";
+         }
+         else
+         {
+            // not a sub-command, so it's a prefix to list
+            m_registry.write_list(oss, sub);
+         }
+
+         rv = oss.str();
+
+         return true;
+      }
+
+   private:
+      registry& m_registry;
+   };
+
+}}
+
+#endif
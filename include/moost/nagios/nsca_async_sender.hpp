@@ -0,0 +1,400 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_NAGIOS_NSCA_ASYNC_SENDER_HPP__
+#define MOOST_NAGIOS_NSCA_ASYNC_SENDER_HPP__
+
+#include <string>
+#include <list>
+#include <map>
+#include <set>
+#include <sstream>
+#include <vector>
+#include <ctime>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "nsca_client.hpp"
+
+namespace moost { namespace nagios {
+
+   /// Statistics of an nsca_async_sender
+   struct nsca_async_sender_stats
+   {
+      boost::uint64_t enqueued;     ///< results accepted by send()
+      boost::uint64_t sent;         ///< results sent to the server
+      boost::uint64_t dropped;      ///< oldest results dropped because the queue was full
+      boost::uint64_t coalesced;    ///< duplicates of a result that was still queued
+      boost::uint64_t suppressed;   ///< duplicates of a result sent less than min_resend_interval ago
+      boost::uint64_t failed;       ///< results that couldn't be sent
+      boost::uint64_t connects;     ///< connections made to the server
+   };
+
+   /**
+    * @brief Sends service check results to an nsca server from a background thread
+    *
+    * send() only queues the result, so callers never wait for the network.
+    * The background thread sends everything queued in one go, over a single
+    * connection (see nsca_client::session), which it keeps open for further
+    * batches for up to connection_ttl_secs.
+    *
+    * The queue is bounded; when it is full, the oldest result is dropped to
+    * make room. Results identical to one that is still queued are coalesced
+    * into it, and results identical to one sent less than min_resend_interval
+    * ago are suppressed, so a burst of the same warning costs one packet.
+    */
+   class nsca_async_sender : boost::noncopyable
+   {
+   public:
+      /**
+       * @brief Construct a sender and start its background thread
+       *
+       * @param cfg : configuration of the nsca server
+       * @param max_queue : maximum number of queued results
+       * @param min_resend_interval_ms : suppress identical results within this interval, 0 never does
+       * @param connection_ttl_secs : how long a connection is reused, 0 connects for every batch;
+       *        keep this well below the server's max_packet_age
+       */
+      nsca_async_sender(
+         nsca_config const & cfg,
+         size_t max_queue = 1000,
+         int min_resend_interval_ms = 0,
+         int connection_ttl_secs = 10
+         )
+         : client_(cfg)
+         , max_queue_(max_queue > 0 ? max_queue : 1)
+         , min_resend_interval_(boost::posix_time::milliseconds(min_resend_interval_ms))
+         , connection_ttl_secs_(connection_ttl_secs)
+         , stop_(false)
+         , busy_(false)
+      {
+         stats_.enqueued = stats_.sent = stats_.dropped = stats_.coalesced = 0;
+         stats_.suppressed = stats_.failed = stats_.connects = 0;
+
+         thread_.reset(new boost::thread(boost::bind(&nsca_async_sender::run, this)));
+      }
+
+      virtual ~nsca_async_sender()
+      {
+         stop();
+      }
+
+      /**
+       * @brief Queue a result, never blocks on the network
+       */
+      void send(
+         std::string const & hostname,
+         std::string const & svc_description,
+         boost::int16_t return_code,
+         std::string const & plugin_output)
+      {
+         check c;
+         c.hostname = hostname;
+         c.svc_description = svc_description;
+         c.return_code = return_code;
+         c.plugin_output = plugin_output;
+
+         std::string const k = c.key();
+
+         boost::mutex::scoped_lock lock(mutex_);
+
+         ++stats_.enqueued;
+
+         if (stop_)
+         {
+            ++stats_.dropped;
+            return;
+         }
+
+         if (queued_.find(k) != queued_.end())
+         {
+            ++stats_.coalesced;
+            return;
+         }
+
+         if (queue_.size() >= max_queue_)
+         {
+            queued_.erase(queue_.front().key());
+            queue_.pop_front();
+            ++stats_.dropped;
+         }
+
+         queue_.push_back(c);
+         queued_.insert(k);
+         cond_.notify_one();
+      }
+
+      /**
+       * @brief Wait until everything queued so far has been handled
+       *
+       * @return false if that didn't happen within timeout_ms
+       */
+      bool flush(int timeout_ms)
+      {
+         boost::system_time const deadline = boost::get_system_time() + boost::posix_time::milliseconds(timeout_ms);
+         boost::mutex::scoped_lock lock(mutex_);
+
+         while (!queue_.empty() || busy_)
+         {
+            if (!idle_cond_.timed_wait(lock, deadline))
+               return queue_.empty() && !busy_;
+         }
+
+         return true;
+      }
+
+      /**
+       * @brief Send whatever is still queued and stop the background thread
+       */
+      void stop()
+      {
+         {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (stop_)
+               return;
+            stop_ = true;
+            cond_.notify_one();
+         }
+
+         thread_->join();
+      }
+
+      void stats(nsca_async_sender_stats & st) const
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         st = stats_;
+      }
+
+   protected:
+      /**
+       * @brief Optionally override this method for custom error logging.
+       *
+       * It is called from the background thread; classes overriding it
+       * must call stop() in their destructor.
+       */
+      virtual void report_error(std::exception const &) {}
+
+   private:
+      struct check
+      {
+         std::string hostname;
+         std::string svc_description;
+         boost::int16_t return_code;
+         std::string plugin_output;
+
+         std::string key() const
+         {
+            std::ostringstream oss;
+            oss << hostname << '\n' << svc_description << '\n' << return_code << '\n' << plugin_output;
+            return oss.str();
+         }
+      };
+
+      typedef std::list<check> queue_t;
+      typedef std::map<std::string, boost::posix_time::ptime> sent_t;
+
+      void run()
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+
+         for (;;)
+         {
+            while (queue_.empty() && !stop_)
+            {
+               idle_cond_.notify_all();
+               cond_.wait(lock);
+            }
+
+            if (queue_.empty())
+               break;
+
+            queue_t batch;
+            batch.swap(queue_);
+            queued_.clear();
+            busy_ = true;
+
+            lock.unlock();
+            send_batch(batch);
+            lock.lock();
+
+            busy_ = false;
+         }
+
+         session_.reset();
+         idle_cond_.notify_all();
+      }
+
+      // runs on the background thread without holding the mutex
+      void send_batch(queue_t const & batch)
+      {
+         boost::posix_time::ptime const now = boost::posix_time::microsec_clock::universal_time();
+         std::vector<nsca_data_packet> packets;
+         std::vector<std::string> keys;   // of the packets, to remember the ones that went out
+         boost::uint64_t suppressed = 0, failed = 0;
+
+         if (!min_resend_interval_.is_zero())
+         {
+            expire_sent(now);
+         }
+
+         for (queue_t::const_iterator it = batch.begin(); it != batch.end(); ++it)
+         {
+            std::string const k = it->key();
+
+            if (!min_resend_interval_.is_zero() && sent_.find(k) != sent_.end())
+            {
+               ++suppressed;
+               continue;
+            }
+
+            try
+            {
+               packets.push_back(nsca_data_packet());
+               client_.make_packet(it->hostname, it->svc_description, it->return_code, it->plugin_output, packets.back());
+               keys.push_back(k);
+            }
+            catch (std::exception const & e)
+            {
+               packets.pop_back();
+               ++failed;
+               report_error(e);
+            }
+         }
+
+         size_t sent = 0;
+         boost::uint64_t connects = 0;
+
+         if (!packets.empty())
+         {
+            try
+            {
+               send_packets(packets, sent, connects);
+            }
+            catch (std::exception const & e)
+            {
+               session_.reset();
+               report_error(e);
+            }
+            failed += packets.size() - sent;
+         }
+
+         // only results that actually went out hold back their duplicates,
+         // so an alert that failed to send is sent again when repeated
+         if (!min_resend_interval_.is_zero())
+         {
+            for (size_t i = 0; i < sent; ++i)
+               sent_[keys[i]] = now;
+         }
+
+         boost::mutex::scoped_lock lock(mutex_);
+         stats_.sent += sent;
+         stats_.suppressed += suppressed;
+         stats_.failed += failed;
+         stats_.connects += connects;
+      }
+
+      // sends the packets in order, counting them in sent as they go out, so
+      // that it's right even if this throws; a connection that's being reused
+      // may turn out to be broken, so in that case the rest of the batch is
+      // retried once on a fresh connection
+      void send_packets(std::vector<nsca_data_packet> const & packets, size_t & sent, boost::uint64_t & connects)
+      {
+         bool const reused = session_ && session_->age() < connection_ttl_secs_ && session_->alive();
+
+         if (!reused)
+         {
+            session_.reset();
+            session_.reset(new nsca_client::session(client_));
+            ++connects;
+         }
+
+         try
+         {
+            for (; sent < packets.size(); ++sent)
+               session_->send(packets[sent]);
+         }
+         catch (std::exception const &)
+         {
+            if (!reused)
+               throw;
+
+            session_.reset();
+            session_.reset(new nsca_client::session(client_));
+            ++connects;
+
+            for (; sent < packets.size(); ++sent)
+               session_->send(packets[sent]);
+         }
+
+         if (connection_ttl_secs_ <= 0)
+            session_.reset();
+      }
+
+      void expire_sent(boost::posix_time::ptime const & now)
+      {
+         for (sent_t::iterator it = sent_.begin(); it != sent_.end(); )
+         {
+            if (now - it->second >= min_resend_interval_)
+               sent_.erase(it++);
+            else
+               ++it;
+         }
+      }
+
+   private:
+      nsca_client client_;
+      size_t const max_queue_;
+      boost::posix_time::time_duration const min_resend_interval_;
+      int const connection_ttl_secs_;
+
+      mutable boost::mutex mutex_;
+      boost::condition_variable cond_;
+      boost::condition_variable idle_cond_;
+      queue_t queue_;
+      std::set<std::string> queued_;
+      nsca_async_sender_stats stats_;
+      bool stop_;
+      bool busy_;
+
+      // only used by the background thread
+      boost::scoped_ptr<nsca_client::session> session_;
+      sent_t sent_;
+
+      boost::scoped_ptr<boost::thread> thread_;
+   };
+
+}}
+
+#endif
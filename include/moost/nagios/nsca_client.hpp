@@ -32,7 +32,9 @@
 #include <sstream>
 #include <stdexcept>
 #include <ctime>
+#include <cerrno>
 #include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/thread.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/shared_ptr.hpp>
@@ -89,21 +91,52 @@ namespace moost { namespace nagios {
          boost::int16_t return_code,
          std::string plugin_output) const
       {
+         nsca_data_packet send_packet;
+         make_packet(hostname, svc_description, return_code, plugin_output, send_packet);
+
+         send(send_packet);
+      }
+
+      // Builds a data packet; throws if the host name or service description
+      // are too long, the plugin output is truncated to its first line and
+      // to the maximum length NSCA can handle.
+      void make_packet(
+         std::string const & hostname,
+         std::string const & svc_description,
+         boost::int16_t return_code,
+         std::string const & plugin_output,
+         nsca_data_packet & send_packet) const
+      {
+         // the packet parser reports these by setting failbit, which it also
+         // sets on reaching the end of the payload, so check them up front
+         if(hostname.size() > nsca_const::MAX_HOSTNAME_LENGTH-1)
+         {
+            throw std::invalid_argument("Hostname is too long for NSCA to handle");
+         }
+
+         if(svc_description.size() > nsca_const::MAX_DESCRIPTION_LENGTH-1)
+         {
+            throw std::invalid_argument("Service description is too long for NSCA to handle");
+         }
+
+         std::string output = plugin_output.substr(0, plugin_output.find('\n'));
+         if(output.size() > nsca_const::MAX_PLUGINOUTPUT_LENGTH-1)
+         {
+            output.resize(nsca_const::MAX_PLUGINOUTPUT_LENGTH-1);
+         }
+
          std::stringstream ss;
 
          ss
             << hostname << "\n"
             << svc_description << "\n"
             << return_code << "\n"
-            << plugin_output << "\n";
+            << output << "\n";
 
          ss.exceptions(std::ios::badbit); // simplify life.
 
-         nsca_data_packet send_packet;
          init_packet(send_packet);
          ss >> send_packet;
-
-         send(send_packet);
       }
 
    private:
@@ -111,6 +144,84 @@ namespace moost { namespace nagios {
 
       typedef boost::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
 
+   public:
+      // A session is one connection to the nsca server. The server sends its
+      // initialisation packet (IV and timestamp) once per connection, after
+      // which the client may send any number of packets, so a session pays
+      // for connecting and setting up the crypto state only once.
+      //
+      // Note the server rejects packets whose timestamp (which is taken from
+      // the initialisation packet) is older than its max_packet_age, so
+      // sessions should not be kept for long.
+      class session : boost::noncopyable
+      {
+      public:
+         session(nsca_client const & client)
+            : client_(client)
+            , created_(time(0))
+         {
+            psock_ = client_.connect(io_service_);
+            client_.recv(psock_, init_packet_);
+
+            pcrypto_.reset(
+               new nsca_crypto(
+                  init_packet_.iv,
+                  client_.cfg_->enctype,
+                  client_.cfg_->encpass
+               ));
+         }
+
+         // send the status update to the server
+         void send(nsca_data_packet const & send_packet)
+         {
+            using namespace boost::asio::detail::socket_ops;
+
+            // a copy of send_packet with the fields converted to network byte order
+            nsca_data_packet hton_send_packet;
+
+            // memcpy used as we need a binary copy (the padding is important) =/
+            memcpy(&hton_send_packet, &send_packet, sizeof(hton_send_packet));
+
+            hton_send_packet.packet_version= host_to_network_short(nsca_const::NSCA_PACKET_VERSION);
+            hton_send_packet.return_code = host_to_network_short(send_packet.return_code);
+            hton_send_packet.timestamp = host_to_network_long(init_packet_.timestamp);
+            hton_send_packet.crc32_value = 0;
+            hton_send_packet.crc32_value = host_to_network_long(client_.crc32_.calculate(hton_send_packet));
+
+            pcrypto_->encrypt(hton_send_packet);
+
+            client_.send(psock_, hton_send_packet);
+         }
+
+         // false once the server has closed the connection
+         bool alive() const
+         {
+#ifdef WIN32
+            return true;
+#else
+            char c;
+            ssize_t const n = ::recv(psock_->native(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+#endif
+         }
+
+         // seconds since the session was established
+         time_t age() const
+         {
+            return time(0) - created_;
+         }
+
+      private:
+         nsca_client const & client_;
+         time_t created_;
+         boost::asio::io_service io_service_;
+         socket_ptr psock_;
+         nsca_init_packet init_packet_;
+         crypto_ptr pcrypto_;
+      };
+
+   private:
+
       void init_packet(nsca_data_packet & send_packet) const
       {
          nsca_data_packet::randomize(send_packet);
@@ -159,52 +270,10 @@ namespace moost { namespace nagios {
          }
       }
 
-      // send the status update to the server
+      // send the status update to the server on a connection of its own
       void send(nsca_data_packet const & send_packet) const
       {
-         using namespace boost::asio::detail::socket_ops;
-
-         // a copy of send_packet with the fields converted to network byte order
-         nsca_data_packet hton_send_packet;
-
-         // memcpy used as we need a binary copy (the padding is important) =/
-         memcpy(&hton_send_packet, &send_packet, sizeof(hton_send_packet));
-
-         // socket service
-         boost::asio::io_service io_service;
-         socket_ptr psock;
-
-         // get the initialisation packet from the server
-         nsca_init_packet init_packet;
-
-         psock = connect(io_service);
-         recv(psock, init_packet);
-
-         // send the server the status update
-         hton_send_packet.packet_version= host_to_network_short(nsca_const::NSCA_PACKET_VERSION);
-         hton_send_packet.return_code = host_to_network_short(send_packet.return_code);
-         hton_send_packet.timestamp = host_to_network_long(init_packet.timestamp);
-         hton_send_packet.crc32_value = 0;
-         hton_send_packet.crc32_value = host_to_network_long(crc32_.calculate(hton_send_packet));
-
-         crypto_ptr pcrypto(
-            new nsca_crypto(
-               init_packet.iv,
-               cfg_->enctype,
-               cfg_->encpass
-            ));
-
-         pcrypto->encrypt(hton_send_packet);
-
-
-         if(!psock) { psock = connect(io_service); }
-         send(psock, hton_send_packet);
-
-         if(pcrypto)
-         {
-            pcrypto->decrypt(hton_send_packet);
-         }
-
+         session(*this).send(send_packet);
       }
 
    private:
@@ -72,6 +72,11 @@ public:
  * and handler_command() methods. It can be, but doesn't neccessarily have to be derived
  * from moost::fm303_cmd_shell.
  *
+ * Besides the handler's own commands, the shell offers the \c metrics command
+ * (see moost::metrics::shell_commands) to inspect the process' metrics registry.
+ * The handler gets to see every command first, so it can still define its own
+ * \c metrics command.
+ *
  * With the above class, a simple service can be implemented in a couple of lines of code:
 
 \code
@@ -168,6 +173,7 @@ int main()
 #include "../logging/standard_console.hpp"
 #include "../service/remote_shell.h"
 #include "../service/appender.h"
+#include "../metrics/shell_commands.hpp"
 
 // XXX: This is just a workaround until hopefully some day show_help() and get_prompt() are const...
 // #define MPS_FM303_SHELL_CONST const
@@ -390,6 +396,7 @@ private:
 
          help += m_logger.show_help();
          help += checked_handler()->show_help();
+         help += m_metrics.show_help();
 
          return help;
       }
@@ -401,7 +408,12 @@ private:
             return true;
          }
 
-         return checked_handler()->handle_command(rv, cmd, args);
+         if (checked_handler()->handle_command(rv, cmd, args))
+         {
+            return true;
+         }
+
+         return m_metrics.handle_command(rv, cmd, args);
       }
 
       std::string name() const
@@ -444,6 +456,7 @@ private:
    private:
       boost::shared_ptr<ServiceT> m_service;
       ConsoleLoggerPolicy m_logger;
+      moost::metrics::shell_commands m_metrics;
    };
 
    struct enable_logger_func
@@ -31,12 +31,185 @@
 #include <string>
 #include <sstream>
 #include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include <pqxx/pqxx>
 
+#include "../thread/worker_group.hpp"
+
 namespace moost {
 namespace psql {
 
+namespace detail {
+
+/**
+ * Hands chunks of events to a pool of threads and keeps track of which ones
+ * are done. The chunks themselves stay with the fetching thread, which is the
+ * only one that creates and destroys them, as pqxx::result isn't thread safe
+ * to copy.
+ */
+class pgq_chunk_pipeline : boost::noncopyable
+{
+public:
+    pgq_chunk_pipeline(size_t num_threads, size_t max_chunks)
+        : m_max_chunks(max_chunks)
+        , m_first(0)
+        , m_failed(false)
+        , m_workers(num_threads)
+    {
+    }
+
+    /**
+     * \brief Wait until another chunk may be fetched.
+     *
+     * \return the number of chunks, from the oldest, that are done and can be released.
+     */
+    size_t reserve()
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        size_t released = 0;
+
+        for (;;)
+        {
+            released += release();
+
+            if (m_done.size() < m_max_chunks || m_failed)
+            {
+                return released;
+            }
+
+            m_cond.wait(lock);
+        }
+    }
+
+    /**
+     * \brief Wait for all chunks to be done.
+     *
+     * \return the number of chunks that can be released, which is all of them.
+     */
+    size_t drain()
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        size_t released = release();
+
+        while (!m_done.empty())
+        {
+            m_cond.wait(lock);
+            released += release();
+        }
+
+        return released;
+    }
+
+    template<class FunctorType>
+    void submit(FunctorType const & functor, pqxx::result const & chunk)
+    {
+        size_t index;
+
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            index = m_first + m_done.size();
+            m_done.push_back(false);
+        }
+
+        m_workers.add_job(boost::bind(&pgq_chunk_pipeline::process<FunctorType>, this,
+                                      boost::cref(functor), boost::cref(chunk), index));
+    }
+
+    bool failed() const
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_failed;
+    }
+
+    /// The error of the first chunk that failed, clears the error.
+    std::string take_error()
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        std::string error;
+        error.swap(m_error);
+        m_failed = false;
+        return error;
+    }
+
+private:
+    // Must be called with the mutex held
+    size_t release()
+    {
+        size_t released = 0;
+
+        while (!m_done.empty() && m_done.front())
+        {
+            m_done.pop_front();
+            ++m_first;
+            ++released;
+        }
+
+        return released;
+    }
+
+    template<class FunctorType>
+    void process(FunctorType const & functor, pqxx::result const & chunk, size_t index)
+    {
+        std::string error;
+        bool failed = false;
+
+        // Once a chunk has failed the batch won't be finished, so don't bother
+        if (!this->failed())
+        {
+            try
+            {
+                functor(chunk);
+            }
+            catch (std::exception const & e)
+            {
+                failed = true;
+                error = e.what();
+            }
+            catch (...)
+            {
+                failed = true;
+                error = "unknown exception";
+            }
+        }
+
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+
+            if (failed && !m_failed)
+            {
+                m_failed = true;
+                m_error = error;
+            }
+
+            m_done[index - m_first] = true;
+        }
+
+        m_cond.notify_all();
+    }
+
+    size_t const m_max_chunks;
+
+    mutable boost::mutex m_mutex;
+    boost::condition_variable m_cond;
+    std::deque<bool> m_done;
+    size_t m_first;
+    bool m_failed;
+    std::string m_error;
+
+    // last, so the threads are stopped before anything they use goes away
+    moost::thread::worker_group m_workers;
+};
+
+} // namespace detail
+
 /// This class represents a consumer for a queue in pgq
 class pgq_consumer
 {
@@ -164,25 +337,14 @@ public:
 
         for(;; )
         {
-            std::stringstream query;
-            query << "select next_batch from pgq.next_batch("
-                  << conn.quote(m_queue_name) << ','
-                  << conn.quote(m_consumer_name) << ");";
-
-            pqxx::work transaction1(conn, "PollPgq1");
-            pqxx::result res = transaction1.exec(query);
+            long next_batch;
 
-            if (res.empty() || res.front()[0].is_null())
+            if (!get_next_batch(conn, next_batch))
             {
-                transaction1.commit();
                 return;
             }
 
-            long next_batch;
-            res.front()[0].to(next_batch);
-            transaction1.commit();
-
-            query.str(std::string());
+            std::stringstream query;
             query << "select " << columns << " from pgq.get_batch_events(" << next_batch << ");";
 
             pqxx::work transaction2(conn, "PollPgq2");
@@ -196,6 +358,109 @@ public:
         }
     }
 
+    /**
+     * \brief Poll the pgq queue and stream the events of each batch to a functor in chunks.
+     *
+     * Like poll(), but the events of a batch are never held in memory all at once. They
+     * are read through a cursor, chunk_size rows at a time, and each chunk is passed to
+     * the functor as a pqxx::result on one of num_threads threads while the next chunks
+     * are fetched. At most num_threads + prefetch chunks are held at any time.
+     *
+     * A batch is only finished once the functor has returned for all of its chunks. If
+     * the functor throws for any chunk, no further chunks are fetched, the batch isn't
+     * finished and a std::runtime_error is thrown once the outstanding chunks are done,
+     * so the whole batch will be delivered again.
+     *
+     * With more than one thread the functor is called concurrently, and chunks may be
+     * processed out of order. With one thread they're processed in order.
+     *
+     * \param columns The columns of pgq.get_batch_events() to select.
+     * \param functor The functor to be called for each chunk of events.
+     * \param chunk_size The maximum number of events per chunk.
+     * \param num_threads The number of threads that call the functor.
+     * \param prefetch The number of chunks to fetch ahead of processing.
+     */
+
+    template<class FunctorType>
+    void stream(char const * columns, FunctorType const & functor,
+                size_t chunk_size = 1000, size_t num_threads = 1, size_t prefetch = 2) const
+    {
+        num_threads = std::max(num_threads, size_t(1));
+        chunk_size = std::max(chunk_size, size_t(1));
+
+        pqxx::connection conn(m_dbconn);
+        detail::pgq_chunk_pipeline pipeline(num_threads, num_threads + prefetch);
+
+        std::stringstream fetch;
+        fetch << "fetch forward " << chunk_size << " from pgq_stream_events;";
+
+        for(;; )
+        {
+            long next_batch;
+
+            if (!get_next_batch(conn, next_batch))
+            {
+                return;
+            }
+
+            pqxx::work transaction(conn, "StreamPgq");
+
+            std::stringstream query;
+            query << "declare pgq_stream_events no scroll cursor for select " << columns
+                  << " from pgq.get_batch_events(" << next_batch << ");";
+            transaction.exec(query);
+
+            // only ever touched by this thread; the pipeline says when chunks can go
+            std::deque<pqxx::result> chunks;
+
+            try
+            {
+                for(;; )
+                {
+                    release(chunks, pipeline.reserve());
+
+                    if (pipeline.failed())
+                    {
+                        break;
+                    }
+
+                    chunks.push_back(transaction.exec(fetch.str()));
+
+                    if (chunks.back().empty())
+                    {
+                        break;
+                    }
+
+                    pipeline.submit(functor, chunks.back());
+                }
+            }
+            catch (...)
+            {
+                // the chunks must outlive the threads processing them
+                pipeline.drain();
+                throw;
+            }
+
+            release(chunks, pipeline.drain());
+            chunks.clear();
+
+            if (pipeline.failed())
+            {
+                // the transaction is aborted, so the batch will be delivered again
+                std::stringstream error;
+                error << "error processing pgq batch " << next_batch << ": " << pipeline.take_error();
+                throw std::runtime_error(error.str());
+            }
+
+            transaction.exec("close pgq_stream_events;");
+
+            query.str(std::string());
+            query << "select pgq.finish_batch(" << next_batch << ");";
+            transaction.exec(query);
+            transaction.commit();
+        }
+    }
+
     /**
      * \return The db connection string.
      */
@@ -224,6 +489,34 @@ public:
     }
 
 private:
+    /// Returns false if there's no batch to process
+    bool get_next_batch(pqxx::connection & conn, long & next_batch) const
+    {
+        std::stringstream query;
+        query << "select next_batch from pgq.next_batch("
+              << conn.quote(m_queue_name) << ','
+              << conn.quote(m_consumer_name) << ");";
+
+        pqxx::work transaction(conn, "PollPgq1");
+        pqxx::result res = transaction.exec(query);
+
+        bool const have_batch = !res.empty() && !res.front()[0].is_null();
+
+        if (have_batch)
+        {
+            res.front()[0].to(next_batch);
+        }
+
+        transaction.commit();
+
+        return have_batch;
+    }
+
+    static void release(std::deque<pqxx::result> & chunks, size_t count)
+    {
+        chunks.erase(chunks.begin(), chunks.begin() + std::min(count, chunks.size()));
+    }
+
     std::string const m_dbconn;
     std::string const m_queue_name;
     std::string const m_consumer_name;
@@ -0,0 +1,568 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_SERIALIZATION_HASHMAP_SNAPSHOT_HPP__
+#define MOOST_SERIALIZATION_HASHMAP_SNAPSHOT_HPP__
+
+/*!
+ * Binary snapshots of moost (Google) sparse and dense hashmaps
+ *
+ * Serialising hash maps element by element through boost::archive is slow
+ * for large maps. For maps of POD keys and values, this writes a binary
+ * snapshot instead:
+ *
+ *    header             magic, version, key/value sizes, entry count, ...
+ *    chunk checksums    one murmur3 checksum per chunk of entries
+ *    bucket index       offsets of the first entry of each bucket
+ *    entries            all key/value pairs, grouped by bucket
+ *
+ * Loading a snapshot verifies the checksums in parallel and inserts the
+ * entries into a table that has been sized up front. A snapshot can also be
+ * memory mapped using hash_map_snapshot_view, which looks up keys straight
+ * from the file without loading anything.
+ *
+ * Keys are hashed and compared bytewise, so they must not contain padding.
+ *
+ *    moost::serialization::save_hash_map_snapshot(map, "pages.snap");
+ *    moost::serialization::load_hash_map_snapshot(map, "pages.snap");
+ *
+ *    moost::serialization::hash_map_snapshot_view<int, float> view("pages.snap");
+ *    const float *val = view.find(42);
+ *
+ * Maps with non-POD keys or values are saved through boost::archive (using
+ * hashmap_serializer.hpp), and load_hash_map_snapshot() loads files that
+ * aren't snapshots through boost::archive, so existing files can still be
+ * read.
+ */
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/cast.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/mpl/and.hpp>
+#include <boost/mpl/if.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/type_traits/is_pod.hpp>
+
+#include "../hash/murmur3.hpp"
+#include "hashmap_serializer.hpp"
+
+namespace moost { namespace serialization {
+
+   /// types that can be written to a snapshot as raw bytes
+   template <typename T>
+   struct is_snapshot_pod : public boost::is_pod<T>
+   {
+   };
+
+   template <typename T1, typename T2>
+   struct is_snapshot_pod< std::pair<T1, T2> >
+      : public boost::integral_constant<bool, is_snapshot_pod<T1>::value && is_snapshot_pod<T2>::value>
+   {
+   };
+
+   /// the layout of an entry in a snapshot
+   template <typename keyT, typename valueT>
+   struct hash_map_snapshot_entry
+   {
+      keyT key;
+      valueT value;
+   };
+
+   namespace detail {
+
+      struct hash_map_snapshot_header
+      {
+         char magic[8];
+         boost::uint32_t version;
+         boost::uint32_t byte_order;
+         boost::uint32_t key_size;
+         boost::uint32_t value_size;
+         boost::uint32_t entry_size;
+         boost::uint32_t bucket_bits;
+         boost::uint64_t num_entries;
+         boost::uint64_t entries_per_chunk;
+         boost::uint32_t index_checksum;
+         boost::uint32_t header_checksum;
+         char reserved[8];
+      };
+
+      const char hash_map_snapshot_magic[8] = { 'M', 'H', 'M', 'S', 'N', 'A', 'P', '\0' };
+      const boost::uint32_t hash_map_snapshot_version = 1;
+      const boost::uint32_t hash_map_snapshot_byte_order = 0x01020304;
+      const size_t hash_map_snapshot_alignment = 64;
+
+      inline boost::uint32_t snapshot_checksum(const void *data, size_t size, boost::uint32_t seed)
+      {
+         return moost::hash::murmur3::compute32(data, size, seed);
+      }
+
+      inline boost::uint32_t header_checksum(const hash_map_snapshot_header& hdr)
+      {
+         return snapshot_checksum(&hdr, offsetof(hash_map_snapshot_header, header_checksum), 0);
+      }
+
+      inline size_t align_snapshot(size_t offset)
+      {
+         return (offset + hash_map_snapshot_alignment - 1) & ~(hash_map_snapshot_alignment - 1);
+      }
+
+      /// the file layout described by a header
+      struct hash_map_snapshot_layout
+      {
+         size_t num_chunks;
+         size_t num_buckets;
+         size_t checksums_offset;
+         size_t index_offset;
+         size_t entries_offset;
+         size_t file_size;
+
+         explicit hash_map_snapshot_layout(const hash_map_snapshot_header& hdr)
+         {
+            size_t const num_entries = boost::numeric_cast<size_t>(hdr.num_entries);
+            size_t const per_chunk = boost::numeric_cast<size_t>(hdr.entries_per_chunk);
+
+            num_chunks = per_chunk > 0 ? (num_entries + per_chunk - 1)/per_chunk : 0;
+            num_buckets = size_t(1) << hdr.bucket_bits;
+            checksums_offset = align_snapshot(sizeof(hash_map_snapshot_header));
+            index_offset = align_snapshot(checksums_offset + num_chunks*sizeof(boost::uint32_t));
+            entries_offset = align_snapshot(index_offset + (num_buckets + 1)*sizeof(boost::uint64_t));
+            file_size = entries_offset + num_entries*hdr.entry_size;
+         }
+      };
+
+      inline size_t snapshot_bucket(const void *key, size_t size, boost::uint32_t bucket_bits)
+      {
+         boost::uint32_t h = moost::hash::murmur3::compute32(key, size, 0);
+         return bucket_bits > 0 ? h >> (32 - bucket_bits) : 0;
+      }
+
+      inline void snapshot_worker(const boost::function<void (size_t)>& func, size_t count, boost::atomic<size_t>& next)
+      {
+         size_t i;
+
+         while ((i = next.fetch_add(1, boost::memory_order_relaxed)) < count)
+         {
+            func(i);
+         }
+      }
+
+      /// calls func(0) ... func(count - 1) on up to num_threads threads
+      inline void snapshot_parallel_for(size_t count, size_t num_threads, const boost::function<void (size_t)>& func)
+      {
+         if (num_threads == 0)
+         {
+            num_threads = std::max(boost::thread::hardware_concurrency(), 1u);
+         }
+
+         boost::atomic<size_t> next(0);
+         boost::thread_group threads;
+
+         for (size_t i = 1; i < std::min(num_threads, count); ++i)
+         {
+            threads.create_thread(boost::bind(&snapshot_worker, boost::cref(func), count, boost::ref(next)));
+         }
+
+         snapshot_worker(func, count, next);
+
+         threads.join_all();
+      }
+
+      inline void verify_chunk(const char *entries, size_t entry_size, size_t num_entries, size_t per_chunk,
+                               const boost::uint32_t *checksums, boost::atomic<size_t>& failed, size_t chunk)
+      {
+         size_t const first = chunk*per_chunk;
+         size_t const count = std::min(per_chunk, num_entries - first);
+
+         if (snapshot_checksum(entries + first*entry_size, count*entry_size, static_cast<boost::uint32_t>(chunk)) != checksums[chunk])
+         {
+            ++failed;
+         }
+      }
+
+      inline void compute_chunk(const char *entries, size_t entry_size, size_t num_entries, size_t per_chunk,
+                                boost::uint32_t *checksums, size_t chunk)
+      {
+         size_t const first = chunk*per_chunk;
+         size_t const count = std::min(per_chunk, num_entries - first);
+
+         checksums[chunk] = snapshot_checksum(entries + first*entry_size, count*entry_size, static_cast<boost::uint32_t>(chunk));
+      }
+
+      /// a mapped snapshot file with a validated header
+      class hash_map_snapshot_file : public boost::noncopyable
+      {
+      public:
+         /// returns false if the file isn't a snapshot at all
+         bool open(const std::string& path, size_t key_size, size_t value_size, size_t entry_size)
+         {
+            m_file.open(path);
+
+            if (m_file.size() < sizeof(m_hdr) ||
+                std::memcmp(m_file.data(), hash_map_snapshot_magic, sizeof(hash_map_snapshot_magic)) != 0)
+            {
+               m_file.close();
+               return false;
+            }
+
+            std::memcpy(&m_hdr, m_file.data(), sizeof(m_hdr));
+
+            if (m_hdr.header_checksum != header_checksum(m_hdr))
+               throw std::runtime_error("corrupt hash map snapshot header: " + path);
+            if (m_hdr.version != hash_map_snapshot_version)
+               throw std::runtime_error("unsupported hash map snapshot version: " + path);
+            if (m_hdr.byte_order != hash_map_snapshot_byte_order)
+               throw std::runtime_error("hash map snapshot has wrong byte order: " + path);
+            if (m_hdr.key_size != key_size || m_hdr.value_size != value_size || m_hdr.entry_size != entry_size)
+               throw std::runtime_error("hash map snapshot doesn't match map type: " + path);
+            if (m_hdr.bucket_bits > 32 || (m_hdr.num_entries > 0 && m_hdr.entries_per_chunk == 0))
+               throw std::runtime_error("invalid hash map snapshot header: " + path);
+
+            m_layout.reset(new hash_map_snapshot_layout(m_hdr));
+
+            if (m_file.size() != m_layout->file_size)
+               throw std::runtime_error("hash map snapshot has wrong size: " + path);
+
+            return true;
+         }
+
+         /// verifies all checksums, using up to num_threads threads
+         void verify(size_t num_threads) const
+         {
+            if (snapshot_checksum(data() + m_layout->index_offset, (m_layout->num_buckets + 1)*sizeof(boost::uint64_t), 0) != m_hdr.index_checksum)
+               throw std::runtime_error("corrupt hash map snapshot index");
+
+            const boost::uint64_t *index = this->index();
+
+            if (index[0] != 0 || index[m_layout->num_buckets] != m_hdr.num_entries)
+               throw std::runtime_error("corrupt hash map snapshot index");
+
+            boost::atomic<size_t> failed(0);
+
+            snapshot_parallel_for(m_layout->num_chunks, num_threads,
+                  boost::bind(&verify_chunk, entries(), size_t(m_hdr.entry_size), size_t(m_hdr.num_entries),
+                              size_t(m_hdr.entries_per_chunk), checksums(), boost::ref(failed), _1));
+
+            if (failed > 0)
+               throw std::runtime_error("corrupt hash map snapshot data");
+         }
+
+         const hash_map_snapshot_header& header() const { return m_hdr; }
+         const hash_map_snapshot_layout& layout() const { return *m_layout; }
+
+         const char *data() const { return m_file.data(); }
+
+         const boost::uint32_t *checksums() const
+         {
+            return reinterpret_cast<const boost::uint32_t *>(data() + m_layout->checksums_offset);
+         }
+
+         const boost::uint64_t *index() const
+         {
+            return reinterpret_cast<const boost::uint64_t *>(data() + m_layout->index_offset);
+         }
+
+         const char *entries() const
+         {
+            return data() + m_layout->entries_offset;
+         }
+
+      private:
+         boost::iostreams::mapped_file_source m_file;
+         hash_map_snapshot_header m_hdr;
+         boost::scoped_ptr<hash_map_snapshot_layout> m_layout;
+      };
+
+      struct hash_map_snapshot_writer__
+      {
+         template <typename mapT>
+         static void save(mapT const & map, std::string const & path, size_t entries_per_chunk, size_t num_threads)
+         {
+            typedef typename mapT::key_type key_type;
+            typedef typename mapT::data_type value_type;
+            typedef hash_map_snapshot_entry<key_type, value_type> entry_type;
+
+            hash_map_snapshot_header hdr;
+            std::memset(&hdr, 0, sizeof(hdr));
+            std::memcpy(hdr.magic, hash_map_snapshot_magic, sizeof(hdr.magic));
+            hdr.version = hash_map_snapshot_version;
+            hdr.byte_order = hash_map_snapshot_byte_order;
+            hdr.key_size = sizeof(key_type);
+            hdr.value_size = sizeof(value_type);
+            hdr.entry_size = sizeof(entry_type);
+            hdr.num_entries = map.size();
+            hdr.entries_per_chunk = std::max(entries_per_chunk, size_t(1));
+
+            // about four entries per bucket
+            while (hdr.bucket_bits < 32 && (size_t(4) << hdr.bucket_bits) < map.size())
+               ++hdr.bucket_bits;
+
+            hash_map_snapshot_layout layout(hdr);
+
+            // group the entries by bucket (counting sort)
+            std::vector<boost::uint32_t> buckets;
+            buckets.reserve(map.size());
+            std::vector<boost::uint64_t> index(layout.num_buckets + 1, 0);
+
+            for (typename mapT::const_iterator it = map.begin(); it != map.end(); ++it)
+            {
+               buckets.push_back(static_cast<boost::uint32_t>(snapshot_bucket(&it->first, sizeof(key_type), hdr.bucket_bits)));
+               ++index[buckets.back() + 1];
+            }
+
+            for (size_t i = 0; i < layout.num_buckets; ++i)
+               index[i + 1] += index[i];
+
+            // zeroed, so that padding doesn't end up in the file
+            std::vector<char> entries(map.size()*sizeof(entry_type), 0);
+            std::vector<boost::uint64_t> pos(index.begin(), index.end() - 1);
+            size_t i = 0;
+
+            for (typename mapT::const_iterator it = map.begin(); it != map.end(); ++it, ++i)
+            {
+               entry_type *e = reinterpret_cast<entry_type *>(&entries[0] + pos[buckets[i]]++*sizeof(entry_type));
+               std::memcpy(&e->key, &it->first, sizeof(key_type));
+               std::memcpy(&e->value, &it->second, sizeof(value_type));
+            }
+
+            std::vector<boost::uint32_t> checksums(layout.num_chunks);
+
+            if (!checksums.empty())
+            {
+               snapshot_parallel_for(layout.num_chunks, num_threads,
+                     boost::bind(&compute_chunk, &entries[0], sizeof(entry_type), map.size(),
+                                 size_t(hdr.entries_per_chunk), &checksums[0], _1));
+            }
+
+            hdr.index_checksum = snapshot_checksum(&index[0], index.size()*sizeof(index[0]), 0);
+            hdr.header_checksum = header_checksum(hdr);
+
+            std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+            if (!out) { throw std::runtime_error("unable to open hash map snapshot for writing: " + path); }
+            out.exceptions(std::ios::badbit | std::ios::failbit);
+
+            const char padding[hash_map_snapshot_alignment] = { 0 };
+
+            out.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+            out.write(padding, layout.checksums_offset - sizeof(hdr));
+            out.write(reinterpret_cast<const char *>(checksums.empty() ? 0 : &checksums[0]), checksums.size()*sizeof(checksums[0]));
+            out.write(padding, layout.index_offset - layout.checksums_offset - checksums.size()*sizeof(checksums[0]));
+            out.write(reinterpret_cast<const char *>(&index[0]), index.size()*sizeof(index[0]));
+            out.write(padding, layout.entries_offset - layout.index_offset - index.size()*sizeof(index[0]));
+            out.write(entries.empty() ? 0 : &entries[0], entries.size());
+            out.close();
+         }
+      };
+
+      struct hash_map_archive_writer__
+      {
+         template <typename mapT>
+         static void save(mapT const & map, std::string const & path, size_t, size_t)
+         {
+            std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+            if (!out) { throw std::runtime_error("unable to open hash map file for writing: " + path); }
+            boost::archive::binary_oarchive ar(out);
+            ar << map;
+         }
+      };
+
+      struct hash_map_snapshot_reader__
+      {
+         template <typename mapT>
+         static bool load(mapT & map, std::string const & path, size_t num_threads)
+         {
+            typedef typename mapT::key_type key_type;
+            typedef typename mapT::data_type value_type;
+            typedef hash_map_snapshot_entry<key_type, value_type> entry_type;
+
+            hash_map_snapshot_file file;
+
+            if (!file.open(path, sizeof(key_type), sizeof(value_type), sizeof(entry_type)))
+               return false;
+
+            file.verify(num_threads);
+
+            size_t const num_entries = boost::numeric_cast<size_t>(file.header().num_entries);
+            const entry_type *entries = reinterpret_cast<const entry_type *>(file.entries());
+
+            map.resize(map.size() + num_entries);
+
+            for (size_t i = 0; i < num_entries; ++i)
+               map[entries[i].key] = entries[i].value;
+
+            return true;
+         }
+      };
+
+      struct hash_map_archive_reader__
+      {
+         template <typename mapT>
+         static bool load(mapT &, std::string const &, size_t)
+         {
+            return false;
+         }
+      };
+
+      template <typename mapT>
+      struct is_snapshot_map
+         : public boost::mpl::and_< is_snapshot_pod<typename mapT::key_type>, is_snapshot_pod<typename mapT::data_type> >
+      {
+      };
+
+   }
+
+   /// default number of entries covered by each checksum
+   const size_t hash_map_snapshot_chunk_size = 1 << 16;
+
+   /**
+    * Saves a hash map to a file, as a snapshot if both key and value are POD
+    * types, or through boost::archive otherwise.
+    *
+    * \param num_threads    Maximum number of threads used, 0 means one per core
+    */
+   template <typename mapT>
+   void save_hash_map_snapshot(mapT const & map, std::string const & path,
+                               size_t entries_per_chunk = hash_map_snapshot_chunk_size, size_t num_threads = 0)
+   {
+      boost::mpl::if_<
+         detail::is_snapshot_map<mapT>,
+         detail::hash_map_snapshot_writer__,
+         detail::hash_map_archive_writer__
+      >::type::save(map, path, entries_per_chunk, num_threads);
+   }
+
+   /**
+    * Loads a hash map saved with save_hash_map_snapshot(). The contents are
+    * added to the map. Files that aren't snapshots are loaded through
+    * boost::archive. Throws std::runtime_error if the snapshot is corrupt,
+    * in which case the map is left unchanged.
+    *
+    * \param num_threads    Maximum number of threads used, 0 means one per core
+    */
+   template <typename mapT>
+   void load_hash_map_snapshot(mapT & map, std::string const & path, size_t num_threads = 0)
+   {
+      if (!boost::mpl::if_<
+             detail::is_snapshot_map<mapT>,
+             detail::hash_map_snapshot_reader__,
+             detail::hash_map_archive_reader__
+          >::type::load(map, path, num_threads))
+      {
+         std::ifstream in(path.c_str(), std::ios::binary);
+         if (!in) { throw std::runtime_error("unable to open hash map file: " + path); }
+         boost::archive::binary_iarchive ar(in);
+         ar >> map;
+      }
+   }
+
+   /**
+    * Read-only access to a memory mapped snapshot, without loading it.
+    *
+    * Lookups hash the key, which takes them to a bucket of about four entries
+    * in the file. Only the pages touched by lookups are ever read.
+    */
+   template <typename keyT, typename valueT>
+   class hash_map_snapshot_view : public boost::noncopyable
+   {
+   public:
+      typedef hash_map_snapshot_entry<keyT, valueT> entry_type;
+      typedef const entry_type *const_iterator;
+
+      /**
+       * Maps a snapshot. Throws if the file isn't a snapshot of a map with
+       * matching key and value types.
+       *
+       * \param verify         Verify the checksums of the whole file first
+       * \param num_threads    Maximum number of threads used for verifying,
+       *                       0 means one per core
+       */
+      explicit hash_map_snapshot_view(std::string const & path, bool verify = true, size_t num_threads = 0)
+      {
+         if (!m_file.open(path, sizeof(keyT), sizeof(valueT), sizeof(entry_type)))
+            throw std::runtime_error("not a hash map snapshot: " + path);
+
+         if (verify)
+            m_file.verify(num_threads);
+
+         m_index = m_file.index();
+         m_entries = reinterpret_cast<const entry_type *>(m_file.entries());
+         m_size = boost::numeric_cast<size_t>(m_file.header().num_entries);
+         m_bucket_bits = m_file.header().bucket_bits;
+      }
+
+      size_t size() const { return m_size; }
+      bool empty() const { return m_size == 0; }
+
+      const_iterator begin() const { return m_entries; }
+      const_iterator end() const { return m_entries + m_size; }
+
+      /// returns the value for key, or NULL if there is none
+      const valueT *find(const keyT& key) const
+      {
+         size_t const bucket = detail::snapshot_bucket(&key, sizeof(keyT), m_bucket_bits);
+
+         for (const entry_type *e = m_entries + m_index[bucket]; e != m_entries + m_index[bucket + 1]; ++e)
+         {
+            if (std::memcmp(&e->key, &key, sizeof(keyT)) == 0)
+               return &e->value;
+         }
+
+         return 0;
+      }
+
+      size_t count(const keyT& key) const
+      {
+         return find(key) ? 1 : 0;
+      }
+
+   private:
+      detail::hash_map_snapshot_file m_file;
+      const boost::uint64_t *m_index;
+      const entry_type *m_entries;
+      size_t m_size;
+      boost::uint32_t m_bucket_bits;
+   };
+
+}}
+
+#endif /// MOOST_SERIALIZATION_HASHMAP_SNAPSHOT_HPP__
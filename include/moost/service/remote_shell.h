@@ -97,6 +97,11 @@ rlwrap nc myhost 42001
  * using the \c exit, \c quit, or \c bye commands. This will \b not leave the run()
  * method. To leave the run() method in order to shut down the application, use the
  * \c shutdown command.
+ *
+ * Sessions never block the application: stdout, stderr and log output is queued
+ * per session up to a limit (see set_session_buffer_size()) and dropped beyond
+ * that, so a client that stops reading can neither stall the application's
+ * output nor the shutdown.
  */
 
 #include <iostream>
@@ -166,6 +171,8 @@ public:
    void set_listen_port(unsigned short);
    void set_pre_shutdown_function(boost::function0<void>&);
    void enable_local_shell(bool);
+   void set_num_threads(size_t);
+   void set_session_buffer_size(size_t);
 };
 
 /**
@@ -243,6 +250,30 @@ public:
       m_srv.enable_local_shell(enabled);
    }
 
+   /**
+    * \brief Set the number of threads running the shell's io_service
+    *
+    * Defaults to a single thread. Commands handled by the application's
+    * handler are always run sequentially in a separate thread.
+    */
+   void set_num_threads(size_t num_threads)
+   {
+      m_srv.set_num_threads(num_threads);
+   }
+
+   /**
+    * \brief Set the maximum amount of output buffered per session
+    *
+    * Once a client has this many bytes of output waiting to be sent, any
+    * further stdout, stderr or log output for that client is dropped (and
+    * the client is told how much was dropped) until it catches up. Defaults
+    * to 256 KiB.
+    */
+   void set_session_buffer_size(size_t bytes)
+   {
+      m_srv.set_session_buffer_size(bytes);
+   }
+
    void stop(const std::string& msg)
    {
       m_srv.stop(msg);
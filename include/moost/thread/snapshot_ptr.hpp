@@ -0,0 +1,143 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_THREAD_SNAPSHOT_PTR_HPP__
+#define MOOST_THREAD_SNAPSHOT_PTR_HPP__
+
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace moost { namespace thread {
+
+/** \brief snapshot_ptr publishes immutable snapshots of an object to many readers
+ *
+ * snapshot_ptr is meant for read-mostly data that is replaced wholesale, such
+ * as a data set that gets reloaded from disk. Readers grab a shared_ptr to the
+ * current snapshot without taking a lock, and can keep using it for as long as
+ * they like; publishing a new snapshot never affects a snapshot a reader holds.
+ *
+ * Internally there are two slots. A publisher fills the slot readers aren't
+ * using, flips the active index, then waits for stragglers on the old slot
+ * before releasing it. Readers announce themselves with a per-slot counter
+ * and retry if the index flipped underneath them, so they never block on
+ * each other or on a publisher. Publishers are serialised by a mutex and may
+ * briefly spin while a reader copies a shared_ptr out of a slot.
+ */
+template <class T>
+class snapshot_ptr : public boost::noncopyable
+{
+public:
+
+   typedef T element_type;
+
+   snapshot_ptr()
+     : m_active(0)
+   {
+      m_readers[0] = 0;
+      m_readers[1] = 0;
+   }
+
+   explicit snapshot_ptr(const boost::shared_ptr<T> & p)
+     : m_active(0)
+   {
+      m_readers[0] = 0;
+      m_readers[1] = 0;
+      m_slot[0] = p;
+   }
+
+   /** returns the current snapshot, never blocks */
+   boost::shared_ptr<T> get_shared() const
+   {
+      for (;;)
+      {
+         unsigned i = m_active.load(boost::memory_order_acquire);
+         m_readers[i].fetch_add(1, boost::memory_order_seq_cst);
+         if (m_active.load(boost::memory_order_seq_cst) == i)
+         {
+            boost::shared_ptr<T> p(m_slot[i]);
+            m_readers[i].fetch_sub(1, boost::memory_order_release);
+            return p;
+         }
+         m_readers[i].fetch_sub(1, boost::memory_order_release);
+      }
+   }
+
+   boost::shared_ptr<T> operator->() const
+   {
+      return get_shared();
+   }
+
+   /** publishes a new snapshot, readers see either the old or the new one */
+   void publish(const boost::shared_ptr<T> & p)
+   {
+      boost::mutex::scoped_lock lock(m_publish_mutex);
+
+      unsigned old = m_active.load(boost::memory_order_relaxed);
+      unsigned next = old ^ 1u;
+
+      // a reader that read the index two publishes ago may still be copying
+      wait_for_readers(next);
+      m_slot[next] = p;
+      m_active.store(next, boost::memory_order_seq_cst);
+
+      // drop our reference to the old snapshot once nobody is copying it,
+      // readers that already hold it keep it alive
+      wait_for_readers(old);
+      m_slot[old].reset();
+   }
+
+   snapshot_ptr<T> & operator=(const boost::shared_ptr<T> & p)
+   {
+      publish(p);
+      return *this;
+   }
+
+   void reset()
+   {
+      publish(boost::shared_ptr<T>());
+   }
+
+private:
+
+   void wait_for_readers(unsigned i) const
+   {
+      while (m_readers[i].load(boost::memory_order_seq_cst) != 0)
+         boost::this_thread::yield();
+   }
+
+   boost::shared_ptr<T> m_slot[2];
+   boost::atomic<unsigned> m_active;
+   mutable boost::atomic<unsigned> m_readers[2];
+   boost::mutex m_publish_mutex;
+};
+
+}} // moost::thread
+
+#endif // MOOST_THREAD_SNAPSHOT_PTR_HPP__
@@ -31,11 +31,15 @@
 #define MOOST_THREAD_WORKER_GROUP_HPP
 
 #include <queue>
+#include <string>
 #include <csignal>
 
 #include <boost/function.hpp>
 #include <boost/thread.hpp>
 #include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "../metrics/registry.hpp"
 
 namespace moost { namespace thread {
 
@@ -45,6 +49,12 @@ namespace moost { namespace thread {
  * This is an easy to use, multithreaded work dispatcher.
  * You can add jobs at any time and they will be dispatched
  * to the next available worker thread.
+ *
+ * A worker group that is given a name reports to moost::metrics
+ * how many jobs it ran ("thread.<name>.jobs"), how many are
+ * waiting ("thread.<name>.queued") and how long jobs waited
+ * for and ran on a worker ("thread.<name>.wait_us" and
+ * "thread.<name>.run_us").
  */
 class worker_group : public boost::noncopyable
 {
@@ -59,15 +69,20 @@ public:
    explicit worker_group(size_t num_workers = 1)
       : m_running(1)
    {
-      if (num_workers < 1)
-      {
-         throw std::runtime_error("invalid number of worker threads");
-      }
+      start(num_workers);
+   }
 
-      for (size_t i = 0; i < num_workers; ++i)
-      {
-         m_workers.create_thread(boost::bind(&worker_group::work, this));
-      }
+   /**
+    * Create a worker group that reports metrics
+    *
+    * \param num_workers     Number of worker threads.
+    * \param name            Name of the group in the metrics registry.
+    */
+   worker_group(size_t num_workers, const std::string& name)
+      : m_running(1)
+      , m_metrics(new job_metrics(name))
+   {
+      start(num_workers);
    }
 
    /**
@@ -86,6 +101,10 @@ public:
 
    /**
     * Stop a worker group
+    *
+    * The workers run the jobs already queued before they exit, and
+    * add_job() fails from now on. Should any job be left behind, it
+    * is dropped and no longer counted as queued.
     */
    void stop()
    {
@@ -97,6 +116,15 @@ public:
          }
          m_cond.notify_all();
          m_workers.join_all();
+
+         boost::mutex::scoped_lock lock(m_mx);
+
+         if (m_metrics)
+         {
+            m_metrics->queued.sub(static_cast<boost::int64_t>(m_jobs.size()));
+         }
+
+         jobs_t().swap(m_jobs);
       }
    }
 
@@ -117,19 +145,31 @@ public:
     */
    bool add_job(job_t job)
    {
-      bool added = m_running != 0;
+      queued_job qj;
+      qj.job = job;
+      qj.queued_us = m_metrics ? moost::metrics::monotonic_us() : 0;
 
-      if (added)
       {
+         boost::mutex::scoped_lock lock(m_mx);
+
+         // checked under the lock, so nothing is queued once stop() has
+         // let the workers go
+         if (!m_running)
          {
-            boost::mutex::scoped_lock lock(m_mx);
-            m_jobs.push(job);
+            return false;
+         }
+
+         if (m_metrics)
+         {
+            m_metrics->queued.add(1);
          }
 
-         m_cond.notify_one();
+         m_jobs.push(qj);
       }
 
-      return added;
+      m_cond.notify_one();
+
+      return true;
    }
 
    /**
@@ -154,13 +194,48 @@ public:
    }
 
 private:
-   typedef std::queue<job_t> jobs_t;
+   struct queued_job
+   {
+      job_t job;
+      boost::uint64_t queued_us;
+   };
+
+   struct job_metrics
+   {
+      explicit job_metrics(const std::string& name)
+         : jobs(moost::metrics::get_counter(moost::metrics::make_name("thread", name) + ".jobs"))
+         , queued(moost::metrics::get_gauge(moost::metrics::make_name("thread", name) + ".queued"))
+         , wait_us(moost::metrics::get_histogram(moost::metrics::make_name("thread", name) + ".wait_us"))
+         , run_us(moost::metrics::get_histogram(moost::metrics::make_name("thread", name) + ".run_us"))
+      {
+      }
+
+      moost::metrics::counter& jobs;
+      moost::metrics::gauge& queued;
+      moost::metrics::histogram& wait_us;
+      moost::metrics::histogram& run_us;
+   };
+
+   typedef std::queue<queued_job> jobs_t;
+
+   void start(size_t num_workers)
+   {
+      if (num_workers < 1)
+      {
+         throw std::runtime_error("invalid number of worker threads");
+      }
+
+      for (size_t i = 0; i < num_workers; ++i)
+      {
+         m_workers.create_thread(boost::bind(&worker_group::work, this));
+      }
+   }
 
    void work()
    {
       for (;;)
       {
-         job_t job;
+         queued_job job;
 
          {
             boost::mutex::scoped_lock lock(m_mx);
@@ -182,7 +257,19 @@ private:
             m_jobs.pop();
          }
 
-         job();
+         if (m_metrics)
+         {
+            boost::uint64_t start_us = moost::metrics::monotonic_us();
+            m_metrics->queued.sub(1);
+            m_metrics->wait_us.record(start_us - job.queued_us);
+            job.job();
+            m_metrics->run_us.record(moost::metrics::monotonic_us() - start_us);
+            ++m_metrics->jobs;
+         }
+         else
+         {
+            job.job();
+         }
       }
    }
 
@@ -191,6 +278,7 @@ private:
    boost::condition_variable m_cond;
    mutable boost::mutex m_mx;
    volatile sig_atomic_t m_running;
+   boost::scoped_ptr<job_metrics> m_metrics;
 };
 
 }}
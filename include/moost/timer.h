@@ -129,6 +129,9 @@ public:
 
 /** multi_timer provides a thread-safe collection of timers indexed by name
  * just a little syntactic confectionary
+ *
+ * utils::perf_profiler can feed the same timers while also collecting
+ * hardware performance counters for each scope.
  */
 class multi_timer
 {
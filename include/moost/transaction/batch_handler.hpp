@@ -0,0 +1,512 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_TRANSACTION_BATCH_HANDLER_HPP__
+#define MOOST_TRANSACTION_BATCH_HANDLER_HPP__
+
+// A transaction handler that drains its queue in batches. A number of
+// committer threads each take up to a batch worth of queued items and hand
+// them to a user defined batch commit functor. Items that fail to commit are
+// retried after an exponentially growing, jittered delay, so an unavailable
+// sink doesn't turn into a hot retry loop. Items that keep failing are
+// handed to a dead letter sink (or just dropped) after a number of attempts.
+//
+// The batch commit functor is called with the items to commit and returns
+// how many of them, counted from the front of the batch, were committed. The
+// remaining items are retried. Throwing an exception fails the whole batch:
+//
+//   size_t operator()(std::vector<value_type> const & batch);
+//
+// Existing single item commit functors can be adapted with PerItemCommit.
+//
+// Items stay in the queue until they've been committed or dead lettered, so
+// a persisted queue (see moost/transaction/queue.hpp) keeps them across a
+// restart. As the queue can only be popped from the front, an item is
+// removed once it and all items queued before it are done. An item that is
+// retried forever (maxAttempts = 0) therefore holds back every item queued
+// after it, which is why attempts are limited by default.
+//
+// A handler given a name reports to moost::metrics:
+//
+//   transaction.<name>.queued         items waiting to be committed
+//   transaction.<name>.backoff        items waiting for a retry
+//   transaction.<name>.held           done items held in the queue behind one that isn't
+//   transaction.<name>.committed      items committed
+//   transaction.<name>.retried        failed items scheduled for a retry
+//   transaction.<name>.dead_letters   items given up on
+//   transaction.<name>.commit_us      latency of batch commits
+//   transaction.<name>.batch_size     items per batch
+
+#include <deque>
+#include <map>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/date_time/posix_time/conversion.hpp>
+
+#include "../metrics/registry.hpp"
+
+namespace moost { namespace transaction {
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+// When to retry failed items and when to give up on them
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+
+struct RetryPolicy
+{
+   RetryPolicy(
+      size_t maxAttempts = 10,       // 0 retries forever
+      size_t initialBackoffMs = 100,
+      size_t maxBackoffMs = 30000,
+      double jitter = 0.5            // fraction of the delay that's random
+      ) :
+      maxAttempts(maxAttempts),
+      initialBackoffMs(initialBackoffMs),
+      maxBackoffMs(maxBackoffMs),
+      jitter(jitter)
+   {
+   }
+
+   size_t maxAttempts;
+   size_t initialBackoffMs;
+   size_t maxBackoffMs;
+   double jitter;
+
+   // The delay before retrying an item for the given number of failed
+   // attempts, without jitter
+   boost::uint64_t BackoffUs(size_t attempts) const
+   {
+      boost::uint64_t delay = static_cast<boost::uint64_t>(initialBackoffMs)*1000;
+      boost::uint64_t const maxDelay = static_cast<boost::uint64_t>(maxBackoffMs)*1000;
+
+      for(size_t i = 1 ; i < attempts && delay < maxDelay ; ++i)
+      {
+         delay *= 2;
+      }
+
+      return std::min(delay, maxDelay);
+   }
+};
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+// Adapts a single item commit functor, as used by TransactionHandler, to a
+// batch commit functor. Items are committed one at a time and the batch
+// stops at the first item that fails or throws.
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+
+template <typename commitFunctorT>
+class PerItemCommit
+{
+public:
+   PerItemCommit(commitFunctorT commitFunctor) : m_commitFunctor(commitFunctor) {}
+
+   template <typename valueT>
+   size_t operator()(std::vector<valueT> const & batch)
+   {
+      size_t committed = 0;
+
+      try
+      {
+         while(committed < batch.size() && m_commitFunctor(batch[committed]))
+         {
+            ++committed;
+         }
+      }
+      catch(...) { }
+
+      return committed;
+   }
+
+private:
+   commitFunctorT m_commitFunctor;
+};
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+// Batch draining transaction handler
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// queueT has the same interface requirements as for TransactionHandler.
+//
+// The batch commit functor is called concurrently from all committer
+// threads, so it must be thread safe if there's more than one of them.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+
+template <
+   typename queueT, // See handler.hpp for interface requirements
+   typename batchCommitFunctorT
+   >
+class BatchTransactionHandler : boost::noncopyable
+{
+public:
+   typedef typename queueT::value_type value_type;
+   typedef boost::function<void (value_type const &, size_t)> dead_letter_sink_t;
+
+   BatchTransactionHandler(
+      queueT & queue,
+      batchCommitFunctorT commitFunctor,
+      size_t numCommitters = 1,
+      size_t maxBatch = 100,
+      RetryPolicy const & retryPolicy = RetryPolicy(),
+      dead_letter_sink_t deadLetterSink = dead_letter_sink_t(),
+      std::string const & name = std::string()
+      ) :
+      m_running(true), m_queue(queue), m_commitFunctor(commitFunctor),
+      m_maxBatch(std::max(maxBatch, size_t(1))), m_retryPolicy(retryPolicy),
+      m_deadLetterSink(deadLetterSink), m_rng(rng_seed()), m_headSeq(0), m_nextSeq(0), m_held(0)
+   {
+      if(numCommitters < 1)
+      {
+         throw std::runtime_error("invalid number of committer threads");
+      }
+
+      if(!name.empty())
+      {
+         m_metrics.reset(new handler_metrics(name));
+      }
+
+      // The queue can only be read at the front, so items queued before we
+      // started are rotated through it to find out what they are
+      for(size_t qsize = m_queue.size() ; qsize > 0 ; --qsize)
+      {
+         value_type data = m_queue.front();
+         m_queue.push_back(data);
+         m_queue.pop_front();
+         enqueue(data);
+      }
+
+      for(size_t i = 0 ; i < numCommitters ; ++i)
+      {
+         m_committers.create_thread(boost::bind(&BatchTransactionHandler::CommitLoop, this));
+      }
+   }
+
+   ~BatchTransactionHandler()
+   {
+      // Stop the committers
+      //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+      // Every item still pending gets one more attempt, regardless of any
+      // backoff. Items that fail that attempt are left in the queue, so
+      // they'll be lost unless the queue is fully persisted.
+
+      {
+         lock_t l(m_mtx);
+         m_running = false;
+      }
+
+      m_cond.notify_all();
+      m_committers.join_all();
+   }
+
+   void post(value_type const & data)
+   {
+      {
+         lock_t l(m_mtx);
+         m_queue.push_back(data);
+         enqueue(data);
+      }
+
+      m_cond.notify_one();
+   }
+
+   // The number of items that haven't been committed or dead lettered yet
+   size_t size() const
+   {
+      lock_t l(m_mtx);
+      return static_cast<size_t>(m_nextSeq - m_headSeq);
+   }
+
+private:
+   struct record
+   {
+      record(value_type const & data, boost::uint64_t seq) : data(data), seq(seq), attempts(0) {}
+
+      value_type data;
+      boost::uint64_t seq;
+      size_t attempts;
+   };
+
+   struct handler_metrics
+   {
+      explicit handler_metrics(std::string const & name) :
+         queued(metrics::get_gauge(metrics::make_name("transaction", name) + ".queued")),
+         backoff(metrics::get_gauge(metrics::make_name("transaction", name) + ".backoff")),
+         held(metrics::get_gauge(metrics::make_name("transaction", name) + ".held")),
+         committed(metrics::get_counter(metrics::make_name("transaction", name) + ".committed")),
+         retried(metrics::get_counter(metrics::make_name("transaction", name) + ".retried")),
+         deadLetters(metrics::get_counter(metrics::make_name("transaction", name) + ".dead_letters")),
+         commitUs(metrics::get_histogram(metrics::make_name("transaction", name) + ".commit_us")),
+         batchSize(metrics::get_histogram(metrics::make_name("transaction", name) + ".batch_size", "items"))
+      {
+      }
+
+      metrics::gauge & queued;
+      metrics::gauge & backoff;
+      metrics::gauge & held;
+      metrics::counter & committed;
+      metrics::counter & retried;
+      metrics::counter & deadLetters;
+      metrics::histogram & commitUs;
+      metrics::histogram & batchSize;
+   };
+
+   typedef boost::mutex::scoped_lock lock_t;
+   typedef std::multimap<boost::uint64_t, record> backoff_t;
+
+   // Must be called with the mutex held
+   void enqueue(value_type const & data)
+   {
+      m_ready.push_back(record(data, m_nextSeq++));
+      m_done.push_back(false);
+
+      if(m_metrics) { m_metrics->queued.add(1); }
+   }
+
+   // Must be called with the mutex held. Pops everything from the front of
+   // the queue that's done with.
+   void resolve(record const & rec)
+   {
+      m_done[static_cast<size_t>(rec.seq - m_headSeq)] = true;
+      ++m_held;
+
+      while(!m_done.empty() && m_done.front())
+      {
+         m_queue.pop_front();
+         m_done.pop_front();
+         ++m_headSeq;
+         --m_held;
+      }
+
+      if(m_metrics)
+      {
+         m_metrics->queued.sub(1);
+         m_metrics->held.set(static_cast<boost::int64_t>(m_held));
+      }
+   }
+
+   // Must be called with the mutex held. Moves items whose backoff has
+   // expired, or all of them when stopping, to the ready queue.
+   void promote(boost::uint64_t now)
+   {
+      typename backoff_t::iterator end = m_running ? m_backoff.upper_bound(now) : m_backoff.end();
+
+      for(typename backoff_t::iterator itr = m_backoff.begin() ; itr != end ; ++itr)
+      {
+         m_ready.push_back(itr->second);
+      }
+
+      if(m_metrics) { m_metrics->backoff.sub(std::distance(m_backoff.begin(), end)); }
+
+      m_backoff.erase(m_backoff.begin(), end);
+   }
+
+   // Waits for a batch of ready items, returns false once stopped and drained
+   bool take(std::vector<record> & batch)
+   {
+      lock_t l(m_mtx);
+
+      for(;;)
+      {
+         boost::uint64_t const now = metrics::monotonic_us();
+
+         promote(now);
+
+         if(!m_ready.empty()) { break; }
+         if(!m_running) { return false; }
+
+         if(m_backoff.empty())
+         {
+            m_cond.wait(l);
+         }
+         else
+         {
+            m_cond.timed_wait(l, boost::posix_time::microseconds(m_backoff.begin()->first - now));
+         }
+      }
+
+      size_t const count = std::min(m_ready.size(), m_maxBatch);
+      batch.assign(m_ready.begin(), m_ready.begin() + count);
+      m_ready.erase(m_ready.begin(), m_ready.begin() + count);
+
+      // Let another committer pick up what's left
+      if(!m_ready.empty()) { m_cond.notify_one(); }
+
+      return true;
+   }
+
+   void CommitLoop()
+   {
+      std::vector<record> batch;
+      std::vector<value_type> values;
+      std::vector<record> dead;
+
+      while(take(batch))
+      {
+         values.clear();
+
+         for(size_t i = 0 ; i < batch.size() ; ++i)
+         {
+            values.push_back(batch[i].data);
+         }
+
+         size_t committed = 0;
+         boost::uint64_t const start = metrics::monotonic_us();
+
+         try
+         {
+            // Attempt commit
+            committed = std::min(m_commitFunctor(values), batch.size());
+         }
+         catch(...) { }
+
+         if(m_metrics)
+         {
+            m_metrics->commitUs.record(metrics::monotonic_us() - start);
+            m_metrics->batchSize.record(batch.size());
+            m_metrics->committed += committed;
+         }
+
+         dead.clear();
+
+         {
+            lock_t l(m_mtx);
+            boost::uint64_t const now = metrics::monotonic_us();
+
+            for(size_t i = 0 ; i < committed ; ++i)
+            {
+               resolve(batch[i]);
+            }
+
+            for(size_t i = committed ; i < batch.size() ; ++i)
+            {
+               record & rec = batch[i];
+
+               // Only the first uncommitted item is known to have failed, the
+               // ones after it may not have been tried, so they back off
+               // without being charged an attempt
+               size_t const failures = i == committed ? ++rec.attempts : rec.attempts + 1;
+
+               if(i == committed && rec.attempts >= m_retryPolicy.maxAttempts && m_retryPolicy.maxAttempts > 0)
+               {
+                  dead.push_back(rec);
+               }
+               else if(m_running)
+               {
+                  m_backoff.insert(std::make_pair(now + backoff(failures), rec));
+                  if(m_metrics) { m_metrics->retried.add(1); m_metrics->backoff.add(1); }
+               }
+               // else it stays in the queue, as we're stopping
+            }
+         }
+
+         if(!dead.empty())
+         {
+            for(size_t i = 0 ; i < dead.size() ; ++i)
+            {
+               try
+               {
+                  if(m_deadLetterSink) { m_deadLetterSink(dead[i].data, dead[i].attempts); }
+               }
+               catch(...) { }
+            }
+
+            lock_t l(m_mtx);
+
+            for(size_t i = 0 ; i < dead.size() ; ++i)
+            {
+               resolve(dead[i]);
+            }
+
+            if(m_metrics) { m_metrics->deadLetters += dead.size(); }
+         }
+      }
+   }
+
+   // Differs between processes and handlers, so that their retries don't
+   // all back off in step
+   boost::uint32_t rng_seed() const
+   {
+      boost::posix_time::time_duration const t =
+         boost::posix_time::microsec_clock::universal_time() - boost::posix_time::from_time_t(0);
+      boost::uint64_t const seed = static_cast<boost::uint64_t>(t.total_microseconds())
+         ^ (static_cast<boost::uint64_t>(::getpid()) << 16)
+         ^ reinterpret_cast<size_t>(this);
+
+      return static_cast<boost::uint32_t>(seed ^ (seed >> 32));
+   }
+
+   // Must be called with the mutex held
+   boost::uint64_t backoff(size_t attempts)
+   {
+      double const delay = static_cast<double>(m_retryPolicy.BackoffUs(attempts));
+      double const jitter = std::min(std::max(m_retryPolicy.jitter, 0.0), 1.0);
+      boost::uniform_real<double> dist(0.0, 1.0);
+
+      return static_cast<boost::uint64_t>(delay*(1.0 - jitter) + delay*jitter*dist(m_rng));
+   }
+
+private:
+   bool m_running;
+   queueT & m_queue;
+   batchCommitFunctorT m_commitFunctor;
+   size_t const m_maxBatch;
+   RetryPolicy const m_retryPolicy;
+   dead_letter_sink_t m_deadLetterSink;
+   boost::scoped_ptr<handler_metrics> m_metrics;
+
+   mutable boost::mutex m_mtx;
+   boost::condition_variable m_cond;
+   boost::mt19937 m_rng;
+
+   std::deque<record> m_ready;        // items to commit now
+   backoff_t m_backoff;               // items to retry later, by due time
+   std::deque<bool> m_done;           // whether each queued item is done with
+   boost::uint64_t m_headSeq;         // sequence number of the queue's front
+   boost::uint64_t m_nextSeq;         // sequence number of the next item queued
+   size_t m_held;                     // done items still queued behind one that isn't
+
+   boost::thread_group m_committers;
+};
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+
+}}
+
+#endif // MOOST_TRANSACTION_BATCH_HANDLER_HPP__
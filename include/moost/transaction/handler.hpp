@@ -35,6 +35,9 @@
 
 // Tip: For a persisted queue take a look a moost/transaction/queue.hpp
 
+// Tip: To commit in batches, on several threads and with backoff between
+//      retries take a look at moost/transaction/batch_handler.hpp
+
 #include <csignal>
 
 #include <boost/asio.hpp>
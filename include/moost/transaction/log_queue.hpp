@@ -0,0 +1,592 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_TRANSACTION_LOG_QUEUE_HPP__
+#define MOOST_TRANSACTION_LOG_QUEUE_HPP__
+
+// A persisted transaction queue backed by an append-only log, for use with
+// moost/transaction/handler.hpp in place of FullyPersistedTQ.
+//
+// Items are appended to segment files of a configurable size, which are
+// fdatasync'ed in batches: after a number of items or when a time interval
+// has passed since the last sync, whichever comes first. Popping an item only
+// moves a read cursor, which is written to a checkpoint file whenever the log
+// is synced. Segments that have been read completely are kept as spares and
+// overwritten by later segments, so a long running queue keeps reusing a
+// handful of files. On startup the segments are read sequentially, starting
+// at the checkpoint.
+//
+// Files in rootDir, for a queue id of "myqueue":
+//
+//   myqueue.0000000000000007.log     segments, in order
+//   myqueue.free.0000000000000005    spare segments
+//   myqueue.checkpoint               read cursor
+//
+// Each record carries a checksum that depends on the segment it's in, so a
+// record torn by a crash, or left behind in a reused segment, ends the
+// segment when it's replayed.
+//
+// Items popped since the last sync may be replayed after a crash. Items
+// pushed since the last sync may be lost; Sync() can be called at any time,
+// e.g. from a timer, to bound how long that window is.
+//
+// Like the other queues, this isn't thread safe; TransactionHandler does
+// its own locking.
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "queue.hpp"
+#include "../hash/murmur3.hpp"
+#include "../metrics/histogram.hpp"
+
+namespace moost { namespace transaction {
+
+   //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+   // This is a generic record serialiser for POD types ONLY. If your data has
+   // specific serialisation requirements implement a serialiser with the
+   // same interface.
+
+   template <typename dataT>
+   class RecordSerializer
+   {
+   public:
+      void Serialise(dataT const & data, std::string & record) const
+      {
+         record.assign(reinterpret_cast<char const *>(&data), sizeof(data));
+      }
+
+      bool Deserialise(char const * record, size_t size, dataT & data) const
+      {
+         if(size != sizeof(data))
+         {
+            return false;
+         }
+
+         std::memcpy(&data, record, size);
+         return true;
+      }
+   };
+
+   //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+   // The append-only log queue
+
+   template <
+      typename dataT,
+      typename serializerT = RecordSerializer<dataT>,
+      template<typename T, typename A = std::allocator<T> > class queueT = std::deque
+   >
+   class LogPersistedTQ : public ITransactionQueue<dataT>, boost::noncopyable
+   {
+   public:
+      typedef dataT value_type;
+
+      LogPersistedTQ(
+         std::string const & rootDir,
+         std::string const & queueId,
+         size_t segmentSize = 64 << 20,  // bytes per segment file
+         size_t syncItems = 1000,        // sync after this many pushes...
+         size_t syncIntervalMs = 100     // ...or this long, 0 syncs every push
+         ) :
+         m_rootDir(rootDir), m_queueId(queueId), m_segmentSize(segmentSize),
+         m_syncItems(std::max(syncItems, size_t(1))), m_syncIntervalUs(static_cast<boost::uint64_t>(syncIntervalMs)*1000),
+         m_fd(-1), m_cpFd(-1), m_writeOffset(0), m_cursorSeg(0), m_cursorOff(0), m_cursorDirty(false),
+         m_unsynced(0), m_lastSyncUs(metrics::monotonic_us())
+      {
+         try
+         {
+            boost::filesystem::create_directories(rootDir);
+            Open();
+         }
+         catch(...)
+         {
+            Close();
+            throw;
+         }
+      }
+
+      ~LogPersistedTQ()
+      {
+         try
+         {
+            Sync();
+         }
+         catch(...) { }
+
+         Close();
+      }
+
+      size_t size() const { return m_queue.size(); }
+
+      bool empty() const { return m_queue.empty(); }
+
+      value_type & front()
+      {
+         return m_queue.front().data;
+      }
+
+      void push_back(value_type const & data)
+      {
+         m_serializer.Serialise(data, m_record);
+
+         size_t const size = sizeof(boost::uint32_t)*2 + m_record.size();
+
+         if(m_writeOffset + size > m_segmentSize && m_writeOffset > sizeof(segment_header))
+         {
+            Rollover();
+         }
+
+         boost::uint32_t frame[2];
+         frame[0] = static_cast<boost::uint32_t>(m_record.size());
+         frame[1] = Checksum(m_segments.back(), m_record.data(), m_record.size());
+         m_record.insert(0, reinterpret_cast<char const *>(frame), sizeof(frame));
+
+         Write(m_fd, m_record.data(), m_record.size(), m_writeOffset);
+         m_writeOffset += m_record.size();
+
+         m_queue.push_back(item(data, m_segments.back(), m_writeOffset));
+         ++m_unsynced;
+
+         MaybeSync();
+      }
+
+      void pop_front()
+      {
+         m_cursorSeg = m_queue.front().seg;
+         m_cursorOff = m_queue.front().end;
+         m_cursorDirty = true;
+
+         m_queue.pop_front();
+
+         // Anything before the segment the cursor is in has been read
+         while(m_segments.front() < m_cursorSeg)
+         {
+            Recycle(m_segments.front());
+            m_segments.pop_front();
+         }
+
+         MaybeSync();
+      }
+
+      // Makes all pushes and pops so far durable
+      void Sync()
+      {
+         if(m_unsynced > 0)
+         {
+            if(::fdatasync(m_fd) != 0) { Fail("unable to sync", SegmentPath(m_segments.back())); }
+            m_unsynced = 0;
+         }
+
+         if(m_cursorDirty)
+         {
+            checkpoint cp;
+            std::memset(&cp, 0, sizeof(cp));
+            cp.seg = m_cursorSeg;
+            cp.off = m_cursorOff;
+            cp.checksum = moost::hash::murmur3::compute32(&cp, offsetof(checkpoint, checksum), 0);
+
+            Write(m_cpFd, &cp, sizeof(cp), 0);
+            if(::fdatasync(m_cpFd) != 0) { Fail("unable to sync", CheckpointPath()); }
+            m_cursorDirty = false;
+         }
+
+         m_lastSyncUs = metrics::monotonic_us();
+      }
+
+      // The number of segment files in use, not counting spares
+      size_t segments() const { return m_segments.size(); }
+
+   private:
+      struct item
+      {
+         item(dataT const & data, boost::uint64_t seg, boost::uint64_t end) : data(data), seg(seg), end(end) {}
+
+         dataT data;
+         boost::uint64_t seg;  // segment the item is in
+         boost::uint64_t end;  // offset of the next record
+      };
+
+      struct segment_header
+      {
+         char magic[8];
+         boost::uint64_t seg;
+      };
+
+      struct checkpoint
+      {
+         boost::uint64_t seg;
+         boost::uint64_t off;
+         boost::uint32_t checksum;
+         boost::uint32_t reserved;
+      };
+
+      static const size_t s_maxSpares = 2;
+
+      static char const * Magic() { return "MTQLOG01"; }
+
+      static boost::uint32_t Checksum(boost::uint64_t seg, char const * data, size_t size)
+      {
+         return moost::hash::murmur3::compute32(data, size, static_cast<boost::uint32_t>(seg ^ (seg >> 32)) ^ static_cast<boost::uint32_t>(size));
+      }
+
+      static void Fail(char const * what, std::string const & path)
+      {
+         throw std::runtime_error(std::string("Log queue ") + what + ": " + path + " (" + strerror(errno) + ")");
+      }
+
+      static void Write(int fd, void const * data, size_t size, boost::uint64_t offset)
+      {
+         char const * p = static_cast<char const *>(data);
+
+         while(size > 0)
+         {
+            ssize_t rv = ::pwrite(fd, p, size, static_cast<off_t>(offset));
+
+            if(rv < 0)
+            {
+               if(errno == EINTR) { continue; }
+               throw std::runtime_error(std::string("Log queue write failed: ") + strerror(errno));
+            }
+
+            p += rv;
+            size -= rv;
+            offset += rv;
+         }
+      }
+
+      std::string FilePath(std::string const & name) const
+      {
+         return m_rootDir + "/" + name;
+      }
+
+      std::string SegmentPath(boost::uint64_t seg) const
+      {
+         std::ostringstream ss;
+         ss << m_queueId << "." << std::hex << std::setw(16) << std::setfill('0') << seg << ".log";
+         return FilePath(ss.str());
+      }
+
+      std::string SparePath(boost::uint64_t seg) const
+      {
+         std::ostringstream ss;
+         ss << m_queueId << ".free." << std::hex << std::setw(16) << std::setfill('0') << seg;
+         return FilePath(ss.str());
+      }
+
+      std::string CheckpointPath() const
+      {
+         return FilePath(m_queueId + ".checkpoint");
+      }
+
+      // Returns true and the sequence number if name is <queueId><infix><hex><suffix>
+      bool ParseName(std::string const & name, std::string const & infix, std::string const & suffix, boost::uint64_t & seg) const
+      {
+         std::string const prefix = m_queueId + infix;
+
+         if(name.size() != prefix.size() + 16 + suffix.size() ||
+            name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+         {
+            return false;
+         }
+
+         std::string const hex = name.substr(prefix.size(), 16);
+
+         if(hex.find_first_not_of("0123456789abcdef") != std::string::npos)
+         {
+            return false;
+         }
+
+         std::istringstream ss(hex);
+         ss >> std::hex >> seg;
+         return true;
+      }
+
+      void Open()
+      {
+         std::vector<boost::uint64_t> segs;
+
+         DIR * dir = ::opendir(m_rootDir.c_str());
+         if(!dir) { Fail("unable to open", m_rootDir); }
+
+         for(struct dirent * de = ::readdir(dir) ; de ; de = ::readdir(dir))
+         {
+            boost::uint64_t seg;
+
+            if(ParseName(de->d_name, ".", ".log", seg))
+            {
+               segs.push_back(seg);
+            }
+            else if(ParseName(de->d_name, ".free.", "", seg))
+            {
+               m_spares.push_back(FilePath(de->d_name));
+            }
+         }
+
+         ::closedir(dir);
+
+         std::sort(segs.begin(), segs.end());
+
+         m_cpFd = ::open(CheckpointPath().c_str(), O_RDWR | O_CREAT, 0644);
+         if(m_cpFd < 0) { Fail("unable to open", CheckpointPath()); }
+
+         checkpoint cp;
+         bool const haveCp = ::pread(m_cpFd, &cp, sizeof(cp), 0) == static_cast<ssize_t>(sizeof(cp)) &&
+                             cp.checksum == moost::hash::murmur3::compute32(&cp, offsetof(checkpoint, checksum), 0);
+
+         boost::uint64_t end = sizeof(segment_header);
+
+         for(size_t i = 0 ; i < segs.size() ; ++i)
+         {
+            if(haveCp && segs[i] < cp.seg)
+            {
+               Recycle(segs[i]);
+               continue;
+            }
+
+            bool const atCp = haveCp && segs[i] == cp.seg;
+
+            if(m_segments.empty())
+            {
+               m_cursorSeg = segs[i];
+               m_cursorOff = atCp ? cp.off : sizeof(segment_header);
+            }
+
+            m_segments.push_back(segs[i]);
+            end = Replay(segs[i], atCp ? cp.off : sizeof(segment_header));
+         }
+
+         if(m_segments.empty())
+         {
+            // Carry on numbering from the checkpoint, so no stale records match
+            boost::uint64_t const seg = std::max(haveCp ? cp.seg + 1 : 1, segs.empty() ? 1 : segs.back() + 1);
+            OpenSegment(seg);
+            m_cursorSeg = seg;
+            m_cursorOff = m_writeOffset;
+         }
+         else
+         {
+            m_fd = ::open(SegmentPath(m_segments.back()).c_str(), O_WRONLY);
+            if(m_fd < 0) { Fail("unable to open", SegmentPath(m_segments.back())); }
+            m_writeOffset = end;
+
+            // A segment whose header didn't make it to disk is rewritten
+            if(end == sizeof(segment_header))
+            {
+               WriteHeader(m_segments.back());
+            }
+         }
+      }
+
+      // Reads the items in a segment from offset, returns the end of the last valid record
+      boost::uint64_t Replay(boost::uint64_t seg, boost::uint64_t offset)
+      {
+         std::string const path = SegmentPath(seg);
+         std::ifstream in(path.c_str(), std::ios::binary);
+         if(!in) { Fail("unable to open", path); }
+
+         in.seekg(0, std::ios::end);
+         std::streamoff const size = in.tellg();
+         in.seekg(0);
+
+         m_readBuf.resize(static_cast<size_t>(size));
+         if(size > 0 && !in.read(&m_readBuf[0], size)) { Fail("unable to read", path); }
+
+         segment_header hdr;
+
+         if(m_readBuf.size() < sizeof(hdr))
+         {
+            return sizeof(hdr);
+         }
+
+         std::memcpy(&hdr, &m_readBuf[0], sizeof(hdr));
+
+         if(std::memcmp(hdr.magic, Magic(), sizeof(hdr.magic)) != 0 || hdr.seg != seg)
+         {
+            return sizeof(hdr);
+         }
+
+         size_t pos = static_cast<size_t>(std::max(offset, static_cast<boost::uint64_t>(sizeof(hdr))));
+         dataT data = dataT();
+
+         while(pos + sizeof(boost::uint32_t)*2 <= m_readBuf.size())
+         {
+            boost::uint32_t frame[2];
+            std::memcpy(frame, &m_readBuf[pos], sizeof(frame));
+
+            char const * record = &m_readBuf[pos] + sizeof(frame);
+
+            if(frame[0] > m_readBuf.size() - pos - sizeof(frame) || frame[1] != Checksum(seg, record, frame[0]))
+            {
+               break;
+            }
+
+            if(!m_serializer.Deserialise(record, frame[0], data))
+            {
+               throw std::runtime_error("Error loading log queue record: " + path);
+            }
+
+            pos += sizeof(frame) + frame[0];
+            m_queue.push_back(item(data, seg, pos));
+         }
+
+         return pos;
+      }
+
+      void WriteHeader(boost::uint64_t seg)
+      {
+         segment_header hdr;
+         std::memcpy(hdr.magic, Magic(), sizeof(hdr.magic));
+         hdr.seg = seg;
+         Write(m_fd, &hdr, sizeof(hdr), 0);
+      }
+
+      void OpenSegment(boost::uint64_t seg)
+      {
+         std::string const path = SegmentPath(seg);
+
+         if(!m_spares.empty())
+         {
+            if(::rename(m_spares.back().c_str(), path.c_str()) != 0) { Fail("unable to reuse", m_spares.back()); }
+            m_spares.pop_back();
+         }
+
+         m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+         if(m_fd < 0) { Fail("unable to open", path); }
+
+         WriteHeader(seg);
+         m_writeOffset = sizeof(segment_header);
+         m_segments.push_back(seg);
+
+         // Make sure the new segment's name is durable before anything goes into it
+         if(::fdatasync(m_fd) != 0) { Fail("unable to sync", path); }
+         SyncDir();
+      }
+
+      void Rollover()
+      {
+         // Everything in a segment is on disk before the next one is used
+         if(::fdatasync(m_fd) != 0) { Fail("unable to sync", SegmentPath(m_segments.back())); }
+         m_unsynced = 0;
+
+         ::close(m_fd);
+         m_fd = -1;
+
+         OpenSegment(m_segments.back() + 1);
+      }
+
+      void Recycle(boost::uint64_t seg)
+      {
+         std::string const path = SegmentPath(seg);
+
+         if(m_spares.size() < s_maxSpares)
+         {
+            std::string const spare = SparePath(seg);
+            if(::rename(path.c_str(), spare.c_str()) != 0) { Fail("unable to recycle", path); }
+            m_spares.push_back(spare);
+         }
+         else
+         {
+            boost::filesystem::remove(path);
+         }
+      }
+
+      void SyncDir()
+      {
+         int fd = ::open(m_rootDir.c_str(), O_RDONLY);
+
+         if(fd >= 0)
+         {
+            ::fsync(fd);
+            ::close(fd);
+         }
+      }
+
+      void MaybeSync()
+      {
+         if(m_unsynced >= m_syncItems || m_syncIntervalUs == 0 ||
+            metrics::monotonic_us() - m_lastSyncUs >= m_syncIntervalUs)
+         {
+            Sync();
+         }
+      }
+
+      void Close()
+      {
+         if(m_fd >= 0) { ::close(m_fd); m_fd = -1; }
+         if(m_cpFd >= 0) { ::close(m_cpFd); m_cpFd = -1; }
+      }
+
+   private:
+      std::string const m_rootDir;
+      std::string const m_queueId;
+      size_t const m_segmentSize;
+      size_t const m_syncItems;
+      boost::uint64_t const m_syncIntervalUs;
+
+      queueT<item> m_queue;
+      serializerT m_serializer;
+
+      std::deque<boost::uint64_t> m_segments;  // live segments, oldest first
+      std::vector<std::string> m_spares;
+
+      int m_fd;                                // the last segment
+      int m_cpFd;
+      boost::uint64_t m_writeOffset;
+
+      boost::uint64_t m_cursorSeg;
+      boost::uint64_t m_cursorOff;
+      bool m_cursorDirty;
+
+      size_t m_unsynced;
+      boost::uint64_t m_lastSyncUs;
+
+      std::string m_record;
+      std::vector<char> m_readBuf;
+   };
+
+}}
+
+#endif // MOOST_TRANSACTION_LOG_QUEUE_HPP__
@@ -29,6 +29,10 @@
 #define MOOST_TRANSACTION_QUEUE_HPP__
 
 // A collection of queue types for use with moost/transaction/handler.hpp
+//
+// The persisted queues here write a file per item, which gets slow with many
+// queued items. LogPersistedTQ in moost/transaction/log_queue.hpp keeps all
+// items in a few append-only log files instead.
 
 #include <fstream>
 #include <sstream>
@@ -67,6 +67,9 @@ bm.output(std::cout);
  * This will provide you with histograms for each result type as
  * well as a combined histogram and statistical analysis of the
  * distribution of request times.
+ *
+ * Requests are timed with the monotonic clock. If you want to time a few
+ * lines of code rather than requests, have a look at micro_benchmark.hpp.
  */
 
 #include <iostream>
@@ -75,10 +78,11 @@ bm.output(std::cout);
 #include <map>
 
 #include <boost/thread.hpp>
-#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/cstdint.hpp>
 
 #include "foreach.hpp"
 #include "histogram.hpp"
+#include "benchmark_clock.hpp"
 
 namespace moost { namespace utils {
 
@@ -112,15 +116,14 @@ public:
       void restart()
       {
          m_running = true;
-         m_start = boost::posix_time::microsec_clock::universal_time();
+         m_start = monotonic_clock::now_ns();
       }
 
       void stop(const std::string& result = "success")
       {
          if (m_running)
          {
-            boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
-            float seconds = 1e-6*(now - m_start).total_microseconds();
+            float seconds = 1e-9*(monotonic_clock::now_ns() - m_start);
             m_bm.add_timing(result, seconds);
             m_running = false;
          }
@@ -129,7 +132,7 @@ public:
    private:
       benchmark& m_bm;
       bool m_running;
-      boost::posix_time::ptime m_start;
+      boost::uint64_t m_start;
       const std::string m_default_result;
    };
 
@@ -0,0 +1,254 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_UTILS_BENCHMARK_CLOCK_HPP__
+#define MOOST_UTILS_BENCHMARK_CLOCK_HPP__
+
+/**
+ * \file benchmark_clock.hpp
+ *
+ * Clocks for timing code. Unlike the wall clock used by stopwatch, these
+ * never jump when the system time is adjusted.
+ *
+ * monotonic_clock is clock_gettime(CLOCK_MONOTONIC) in nanoseconds. It's
+ * the right choice almost always.
+ *
+ * tsc_clock reads the CPU's time stamp counter, which is cheaper and
+ * finer grained still, and converts ticks to nanoseconds using a rate
+ * calibrated once against the monotonic clock. It is only trustworthy
+ * on CPUs with an invariant TSC ("constant_tsc" and "nonstop_tsc" in
+ * /proc/cpuinfo), which is what tsc_clock::reliable() checks for.
+ *
+ * benchmark_clock picks one of the two at runtime:
+
+\code
+moost::utils::benchmark_clock clock(moost::utils::benchmark_clock::parse("tsc"));
+boost::uint64_t t0 = clock.ticks();
+do_something();
+double ns = clock.elapsed_ns(t0, clock.ticks());
+\endcode
+ */
+
+#include <ctime>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include <boost/cstdint.hpp>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define MOOST_UTILS_BENCHMARK_CLOCK_HAVE_TSC 1
+#endif
+
+namespace moost { namespace utils {
+
+struct monotonic_clock
+{
+   /// nanoseconds from an arbitrary but fixed point in time
+   static boost::uint64_t now_ns()
+   {
+      timespec ts;
+      ::clock_gettime(CLOCK_MONOTONIC, &ts);
+      return static_cast<boost::uint64_t>(ts.tv_sec)*1000000000 + ts.tv_nsec;
+   }
+
+   static boost::uint64_t now_us()
+   {
+      return now_ns()/1000;
+   }
+};
+
+class tsc_clock
+{
+public:
+   static bool available()
+   {
+#ifdef MOOST_UTILS_BENCHMARK_CLOCK_HAVE_TSC
+      return true;
+#else
+      return false;
+#endif
+   }
+
+   /// true if the CPU advertises a TSC that ticks at a constant rate in all power states
+   static bool reliable()
+   {
+      if (!available())
+      {
+         return false;
+      }
+
+      std::ifstream cpuinfo("/proc/cpuinfo");
+      std::string line;
+
+      while (std::getline(cpuinfo, line))
+      {
+         if (line.compare(0, 5, "flags") == 0)
+         {
+            line += ' ';
+            return line.find(" constant_tsc ") != std::string::npos &&
+                   line.find(" nonstop_tsc ") != std::string::npos;
+         }
+      }
+
+      return false;
+   }
+
+   static boost::uint64_t ticks()
+   {
+#ifdef MOOST_UTILS_BENCHMARK_CLOCK_HAVE_TSC
+      boost::uint32_t lo, hi;
+      __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+      return (static_cast<boost::uint64_t>(hi) << 32) | lo;
+#else
+      throw std::runtime_error("no time stamp counter on this platform");
+#endif
+   }
+
+   /// nanoseconds per tick, measured against the monotonic clock on first use
+   static double ns_per_tick()
+   {
+      static const double rate = calibrate();
+      return rate;
+   }
+
+private:
+   // reads the tick counter between two monotonic clock reads; the tick
+   // count belongs to the middle of the two, and the width of the bracket
+   // says how far off that may be (wide if we were preempted in between)
+   static boost::uint64_t bracketed_ticks(boost::uint64_t& ns, boost::uint64_t& width)
+   {
+      boost::uint64_t ns0 = monotonic_clock::now_ns();
+      boost::uint64_t t = ticks();
+      boost::uint64_t ns1 = monotonic_clock::now_ns();
+      ns = ns0 + (ns1 - ns0)/2;
+      width = ns1 - ns0;
+      return t;
+   }
+
+   static double calibrate()
+   {
+      // brackets wider than this are taken to have been preempted
+      const boost::uint64_t max_width = 5000;
+      std::vector<double> rates;
+
+      // a run preempted during a tick read is thrown away rather than
+      // skewing the rate; preemption anywhere else doesn't matter, as both
+      // clocks keep running. The median of the rest is used, so a single
+      // odd run can't pull the result either way.
+      for (int run = 0; run < 20 && rates.size() < 5; ++run)
+      {
+         boost::uint64_t ns0, ns1, w0, w1;
+         boost::uint64_t t0 = bracketed_ticks(ns0, w0);
+
+         while (monotonic_clock::now_ns() - ns0 < 10000000)
+         {
+         }
+
+         boost::uint64_t t1 = bracketed_ticks(ns1, w1);
+
+         if (w0 <= max_width && w1 <= max_width && t1 > t0)
+         {
+            rates.push_back(static_cast<double>(ns1 - ns0)/(t1 - t0));
+         }
+      }
+
+      if (rates.empty())
+      {
+         throw std::runtime_error("unable to calibrate tsc clock");
+      }
+
+      std::sort(rates.begin(), rates.end());
+
+      return rates[rates.size()/2];
+   }
+};
+
+class benchmark_clock
+{
+public:
+   enum type
+   {
+      monotonic,
+      tsc
+   };
+
+   explicit benchmark_clock(type t = monotonic)
+      : m_type(t)
+      , m_ns_per_tick(1.0)
+   {
+      if (m_type == tsc)
+      {
+         if (!tsc_clock::available())
+         {
+            throw std::runtime_error("tsc clock is not available on this platform");
+         }
+
+         m_ns_per_tick = tsc_clock::ns_per_tick();
+      }
+   }
+
+   static type parse(const std::string& name)
+   {
+      if (name == "monotonic")
+      {
+         return monotonic;
+      }
+
+      if (name == "tsc")
+      {
+         return tsc;
+      }
+
+      throw std::runtime_error("unknown clock: " + name);
+   }
+
+   const char *name() const
+   {
+      return m_type == tsc ? "tsc" : "monotonic";
+   }
+
+   boost::uint64_t ticks() const
+   {
+      return m_type == tsc ? tsc_clock::ticks() : monotonic_clock::now_ns();
+   }
+
+   double elapsed_ns(boost::uint64_t start, boost::uint64_t end) const
+   {
+      return m_ns_per_tick*(end - start);
+   }
+
+private:
+   type m_type;
+   double m_ns_per_tick;
+};
+
+}}
+
+#endif
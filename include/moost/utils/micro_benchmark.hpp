@@ -0,0 +1,579 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_UTILS_MICRO_BENCHMARK_HPP__
+#define MOOST_UTILS_MICRO_BENCHMARK_HPP__
+
+/**
+ * \file micro_benchmark.hpp
+ *
+ * A harness for repeatable micro benchmarks. Where utils::benchmark is
+ * meant for timing requests against a service, this is meant for timing
+ * a few lines of code that run in nanoseconds to microseconds.
+ *
+ * Benchmarks are grouped in suites. A suite is registered with a setup
+ * function that builds whatever the cases need (a populated container,
+ * a dataset on disk) and adds the cases, each being a function that runs
+ * the code under test a given number of times. Setup only happens if the
+ * suite is selected, and everything it built is released after the suite
+ * has run.
+
+\code
+void setup_lru(moost::utils::micro_benchmark::suite& s)
+{
+   boost::shared_ptr<lru_type> cache(new lru_type(1000));
+   fill(*cache);
+   s.add("get", boost::bind(&lru_get, cache, _1));
+}
+
+moost::utils::micro_benchmark mb;
+mb.add_suite("lru", &setup_lru);
+mb.run(std::vector<std::string>(), "", results);
+moost::utils::micro_benchmark::write_table(std::cout, results);
+\endcode
+
+ * For each case, the number of iterations per sample is doubled until a
+ * single sample takes at least min_sample_ms, which also warms up caches,
+ * branch predictors and the CPU clock. The case then keeps running until
+ * warmup_ms have passed before the samples are taken. Samples further than
+ * outlier_sigma robust standard deviations (1.4826 times the median absolute
+ * deviation) from the median are discarded, as they are almost always the
+ * result of preemption or page faults. The mean of the remaining samples
+ * is reported with a 95% confidence interval from Student's t distribution.
+ *
+ * Cases must make sure the compiler can't throw away the work being timed,
+ * do_not_optimize() is the easiest way to do that.
+ */
+
+#include <cmath>
+#include <vector>
+#include <string>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "benchmark.hpp"
+#include "benchmark_clock.hpp"
+
+namespace moost { namespace utils {
+
+/**
+ * Pretend to read value so that the computation producing it can't be
+ * optimised away
+ */
+template <typename T>
+inline void do_not_optimize(const T& value)
+{
+   __asm__ __volatile__ ("" : : "r" (&value) : "memory");
+}
+
+struct micro_benchmark_options
+{
+   micro_benchmark_options()
+      : clock(benchmark_clock::monotonic)
+      , warmup_ms(100.0)
+      , min_sample_ms(10.0)
+      , samples(20)
+      , max_iterations(boost::uint64_t(1) << 32)
+      , outlier_sigma(3.0)
+   {
+   }
+
+   benchmark_clock::type clock;
+   double warmup_ms;
+   double min_sample_ms;
+   size_t samples;
+   boost::uint64_t max_iterations;
+   double outlier_sigma;
+};
+
+struct micro_benchmark_result
+{
+   micro_benchmark_result()
+      : iterations(0)
+      , samples(0)
+      , outliers(0)
+      , mean_ns(0.0)
+      , median_ns(0.0)
+      , min_ns(0.0)
+      , max_ns(0.0)
+      , stddev_ns(0.0)
+      , ci_low_ns(0.0)
+      , ci_high_ns(0.0)
+   {
+   }
+
+   double ops_per_sec() const
+   {
+      return mean_ns > 0.0 ? 1e9/mean_ns : 0.0;
+   }
+
+   std::string suite;
+   std::string name;
+   boost::uint64_t iterations;   // per sample
+   size_t samples;               // samples taken, including outliers
+   size_t outliers;
+   double mean_ns;               // all timings are per iteration
+   double median_ns;
+   double min_ns;
+   double max_ns;
+   double stddev_ns;
+   double ci_low_ns;             // 95% confidence interval of the mean
+   double ci_high_ns;
+};
+
+/**
+ * The statistics behind micro_benchmark, separate so they can be tested
+ */
+struct micro_benchmark_stats
+{
+   static double median(std::vector<double> v)
+   {
+      if (v.empty())
+      {
+         return 0.0;
+      }
+
+      size_t mid = v.size()/2;
+      std::nth_element(v.begin(), v.begin() + mid, v.end());
+      double m = v[mid];
+
+      if (v.size() % 2 == 0)
+      {
+         m = (m + *std::max_element(v.begin(), v.begin() + mid))/2.0;
+      }
+
+      return m;
+   }
+
+   /// two-sided 95% critical value of Student's t distribution
+   static double t_critical_95(size_t dof)
+   {
+      static const double table[] = {
+         0.0,
+         12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+          2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+          2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+      };
+
+      if (dof < sizeof(table)/sizeof(table[0]))
+      {
+         return table[dof];
+      }
+
+      // conservative between the tabulated values
+      return dof < 40 ? 2.042 : dof < 60 ? 2.021 : dof < 120 ? 2.000 : dof < 1000 ? 1.980 : 1.960;
+   }
+
+   /**
+    * Remove outliers from samples and fill in the statistics of the rest
+    */
+   static void summarise(std::vector<double>& samples, double outlier_sigma, micro_benchmark_result& r)
+   {
+      r.samples = samples.size();
+      r.outliers = 0;
+
+      if (samples.empty())
+      {
+         return;
+      }
+
+      double med = median(samples);
+      std::vector<double> dev;
+      dev.reserve(samples.size());
+
+      for (size_t i = 0; i < samples.size(); ++i)
+      {
+         dev.push_back(std::fabs(samples[i] - med));
+      }
+
+      double limit = outlier_sigma*1.4826*median(dev);
+
+      if (limit > 0.0)
+      {
+         size_t kept = 0;
+
+         for (size_t i = 0; i < samples.size(); ++i)
+         {
+            if (dev[i] <= limit)
+            {
+               samples[kept++] = samples[i];
+            }
+         }
+
+         r.outliers = samples.size() - kept;
+         samples.resize(kept);
+      }
+
+      size_t n = samples.size();
+      double sum = 0.0;
+
+      for (size_t i = 0; i < n; ++i)
+      {
+         sum += samples[i];
+      }
+
+      r.mean_ns = sum/n;
+      r.median_ns = median(samples);
+      r.min_ns = *std::min_element(samples.begin(), samples.end());
+      r.max_ns = *std::max_element(samples.begin(), samples.end());
+
+      double sq = 0.0;
+
+      for (size_t i = 0; i < n; ++i)
+      {
+         sq += (samples[i] - r.mean_ns)*(samples[i] - r.mean_ns);
+      }
+
+      r.stddev_ns = n > 1 ? std::sqrt(sq/(n - 1)) : 0.0;
+
+      double half = n > 1 ? t_critical_95(n - 1)*r.stddev_ns/std::sqrt(static_cast<double>(n)) : 0.0;
+      r.ci_low_ns = r.mean_ns - half;
+      r.ci_high_ns = r.mean_ns + half;
+   }
+};
+
+class micro_benchmark : public boost::noncopyable
+{
+public:
+   typedef micro_benchmark_options options;
+   typedef micro_benchmark_result result;
+
+   /// runs the code under test the given number of times
+   typedef boost::function<void (boost::uint64_t)> case_t;
+
+   class suite
+   {
+   public:
+      void add(const std::string& name, case_t fn)
+      {
+         m_cases.push_back(std::make_pair(name, fn));
+      }
+
+   private:
+      friend class micro_benchmark;
+
+      std::vector< std::pair<std::string, case_t> > m_cases;
+   };
+
+   typedef boost::function<void (suite&)> setup_t;
+
+   explicit micro_benchmark(const options& opt = options())
+      : m_opt(opt)
+      , m_clock(opt.clock)
+   {
+   }
+
+   const options& get_options() const
+   {
+      return m_opt;
+   }
+
+   const benchmark_clock& clock() const
+   {
+      return m_clock;
+   }
+
+   void add_suite(const std::string& name, setup_t setup)
+   {
+      m_suites.push_back(std::make_pair(name, setup));
+   }
+
+   void suites(std::vector<std::string>& names) const
+   {
+      names.clear();
+
+      for (size_t i = 0; i < m_suites.size(); ++i)
+      {
+         names.push_back(m_suites[i].first);
+      }
+   }
+
+   /**
+    * Run benchmarks
+    *
+    * @param only
+    *    names of the suites to run, or empty to run all suites
+    *
+    * @param filter
+    *    only run cases with "<suite>/<case>" containing this string
+    *
+    * @param results
+    *    results are appended here
+    *
+    * @param log
+    *    progress and errors are written here if not null
+    *
+    * @param timings
+    *    every sample that isn't an outlier is added to this benchmark
+    *    as a timing named "<suite>/<case>" if not null
+    *
+    * @return
+    *    the number of suites or cases that failed
+    */
+   size_t run(const std::vector<std::string>& only, const std::string& filter,
+              std::vector<result>& results, std::ostream *log = 0, benchmark *timings = 0) const
+   {
+      size_t failed = 0;
+
+      for (size_t s = 0; s < m_suites.size(); ++s)
+      {
+         const std::string& suite_name = m_suites[s].first;
+
+         if (!only.empty() && std::find(only.begin(), only.end(), suite_name) == only.end())
+         {
+            continue;
+         }
+
+         suite cases;
+
+         try
+         {
+            m_suites[s].second(cases);
+         }
+         catch (const std::exception& e)
+         {
+            if (log)
+            {
+               *log << suite_name << ": setup failed: " << e.what() << std::endl;
+            }
+
+            ++failed;
+            continue;
+         }
+
+         for (size_t c = 0; c < cases.m_cases.size(); ++c)
+         {
+            std::string full_name = suite_name + "/" + cases.m_cases[c].first;
+
+            if (full_name.find(filter) == std::string::npos)
+            {
+               continue;
+            }
+
+            result r;
+            r.suite = suite_name;
+            r.name = cases.m_cases[c].first;
+            std::vector<double> samples;
+
+            try
+            {
+               if (log)
+               {
+                  *log << full_name << "..." << std::flush;
+               }
+
+               measure(cases.m_cases[c].second, r, samples);
+
+               if (log)
+               {
+                  *log << " " << r.iterations << " x " << r.samples << std::endl;
+               }
+            }
+            catch (const std::exception& e)
+            {
+               if (log)
+               {
+                  *log << " failed: " << e.what() << std::endl;
+               }
+
+               ++failed;
+               continue;
+            }
+
+            if (timings)
+            {
+               for (size_t i = 0; i < samples.size(); ++i)
+               {
+                  timings->add_timing(full_name, static_cast<float>(1e-9*samples[i]));
+               }
+            }
+
+            results.push_back(r);
+         }
+      }
+
+      return failed;
+   }
+
+   /**
+    * Measure a single case
+    *
+    * @param samples
+    *    receives the per iteration time in nanoseconds of each sample that
+    *    isn't an outlier
+    */
+   void measure(const case_t& fn, result& r, std::vector<double>& samples) const
+   {
+      const double min_sample_ns = 1e6*m_opt.min_sample_ms;
+      boost::uint64_t start = monotonic_clock::now_ns();
+      boost::uint64_t iterations = 1;
+
+      for (;;)
+      {
+         double ns = time(fn, iterations);
+
+         if (ns >= min_sample_ns || iterations >= m_opt.max_iterations)
+         {
+            break;
+         }
+
+         // aim a little beyond the minimum, but grow by no more than 10x at a
+         // time in case the first few iterations were unusually slow
+         double grow = ns > 0.0 ? 1.2*min_sample_ns/ns : 10.0;
+         grow = std::max(2.0, std::min(10.0, grow));
+         iterations = std::min(m_opt.max_iterations, static_cast<boost::uint64_t>(std::ceil(iterations*grow)));
+      }
+
+      while (monotonic_clock::now_ns() - start < 1e6*m_opt.warmup_ms)
+      {
+         time(fn, iterations);
+      }
+
+      samples.clear();
+      samples.reserve(m_opt.samples);
+
+      for (size_t i = 0; i < m_opt.samples; ++i)
+      {
+         samples.push_back(time(fn, iterations)/iterations);
+      }
+
+      r.iterations = iterations;
+      micro_benchmark_stats::summarise(samples, m_opt.outlier_sigma, r);
+   }
+
+   static void write_table(std::ostream& os, const std::vector<result>& results)
+   {
+      std::ios::fmtflags flags = os.flags();
+
+      os << std::left << std::setw(40) << "benchmark" << std::right
+         << std::setw(12) << "iterations"
+         << std::setw(9) << "samples"
+         << std::setw(14) << "mean ns"
+         << std::setw(10) << "+/- 95%"
+         << std::setw(14) << "median ns"
+         << std::setw(14) << "min ns"
+         << std::setw(16) << "ops/s"
+         << std::endl;
+
+      for (size_t i = 0; i < results.size(); ++i)
+      {
+         const result& r = results[i];
+         double rel = r.mean_ns > 0.0 ? 100.0*(r.ci_high_ns - r.mean_ns)/r.mean_ns : 0.0;
+
+         os << std::left << std::setw(40) << (r.suite + "/" + r.name) << std::right << std::fixed
+            << std::setw(12) << r.iterations
+            << std::setw(9) << (r.samples - r.outliers)
+            << std::setw(14) << std::setprecision(2) << r.mean_ns
+            << std::setw(9) << std::setprecision(1) << rel << "%"
+            << std::setw(14) << std::setprecision(2) << r.median_ns
+            << std::setw(14) << r.min_ns
+            << std::setw(16) << std::setprecision(0) << r.ops_per_sec()
+            << std::endl;
+      }
+
+      os.flags(flags);
+   }
+
+   void write_json(std::ostream& os, const std::vector<result>& results) const
+   {
+      std::ios::fmtflags flags = os.flags();
+      std::streamsize precision = os.precision();
+
+      os << std::setprecision(6) << std::fixed
+         << "{\"clock\":\"" << m_clock.name() << "\""
+         << ",\"warmup_ms\":" << m_opt.warmup_ms
+         << ",\"min_sample_ms\":" << m_opt.min_sample_ms
+         << ",\"outlier_sigma\":" << m_opt.outlier_sigma
+         << ",\"confidence\":0.95"
+         << ",\"results\":[";
+
+      for (size_t i = 0; i < results.size(); ++i)
+      {
+         const result& r = results[i];
+
+         os << (i ? ",{" : "{")
+            << "\"suite\":\"" << json_escape(r.suite) << "\""
+            << ",\"name\":\"" << json_escape(r.name) << "\""
+            << ",\"iterations\":" << r.iterations
+            << ",\"samples\":" << r.samples
+            << ",\"outliers\":" << r.outliers
+            << ",\"mean_ns\":" << r.mean_ns
+            << ",\"median_ns\":" << r.median_ns
+            << ",\"min_ns\":" << r.min_ns
+            << ",\"max_ns\":" << r.max_ns
+            << ",\"stddev_ns\":" << r.stddev_ns
+            << ",\"ci_low_ns\":" << r.ci_low_ns
+            << ",\"ci_high_ns\":" << r.ci_high_ns
+            << ",\"ops_per_sec\":" << r.ops_per_sec()
+            << "}";
+      }
+
+      os << "]}" << std::endl;
+
+      os.flags(flags);
+      os.precision(precision);
+   }
+
+private:
+   double time(const case_t& fn, boost::uint64_t iterations) const
+   {
+      boost::uint64_t t0 = m_clock.ticks();
+      fn(iterations);
+      return m_clock.elapsed_ns(t0, m_clock.ticks());
+   }
+
+   static std::string json_escape(const std::string& s)
+   {
+      std::string rv;
+
+      for (size_t i = 0; i < s.size(); ++i)
+      {
+         if (s[i] == '"' || s[i] == '\\')
+         {
+            rv += '\\';
+         }
+
+         rv += s[i] < 0x20 && s[i] >= 0 ? ' ' : s[i];
+      }
+
+      return rv;
+   }
+
+   const options m_opt;
+   const benchmark_clock m_clock;
+   std::vector< std::pair<std::string, setup_t> > m_suites;
+};
+
+}}
+
+#endif
@@ -0,0 +1,657 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_UTILS_PERF_PROFILER_HPP__
+#define MOOST_UTILS_PERF_PROFILER_HPP__
+
+/**
+ * \file perf_profiler.hpp
+ *
+ * Attributes hardware performance counters to named scopes, so that you
+ * can tell whether a slow piece of code is slow because of cache misses,
+ * TLB misses, page faults or being scheduled out, without having to run
+ * perf on a production box.
+
+\code
+moost::utils::perf_profiler prof;
+
+void lookup(...)
+{
+   moost::utils::perf_profiler::scope s(prof, "mmd.lookup");
+   ...
+}
+
+prof.write_text(std::cout);
+\endcode
+
+ * Each thread opens its own set of counters with perf_event_open() the
+ * first time it enters a scope: cycles, instructions, last level cache
+ * misses and dTLB misses (user space only), plus page faults and context
+ * switches. Whatever can't be opened (no PMU in a VM, perf_event_paranoid
+ * set too high, not Linux) is simply not reported, and if nothing can be
+ * opened the profiler falls back to wall clock time. Entering and leaving
+ * a scope costs one read() of the counter group each, so don't use this
+ * for scopes that only take a few nanoseconds.
+ *
+ * Nested scopes are inclusive, i.e. the outer scope includes everything
+ * counted in the inner one.
+ *
+ * Every thread accumulates into its own slots, which only that thread ever
+ * writes, so there's no locking once a thread has seen a scope name for the
+ * first time. snapshot() and write_text() add up the slots of all threads,
+ * including the ones that have already finished.
+ *
+ * If you pass a multi_timer to the constructor, each scope is also timed
+ * into the multi_timer entry of the same name, so the scopes show up in
+ * whatever already reports on that multi_timer. Each thread looks the timer
+ * up once, but a timer takes its own mutex to record a time, so that does
+ * cost a lock on every exit from a scope. Only times go to the multi_timer;
+ * update_metrics() publishes the per call counter averages as gauges in
+ * moost::metrics, for whatever reports on those.
+ */
+
+#include <map>
+#include <vector>
+#include <string>
+#include <limits>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#ifdef __linux__
+# include <cstring>
+# include <unistd.h>
+# include <sys/syscall.h>
+# include <linux/perf_event.h>
+# define MOOST_UTILS_PERF_PROFILER_HAVE_PERF_EVENTS 1
+#endif
+
+#include "benchmark_clock.hpp"
+#include "../timer.h"
+#include "../metrics/registry.hpp"
+
+namespace moost { namespace utils {
+
+struct perf_counters
+{
+   enum event
+   {
+      cycles,
+      instructions,
+      llc_misses,
+      dtlb_misses,
+      page_faults,
+      context_switches,
+      num_events
+   };
+
+   static const char *name(size_t e)
+   {
+      static const char *names[num_events] = {
+         "cycles", "instructions", "llc_misses", "dtlb_misses", "page_faults", "context_switches"
+      };
+
+      return e < num_events ? names[e] : "unknown";
+   }
+};
+
+/**
+ * The performance counters of the calling thread
+ *
+ * The counters are opened as a single group, so they're all read with one
+ * system call and count exactly the same instructions.
+ */
+class perf_event_group : public boost::noncopyable
+{
+public:
+   explicit perf_event_group(bool enable = true)
+      : m_leader(-1)
+      , m_open(0)
+   {
+      for (size_t e = 0; e < perf_counters::num_events; ++e)
+      {
+         m_pos[e] = -1;
+         m_fd[e] = -1;
+      }
+
+#ifdef MOOST_UTILS_PERF_PROFILER_HAVE_PERF_EVENTS
+      if (enable)
+      {
+         // hardware events first, so one of them leads the group if possible
+         open_event(perf_counters::cycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+         open_event(perf_counters::instructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+         open_event(perf_counters::llc_misses, PERF_TYPE_HW_CACHE,
+                    PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+         open_event(perf_counters::dtlb_misses, PERF_TYPE_HW_CACHE,
+                    PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+         open_event(perf_counters::page_faults, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+         open_event(perf_counters::context_switches, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+      }
+#endif
+   }
+
+   ~perf_event_group()
+   {
+#ifdef MOOST_UTILS_PERF_PROFILER_HAVE_PERF_EVENTS
+      for (size_t i = 0; i < m_open; ++i)
+      {
+         ::close(m_fd[i]);
+      }
+#endif
+   }
+
+   bool available(size_t e) const
+   {
+      return e < perf_counters::num_events && m_pos[e] >= 0;
+   }
+
+   bool any() const
+   {
+      return m_leader >= 0;
+   }
+
+   /**
+    * Read the current counter values
+    *
+    * Counters that aren't available read as zero. If the kernel had to
+    * multiplex the counters, the values are scaled to the full time the
+    * group was enabled.
+    */
+   bool read(boost::uint64_t (&values)[perf_counters::num_events]) const
+   {
+#ifdef MOOST_UTILS_PERF_PROFILER_HAVE_PERF_EVENTS
+      if (m_leader >= 0)
+      {
+         // nr, time_enabled, time_running, values
+         boost::uint64_t buf[3 + perf_counters::num_events];
+         ssize_t rv = ::read(m_leader, buf, sizeof(buf));
+
+         if (rv >= static_cast<ssize_t>((3 + m_open)*sizeof(buf[0])))
+         {
+            double scale = buf[2] > 0 && buf[2] < buf[1] ? static_cast<double>(buf[1])/buf[2] : 1.0;
+
+            for (size_t e = 0; e < perf_counters::num_events; ++e)
+            {
+               values[e] = m_pos[e] >= 0 ? static_cast<boost::uint64_t>(scale*buf[3 + m_pos[e]]) : 0;
+            }
+
+            return true;
+         }
+      }
+#endif
+
+      return false;
+   }
+
+private:
+#ifdef MOOST_UTILS_PERF_PROFILER_HAVE_PERF_EVENTS
+   void open_event(size_t e, boost::uint32_t type, boost::uint64_t config)
+   {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = type;
+      attr.config = config;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      attr.exclude_hv = 1;
+
+      // context switches and page faults happen in the kernel, so try to
+      // count kernel events for those; perf_event_paranoid may not allow it
+      attr.exclude_kernel = type == PERF_TYPE_SOFTWARE ? 0 : 1;
+
+      int fd = ::syscall(__NR_perf_event_open, &attr, 0, -1, m_leader, 0);
+
+      if (fd < 0 && !attr.exclude_kernel)
+      {
+         attr.exclude_kernel = 1;
+         fd = ::syscall(__NR_perf_event_open, &attr, 0, -1, m_leader, 0);
+      }
+
+      if (fd >= 0)
+      {
+         if (m_leader < 0)
+         {
+            m_leader = fd;
+         }
+
+         m_pos[e] = static_cast<int>(m_open);
+         m_fd[m_open++] = fd;
+      }
+   }
+#endif
+
+   int m_leader;
+   size_t m_open;
+   int m_pos[perf_counters::num_events];   // position of each event in the group
+   int m_fd[perf_counters::num_events];
+};
+
+/**
+ * Totals of one scope
+ */
+struct perf_scope_stats
+{
+   perf_scope_stats()
+      : count(0)
+      , wall_ns(0)
+      , measured(0)
+   {
+      for (size_t e = 0; e < perf_counters::num_events; ++e)
+      {
+         value[e] = 0;
+         available[e] = false;
+      }
+   }
+
+   /// average wall time in microseconds
+   double wall_us() const
+   {
+      return count > 0 ? wall_ns/(1e3*count) : 0.0;
+   }
+
+   /// average counter value per call, over the calls that had counters
+   double per_call(size_t e) const
+   {
+      return measured > 0 ? static_cast<double>(value[e])/measured : 0.0;
+   }
+
+   boost::uint64_t count;        // times the scope was left
+   boost::uint64_t wall_ns;
+   boost::uint64_t measured;     // times the scope was left with counters available
+   boost::uint64_t value[perf_counters::num_events];
+   bool available[perf_counters::num_events];   // in any of the threads
+};
+
+class perf_profiler : public boost::noncopyable
+{
+private:
+   /// totals of a scope in a single thread, only ever written by that thread
+   struct slot
+   {
+      slot()
+      {
+         count = 0;
+         wall_ns = 0;
+         measured = 0;
+
+         for (size_t e = 0; e < perf_counters::num_events; ++e)
+         {
+            value[e] = 0;
+         }
+      }
+
+      boost::atomic<boost::uint64_t> count;
+      boost::atomic<boost::uint64_t> wall_ns;
+      boost::atomic<boost::uint64_t> measured;
+      boost::atomic<boost::uint64_t> value[perf_counters::num_events];
+   };
+
+   struct thread_state
+   {
+      explicit thread_state(size_t max_scopes)
+         : slots(new slot[max_scopes])
+         , timers(new timer *[max_scopes])
+      {
+         for (size_t e = 0; e < perf_counters::num_events; ++e)
+         {
+            available[e] = false;
+         }
+
+         std::fill(timers.get(), timers.get() + max_scopes, static_cast<timer *>(0));
+      }
+
+      boost::scoped_array<slot> slots;
+      boost::scoped_array<timer *> timers;   // cache of multi_timer entries
+      bool available[perf_counters::num_events];
+      std::map<std::string, size_t> ids;   // cache of scope ids
+   };
+
+   /// owned by the thread, so the counters are closed when it exits
+   struct thread_handle
+   {
+      thread_handle(boost::shared_ptr<thread_state> s, bool use_counters)
+         : state(s)
+         , counters(use_counters)
+      {
+         for (size_t e = 0; e < perf_counters::num_events; ++e)
+         {
+            state->available[e] = counters.available(e);
+         }
+      }
+
+      boost::shared_ptr<thread_state> state;
+      perf_event_group counters;
+   };
+
+   static void add(boost::atomic<boost::uint64_t>& total, boost::uint64_t value)
+   {
+      // there's only one writer, so there's no need for an atomic add
+      total.store(total.load(boost::memory_order_relaxed) + value, boost::memory_order_relaxed);
+   }
+
+public:
+   class scope : public boost::noncopyable
+   {
+   public:
+      scope(perf_profiler& prof, const std::string& name)
+         : m_thread(prof.this_thread())
+         , m_id(prof.scope_id(m_thread, name))
+         , m_slot(m_thread.state->slots[m_id])
+         , m_timer(prof.scope_timer(m_thread, m_id, name))
+         , m_stopped(false)
+      {
+         if (m_timer)
+         {
+            m_time = boost::posix_time::microsec_clock::local_time();
+         }
+
+         m_have_counters = m_thread.counters.read(m_start);
+         m_start_ns = monotonic_clock::now_ns();
+      }
+
+      ~scope()
+      {
+         stop();
+      }
+
+      void stop()
+      {
+         if (m_stopped)
+         {
+            return;
+         }
+
+         boost::uint64_t end_ns = monotonic_clock::now_ns();
+         boost::uint64_t end[perf_counters::num_events];
+
+         if (m_have_counters && m_thread.counters.read(end))
+         {
+            for (size_t e = 0; e < perf_counters::num_events; ++e)
+            {
+               // multiplexing scale factors can make scaled values go backwards
+               add(m_slot.value[e], end[e] > m_start[e] ? end[e] - m_start[e] : 0);
+            }
+
+            add(m_slot.measured, 1);
+         }
+
+         add(m_slot.wall_ns, end_ns - m_start_ns);
+         add(m_slot.count, 1);
+
+         if (m_timer)
+         {
+            m_timer->time(m_time);
+         }
+
+         m_stopped = true;
+      }
+
+   private:
+      thread_handle& m_thread;
+      const size_t m_id;
+      slot& m_slot;
+      timer *m_timer;
+      bool m_stopped;
+      bool m_have_counters;
+      boost::uint64_t m_start_ns;
+      boost::uint64_t m_start[perf_counters::num_events];
+      boost::posix_time::ptime m_time;
+   };
+
+   /**
+    * Create a profiler
+    *
+    * @param use_counters
+    *    if false, only wall clock time is measured
+    *
+    * @param max_scopes
+    *    the number of distinct scope names that can be used; each thread
+    *    allocates space for this many scopes
+    *
+    * @param timers
+    *    if not null, scopes are also timed into this multi_timer
+    */
+   explicit perf_profiler(bool use_counters = true, size_t max_scopes = 256, multi_timer *timers = 0)
+      : m_use_counters(use_counters)
+      , m_max_scopes(max_scopes)
+      , m_timers(timers)
+   {
+   }
+
+   /**
+    * Whether the calling thread measures the given counter
+    */
+   bool available(size_t e)
+   {
+      return this_thread().counters.available(e);
+   }
+
+   /**
+    * Add up the totals of all threads by scope name
+    */
+   void snapshot(std::map<std::string, perf_scope_stats>& stats) const
+   {
+      boost::mutex::scoped_lock lock(m_mutex);
+
+      stats.clear();
+
+      for (std::map<std::string, size_t>::const_iterator it = m_ids.begin(); it != m_ids.end(); ++it)
+      {
+         perf_scope_stats& s = stats[it->first];
+
+         for (size_t t = 0; t < m_threads.size(); ++t)
+         {
+            const thread_state& ts = *m_threads[t];
+            const slot& sl = ts.slots[it->second];
+
+            s.count += sl.count.load(boost::memory_order_relaxed);
+            s.wall_ns += sl.wall_ns.load(boost::memory_order_relaxed);
+            s.measured += sl.measured.load(boost::memory_order_relaxed);
+
+            for (size_t e = 0; e < perf_counters::num_events; ++e)
+            {
+               s.value[e] += sl.value[e].load(boost::memory_order_relaxed);
+               s.available[e] = s.available[e] || ts.available[e];
+            }
+         }
+      }
+   }
+
+   /**
+    * Publish the per call averages of all scopes as gauges
+    *
+    * Sets <prefix>.<scope>.calls and, for each counter measured by any
+    * thread, <prefix>.<scope>.<counter> to the average per call, rounded.
+    * Call this before reporting on moost::metrics.
+    */
+   void update_metrics(const std::string& prefix = "perf") const
+   {
+      std::map<std::string, perf_scope_stats> stats;
+      snapshot(stats);
+
+      for (std::map<std::string, perf_scope_stats>::const_iterator it = stats.begin(); it != stats.end(); ++it)
+      {
+         const perf_scope_stats& s = it->second;
+         const std::string name = metrics::make_name(prefix, it->first);
+
+         metrics::get_gauge(name + ".calls").set(static_cast<metrics::gauge::value_type>(s.count));
+
+         for (size_t e = 0; e < perf_counters::num_events; ++e)
+         {
+            if (s.available[e])
+            {
+               metrics::get_gauge(metrics::make_name(name, perf_counters::name(e)))
+                  .set(static_cast<metrics::gauge::value_type>(s.per_call(e) + 0.5));
+            }
+         }
+      }
+   }
+
+   /**
+    * Write a table of per call averages for all scopes
+    */
+   void write_text(std::ostream& os) const
+   {
+      std::map<std::string, perf_scope_stats> stats;
+      snapshot(stats);
+
+      std::ios::fmtflags flags = os.flags();
+      std::streamsize precision = os.precision();
+
+      os << std::left << std::setw(32) << "scope" << std::right
+         << std::setw(12) << "calls"
+         << std::setw(12) << "wall_us";
+
+      for (size_t e = 0; e < perf_counters::num_events; ++e)
+      {
+         os << std::setw(18) << perf_counters::name(e);
+      }
+
+      os << std::setw(8) << "ipc" << std::endl;
+
+      for (std::map<std::string, perf_scope_stats>::const_iterator it = stats.begin(); it != stats.end(); ++it)
+      {
+         const perf_scope_stats& s = it->second;
+
+         os << std::left << std::setw(32) << it->first << std::right << std::fixed << std::setprecision(2)
+            << std::setw(12) << s.count
+            << std::setw(12) << s.wall_us();
+
+         for (size_t e = 0; e < perf_counters::num_events; ++e)
+         {
+            if (s.available[e])
+            {
+               os << std::setw(18) << s.per_call(e);
+            }
+            else
+            {
+               os << std::setw(18) << "-";
+            }
+         }
+
+         if (s.available[perf_counters::cycles] && s.available[perf_counters::instructions] && s.value[perf_counters::cycles] > 0)
+         {
+            os << std::setw(8) << static_cast<double>(s.value[perf_counters::instructions])/s.value[perf_counters::cycles];
+         }
+         else
+         {
+            os << std::setw(8) << "-";
+         }
+
+         os << std::endl;
+      }
+
+      os.flags(flags);
+      os.precision(precision);
+   }
+
+private:
+   thread_handle& this_thread()
+   {
+      thread_handle *th = m_this_thread.get();
+
+      if (!th)
+      {
+         boost::shared_ptr<thread_state> state(new thread_state(m_max_scopes));
+         th = new thread_handle(state, m_use_counters);
+         m_this_thread.reset(th);
+
+         boost::mutex::scoped_lock lock(m_mutex);
+         m_threads.push_back(state);
+      }
+
+      return *th;
+   }
+
+   size_t scope_id(thread_handle& th, const std::string& name)
+   {
+      std::map<std::string, size_t>& cache = th.state->ids;
+      std::map<std::string, size_t>::const_iterator it = cache.find(name);
+
+      if (it != cache.end())
+      {
+         return it->second;
+      }
+
+      boost::mutex::scoped_lock lock(m_mutex);
+      std::map<std::string, size_t>::const_iterator id = m_ids.find(name);
+
+      if (id == m_ids.end())
+      {
+         if (m_ids.size() >= m_max_scopes)
+         {
+            throw std::runtime_error("too many perf_profiler scopes, cannot add " + name);
+         }
+
+         id = m_ids.insert(std::make_pair(name, m_ids.size())).first;
+      }
+
+      cache.insert(*id);
+
+      return id->second;
+   }
+
+   timer *scope_timer(thread_handle& th, size_t id, const std::string& name)
+   {
+      if (!m_timers)
+      {
+         return 0;
+      }
+
+      timer *& t = th.state->timers[id];
+
+      if (!t)
+      {
+         t = &(*m_timers)(name, (std::numeric_limits<int>::max)());
+      }
+
+      return t;
+   }
+
+   const bool m_use_counters;
+   const size_t m_max_scopes;
+   multi_timer * const m_timers;
+
+   mutable boost::mutex m_mutex;
+   std::map<std::string, size_t> m_ids;
+   std::vector< boost::shared_ptr<thread_state> > m_threads;
+   boost::thread_specific_ptr<thread_handle> m_this_thread;
+};
+
+}}
+
+#endif
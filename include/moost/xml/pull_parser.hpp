@@ -0,0 +1,477 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_XML_PULL_PARSER_HPP
+#define MOOST_XML_PULL_PARSER_HPP
+
+/**
+ * \file pull_parser.hpp
+ *
+ * A streaming (pull) xml parser. Instead of building a tree, the parser is
+ * asked for one event at a time, e.g. to parse:
+\verbatim
+<base>
+   <foo>10</foo>
+   <bar>20</bar>
+</base>\endverbatim
+\code
+moost::xml::file_pull_parser xml("somefile.xml");
+
+while (xml.next() != moost::xml::pull_parser::END_DOCUMENT)
+{
+   // will print
+   // foo: 10
+   // bar: 20
+   if (xml.event() == moost::xml::pull_parser::START_TAG && xml.depth() == 2)
+   {
+      std::string tag = xml.name().str();
+
+      if (xml.next() == moost::xml::pull_parser::TEXT)
+         cout << tag << ": " << xml.text() << endl;
+   }
+}
+\endcode
+ *
+ * Names, attributes and text are returned as string_refs pointing into the
+ * parsed buffer, so nothing is allocated or copied per element. The only
+ * memory used is a small stack of open tags. file_pull_parser parses a
+ * memory mapped file, so even large files are never read into memory.
+ *
+ * This parser understands the same subset of xml as simple_parser, plus a
+ * little more:
+ *
+ *   - leading whitespace is skipped for text, and whitespace-only text
+ *     is ignored
+ *   - comments, processing instructions (\<?xml ...?\>) and doctype
+ *     declarations are skipped
+ *   - \<foo/\> is reported as a start tag immediately followed by an end tag
+ *   - attributes are reported as a single, unparsed string
+ *   - CDATA sections are reported as text
+ *
+ * Entities are \b not decoded.
+ */
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace moost { namespace xml {
+
+/**
+ * A non-owning reference to a string in a buffer, as returned by pull_parser.
+ * It is only valid as long as the buffer it points into.
+ */
+class string_ref
+{
+public:
+   typedef const char *const_iterator;
+   typedef const char *iterator;
+
+   string_ref()
+      : m_begin(0), m_end(0)
+   {}
+
+   string_ref(const char *begin, const char *end)
+      : m_begin(begin), m_end(end)
+   {}
+
+   string_ref(const char *str)
+      : m_begin(str), m_end(str + std::strlen(str))
+   {}
+
+   string_ref(const std::string& str)
+      : m_begin(str.data()), m_end(str.data() + str.size())
+   {}
+
+   const_iterator begin() const { return m_begin; }
+   const_iterator end() const { return m_end; }
+   const char *data() const { return m_begin; }
+   size_t size() const { return m_end - m_begin; }
+   bool empty() const { return m_begin == m_end; }
+   char operator[](size_t i) const { return m_begin[i]; }
+
+   /**
+   * Returns a copy of the referenced string.
+   */
+   std::string str() const { return std::string(m_begin, m_end); }
+
+private:
+   const char *m_begin;
+   const char *m_end;
+};
+
+inline bool operator==(const string_ref& a, const string_ref& b)
+{
+   return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+inline bool operator!=(const string_ref& a, const string_ref& b)
+{
+   return !(a == b);
+}
+
+inline std::ostream& operator<<(std::ostream& os, const string_ref& s)
+{
+   return os.write(s.data(), s.size());
+}
+
+/**
+ *  A streaming xml parser working on a buffer in memory
+ */
+class pull_parser
+{
+public:
+   enum event_type
+   {
+      START_TAG,     //< name() and attributes() are valid
+      END_TAG,       //< name() is valid
+      TEXT,          //< text() is valid
+      END_DOCUMENT
+   };
+
+   pull_parser()
+   {
+      reset(0, 0);
+   }
+
+   /**
+   * Parses size bytes starting at data. The buffer must outlive the parser
+   * and any string_refs returned by it.
+   */
+   pull_parser(const char *data, size_t size)
+   {
+      reset(data, size);
+   }
+
+   /**
+   * Restarts parsing on a new buffer.
+   */
+   inline void reset(const char *data, size_t size);
+
+   /**
+   * Moves to the next event and returns it. Throws std::runtime_error on
+   * malformed input, i.e. if a tag is left open or closed by the wrong tag.
+   */
+   inline event_type next();
+
+   /**
+   * Skips the rest of the current element, i.e. everything up to and
+   * including its end tag. Must be called right after a START_TAG event.
+   */
+   inline void skip();
+
+   /**
+   * Returns the current event.
+   */
+   event_type event() const { return m_event; }
+
+   /**
+   * Returns the number of open elements. Start and end tags of an element
+   * report the same depth, i.e. for the root element, depth() is 1.
+   */
+   size_t depth() const { return m_open.size(); }
+
+   /**
+   * Returns the name of the current start or end tag.
+   */
+   const string_ref& name() const { return m_name; }
+
+   /**
+   * Returns the unparsed attributes of the current start tag.
+   */
+   const string_ref& attributes() const { return m_attributes; }
+
+   /**
+   * Returns the current text.
+   */
+   const string_ref& text() const { return m_text; }
+
+private:
+   static bool is_space(char c)
+   {
+      return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+   }
+
+   inline const char *find(const char *from, const char *what) const;
+   inline const char *find_tag_end(const char *from) const;
+   inline void error(const char *pos, const std::string& msg) const;
+
+   const char *m_begin;
+   const char *m_pos;
+   const char *m_end;
+   event_type m_event;
+   string_ref m_name;
+   string_ref m_attributes;
+   string_ref m_text;
+   std::vector<string_ref> m_open;  //< stack of open tags
+   bool m_pop;                      //< pop m_open on next()
+   bool m_empty_element;            //< report an END_TAG on next()
+};
+
+/**
+ *  A pull_parser working on a memory mapped file
+ */
+class file_pull_parser : public pull_parser, public boost::noncopyable
+{
+public:
+   /**
+   * Maps the file and prepares to parse it.
+   * \param fileName the name of the file to parse
+   */
+   explicit file_pull_parser(const std::string& fileName)
+   {
+      boost::system::error_code ec;
+      boost::uintmax_t size = boost::filesystem::file_size(fileName, ec);
+
+      if ( ec )
+         throw std::runtime_error("Cannot open file <" + fileName + ">!" );
+
+      // empty files cannot be mapped
+      if ( size > 0 )
+      {
+         m_file.open(fileName);
+         reset(m_file.data(), m_file.size());
+      }
+   }
+
+private:
+   boost::iostreams::mapped_file_source m_file;
+};
+
+// -----------------------------------------------------------------------------
+
+void pull_parser::reset(const char *data, size_t size)
+{
+   m_begin = m_pos = data;
+   m_end = data + size;
+   m_event = END_DOCUMENT;
+   m_name = m_attributes = m_text = string_ref();
+   m_open.clear();
+   m_pop = false;
+   m_empty_element = false;
+}
+
+// -----------------------------------------------------------------------------
+
+pull_parser::event_type pull_parser::next()
+{
+   if ( m_pop )
+   {
+      m_open.pop_back();
+      m_pop = false;
+   }
+
+   if ( m_empty_element )
+   {
+      m_empty_element = false;
+      m_pop = true;
+      return m_event = END_TAG;
+   }
+
+   for (;;)
+   {
+      while ( m_pos != m_end && is_space(*m_pos) )
+         ++m_pos;
+
+      if ( m_pos == m_end )
+      {
+         if ( !m_open.empty() )
+            error(m_pos, "unexpected end of document, <" + m_open.back().str() + "> not closed");
+
+         return m_event = END_DOCUMENT;
+      }
+
+      if ( *m_pos != '<' )
+      {
+         const char *lt = static_cast<const char *>(std::memchr(m_pos, '<', m_end - m_pos));
+
+         if ( !lt )
+            lt = m_end;
+
+         m_text = string_ref(m_pos, lt);
+         m_pos = lt;
+
+         return m_event = TEXT;
+      }
+
+      const char *tag = m_pos + 1;
+
+      if ( m_end - tag >= 3 && std::memcmp(tag, "!--", 3) == 0 )
+      {
+         const char *end = find(tag + 3, "-->");
+         if ( !end )
+            error(m_pos, "unterminated comment");
+         m_pos = end + 3;
+         continue;
+      }
+
+      if ( m_end - tag >= 8 && std::memcmp(tag, "![CDATA[", 8) == 0 )
+      {
+         const char *end = find(tag + 8, "]]>");
+         if ( !end )
+            error(m_pos, "unterminated CDATA section");
+         m_text = string_ref(tag + 8, end);
+         m_pos = end + 3;
+
+         if ( m_text.empty() )
+            continue;
+
+         return m_event = TEXT;
+      }
+
+      const char *gt = find_tag_end(tag);
+
+      if ( !gt )
+         error(m_pos, "unterminated tag");
+
+      if ( tag != m_end && (*tag == '?' || *tag == '!') )
+      {
+         // processing instruction or doctype declaration
+         m_pos = gt + 1;
+         continue;
+      }
+
+      if ( tag != m_end && *tag == '/' )
+      {
+         const char *name_end = gt;
+
+         while ( name_end > tag + 1 && is_space(name_end[-1]) )
+            --name_end;
+
+         m_name = string_ref(tag + 1, name_end);
+
+         if ( m_open.empty() )
+            error(m_pos, "unexpected closing tag </" + m_name.str() + ">");
+
+         if ( m_name != m_open.back() )
+            error(m_pos, "cannot find closing tag for <" + m_open.back().str() + ">, found </" + m_name.str() + "> instead");
+
+         m_pos = gt + 1;
+         m_pop = true;
+
+         return m_event = END_TAG;
+      }
+
+      const char *tag_end = gt;
+
+      if ( tag_end > tag && tag_end[-1] == '/' )
+      {
+         m_empty_element = true;
+         --tag_end;
+      }
+
+      const char *name_end = tag;
+
+      while ( name_end != tag_end && !is_space(*name_end) )
+         ++name_end;
+
+      if ( name_end == tag )
+         error(m_pos, "empty tag");
+
+      const char *attr = name_end;
+
+      while ( attr != tag_end && is_space(*attr) )
+         ++attr;
+
+      while ( tag_end != attr && is_space(tag_end[-1]) )
+         --tag_end;
+
+      m_name = string_ref(tag, name_end);
+      m_attributes = string_ref(attr, tag_end);
+      m_open.push_back(m_name);
+      m_pos = gt + 1;
+
+      return m_event = START_TAG;
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+void pull_parser::skip()
+{
+   if ( m_event != START_TAG )
+      throw std::runtime_error("pull_parser::skip() called outside of a start tag");
+
+   size_t level = depth();
+
+   while ( !(next() == END_TAG && depth() == level) )
+      ;
+}
+
+// -----------------------------------------------------------------------------
+
+const char *pull_parser::find(const char *from, const char *what) const
+{
+   const char *end = std::search(from, m_end, what, what + std::strlen(what));
+   return end == m_end ? 0 : end;
+}
+
+// -----------------------------------------------------------------------------
+
+const char *pull_parser::find_tag_end(const char *from) const
+{
+   // a '>' may appear in quoted attribute values
+   char quote = 0;
+
+   for ( const char *p = from; p != m_end; ++p )
+   {
+      if ( quote )
+      {
+         if ( *p == quote )
+            quote = 0;
+      }
+      else if ( *p == '"' || *p == '\'' )
+         quote = *p;
+      else if ( *p == '>' )
+         return p;
+   }
+
+   return 0;
+}
+
+// -----------------------------------------------------------------------------
+
+void pull_parser::error(const char *pos, const std::string& msg) const
+{
+   std::ostringstream oss;
+   oss << "xml error at line " << (std::count(m_begin, pos, '\n') + 1) << ": " << msg;
+   throw std::runtime_error(oss.str());
+}
+
+}}
+
+// -----------------------------------------------------------------------------
+
+#endif // MOOST_XML_PULL_PARSER_HPP
@@ -31,7 +31,9 @@
 /**
  * \file simple_parser.h
  *
- * A very simple and basic xml parser.
+ * A very simple and basic xml parser. The tree is built from the events of a
+ * pull_parser, see pull_parser.hpp for the xml it understands. Use the
+ * pull_parser directly for large files to avoid building the tree.
  * Example, to parse:
 \verbatim
 <base>
@@ -93,6 +95,8 @@ for ( rootIt = root.begin(); rootIt != root.end(); ++rootIt )
 #include  <boost/algorithm/string/case_conv.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include "pull_parser.hpp"
+
 namespace moost { namespace xml {
 
 /**
@@ -141,32 +145,13 @@ public:
    inline const tree_branch_t&
       get_root() const { return m_root; }
 
-private:
-
    /**
-   * Recursively parse a given tag.
-   * \param header the header of the tag to parse. Used to make sure that the tog will be closed.
-   * \param pCurrNode the node to be parsed
-   * makeLowercaseTags if true it will turn the tags (i.e. <foo>) into lowercase
-   */
-   inline void recursive_parse_tag( const std::string& header,
-                                    std::istream& xmlFile,
-                                    boost::shared_ptr<tree_node>& pCurrNode,
-                                    bool makeLowercaseTags = false);
-
-   /**
-   * Recursively parse the xml file.
-   * Will return true if the token was IN the token, false if it was OUTSIDE the token,
-   * i.e. with opening "<" and closing ">"
-   * <test>hello</test>
-   * test -> true
-   * hello -> false
-   * \param xmlFile the file to parse
-   * \param token the returned parsed token
-   * \param isComment in\out if it's in a comment block
+   * Builds the tree from the events of a pull_parser.
+   * \param parser the parser to read the events from
+   * \param makeLowercaseTags if true it will turn the tags (i.e. <foo>) into lowercase
    */
-   inline bool parse_token( std::istream& xmlFile,
-                            std::string& token, bool& isComment);
+   inline void
+      parse(pull_parser& parser, bool makeLowercaseTags = false);
 
 private:
 
@@ -177,134 +162,50 @@ private:
 
 void simple_parser::load(const std::string& fileName, bool makeLowercaseTags)
 {
-   std::ifstream xmlFile(fileName.c_str());
-
-   if ( !xmlFile.is_open() )
-      throw std::runtime_error("Cannot open file <" + fileName + ">!" );
-
-   xmlFile.exceptions(std::ios::badbit);
-
-   std::string tokenName;
-   bool isComment;
-   bool isInTag;
-   for (;;)
-   {
-      isInTag = parse_token(xmlFile, tokenName, isComment);
-      if ( xmlFile.eof() )
-         break;
-
-      if ( isInTag )
-      {
-         if ( isComment )
-            continue;
-
-         boost::shared_ptr<tree_node> pTmpMap(new tree_node());
-         m_root.push_back(pTmpMap);
-
-         recursive_parse_tag(tokenName, xmlFile, pTmpMap, makeLowercaseTags);
-      }
-   }
+   file_pull_parser xmlFile(fileName);
+   parse(xmlFile, makeLowercaseTags);
 }
 
 // -----------------------------------------------------------------------------
 
-bool simple_parser::parse_token( std::istream& xmlFile,
-                                 std::string& token, bool& isComment)
+void simple_parser::parse(pull_parser& parser, bool makeLowercaseTags)
 {
-   token.clear();
-   bool isInTag = false;
-   isComment = false;
-   char c = 0;
+   std::vector<tree_node*> openNodes;
 
-   for(;;)
+   for (;;)
    {
-      c = xmlFile.get();
-      if ( xmlFile.eof() )
-         break;
-
-      if ( isspace(c) && token.empty() )
-         continue;
-
-      if ( c == '<' && !isComment )
+      switch ( parser.next() )
       {
-         if ( !token.empty() ) // end of a in-token
+      case pull_parser::START_TAG:
          {
-            xmlFile.putback(c);
-            break;
-         }
+            boost::shared_ptr<tree_node> pTmpMap(new tree_node());
+            pTmpMap->header.assign(parser.name().begin(), parser.name().end());
 
-         isInTag = true;
-         continue;
-      }
-      else if ( c == '>' )
-      {
-         if ( isComment )
-         {
-            if ( token.substr(token.size()-2,2) == "--" )
-               break;
-         }
-         else
-            break;
-      }
-
-      token.append(1, c);
-      if ( token.size() == 3 && token == "!--" )
-         isComment = true;
-   }
-
-   return isInTag;
-}
-
-// -----------------------------------------------------------------------------
-
-void simple_parser::recursive_parse_tag( const std::string& header,
-                                         std::istream& xmlFile,
-                                         boost::shared_ptr<tree_node>& pCurrNode,
-                                         bool makeLowercaseTags)
-{
-   pCurrNode->header = header;
-
-   if ( makeLowercaseTags )
-   {
-      std::transform( pCurrNode->header.begin(), pCurrNode->header.end(),
-                      pCurrNode->header.begin(), (int(*)(int)) std::tolower);
-   }
-
-   bool isInTag = false;
-   bool isComment = false;
+            if ( makeLowercaseTags )
+            {
+               std::transform( pTmpMap->header.begin(), pTmpMap->header.end(),
+                               pTmpMap->header.begin(), (int(*)(int)) std::tolower);
+            }
 
-   std::string tokenName;
-   std::string closeToken = "/" + header;
-
-   for (;;)
-   {
-      isInTag = parse_token(xmlFile, tokenName, isComment);
-      if ( xmlFile.eof() )
-         throw std::runtime_error("EOF Before finding the right token!" );
-
-      if ( isInTag )
-      {
-         if ( tokenName.empty() )
-            continue;
-
-         if ( isComment )
-            continue;
+            (openNodes.empty() ? m_root : openNodes.back()->leaves).push_back(pTmpMap);
+            openNodes.push_back(pTmpMap.get());
+         }
+         break;
 
-         if ( tokenName == closeToken )
-            return;
+      case pull_parser::END_TAG:
+         openNodes.pop_back();
+         break;
 
-         if ( tokenName[0] == '/' )
-            throw std::runtime_error("Cannot find closing token for <" + header + ">! Found <" + tokenName + "> instead!" );
+      case pull_parser::TEXT:
+         // text outside of the root tag is ignored
+         if ( !openNodes.empty() )
+            openNodes.back()->value.assign(parser.text().begin(), parser.text().end());
+         break;
 
-         boost::shared_ptr<tree_node> pTmpMap(new tree_node());
-         pCurrNode->leaves.push_back( pTmpMap );
-         recursive_parse_tag(tokenName, xmlFile, pTmpMap, makeLowercaseTags);
+      case pull_parser::END_DOCUMENT:
+         return;
       }
-      else
-         pCurrNode->value = tokenName;
    }
-
-   throw std::runtime_error("simple_parser::recursive_parse_tag. Should never end here!");
 }
 
 // -----------------------------------------------------------------------------
@@ -0,0 +1,281 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <cstring>
+#include <algorithm>
+
+#include "sha256_block.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# define MOOST_DIGEST_HAVE_SHA_NI 1
+# include <cpuid.h>
+# include <immintrin.h>
+#endif
+
+namespace moost { namespace digest { namespace detail {
+
+namespace {
+
+const boost::uint32_t K[64] = {
+   0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+   0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+   0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+   0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+   0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+   0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+   0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+   0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const boost::uint32_t H0[8] = {
+   0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+inline boost::uint32_t rotr(boost::uint32_t x, int n)
+{
+   return (x >> n) | (x << (32 - n));
+}
+
+void compress_portable(boost::uint32_t *state, const boost::uint8_t *data, size_t blocks)
+{
+   boost::uint32_t w[64];
+
+   for (; blocks > 0; --blocks, data += sha256_hasher::block_size)
+   {
+      for (int i = 0; i < 16; ++i)
+      {
+         w[i] = (boost::uint32_t(data[4*i]) << 24) | (boost::uint32_t(data[4*i + 1]) << 16) |
+                (boost::uint32_t(data[4*i + 2]) << 8) | boost::uint32_t(data[4*i + 3]);
+      }
+
+      for (int i = 16; i < 64; ++i)
+      {
+         boost::uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+         boost::uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+         w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+      }
+
+      boost::uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+      boost::uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+      for (int i = 0; i < 64; ++i)
+      {
+         boost::uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+         boost::uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+         h = g; g = f; f = e; e = d + t1;
+         d = c; c = b; b = a; a = t1 + t2;
+      }
+
+      state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+      state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+   }
+}
+
+#ifdef MOOST_DIGEST_HAVE_SHA_NI
+
+bool cpu_has_sha_ni()
+{
+   unsigned int eax, ebx, ecx, edx;
+
+   if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & (1u << 19)))   // SSE4.1
+   {
+      return false;
+   }
+
+   if (__get_cpuid_max(0, 0) < 7)
+   {
+      return false;
+   }
+
+   __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+   return (ebx & (1u << 29)) != 0;   // SHA
+}
+
+__attribute__((target("sha,sse4.1")))
+void compress_sha_ni(boost::uint32_t *state, const boost::uint8_t *data, size_t blocks)
+{
+   const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+   // the sha256rnds2 instruction wants the state as ABEF/CDGH
+   __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[0])), 0xB1);
+   __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[4])), 0x1B);
+   __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+   state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+   for (; blocks > 0; --blocks, data += sha256_hasher::block_size)
+   {
+      const __m128i abef = state0;
+      const __m128i cdgh = state1;
+      __m128i msg[4];
+
+      for (int i = 0; i < 4; ++i)
+      {
+         msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16*i)), mask);
+      }
+
+      // 16 groups of 4 rounds, computing the message schedule on the fly
+      for (int i = 0; i < 16; ++i)
+      {
+         __m128i m = _mm_add_epi32(msg[i & 3], _mm_loadu_si128(reinterpret_cast<const __m128i *>(&K[4*i])));
+         state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+
+         if (i >= 3 && i < 15)
+         {
+            tmp = _mm_alignr_epi8(msg[i & 3], msg[(i - 1) & 3], 4);
+            msg[(i + 1) & 3] = _mm_add_epi32(msg[(i + 1) & 3], tmp);
+            msg[(i + 1) & 3] = _mm_sha256msg2_epu32(msg[(i + 1) & 3], msg[i & 3]);
+         }
+
+         m = _mm_shuffle_epi32(m, 0x0E);
+         state0 = _mm_sha256rnds2_epu32(state0, state1, m);
+
+         if (i >= 1 && i < 13)
+         {
+            msg[(i - 1) & 3] = _mm_sha256msg1_epu32(msg[(i - 1) & 3], msg[i & 3]);
+         }
+      }
+
+      state0 = _mm_add_epi32(state0, abef);
+      state1 = _mm_add_epi32(state1, cdgh);
+   }
+
+   tmp = _mm_shuffle_epi32(state0, 0x1B);
+   state1 = _mm_shuffle_epi32(state1, 0xB1);
+   state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+   state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+   _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[0]), state0);
+   _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[4]), state1);
+}
+
+#endif
+
+sha256_hasher::compress_fn select_compress(bool use_cpu_extensions)
+{
+#ifdef MOOST_DIGEST_HAVE_SHA_NI
+   static const bool has_sha_ni = cpu_has_sha_ni();
+
+   if (use_cpu_extensions && has_sha_ni)
+   {
+      return &compress_sha_ni;
+   }
+#else
+   (void) use_cpu_extensions;
+#endif
+
+   return &compress_portable;
+}
+
+}
+
+sha256_hasher::sha256_hasher(bool use_cpu_extensions)
+   : m_compress(select_compress(use_cpu_extensions))
+{
+   reset();
+}
+
+bool sha256_hasher::have_cpu_extensions()
+{
+   return select_compress(true) != &compress_portable;
+}
+
+void sha256_hasher::reset()
+{
+   std::memcpy(m_state, H0, sizeof(m_state));
+   m_buffered = 0;
+   m_length = 0;
+}
+
+void sha256_hasher::update(const void *data, size_t size)
+{
+   const boost::uint8_t *p = static_cast<const boost::uint8_t *>(data);
+
+   m_length += size;
+
+   if (m_buffered > 0)
+   {
+      size_t take = std::min(size, size_t(block_size) - m_buffered);
+      std::memcpy(m_buffer + m_buffered, p, take);
+      m_buffered += take;
+      p += take;
+      size -= take;
+
+      if (m_buffered < block_size)
+      {
+         return;
+      }
+
+      m_compress(m_state, m_buffer, 1);
+      m_buffered = 0;
+   }
+
+   // whole blocks are hashed straight from the input
+   if (size >= block_size)
+   {
+      m_compress(m_state, p, size/block_size);
+      p += size - size % block_size;
+      size %= block_size;
+   }
+
+   std::memcpy(m_buffer, p, size);
+   m_buffered = size;
+}
+
+void sha256_hasher::final(boost::uint8_t *digest)
+{
+   const boost::uint64_t bits = m_length*8;
+
+   m_buffer[m_buffered++] = 0x80;
+
+   if (m_buffered > block_size - 8)
+   {
+      std::memset(m_buffer + m_buffered, 0, block_size - m_buffered);
+      m_compress(m_state, m_buffer, 1);
+      m_buffered = 0;
+   }
+
+   std::memset(m_buffer + m_buffered, 0, block_size - 8 - m_buffered);
+
+   for (int i = 0; i < 8; ++i)
+   {
+      m_buffer[block_size - 1 - i] = static_cast<boost::uint8_t>(bits >> (8*i));
+   }
+
+   m_compress(m_state, m_buffer, 1);
+
+   for (int i = 0; i < 8; ++i)
+   {
+      digest[4*i + 0] = static_cast<boost::uint8_t>(m_state[i] >> 24);
+      digest[4*i + 1] = static_cast<boost::uint8_t>(m_state[i] >> 16);
+      digest[4*i + 2] = static_cast<boost::uint8_t>(m_state[i] >> 8);
+      digest[4*i + 3] = static_cast<boost::uint8_t>(m_state[i]);
+   }
+}
+
+}}}
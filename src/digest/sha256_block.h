@@ -0,0 +1,66 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_DIGEST_SHA256_BLOCK_H__
+#define MOOST_DIGEST_SHA256_BLOCK_H__
+
+#include <cstddef>
+
+#include <boost/cstdint.hpp>
+
+namespace moost { namespace digest { namespace detail {
+
+/*
+ *  Plain SHA-256 with a fast block function. The SHA extensions of x86 CPUs
+ *  are used where they are available, otherwise a portable implementation.
+ */
+class sha256_hasher
+{
+public:
+   enum { digest_size = 32, block_size = 64 };
+
+   typedef void (*compress_fn)(boost::uint32_t *state, const boost::uint8_t *data, size_t blocks);
+
+   explicit sha256_hasher(bool use_cpu_extensions = true);
+
+   void reset();
+   void update(const void *data, size_t size);
+   void final(boost::uint8_t *digest);
+
+   static bool have_cpu_extensions();
+
+private:
+   compress_fn m_compress;
+   boost::uint32_t m_state[8];
+   boost::uint8_t m_buffer[block_size];
+   size_t m_buffered;
+   boost::uint64_t m_length;
+};
+
+}}}
+
+#endif
@@ -0,0 +1,233 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "../../include/moost/digest/sha256_tree.h"
+
+#include "sha256_block.h"
+
+namespace moost { namespace digest {
+
+namespace {
+
+typedef detail::sha256_hasher hasher;
+
+struct leaf
+{
+   boost::uint8_t hash[hasher::digest_size];
+};
+
+void hash_chunk(const char *data, size_t size, leaf& out)
+{
+   const boost::uint8_t prefix = 0x00;
+   hasher h;
+   h.update(&prefix, 1);
+   h.update(data, size);
+   h.final(out.hash);
+}
+
+void hash_worker(const char *data, size_t chunk_size, std::vector<leaf>& leaves, boost::atomic<size_t>& next)
+{
+   size_t i;
+
+   while ((i = next.fetch_add(1, boost::memory_order_relaxed)) < leaves.size())
+   {
+      hash_chunk(data + i*chunk_size, chunk_size, leaves[i]);
+   }
+}
+
+// mapping the whole of a huge file at once isn't necessary
+const boost::uint64_t file_window_size = boost::uint64_t(1) << 30;
+
+}
+
+class sha256_tree_impl
+{
+public:
+   sha256_tree_impl(size_t chunk_size, size_t num_threads)
+      : m_chunk_size(chunk_size)
+      , m_num_threads(num_threads)
+   {
+      if (m_chunk_size == 0)
+      {
+         throw std::invalid_argument("sha256_tree chunk size must not be zero");
+      }
+
+      if (m_num_threads == 0)
+      {
+         m_num_threads = std::max(boost::thread::hardware_concurrency(), 1u);
+      }
+
+      m_batch_size = m_chunk_size*m_num_threads;
+
+      reset();
+   }
+
+   void reset()
+   {
+      const boost::uint8_t prefix = 0x01;
+      boost::uint8_t size[8];
+
+      for (int i = 0; i < 8; ++i)
+      {
+         size[i] = static_cast<boost::uint8_t>(boost::uint64_t(m_chunk_size) >> (8*(7 - i)));
+      }
+
+      m_root.reset();
+      m_root.update(&prefix, 1);
+      m_root.update(size, sizeof(size));
+      m_num_leaves = 0;
+      m_buffer.clear();
+   }
+
+   void add(const char *data, size_t size)
+   {
+      while (size > 0)
+      {
+         if (m_buffer.empty() && size >= m_chunk_size)
+         {
+            size_t whole = size - size % m_chunk_size;
+            hash_chunks(m_root, m_num_leaves, data, whole);
+            data += whole;
+            size -= whole;
+         }
+         else
+         {
+            size_t take = std::min(size, m_batch_size - m_buffer.size());
+            m_buffer.append(data, take);
+            data += take;
+            size -= take;
+
+            if (m_buffer.size() == m_batch_size)
+            {
+               hash_chunks(m_root, m_num_leaves, m_buffer.data(), m_buffer.size());
+               m_buffer.clear();
+            }
+         }
+      }
+   }
+
+   std::string digest() const
+   {
+      hasher root(m_root);
+      size_t num_leaves = m_num_leaves;
+      size_t whole = m_buffer.size() - m_buffer.size() % m_chunk_size;
+
+      hash_chunks(root, num_leaves, m_buffer.data(), whole);
+
+      if (whole < m_buffer.size() || num_leaves == 0)
+      {
+         leaf tail;
+         hash_chunk(m_buffer.data() + whole, m_buffer.size() - whole, tail);
+         root.update(tail.hash, sizeof(tail.hash));
+      }
+
+      boost::uint8_t digest[hasher::digest_size];
+      root.final(digest);
+
+      return std::string(reinterpret_cast<const char *>(&digest[0]), sizeof(digest));
+   }
+
+private:
+   // hashes size/m_chunk_size whole chunks in parallel and adds them to root
+   void hash_chunks(hasher& root, size_t& num_leaves, const char *data, size_t size) const
+   {
+      std::vector<leaf> leaves(size/m_chunk_size);
+
+      if (leaves.empty())
+      {
+         return;
+      }
+
+      boost::atomic<size_t> next(0);
+      boost::thread_group threads;
+
+      for (size_t i = 1; i < std::min(m_num_threads, leaves.size()); ++i)
+      {
+         threads.create_thread(boost::bind(&hash_worker, data, m_chunk_size, boost::ref(leaves), boost::ref(next)));
+      }
+
+      hash_worker(data, m_chunk_size, leaves, next);
+
+      threads.join_all();
+
+      root.update(&leaves[0], leaves.size()*sizeof(leaf));
+      num_leaves += leaves.size();
+   }
+
+   size_t m_chunk_size;
+   size_t m_num_threads;
+   size_t m_batch_size;
+   hasher m_root;
+   size_t m_num_leaves;
+   std::string m_buffer;
+};
+
+sha256_tree::sha256_tree(size_t chunk_size, size_t num_threads)
+   : m_impl(new sha256_tree_impl(chunk_size, num_threads))
+{
+}
+
+void sha256_tree::reset()
+{
+   m_impl->reset();
+}
+
+void sha256_tree::add_raw(const void *data, size_t size)
+{
+   m_impl->add(static_cast<const char *>(data), size);
+}
+
+std::string sha256_tree::digest() const
+{
+   return m_impl->digest();
+}
+
+void sha256_tree::add_file(const std::string& path)
+{
+   const boost::uint64_t size = boost::filesystem::file_size(path);
+
+   for (boost::uint64_t offset = 0; offset < size; offset += file_window_size)
+   {
+      boost::iostreams::mapped_file_source file(path,
+            static_cast<size_t>(std::min(file_window_size, size - offset)), offset);
+
+      m_impl->add(file.data(), file.size());
+   }
+}
+
+}}
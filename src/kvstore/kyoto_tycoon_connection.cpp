@@ -27,6 +27,8 @@
 
 #include "../../include/moost/kvstore/kyoto_tycoon_connection.h"
 
+#include <limits>
+
 // below is just the linux specific implementation
 
 #ifndef WIN32
@@ -117,6 +119,86 @@ namespace moost { namespace kvstore { namespace detail {
       }
    }
 
+   bool KyotoTycoonConnection::remove(const void* pkey, size_t ksize) const
+   {
+      assert_data_store_open();
+      if (pDb_->remove(reinterpret_cast<const char *>(pkey), ksize))
+         return true;
+      if (pDb_->error().code() == kyototycoon::RemoteDB::Error::LOGIC)
+         return false; // no such record
+      throw_kt_exception("Failed to remove from remote datastore");
+      return false;
+   }
+
+   size_t KyotoTycoonConnection::get_bulk(const key_list_t& keys, record_map_t& recs) const
+   {
+      assert_data_store_open();
+      int64_t found = pDb_->get_bulk(keys, &recs);
+      if (found < 0)
+         throw_kt_exception("Failed to bulk get from remote datastore");
+      return static_cast<size_t>(found);
+   }
+
+   void KyotoTycoonConnection::set_bulk(const record_map_t& recs, int64_t expirySecs) const
+   {
+      assert_data_store_open();
+      int64_t stored = expirySecs < 0 ? pDb_->set_bulk(recs) : pDb_->set_bulk(recs, expirySecs);
+      if (stored < 0)
+         throw_kt_exception("Failed to bulk set in remote datastore");
+   }
+
+   size_t KyotoTycoonConnection::remove_bulk(const key_list_t& keys) const
+   {
+      assert_data_store_open();
+      int64_t removed = pDb_->remove_bulk(keys);
+      if (removed < 0)
+         throw_kt_exception("Failed to bulk remove from remote datastore");
+      return static_cast<size_t>(removed);
+   }
+
+   boost::shared_array<char> KyotoTycoonConnection::get_with_expiry(const void* pkey, size_t ksize, size_t& vsize, int64_t& expiryTime) const
+   {
+      assert_data_store_open();
+      int64_t xt = -1;
+      boost::shared_array<char> val(pDb_->get(reinterpret_cast<const char *>(pkey), ksize, &vsize, &xt));
+      // records without expiry report the largest possible expiry time
+      expiryTime = (val && xt < std::numeric_limits<int64_t>::max()) ? xt : -1;
+      return val;
+   }
+
+   size_t KyotoTycoonConnection::get_bulk_with_expiry(const key_list_t& keys, record_map_t& recs, expiry_map_t& expiryTimes) const
+   {
+      assert_data_store_open();
+      std::vector<kyototycoon::RemoteDB::BulkRecord> bulk(keys.size());
+      for (size_t i = 0; i < keys.size(); ++i)
+      {
+         bulk[i].dbidx = 0;
+         bulk[i].key = keys[i];
+         bulk[i].xt = 0;
+      }
+      if (!pDb_->get_bulk_binary(&bulk))
+         throw_kt_exception("Failed to bulk get from remote datastore");
+      size_t found = 0;
+      for (size_t i = 0; i < bulk.size(); ++i)
+      {
+         // missing records come back with a negative expiry time
+         if (bulk[i].xt < 0)
+            continue;
+         recs[bulk[i].key].swap(bulk[i].value);
+         expiryTimes[bulk[i].key] = bulk[i].xt < std::numeric_limits<int64_t>::max() ? bulk[i].xt : -1;
+         ++found;
+      }
+      return found;
+   }
+
+   bool KyotoTycoonConnection::ping() const
+   {
+      if (!isOpen_)
+         return false;
+      std::map<std::string, std::string> status;
+      return pDb_->status(&status);
+   }
+
    void KyotoTycoonConnection::throw_kt_exception(const std::string& msg) const
    {
       throw std::runtime_error(msg + ": " + pDb_->error().name() + " (" + pDb_->error().message() + ")");
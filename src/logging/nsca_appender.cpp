@@ -46,6 +46,7 @@
 #include <log4cxx/helpers/synchronized.h>
 
 #include "../../include/moost/nagios/nsca_client.hpp"
+#include "../../include/moost/nagios/nsca_async_sender.hpp"
 
 #include "../../include/moost/logging/global.hpp"
 #include "../../include/moost/logging/nsca_appender.hpp"
@@ -58,11 +59,49 @@ using namespace moost::nagios;
 
 IMPLEMENT_LOG4CXX_OBJECT(NscaAppender)
 
+namespace
+{
+   // reports send failures of the background thread on the status stream
+   class appender_sender : public nsca_async_sender
+   {
+   public:
+      appender_sender(
+            nsca_config const & cfg,
+            size_t max_queue,
+            int min_resend_interval_ms,
+            int connection_ttl_secs,
+            moost::logging::pseudo_ostream & out
+            )
+         : nsca_async_sender(cfg, max_queue, min_resend_interval_ms, connection_ttl_secs)
+           , out_(out)
+      {
+      }
+
+      ~appender_sender()
+      {
+         stop();
+      }
+
+   protected:
+      void report_error(std::exception const & e)
+      {
+         out_ << "append failed: " << e.what() << std::endl;
+      }
+
+   private:
+      moost::logging::pseudo_ostream & out_;
+   };
+}
+
 namespace log4cxx
 {
    NscaAppender::NscaAppender()
       : AppenderSkeleton(LayoutPtr(new PatternLayout(LOG4CXX_STR("%m"))))
         , out_(moost::logging::global_singleton::instance().get_ostream())
+        , async_(true)
+        , max_queue_(1000)
+        , min_resend_interval_ms_(0)
+        , connection_ttl_secs_(10)
    {
       activateOptions();
    }
@@ -76,6 +115,10 @@ namespace log4cxx
         , this_host_desc_(this_host)
         , nsca_config_(cfg)
         , out_(moost::logging::global_singleton::instance().get_ostream())
+        , async_(true)
+        , max_queue_(1000)
+        , min_resend_interval_ms_(0)
+        , connection_ttl_secs_(10)
    {
       activateOptions();
    }
@@ -89,6 +132,10 @@ namespace log4cxx
         , this_host_desc_(this_host)
         , nsca_config_(nsca_svr_host)
         , out_(moost::logging::global_singleton::instance().get_ostream())
+        , async_(true)
+        , max_queue_(1000)
+        , min_resend_interval_ms_(0)
+        , connection_ttl_secs_(10)
    {
       activateOptions();
    }
@@ -103,6 +150,10 @@ namespace log4cxx
         , this_host_desc_(this_host_desc)
         , nsca_config_(cfg)
         , out_(moost::logging::global_singleton::instance().get_ostream())
+        , async_(true)
+        , max_queue_(1000)
+        , min_resend_interval_ms_(0)
+        , connection_ttl_secs_(10)
    {
       activateOptions();
    }
@@ -117,12 +168,20 @@ namespace log4cxx
         , this_host_desc_(this_host_desc)
         , nsca_config_(nsca_svr_host)
         , out_(moost::logging::global_singleton::instance().get_ostream())
+        , async_(true)
+        , max_queue_(1000)
+        , min_resend_interval_ms_(0)
+        , connection_ttl_secs_(10)
    {
    }
 
    NscaAppender::NscaAppender(LayoutPtr & layout)
       : log4cxx::AppenderSkeleton(layout)
         , out_(moost::logging::global_singleton::instance().get_ostream())
+        , async_(true)
+        , max_queue_(1000)
+        , min_resend_interval_ms_(0)
+        , connection_ttl_secs_(10)
    {
       activateOptions();
    }
@@ -137,6 +196,10 @@ namespace log4cxx
         , this_host_desc_(this_host)
         , nsca_config_(cfg)
         , out_(moost::logging::global_singleton::instance().get_ostream())
+        , async_(true)
+        , max_queue_(1000)
+        , min_resend_interval_ms_(0)
+        , connection_ttl_secs_(10)
    {
       activateOptions();
    }
@@ -151,6 +214,10 @@ namespace log4cxx
         , this_host_desc_(this_host)
         , nsca_config_(nsca_svr_host)
         , out_(moost::logging::global_singleton::instance().get_ostream())
+        , async_(true)
+        , max_queue_(1000)
+        , min_resend_interval_ms_(0)
+        , connection_ttl_secs_(10)
    {
       activateOptions();
    }
@@ -166,6 +233,10 @@ namespace log4cxx
         , this_host_desc_(this_host_desc)
         , nsca_config_(cfg)
         , out_(moost::logging::global_singleton::instance().get_ostream())
+        , async_(true)
+        , max_queue_(1000)
+        , min_resend_interval_ms_(0)
+        , connection_ttl_secs_(10)
    {
       activateOptions();
    }
@@ -181,6 +252,10 @@ namespace log4cxx
         , this_host_desc_(this_host_desc)
         , nsca_config_(nsca_svr_host)
         , out_(moost::logging::global_singleton::instance().get_ostream())
+        , async_(true)
+        , max_queue_(1000)
+        , min_resend_interval_ms_(0)
+        , connection_ttl_secs_(10)
    {
       activateOptions();
    }
@@ -233,6 +308,30 @@ namespace log4cxx
       out_ << "ThisHostDesc: " << desc << std::endl;
    }
 
+   void NscaAppender::setAsync(bool async)
+   {
+      async_ = async;
+      out_ << "Async: " << async << std::endl;
+   }
+
+   void NscaAppender::setMaxQueue(size_t max_queue)
+   {
+      max_queue_ = max_queue;
+      out_ << "MaxQueue: " << max_queue << std::endl;
+   }
+
+   void NscaAppender::setMinResendIntervalMs(int interval)
+   {
+      min_resend_interval_ms_ = interval;
+      out_ << "MinResendInterval: " << interval << std::endl;
+   }
+
+   void NscaAppender::setConnectionTtlSecs(int ttl)
+   {
+      connection_ttl_secs_ = ttl;
+      out_ << "ConnectionTtl: " << ttl << std::endl;
+   }
+
    void NscaAppender::setOption(const LogString& option, const LogString& value)
    {
       if (StringHelper::equalsIgnoreCase(option,
@@ -285,9 +384,33 @@ namespace log4cxx
                               setThisHostDesc(value);
                            }
                            else
-                           {
-                              AppenderSkeleton::setOption(option, value);
-                           }
+                              if (StringHelper::equalsIgnoreCase(option,
+                                       LOG4CXX_STR("ASYNC"), LOG4CXX_STR("async")))
+                              {
+                                 setAsync(OptionConverter::toBoolean(value, true));
+                              }
+                              else
+                                 if (StringHelper::equalsIgnoreCase(option,
+                                          LOG4CXX_STR("MAXQUEUE"), LOG4CXX_STR("maxqueue")))
+                                 {
+                                    setMaxQueue(OptionConverter::toInt(value, 1000));
+                                 }
+                                 else
+                                    if (StringHelper::equalsIgnoreCase(option,
+                                             LOG4CXX_STR("MINRESENDINTERVALMS"), LOG4CXX_STR("minresendintervalms")))
+                                    {
+                                       setMinResendIntervalMs(OptionConverter::toInt(value, 0));
+                                    }
+                                    else
+                                       if (StringHelper::equalsIgnoreCase(option,
+                                                LOG4CXX_STR("CONNECTIONTTLSECS"), LOG4CXX_STR("connectionttlsecs")))
+                                       {
+                                          setConnectionTtlSecs(OptionConverter::toInt(value, 10));
+                                       }
+                                       else
+                                       {
+                                          AppenderSkeleton::setOption(option, value);
+                                       }
    }
 
    void NscaAppender::activateOptions()
@@ -298,8 +421,23 @@ namespace log4cxx
 
    void NscaAppender::activateOptions(Pool& p )
    {
+      // stop any previous sender (sending what it has queued) first
+      nsca_sender_.reset();
       nsca_client_.reset(new nsca_client(nsca_config_));
-      out_ << "Nagios client activated" << std::endl;
+
+      if(async_)
+      {
+         nsca_sender_.reset(
+               new appender_sender(
+                  nsca_config_,
+                  max_queue_,
+                  min_resend_interval_ms_,
+                  connection_ttl_secs_,
+                  out_
+                  ));
+      }
+
+      out_ << "Nagios client activated" << (async_ ? " (async)" : "") << std::endl;
 
       // Ensure any base class options get activated
       AppenderSkeleton::activateOptions(p);
@@ -307,6 +445,7 @@ namespace log4cxx
 
    void NscaAppender::close()
    {
+      nsca_sender_.reset();
       nsca_client_.reset();
       out_ << "Nagios client terminated" << std::endl;
    }
@@ -401,11 +540,23 @@ namespace log4cxx
                << narrow
                << std::endl;
 
-            nsca_client_->send(
-                  thost,
-                  tdesc,
-                  service_state,
-                  narrow);
+            if(nsca_sender_)
+            {
+               // only queues the alert, the network i/o happens on the sender's thread
+               nsca_sender_->send(
+                     thost,
+                     tdesc,
+                     service_state,
+                     narrow);
+            }
+            else
+            {
+               nsca_client_->send(
+                     thost,
+                     tdesc,
+                     service_state,
+                     narrow);
+            }
          }
       }
       catch(std::exception const & e)
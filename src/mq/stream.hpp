@@ -34,6 +34,7 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "../../include/moost/mq/stomp_client.h"
+#include "../../include/moost/metrics/registry.hpp"
 
 namespace moost { namespace mq {
 
@@ -42,18 +43,22 @@ class stream
 public:
    typedef boost::function<void (const std::string&)> message_cb_t;
 
-   stream(const message_cb_t& cb, stomp_client::ack::type ack_type,
+   stream(const std::string& topic, const message_cb_t& cb, stomp_client::ack::type ack_type,
           const boost::posix_time::time_duration& max_msg_interval)
       : m_callback(cb)
       , m_last_invoke(boost::posix_time::microsec_clock::universal_time())
       , m_ack_type(ack_type)
       , m_max_msg_interval(max_msg_interval)
+      , m_messages(moost::metrics::get_counter(moost::metrics::make_name("mq.stream", topic) + ".messages"))
+      , m_handler_us(moost::metrics::get_histogram(moost::metrics::make_name("mq.stream", topic) + ".handler_us"))
    {
    }
 
    void invoke(const std::string& message)
    {
       reset_interval_timer();
+      ++m_messages;
+      moost::metrics::scoped_timer timer(m_handler_us);
       m_callback(message);
    }
 
@@ -94,6 +99,9 @@ private:
 
    const stomp_client::ack::type m_ack_type;
    const boost::posix_time::time_duration m_max_msg_interval;
+
+   moost::metrics::counter& m_messages;
+   moost::metrics::histogram& m_handler_us;
 };
 
 }}
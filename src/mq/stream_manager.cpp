@@ -30,7 +30,9 @@
 namespace moost { namespace mq {
 
 stream_manager::stream_manager(size_t consumer_pool_size)
-   : m_running(1)
+   : m_pending(moost::metrics::get_gauge("mq.pending"))
+   , m_unrouted(moost::metrics::get_counter("mq.unrouted"))
+   , m_running(1)
 {
    for (size_t i = 0; i < consumer_pool_size; ++i)
    {
@@ -61,7 +63,7 @@ bool stream_manager::insert(const std::string& topic, stream::message_cb_t messa
       return false;
    }
 
-   m_streams[topic].reset(new stream(message_cb, ack_type, max_msg_interval));
+   m_streams[topic].reset(new stream(topic, message_cb, ack_type, max_msg_interval));
 
    return true;
 }
@@ -113,10 +115,13 @@ bool stream_manager::push_message(const std::string& topic, const std::string& m
       }
       else
       {
+         ++m_unrouted;
          return false;
       }
    }
 
+   m_pending.add(1);
+
    {
       boost::mutex::scoped_lock lock(m_mx_messages_list);
       m_messages_list.push_back(std::make_pair(sp, message));
@@ -152,6 +157,8 @@ void stream_manager::consumer_thread()
          m_messages_list.pop_front();
       }
 
+      m_pending.sub(1);
+
       smp.first->invoke(smp.second);
    }
 }
@@ -88,6 +88,9 @@ private:
    boost::condition_variable m_cond_messages_list;
    std::deque<stream_message_pair> m_messages_list;
 
+   moost::metrics::gauge& m_pending;
+   moost::metrics::counter& m_unrouted;
+
    boost::thread_group m_consumer_threads;
 
    volatile sig_atomic_t m_running;
@@ -1,4 +1,14 @@
 #include <unistd.h>
+#include <fcntl.h>
+
+namespace {
+
+// Output written to a stolen stream only blocks the writer if the reader
+// falls this far behind, so make the pipe a lot bigger than the default
+// of a few pages where the platform lets us.
+const int stolen_pipe_size = 1 << 20;
+
+}
 
 detail::posix_stream_stealer::posix_stream_stealer(bool restore, bool close_pipe)
   : m_handle(0)
@@ -45,6 +55,11 @@ bool detail::posix_stream_stealer::steal(FILE *handle)
       goto fail2;
    }
 
+#ifdef F_SETPIPE_SZ
+   // best effort, the pipe works fine with its default size
+   (void) fcntl(pfd[0], F_SETPIPE_SZ, stolen_pipe_size);
+#endif
+
    m_handle = handle;
    m_backup_fd = backup;
    m_pipe_fd = pfd[0];
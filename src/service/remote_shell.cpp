@@ -27,8 +27,11 @@
 
 #include <cstdio>
 #include <set>
+#include <deque>
 #include <queue>
+#include <vector>
 #include <string>
+#include <algorithm>
 #include <stdexcept>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
@@ -36,6 +39,9 @@
 #include <boost/noncopyable.hpp>
 #include <boost/foreach.hpp>
 #include <boost/algorithm/string/trim.hpp>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/weak_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
@@ -45,6 +51,7 @@
 #include "../../include/moost/io/async_stream_forwarder.hpp"
 #include "../../include/moost/service/remote_shell.h"
 #include "../../include/moost/service/posix_stream_stealer.h"
+#include "../../include/moost/metrics/registry.hpp"
 
 #if defined(_POSIX_SOURCE) || defined(__CYGWIN__)
 // needed for ::dup(), ::write(), ::fileno()
@@ -67,7 +74,17 @@ using namespace moost::service;
 class session_base;
 typedef shared_ptr<session_base> session_ptr;
 typedef shared_ptr<tcp::socket> socket_ptr;
-typedef void (session_base::*session_meth)(const char *buffer, size_t count);
+
+/*
+ *  Output is passed around in reference counted, immutable buffers, so
+ *  the same chunk of stdout can sit in the output queues of any number
+ *  of sessions without being copied for each of them.
+ */
+typedef shared_ptr<const std::string> output_buffer;
+typedef std::vector<asio::const_buffer> output_buffers;
+typedef boost::function<void (const system::error_code&, size_t)> write_handler;
+
+typedef void (session_base::*session_meth)(const output_buffer& buffer);
 
 namespace moost { namespace service {
 
@@ -106,8 +123,8 @@ private:
 
 #ifdef BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR
    bool snoop_stdio(posix_stream_stealer& stealer, FILE *stream, stdstream *bsd, session_meth cb);
-   void on_stdio_read(stdstream *bsd, session_meth cb, const system::error_code& error, char *buffer, size_t count);
-   void stdio_read_more(stdstream *bsd, session_meth cb, char *buffer);
+   void on_stdio_read(stdstream *bsd, session_meth cb, const system::error_code& error, shared_ptr<std::string> buffer, size_t count);
+   void stdio_read_more(stdstream *bsd, session_meth cb, shared_ptr<std::string> buffer);
 #endif
 
    bool setup_stdio_snoopers();
@@ -117,10 +134,17 @@ private:
    bool setup_console_session(remote_shell_iface *rsi);
 
    void command_thread(remote_shell_iface *rsi);
+   void io_thread();
+
+   void add_session(session_ptr p);
+   bool has_session(session_ptr p) const;
+   void get_sessions(std::vector<session_ptr>& sessions) const;
 
    shared_ptr<asio::io_service> m_ios;
+   asio::io_service::strand m_strand;
    shared_ptr<tcp::acceptor> m_acceptor;
    std::set<session_ptr> m_sessions;
+   mutable mutex m_sessions_mutex;
    appender_factory_ptr m_app_factory;
 #ifdef BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR
    stdstream m_stdout;
@@ -134,6 +158,8 @@ private:
    bool m_enable_local;
    bool m_can_snoop_stdio;
    unsigned short m_listen_port;
+   size_t m_num_threads;
+   size_t m_session_buffer_size;
    shared_ptr<thread> m_cmd_runner;
    std::queue< command > m_cmd_queue;
    mutex m_cmd_queue_mutex;
@@ -152,6 +178,8 @@ public:
    void set_listen_port(unsigned short port);
    void set_pre_shutdown_function(boost::function0<void>& func);
    void enable_local_shell(bool enabled);
+   void set_num_threads(size_t num_threads);
+   void set_session_buffer_size(size_t bytes);
    void get_sessions_list(std::string& rv);
    void process_command(session_ptr session, const std::string& cmd, const std::string& args);
 
@@ -159,6 +187,16 @@ public:
    {
       return m_welcome;
    }
+
+   asio::io_service& io_service()
+   {
+      return *m_ios;
+   }
+
+   size_t session_buffer_size() const
+   {
+      return m_session_buffer_size;
+   }
 };
 
 } }
@@ -189,18 +227,10 @@ public:
       m_socket->close();
    }
 
-   template <typename HandlerT>
-   void write_stdout(const std::string& data, HandlerT handler)
-   {
-      mutex::scoped_lock lock(m_mutex);
-      asio::async_write(*m_socket, asio::buffer(data.c_str(), data.length()), handler);
-   }
-
-   template <typename HandlerT>
-   void write_stderr(const std::string& data, HandlerT handler)
+   void write(const output_buffers& buffers, bool /* err */, const write_handler& handler)
    {
       mutex::scoped_lock lock(m_mutex);
-      asio::async_write(*m_socket, asio::buffer(data.c_str(), data.length()), handler);
+      asio::async_write(*m_socket, buffers, handler);
    }
 
    template <typename HandlerT>
@@ -245,27 +275,7 @@ public:
       m_in_fwd.close();
    }
 
-   template <typename HandlerT>
-   void write_stdout(const std::string& data, HandlerT handler)
-   {
-      write_console(m_out, data, handler);
-   }
-
-   template <typename HandlerT>
-   void write_stderr(const std::string& data, HandlerT handler)
-   {
-      write_console(m_err, data, handler);
-   }
-
-   template <typename HandlerT>
-   void read_some(void *data, size_t size, HandlerT handler)
-   {
-      m_in_fwd.read_async(data, size, handler);
-   }
-
-private:
-   template <typename HandlerT>
-   void write_console(native_io_t fd, const std::string& data, HandlerT handler)
+   void write(const output_buffers& buffers, bool err, const write_handler& handler)
    {
       // We can't use boost::asio for this, as we could be writing
       // to a regular file, for which the asio reactor (e.g. epoll
@@ -275,24 +285,39 @@ private:
       // it to behave as similar to boost::asio as possible.
 
       boost::system::error_code ec;
-      size_t written = 0;
+      size_t total = 0;
 
       {
          mutex::scoped_lock lock(m_mutex);
 
-         if (!moost::io::helper::write(fd, data.c_str(), data.length(), &written))
+         foreach (const asio::const_buffer& buf, buffers)
          {
-            ec.assign(moost::io::helper::error(), boost::asio::error::get_system_category());
-            written = 0;
+            size_t written = 0;
+
+            if (!moost::io::helper::write(err ? m_err : m_out, asio::buffer_cast<const char *>(buf),
+                                          asio::buffer_size(buf), &written))
+            {
+               ec.assign(moost::io::helper::error(), boost::asio::error::get_system_category());
+               break;
+            }
+
+            total += written;
          }
       }
 
       // Make sure the handler is called synchronously, modelling
       // the behaviour of boost::asio.
 
-      m_ios->post(bind(handler, ec, static_cast<std::size_t>(written)));
+      m_ios->post(bind(handler, ec, total));
+   }
+
+   template <typename HandlerT>
+   void read_some(void *data, size_t size, HandlerT handler)
+   {
+      m_in_fwd.read_async(data, size, handler);
    }
 
+private:
    mutex m_mutex;
    shared_ptr<asio::io_service> m_ios;
    moost::io::async_stream_forwarder m_in_fwd;
@@ -301,30 +326,6 @@ private:
    const std::string m_name;
 };
 
-template <class SessionIoT>
-class session_writer : public stream_writer_iface
-{
-public:
-   session_writer(shared_ptr<SessionIoT> io)
-     : m_io(io)
-   {
-   }
-
-   virtual void write(const char *data, size_t len)
-   {
-      std::string *s = new std::string(data, len);
-      m_io->write_stdout(*s, bind(&session_writer<SessionIoT>::on_write_done, s));
-   }
-
-private:
-   static void on_write_done(std::string *str)
-   {
-      delete str;
-   }
-
-   shared_ptr<SessionIoT> m_io;
-};
-
 class session_base : public enable_shared_from_this<session_base>, public noncopyable
 {
 protected:
@@ -336,8 +337,12 @@ protected:
    };
 
 public:
-   session_base(remote_shell_server_impl& srv, remote_shell_iface *rsi, bool allow_quit, bool enable_cout_cerr, bool enable_cls)
-      : m_srv(srv)
+   session_base(remote_shell_server_impl& srv, remote_shell_iface *rsi, const std::string& peer,
+                bool allow_quit, bool enable_cout_cerr, bool enable_cls)
+      : m_strand(srv.io_service())
+      , m_srv(srv)
+      , m_peer(peer)
+      , m_stop_timer(srv.io_service())
       , m_state(SESSION_CREATED)
       , m_rsi(rsi)
       , m_cout_on(true)
@@ -347,6 +352,12 @@ public:
       , m_enable_cout_cerr(enable_cout_cerr)
       , m_enable_cls(enable_cls)
       , m_t_connect(boost::posix_time::second_clock::universal_time())
+      , m_out_bytes(0)
+      , m_out_dropped(0)
+      , m_out_dropped_total(0)
+      , m_out_writing(false)
+      , m_out_closed(false)
+      , m_dropped_metric(moost::metrics::get_counter("service.shell.output_dropped"))
    {
    }
 
@@ -360,17 +371,18 @@ public:
       m_app = appender;
       m_app->attach();
       m_state = SESSION_ATTACHED;
-      m_peer = get_peer_string();
       continue_session("accepted client connection from " + m_peer + "\r\n" + m_srv.welcome());
       read_more();
    }
 
-   void stop(const std::string& msg)
+   void post_stop(const std::string& msg)
    {
-      if (is_attached())
-      {
-         write("\r\n" + msg, SESSION_STOPPING);
-      }
+      m_strand.post(bind(&session_base::stop, shared_from_this(), msg));
+   }
+
+   void post_command_result(bool handled, const std::string& cmd, const std::string& rv)
+   {
+      m_strand.post(bind(&session_base::command_result, shared_from_this(), handled, cmd, rv));
    }
 
    void set_stdout_state(bool on)
@@ -390,25 +402,56 @@ public:
 
       oss << m_peer << " [" << duration << "]";
 
+      mutex::scoped_lock lock(m_out_mutex);
+
+      if (m_out_dropped_total > 0)
+      {
+         oss << " (" << m_out_dropped_total << " bytes of output dropped)";
+      }
+
       return oss.str();
    }
 
-   void add_stdout(const char *buffer, size_t count);
-   void add_stderr(const char *buffer, size_t count);
-   void command_result(bool handled, const std::string& cmd, const std::string& rv);
+   void add_stdout(const output_buffer& buffer);
+   void add_stderr(const output_buffer& buffer);
+   void add_log(const char *data, size_t len);
 
 protected:
    virtual void set_nodelay() = 0;
-   virtual std::string get_peer_string() const = 0;
    virtual void close() = 0;
    virtual void read_more(char *data, size_t max) = 0;
-   virtual void write_stdout(std::string *s, state st) = 0;
-   virtual void write_stderr(std::string *s, state st) = 0;
+   virtual void write_buffers(const output_buffers& buffers, bool err, const write_handler& handler) = 0;
 
-   void on_write_done(std::string *s, state st, const system::error_code& error);
    void on_read_done(const system::error_code& error, size_t bytes_transferred);
 
+   asio::io_service::strand m_strand;
+
 private:
+   /*
+    *  A piece of output waiting to be written to the client. The prefix and
+    *  suffix (if any) are static strings used to colour stdout and stderr,
+    *  so the output itself can be shared between all sessions.
+    */
+   struct output_chunk
+   {
+      output_buffer data;
+      const std::string *prefix;
+      const std::string *suffix;
+      bool err;
+      state st;
+
+      output_chunk(const output_buffer& d, const std::string *pre, const std::string *post, bool e, state s)
+         : data(d), prefix(pre), suffix(post), err(e), st(s)
+      {}
+
+      size_t size() const
+      {
+         return data->size() + (prefix ? prefix->size() : 0) + (suffix ? suffix->size() : 0);
+      }
+   };
+
+   enum { max_gather_chunks = 64 };
+
    void read_more()
    {
       read_more(m_data, max_length);
@@ -416,13 +459,12 @@ private:
 
    void write(const std::string& str)
    {
-      write(str, m_state);
+      write(str, SESSION_CREATED);
    }
 
    void write(const std::string& str, state st)
    {
-      std::string *s = new std::string(str);
-      write_stdout(s, st);
+      queue_output(output_chunk(output_buffer(new std::string(str)), 0, 0, false, st), true);
    }
 
    bool is_attached() const
@@ -438,6 +480,13 @@ private:
    template <typename T>
    void get_more_help(std::ostream& os, const T& obj) const;
 
+   void stop(const std::string& msg);
+   void on_stop_timeout(const system::error_code& error);
+   void command_result(bool handled, const std::string& cmd, const std::string& rv);
+   void queue_output(const output_chunk& chunk, bool essential);
+   void queue_dropped_notice();
+   void write_more();
+   void on_write_done(const system::error_code& error, size_t bytes_transferred);
    void get_help(std::string& rv) const;
    void continue_session(const std::string& str = "");
    void handle_stop();
@@ -447,20 +496,32 @@ private:
    void process_input();
 
    remote_shell_server_impl& m_srv;
-   std::string m_peer;
+   const std::string m_peer;
+   asio::deadline_timer m_stop_timer;
    enum { max_length = 1024 };
    char m_data[max_length];
    appender_ptr m_app;
    enum state m_state;
    remote_shell_iface * const m_rsi;
    std::string m_inbuf;
-   bool m_cout_on;
-   bool m_cerr_on;
+   boost::atomic<bool> m_cout_on;
+   boost::atomic<bool> m_cerr_on;
    bool m_processing_input;
    const bool m_allow_quit;
    const bool m_enable_cout_cerr;
    const bool m_enable_cls;
    const boost::posix_time::ptime m_t_connect;
+
+   // output queue, all of this is protected by m_out_mutex
+   mutable mutex m_out_mutex;
+   std::deque<output_chunk> m_out_queue;
+   std::vector<output_chunk> m_out_inflight;
+   size_t m_out_bytes;
+   size_t m_out_dropped;
+   size_t m_out_dropped_total;
+   bool m_out_writing;
+   bool m_out_closed;
+   moost::metrics::counter& m_dropped_metric;
 };
 
 template <class SessionIoT, bool AllowQuit = true, bool EnableCLS = true>
@@ -468,7 +529,7 @@ class session : public session_base
 {
 public:
    session(remote_shell_server_impl& srv, remote_shell_iface *rsi, shared_ptr<SessionIoT> io, bool enable_cout_cerr = true)
-      : session_base(srv, rsi, AllowQuit, enable_cout_cerr, EnableCLS)
+      : session_base(srv, rsi, io->get_peer_string(), AllowQuit, enable_cout_cerr, EnableCLS)
       , m_io(io)
    {
    }
@@ -479,11 +540,6 @@ protected:
       m_io->set_nodelay();
    }
 
-   virtual std::string get_peer_string() const
-   {
-      return m_io->get_peer_string();
-   }
-
    virtual void close()
    {
       return m_io->close();
@@ -491,51 +547,197 @@ protected:
 
    virtual void read_more(char *data, size_t max)
    {
-      m_io->read_some(data, max, bind(&session::on_read_done, shared_from_this(),
-            asio::placeholders::error, asio::placeholders::bytes_transferred));
+      m_io->read_some(data, max, m_strand.wrap(bind(&session::on_read_done, shared_from_this(),
+            asio::placeholders::error, asio::placeholders::bytes_transferred)));
    }
 
-   virtual void write_stdout(std::string *s, state st)
+   virtual void write_buffers(const output_buffers& buffers, bool err, const write_handler& handler)
    {
-      m_io->write_stdout(*s, bind(&session::on_write_done, shared_from_this(), s, st, asio::placeholders::error));
+      m_io->write(buffers, err, handler);
    }
 
-   virtual void write_stderr(std::string *s, state st)
+private:
+   shared_ptr<SessionIoT> m_io;
+};
+
+/*
+ *  The log appender of a session writes through this. Logging may happen
+ *  from any thread, and the output is treated just like stdout, i.e. it
+ *  will be dropped rather than queued up without bounds if the client
+ *  can't keep up.
+ */
+class session_writer : public stream_writer_iface
+{
+public:
+   session_writer(session_ptr session)
+     : m_session(session)
    {
-      m_io->write_stderr(*s, bind(&session::on_write_done, shared_from_this(), s, st, asio::placeholders::error));
+   }
+
+   virtual void write(const char *data, size_t len)
+   {
+      session_ptr s = m_session.lock();
+
+      if (s)
+      {
+         s->add_log(data, len);
+      }
    }
 
 private:
-   shared_ptr<SessionIoT> m_io;
+   weak_ptr<session_base> m_session;
 };
 
 /**********************************************************************/
 
-void session_base::add_stdout(const char *buffer, size_t count)
+namespace {
+
+const std::string& stdout_prefix()
+{
+   static const std::string s = terminal_format::color(C_GREEN);
+   return s;
+}
+
+const std::string& stderr_prefix()
+{
+   static const std::string s = terminal_format::color(C_RED) + terminal_format::bold();
+   return s;
+}
+
+const std::string& output_suffix()
+{
+   static const std::string s = terminal_format::reset();
+   return s;
+}
+
+}
+
+void session_base::add_stdout(const output_buffer& buffer)
 {
    if (m_cout_on)
    {
-      std::string *s = new std::string();
-      s->append(terminal_format::color(C_GREEN));
-      s->append(buffer, count);
-      s->append(terminal_format::reset());
-      write_stdout(s, m_state);
+      queue_output(output_chunk(buffer, &stdout_prefix(), &output_suffix(), false, SESSION_CREATED), false);
    }
 }
 
-void session_base::add_stderr(const char *buffer, size_t count)
+void session_base::add_stderr(const output_buffer& buffer)
 {
    if (m_cerr_on)
    {
-      std::string *s = new std::string();
-      s->append(terminal_format::color(C_RED));
-      s->append(terminal_format::bold());
-      s->append(buffer, count);
-      s->append(terminal_format::reset());
-      write_stderr(s, m_state);
+      queue_output(output_chunk(buffer, &stderr_prefix(), &output_suffix(), true, SESSION_CREATED), false);
    }
 }
 
+void session_base::add_log(const char *data, size_t len)
+{
+   queue_output(output_chunk(output_buffer(new std::string(data, len)), 0, 0, false, SESSION_CREATED), false);
+}
+
+void session_base::queue_output(const output_chunk& chunk, bool essential)
+{
+   /*
+    *  This can be called from any thread. Output that isn't essential to
+    *  the session (i.e. anything but prompts and command results) is
+    *  dropped once the client falls too far behind, so that a stuck
+    *  client can neither stall the application nor eat up its memory.
+    */
+
+   bool start_writing = false;
+
+   {
+      mutex::scoped_lock lock(m_out_mutex);
+
+      if (m_out_closed)
+      {
+         return;
+      }
+
+      size_t size = chunk.size();
+
+      if (!essential && m_out_bytes + size > m_srv.session_buffer_size())
+      {
+         m_out_dropped += size;
+         m_out_dropped_total += size;
+         m_dropped_metric += size;
+         return;
+      }
+
+      queue_dropped_notice();
+
+      m_out_queue.push_back(chunk);
+      m_out_bytes += size;
+
+      if (!m_out_writing)
+      {
+         m_out_writing = start_writing = true;
+      }
+   }
+
+   if (start_writing)
+   {
+      m_strand.post(bind(&session_base::write_more, shared_from_this()));
+   }
+}
+
+void session_base::queue_dropped_notice()
+{
+   // m_out_mutex must be locked
+
+   if (m_out_dropped > 0)
+   {
+      std::ostringstream oss;
+      oss << terminal_format::reset() << "\r\n*** " << m_out_dropped << " bytes of output dropped (client too slow) ***\r\n";
+      output_buffer notice(new std::string(oss.str()));
+
+      m_out_queue.push_back(output_chunk(notice, 0, 0, false, SESSION_CREATED));
+      m_out_bytes += notice->size();
+      m_out_dropped = 0;
+   }
+}
+
+void session_base::write_more()
+{
+   output_buffers buffers;
+   bool err = false;
+
+   {
+      mutex::scoped_lock lock(m_out_mutex);
+
+      if (m_out_closed || m_out_queue.empty())
+      {
+         m_out_writing = false;
+         return;
+      }
+
+      // gather as many chunks as possible into a single write
+
+      err = m_out_queue.front().err;
+
+      while (!m_out_queue.empty() && m_out_inflight.size() < max_gather_chunks && m_out_queue.front().err == err)
+      {
+         const output_chunk& c = m_out_queue.front();
+
+         if (c.prefix)
+         {
+            buffers.push_back(asio::buffer(*c.prefix));
+         }
+
+         buffers.push_back(asio::buffer(*c.data));
+
+         if (c.suffix)
+         {
+            buffers.push_back(asio::buffer(*c.suffix));
+         }
+
+         m_out_inflight.push_back(c);
+         m_out_queue.pop_front();
+      }
+   }
+
+   write_buffers(buffers, err, m_strand.wrap(bind(&session_base::on_write_done, shared_from_this(),
+         asio::placeholders::error, asio::placeholders::bytes_transferred)));
+}
+
 template <typename T>
 void session_base::get_more_help(std::ostream& os, const T& obj) const
 {
@@ -596,35 +798,44 @@ void session_base::get_help(std::string& rv) const
    rv = oss.str();
 }
 
-void session_base::on_write_done(std::string *s, state st, const system::error_code& error)
+void session_base::on_write_done(const system::error_code& error, size_t /* bytes_transferred */)
 {
+   state st = SESSION_CREATED;
+
+   {
+      mutex::scoped_lock lock(m_out_mutex);
+
+      foreach (const output_chunk& c, m_out_inflight)
+      {
+         st = std::max(st, c.st);
+         m_out_bytes -= c.size();
+      }
+
+      m_out_inflight.clear();
+   }
+
    if (st > m_state)
    {
       m_state = st;
    }
 
-   delete s;
-
-   if (!error)
+   if (error || m_state >= SESSION_STOPPING)
    {
-      switch (m_state)
-      {
-         case SESSION_ATTACHED:
-            break;
+      handle_stop();
+      return;
+   }
 
-         case SESSION_STOPPING:
-            handle_stop();
-            break;
+   {
+      mutex::scoped_lock lock(m_out_mutex);
 
-         default:
-            handle_stop();
-            break;
+      if (m_out_queue.empty())
+      {
+         // let the client know if we had to drop anything
+         queue_dropped_notice();
       }
    }
-   else if (!is_stopped())
-   {
-      handle_stop();
-   }
+
+   write_more();
 }
 
 void session_base::on_read_done(const system::error_code& error, size_t bytes_transferred)
@@ -684,6 +895,27 @@ void session_base::process_input()
    }
 }
 
+void session_base::stop(const std::string& msg)
+{
+   if (is_attached())
+   {
+      write("\r\n" + msg, SESSION_STOPPING);
+
+      // don't let a client that doesn't read its output hold up the shutdown
+      m_stop_timer.expires_from_now(boost::posix_time::seconds(2));
+      m_stop_timer.async_wait(m_strand.wrap(bind(&session_base::on_stop_timeout, shared_from_this(),
+            asio::placeholders::error)));
+   }
+}
+
+void session_base::on_stop_timeout(const system::error_code& error)
+{
+   if (!error)
+   {
+      handle_stop();
+   }
+}
+
 void session_base::command_result(bool handled, const std::string& cmd, const std::string& rv)
 {
    if (handled)
@@ -734,6 +966,15 @@ void session_base::handle_stop()
 {
    if (!is_stopped())
    {
+      system::error_code ec;
+      m_stop_timer.cancel(ec);
+
+      {
+         mutex::scoped_lock lock(m_out_mutex);
+         m_out_closed = true;
+         m_out_queue.clear();
+      }
+
       close();
 
       if (is_attached())
@@ -761,7 +1002,7 @@ bool session_base::handle_command(std::string& rv, const std::string& cmd, const
    }
    else if (m_enable_cout_cerr && (cmd == "cerr" || cmd == "cout"))
    {
-      bool *var = cmd == "cerr" ? &m_cerr_on : &m_cout_on;
+      boost::atomic<bool> *var = cmd == "cerr" ? &m_cerr_on : &m_cout_on;
 
       if (args == "on")
       {
@@ -849,6 +1090,7 @@ bool session_base::read_next_command(std::string& cmd, std::string& args)
 
 remote_shell_server_impl::remote_shell_server_impl(shared_ptr<asio::io_service> ios)
    : m_ios(ios)
+   , m_strand(*ios)
    , m_app_factory(new null_appender_factory)
 #ifdef BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR
    , m_stdout(*ios)
@@ -859,6 +1101,8 @@ remote_shell_server_impl::remote_shell_server_impl(shared_ptr<asio::io_service>
    , m_enable_local(false)
    , m_can_snoop_stdio(false)
    , m_listen_port(0)
+   , m_num_threads(1)
+   , m_session_buffer_size(256*1024)
    , m_pre_shutdown_func(noop_pre_shutdown_func())
 {
 }
@@ -877,32 +1121,54 @@ bool remote_shell_server_impl::snoop_stdio(posix_stream_stealer& stealer, FILE *
 
    bsd->assign(stealer.get_pipe_fd());
 
-   stdio_read_more(bsd, cb, new char[BUFSIZ]);
+   stdio_read_more(bsd, cb, shared_ptr<std::string>(new std::string(BUFSIZ, '\0')));
 
    return true;
 }
 
-void remote_shell_server_impl::on_stdio_read(stdstream *bsd, session_meth cb, const system::error_code& error, char *buffer, size_t count)
+void remote_shell_server_impl::on_stdio_read(stdstream *bsd, session_meth cb, const system::error_code& error, shared_ptr<std::string> buffer, size_t count)
 {
    if (error)
    {
-      delete[] buffer;
       return;
    }
 
-   foreach(session_ptr s, m_sessions)
+   /*
+    *  The output is handed to all sessions as a single shared buffer. Large
+    *  reads give away the read buffer itself, small ones are copied so the
+    *  sessions don't keep a mostly empty buffer alive.
+    */
+
+   output_buffer out;
+
+   if (count >= BUFSIZ/4)
+   {
+      buffer->resize(count);
+      out = buffer;
+      buffer.reset(new std::string(BUFSIZ, '\0'));
+   }
+   else
+   {
+      out.reset(new std::string(buffer->data(), count));
+   }
+
    {
-      (s.get()->*cb)(buffer, count);
+      mutex::scoped_lock lock(m_sessions_mutex);
+
+      foreach(session_ptr s, m_sessions)
+      {
+         (s.get()->*cb)(out);
+      }
    }
 
    stdio_read_more(bsd, cb, buffer);
 }
 
-void remote_shell_server_impl::stdio_read_more(stdstream *bsd, session_meth cb, char *buffer)
+void remote_shell_server_impl::stdio_read_more(stdstream *bsd, session_meth cb, shared_ptr<std::string> buffer)
 {
-   bsd->async_read_some(asio::buffer(buffer, BUFSIZ),
-       bind(&remote_shell_server_impl::on_stdio_read, this, bsd, cb,
-         asio::placeholders::error, buffer, asio::placeholders::bytes_transferred));
+   bsd->async_read_some(asio::buffer(&(*buffer)[0], buffer->size()),
+       m_strand.wrap(bind(&remote_shell_server_impl::on_stdio_read, this, bsd, cb,
+         asio::placeholders::error, buffer, asio::placeholders::bytes_transferred)));
 }
 #endif
 
@@ -959,7 +1225,7 @@ bool remote_shell_server_impl::create_console_session(remote_shell_iface *rsi, s
 
    new_session.reset(new session<session_io_console, false, true>(*this, rsi, io, m_can_snoop_stdio));
 
-   writer.reset(new session_writer<session_io_console>(io));
+   writer.reset(new session_writer(new_session));
 
    return true;
 
@@ -981,7 +1247,7 @@ bool remote_shell_server_impl::create_console_session(remote_shell_iface *rsi, s
 
    new_session.reset(new session<session_io_console, false, false>(*this, rsi, io, m_can_snoop_stdio));
 
-   writer.reset(new session_writer<session_io_console>(io));
+   writer.reset(new session_writer(new_session));
 
    return true;
 
@@ -1005,7 +1271,7 @@ bool remote_shell_server_impl::setup_console_session(remote_shell_iface *rsi)
    session->set_stdout_state(m_default_stdout_state);
    session->set_stderr_state(m_default_stderr_state);
 
-   m_sessions.insert(session);
+   add_session(session);
 
    session->start(m_app_factory->create(writer));
 
@@ -1014,7 +1280,7 @@ bool remote_shell_server_impl::setup_console_session(remote_shell_iface *rsi)
 
 void remote_shell_server_impl::stop(const std::string& msg)
 {
-   m_ios->post(bind(&remote_shell_server_impl::handle_stop, this, msg));
+   m_strand.post(bind(&remote_shell_server_impl::handle_stop, this, msg));
 }
 
 void remote_shell_server_impl::handle_accept(socket_ptr socket, remote_shell_iface *rsi, const system::error_code& error)
@@ -1024,12 +1290,12 @@ void remote_shell_server_impl::handle_accept(socket_ptr socket, remote_shell_ifa
       shared_ptr<session_io_socket> io(new session_io_socket(socket));
       session_ptr new_session(new session<session_io_socket>(*this, rsi, io, m_can_snoop_stdio));
 
-      stream_writer_ptr writer(new session_writer<session_io_socket>(io));
+      stream_writer_ptr writer(new session_writer(new_session));
 
       new_session->set_stdout_state(m_default_stdout_state);
       new_session->set_stderr_state(m_default_stderr_state);
 
-      m_sessions.insert(new_session);
+      add_session(new_session);
 
       new_session->start(m_app_factory->create(writer));
 
@@ -1042,15 +1308,34 @@ void remote_shell_server_impl::accept_session(remote_shell_iface *rsi)
    socket_ptr socket(new tcp::socket(*m_ios));
 
    m_acceptor->async_accept(*socket,
-       bind(&remote_shell_server_impl::handle_accept,
-         this, socket, rsi, asio::placeholders::error));
+       m_strand.wrap(bind(&remote_shell_server_impl::handle_accept,
+         this, socket, rsi, asio::placeholders::error)));
+}
+
+void remote_shell_server_impl::add_session(session_ptr p)
+{
+   mutex::scoped_lock lock(m_sessions_mutex);
+   m_sessions.insert(p);
 }
 
 void remote_shell_server_impl::remove_session(session_ptr p)
 {
+   mutex::scoped_lock lock(m_sessions_mutex);
    m_sessions.erase(p);
 }
 
+bool remote_shell_server_impl::has_session(session_ptr p) const
+{
+   mutex::scoped_lock lock(m_sessions_mutex);
+   return m_sessions.find(p) != m_sessions.end();
+}
+
+void remote_shell_server_impl::get_sessions(std::vector<session_ptr>& sessions) const
+{
+   mutex::scoped_lock lock(m_sessions_mutex);
+   sessions.assign(m_sessions.begin(), m_sessions.end());
+}
+
 void remote_shell_server_impl::handle_stop(const std::string& msg)
 {
    if (m_acceptor)
@@ -1058,12 +1343,15 @@ void remote_shell_server_impl::handle_stop(const std::string& msg)
       m_acceptor->close();
    }
 
-   foreach(session_ptr s, m_sessions)
+   std::vector<session_ptr> sessions;
+   get_sessions(sessions);
+
+   foreach(session_ptr s, sessions)
    {
-      m_ios->post(bind(&session_base::stop, s, msg));
+      s->post_stop(msg);
    }
 
-   m_ios->post(bind(&remote_shell_server_impl::pre_shutdown, this));
+   m_strand.post(bind(&remote_shell_server_impl::pre_shutdown, this));
 }
 
 void remote_shell_server_impl::pre_shutdown()
@@ -1075,8 +1363,11 @@ void remote_shell_server_impl::pre_shutdown()
 void remote_shell_server_impl::get_sessions_list(std::string& rv)
 {
    std::ostringstream oss;
+   std::vector<session_ptr> sessions;
+
+   get_sessions(sessions);
 
-   foreach(session_ptr s, m_sessions)
+   foreach(session_ptr s, sessions)
    {
       oss << s->get_info() << "\r\n";
    }
@@ -1150,9 +1441,9 @@ void remote_shell_server_impl::command_thread(remote_shell_iface *rsi)
          rv = oss.str();
       }
 
-      if (m_sessions.find(cmd.session) != m_sessions.end())
+      if (has_session(cmd.session))
       {
-         m_ios->post(bind(&session_base::command_result, cmd.session, handled, cmd.cmd, rv));
+         cmd.session->post_command_result(handled, cmd.cmd, rv);
       }
    }
 }
@@ -1187,6 +1478,21 @@ void remote_shell_server_impl::enable_local_shell(bool enabled)
    m_enable_local = enabled;
 }
 
+void remote_shell_server_impl::set_num_threads(size_t num_threads)
+{
+   m_num_threads = std::max(num_threads, size_t(1));
+}
+
+void remote_shell_server_impl::set_session_buffer_size(size_t bytes)
+{
+   m_session_buffer_size = bytes;
+}
+
+void remote_shell_server_impl::io_thread()
+{
+   m_ios->run();
+}
+
 void remote_shell_server_impl::run(remote_shell_iface *rsi)
 {
    if (m_listen_port == 0 && !m_enable_local)
@@ -1221,8 +1527,17 @@ void remote_shell_server_impl::run(remote_shell_iface *rsi)
 
    m_cmd_runner.reset(new thread(boost::bind(&remote_shell_server_impl::command_thread, this, rsi)));
 
+   thread_group io_threads;
+
+   for (size_t i = 1; i < m_num_threads; ++i)
+   {
+      io_threads.create_thread(boost::bind(&remote_shell_server_impl::io_thread, this));
+   }
+
    m_ios->run();
 
+   io_threads.join_all();
+
    {
       mutex::scoped_lock lock(m_cmd_queue_mutex);
       m_cmd_queue.push(command()); // shutdown thread
@@ -1284,3 +1599,12 @@ void remote_shell_server::enable_local_shell(bool enabled)
    m_impl->enable_local_shell(enabled);
 }
 
+void remote_shell_server::set_num_threads(size_t num_threads)
+{
+   m_impl->set_num_threads(num_threads);
+}
+
+void remote_shell_server::set_session_buffer_size(size_t bytes)
+{
+   m_impl->set_session_buffer_size(bytes);
+}
@@ -0,0 +1,202 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Measures the throughput of async_writer against batched_async_writer
+ * (plain, gzip framed and with group fdatasync) for a number of producer
+ * threads writing short text lines, as an event log would.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string>
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+
+#include "../../../include/moost/io/async_writer.hpp"
+#include "../../../include/moost/io/batched_async_writer.hpp"
+#include "../../../include/moost/io/gzip_framing.hpp"
+#include "../../../include/moost/utils/stopwatch.hpp"
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+namespace {
+
+struct line
+{
+   std::string text;
+
+   line() {}
+   line(const std::string& t) : text(t) {}
+
+   void write(std::ostream& out)
+   {
+      out << text << '\n';
+   }
+};
+
+std::vector<line> make_lines(size_t count, size_t length)
+{
+   std::vector<line> lines(count);
+
+   for (size_t i = 0; i < count; ++i)
+   {
+      std::ostringstream oss;
+      oss << "event=" << i << " user=" << (i * 2654435761u) % 100000 << " payload=";
+      std::string text = oss.str();
+      text.resize(length, 'x');
+      lines[i] = line(text);
+   }
+
+   return lines;
+}
+
+template <class WriterT>
+void produce(WriterT& writer, const std::vector<line>& lines, size_t begin, size_t end)
+{
+   for (size_t i = begin; i < end; ++i)
+   {
+      writer.enqueue(lines[i]);
+   }
+}
+
+template <class WriterT>
+void run(const std::string& name, WriterT& writer, const std::vector<line>& lines, size_t producers, size_t length)
+{
+   moost::utils::stopwatch sw;
+
+   boost::thread_group threads;
+   size_t const chunk = lines.size() / producers;
+   for (size_t t = 0; t < producers; ++t)
+   {
+      size_t const end = t + 1 == producers ? lines.size() : (t + 1) * chunk;
+      threads.create_thread(boost::bind(&produce<WriterT>, boost::ref(writer), boost::cref(lines), t * chunk, end));
+   }
+   threads.join_all();
+   writer.stop();
+
+   double const secs = sw.elapsed_us() / 1e6;
+
+   std::cout << std::left << std::setw(28) << name << std::right << std::fixed
+             << std::setw(14) << std::setprecision(0) << lines.size() / secs
+             << std::setw(12) << std::setprecision(1) << lines.size() * (length + 1) / secs / 1e6
+             << std::endl;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   size_t num_lines;
+   size_t length;
+   size_t producers;
+   int sync_ms;
+   size_t max_queue;
+   std::string dir;
+
+   po::options_description opt("Options");
+   opt.add_options()
+      ("help,h", "show this help")
+      ("lines,n", po::value<size_t>(&num_lines)->default_value(1000000), "number of lines to write")
+      ("length,l", po::value<size_t>(&length)->default_value(120), "length of each line")
+      ("producers,p", po::value<size_t>(&producers)->default_value(4), "number of producer threads")
+      ("sync-ms,s", po::value<int>(&sync_ms)->default_value(100), "group fdatasync interval")
+      ("max-queue,q", po::value<size_t>(&max_queue)->default_value(10000), "maximum queue length before producers block")
+      ("dir,d", po::value<std::string>(&dir)->default_value("async_writer_benchmark"), "scratch directory (removed afterwards)")
+      ;
+
+   po::variables_map vm;
+
+   try
+   {
+      po::store(po::parse_command_line(argc, argv, opt), vm);
+      po::notify(vm);
+   }
+   catch (const std::exception& e)
+   {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      return 1;
+   }
+
+   if (vm.count("help"))
+   {
+      std::cout << opt << std::endl;
+      return 0;
+   }
+
+   if (producers == 0)
+   {
+      producers = 1;
+   }
+
+   std::vector<line> lines = make_lines(num_lines, length);
+
+   fs::path base(dir);
+   fs::remove_all(base);
+   fs::create_directory(base);
+
+   std::cout << std::left << std::setw(28) << "writer" << std::right
+             << std::setw(14) << "lines/s"
+             << std::setw(12) << "MB/s"
+             << std::endl;
+
+   {
+      moost::io::async_writer<line> writer((base / "async_writer").string(), moost::io::count_rollover(), max_queue);
+      run("async_writer", writer, lines, producers, length);
+   }
+
+   {
+      moost::io::batched_async_writer<line> writer((base / "batched").string(),
+         moost::io::count_rollover(), moost::io::raw_framing(), max_queue);
+      run("batched_async_writer", writer, lines, producers, length);
+      std::cout << "  (" << writer.items_written() / (writer.batches_written() ? writer.batches_written() : 1)
+                << " lines per batch)" << std::endl;
+   }
+
+   {
+      moost::io::batched_async_writer<line> writer((base / "batched_sync").string(),
+         moost::io::count_rollover(), moost::io::raw_framing(), max_queue, 0, sync_ms);
+      run("batched (group sync)", writer, lines, producers, length);
+   }
+
+   {
+      moost::io::batched_async_writer<line, moost::io::count_rollover, moost::io::gzip_framing> writer((base / "batched_gzip").string(),
+         moost::io::count_rollover(), moost::io::gzip_framing(), max_queue);
+      run("batched (gzip)", writer, lines, producers, length);
+   }
+
+   fs::remove_all(base);
+
+   return 0;
+}
@@ -0,0 +1,195 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Compares memory usage, false positive rate and throughput of the
+ * filter family (bit_filter, blocked_bloom_filter, cuckoo_filter) for a
+ * given number of items and target false positive rate.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <string>
+
+#include <boost/program_options.hpp>
+#include <boost/cstdint.hpp>
+
+#include "../../../include/moost/container/bit_filter.hpp"
+#include "../../../include/moost/container/bloom_filter.hpp"
+#include "../../../include/moost/container/cuckoo_filter.hpp"
+#include "../../../include/moost/container/detail/filter_support.hpp"
+#include "../../../include/moost/utils/stopwatch.hpp"
+
+namespace po = boost::program_options;
+
+namespace {
+
+typedef std::vector<size_t> items_t;
+
+struct scrambled_hash
+{
+   size_t operator()(size_t item) const
+   {
+      return static_cast<size_t>(moost::container::filter_types::mix64(item));
+   }
+};
+
+void make_items(items_t& items, size_t count, size_t salt)
+{
+   items.resize(count);
+
+   for (size_t i = 0; i < count; ++i)
+   {
+      items[i] = static_cast<size_t>(moost::container::filter_types::mix64(2*i + salt));
+   }
+}
+
+void report(const std::string& name, size_t memory, size_t false_positives, size_t probes,
+            double insert_us, double hit_us, double miss_us, size_t items)
+{
+   std::cout << std::left << std::setw(24) << name << std::right
+             << std::setw(12) << memory
+             << std::fixed
+             << std::setw(12) << std::setprecision(2) << 8.0*memory/items
+             << std::setw(14) << std::setprecision(5) << static_cast<double>(false_positives)/probes
+             << std::setw(12) << std::setprecision(1) << 1e3*insert_us/items
+             << std::setw(12) << std::setprecision(1) << 1e3*hit_us/items
+             << std::setw(12) << std::setprecision(1) << 1e3*miss_us/probes
+             << std::endl;
+}
+
+template <class FilterT>
+void run_common(const std::string& name, FilterT& filter, const items_t& items, const items_t& others)
+{
+   moost::utils::stopwatch sw;
+
+   sw.restart();
+   for (items_t::const_iterator it = items.begin(); it != items.end(); ++it)
+   {
+      filter.insert(*it);
+   }
+   double const insert_us = sw.elapsed_us();
+
+   sw.restart();
+   size_t const hits = filter.find(items.begin(), items.end());
+   double const hit_us = sw.elapsed_us();
+
+   sw.restart();
+   size_t const false_positives = filter.find(others.begin(), others.end());
+   double const miss_us = sw.elapsed_us();
+
+   if (hits != items.size())
+   {
+      std::cerr << name << ": false negatives detected!" << std::endl;
+   }
+
+   report(name, filter.memory(), false_positives, others.size(), insert_us, hit_us, miss_us, items.size());
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   size_t num_items;
+   size_t num_probes;
+   double fpr;
+
+   po::options_description opt("Options");
+   opt.add_options()
+      ("help,h", "show this help")
+      ("items,n", po::value<size_t>(&num_items)->default_value(1000000), "number of items to insert")
+      ("probes,p", po::value<size_t>(&num_probes)->default_value(1000000), "number of negative lookups")
+      ("fpr,f", po::value<double>(&fpr)->default_value(0.01), "target false positive rate")
+      ;
+
+   po::variables_map vm;
+
+   try
+   {
+      po::store(po::parse_command_line(argc, argv, opt), vm);
+      po::notify(vm);
+   }
+   catch (const std::exception& e)
+   {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      return 1;
+   }
+
+   if (vm.count("help"))
+   {
+      std::cout << opt << std::endl;
+      return 0;
+   }
+
+   items_t items, others;
+   make_items(items, num_items, 0);
+   make_items(others, num_probes, 1);
+
+   std::cout << std::left << std::setw(24) << "filter" << std::right
+             << std::setw(12) << "bytes"
+             << std::setw(12) << "bits/item"
+             << std::setw(14) << "fpr"
+             << std::setw(12) << "ins ns"
+             << std::setw(12) << "hit ns"
+             << std::setw(12) << "miss ns"
+             << std::endl;
+
+   moost::container::blocked_bloom_filter<size_t> bloom(num_items, fpr);
+   run_common("blocked_bloom_filter", bloom, items, others);
+
+   {
+      // same probes, but through the batched (prefetching) interface
+      moost::utils::stopwatch sw;
+      std::vector<char> result(std::max(items.size(), others.size()));
+      size_t const fp = bloom.find_batch(&others[0], others.size(), reinterpret_cast<bool *>(&result[0]));
+      double const miss_us = sw.elapsed_us();
+      sw.restart();
+      bloom.find_batch(&items[0], items.size(), reinterpret_cast<bool *>(&result[0]));
+      double const hit_us = sw.elapsed_us();
+      report("blocked_bloom (batch)", bloom.memory(), fp, others.size(), 0.0, hit_us, miss_us, items.size());
+   }
+
+   // bit_filter with the same number of bits as the blocked Bloom filter
+   moost::container::bit_filter<size_t, scrambled_hash> bits(bloom.size());
+   run_common("bit_filter (same size)", bits, items, others);
+   bits.optimize();
+   std::cout << "  (bit_filter after optimize(): " << bits.memory() << " bytes)" << std::endl;
+
+   try
+   {
+      moost::container::cuckoo_filter<size_t> cuckoo(num_items, fpr);
+      run_common("cuckoo_filter", cuckoo, items, others);
+   }
+   catch (const std::exception& e)
+   {
+      std::cout << std::left << std::setw(24) << "cuckoo_filter" << e.what() << std::endl;
+   }
+
+   return 0;
+}
@@ -0,0 +1,173 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Measures how many records per second can be fetched from a Kyoto Tycoon
+ * store one key at a time, with single bulk calls and with pipelined bulk
+ * calls on a connection pool, and from a warm local cache. Runs against the in-process mock connection
+ * with a simulated round trip latency, so no server is needed.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <algorithm>
+
+#include <boost/program_options.hpp>
+
+#include "../../../include/moost/kvstore/mock_connection.hpp"
+#include "../../../include/moost/kvstore/kyoto_tycoon_connection_pool.hpp"
+#include "../../../include/moost/kvstore/caching_kyoto_tycoon_connection.hpp"
+#include "../../../include/moost/utils/stopwatch.hpp"
+
+namespace po = boost::program_options;
+
+using namespace moost::kvstore;
+
+namespace {
+
+typedef MockKyotoTycoonConnection<> connection_t;
+typedef KyotoTycoonConnectionPool<connection_t> pool_t;
+
+void report(const std::string& name, size_t records, double secs)
+{
+   std::cout << std::left << std::setw(28) << name << std::right << std::fixed
+             << std::setw(14) << std::setprecision(0) << records / secs
+             << std::setw(14) << connection_t::round_trips()
+             << std::endl;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   size_t num_keys;
+   size_t batch_size;
+   size_t pool_size;
+   int latency_us;
+
+   po::options_description opt("Options");
+   opt.add_options()
+      ("help,h", "show this help")
+      ("keys,n", po::value<size_t>(&num_keys)->default_value(5000), "number of records to fetch")
+      ("batch-size,b", po::value<size_t>(&batch_size)->default_value(100), "keys per bulk round trip")
+      ("pool-size,p", po::value<size_t>(&pool_size)->default_value(8), "number of pooled connections")
+      ("latency-us,l", po::value<int>(&latency_us)->default_value(1000), "simulated round trip latency in microseconds")
+      ;
+
+   po::variables_map vm;
+
+   try
+   {
+      po::store(po::parse_command_line(argc, argv, opt), vm);
+      po::notify(vm);
+   }
+   catch (const std::exception& e)
+   {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      return 1;
+   }
+
+   if (vm.count("help"))
+   {
+      std::cout << opt << std::endl;
+      return 0;
+   }
+
+   IKyotoTycoonConnection::key_list_t keys;
+   IKyotoTycoonConnection::record_map_t recs;
+
+   for (size_t i = 0; i < num_keys; ++i)
+   {
+      std::ostringstream oss;
+      oss << "key" << i;
+      keys.push_back(oss.str());
+      recs[oss.str()] = std::string(64, 'x');
+   }
+
+   connection_t conn;
+   conn.open("", 0, 0);
+   conn.set_bulk(recs);
+
+   connection_t::set_round_trip_latency_us(latency_us);
+
+   std::cout << std::left << std::setw(28) << "method" << std::right
+             << std::setw(14) << "records/s"
+             << std::setw(14) << "round trips"
+             << std::endl;
+
+   {
+      connection_t::reset_round_trips();
+      moost::utils::stopwatch sw;
+      for (IKyotoTycoonConnection::key_list_t::const_iterator it = keys.begin(); it != keys.end(); ++it)
+      {
+         size_t vsize;
+         conn.get(it->data(), it->size(), vsize);
+      }
+      report("get", keys.size(), sw.elapsed_us() / 1e6);
+   }
+
+   {
+      connection_t::reset_round_trips();
+      IKyotoTycoonConnection::record_map_t out;
+      moost::utils::stopwatch sw;
+      for (size_t i = 0; i < keys.size(); i += batch_size)
+      {
+         IKyotoTycoonConnection::key_list_t batch(keys.begin() + i, keys.begin() + std::min(keys.size(), i + batch_size));
+         conn.get_bulk(batch, out);
+      }
+      report("get_bulk", keys.size(), sw.elapsed_us() / 1e6);
+   }
+
+   {
+      pool_t pool("", 0, 0, pool_size, -1, batch_size);
+      connection_t::reset_round_trips();
+      IKyotoTycoonConnection::record_map_t out;
+      moost::utils::stopwatch sw;
+      pool.get_bulk(keys, out);
+      report("pooled pipelined get_bulk", keys.size(), sw.elapsed_us() / 1e6);
+   }
+
+   {
+      KyotoTycoonCache cache(2*keys.size());
+      CachingKyotoTycoonConnection cached(conn, cache);
+      IKyotoTycoonConnection::record_map_t out;
+      cached.get_bulk(keys, out);
+
+      connection_t::reset_round_trips();
+      moost::utils::stopwatch sw;
+      for (IKyotoTycoonConnection::key_list_t::const_iterator it = keys.begin(); it != keys.end(); ++it)
+      {
+         size_t vsize;
+         cached.get(it->data(), it->size(), vsize);
+      }
+      report("cached get (warm)", keys.size(), sw.elapsed_us() / 1e6);
+   }
+
+   return 0;
+}
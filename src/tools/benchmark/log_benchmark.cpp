@@ -0,0 +1,236 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Measures the per-call cost of the MLOG macros as seen by the logging
+ * threads, synchronously and through the async logger with each overflow
+ * policy, with stream expressions and with log_format. The cost is the CPU time of the logging threads, so the
+ * dispatcher's work doesn't count towards it even when it has to share a
+ * core with them. The appender writes a formatted line per record to a file
+ * (/dev/null by default), so that each record costs a system call as it
+ * would with a real file appender.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+
+#include <log4cxx/appenderskeleton.h>
+#include <log4cxx/helpers/pool.h>
+#include <log4cxx/spi/loggingevent.h>
+
+#include "../../../include/moost/logging/logger.hpp"
+#include "../../../include/moost/utils/stopwatch.hpp"
+
+namespace po = boost::program_options;
+namespace ml = moost::logging;
+
+namespace {
+
+boost::int64_t thread_cpu_ns()
+{
+   struct timespec ts;
+   ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+   return boost::int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+class fd_appender : public log4cxx::AppenderSkeleton
+{
+public:
+   explicit fd_appender(int fd) : fd_(fd) {}
+
+   void append(log4cxx::spi::LoggingEventPtr const & event, log4cxx::helpers::Pool &)
+   {
+      std::string line;
+      event->getLevel()->toString(line);
+      line += " [";
+      line.append(event->getLoggerName().begin(), event->getLoggerName().end());
+      line += "] ";
+      line.append(event->getMessage().begin(), event->getMessage().end());
+      line += '\n';
+      ssize_t rv = ::write(fd_, line.data(), line.size());
+      (void) rv;
+   }
+
+   void close() {}
+   bool requiresLayout() const { return false; }
+
+private:
+   int fd_;
+};
+
+enum style
+{
+   DISABLED,   // a level the logger isn't enabled for
+   STREAM,     // MLOG_INFO with a stream expression
+   FORMAT      // MLOG_FMT_INFO with a log_format
+};
+
+void produce(log4cxx::LoggerPtr logger, size_t count, style how, boost::atomic<boost::int64_t> & total_ns)
+{
+   boost::int64_t const start = thread_cpu_ns();
+
+   switch (how)
+   {
+      case DISABLED:
+         for (size_t i = 0; i < count; ++i)
+            MLOG_TRACE(logger, "request " << i << " took " << (i % 1000) / 10.0 << "ms for user " << i * 2654435761u % 100000);
+         break;
+
+      case STREAM:
+         for (size_t i = 0; i < count; ++i)
+            MLOG_INFO(logger, "request " << i << " took " << (i % 1000) / 10.0 << "ms for user " << i * 2654435761u % 100000);
+         break;
+
+      case FORMAT:
+         for (size_t i = 0; i < count; ++i)
+            MLOG_FMT_INFO(logger, ml::log_format("request {} took {}ms for user {}") % i % ((i % 1000) / 10.0) % (i * 2654435761u % 100000));
+         break;
+   }
+
+   total_ns += thread_cpu_ns() - start;
+}
+
+void run(const std::string & name, log4cxx::LoggerPtr logger, size_t threads, size_t count, style how)
+{
+   ml::async_logger & async = ml::async_logger_singleton::instance();
+   ml::async_logger_stats before = async.stats();
+   boost::atomic<boost::int64_t> total_ns(0);
+
+   moost::utils::stopwatch sw;
+
+   boost::thread_group group;
+   for (size_t t = 0; t < threads; ++t)
+      group.create_thread(boost::bind(&produce, logger, count, how, boost::ref(total_ns)));
+   group.join_all();
+
+   double const produce_ms = sw.elapsed_us() / 1e3;
+   async.flush();
+   double const total_ms = sw.elapsed_us() / 1e3;
+
+   ml::async_logger_stats after = async.stats();
+
+   std::cout << std::left << std::setw(20) << name << std::right << std::fixed
+             << std::setw(12) << std::setprecision(0) << double(total_ns.load()) / (threads * count)
+             << std::setw(12) << std::setprecision(1) << produce_ms
+             << std::setw(12) << std::setprecision(1) << total_ms
+             << std::setw(12) << (after.dropped - before.dropped) + (after.sampled_out - before.sampled_out)
+             << std::endl;
+}
+
+void run_async(const std::string & name, log4cxx::LoggerPtr logger, size_t threads, size_t count,
+               style how, size_t ring, ml::async_overflow_policy::type policy)
+{
+   ml::async_logger & async = ml::async_logger_singleton::instance();
+   async.start(ring, policy);
+   run(name, logger, threads, count, how);
+   async.stop();
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   size_t count;
+   size_t threads;
+   size_t ring;
+   std::string path;
+
+   po::options_description opt("Options");
+   opt.add_options()
+      ("help,h", "show this help")
+      ("count,n", po::value<size_t>(&count)->default_value(200000), "records logged by each thread")
+      ("threads,t", po::value<size_t>(&threads)->default_value(4), "number of logging threads")
+      ("ring,r", po::value<size_t>(&ring)->default_value(8192), "async ring capacity per thread")
+      ("output,o", po::value<std::string>(&path)->default_value("/dev/null"), "file the appender writes to")
+      ;
+
+   po::variables_map vm;
+
+   try
+   {
+      po::store(po::parse_command_line(argc, argv, opt), vm);
+      po::notify(vm);
+   }
+   catch (const std::exception& e)
+   {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      return 1;
+   }
+
+   if (vm.count("help"))
+   {
+      std::cout << opt << std::endl;
+      return 0;
+   }
+
+   if (threads == 0)
+   {
+      threads = 1;
+   }
+
+   int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+   if (fd < 0)
+   {
+      std::cerr << "ERROR: cannot open " << path << std::endl;
+      return 1;
+   }
+
+   log4cxx::LoggerPtr logger = MLOG_NAMED_LOGGER("moost.log_benchmark");
+   logger->setAdditivity(false);
+   logger->setLevel(log4cxx::Level::getInfo());
+   logger->addAppender(log4cxx::AppenderPtr(new fd_appender(fd)));
+
+   std::cout << std::left << std::setw(20) << "backend" << std::right
+             << std::setw(12) << "cpu ns/call"
+             << std::setw(12) << "log ms"
+             << std::setw(12) << "total ms"
+             << std::setw(12) << "discarded"
+             << std::endl;
+
+   run("disabled level", logger, threads, count, DISABLED);
+   run("synchronous", logger, threads, count, STREAM);
+   run("synchronous fmt", logger, threads, count, FORMAT);
+   run_async("async (block)", logger, threads, count, STREAM, ring, ml::async_overflow_policy::BLOCK);
+   run_async("async (drop)", logger, threads, count, STREAM, ring, ml::async_overflow_policy::DROP);
+   run_async("async (sample)", logger, threads, count, STREAM, ring, ml::async_overflow_policy::SAMPLE);
+   run_async("async fmt (block)", logger, threads, count, FORMAT, ring, ml::async_overflow_policy::BLOCK);
+   run_async("async fmt (sample)", logger, threads, count, FORMAT, ring, ml::async_overflow_policy::SAMPLE);
+
+   logger->removeAllAppenders();
+   ::close(fd);
+
+   return 0;
+}
@@ -0,0 +1,157 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * The in-memory containers: lru and multi_map.
+ */
+
+#include <vector>
+#include <utility>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "../../../../include/moost/container/lru.hpp"
+#include "../../../../include/moost/container/multi_map.hpp"
+
+#include "suites.hpp"
+
+using namespace moost::container;
+using moost::utils::micro_benchmark;
+using moost::utils::do_not_optimize;
+
+namespace micro {
+
+namespace {
+
+typedef lru<boost::uint32_t, boost::uint32_t> lru_t;
+
+struct lru_fixture
+{
+   explicit lru_fixture(const suite_config& cfg)
+      : cache(cfg.elements)
+      , hits(cfg.elements, 2)
+      , misses(cfg.elements, 2, 1)
+      , churn(2*cfg.elements, 2)
+   {
+      for (size_t i = 0; i < cfg.elements; ++i)
+      {
+         cache.put(static_cast<boost::uint32_t>(2*i), static_cast<boost::uint32_t>(i));
+      }
+   }
+
+   lru_t cache;
+   key_sequence hits;
+   key_sequence misses;
+   key_sequence churn;   // twice as many keys as fit, so about every other put evicts
+};
+
+void lru_get(boost::shared_ptr<lru_fixture> f, const key_sequence *keys, boost::uint64_t n)
+{
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      boost::uint32_t val;
+      bool found = f->cache.get((*keys)[i], val);
+      do_not_optimize(found);
+   }
+}
+
+void lru_put(boost::shared_ptr<lru_fixture> f, boost::uint64_t n)
+{
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      f->cache.put(f->churn[i], static_cast<boost::uint32_t>(i));
+   }
+}
+
+void setup_lru(const suite_config& cfg, micro_benchmark::suite& s)
+{
+   boost::shared_ptr<lru_fixture> f(new lru_fixture(cfg));
+
+   // put goes last as it changes what's in the cache
+   s.add("get_hit", boost::bind(&lru_get, f, &f->hits, _1));
+   s.add("get_miss", boost::bind(&lru_get, f, &f->misses, _1));
+   s.add("put_evict", boost::bind(&lru_put, f, _1));
+}
+
+typedef multi_map<int, int> multi_map_t;
+
+struct multi_map_fixture
+{
+   explicit multi_map_fixture(const suite_config& cfg)
+      : map(multi_map_t::loc_map_policy_type(-1, cfg.elements))
+      , hits(cfg.elements, 2)
+      , misses(cfg.elements, 2, 1)
+   {
+      std::vector< std::pair<int, int> > data;
+      data.reserve(4*cfg.elements);
+
+      for (size_t i = 0; i < cfg.elements; ++i)
+      {
+         for (int v = 0; v < 4; ++v)
+         {
+            data.push_back(std::make_pair(static_cast<int>(2*i), v));
+         }
+      }
+
+      map.create_map<1>(data);
+   }
+
+   multi_map_t map;
+   key_sequence hits;
+   key_sequence misses;
+};
+
+void multi_map_lookup(boost::shared_ptr<multi_map_fixture> f, const key_sequence *keys, boost::uint64_t n)
+{
+   const multi_map_t& map = f->map;
+
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      multi_map_t::const_range r = map[static_cast<int>((*keys)[i])];
+      size_t size = r.size();
+      do_not_optimize(size);
+   }
+}
+
+void setup_multi_map(const suite_config& cfg, micro_benchmark::suite& s)
+{
+   boost::shared_ptr<multi_map_fixture> f(new multi_map_fixture(cfg));
+
+   s.add("lookup_hit", boost::bind(&multi_map_lookup, f, &f->hits, _1));
+   s.add("lookup_miss", boost::bind(&multi_map_lookup, f, &f->misses, _1));
+}
+
+}
+
+void add_container_suites(micro_benchmark& mb, const suite_config& cfg)
+{
+   mb.add_suite("lru", boost::bind(&setup_lru, cfg, _1));
+   mb.add_suite("multi_map", boost::bind(&setup_multi_map, cfg, _1));
+}
+
+}
@@ -0,0 +1,166 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Hash functions, for a 32-bit integer and for short and longer strings.
+ */
+
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/functional/hash.hpp>
+
+#include "../../../../include/moost/hash/murmur3.hpp"
+#include "../../../../include/moost/algorithm/fast_hash.hpp"
+
+#include "suites.hpp"
+
+using moost::hash::murmur3;
+using moost::algorithm::fast_hash;
+using moost::utils::micro_benchmark;
+using moost::utils::do_not_optimize;
+
+namespace micro {
+
+namespace {
+
+struct hash_fixture
+{
+   explicit hash_fixture(const suite_config& cfg)
+      : keys(cfg.elements)
+   {
+      for (size_t i = 0; i < 1024; ++i)
+      {
+         std::string s = "user:" + boost::lexical_cast<std::string>(i);
+         short_strings.push_back(s);
+         long_strings.push_back(s + std::string(256 - s.size(), 'x'));
+      }
+   }
+
+   const std::vector<std::string>& strings(bool want_long) const
+   {
+      return want_long ? long_strings : short_strings;
+   }
+
+   key_sequence keys;
+   std::vector<std::string> short_strings;
+   std::vector<std::string> long_strings;
+};
+
+void murmur3_int(boost::shared_ptr<hash_fixture> f, boost::uint64_t n)
+{
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      boost::uint32_t h = murmur3::compute32(f->keys[i], 0);
+      do_not_optimize(h);
+   }
+}
+
+void fast_hash_int(boost::shared_ptr<hash_fixture> f, boost::uint64_t n)
+{
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      boost::uint32_t key = f->keys[i];
+      size_t h = fast_hash(&key, sizeof(key));
+      do_not_optimize(h);
+   }
+}
+
+void boost_hash_int(boost::shared_ptr<hash_fixture> f, boost::uint64_t n)
+{
+   boost::hash<boost::uint32_t> hasher;
+
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      size_t h = hasher(f->keys[i]);
+      do_not_optimize(h);
+   }
+}
+
+void murmur3_string(boost::shared_ptr<hash_fixture> f, bool long_strings, boost::uint64_t n)
+{
+   const std::vector<std::string>& strings = f->strings(long_strings);
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      boost::uint32_t h = murmur3::compute32(strings[i & 1023], 0);
+      do_not_optimize(h);
+   }
+}
+
+void fast_hash_string(boost::shared_ptr<hash_fixture> f, bool long_strings, boost::uint64_t n)
+{
+   const std::vector<std::string>& strings = f->strings(long_strings);
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      const std::string& s = strings[i & 1023];
+      size_t h = fast_hash(s.data(), s.size());
+      do_not_optimize(h);
+   }
+}
+
+void boost_hash_string(boost::shared_ptr<hash_fixture> f, bool long_strings, boost::uint64_t n)
+{
+   const std::vector<std::string>& strings = f->strings(long_strings);
+   boost::hash<std::string> hasher;
+
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      size_t h = hasher(strings[i & 1023]);
+      do_not_optimize(h);
+   }
+}
+
+void add_string_cases(micro_benchmark::suite& s, const std::string& suffix,
+                      boost::shared_ptr<hash_fixture> f, bool long_strings)
+{
+   s.add("murmur3_" + suffix, boost::bind(&murmur3_string, f, long_strings, _1));
+   s.add("fast_hash_" + suffix, boost::bind(&fast_hash_string, f, long_strings, _1));
+   s.add("boost_hash_" + suffix, boost::bind(&boost_hash_string, f, long_strings, _1));
+}
+
+void setup_hash(const suite_config& cfg, micro_benchmark::suite& s)
+{
+   boost::shared_ptr<hash_fixture> f(new hash_fixture(cfg));
+
+   s.add("murmur3_uint32", boost::bind(&murmur3_int, f, _1));
+   s.add("fast_hash_uint32", boost::bind(&fast_hash_int, f, _1));
+   s.add("boost_hash_uint32", boost::bind(&boost_hash_int, f, _1));
+   add_string_cases(s, "short_string", f, false);
+   add_string_cases(s, "256b_string", f, true);
+}
+
+}
+
+void add_hash_suites(micro_benchmark& mb, const suite_config& cfg)
+{
+   mb.add_suite("hash", boost::bind(&setup_hash, cfg, _1));
+}
+
+}
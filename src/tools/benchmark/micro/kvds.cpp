@@ -0,0 +1,122 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Point lookups and overwrites against every IKvds backend, through the
+ * untyped interface so only the store itself is measured.
+ */
+
+#include <string>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "../../../../include/moost/kvds.hpp"
+#include "../../../../include/moost/io/tempdir.hpp"
+
+#include "suites.hpp"
+
+using namespace moost::kvds;
+using moost::utils::micro_benchmark;
+using moost::utils::do_not_optimize;
+
+namespace micro {
+
+namespace {
+
+struct kvds_fixture
+{
+   explicit kvds_fixture(const suite_config& cfg)
+      : dir(cfg.workdir + "/moost_micro_kvds_XXXXXX")
+      , hits(cfg.elements, 2)
+      , misses(cfg.elements, 2, 1)
+   {
+   }
+
+   moost::io::tempdir dir;    // first, so it's removed after the store is closed
+   boost::shared_ptr<IKvds> store;
+   key_sequence hits;
+   key_sequence misses;
+};
+
+void kvds_get(boost::shared_ptr<kvds_fixture> f, const key_sequence *keys, boost::uint64_t n)
+{
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      boost::uint32_t key = (*keys)[i];
+      boost::uint32_t val = 0;
+      size_t vsize = sizeof(val);
+      bool found = f->store->get(&key, sizeof(key), &val, vsize);
+      do_not_optimize(found);
+      do_not_optimize(val);
+   }
+}
+
+void kvds_put(boost::shared_ptr<kvds_fixture> f, boost::uint64_t n)
+{
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      boost::uint32_t key = f->hits[i];
+      boost::uint32_t val = static_cast<boost::uint32_t>(i);
+      f->store->put(&key, sizeof(key), &val, sizeof(val));
+   }
+}
+
+template <class StoreT>
+void setup_kvds(const suite_config& cfg, micro_benchmark::suite& s)
+{
+   boost::shared_ptr<kvds_fixture> f(new kvds_fixture(cfg));
+   boost::shared_ptr<StoreT> store(new StoreT);
+   store->open((f->dir.string() + "/store").c_str(), true);
+   f->store = store;
+
+   for (size_t i = 0; i < cfg.elements; ++i)
+   {
+      boost::uint32_t key = static_cast<boost::uint32_t>(2*i);
+      boost::uint32_t val = static_cast<boost::uint32_t>(i);
+      f->store->put(&key, sizeof(key), &val, sizeof(val));
+   }
+
+   s.add("get_hit", boost::bind(&kvds_get, f, &f->hits, _1));
+   s.add("get_miss", boost::bind(&kvds_get, f, &f->misses, _1));
+   s.add("put", boost::bind(&kvds_put, f, _1));
+}
+
+}
+
+void add_kvds_suites(micro_benchmark& mb, const suite_config& cfg)
+{
+   mb.add_suite("kvds.mem_map", boost::bind(&setup_kvds<KvdsMemMap>, cfg, _1));
+   mb.add_suite("kvds.page_store", boost::bind(&setup_kvds< KvdsPageStore< KvdsPageMapIntrinsicKey<boost::uint32_t> > >, cfg, _1));
+   mb.add_suite("kvds.page_store_nonintrinsic", boost::bind(&setup_kvds< KvdsPageStore< KvdsPageMapNonIntrinsicKey<> > >, cfg, _1));
+   mb.add_suite("kvds.tch", boost::bind(&setup_kvds<KvdsTch>, cfg, _1));
+   mb.add_suite("kvds.kch", boost::bind(&setup_kvds<KvdsKch>, cfg, _1));
+   mb.add_suite("kvds.bht", boost::bind(&setup_kvds<KvdsBht>, cfg, _1));
+   mb.add_suite("kvds.bbt", boost::bind(&setup_kvds<KvdsBbt>, cfg, _1));
+}
+
+}
@@ -0,0 +1,174 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Runs micro benchmarks for the hot paths in libmoost: the kvds backends,
+ * the memory mapped dataset sections, lru, multi_map, the partitioners,
+ * the hash functions and the thread pools.
+ *
+ * Results are printed as a table; --json writes them in a form that's easy
+ * to compare between builds:
+ *
+ *    moost-micro-benchmark --suite mmd --suite lru --json baseline.json
+ */
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <boost/program_options.hpp>
+
+#include "../../../../include/moost/utils/micro_benchmark.hpp"
+
+#include "suites.hpp"
+
+namespace po = boost::program_options;
+
+using moost::utils::micro_benchmark;
+
+int main(int argc, char **argv)
+{
+   micro_benchmark::options opt;
+   micro::suite_config cfg;
+   std::vector<std::string> suites;
+   std::string filter;
+   std::string clock;
+   std::string json;
+
+   po::options_description desc("Options");
+   desc.add_options()
+      ("help,h", "show this help")
+      ("list,l", "list all suites and exit")
+      ("suite,s", po::value< std::vector<std::string> >(&suites)->composing(), "run only this suite (can be repeated)")
+      ("filter,f", po::value<std::string>(&filter), "run only benchmarks with <suite>/<name> containing this string")
+      ("clock,c", po::value<std::string>(&clock)->default_value("monotonic"), "clock to use (monotonic, tsc)")
+      ("warmup-ms", po::value<double>(&opt.warmup_ms)->default_value(opt.warmup_ms), "minimum warmup time per benchmark")
+      ("min-sample-ms", po::value<double>(&opt.min_sample_ms)->default_value(opt.min_sample_ms), "minimum duration of each sample")
+      ("samples,n", po::value<size_t>(&opt.samples)->default_value(opt.samples), "samples per benchmark")
+      ("outlier-sigma", po::value<double>(&opt.outlier_sigma)->default_value(opt.outlier_sigma), "discard samples further than this from the median (0 keeps all)")
+      ("elements,e", po::value<size_t>(&cfg.elements)->default_value(100000), "number of elements in each container")
+      ("threads,t", po::value<size_t>(&cfg.threads)->default_value(4), "number of threads in each thread pool")
+      ("workdir,w", po::value<std::string>(&cfg.workdir)->default_value("."), "where to create on-disk stores and datasets")
+      ("json,j", po::value<std::string>(&json), "also write results as JSON to this file ('-' for stdout)")
+      ("histogram", "also print a histogram of the samples of each benchmark")
+      ;
+
+   po::variables_map vm;
+
+   try
+   {
+      po::store(po::parse_command_line(argc, argv, desc), vm);
+      po::notify(vm);
+
+      opt.clock = moost::utils::benchmark_clock::parse(clock);
+
+      if (cfg.elements == 0 || cfg.threads == 0 || opt.samples == 0)
+      {
+         throw std::runtime_error("elements, threads and samples must be positive");
+      }
+   }
+   catch (const std::exception& e)
+   {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      return 1;
+   }
+
+   if (vm.count("help"))
+   {
+      std::cout << desc << std::endl;
+      return 0;
+   }
+
+   micro_benchmark mb(opt);
+
+   micro::add_kvds_suites(mb, cfg);
+   micro::add_mmd_suites(mb, cfg);
+   micro::add_container_suites(mb, cfg);
+   micro::add_partitioner_suites(mb, cfg);
+   micro::add_hash_suites(mb, cfg);
+   micro::add_thread_suites(mb, cfg);
+
+   std::vector<std::string> names;
+   mb.suites(names);
+
+   if (vm.count("list"))
+   {
+      for (size_t i = 0; i < names.size(); ++i)
+      {
+         std::cout << names[i] << std::endl;
+      }
+
+      return 0;
+   }
+
+   for (size_t i = 0; i < suites.size(); ++i)
+   {
+      if (std::find(names.begin(), names.end(), suites[i]) == names.end())
+      {
+         std::cerr << "ERROR: no such suite: " << suites[i] << std::endl;
+         return 1;
+      }
+   }
+
+   if (opt.clock == moost::utils::benchmark_clock::tsc && !moost::utils::tsc_clock::reliable())
+   {
+      std::cerr << "WARNING: this CPU doesn't advertise an invariant TSC, timings may be off" << std::endl;
+   }
+
+   std::vector<micro_benchmark::result> results;
+   moost::utils::benchmark timings("micro benchmark");
+   size_t failed = mb.run(suites, filter, results, &std::cerr, vm.count("histogram") ? &timings : 0);
+
+   std::cout << std::endl;
+   micro_benchmark::write_table(std::cout, results);
+
+   if (vm.count("histogram"))
+   {
+      timings.output(std::cout);
+   }
+
+   if (json == "-")
+   {
+      mb.write_json(std::cout, results);
+   }
+   else if (!json.empty())
+   {
+      std::ofstream out(json.c_str());
+
+      if (!out)
+      {
+         std::cerr << "ERROR: cannot write " << json << std::endl;
+         return 1;
+      }
+
+      mb.write_json(out, results);
+   }
+
+   return failed > 0 ? 2 : 0;
+}
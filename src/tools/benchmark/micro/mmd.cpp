@@ -0,0 +1,238 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Lookups in each kind of memory mapped dataset section. The dataset is
+ * written once during setup and then mapped, so after warmup all lookups
+ * are served from the page cache.
+ */
+
+#include <limits>
+#include <utility>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "../../../../include/moost/container/memory_mapped_dataset.hpp"
+#include "../../../../include/moost/io/tempdir.hpp"
+
+#include "suites.hpp"
+
+using namespace moost::container;
+using moost::utils::micro_benchmark;
+using moost::utils::do_not_optimize;
+
+namespace micro {
+
+namespace {
+
+struct bench_dataset : memory_mapped_dataset
+{
+   struct writer : public memory_mapped_dataset::writer
+   {
+      writer(const std::string& file)
+         : memory_mapped_dataset::writer(file, "micro_benchmark", 1)
+      {
+      }
+   };
+
+   bench_dataset(const std::string& file)
+      : memory_mapped_dataset(file, "micro_benchmark", 1)
+   {
+   }
+};
+
+typedef mmd_dense_hash_map<boost::uint32_t, boost::uint32_t> dense_map_t;
+typedef mmd_hash_multimap<boost::uint32_t, boost::uint32_t> multimap_t;
+typedef mmd_vector<boost::uint32_t> vector_t;
+typedef mmd_bloom_filter<boost::uint32_t> bloom_t;
+
+struct mmd_fixture
+{
+   explicit mmd_fixture(const suite_config& cfg)
+      : dir(cfg.workdir + "/moost_micro_mmd_XXXXXX")
+      , file(dir.string() + "/bench.mmd")
+      , hits(cfg.elements, 2)
+      , misses(cfg.elements, 2, 1)
+      , index(cfg.elements)
+   {
+      {
+         bench_dataset::writer wr(file);
+
+         dense_map_t::writer dense_wr(wr, "dense", std::numeric_limits<boost::uint32_t>::max());
+
+         for (size_t i = 0; i < cfg.elements; ++i)
+         {
+            dense_wr << std::make_pair(static_cast<boost::uint32_t>(2*i), static_cast<boost::uint32_t>(i));
+         }
+
+         dense_wr.commit();
+
+         size_t hash_bits = 10;
+
+         while ((size_t(1) << hash_bits) < cfg.elements && hash_bits < 24)
+         {
+            ++hash_bits;
+         }
+
+         multimap_t::writer multi_wr(wr, "multi", hash_bits);
+
+         for (size_t i = 0; i < cfg.elements; ++i)
+         {
+            multimap_t::value_type v;
+            v.first = static_cast<boost::uint32_t>(2*i);
+
+            for (v.second = 0; v.second < 4; ++v.second)
+            {
+               multi_wr << v;
+            }
+         }
+
+         multi_wr.commit();
+
+         vector_t::writer vec_wr(wr, "vec");
+
+         for (size_t i = 0; i < cfg.elements; ++i)
+         {
+            vec_wr << static_cast<boost::uint32_t>(i);
+         }
+
+         vec_wr.commit();
+
+         bloom_t::writer bloom_wr(wr, "bloom", cfg.elements, 0.01);
+
+         for (size_t i = 0; i < cfg.elements; ++i)
+         {
+            bloom_wr << static_cast<boost::uint32_t>(2*i);
+         }
+
+         bloom_wr.commit();
+         wr.close();
+      }
+
+      ds.reset(new bench_dataset(file));
+      dense.reset(new dense_map_t(*ds, "dense"));
+      multi.reset(new multimap_t(*ds, "multi"));
+      vec.reset(new vector_t(*ds, "vec"));
+      bloom.reset(new bloom_t(*ds, "bloom"));
+   }
+
+   moost::io::tempdir dir;    // first, so it's removed after the dataset is unmapped
+   const std::string file;
+   boost::shared_ptr<bench_dataset> ds;
+   boost::shared_ptr<dense_map_t> dense;
+   boost::shared_ptr<multimap_t> multi;
+   boost::shared_ptr<vector_t> vec;
+   boost::shared_ptr<bloom_t> bloom;
+   key_sequence hits;
+   key_sequence misses;
+   key_sequence index;
+};
+
+void dense_find(boost::shared_ptr<mmd_fixture> f, const key_sequence *keys, boost::uint64_t n)
+{
+   const dense_map_t& map = *f->dense;
+
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      dense_map_t::const_iterator it = map.find((*keys)[i]);
+      bool found = it != map.end();
+      do_not_optimize(found);
+   }
+}
+
+void multimap_lower_bound(boost::shared_ptr<mmd_fixture> f, const key_sequence *keys, boost::uint64_t n)
+{
+   const multimap_t& map = *f->multi;
+
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      multimap_t::const_iterator it = map.lower_bound((*keys)[i]);
+      do_not_optimize(it);
+   }
+}
+
+void vector_random(boost::shared_ptr<mmd_fixture> f, boost::uint64_t n)
+{
+   const vector_t& vec = *f->vec;
+   boost::uint32_t sum = 0;
+
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      sum += vec[f->index[i]];
+   }
+
+   do_not_optimize(sum);
+}
+
+void vector_scan(boost::shared_ptr<mmd_fixture> f, boost::uint64_t n)
+{
+   const vector_t& vec = *f->vec;
+   const size_t size = vec.size();
+   boost::uint32_t sum = 0;
+
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      sum += vec[i % size];
+   }
+
+   do_not_optimize(sum);
+}
+
+void bloom_find(boost::shared_ptr<mmd_fixture> f, const key_sequence *keys, boost::uint64_t n)
+{
+   const bloom_t& bloom = *f->bloom;
+
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      bool found = bloom.find((*keys)[i]);
+      do_not_optimize(found);
+   }
+}
+
+void setup_mmd(const suite_config& cfg, micro_benchmark::suite& s)
+{
+   boost::shared_ptr<mmd_fixture> f(new mmd_fixture(cfg));
+
+   s.add("dense_hash_map_find_hit", boost::bind(&dense_find, f, &f->hits, _1));
+   s.add("dense_hash_map_find_miss", boost::bind(&dense_find, f, &f->misses, _1));
+   s.add("hash_multimap_lower_bound_hit", boost::bind(&multimap_lower_bound, f, &f->hits, _1));
+   s.add("hash_multimap_lower_bound_miss", boost::bind(&multimap_lower_bound, f, &f->misses, _1));
+   s.add("vector_random", boost::bind(&vector_random, f, _1));
+   s.add("vector_scan", boost::bind(&vector_scan, f, _1));
+   s.add("bloom_filter_find_hit", boost::bind(&bloom_find, f, &f->hits, _1));
+   s.add("bloom_filter_find_miss", boost::bind(&bloom_find, f, &f->misses, _1));
+}
+
+}
+
+void add_mmd_suites(micro_benchmark& mb, const suite_config& cfg)
+{
+   mb.add_suite("mmd", boost::bind(&setup_mmd, cfg, _1));
+}
+
+}
@@ -0,0 +1,99 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Mapping keys to buckets with each of the partitioners.
+ */
+
+#include <string>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "../../../../include/moost/algorithm/ketama_partitioner.hpp"
+#include "../../../../include/moost/algorithm/modulo_partitioner.hpp"
+
+#include "suites.hpp"
+
+using namespace moost::algorithm;
+using moost::utils::micro_benchmark;
+using moost::utils::do_not_optimize;
+
+namespace micro {
+
+namespace {
+
+struct partitioner_fixture
+{
+   partitioner_fixture(const suite_config& cfg, partitioner<boost::uint32_t> *p)
+      : part(p)
+      , keys(cfg.elements)
+   {
+   }
+
+   boost::shared_ptr< partitioner<boost::uint32_t> > part;
+   key_sequence keys;
+};
+
+void partition(boost::shared_ptr<partitioner_fixture> f, boost::uint64_t n)
+{
+   const partitioner<boost::uint32_t>& part = *f->part;
+
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      size_t bucket = part.partition(f->keys[i]);
+      do_not_optimize(bucket);
+   }
+}
+
+void setup_partitioners(const suite_config& cfg, micro_benchmark::suite& s)
+{
+   static const size_t buckets[] = { 4, 64, 1024 };
+
+   for (size_t i = 0; i < sizeof(buckets)/sizeof(buckets[0]); ++i)
+   {
+      std::string suffix = "_" + boost::lexical_cast<std::string>(buckets[i]);
+
+      boost::shared_ptr<partitioner_fixture> ketama(
+         new partitioner_fixture(cfg, new ketama_partitioner<boost::uint32_t>(buckets[i])));
+      s.add("ketama" + suffix, boost::bind(&partition, ketama, _1));
+
+      boost::shared_ptr<partitioner_fixture> modulo(
+         new partitioner_fixture(cfg, new modulo_partitioner<boost::uint32_t>(buckets[i])));
+      s.add("modulo" + suffix, boost::bind(&partition, modulo, _1));
+   }
+}
+
+}
+
+void add_partitioner_suites(micro_benchmark& mb, const suite_config& cfg)
+{
+   mb.add_suite("partitioner", boost::bind(&setup_partitioners, cfg, _1));
+}
+
+}
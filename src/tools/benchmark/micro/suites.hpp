@@ -0,0 +1,103 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_TOOLS_BENCHMARK_MICRO_SUITES_HPP__
+#define MOOST_TOOLS_BENCHMARK_MICRO_SUITES_HPP__
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <boost/cstdint.hpp>
+#include <boost/random/mersenne_twister.hpp>
+
+#include "../../../../include/moost/utils/micro_benchmark.hpp"
+
+namespace micro {
+
+struct suite_config
+{
+   size_t elements;        // number of elements in each container
+   size_t threads;         // number of threads for the thread pool suites
+   std::string workdir;    // where on-disk stores and datasets are created
+};
+
+/**
+ * A fixed, pseudo random sequence of keys
+ *
+ * Key i is k*stride + offset with k in [0, elements). Looking keys up in a
+ * random rather than in insertion order keeps the hardware prefetcher from
+ * making every container look equally fast.
+ */
+class key_sequence
+{
+public:
+   key_sequence(size_t elements, boost::uint32_t stride = 1, boost::uint32_t offset = 0)
+   {
+      size_t size = 1;
+
+      while (size < elements)
+      {
+         size <<= 1;
+      }
+
+      boost::random::mt19937 rng(4711);
+      m_keys.reserve(size);
+
+      for (size_t i = 0; i < size; ++i)
+      {
+         m_keys.push_back(static_cast<boost::uint32_t>((i % elements)*stride + offset));
+      }
+
+      for (size_t i = size - 1; i > 0; --i)
+      {
+         std::swap(m_keys[i], m_keys[rng() % (i + 1)]);
+      }
+
+      m_mask = size - 1;
+   }
+
+   boost::uint32_t operator[] (boost::uint64_t i) const
+   {
+      return m_keys[i & m_mask];
+   }
+
+private:
+   std::vector<boost::uint32_t> m_keys;
+   size_t m_mask;
+};
+
+void add_kvds_suites(moost::utils::micro_benchmark& mb, const suite_config& cfg);
+void add_mmd_suites(moost::utils::micro_benchmark& mb, const suite_config& cfg);
+void add_container_suites(moost::utils::micro_benchmark& mb, const suite_config& cfg);
+void add_partitioner_suites(moost::utils::micro_benchmark& mb, const suite_config& cfg);
+void add_hash_suites(moost::utils::micro_benchmark& mb, const suite_config& cfg);
+void add_thread_suites(moost::utils::micro_benchmark& mb, const suite_config& cfg);
+
+}
+
+#endif
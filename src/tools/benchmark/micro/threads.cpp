@@ -0,0 +1,137 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Per job overhead of the thread pools. Every job is trivial, so what's
+ * measured is handing a job to a worker and learning that it's done.
+ * Each iteration is one job.
+ */
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "../../../../include/moost/thread/worker_group.hpp"
+#include "../../../../include/moost/thread/async_batch_processor.hpp"
+#include "../../../../include/moost/thread/threaded_job_scheduler.hpp"
+
+#include "suites.hpp"
+
+using namespace moost::thread;
+using moost::utils::micro_benchmark;
+
+namespace micro {
+
+namespace {
+
+const boost::uint64_t batch_size = 64;
+
+void count_job(boost::atomic<boost::uint64_t> *done)
+{
+   done->fetch_add(1, boost::memory_order_relaxed);
+}
+
+struct pool_fixture
+{
+   explicit pool_fixture(const suite_config& cfg)
+      : done(0)
+      , workers(cfg.threads)
+      , batches(cfg.threads)
+      , scheduler(cfg.threads)
+   {
+   }
+
+   boost::atomic<boost::uint64_t> done;
+   worker_group workers;
+   async_batch_processor batches;
+   threaded_job_scheduler scheduler;
+};
+
+void worker_group_jobs(boost::shared_ptr<pool_fixture> f, boost::uint64_t n)
+{
+   boost::uint64_t target = f->done.load() + n;
+
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      f->workers.add_job(boost::bind(&count_job, &f->done));
+   }
+
+   while (f->done.load() < target)
+   {
+      boost::this_thread::yield();
+   }
+}
+
+void async_batch_jobs(boost::shared_ptr<pool_fixture> f, boost::uint64_t n)
+{
+   async_batch_processor::jobs_t jobs;
+
+   while (n > 0)
+   {
+      jobs.assign(std::min(n, batch_size), boost::bind(&count_job, &f->done));
+      f->batches.dispatch(jobs);
+      n -= jobs.size();
+   }
+}
+
+void scheduler_jobs(boost::shared_ptr<pool_fixture> f, boost::uint64_t n)
+{
+   while (n > 0)
+   {
+      boost::uint64_t size = std::min(n, batch_size);
+      boost::shared_ptr<threaded_job_batch> batch(new threaded_job_batch);
+
+      for (boost::uint64_t i = 0; i < size; ++i)
+      {
+         batch->add(boost::bind(&count_job, &f->done));
+      }
+
+      f->scheduler.dispatch(batch);
+      n -= size;
+   }
+}
+
+void setup_threads(const suite_config& cfg, micro_benchmark::suite& s)
+{
+   boost::shared_ptr<pool_fixture> f(new pool_fixture(cfg));
+
+   s.add("worker_group", boost::bind(&worker_group_jobs, f, _1));
+   s.add("async_batch_processor", boost::bind(&async_batch_jobs, f, _1));
+   s.add("threaded_job_scheduler", boost::bind(&scheduler_jobs, f, _1));
+}
+
+}
+
+void add_thread_suites(micro_benchmark& mb, const suite_config& cfg)
+{
+   mb.add_suite("thread", boost::bind(&setup_threads, cfg, _1));
+}
+
+}
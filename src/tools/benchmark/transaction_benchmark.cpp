@@ -0,0 +1,204 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Measures how quickly TransactionHandler and BatchTransactionHandler drain
+ * a queue into a slow sink. Every call to the sink costs a fixed round trip,
+ * as a remote database or message broker would, plus a little per item.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string>
+
+#include <boost/program_options.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/atomic.hpp>
+
+#include "../../../include/moost/transaction/handler.hpp"
+#include "../../../include/moost/transaction/batch_handler.hpp"
+#include "../../../include/moost/transaction/queue.hpp"
+#include "../../../include/moost/utils/stopwatch.hpp"
+
+namespace po = boost::program_options;
+namespace mt = moost::transaction;
+
+namespace {
+
+typedef mt::NonePersistedTQ<int> queue_t;
+
+class slow_sink
+{
+public:
+   slow_sink(boost::atomic<size_t>& committed, int call_us, int item_us)
+      : m_committed(&committed)
+      , m_call_us(call_us)
+      , m_item_us(item_us)
+   {
+   }
+
+   bool operator()(const int&)
+   {
+      wait(1);
+      ++*m_committed;
+      return true;
+   }
+
+   size_t operator()(const std::vector<int>& batch)
+   {
+      wait(batch.size());
+      *m_committed += batch.size();
+      return batch.size();
+   }
+
+private:
+   void wait(size_t items) const
+   {
+      boost::this_thread::sleep(boost::posix_time::microseconds(m_call_us + m_item_us*items));
+   }
+
+   boost::atomic<size_t> *m_committed;
+   int m_call_us;
+   int m_item_us;
+};
+
+void wait_for(const boost::atomic<size_t>& committed, size_t count)
+{
+   while (committed < count)
+   {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+   }
+}
+
+void report(const std::string& name, size_t count, const moost::utils::stopwatch& sw)
+{
+   double const secs = sw.elapsed_us() / 1e6;
+
+   std::cout << std::left << std::setw(36) << name << std::right << std::fixed
+             << std::setw(14) << std::setprecision(0) << count / secs
+             << std::setw(12) << std::setprecision(3) << secs
+             << std::endl;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+   size_t num_items;
+   size_t legacy_items;
+   int call_us;
+   int item_us;
+   size_t batch;
+   std::vector<size_t> committers;
+
+   po::options_description opt("Options");
+   opt.add_options()
+      ("help,h", "show this help")
+      ("items,n", po::value<size_t>(&num_items)->default_value(100000), "number of items to commit")
+      ("legacy-items,l", po::value<size_t>(&legacy_items)->default_value(2000), "number of items to commit through TransactionHandler")
+      ("call-us,c", po::value<int>(&call_us)->default_value(500), "cost of each call to the sink")
+      ("item-us,i", po::value<int>(&item_us)->default_value(2), "additional cost of each item")
+      ("batch,b", po::value<size_t>(&batch)->default_value(100), "maximum batch size")
+      ("committers,t", po::value< std::vector<size_t> >(&committers)->multitoken(), "numbers of committer threads to try (default: 1 4 16)")
+      ;
+
+   po::variables_map vm;
+
+   try
+   {
+      po::store(po::parse_command_line(argc, argv, opt), vm);
+      po::notify(vm);
+   }
+   catch (const std::exception& e)
+   {
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      return 1;
+   }
+
+   if (vm.count("help"))
+   {
+      std::cout << opt << std::endl;
+      return 0;
+   }
+
+   if (committers.empty())
+   {
+      committers.push_back(1);
+      committers.push_back(4);
+      committers.push_back(16);
+   }
+
+   std::cout << std::left << std::setw(36) << "handler" << std::right
+             << std::setw(14) << "items/s"
+             << std::setw(12) << "seconds"
+             << std::endl;
+
+   {
+      boost::atomic<size_t> committed(0);
+      queue_t queue;
+      moost::utils::stopwatch sw;
+
+      {
+         mt::TransactionHandler<queue_t, slow_sink> handler(queue, slow_sink(committed, call_us, item_us));
+
+         for (size_t i = 0; i < legacy_items; ++i)
+         {
+            handler.post(static_cast<int>(i));
+         }
+
+         wait_for(committed, legacy_items);
+      }
+
+      report("TransactionHandler", legacy_items, sw);
+   }
+
+   for (size_t t = 0; t < committers.size(); ++t)
+   {
+      boost::atomic<size_t> committed(0);
+      queue_t queue;
+      moost::utils::stopwatch sw;
+
+      {
+         mt::BatchTransactionHandler<queue_t, slow_sink> handler(queue, slow_sink(committed, call_us, item_us), committers[t], batch);
+
+         for (size_t i = 0; i < num_items; ++i)
+         {
+            handler.post(static_cast<int>(i));
+         }
+
+         wait_for(committed, num_items);
+      }
+
+      std::ostringstream name;
+      name << "BatchTransactionHandler (" << committers[t] << " thr)";
+      report(name.str(), num_items, sw);
+   }
+
+   return 0;
+}
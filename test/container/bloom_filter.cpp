@@ -0,0 +1,174 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+#include <boost/foreach.hpp>
+#define foreach BOOST_FOREACH
+
+#include "../../include/moost/container/bloom_filter.hpp"
+#include <vector>
+#include <iterator>
+
+using namespace moost::container;
+
+BOOST_AUTO_TEST_SUITE( bloom_filter_tests )
+
+namespace {
+
+typedef std::vector<size_t> items_t;
+
+items_t create_items(size_t first, size_t count)
+{
+   items_t items;
+
+   for (size_t i = 0; i < count; ++i)
+   {
+      items.push_back(first + 7*i);
+   }
+
+   return items;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( test_bloom_filter_no_false_negatives )
+{
+   items_t const items = create_items(0, 10000);
+   blocked_bloom_filter<size_t> bf(items.size(), 0.01, items.begin(), items.end());
+
+   foreach(size_t item, items)
+   {
+      BOOST_CHECK(bf.find(item));
+   }
+
+   BOOST_CHECK_EQUAL(bf.find(items.begin(), items.end()), items.size());
+}
+
+BOOST_AUTO_TEST_CASE( test_bloom_filter_fpr )
+{
+   double const target[] = { 0.1, 0.01, 0.001 };
+
+   for (size_t ti = 0; ti < sizeof(target)/sizeof(target[0]); ++ti)
+   {
+      items_t const items = create_items(0, 20000);
+      items_t const others = create_items(1, 100000);
+
+      blocked_bloom_filter<size_t> bf(items.size(), target[ti], items.begin(), items.end());
+
+      BOOST_CHECK_LE(bf.expected_fpr(items.size()), target[ti]);
+
+      double const fpr = static_cast<double>(bf.find(others.begin(), others.end()))/others.size();
+
+      // allow for some statistical slack
+      BOOST_CHECK_LE(fpr, 1.5*target[ti]);
+   }
+}
+
+BOOST_AUTO_TEST_CASE( test_bloom_filter_find_batch )
+{
+   items_t const items = create_items(0, 1000);
+   items_t const probe = create_items(0, 3000);
+   blocked_bloom_filter<size_t> bf(items.size(), 0.001, items.begin(), items.end());
+
+   std::vector<char> result(probe.size());
+   size_t const cnt = bf.find_batch(&probe[0], probe.size(), reinterpret_cast<bool *>(&result[0]));
+
+   BOOST_CHECK_EQUAL(cnt, bf.find(probe.begin(), probe.end()));
+
+   for (size_t i = 0; i < probe.size(); ++i)
+   {
+      BOOST_CHECK_EQUAL(result[i] != 0, bf.find(probe[i]));
+   }
+}
+
+BOOST_AUTO_TEST_CASE( test_bloom_filter_find_what )
+{
+   items_t const items = create_items(0, 100);
+   blocked_bloom_filter<size_t> bf(items.size(), 0.001, items.begin(), items.end());
+
+   items_t result;
+   BOOST_CHECK_EQUAL(bf.find(items.begin(), items.end(), std::back_inserter(result)), items.size());
+   BOOST_CHECK(items == result);
+}
+
+BOOST_AUTO_TEST_CASE( test_bloom_filter_clear_and_copy )
+{
+   items_t const items = create_items(0, 100);
+   blocked_bloom_filter<size_t> bf(items.size(), 0.01, items.begin(), items.end());
+
+   BOOST_CHECK_GT(bf.count(), 0U);
+   BOOST_CHECK_EQUAL(bf.size() % 512, 0U);
+
+   blocked_bloom_filter<size_t> copy(bf);
+   BOOST_CHECK(copy == bf);
+   BOOST_CHECK_EQUAL(copy.find(items.begin(), items.end()), items.size());
+
+   bf.clear();
+   BOOST_CHECK_EQUAL(bf.count(), 0U);
+   BOOST_CHECK(copy != bf);
+
+   bf = copy;
+   BOOST_CHECK(copy == bf);
+}
+
+BOOST_AUTO_TEST_CASE( test_bloom_filter_serialize )
+{
+   items_t const items = create_items(0, 1000);
+   items_t const more = create_items(100000, 1000);
+
+   blocked_bloom_filter<size_t> bf(2000, 0.01, items.begin(), items.end());
+   blocked_bloom_filter<size_t> bf_more(2000, 0.01, more.begin(), more.end());
+
+   filter_types::serial_buffer_t buf;
+   bf >> buf;
+
+   blocked_bloom_filter<size_t> result(10, 0.5);
+   result << buf;
+   BOOST_CHECK(bf == result);
+
+   // merging the other filter must yield the union
+   bf_more.serialize(buf);
+   result.deserialize(buf, false);
+   BOOST_CHECK_EQUAL(result.find(items.begin(), items.end()), items.size());
+   BOOST_CHECK_EQUAL(result.find(more.begin(), more.end()), more.size());
+
+   blocked_bloom_filter<size_t> other(10, 0.5);
+   BOOST_CHECK_THROW(other.deserialize(buf, false), std::runtime_error);
+
+   buf.resize(buf.size() - 1);
+   BOOST_CHECK_THROW(other.deserialize(buf), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( test_bloom_filter_invalid )
+{
+   BOOST_CHECK_THROW(blocked_bloom_filter<size_t>(100, 0.0), std::invalid_argument);
+   BOOST_CHECK_THROW(blocked_bloom_filter<size_t>(100, 1.0), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,172 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+#include <boost/foreach.hpp>
+#define foreach BOOST_FOREACH
+
+#include "../../include/moost/container/cuckoo_filter.hpp"
+#include <vector>
+
+using namespace moost::container;
+
+BOOST_AUTO_TEST_SUITE( cuckoo_filter_tests )
+
+namespace {
+
+typedef std::vector<size_t> items_t;
+
+items_t create_items(size_t first, size_t count)
+{
+   items_t items;
+
+   for (size_t i = 0; i < count; ++i)
+   {
+      items.push_back(first + 7*i);
+   }
+
+   return items;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( test_cuckoo_filter_insert_find )
+{
+   items_t const items = create_items(0, 10000);
+   cuckoo_filter<size_t> cf(items.size(), 0.001);
+
+   BOOST_CHECK_EQUAL(cf.insert(items.begin(), items.end()), items.size());
+   BOOST_CHECK_EQUAL(cf.count(), items.size());
+
+   foreach(size_t item, items)
+   {
+      BOOST_CHECK(cf.find(item));
+   }
+
+   items_t const others = create_items(1, 100000);
+   double const fpr = static_cast<double>(cf.find(others.begin(), others.end()))/others.size();
+   BOOST_CHECK_LE(fpr, 0.002);
+}
+
+BOOST_AUTO_TEST_CASE( test_cuckoo_filter_erase )
+{
+   items_t const items = create_items(0, 5000);
+   cuckoo_filter<size_t> cf(items.size(), 0.0005);
+
+   cf.insert(items.begin(), items.end());
+
+   for (size_t i = 0; i < items.size(); i += 2)
+   {
+      BOOST_CHECK(cf.erase(items[i]));
+   }
+
+   BOOST_CHECK_EQUAL(cf.count(), items.size()/2);
+
+   size_t present = 0;
+
+   for (size_t i = 0; i < items.size(); ++i)
+   {
+      if (i % 2)
+      {
+         BOOST_CHECK(cf.find(items[i]));
+      }
+      else if (cf.find(items[i]))
+      {
+         ++present;
+      }
+   }
+
+   // only false positives may remain
+   BOOST_CHECK_LE(present, 10U);
+}
+
+BOOST_AUTO_TEST_CASE( test_cuckoo_filter_duplicates )
+{
+   cuckoo_filter<size_t> cf(100, 0.01);
+
+   BOOST_CHECK(cf.insert(42));
+   BOOST_CHECK(cf.insert(42));
+   BOOST_CHECK_EQUAL(cf.count(), 2U);
+   BOOST_CHECK(cf.erase(42));
+   BOOST_CHECK(cf.find(42));
+   BOOST_CHECK(cf.erase(42));
+   BOOST_CHECK(!cf.find(42));
+   BOOST_CHECK(!cf.erase(42));
+}
+
+BOOST_AUTO_TEST_CASE( test_cuckoo_filter_full )
+{
+   cuckoo_filter<size_t> cf(100, 0.01);
+   items_t const items = create_items(0, 10*cf.size());
+
+   size_t const inserted = cf.insert(items.begin(), items.end());
+
+   BOOST_CHECK_LT(inserted, items.size());
+   BOOST_CHECK_GE(inserted, cf.size()*8/10);
+   BOOST_CHECK_EQUAL(cf.count(), inserted);
+
+   for (size_t i = 0; i < inserted; ++i)
+   {
+      BOOST_CHECK(cf.find(items[i]));
+   }
+
+   // make room again
+   BOOST_CHECK(cf.erase(items[0]));
+   BOOST_CHECK(cf.erase(items[1]));
+   BOOST_CHECK(cf.insert(items[0]));
+}
+
+BOOST_AUTO_TEST_CASE( test_cuckoo_filter_serialize )
+{
+   items_t const items = create_items(0, 1000);
+   cuckoo_filter<size_t> cf(items.size(), 0.001);
+   cf.insert(items.begin(), items.end());
+
+   filter_types::serial_buffer_t buf;
+   cf >> buf;
+
+   cuckoo_filter<size_t> result(10, 0.1);
+   result << buf;
+   BOOST_CHECK(cf == result);
+   BOOST_CHECK_EQUAL(result.find(items.begin(), items.end()), items.size());
+
+   cuckoo_filter<size_t, filter_types::default_hash, boost::uint8_t> narrow(10, 0.1);
+   BOOST_CHECK_THROW(narrow.deserialize(buf), std::runtime_error);
+   BOOST_CHECK_THROW(result.deserialize(buf, false), std::logic_error);
+}
+
+BOOST_AUTO_TEST_CASE( test_cuckoo_filter_invalid )
+{
+   typedef cuckoo_filter<size_t, filter_types::default_hash, boost::uint8_t> narrow_filter;
+
+   BOOST_CHECK_THROW(narrow_filter(100, 1e-6), std::invalid_argument);
+   BOOST_CHECK_THROW(cuckoo_filter<size_t>(100, 0.0), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -335,6 +335,107 @@ BOOST_AUTO_TEST_CASE(test_mmd_dense_hash_map_variety)
    }
 }
 
+BOOST_AUTO_TEST_CASE(test_mmd_dense_hash_map_metrics)
+{
+   typedef mmd_dense_hash_map<boost::uint32_t, boost::uint32_t> map_type;
+
+   scoped_tempfile dsfile("dense_hash_map_metrics.mmd");
+
+   {
+      test_dataset::writer wr(dsfile.path());
+      map_type::writer map_wr(wr, "dense", std::numeric_limits<boost::uint32_t>::max());
+
+      for (boost::uint32_t i = 0; i < 10; ++i)
+      {
+         std::pair<boost::uint32_t, boost::uint32_t> p(i, i + 1);
+         map_wr << p;
+      }
+
+      map_wr.commit();
+      wr.close();
+   }
+
+   test_dataset ds(dsfile.path());
+   map_type map(ds, "dense");
+
+   // not counted before metrics are enabled
+   map.find(0);
+
+   moost::metrics::registry_singleton::instance().reset("mmd.dense_metrics_test.");
+   map.enable_metrics("dense_metrics_test");
+
+   for (boost::uint32_t i = 0; i < 15; ++i)
+   {
+      map.find(i);
+   }
+
+   BOOST_CHECK_EQUAL(map[3], 4U);
+   BOOST_CHECK_THROW(map[42], std::runtime_error);
+
+   BOOST_CHECK_EQUAL(moost::metrics::get_counter("mmd.dense_metrics_test.lookups").value(), 17);
+   BOOST_CHECK_EQUAL(moost::metrics::get_counter("mmd.dense_metrics_test.misses").value(), 6);
+}
+
+BOOST_AUTO_TEST_CASE(test_mmd_bloom_filter)
+{
+   typedef mmd_bloom_filter<boost::uint32_t> filter_type;
+
+   scoped_tempfile dsfile("bloom_filter.mmd");
+   {
+      test_dataset::writer wr(dsfile.path());
+      mmd_vector<boost::uint64_t>::writer vec_wr(wr, "vec");
+      vec_wr << 4711;
+      vec_wr.commit();
+
+      filter_type::writer filter_wr(wr, "bloom", 10000, 0.01);
+
+      for (boost::uint32_t i = 0; i < 10000; ++i)
+      {
+         filter_wr << 2*i;
+      }
+
+      filter_wr.commit();
+      wr.close();
+   }
+   BOOST_REQUIRE(dsfile.exists());
+
+   test_dataset ds(dsfile.path());
+   filter_type filter(ds, "bloom");
+
+   BOOST_CHECK_EQUAL(filter.size(), 10000U);
+   BOOST_CHECK_LE(filter.expected_fpr(), 0.01);
+
+   size_t false_positives = 0;
+
+   for (boost::uint32_t i = 0; i < 10000; ++i)
+   {
+      BOOST_CHECK(filter.find(2*i));
+
+      if (filter.find(2*i + 1))
+      {
+         ++false_positives;
+      }
+   }
+
+   BOOST_CHECK_LE(false_positives, 150U);
+
+   // the mapped filter must agree with an in-memory one
+   filter_type::filter_type bf(10000, 0.01);
+
+   for (boost::uint32_t i = 0; i < 10000; ++i)
+   {
+      bf.insert(2*i);
+   }
+
+   for (boost::uint32_t i = 0; i < 20000; ++i)
+   {
+      BOOST_CHECK_EQUAL(filter.find(i), bf.find(i));
+   }
+
+   filter_type wrong;
+   BOOST_CHECK_EXCEPTION(wrong.set(ds, "vec"), std::runtime_error, matches(".*invalid section type mmd_vector \\(expected mmd_bloom_filter\\)"));
+}
+
 BOOST_AUTO_TEST_CASE(test_mmd_dense_hash_map_error)
 {
    typedef mmd_dense_hash_map<boost::int32_t, test_val, const_hash> map_type;
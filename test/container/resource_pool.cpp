@@ -0,0 +1,216 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "../../include/moost/container/resource_pool.hpp"
+
+using namespace moost::container;
+
+BOOST_AUTO_TEST_SUITE( resource_pool_test )
+
+struct Fixture
+{
+   resource_pool<int> resource_pool_;
+
+   Fixture()
+   {
+     resource_pool_.add_resource(boost::shared_ptr<int>(new int(3)));
+     resource_pool_.add_resource(boost::shared_ptr<int>(new int(5)));
+   }
+};
+
+namespace {
+
+void hammer(resource_pool<int> & pool, int iterations, int & failures)
+{
+   for (int i = 0; i < iterations; ++i)
+   {
+      resource_pool<int>::scoped_resource sr(pool);
+
+      // nobody else must be holding this resource
+      int const v = ++*sr;
+      boost::this_thread::yield();
+      if (*sr != v)
+      {
+         ++failures;
+      }
+   }
+}
+
+void hold(resource_pool<int> & pool, int ms)
+{
+   resource_pool<int>::scoped_resource sr(pool);
+   boost::this_thread::sleep(boost::posix_time::milliseconds(ms));
+}
+
+}
+
+BOOST_FIXTURE_TEST_CASE( test_initial, Fixture )
+{
+  BOOST_CHECK_EQUAL(resource_pool_.size(), 2);
+  BOOST_CHECK_EQUAL(resource_pool_.total_size(), 2);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_get_resource, Fixture )
+{
+  resource_pool<int>::scoped_resource sr(resource_pool_);
+
+  BOOST_CHECK_EQUAL(resource_pool_.size(), 1);
+  BOOST_CHECK_EQUAL(*sr, 5);
+  BOOST_CHECK_EQUAL(resource_pool_.total_size(), 2);
+
+  resource_pool<int>::scoped_resource sr2(resource_pool_, false);
+  BOOST_CHECK_EQUAL(resource_pool_.size(), 0);
+  BOOST_CHECK_EQUAL(*sr2, 3);
+  BOOST_CHECK_EQUAL(resource_pool_.total_size(), 2);
+
+  BOOST_CHECK_THROW(
+    resource_pool<int>::scoped_resource sr3(resource_pool_, false),
+    no_resource_available
+  );
+}
+
+BOOST_FIXTURE_TEST_CASE( test_release, Fixture )
+{
+  resource_pool<int>::scoped_resource sr(resource_pool_);
+
+  {
+    resource_pool<int>::scoped_resource sr2(resource_pool_);
+  }
+  BOOST_CHECK_EQUAL(resource_pool_.size(), 1);
+  BOOST_CHECK_EQUAL(*sr, 5);
+
+  resource_pool<int>::scoped_resource sr3(resource_pool_);
+  BOOST_CHECK_EQUAL(resource_pool_.size(), 0);
+  BOOST_CHECK_EQUAL(*sr3, 3);
+  BOOST_CHECK_EQUAL(resource_pool_.total_size(), 2);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_affinity, Fixture )
+{
+  for (int i = 0; i < 10; ++i)
+  {
+    resource_pool<int>::scoped_resource sr(resource_pool_);
+  }
+
+  resource_pool_stats st;
+  resource_pool_.stats(st);
+
+  BOOST_CHECK_EQUAL(st.acquisitions, 10U);
+  BOOST_CHECK_EQUAL(st.cache_hits, 9U);
+  BOOST_CHECK_EQUAL(st.in_use, 0U);
+  BOOST_CHECK_EQUAL(st.waits, 0U);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_timeout, Fixture )
+{
+  resource_pool<int>::scoped_resource sr(resource_pool_);
+  resource_pool<int>::scoped_resource sr2(resource_pool_);
+
+  BOOST_CHECK_THROW(
+    resource_pool<int>::scoped_resource sr3(resource_pool_, 20),
+    no_resource_available
+  );
+
+  resource_pool_stats st;
+  resource_pool_.stats(st);
+
+  BOOST_CHECK_EQUAL(st.timeouts, 1U);
+  BOOST_CHECK_EQUAL(st.in_use, 2U);
+  BOOST_CHECK_CLOSE(st.utilisation(), 1.0, 1e-6);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_wait, Fixture )
+{
+  boost::thread t1(boost::bind(&hold, boost::ref(resource_pool_), 50));
+  boost::thread t2(boost::bind(&hold, boost::ref(resource_pool_), 50));
+
+  while (resource_pool_.size() > 0)
+  {
+    boost::this_thread::yield();
+  }
+
+  {
+    resource_pool<int>::scoped_resource sr(resource_pool_, 5000);
+  }
+
+  t1.join();
+  t2.join();
+
+  resource_pool_stats st;
+  resource_pool_.stats(st);
+
+  BOOST_CHECK_EQUAL(st.waits, 1U);
+  BOOST_CHECK_GT(st.total_wait_us, 0U);
+  BOOST_CHECK_EQUAL(resource_pool_.size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE( test_concurrent )
+{
+  resource_pool<int> pool("ints", 3);
+  int failures[8] = { 0 };
+
+  for (int i = 0; i < 4; ++i)
+  {
+    pool.add_resource(boost::shared_ptr<int>(new int(0)));
+  }
+
+  boost::thread_group threads;
+
+  for (int i = 0; i < 8; ++i)
+  {
+    threads.create_thread(boost::bind(&hammer, boost::ref(pool), 5000, boost::ref(failures[i])));
+  }
+
+  threads.join_all();
+
+  int total = 0;
+  std::vector< boost::shared_ptr<resource_pool<int>::scoped_resource> > held;
+
+  for (int i = 0; i < 4; ++i)
+  {
+    held.push_back(boost::shared_ptr<resource_pool<int>::scoped_resource>(new resource_pool<int>::scoped_resource(pool, false)));
+    total += **held.back();
+  }
+
+  for (int i = 0; i < 8; ++i)
+  {
+    BOOST_CHECK_EQUAL(failures[i], 0);
+  }
+
+  BOOST_CHECK_EQUAL(total, 8*5000);
+  BOOST_CHECK_EQUAL(pool.total_size(), 4U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
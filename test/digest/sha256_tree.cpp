@@ -0,0 +1,189 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string>
+#include <fstream>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/cstdint.hpp>
+
+#include "../../include/moost/digest/sha2.h"
+#include "../../include/moost/digest/sha256_tree.h"
+#include "../../include/moost/testing/test_directory_creator.hpp"
+#include "../../src/digest/sha256_block.h"
+
+BOOST_AUTO_TEST_SUITE(moost_digest_sha256_tree)
+
+namespace
+{
+
+std::string test_data(size_t size)
+{
+   std::string data(size, '\0');
+   boost::uint32_t x = 12345;
+   for (size_t i = 0; i < size; ++i)
+   {
+      x = x*1103515245 + 12345;
+      data[i] = static_cast<char>(x >> 16);
+   }
+   return data;
+}
+
+std::string sha256(const std::string& data)
+{
+   moost::digest::sha256 d;
+   d.add(data);
+   return d.digest();
+}
+
+std::string hasher_digest(const std::string& data, bool use_cpu_extensions)
+{
+   moost::digest::detail::sha256_hasher h(use_cpu_extensions);
+   // feed in uneven pieces to exercise buffering
+   for (size_t pos = 0, step = 1; pos < data.size(); pos += step, step = step*3 + 1)
+   {
+      h.update(data.data() + pos, std::min(step, data.size() - pos));
+   }
+   boost::uint8_t digest[32];
+   h.final(digest);
+   return std::string(reinterpret_cast<const char *>(&digest[0]), sizeof(digest));
+}
+
+// straightforward implementation of the tree hash using the reference SHA-256
+std::string reference_tree(const std::string& data, size_t chunk_size)
+{
+   std::string root(1, '\x01');
+   for (int i = 7; i >= 0; --i)
+   {
+      root += static_cast<char>(boost::uint64_t(chunk_size) >> (8*i));
+   }
+   size_t pos = 0;
+   do
+   {
+      root += sha256(std::string(1, '\0') + data.substr(pos, chunk_size));
+      pos += chunk_size;
+   }
+   while (pos < data.size());
+   return sha256(root);
+}
+
+std::string tree(const std::string& data, size_t chunk_size, size_t threads, size_t step)
+{
+   moost::digest::sha256_tree d(chunk_size, threads);
+   for (size_t pos = 0; pos < data.size(); pos += step)
+   {
+      d.add_raw(data.data() + pos, std::min(step, data.size() - pos));
+   }
+   return d.digest();
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(digest_sha256_hasher)
+{
+   for (size_t size = 0; size < 300; ++size)
+   {
+      const std::string data = test_data(size);
+      BOOST_CHECK_EQUAL(hasher_digest(data, false), sha256(data));
+      BOOST_CHECK_EQUAL(hasher_digest(data, true), sha256(data));
+   }
+
+   const std::string data = test_data(100000);
+   BOOST_CHECK_EQUAL(hasher_digest(data, false), sha256(data));
+   BOOST_CHECK_EQUAL(hasher_digest(data, true), sha256(data));
+}
+
+BOOST_AUTO_TEST_CASE(digest_sha256_tree)
+{
+   moost::digest::sha256_tree empty(64, 1);
+   BOOST_CHECK_EQUAL(empty.digest(), reference_tree("", 64));
+
+   const size_t sizes[] = { 1, 63, 64, 65, 1000, 4096, 10007 };
+
+   for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); ++i)
+   {
+      const std::string data = test_data(sizes[i]);
+      const std::string expected = reference_tree(data, 100);
+
+      BOOST_CHECK_EQUAL(tree(data, 100, 1, data.size()), expected);
+      BOOST_CHECK_EQUAL(tree(data, 100, 4, data.size()), expected);
+      BOOST_CHECK_EQUAL(tree(data, 100, 4, 7), expected);
+      BOOST_CHECK_EQUAL(tree(data, 100, 3, 100), expected);
+      BOOST_CHECK_EQUAL(tree(data, 100, 16, 333), expected);
+   }
+
+   // not the same as plain SHA-256, and depends on the chunk size
+   const std::string data = test_data(1000);
+   BOOST_CHECK(tree(data, 100, 2, 1000) != sha256(data));
+   BOOST_CHECK(tree(data, 100, 2, 1000) != tree(data, 200, 2, 1000));
+}
+
+BOOST_AUTO_TEST_CASE(digest_sha256_tree_incremental)
+{
+   const std::string data = test_data(5000);
+   moost::digest::sha256_tree d(256, 4);
+
+   d.add(data.substr(0, 1234));
+   // digest() doesn't affect the state
+   BOOST_CHECK_EQUAL(d.digest(), reference_tree(data.substr(0, 1234), 256));
+   d.add(data.substr(1234));
+   BOOST_CHECK_EQUAL(d.digest(), reference_tree(data, 256));
+   BOOST_CHECK_EQUAL(d.hexdigest().size(), 64U);
+
+   d.reset();
+   d.add(data);
+   BOOST_CHECK_EQUAL(d.digest(), reference_tree(data, 256));
+
+   BOOST_CHECK_THROW(moost::digest::sha256_tree(0), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(digest_sha256_tree_file)
+{
+   moost::testing::test_directory_creator tdc("Sha256TreeTest_Directory");
+   const std::string path = tdc.GetFilePath("data");
+   const std::string data = test_data(300000);
+
+   moost::digest::sha256_tree d(4096, 4);
+   BOOST_CHECK_THROW(d.add_file(path), std::exception);
+
+   {
+      std::ofstream ofs(path.c_str(), std::ios::binary);
+   }
+
+   d.add_file(path);
+   BOOST_CHECK_EQUAL(d.digest(), reference_tree("", 4096));
+
+   {
+      std::ofstream ofs(path.c_str(), std::ios::binary);
+      ofs << data;
+   }
+
+   d.add_file(path);
+   BOOST_CHECK_EQUAL(d.digest(), reference_tree(data, 4096));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
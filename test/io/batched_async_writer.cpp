@@ -0,0 +1,282 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <fstream>
+
+#include <zlib.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include "../../include/moost/io/batched_async_writer.hpp"
+#include "../../include/moost/io/gzip_framing.hpp"
+
+using namespace boost::filesystem;
+using namespace moost::io;
+
+BOOST_AUTO_TEST_SUITE( batched_async_writer_test )
+
+namespace {
+
+struct Item
+{
+  int x;
+
+  Item(int x_ = 0) : x(x_) {}
+
+  void write(std::ostream & out)
+  {
+    out.write(reinterpret_cast<const char *>(&x), sizeof(x));
+  }
+};
+
+struct Line
+{
+  std::string text;
+
+  Line(const std::string & text_) : text(text_) {}
+
+  void write(std::ostream & out)
+  {
+    out << text << '\n';
+  }
+};
+
+typedef batched_async_writer<Item> item_writer;
+
+std::vector<int> read_items(const path & p)
+{
+  std::vector<int> items;
+  std::ifstream in(p.string().c_str(), std::ios::binary);
+  int x;
+  while (in.read(reinterpret_cast<char *>(&x), sizeof(x)))
+    items.push_back(x);
+  return items;
+}
+
+std::vector<path> list_files(const path & dir)
+{
+  std::vector<path> files;
+  for (directory_iterator it(dir); it != directory_iterator(); ++it)
+    files.push_back(it->path());
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+void produce(item_writer & writer, int base, int count)
+{
+  for (int i = 0; i < count; ++i)
+    writer.enqueue(Item(base + i));
+}
+
+}
+
+struct Fixture
+{
+  struct TempDirectory
+  {
+    path Path;
+    TempDirectory(const std::string & path_name) : Path(path_name) { remove_all(Path); create_directory(Path); }
+    ~TempDirectory() { remove_all(Path); }
+  };
+  TempDirectory temp_dir;
+
+  Fixture()
+  : temp_dir("batched_async_writer_test")
+  {
+  }
+};
+
+// what happens when we do nothing?
+BOOST_FIXTURE_TEST_CASE( test_nothing, Fixture )
+{
+  item_writer writer((temp_dir.Path / "simple").string());
+  writer.stop();
+  BOOST_CHECK(list_files(temp_dir.Path).empty());
+}
+
+BOOST_FIXTURE_TEST_CASE( test_in_order, Fixture )
+{
+  item_writer writer((temp_dir.Path / "simple").string());
+  for (int i = 0; i < 10000; ++i)
+    writer.enqueue(Item(i));
+  writer.stop();
+
+  BOOST_CHECK_EQUAL(writer.items_written(), 10000u);
+  BOOST_CHECK(writer.batches_written() >= 1);
+
+  std::vector<path> files = list_files(temp_dir.Path);
+  BOOST_REQUIRE_EQUAL(files.size(), 1u);
+  std::vector<int> items = read_items(files[0]);
+  BOOST_REQUIRE_EQUAL(items.size(), 10000u);
+  for (int i = 0; i < 10000; ++i)
+    BOOST_CHECK_EQUAL(items[i], i);
+}
+
+// small flush sizes split batches into several writes but don't change the output
+BOOST_FIXTURE_TEST_CASE( test_small_flush, Fixture )
+{
+  item_writer writer((temp_dir.Path / "simple").string(), count_rollover(), raw_framing(), 0, 0, 0, 16);
+  for (int i = 0; i < 1000; ++i)
+    writer.enqueue(Item(i));
+  writer.stop();
+
+  std::vector<path> files = list_files(temp_dir.Path);
+  BOOST_REQUIRE_EQUAL(files.size(), 1u);
+  std::vector<int> items = read_items(files[0]);
+  BOOST_REQUIRE_EQUAL(items.size(), 1000u);
+  for (int i = 0; i < 1000; ++i)
+    BOOST_CHECK_EQUAL(items[i], i);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_many_producers, Fixture )
+{
+  const int producers = 4;
+  const int count = 20000;
+
+  item_writer writer((temp_dir.Path / "simple").string(), count_rollover(), raw_framing(), 1000);
+  boost::thread_group threads;
+  for (int t = 0; t < producers; ++t)
+    threads.create_thread(boost::bind(&produce, boost::ref(writer), t * count, count));
+  threads.join_all();
+  writer.stop();
+
+  std::vector<path> files = list_files(temp_dir.Path);
+  BOOST_REQUIRE_EQUAL(files.size(), 1u);
+  std::vector<int> items = read_items(files[0]);
+  BOOST_REQUIRE_EQUAL(items.size(), static_cast<size_t>(producers * count));
+
+  // every producer's items must appear in the order it enqueued them
+  std::vector<int> next(producers);
+  for (int t = 0; t < producers; ++t)
+    next[t] = t * count;
+  for (std::vector<int>::const_iterator it = items.begin(); it != items.end(); ++it)
+  {
+    int t = *it / count;
+    BOOST_REQUIRE_EQUAL(*it, next[t]);
+    ++next[t];
+  }
+}
+
+// rollover only ever happens between batches
+BOOST_FIXTURE_TEST_CASE( test_rollover, Fixture )
+{
+  item_writer writer((temp_dir.Path / "roll").string(), count_rollover(3));
+  for (int i = 0; i < 4; ++i)
+  {
+    writer.enqueue(Item(i));
+    // wait for the item to be written so each one is a batch of its own
+    while (writer.items_written() != static_cast<size_t>(i + 1))
+      boost::this_thread::yield();
+  }
+  writer.stop();
+
+  std::vector<path> files = list_files(temp_dir.Path);
+  BOOST_REQUIRE_EQUAL(files.size(), 2u);
+  size_t first = read_items(files[0]).size();
+  size_t second = read_items(files[1]).size();
+  BOOST_CHECK((first == 3 && second == 1) || (first == 1 && second == 3));
+}
+
+BOOST_AUTO_TEST_CASE( test_count_rollover_batches )
+{
+  count_rollover roll(3);
+  BOOST_CHECK(roll(4));   // items 0..3, 0 is a boundary
+  BOOST_CHECK(!roll(1));  // item 4
+  BOOST_CHECK(roll(2));   // items 5..6, 6 is a boundary
+  BOOST_CHECK(!roll(2));  // items 7..8
+  BOOST_CHECK(roll(1));   // item 9
+
+  count_rollover never;
+  BOOST_CHECK(!never(100));
+}
+
+BOOST_FIXTURE_TEST_CASE( test_gzip, Fixture )
+{
+  {
+    batched_async_writer<Line, count_rollover, gzip_framing> writer((temp_dir.Path / "log").string());
+    for (int i = 0; i < 5000; ++i)
+    {
+      std::ostringstream oss;
+      oss << "line " << i;
+      writer.enqueue(Line(oss.str()));
+    }
+    writer.stop();
+  }
+
+  std::vector<path> files = list_files(temp_dir.Path);
+  BOOST_REQUIRE_EQUAL(files.size(), 1u);
+  std::string name = files[0].string();
+  BOOST_CHECK_EQUAL(name.substr(name.size() - 3), ".gz");
+
+  gzFile gz = gzopen(files[0].string().c_str(), "rb");
+  BOOST_REQUIRE(gz != NULL);
+  std::string text;
+  char buf[4096];
+  int n;
+  while ((n = gzread(gz, buf, sizeof(buf))) > 0)
+    text.append(buf, n);
+  gzclose(gz);
+
+  std::istringstream iss(text);
+  std::string line;
+  int i = 0;
+  while (std::getline(iss, line))
+  {
+    std::ostringstream oss;
+    oss << "line " << i++;
+    BOOST_CHECK_EQUAL(line, oss.str());
+  }
+  BOOST_CHECK_EQUAL(i, 5000);
+}
+
+// sync after every batch still writes everything
+BOOST_FIXTURE_TEST_CASE( test_sync, Fixture )
+{
+  item_writer writer((temp_dir.Path / "simple").string(), count_rollover(), raw_framing(), 0, 0, 5);
+  for (int i = 0; i < 100; ++i)
+    writer.enqueue(Item(i));
+  boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+  writer.stop();
+
+  std::vector<path> files = list_files(temp_dir.Path);
+  BOOST_REQUIRE_EQUAL(files.size(), 1u);
+  BOOST_CHECK_EQUAL(read_items(files[0]).size(), 100u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -30,11 +30,14 @@
 
 #include <vector>
 #include <fstream>
+#include <sstream>
 
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
 
 #include "../../include/moost/io/block_store.hpp"
 
@@ -148,4 +151,93 @@ BOOST_FIXTURE_TEST_CASE( test_save_load_freelist, Fixture )
   BOOST_CHECK_EQUAL(block4.index(), 1);
 }
 
+// a block stream must not be able to run past the end of its block
+BOOST_FIXTURE_TEST_CASE( test_block_bounds, Fixture )
+{
+  std::string big(200, 'x');
+  {
+    block_store::scoped_block block(bs);
+    block_store::scoped_block block2(bs);
+    *block2 << "neighbour";
+    block->write(big.data(), big.size());
+    BOOST_CHECK(block->bad());
+  }
+  {
+    block_store::scoped_block block2(bs, 1);
+    std::string out;
+    *block2 >> out;
+    BOOST_CHECK_EQUAL(out, "neighbour");
+  }
+  {
+    block_store::scoped_block block(bs, 0);
+    std::vector<char> buf(200);
+    block->read(&buf[0], buf.size());
+    BOOST_CHECK_EQUAL(block->gcount(), 128);
+  }
+}
+
+// seeks are relative to the start of the block
+BOOST_FIXTURE_TEST_CASE( test_block_seek, Fixture )
+{
+  {
+    block_store::scoped_block block(bs);
+    block_store::scoped_block block2(bs);
+    *block2 << "0123456789";
+    block2->seekp(4);
+    *block2 << "ab";
+    BOOST_CHECK_EQUAL(static_cast<int>(block2->tellp()), 6);
+  }
+  block_store::scoped_block block2(bs, 1);
+  block2->seekg(2);
+  std::string out;
+  *block2 >> out;
+  BOOST_CHECK_EQUAL(out, "23ab6789");
+  block2->clear();
+  block2->seekg(-3, std::ios::end);
+  BOOST_CHECK_EQUAL(static_cast<int>(block2->tellg()), 125);
+}
+
+namespace {
+
+void write_blocks(block_store & store, size_t thread_id, size_t count, std::vector<size_t> & indices)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    block_store::scoped_block block(store);
+    std::ostringstream oss;
+    oss << thread_id << ':' << i;
+    binary_oarchive(*block) << oss.str();
+    indices.push_back(block.index());
+  }
+}
+
+}
+
+// many threads can alloc and write blocks at once without stepping on each other
+BOOST_FIXTURE_TEST_CASE( test_concurrent_readwrite, Fixture )
+{
+  const size_t num_threads = 8;
+  const size_t count = 200;
+  std::vector< std::vector<size_t> > indices(num_threads);
+  boost::thread_group threads;
+  for (size_t t = 0; t < num_threads; ++t)
+    threads.create_thread(boost::bind(&write_blocks, boost::ref(bs), t, count, boost::ref(indices[t])));
+  threads.join_all();
+
+  BOOST_CHECK_EQUAL(bs.allocated(), num_threads * count);
+
+  for (size_t t = 0; t < num_threads; ++t)
+  {
+    for (size_t i = 0; i < count; ++i)
+    {
+      block_store::scoped_block block(bs, indices[t][i]);
+      std::string out;
+      binary_iarchive(*block) >> out;
+      std::ostringstream oss;
+      oss << t << ':' << i;
+      BOOST_CHECK_EQUAL(out, oss.str());
+    }
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
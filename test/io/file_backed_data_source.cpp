@@ -55,6 +55,8 @@ namespace
       "  <MinSecsSinceLastLoad>100</MinSecsSinceLastLoad>\n"
       "  <ThrowOnFirstLoadFail>false</ThrowOnFirstLoadFail>\n"
       "  <MinProportionOfLastLoad>0.8</MinProportionOfLastLoad>\n"
+      "  <UseInotify>false</UseInotify>\n"
+      "  <ParallelReload>true</ParallelReload>\n"
       "</FileBackedDataSource>"
    };
 
@@ -202,6 +204,8 @@ BOOST_FIXTURE_TEST_CASE( test_auto_reload, Fixture )
    IncrementingIntDataPolicy dataPolicy;
    boost::shared_ptr<int_source_t> pSource = m_sourceFactory.createFromConfig(dataPolicy, conf);
 
+   moost::metrics::registry_singleton::instance().reset("io.source.IncrementingIntData.");
+
    pSource->load();
 
    BOOST_CHECK(pSource->size() == 1);
@@ -211,6 +215,9 @@ BOOST_FIXTURE_TEST_CASE( test_auto_reload, Fixture )
 
    writeToFile(filepath, "2", true);  // force a reload by updating the file
 
+   BOOST_CHECK_EQUAL(moost::metrics::get_counter("io.source.IncrementingIntData.reloads").value(), 2);
+   BOOST_CHECK_EQUAL(moost::metrics::get_gauge("io.source.IncrementingIntData.size").value(), 2);
+
    BOOST_CHECK(pSource->size() == 2);
 
    boost::shared_ptr<int> pNewData = pSource->get_shared_ptr();
@@ -238,7 +245,11 @@ BOOST_FIXTURE_TEST_CASE( test_first_load_fail_log, Fixture )
    IncrementingIntDataPolicy dataPolicy(0);
    boost::shared_ptr<int_source_t> pSource = m_sourceFactory.createFromConfig(dataPolicy, conf);
 
+   moost::metrics::registry_singleton::instance().reset("io.source.IncrementingIntData.");
+
    BOOST_CHECK_NO_THROW(pSource->load());
+
+   BOOST_CHECK_EQUAL(moost::metrics::get_counter("io.source.IncrementingIntData.failures").value(), 1);
 }
 
 BOOST_FIXTURE_TEST_CASE( test_reload_too_soon, Fixture )
@@ -296,6 +307,78 @@ BOOST_FIXTURE_TEST_CASE( test_register, Fixture )
    BOOST_CHECK(*pData == 0);
 }
 
+BOOST_FIXTURE_TEST_CASE( test_register_parallel, Fixture )
+{
+   file_backed_data_source_config conf;
+   conf.parallelReload = true;
+   IncrementingIntDataPolicy dataPolicy;
+   boost::shared_ptr<int_source_t> pSource = m_sourceFactory.createFromConfig(dataPolicy, conf);
+   std::vector<boost::shared_ptr<int_source_t> > others;
+
+   for (int i = 0; i < 4; ++i)
+   {
+      others.push_back(m_sourceFactory.createFromConfig(dataPolicy, conf));
+      pSource->registerLoadable(others.back());
+   }
+
+   pSource->load();
+
+   for (int i = 0; i < 4; ++i)
+   {
+      BOOST_CHECK(others[i]->size() == 1);
+      BOOST_CHECK(*others[i]->get_shared_ptr() == 0);
+   }
+}
+
+BOOST_FIXTURE_TEST_CASE( test_register_parallel_throws, Fixture )
+{
+   file_backed_data_source_config conf;
+   conf.parallelReload = true;
+   IncrementingIntDataPolicy dataPolicy;
+   IncrementingIntDataPolicy throwingPolicy(0);
+   boost::shared_ptr<int_source_t> pSource = m_sourceFactory.createFromConfig(dataPolicy, conf);
+
+   pSource->registerLoadable(m_sourceFactory.createFromConfig(dataPolicy, conf));
+   pSource->registerLoadable(m_sourceFactory.createFromConfig(throwingPolicy, conf));
+
+   BOOST_CHECK_THROW(pSource->load(), std::runtime_error);
+}
+
+namespace
+{
+   class InvalidLoadable : public loadable
+   {
+   public:
+      void load()
+      {
+         throw std::invalid_argument("invalid data");
+      }
+   };
+}
+
+BOOST_FIXTURE_TEST_CASE( test_register_parallel_rethrows_original, Fixture )
+{
+   file_backed_data_source_config conf;
+   conf.parallelReload = true;
+   IncrementingIntDataPolicy dataPolicy;
+   boost::shared_ptr<int_source_t> pSource = m_sourceFactory.createFromConfig(dataPolicy, conf);
+   std::vector<boost::shared_ptr<int_source_t> > others;
+
+   pSource->registerLoadable(boost::shared_ptr<loadable>(new InvalidLoadable));
+
+   for (int i = 0; i < 4; ++i)
+   {
+      others.push_back(m_sourceFactory.createFromConfig(dataPolicy, conf));
+      pSource->registerLoadable(others.back());
+   }
+
+   BOOST_CHECK_THROW(pSource->load(), std::invalid_argument);
+
+   // the others were all loaded regardless
+   for (int i = 0; i < 4; ++i)
+      BOOST_CHECK(others[i]->size() == 1);
+}
+
 BOOST_FIXTURE_TEST_CASE( test_valid_options_from_xml, Fixture )
 {
    string filepath(m_tdc.GetFilePath("test_options_from_xml"));
@@ -311,6 +394,8 @@ BOOST_FIXTURE_TEST_CASE( test_valid_options_from_xml, Fixture )
    BOOST_CHECK(conf.minSecsSinceLastLoad == MIN_SECS);
    BOOST_CHECK(conf.throwOnFirstLoadFail == THROW_ON_FIRST);
    BOOST_CHECK(conf.minProportionOfLastLoad == MIN_PROPORTION);
+   BOOST_CHECK(!conf.useInotify);
+   BOOST_CHECK(conf.parallelReload);
 }
 
 BOOST_FIXTURE_TEST_CASE( test_some_valid_options_from_xml, Fixture )
@@ -327,6 +412,8 @@ BOOST_FIXTURE_TEST_CASE( test_some_valid_options_from_xml, Fixture )
 
    BOOST_CHECK(conf.minSecsSinceLastLoad == MIN_SECS);
    BOOST_CHECK(conf.throwOnFirstLoadFail == THROW_ON_FIRST);
+   BOOST_CHECK(!conf.useInotify);
+   BOOST_CHECK(!conf.parallelReload);
 }
 
 BOOST_FIXTURE_TEST_CASE( test_invalid_options_from_xml, Fixture )
@@ -32,6 +32,7 @@
 #include <fstream>
 
 #include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/xtime.hpp>
 #include <boost/bind.hpp>
 
@@ -139,4 +140,130 @@ BOOST_FIXTURE_TEST_CASE( test_delete, Fixture )
    BOOST_REQUIRE_EQUAL(Deletes, 1);
 }
 
+struct InotifyFixture
+{
+   file_watcher fw;
+   std::string test_path;
+
+   boost::mutex mutex;
+   int Creates;
+   int Changes;
+   int Deletes;
+
+   void file_changed(file_watcher::file_action action, const std::string & /*path*/)
+   {
+     boost::mutex::scoped_lock lock(mutex);
+     switch (action)
+     {
+     case file_watcher::CREATED: ++Creates; break;
+     case file_watcher::CHANGED: ++Changes; break;
+     case file_watcher::DELETED: ++Deletes; break;
+     }
+   }
+
+   InotifyFixture()
+   : fw(500, file_watcher::INOTIFY),
+     test_path("file_watcher_Test_File"),
+     Creates(0),
+     Changes(0),
+     Deletes(0)
+   {
+      boost::filesystem::remove(boost::filesystem::path(test_path));
+      fw.insert(test_path, boost::bind(&InotifyFixture::file_changed, this, _1, _2));
+      fw.start();
+   }
+   ~InotifyFixture()
+   {
+      fw.stop();
+      boost::filesystem::remove(boost::filesystem::path(test_path));
+      boost::filesystem::remove(boost::filesystem::path(test_path + ".tmp"));
+   }
+
+   void write(const std::string & path, const std::string & data)
+   {
+      std::ofstream out(path.c_str());
+      out << data;
+   }
+
+   void settle()
+   {
+      // inotify events arrive almost immediately, much faster than polling
+      boost::thread::sleep(xtime_util::add_ms(xtime_util::now(), 100));
+   }
+
+   void check(int creates, int changes, int deletes)
+   {
+      boost::mutex::scoped_lock lock(mutex);
+      BOOST_CHECK_EQUAL(Creates, creates);
+      BOOST_CHECK_EQUAL(Changes, changes);
+      BOOST_CHECK_EQUAL(Deletes, deletes);
+   }
+};
+
+#ifdef MOOST_IO_FILE_WATCHER_HAS_INOTIFY
+
+BOOST_FIXTURE_TEST_CASE( test_inotify_mode, InotifyFixture )
+{
+   BOOST_CHECK_EQUAL(fw.mode(), file_watcher::INOTIFY);
+}
+
+// a file is only reported once the writer has closed it
+BOOST_FIXTURE_TEST_CASE( test_inotify_create_change, InotifyFixture )
+{
+   {
+      std::ofstream out(test_path.c_str());
+      out << "partial" << std::flush;
+      settle();
+      check(0, 0, 0);
+   }
+   settle();
+   check(1, 0, 0);
+
+   write(test_path, "complete");
+   settle();
+   check(1, 1, 0);
+}
+
+// atomically replacing a file counts as a change
+BOOST_FIXTURE_TEST_CASE( test_inotify_rename, InotifyFixture )
+{
+   write(test_path, "old");
+   settle();
+   write(test_path + ".tmp", "new");
+   boost::filesystem::rename(boost::filesystem::path(test_path + ".tmp"), boost::filesystem::path(test_path));
+   settle();
+   check(1, 1, 0);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_inotify_delete, InotifyFixture )
+{
+   write(test_path, "data");
+   settle();
+   boost::filesystem::remove(boost::filesystem::path(test_path));
+   settle();
+   check(1, 0, 1);
+}
+
+// paths in directories that don't exist yet are picked up when they appear
+BOOST_FIXTURE_TEST_CASE( test_inotify_missing_directory, InotifyFixture )
+{
+   std::string dir("file_watcher_Test_Dir");
+   std::string path(dir + "/file");
+   fw.insert(path, boost::bind(&InotifyFixture::file_changed, this, _1, _2));
+
+   boost::filesystem::create_directory(boost::filesystem::path(dir));
+   write(path, "data");
+   boost::thread::sleep(xtime_util::add_ms(xtime_util::now(), 1000));
+   check(1, 0, 0);
+
+   write(path, "more data");
+   settle();
+   check(1, 1, 0);
+
+   fw.erase(path);
+   boost::filesystem::remove_all(boost::filesystem::path(dir));
+}
+
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
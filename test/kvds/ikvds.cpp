@@ -42,6 +42,9 @@
 
 // Include application required header(s)
 #include "../../include/moost/kvds.hpp"
+#include "../../include/moost/kvds/kvds_compress.hpp"
+#include "../../include/moost/kvds/kvds_filter.hpp"
+#include "../../include/moost/kvds/kvds_tiered.hpp"
 
 // Imported required namespace(s)
 using boost::uint32_t;
@@ -458,5 +461,73 @@ BOOST_FIXTURE_TEST_CASE( test_kvds_mem_map, Fixture )
    IKvdsTester()(kvds);
 }
 
+BOOST_FIXTURE_TEST_CASE( test_kvds_metrics, Fixture )
+{
+   moost::metrics::registry & reg = moost::metrics::registry_singleton::instance();
+   reg.reset("kvds.ikvds_test");
+
+   KvdsMetrics kvds(KvdsMetrics::store_ptr_t(new KvdsMemMap), "ikvds test");
+   IKvdsTester()(kvds);
+
+   BOOST_CHECK_GT(moost::metrics::get_counter("kvds.ikvds_test.put").value(), 0);
+   BOOST_CHECK_GT(moost::metrics::get_counter("kvds.ikvds_test.add").value(), 0);
+   BOOST_CHECK_GT(moost::metrics::get_counter("kvds.ikvds_test.del").value(), 0);
+   BOOST_CHECK_GT(moost::metrics::get_counter("kvds.ikvds_test.get.hits").value(), 0);
+   BOOST_CHECK_GT(moost::metrics::get_counter("kvds.ikvds_test.get.misses").value(), 0);
+   BOOST_CHECK_EQUAL(moost::metrics::get_counter("kvds.ikvds_test.errors").value(), 0);
+
+   moost::metrics::histogram_snapshot reads;
+   moost::metrics::get_histogram("kvds.ikvds_test.read_us").snapshot(reads);
+   BOOST_CHECK_EQUAL(boost::int64_t(reads.count),
+                     moost::metrics::get_counter("kvds.ikvds_test.get.hits").value() +
+                     moost::metrics::get_counter("kvds.ikvds_test.get.misses").value());
+}
+
+BOOST_FIXTURE_TEST_CASE( test_kvds_compress, Fixture )
+{
+   KvdsCompress kvds(KvdsCompress::store_ptr_t(new KvdsMemMap), "ikvds test");
+   IKvdsTester()(kvds);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_kvds_compress_integer_values, Fixture )
+{
+   KvdsCompress::options opt;
+   opt.threshold = 0;
+   opt.integer_values = true;
+
+   KvdsCompress kvds(KvdsCompress::store_ptr_t(new KvdsMemMap), "ikvds test", opt);
+   IKvdsTester()(kvds);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_kvds_filter, Fixture )
+{
+   KvdsFilter::options opt;
+   opt.expected_items = 4;
+   opt.sidecar = tdc.GetFilePath("KvdsFilter");
+
+   KvdsFilter kvds(KvdsFilter::store_ptr_t(new KvdsMemMap), "ikvds test", opt);
+   IKvdsTester()(kvds);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_kvds_tiered_write_through, Fixture )
+{
+   KvdsTiered::options opt;
+   opt.max_items = 8;
+
+   KvdsTiered kvds(KvdsTiered::store_ptr_t(new KvdsMemMap), "ikvds test", opt);
+   IKvdsTester()(kvds);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_kvds_tiered_write_back, Fixture )
+{
+   KvdsTiered::options opt;
+   opt.max_items = 8;
+   opt.mode = KvdsTiered::write_back;
+   opt.flush_interval_ms = 1;
+
+   KvdsTiered kvds(KvdsTiered::store_ptr_t(new KvdsMemMap), "ikvds test", opt);
+   IKvdsTester()(kvds);
+}
+
 // Define end of test suite
 BOOST_AUTO_TEST_SUITE_END()
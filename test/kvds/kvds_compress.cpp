@@ -0,0 +1,304 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Include boost test framework required headers
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+// Include CRT/STL required header(s)
+#include <stdexcept>
+#include <vector>
+#include <string>
+#include <sstream>
+
+#include <boost/cstdint.hpp>
+
+// Include application required header(s)
+#include "../../include/moost/kvds/kvds_mem.hpp"
+#include "../../include/moost/kvds/kvds_compress.hpp"
+
+// Imported required namespace(s)
+using boost::uint32_t;
+using namespace moost::kvds;
+
+// Name the test suite
+BOOST_AUTO_TEST_SUITE( kvdsCompressTest )
+
+namespace {
+
+typedef boost::shared_ptr<KvdsMemMap> mem_ptr_t;
+
+std::vector<uint32_t> sorted_ids(size_t count)
+{
+   std::vector<uint32_t> ids;
+
+   for(size_t i = 0; i < count; ++i)
+   {
+      ids.push_back(static_cast<uint32_t>(1000000 + 7*i + (i*i) % 5));
+   }
+
+   return ids;
+}
+
+std::string record(uint32_t id)
+{
+   std::ostringstream oss;
+   oss << "{\"user_id\":" << id << ",\"country\":\"GB\",\"subscriber\":false,\"scrobbles\":" << id*3 << "}";
+   return oss.str();
+}
+
+size_t stored_size(KvdsMemMap & mem, uint32_t key)
+{
+   size_t vsize = 0;
+   BOOST_REQUIRE(mem.siz(&key, sizeof(key), vsize));
+   return vsize;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( test_integer_values )
+{
+   mem_ptr_t mem(new KvdsMemMap);
+   KvdsCompress::options opt;
+   opt.integer_values = true;
+   KvdsCompress kvds(mem, "compress test ints", opt);
+
+   uint32_t key = 42;
+   std::vector<uint32_t> ids = sorted_ids(1000);
+   size_t const raw_size = ids.size()*sizeof(uint32_t);
+
+   BOOST_REQUIRE(kvds.put(&key, sizeof(key), &ids[0], raw_size));
+   BOOST_CHECK_LT(stored_size(*mem, key), raw_size/4);
+
+   size_t vsize = 0;
+   BOOST_REQUIRE(kvds.siz(&key, sizeof(key), vsize));
+   BOOST_CHECK_EQUAL(vsize, raw_size);
+
+   std::vector<uint32_t> out(ids.size());
+   vsize = raw_size;
+   BOOST_REQUIRE(kvds.all(&key, sizeof(key), &out[0], vsize));
+   BOOST_CHECK_EQUAL(vsize, raw_size);
+   BOOST_CHECK(out == ids);
+
+   // partial reads return the beginning of the uncompressed value
+   uint32_t first[3] = { 0 };
+   vsize = sizeof(first);
+   BOOST_REQUIRE(kvds.get(&key, sizeof(key), first, vsize));
+   BOOST_CHECK_EQUAL(vsize, sizeof(first));
+   BOOST_CHECK_EQUAL(first[0], ids[0]);
+   BOOST_CHECK_EQUAL(first[2], ids[2]);
+
+   // all() reports the uncompressed size if the buffer is too small
+   vsize = raw_size - 1;
+   BOOST_CHECK(!kvds.all(&key, sizeof(key), &out[0], vsize));
+   BOOST_CHECK_EQUAL(vsize, raw_size);
+}
+
+BOOST_AUTO_TEST_CASE( test_unsorted_integer_values )
+{
+   mem_ptr_t mem(new KvdsMemMap);
+   KvdsCompress::options opt;
+   opt.integer_values = true;
+   opt.threshold = 0;
+   opt.level = 0;
+   KvdsCompress kvds(mem, "compress test ints", opt);
+
+   uint32_t key = 1;
+   uint32_t vals[] = { 0xFFFFFFFF, 0, 5, 3, 0x80000000, 0x7FFFFFFF, 1, 1 };
+
+   BOOST_REQUIRE(kvds.put(&key, sizeof(key), vals, sizeof(vals)));
+   BOOST_CHECK_LT(stored_size(*mem, key), sizeof(vals));
+
+   uint32_t out[8] = { 0 };
+   size_t vsize = sizeof(out);
+   BOOST_REQUIRE(kvds.all(&key, sizeof(key), out, vsize));
+   BOOST_CHECK_EQUAL(vsize, sizeof(vals));
+   BOOST_CHECK_EQUAL_COLLECTIONS(out, out + 8, vals, vals + 8);
+}
+
+BOOST_AUTO_TEST_CASE( test_empty_value_without_threshold )
+{
+   mem_ptr_t mem(new KvdsMemMap);
+   KvdsCompress::options opt;
+   opt.integer_values = true;
+   opt.threshold = 0;
+   KvdsCompress kvds(mem, "compress test empty", opt);
+
+   uint32_t key = 3;
+   char dummy = 0;
+   BOOST_REQUIRE(kvds.put(&key, sizeof(key), &dummy, 0));
+
+   char out[4] = { 0 };
+   size_t vsize = sizeof(out);
+   BOOST_REQUIRE(kvds.get(&key, sizeof(key), out, vsize));
+   BOOST_CHECK_EQUAL(vsize, 0U);
+}
+
+BOOST_AUTO_TEST_CASE( test_add_appends_to_compressed_value )
+{
+   mem_ptr_t mem(new KvdsMemMap);
+   KvdsCompress::options opt;
+   opt.integer_values = true;
+   KvdsCompress kvds(mem, "compress test ints", opt);
+
+   uint32_t key = 7;
+   std::vector<uint32_t> ids = sorted_ids(500);
+
+   for(size_t i = 0; i < ids.size(); i += 50)
+   {
+      BOOST_REQUIRE(kvds.add(&key, sizeof(key), &ids[i], 50*sizeof(uint32_t)));
+   }
+
+   std::vector<uint32_t> out(ids.size() + 1);
+   size_t vsize = out.size()*sizeof(uint32_t);
+   BOOST_REQUIRE(kvds.all(&key, sizeof(key), &out[0], vsize));
+   BOOST_CHECK_EQUAL(vsize, ids.size()*sizeof(uint32_t));
+   out.pop_back();
+   BOOST_CHECK(out == ids);
+
+   boost::uint64_t cnt = 0;
+   BOOST_REQUIRE(kvds.cnt(cnt));
+   BOOST_CHECK_EQUAL(cnt, 1U);
+}
+
+BOOST_AUTO_TEST_CASE( test_threshold_and_incompressible_values )
+{
+   mem_ptr_t mem(new KvdsMemMap);
+   KvdsCompress::options opt;
+   opt.threshold = 100;
+   KvdsCompress kvds(mem, "compress test threshold", opt);
+
+   moost::metrics::registry_singleton::instance().reset("kvds.compress_test_threshold.");
+
+   uint32_t key = 1;
+   std::string small(99, 'x');
+   BOOST_REQUIRE(kvds.put(&key, sizeof(key), small.data(), small.size()));
+   BOOST_CHECK_GT(stored_size(*mem, key), small.size());
+
+   key = 2;
+   std::string noise;
+   boost::uint32_t x = 12345;
+
+   for(int i = 0; i < 1000; ++i)
+   {
+      x = x*1664525 + 1013904223;
+      noise += static_cast<char>(x >> 24);
+   }
+
+   BOOST_REQUIRE(kvds.put(&key, sizeof(key), noise.data(), noise.size()));
+   BOOST_CHECK_LE(stored_size(*mem, key), noise.size() + 3);
+
+   key = 3;
+   std::string text(1000, 'y');
+   BOOST_REQUIRE(kvds.put(&key, sizeof(key), text.data(), text.size()));
+   BOOST_CHECK_LT(stored_size(*mem, key), 100U);
+
+   for(key = 1; key <= 3; ++key)
+   {
+      std::string const & expected = key == 1 ? small : key == 2 ? noise : text;
+      std::vector<char> out(expected.size());
+      size_t vsize = out.size();
+      BOOST_REQUIRE(kvds.all(&key, sizeof(key), &out[0], vsize));
+      BOOST_CHECK(std::string(out.begin(), out.end()) == expected);
+   }
+
+   KvdsCompress::compress_stats s = kvds.stats();
+   BOOST_CHECK_EQUAL(s.skipped, 2);
+   BOOST_CHECK_EQUAL(s.encodes, 2);
+   BOOST_CHECK_EQUAL(s.raw_bytes, boost::int64_t(small.size() + noise.size() + text.size()));
+   BOOST_CHECK_LT(s.stored_bytes, s.raw_bytes);
+   BOOST_CHECK_GT(s.ratio(), 1.0);
+   BOOST_CHECK_EQUAL(s.decodes, 1);
+
+   std::ostringstream report;
+   s.write(report);
+   BOOST_CHECK(report.str().find("ratio ") == 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_dictionary )
+{
+   std::vector<std::string> samples;
+
+   for(uint32_t id = 0; id < 200; ++id)
+   {
+      samples.push_back(record(id*17));
+   }
+
+   std::string const dict = KvdsCompress::train_dictionary(samples, 1024);
+   BOOST_CHECK(!dict.empty());
+   BOOST_CHECK_LE(dict.size(), 1024U);
+
+   KvdsCompress::options opt;
+   opt.threshold = 16;
+
+   mem_ptr_t plain_mem(new KvdsMemMap);
+   KvdsCompress plain(plain_mem, "compress test dict", opt);
+
+   opt.dictionary = dict;
+   mem_ptr_t dict_mem(new KvdsMemMap);
+   KvdsCompress primed(dict_mem, "compress test dict", opt);
+
+   uint32_t key = 1;
+   std::string const value = record(123457);
+
+   BOOST_REQUIRE(plain.put(&key, sizeof(key), value.data(), value.size()));
+   BOOST_REQUIRE(primed.put(&key, sizeof(key), value.data(), value.size()));
+   BOOST_CHECK_LT(stored_size(*dict_mem, key), stored_size(*plain_mem, key));
+   BOOST_CHECK_LT(stored_size(*dict_mem, key), value.size());
+
+   std::vector<char> out(value.size());
+   size_t vsize = out.size();
+   BOOST_REQUIRE(primed.all(&key, sizeof(key), &out[0], vsize));
+   BOOST_CHECK(std::string(out.begin(), out.end()) == value);
+
+   // reading with another dictionary must fail rather than return garbage
+   opt.dictionary = std::string(dict.rbegin(), dict.rend());
+   KvdsCompress wrong(dict_mem, "compress test dict", opt);
+   vsize = out.size();
+   BOOST_CHECK_THROW(wrong.all(&key, sizeof(key), &out[0], vsize), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( test_foreign_values_are_rejected )
+{
+   mem_ptr_t mem(new KvdsMemMap);
+   KvdsCompress kvds(mem, "compress test foreign");
+
+   uint32_t key = 1;
+   uint32_t val = 0xFFFFFFFF;
+   BOOST_REQUIRE(mem->put(&key, sizeof(key), &val, sizeof(val)));
+
+   size_t vsize = sizeof(val);
+   BOOST_CHECK_THROW(kvds.get(&key, sizeof(key), &val, vsize), std::runtime_error);
+
+   KvdsCompress::options opt;
+   opt.level = 10;
+   BOOST_CHECK_THROW(KvdsCompress(mem, "compress test foreign", opt), std::runtime_error);
+   BOOST_CHECK_THROW(KvdsCompress(KvdsCompress::store_ptr_t(), "compress test foreign"), std::runtime_error);
+}
+
+// Define end of test suite
+BOOST_AUTO_TEST_SUITE_END()
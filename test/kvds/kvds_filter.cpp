@@ -0,0 +1,367 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Include boost test framework required headers
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+// Include CRT/STL required header(s)
+#include <stdexcept>
+#include <vector>
+#include <string>
+#include <fstream>
+
+#include <boost/cstdint.hpp>
+
+#include "../../include/moost/testing/test_directory_creator.hpp"
+
+// Include application required header(s)
+#include "../../include/moost/kvds/kvds_mem.hpp"
+#include "../../include/moost/kvds/kvds_metrics.hpp"
+#include "../../include/moost/kvds/kvds_filter.hpp"
+
+// Imported required namespace(s)
+using boost::uint32_t;
+using namespace moost::kvds;
+using namespace moost::testing;
+
+// Name the test suite
+BOOST_AUTO_TEST_SUITE( kvdsFilterTest )
+
+// Define the test fixture
+struct Fixture
+{
+   Fixture()
+   {
+      moost::metrics::registry_singleton::instance().reset("kvds.filter_test.");
+      moost::metrics::registry_singleton::instance().reset("kvds.filter_test_store.");
+   }
+
+   test_directory_creator tdc;
+};
+
+namespace {
+
+typedef boost::shared_ptr<KvdsMemMap> mem_ptr_t;
+
+boost::int64_t metric(char const * name)
+{
+   return moost::metrics::get_counter(std::string("kvds.filter_test.filter.") + name).value();
+}
+
+/// lookups that made it to the decorated store
+boost::int64_t store_misses()
+{
+   return moost::metrics::get_counter("kvds.filter_test_store.get.misses").value();
+}
+
+KvdsFilter::store_ptr_t counted(mem_ptr_t mem)
+{
+   return KvdsFilter::store_ptr_t(new KvdsMetrics(mem, "filter test store"));
+}
+
+void put(IKvds & kvds, uint32_t key)
+{
+   uint32_t val = key*3;
+   BOOST_REQUIRE(kvds.put(&key, sizeof(key), &val, sizeof(val)));
+}
+
+bool xst(IKvds & kvds, uint32_t key)
+{
+   return kvds.xst(&key, sizeof(key));
+}
+
+}
+
+BOOST_FIXTURE_TEST_CASE( test_negative_lookups, Fixture )
+{
+   mem_ptr_t mem(new KvdsMemMap);
+   KvdsFilter kvds(counted(mem), "filter test");
+
+   for(uint32_t key = 0; key < 1000; ++key)
+   {
+      put(kvds, 2*key);
+   }
+
+   boost::int64_t const misses = store_misses();
+
+   for(uint32_t key = 0; key < 2000; ++key)
+   {
+      uint32_t val = 0;
+      size_t vsize = sizeof(val);
+      size_t size = 0;
+      bool const present = key % 2 == 0;
+
+      BOOST_CHECK_EQUAL(xst(kvds, key), present);
+      BOOST_CHECK_EQUAL(kvds.get(&key, sizeof(key), &val, vsize), present);
+      BOOST_CHECK_EQUAL(kvds.siz(&key, sizeof(key), size), present);
+
+      if(present)
+      {
+         BOOST_CHECK_EQUAL(val, key*3);
+      }
+   }
+
+   // (almost) all misses are answered by the filter
+   BOOST_CHECK_EQUAL(metric("negatives") + metric("false_positives"), 3*1000);
+   BOOST_CHECK_EQUAL(store_misses() - misses, metric("false_positives"));
+   BOOST_CHECK_LT(metric("false_positives"), 3*1000/20);
+   BOOST_CHECK_EQUAL(metric("rebuilds"), 1);
+   BOOST_CHECK_EQUAL(kvds.get_filter().count(), 1000U);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_updates, Fixture )
+{
+   mem_ptr_t mem(new KvdsMemMap);
+   KvdsFilter kvds(counted(mem), "filter test");
+
+   for(uint32_t key = 0; key < 100; ++key)
+   {
+      put(kvds, key);
+      put(kvds, key);
+   }
+
+   uint32_t key = 1000;
+   uint32_t val = 1;
+   BOOST_CHECK(kvds.add(&key, sizeof(key), &val, sizeof(val)));
+   BOOST_CHECK(kvds.add(&key, sizeof(key), &val, sizeof(val)));
+
+   // overwritten keys are only in the filter once
+   BOOST_CHECK_EQUAL(kvds.get_filter().count(), 101U);
+
+   for(key = 0; key < 100; key += 2)
+   {
+      BOOST_CHECK(kvds.del(&key, sizeof(key)));
+      BOOST_CHECK(!kvds.del(&key, sizeof(key)));
+   }
+
+   BOOST_CHECK_EQUAL(kvds.get_filter().count(), 51U);
+
+   for(key = 0; key < 100; ++key)
+   {
+      BOOST_CHECK_EQUAL(xst(kvds, key), key % 2 == 1);
+   }
+
+   BOOST_CHECK(kvds.clr());
+   BOOST_CHECK_EQUAL(kvds.get_filter().count(), 0U);
+   BOOST_CHECK(!xst(kvds, 1));
+}
+
+BOOST_FIXTURE_TEST_CASE( test_built_from_store, Fixture )
+{
+   mem_ptr_t mem(new KvdsMemMap);
+
+   for(uint32_t key = 0; key < 500; ++key)
+   {
+      put(*mem, key);
+   }
+
+   KvdsFilter kvds(counted(mem), "filter test");
+   BOOST_CHECK_EQUAL(kvds.get_filter().count(), 500U);
+
+   for(uint32_t key = 0; key < 1000; ++key)
+   {
+      BOOST_CHECK_EQUAL(xst(kvds, key), key < 500);
+   }
+}
+
+BOOST_FIXTURE_TEST_CASE( test_sidecar, Fixture )
+{
+   mem_ptr_t mem(new KvdsMemMap);
+
+   KvdsFilter::options opt;
+   opt.sidecar = tdc.GetFilePath("filter");
+
+   {
+      KvdsFilter kvds(counted(mem), "filter test", opt);
+
+      for(uint32_t key = 0; key < 300; ++key)
+      {
+         put(kvds, key);
+      }
+   }
+
+   BOOST_CHECK_EQUAL(metric("rebuilds"), 1);
+
+   // loaded, not rebuilt
+   {
+      KvdsFilter kvds(counted(mem), "filter test", opt);
+      BOOST_CHECK_EQUAL(metric("rebuilds"), 1);
+      BOOST_CHECK_EQUAL(kvds.get_filter().count(), 300U);
+      BOOST_CHECK(xst(kvds, 299));
+   }
+
+   // written to behind its back, so the sidecar is stale
+   put(*mem, 300);
+
+   {
+      KvdsFilter kvds(counted(mem), "filter test", opt);
+      BOOST_CHECK_EQUAL(metric("rebuilds"), 2);
+      BOOST_CHECK(xst(kvds, 300));
+   }
+}
+
+BOOST_FIXTURE_TEST_CASE( test_sidecar_after_crash, Fixture )
+{
+   mem_ptr_t mem(new KvdsMemMap);
+
+   KvdsFilter::options opt;
+   opt.sidecar = tdc.GetFilePath("filter");
+
+   {
+      KvdsFilter kvds(counted(mem), "filter test", opt);
+
+      for(uint32_t key = 0; key < 300; ++key)
+      {
+         put(kvds, key);
+      }
+   }
+
+   BOOST_CHECK(std::ifstream(opt.sidecar.c_str()));
+
+   {
+      KvdsFilter kvds(counted(mem), "filter test", opt);
+      BOOST_CHECK_EQUAL(metric("rebuilds"), 1);
+
+      // same number of keys as the sidecar, but not the same keys
+      put(kvds, 1000);
+      uint32_t key = 7;
+      BOOST_REQUIRE(kvds.del(&key, sizeof(key)));
+
+      // the process dies here, before kvds is destroyed
+      BOOST_CHECK(!std::ifstream(opt.sidecar.c_str()));
+
+      KvdsFilter restarted(counted(mem), "filter test", opt);
+      BOOST_CHECK_EQUAL(metric("rebuilds"), 2);
+      BOOST_CHECK(xst(restarted, 1000));
+      BOOST_CHECK(!xst(restarted, 7));
+   }
+}
+
+BOOST_FIXTURE_TEST_CASE( test_grows, Fixture )
+{
+   mem_ptr_t mem(new KvdsMemMap);
+
+   KvdsFilter::options opt;
+   opt.expected_items = 16;
+
+   KvdsFilter kvds(counted(mem), "filter test", opt);
+   size_t const initial = kvds.get_filter().size();
+
+   for(uint32_t key = 0; key < 5000; ++key)
+   {
+      put(kvds, key);
+   }
+
+   BOOST_CHECK_GT(kvds.get_filter().size(), initial);
+   BOOST_CHECK_GT(metric("rebuilds"), 1);
+   BOOST_CHECK_EQUAL(kvds.get_filter().count(), 5000U);
+
+   // no false negatives, ever
+   for(uint32_t key = 0; key < 5000; ++key)
+   {
+      BOOST_CHECK(xst(kvds, key));
+   }
+}
+
+BOOST_FIXTURE_TEST_CASE( test_rebuilds_when_degraded, Fixture )
+{
+   mem_ptr_t mem(new KvdsMemMap);
+
+   for(uint32_t key = 0; key < 2000; ++key)
+   {
+      put(*mem, key);
+   }
+
+   // a filter that's far too leaky for what we ask of it
+   KvdsFilter::options opt;
+   opt.fpr = 0.3;
+   opt.headroom = 1.0;
+   opt.max_fpr = 0.02;
+   opt.min_samples = 1000;
+
+   KvdsFilter kvds(counted(mem), "filter test", opt);
+   size_t const initial = kvds.get_filter().size();
+
+   for(uint32_t key = 100000; key < 200000; ++key)
+   {
+      BOOST_CHECK(!xst(kvds, key));
+   }
+
+   BOOST_CHECK_GT(metric("rebuilds"), 1);
+   BOOST_CHECK_GT(kvds.get_filter().size(), initial);
+   BOOST_CHECK_LE(kvds.observed_fpr(), opt.max_fpr);
+
+   for(uint32_t key = 0; key < 2000; ++key)
+   {
+      BOOST_CHECK(xst(kvds, key));
+   }
+}
+
+BOOST_FIXTURE_TEST_CASE( test_rebuild_waits_for_iteration, Fixture )
+{
+   mem_ptr_t mem(new KvdsMemMap);
+
+   for(uint32_t key = 0; key < 2000; ++key)
+   {
+      put(*mem, key);
+   }
+
+   KvdsFilter::options opt;
+   opt.fpr = 0.3;
+   opt.headroom = 1.0;
+   opt.max_fpr = 0.02;
+   opt.min_samples = 100;
+
+   KvdsFilter kvds(counted(mem), "filter test", opt);
+
+   // lookups during the iteration mustn't restart it
+   BOOST_REQUIRE(kvds.beg());
+
+   uint32_t key;
+   size_t ksize = sizeof(key);
+   size_t seen = 0;
+   uint32_t miss = 100000;
+
+   while(kvds.nxt(&key, ksize))
+   {
+      ++seen;
+
+      for(int i = 0; i < 10; ++i, ++miss)
+      {
+         BOOST_CHECK(!xst(kvds, miss));
+      }
+
+      BOOST_CHECK_EQUAL(metric("rebuilds"), 1);
+   }
+
+   BOOST_CHECK_EQUAL(seen, 2000U);
+   BOOST_CHECK_EQUAL(metric("rebuilds"), 2);
+}
+
+// Define end of test suite
+BOOST_AUTO_TEST_SUITE_END()
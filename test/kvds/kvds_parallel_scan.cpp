@@ -0,0 +1,316 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Include boost test framework required headers
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+// Include CRT/STL required header(s)
+#include <stdexcept>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <algorithm>
+
+#include <boost/cstdint.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "../../include/moost/testing/test_directory_creator.hpp"
+
+// Include application required header(s)
+#include "../../include/moost/kvds.hpp"
+#include "../../include/moost/kvds/kvds_parallel_scan.hpp"
+
+// Imported required namespace(s)
+using boost::uint32_t;
+using namespace moost::kvds;
+using namespace moost::testing;
+
+// Name the test suite
+BOOST_AUTO_TEST_SUITE( kvdsParallelScanTest )
+
+// Define the test fixture
+struct Fixture
+{
+   test_directory_creator tdc;
+};
+
+namespace {
+
+uint32_t const num_keys = 2000;
+
+/// values are 1 to 40 copies of the key, so they end up in different page stores
+void populate(IKvds & kvds)
+{
+   for(uint32_t key = 0; key < num_keys; ++key)
+   {
+      std::vector<uint32_t> val(1 + key % 40, key);
+      BOOST_REQUIRE(kvds.put(&key, sizeof(key), &val[0], val.size()*sizeof(uint32_t)));
+   }
+
+   // leave some holes
+   for(uint32_t key = 0; key < num_keys; key += 7)
+   {
+      BOOST_REQUIRE(kvds.del(&key, sizeof(key)));
+   }
+}
+
+uint32_t expected_count()
+{
+   return num_keys - (num_keys + 6)/7;
+}
+
+/// counts how often each key was seen and checks the values
+class Collector
+{
+public:
+   Collector() : bad_(0)
+   {
+   }
+
+   void visit(byte_array_t const & key, byte_array_t const & val)
+   {
+      // no BOOST_CHECKs in here, boost.test isn't thread safe
+      uint32_t k = 0;
+      bool ok = key.size() == sizeof(k);
+
+      if(ok)
+      {
+         memcpy(&k, &key[0], sizeof(k));
+         ok = k % 7 != 0 && val.size() == (1 + k % 40)*sizeof(uint32_t);
+      }
+
+      for(size_t i = 0; ok && i < val.size(); i += sizeof(uint32_t))
+      {
+         uint32_t v;
+         memcpy(&v, &val[i], sizeof(v));
+         ok = v == k;
+      }
+
+      boost::mutex::scoped_lock lock(mutex_);
+      ++seen_[k];
+
+      if(!ok)
+      {
+         ++bad_;
+      }
+   }
+
+   void check()
+   {
+      BOOST_CHECK_EQUAL(bad_, 0U);
+      BOOST_CHECK_EQUAL(seen_.size(), expected_count());
+
+      for(std::map<uint32_t, size_t>::const_iterator it = seen_.begin(); it != seen_.end(); ++it)
+      {
+         BOOST_CHECK_EQUAL(it->second, 1U);
+      }
+   }
+
+private:
+   boost::mutex mutex_;
+   std::map<uint32_t, size_t> seen_;
+   size_t bad_;
+};
+
+void fail_on(uint32_t bad_key, byte_array_t const & key, byte_array_t const &)
+{
+   uint32_t k;
+   memcpy(&k, &key[0], sizeof(k));
+
+   if(k == bad_key)
+   {
+      throw std::runtime_error("bad key");
+   }
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( test_iteration_fallback )
+{
+   KvdsMemMap kvds;
+   populate(kvds);
+
+   KvdsParallelScan scan(4);
+
+   std::vector<kvds_cursor_ptr_t> cursors;
+   scan.partition(kvds, cursors);
+   BOOST_CHECK_EQUAL(cursors.size(), 1U);
+
+   Collector c;
+   BOOST_CHECK_EQUAL(scan(kvds, boost::bind(&Collector::visit, &c, _1, _2)), expected_count());
+   c.check();
+}
+
+BOOST_FIXTURE_TEST_CASE( test_page_store_partitions, Fixture )
+{
+   KvdsPageStore<KvdsPageMapIntrinsicKey<uint32_t> > kvds;
+   kvds.open(tdc.GetFilePath("KvdsPageStore").c_str());
+   populate(kvds);
+
+   std::vector<kvds_cursor_ptr_t> cursors;
+   kvds.partition(5, cursors);
+   BOOST_REQUIRE_EQUAL(cursors.size(), 5U);
+
+   // every partition gets a share
+   Collector all;
+   byte_array_t key;
+   byte_array_t val;
+
+   for(size_t i = 0; i < cursors.size(); ++i)
+   {
+      size_t n = 0;
+
+      while(cursors[i]->next(key, val))
+      {
+         all.visit(key, val);
+         ++n;
+      }
+
+      BOOST_CHECK_GT(n, 0U);
+      BOOST_CHECK(!cursors[i]->next(key, val));
+   }
+
+   all.check();
+
+   Collector c;
+   KvdsParallelScan scan(3);
+   BOOST_CHECK_EQUAL(scan(kvds, boost::bind(&Collector::visit, &c, _1, _2)), expected_count());
+   c.check();
+}
+
+BOOST_FIXTURE_TEST_CASE( test_page_store_nonintrinsic_partitions, Fixture )
+{
+   KvdsPageStore<KvdsPageMapNonIntrinsicKey<> > kvds;
+   kvds.open(tdc.GetFilePath("KvdsPageStore").c_str());
+   populate(kvds);
+
+   Collector c;
+   KvdsParallelScan scan(4, 2);
+   BOOST_CHECK_EQUAL(scan(kvds, boost::bind(&Collector::visit, &c, _1, _2)), expected_count());
+   c.check();
+}
+
+BOOST_FIXTURE_TEST_CASE( test_page_store_partitions_in_batches, Fixture )
+{
+   KvdsPageStore<KvdsPageMapIntrinsicKey<uint32_t> > kvds;
+   kvds.open(tdc.GetFilePath("KvdsPageStore").c_str());
+
+   // more keys than a cursor takes at a time
+   uint32_t const n = 10000;
+
+   for(uint32_t key = 0; key < n; ++key)
+   {
+      BOOST_REQUIRE(kvds.put(&key, sizeof(key), &key, sizeof(key)));
+   }
+
+   std::vector<kvds_cursor_ptr_t> cursors;
+   kvds.partition(2, cursors);
+   BOOST_REQUIRE_EQUAL(cursors.size(), 2U);
+
+   std::vector<size_t> seen(n);
+   byte_array_t key;
+   byte_array_t val;
+
+   for(size_t i = 0; i < cursors.size(); ++i)
+   {
+      while(cursors[i]->next(key, val))
+      {
+         uint32_t k;
+         uint32_t v;
+         BOOST_REQUIRE_EQUAL(key.size(), sizeof(k));
+         BOOST_REQUIRE_EQUAL(val.size(), sizeof(v));
+         memcpy(&k, &key[0], sizeof(k));
+         memcpy(&v, &val[0], sizeof(v));
+         BOOST_REQUIRE_LT(k, n);
+         BOOST_CHECK_EQUAL(k, v);
+         ++seen[k];
+      }
+   }
+
+   BOOST_CHECK_EQUAL(std::count(seen.begin(), seen.end(), 1U), static_cast<std::ptrdiff_t>(n));
+}
+
+BOOST_FIXTURE_TEST_CASE( test_bbt_partitions, Fixture )
+{
+   KvdsBbt kvds;
+   kvds.open(tdc.GetFilePath("KvdsBbt").c_str());
+   populate(kvds);
+
+   std::vector<kvds_cursor_ptr_t> cursors;
+   kvds.partition(4, cursors);
+   BOOST_REQUIRE_GE(cursors.size(), 1U);
+   BOOST_REQUIRE_LE(cursors.size(), 4U);
+
+   // partitions are consecutive key ranges
+   Collector all;
+   byte_array_t key;
+   byte_array_t val;
+   byte_array_t last;
+
+   for(size_t i = 0; i < cursors.size(); ++i)
+   {
+      while(cursors[i]->next(key, val))
+      {
+         all.visit(key, val);
+
+         if(!last.empty())
+         {
+            BOOST_CHECK(memcmp(&last[0], &key[0], key.size()) < 0);
+         }
+
+         last = key;
+      }
+   }
+
+   all.check();
+
+   Collector c;
+   KvdsParallelScan scan(2);
+   BOOST_CHECK_EQUAL(scan(kvds, boost::bind(&Collector::visit, &c, _1, _2)), expected_count());
+   c.check();
+}
+
+BOOST_FIXTURE_TEST_CASE( test_visitor_errors, Fixture )
+{
+   KvdsPageStore<KvdsPageMapIntrinsicKey<uint32_t> > kvds;
+   kvds.open(tdc.GetFilePath("KvdsPageStore").c_str());
+   populate(kvds);
+
+   KvdsParallelScan scan(2);
+   BOOST_CHECK_THROW(scan(kvds, boost::bind(&fail_on, 100, _1, _2)), std::runtime_error);
+
+   KvdsMemMap mem;
+   populate(mem);
+   BOOST_CHECK_THROW(scan(mem, boost::bind(&fail_on, 100, _1, _2)), std::runtime_error);
+
+   BOOST_CHECK_THROW(KvdsParallelScan(0), std::runtime_error);
+}
+
+// Define end of test suite
+BOOST_AUTO_TEST_SUITE_END()
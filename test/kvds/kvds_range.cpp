@@ -0,0 +1,232 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Include boost test framework required headers
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+// Include CRT/STL required header(s)
+#include <stdexcept>
+#include <vector>
+#include <string>
+#include <cstring>
+
+#include "../../include/moost/testing/test_directory_creator.hpp"
+
+// Include application required header(s)
+#include "../../include/moost/kvds.hpp"
+#include "../../include/moost/kvds/kvds_range.hpp"
+
+// Imported required namespace(s)
+using namespace moost::kvds;
+using namespace moost::testing;
+
+// Name the test suite
+BOOST_AUTO_TEST_SUITE( kvdsRangeTest )
+
+// Define the test fixture
+struct Fixture
+{
+   test_directory_creator tdc;
+};
+
+namespace {
+
+byte_array_t bytes(std::string const & s)
+{
+   return byte_array_t(s.begin(), s.end());
+}
+
+std::string str(byte_array_t const & b)
+{
+   return std::string(b.begin(), b.end());
+}
+
+char const * const keys[] = {
+   "2013-06-19/b",
+   "2013-06-20/a",
+   "2013-06-20/b",
+   "2013-06-20/c",
+   "2013-06-20\xff",
+   "2013-06-21/a",
+   "2013-06-2",
+   "2013-07-01/a",
+   "\x80high",
+};
+
+size_t const num_keys = sizeof(keys)/sizeof(keys[0]);
+
+void populate(IKvds & kvds)
+{
+   for(size_t i = 0; i < num_keys; ++i)
+   {
+      std::string const val = std::string("value of ") + keys[i];
+      BOOST_REQUIRE(kvds.put(keys[i], strlen(keys[i]), val.data(), val.size()));
+   }
+}
+
+std::vector<std::string> drain(kvds_cursor_ptr_t cursor)
+{
+   std::vector<std::string> rv;
+   byte_array_t key;
+   byte_array_t val;
+
+   while(cursor->next(key, val))
+   {
+      BOOST_CHECK_EQUAL(str(val), "value of " + str(key));
+      rv.push_back(str(key));
+   }
+
+   BOOST_CHECK(!cursor->next(key, val));
+
+   return rv;
+}
+
+void check_queries(IKvds & kvds, KvdsRange::unordered_mode const mode)
+{
+   populate(kvds);
+   KvdsRange ranges(kvds, mode);
+
+   std::vector<std::string> rv = drain(ranges.prefix(bytes("2013-06-20")));
+   BOOST_REQUIRE_EQUAL(rv.size(), 4U);
+   BOOST_CHECK_EQUAL(rv[0], "2013-06-20/a");
+   BOOST_CHECK_EQUAL(rv[2], "2013-06-20/c");
+   BOOST_CHECK_EQUAL(rv[3], "2013-06-20\xff");
+
+   rv = drain(ranges.range(bytes("2013-06-2"), bytes("2013-06-21")));
+   BOOST_REQUIRE_EQUAL(rv.size(), 5U);
+   BOOST_CHECK_EQUAL(rv[0], "2013-06-2");
+   BOOST_CHECK_EQUAL(rv[1], "2013-06-20/a");
+
+   // unsigned order, so the high byte comes last
+   rv = drain(ranges.seek(bytes("2013-06-21")));
+   BOOST_REQUIRE_EQUAL(rv.size(), 3U);
+   BOOST_CHECK_EQUAL(rv[0], "2013-06-21/a");
+   BOOST_CHECK_EQUAL(rv[2], "\x80high");
+
+   BOOST_CHECK_EQUAL(drain(ranges.prefix(byte_array_t())).size(), num_keys);
+   BOOST_CHECK(drain(ranges.prefix(bytes("2014"))).empty());
+   BOOST_CHECK(drain(ranges.range(bytes("2013-07"), bytes("2013-06"))).empty());
+
+   // batches stop at the record count or once enough bytes are in
+   kvds_cursor_ptr_t cursor = ranges.prefix(bytes("2013-06"));
+   KvdsBatch batch;
+
+   BOOST_REQUIRE_EQUAL(cursor->read(batch, 2), 2U);
+   BOOST_CHECK_EQUAL(std::string(batch.key(0), batch.key_size(0)), "2013-06-19/b");
+   BOOST_CHECK_EQUAL(std::string(batch.val(1), batch.val_size(1)), "value of 2013-06-2");
+
+   BOOST_REQUIRE_EQUAL(cursor->read(batch, 100, 1), 1U);
+   BOOST_CHECK_EQUAL(std::string(batch.key(0), batch.key_size(0)), "2013-06-20/a");
+
+   BOOST_CHECK_EQUAL(cursor->read(batch, 100), 4U);
+   BOOST_CHECK_EQUAL(std::string(batch.key(3), batch.key_size(3)), "2013-06-21/a");
+   BOOST_CHECK_EQUAL(cursor->read(batch, 100), 0U);
+   BOOST_CHECK(batch.empty());
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( test_prefix_end )
+{
+   BOOST_CHECK(kvds_prefix_end(byte_array_t()).empty());
+   BOOST_CHECK_EQUAL(str(kvds_prefix_end(bytes("ab"))), "ac");
+   BOOST_CHECK_EQUAL(str(kvds_prefix_end(bytes("a\xff\xff"))), "b");
+   BOOST_CHECK(kvds_prefix_end(bytes("\xff\xff")).empty());
+}
+
+BOOST_AUTO_TEST_CASE( test_unordered_throws )
+{
+   KvdsMemMap kvds;
+   populate(kvds);
+
+   KvdsRange ranges(kvds);
+   BOOST_CHECK_THROW(ranges.prefix(bytes("2013")), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( test_mem_scan )
+{
+   KvdsMemMap kvds;
+   check_queries(kvds, KvdsRange::unordered_scan);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_bbt, Fixture )
+{
+   KvdsBbt kvds;
+   kvds.open(tdc.GetFilePath("KvdsBbt").c_str());
+
+   // natively ordered, no scan needed
+   check_queries(kvds, KvdsRange::unordered_throw);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_bbt_large_values, Fixture )
+{
+   KvdsBbt kvds;
+   kvds.open(tdc.GetFilePath("KvdsBbt").c_str());
+
+   // values larger than the cursor's bulk buffer
+   std::vector<std::string> vals;
+
+   for(size_t i = 0; i < 8; ++i)
+   {
+      std::string const key(1, static_cast<char>('a' + i));
+      vals.push_back(std::string((i + 1)*40000, static_cast<char>('A' + i)));
+      BOOST_REQUIRE(kvds.put(key.data(), key.size(), vals.back().data(), vals.back().size()));
+   }
+
+   KvdsRange ranges(kvds);
+   kvds_cursor_ptr_t cursor = ranges.range(bytes("b"), bytes("g"));
+
+   byte_array_t key;
+   byte_array_t val;
+
+   for(size_t i = 1; i < 6; ++i)
+   {
+      BOOST_REQUIRE(cursor->next(key, val));
+      BOOST_CHECK_EQUAL(str(key), std::string(1, static_cast<char>('a' + i)));
+      BOOST_CHECK(str(val) == vals[i]);
+   }
+
+   BOOST_CHECK(!cursor->next(key, val));
+}
+
+BOOST_FIXTURE_TEST_CASE( test_bht, Fixture )
+{
+   KvdsBht kvds;
+   kvds.open(tdc.GetFilePath("KvdsBht").c_str());
+
+   // a hash table has no order, so it takes a scan
+   BOOST_CHECK(!kvds.range(byte_array_t(), byte_array_t()));
+
+   KvdsRange ranges(kvds);
+   BOOST_CHECK_THROW(ranges.seek(bytes("2013")), std::runtime_error);
+
+   check_queries(kvds, KvdsRange::unordered_scan);
+}
+
+// Define end of test suite
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,384 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Include boost test framework required headers
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+// Include CRT/STL required header(s)
+#include <stdexcept>
+#include <vector>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+
+#include "../../include/moost/testing/test_directory_creator.hpp"
+
+// Include application required header(s)
+#include "../../include/moost/kvds/kvds_mem.hpp"
+#include "../../include/moost/kvds/kvds_tiered.hpp"
+
+// Imported required namespace(s)
+using boost::uint32_t;
+using namespace moost::kvds;
+using namespace moost::testing;
+
+// Name the test suite
+BOOST_AUTO_TEST_SUITE( kvdsTieredTest )
+
+// Define the test fixture
+struct Fixture
+{
+   test_directory_creator tdc;
+};
+
+namespace {
+
+/// remembers the order of the writes that make it to the cold store
+class RecordingStore : public KvdsMemMap
+{
+public:
+   RecordingStore() : reads(0) {}
+
+   bool put(void const * pkey, size_t const ksize, void const * pval, size_t const vsize)
+   {
+      puts.push_back(key_of(pkey, ksize));
+      return KvdsMemMap::put(pkey, ksize, pval, vsize);
+   }
+
+   bool del(void const * pkey, size_t const ksize)
+   {
+      dels.push_back(key_of(pkey, ksize));
+      return KvdsMemMap::del(pkey, ksize);
+   }
+
+   bool all(void const * pkey, size_t const ksize, void * pval, size_t & vsize)
+   {
+      ++reads;
+      return KvdsMemMap::all(pkey, ksize, pval, vsize);
+   }
+
+   std::vector<uint32_t> puts;
+   std::vector<uint32_t> dels;
+   size_t reads;
+
+private:
+   static uint32_t key_of(void const * pkey, size_t const ksize)
+   {
+      BOOST_REQUIRE_EQUAL(ksize, sizeof(uint32_t));
+      return *static_cast<uint32_t const *>(pkey);
+   }
+};
+
+typedef boost::shared_ptr<RecordingStore> recording_ptr_t;
+
+bool get(IKvds & kvds, uint32_t key, uint32_t & val)
+{
+   size_t vsize = sizeof(val);
+   return kvds.get(&key, sizeof(key), &val, vsize) && vsize == sizeof(val);
+}
+
+bool put(IKvds & kvds, uint32_t key, uint32_t val)
+{
+   return kvds.put(&key, sizeof(key), &val, sizeof(val));
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( test_read_through_and_eviction )
+{
+   recording_ptr_t cold(new RecordingStore);
+
+   for(uint32_t key = 0; key < 100; ++key)
+   {
+      BOOST_REQUIRE(put(*cold, key, key*10));
+   }
+
+   KvdsTiered::options opt;
+   opt.max_items = 10;
+   KvdsTiered kvds(cold, "tiered test eviction", opt);
+
+   uint32_t val = 0;
+
+   // make keys 0-4 hot
+   for(int round = 0; round < 50; ++round)
+   {
+      for(uint32_t key = 0; key < 5; ++key)
+      {
+         BOOST_REQUIRE(get(kvds, key, val));
+         BOOST_CHECK_EQUAL(val, key*10);
+      }
+   }
+
+   BOOST_CHECK_EQUAL(cold->reads, 5U);
+
+   // a scan over lots of keys that are only used once
+   for(uint32_t key = 5; key < 100; ++key)
+   {
+      BOOST_REQUIRE(get(kvds, key, val));
+      BOOST_CHECK_EQUAL(val, key*10);
+   }
+
+   BOOST_CHECK_EQUAL(kvds.hot_items(), 10U);
+   BOOST_CHECK_EQUAL(cold->reads, 100U);
+
+   // the frequently used keys should have survived the scan
+   for(uint32_t key = 0; key < 5; ++key)
+   {
+      BOOST_REQUIRE(get(kvds, key, val));
+   }
+
+   BOOST_CHECK_EQUAL(cold->reads, 100U);
+
+   uint32_t missing = 1000;
+   BOOST_CHECK(!get(kvds, missing, val));
+   BOOST_CHECK(!kvds.xst(&missing, sizeof(missing)));
+}
+
+BOOST_AUTO_TEST_CASE( test_write_back_flushes_in_key_order )
+{
+   moost::metrics::registry_singleton::instance().reset("kvds.tiered_test_write_back.");
+
+   recording_ptr_t cold(new RecordingStore);
+
+   KvdsTiered::options opt;
+   opt.max_items = 0;
+   opt.mode = KvdsTiered::write_back;
+   opt.flush_interval_ms = 0;
+   opt.flush_batch = 3;
+   KvdsTiered kvds(cold, "tiered test write back", opt);
+
+   uint32_t const keys[] = { 7, 3, 9, 1, 5, 3, 8 };
+
+   for(size_t i = 0; i < sizeof(keys)/sizeof(keys[0]); ++i)
+   {
+      BOOST_REQUIRE(put(kvds, keys[i], uint32_t(i)));
+   }
+
+   BOOST_CHECK(cold->puts.empty());
+   BOOST_CHECK_EQUAL(kvds.dirty_items(), 6U);
+
+   uint32_t val = 0;
+   BOOST_REQUIRE(get(kvds, 3, val));
+   BOOST_CHECK_EQUAL(val, 5U);
+
+   uint32_t key = 9;
+   BOOST_CHECK(kvds.del(&key, sizeof(key)));
+   BOOST_CHECK(!kvds.xst(&key, sizeof(key)));
+   BOOST_CHECK(!get(kvds, key, val));
+
+   kvds.flush();
+
+   uint32_t const expected[] = { 1, 3, 5, 7, 8 };
+   BOOST_CHECK_EQUAL_COLLECTIONS(cold->puts.begin(), cold->puts.end(), expected, expected + 5);
+   BOOST_CHECK_EQUAL(cold->dels.size(), 1U);
+   BOOST_CHECK_EQUAL(kvds.dirty_items(), 0U);
+   BOOST_CHECK_EQUAL(moost::metrics::get_counter("kvds.tiered_test_write_back.tier.flushed").value(), 6);
+   BOOST_CHECK_EQUAL(moost::metrics::get_gauge("kvds.tiered_test_write_back.tier.dirty").value(), 0);
+
+   BOOST_REQUIRE(get(*cold, 3, val));
+   BOOST_CHECK_EQUAL(val, 5U);
+
+   boost::uint64_t cnt = 0;
+   BOOST_REQUIRE(kvds.cnt(cnt));
+   BOOST_CHECK_EQUAL(cnt, 5U);
+}
+
+BOOST_AUTO_TEST_CASE( test_write_back_evicts_dirty_entries )
+{
+   recording_ptr_t cold(new RecordingStore);
+
+   KvdsTiered::options opt;
+   opt.max_items = 4;
+   opt.mode = KvdsTiered::write_back;
+   opt.flush_interval_ms = 0;
+
+   {
+      KvdsTiered kvds(cold, "tiered test write back", opt);
+
+      for(uint32_t key = 0; key < 20; ++key)
+      {
+         BOOST_REQUIRE(put(kvds, key, key + 1));
+      }
+
+      BOOST_CHECK_EQUAL(kvds.hot_items(), 4U);
+      BOOST_CHECK_EQUAL(cold->puts.size(), 16U);
+
+      for(uint32_t key = 0; key < 20; ++key)
+      {
+         uint32_t val = 0;
+         BOOST_REQUIRE(get(kvds, key, val));
+         BOOST_CHECK_EQUAL(val, key + 1);
+      }
+   }
+
+   // the destructor flushes what's left
+   boost::uint64_t cnt = 0;
+   BOOST_REQUIRE(cold->cnt(cnt));
+   BOOST_CHECK_EQUAL(cnt, 20U);
+}
+
+BOOST_AUTO_TEST_CASE( test_background_flush )
+{
+   recording_ptr_t cold(new RecordingStore);
+
+   KvdsTiered::options opt;
+   opt.mode = KvdsTiered::write_back;
+   opt.flush_interval_ms = 5;
+   KvdsTiered kvds(cold, "tiered test background", opt);
+
+   for(uint32_t key = 0; key < 100; ++key)
+   {
+      BOOST_REQUIRE(put(kvds, key, key));
+   }
+
+   for(int i = 0; i < 1000 && kvds.dirty_items() > 0; ++i)
+   {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+   }
+
+   BOOST_CHECK_EQUAL(kvds.dirty_items(), 0U);
+
+   kvds.flush();
+   BOOST_CHECK_EQUAL(cold->puts.size(), 100U);
+}
+
+BOOST_AUTO_TEST_CASE( test_byte_limit )
+{
+   recording_ptr_t cold(new RecordingStore);
+
+   KvdsTiered::options opt;
+   opt.max_items = 0;
+   opt.max_bytes = 1024;
+   KvdsTiered kvds(cold, "tiered test bytes", opt);
+
+   std::string big(4096, 'x');
+   uint32_t key = 1;
+   BOOST_REQUIRE(kvds.put(&key, sizeof(key), big.data(), big.size()));
+   BOOST_CHECK_EQUAL(kvds.hot_items(), 0U);
+
+   std::vector<char> out(big.size());
+   size_t vsize = out.size();
+   BOOST_REQUIRE(kvds.all(&key, sizeof(key), &out[0], vsize));
+   BOOST_CHECK_EQUAL(vsize, big.size());
+   BOOST_CHECK_EQUAL(kvds.hot_items(), 0U);
+
+   for(key = 2; key < 100; ++key)
+   {
+      BOOST_REQUIRE(put(kvds, key, key));
+   }
+
+   BOOST_CHECK_LE(kvds.hot_bytes(), opt.max_bytes);
+   BOOST_CHECK_GT(kvds.hot_items(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE( test_byte_limit_on_growth )
+{
+   recording_ptr_t cold(new RecordingStore);
+
+   KvdsTiered::options opt;
+   opt.max_items = 0;
+   opt.max_bytes = 1024;
+   KvdsTiered kvds(cold, "tiered test growth", opt);
+
+   std::string const small(400, 'x');
+   uint32_t key = 1;
+   BOOST_REQUIRE(kvds.put(&key, sizeof(key), small.data(), small.size()));
+   key = 2;
+   BOOST_REQUIRE(kvds.put(&key, sizeof(key), small.data(), small.size()));
+   BOOST_CHECK_EQUAL(kvds.hot_items(), 2U);
+
+   // overwritten with a bigger value, the other entry has to go
+   std::string const big(900, 'y');
+   BOOST_REQUIRE(kvds.put(&key, sizeof(key), big.data(), big.size()));
+   BOOST_CHECK_LE(kvds.hot_bytes(), opt.max_bytes);
+   BOOST_CHECK_EQUAL(kvds.hot_items(), 1U);
+
+   // and the same when appending
+   key = 3;
+   BOOST_REQUIRE(kvds.put(&key, sizeof(key), small.data(), 100));
+   BOOST_REQUIRE(kvds.add(&key, sizeof(key), small.data(), 300));
+   BOOST_CHECK_LE(kvds.hot_bytes(), opt.max_bytes);
+
+   std::vector<char> out(big.size());
+   size_t vsize = out.size();
+   key = 2;
+   BOOST_REQUIRE(kvds.all(&key, sizeof(key), &out[0], vsize));
+   BOOST_CHECK_EQUAL(std::string(&out[0], vsize), big);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_warm_up, Fixture )
+{
+   std::string const hot_keys = tdc.GetFilePath("hot_keys");
+
+   recording_ptr_t cold(new RecordingStore);
+
+   for(uint32_t key = 0; key < 50; ++key)
+   {
+      BOOST_REQUIRE(put(*cold, key, key));
+   }
+
+   KvdsTiered::options opt;
+   opt.max_items = 5;
+
+   {
+      KvdsTiered kvds(cold, "tiered test warm up", opt);
+      uint32_t val = 0;
+
+      for(int round = 0; round < 5; ++round)
+      {
+         for(uint32_t key = 40; key < 45; ++key)
+         {
+            BOOST_REQUIRE(get(kvds, key, val));
+         }
+      }
+
+      kvds.save_hot_keys(hot_keys);
+   }
+
+   cold->reads = 0;
+
+   KvdsTiered kvds(cold, "tiered test warm up", opt);
+   BOOST_CHECK_EQUAL(kvds.warm_up_from_file(hot_keys), 5U);
+   BOOST_CHECK_EQUAL(cold->reads, 5U);
+
+   uint32_t val = 0;
+
+   for(uint32_t key = 40; key < 45; ++key)
+   {
+      BOOST_REQUIRE(get(kvds, key, val));
+      BOOST_CHECK_EQUAL(val, key);
+   }
+
+   BOOST_CHECK_EQUAL(cold->reads, 5U);
+
+   BOOST_CHECK_THROW(kvds.warm_up_from_file(tdc.GetFilePath("nothing")), std::runtime_error);
+}
+
+// Define end of test suite
+BOOST_AUTO_TEST_SUITE_END()
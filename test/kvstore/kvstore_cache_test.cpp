@@ -0,0 +1,350 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/barrier.hpp>
+
+#include "../../include/moost/kvstore/caching_kyoto_tycoon_connection.hpp"
+#include "../../include/moost/kvstore/kyoto_tycoon_client.hpp"
+#include "../../include/moost/kvstore/mock_connection.hpp"
+
+using namespace moost::kvstore;
+
+BOOST_AUTO_TEST_SUITE( kvstore_cache_test )
+
+namespace {
+
+typedef MockKyotoTycoonConnection<> connection_t;
+
+struct Fixture
+{
+   Fixture()
+   {
+      remote.open("", 0, 0);
+      connection_t::set_round_trip_latency_us(0);
+      connection_t::reset_round_trips();
+   }
+
+   ~Fixture()
+   {
+      connection_t::set_round_trip_latency_us(0);
+   }
+
+   void remote_set(const std::string& key, int val)
+   {
+      remote.set(key.data(), key.size(), &val, sizeof(val));
+   }
+
+   connection_t remote;
+};
+
+class ThrowingConnection : public IKyotoTycoonConnection
+{
+public:
+   void open(const std::string&, int, int) { }
+   void close() { }
+
+   boost::shared_array<char> get(const void*, size_t, size_t&) const
+   {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+      throw std::runtime_error("get failed");
+   }
+
+   void set(const void*, size_t, const void*, size_t) const { }
+   void cache(const void*, size_t, const void*, size_t, boost::int64_t) const { }
+};
+
+// Boost.Test assertions aren't thread safe, so results are collected instead
+void concurrent_get(KyotoTycoonCache& cache, const IKyotoTycoonConnection& conn, const std::string& key,
+                    boost::barrier& start, int& result)
+{
+   start.wait();
+   try
+   {
+      size_t vsize;
+      boost::shared_array<char> val = cache.get(conn, key, vsize);
+      result = (val && vsize == sizeof(int)) ? *reinterpret_cast<int *>(val.get()) : -1;
+   }
+   catch (const std::runtime_error&)
+   {
+      result = -2;
+   }
+}
+
+}
+
+BOOST_FIXTURE_TEST_CASE( test_cache_read_through, Fixture )
+{
+   KyotoTycoonCache cache(100);
+   CachingKyotoTycoonConnection conn(remote, cache);
+   KyotoTycoonClient client(conn);
+
+   remote_set("cache_rt", 42);
+   connection_t::reset_round_trips();
+
+   int i = 0;
+   BOOST_CHECK(client.get(std::string("cache_rt"), i));
+   BOOST_CHECK_EQUAL(42, i);
+   BOOST_CHECK_EQUAL(1u, connection_t::round_trips());
+
+   i = 0;
+   BOOST_CHECK(client.get(std::string("cache_rt"), i));
+   BOOST_CHECK_EQUAL(42, i);
+   BOOST_CHECK_EQUAL(1u, connection_t::round_trips());
+
+   KyotoTycoonCacheStats st;
+   cache.stats(st);
+   BOOST_CHECK_EQUAL(1u, st.hits);
+   BOOST_CHECK_EQUAL(1u, st.misses);
+   BOOST_CHECK_EQUAL(1u, st.entries);
+   BOOST_CHECK_CLOSE(0.5, st.hit_rate(), 0.0001);
+
+   cache.reset_stats();
+   cache.stats(st);
+   BOOST_CHECK_EQUAL(0u, st.lookups());
+}
+
+BOOST_FIXTURE_TEST_CASE( test_cache_write_through, Fixture )
+{
+   KyotoTycoonCache cache(100);
+   CachingKyotoTycoonConnection conn(remote, cache);
+   KyotoTycoonClient client(conn);
+
+   client.set(std::string("cache_wt"), 1);
+   client.cache(std::string("cache_wt2"), 2, 3600);
+   connection_t::reset_round_trips();
+
+   int i = 0;
+   BOOST_CHECK(client.get(std::string("cache_wt"), i));
+   BOOST_CHECK_EQUAL(1, i);
+   BOOST_CHECK(client.get(std::string("cache_wt2"), i));
+   BOOST_CHECK_EQUAL(2, i);
+   BOOST_CHECK_EQUAL(0u, connection_t::round_trips());
+
+   BOOST_CHECK(client.remove(std::string("cache_wt")));
+   BOOST_CHECK(!client.get(std::string("cache_wt"), i));
+}
+
+BOOST_FIXTURE_TEST_CASE( test_cache_negative, Fixture )
+{
+   KyotoTycoonCache cache(100, 60000, 50);
+   CachingKyotoTycoonConnection conn(remote, cache);
+   KyotoTycoonClient client(conn);
+
+   int i = 0;
+   BOOST_CHECK(!client.get(std::string("cache_neg"), i));
+   remote_set("cache_neg", 7);
+
+   // still cached as missing
+   BOOST_CHECK(!client.get(std::string("cache_neg"), i));
+   BOOST_CHECK_EQUAL(2u, connection_t::round_trips());   // including the set
+
+   boost::this_thread::sleep(boost::posix_time::milliseconds(80));
+   BOOST_CHECK(client.get(std::string("cache_neg"), i));
+   BOOST_CHECK_EQUAL(7, i);
+
+   KyotoTycoonCacheStats st;
+   cache.stats(st);
+   BOOST_CHECK_EQUAL(1u, st.negative_hits);
+   BOOST_CHECK_EQUAL(1u, st.expirations);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_cache_server_expiry, Fixture )
+{
+   KyotoTycoonCache cache(100);
+   CachingKyotoTycoonConnection conn(remote, cache);
+
+   std::string key("cache_expiry");
+   int val = 3;
+   remote.cache(key.data(), key.size(), &val, sizeof(val), 1);
+
+   size_t vsize;
+   BOOST_CHECK(conn.get(key.data(), key.size(), vsize));
+   BOOST_CHECK(conn.get(key.data(), key.size(), vsize));
+   BOOST_CHECK_EQUAL(2u, connection_t::round_trips());
+
+   // the cached value expires with the record, not after the max ttl
+   boost::this_thread::sleep(boost::posix_time::milliseconds(1100));
+   conn.get(key.data(), key.size(), vsize);
+   BOOST_CHECK_EQUAL(3u, connection_t::round_trips());
+}
+
+BOOST_FIXTURE_TEST_CASE( test_cache_max_ttl, Fixture )
+{
+   KyotoTycoonCache cache(100, 30);
+   CachingKyotoTycoonConnection conn(remote, cache);
+   KyotoTycoonClient client(conn);
+
+   remote_set("cache_ttl", 1);
+   int i = 0;
+   client.get(std::string("cache_ttl"), i);
+   remote_set("cache_ttl", 2);
+   client.get(std::string("cache_ttl"), i);
+   BOOST_CHECK_EQUAL(1, i);
+
+   boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+   client.get(std::string("cache_ttl"), i);
+   BOOST_CHECK_EQUAL(2, i);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_cache_size_bound, Fixture )
+{
+   KyotoTycoonCache cache(4, 60000, 1000, 1);
+   CachingKyotoTycoonConnection conn(remote, cache);
+   KyotoTycoonClient client(conn);
+
+   for (int k = 0; k < 10; ++k)
+      client.set(k + 5000, k);
+
+   KyotoTycoonCacheStats st;
+   cache.stats(st);
+   BOOST_CHECK_EQUAL(4u, st.entries);
+   BOOST_CHECK_EQUAL(6u, st.evictions);
+
+   // least recently used keys went first
+   connection_t::reset_round_trips();
+   int i = 0;
+   BOOST_CHECK(client.get(5009, i));
+   BOOST_CHECK_EQUAL(0u, connection_t::round_trips());
+   BOOST_CHECK(client.get(5000, i));
+   BOOST_CHECK_EQUAL(1u, connection_t::round_trips());
+}
+
+BOOST_FIXTURE_TEST_CASE( test_cache_bulk, Fixture )
+{
+   KyotoTycoonCache cache(100);
+   CachingKyotoTycoonConnection conn(remote, cache);
+   KyotoTycoonClient client(conn);
+
+   remote_set("cache_bulk_a", 1);
+   remote_set("cache_bulk_b", 2);
+
+   int i = 0;
+   client.get(std::string("cache_bulk_a"), i);
+   connection_t::reset_round_trips();
+
+   std::vector<std::string> keys;
+   keys.push_back("cache_bulk_a");
+   keys.push_back("cache_bulk_b");
+   keys.push_back("cache_bulk_c");
+
+   std::map<std::string, int> vals;
+   BOOST_CHECK_EQUAL(2u, client.get_bulk(keys, vals));
+   BOOST_CHECK_EQUAL(1, vals["cache_bulk_a"]);
+   BOOST_CHECK_EQUAL(2, vals["cache_bulk_b"]);
+   BOOST_CHECK_EQUAL(1u, connection_t::round_trips());
+
+   // everything is cached now, including the missing key
+   vals.clear();
+   BOOST_CHECK_EQUAL(2u, client.get_bulk(keys, vals));
+   BOOST_CHECK_EQUAL(1u, connection_t::round_trips());
+
+   BOOST_CHECK_EQUAL(2u, client.remove_bulk(keys));
+   BOOST_CHECK(!client.get(std::string("cache_bulk_b"), i));
+}
+
+BOOST_FIXTURE_TEST_CASE( test_cache_bulk_server_expiry, Fixture )
+{
+   KyotoTycoonCache cache(100);
+   CachingKyotoTycoonConnection conn(remote, cache);
+
+   std::string key("cache_bulk_expiry");
+   int val = 4;
+   remote.cache(key.data(), key.size(), &val, sizeof(val), 1);
+
+   IKyotoTycoonConnection::key_list_t keys(1, key);
+   IKyotoTycoonConnection::record_map_t recs;
+   BOOST_CHECK_EQUAL(1u, conn.get_bulk(keys, recs));
+   BOOST_CHECK_EQUAL(1u, conn.get_bulk(keys, recs));
+   BOOST_CHECK_EQUAL(2u, connection_t::round_trips());
+
+   // fetched in bulk, the cached value still expires with the record
+   boost::this_thread::sleep(boost::posix_time::milliseconds(1100));
+   conn.get_bulk(keys, recs);
+   BOOST_CHECK_EQUAL(3u, connection_t::round_trips());
+}
+
+BOOST_FIXTURE_TEST_CASE( test_cache_single_flight, Fixture )
+{
+   KyotoTycoonCache cache(100);
+   remote_set("cache_sf", 9);
+   connection_t::set_round_trip_latency_us(100000);
+   connection_t::reset_round_trips();
+
+   const size_t num_threads = 8;
+   std::vector<int> results(num_threads, 0);
+   boost::barrier start(num_threads);
+   boost::thread_group threads;
+
+   for (size_t t = 0; t < num_threads; ++t)
+      threads.create_thread(boost::bind(&concurrent_get, boost::ref(cache), boost::cref(remote),
+                                        std::string("cache_sf"), boost::ref(start), boost::ref(results[t])));
+   threads.join_all();
+
+   for (size_t t = 0; t < num_threads; ++t)
+      BOOST_CHECK_EQUAL(9, results[t]);
+   BOOST_CHECK_EQUAL(1u, connection_t::round_trips());
+
+   KyotoTycoonCacheStats st;
+   cache.stats(st);
+   BOOST_CHECK_EQUAL(1u, st.misses);
+   BOOST_CHECK_EQUAL(num_threads - 1, st.coalesced);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_cache_fetch_error, Fixture )
+{
+   KyotoTycoonCache cache(100);
+   ThrowingConnection failing;
+
+   const size_t num_threads = 4;
+   std::vector<int> results(num_threads, 0);
+   boost::barrier start(num_threads);
+   boost::thread_group threads;
+
+   for (size_t t = 0; t < num_threads; ++t)
+      threads.create_thread(boost::bind(&concurrent_get, boost::ref(cache), boost::cref(failing),
+                                        std::string("cache_err"), boost::ref(start), boost::ref(results[t])));
+   threads.join_all();
+
+   // every waiter sees the error and nothing is cached
+   for (size_t t = 0; t < num_threads; ++t)
+      BOOST_CHECK_EQUAL(-2, results[t]);
+
+   KyotoTycoonCacheStats st;
+   cache.stats(st);
+   BOOST_CHECK_EQUAL(0u, st.entries);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -33,6 +33,7 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <map>
 
 #include "../../include/moost/kvstore/kyoto_tycoon_client.hpp"
 #include "../../include/moost/kvstore/mock_connection.hpp"
@@ -201,4 +202,83 @@ BOOST_FIXTURE_TEST_CASE( test_kyoto_tycoon_client_string_keys, Fixture )
    tester.run();
 }
 
+BOOST_FIXTURE_TEST_CASE( test_kyoto_tycoon_client_bulk_pod_keys, Fixture )
+{
+   MockKyotoTycoonConnection<UnitTestAccessPolicy> conn;
+   conn.open("", 0, 0);
+
+   KyotoTycoonClient client(conn);
+
+   std::map<int, double> in;
+   for (int i = 1000; i < 1100; ++i)
+      in[i] = i/2.0;
+   client.set_bulk(in);
+
+   std::vector<int> keys;
+   keys.push_back(1000);
+   keys.push_back(1050);
+   keys.push_back(5000);   // not there
+
+   std::map<int, double> out;
+   BOOST_REQUIRE_EQUAL(2u, client.get_bulk(keys, out));
+   BOOST_REQUIRE_EQUAL(2u, out.size());
+   BOOST_REQUIRE_CLOSE(500.0, out[1000], 0.0001);
+   BOOST_REQUIRE_CLOSE(525.0, out[1050], 0.0001);
+
+   BOOST_REQUIRE_EQUAL(2u, client.remove_bulk(keys));
+   out.clear();
+   BOOST_REQUIRE_EQUAL(0u, client.get_bulk(keys, out));
+   BOOST_REQUIRE(client.remove(1001));
+   BOOST_REQUIRE(!client.remove(1001));
+}
+
+BOOST_FIXTURE_TEST_CASE( test_kyoto_tycoon_client_bulk_string_keys, Fixture )
+{
+   MockKyotoTycoonConnection<UnitTestAccessPolicy> conn;
+   conn.open("", 0, 0);
+
+   KyotoTycoonClient client(conn);
+
+   std::map<std::string, std::vector<int> > in;
+   in["bulk_a"].push_back(1);
+   in["bulk_b"].push_back(2);
+   in["bulk_b"].push_back(3);
+   in["bulk_c"];   // empty value
+   client.cache_bulk(in, 3600);
+
+   std::vector<std::string> keys;
+   keys.push_back("bulk_a");
+   keys.push_back("bulk_b");
+   keys.push_back("bulk_c");
+
+   std::map<std::string, std::vector<int> > out;
+   BOOST_REQUIRE_EQUAL(3u, client.get_bulk(keys, out));
+   BOOST_REQUIRE(in == out);
+
+   // a value that isn't a whole number of elements
+   client.set(std::string("bulk_d"), 'x');
+   keys.push_back("bulk_d");
+   BOOST_REQUIRE_THROW(client.get_bulk(keys, out), std::runtime_error);
+
+   std::map<std::string, int> fail;
+   fail["fail"] = 1;
+   BOOST_REQUIRE_THROW(client.set_bulk(fail), std::runtime_error);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_kyoto_tycoon_client_cache_expiry, Fixture )
+{
+   MockKyotoTycoonConnection<UnitTestAccessPolicy> conn;
+   conn.open("", 0, 0);
+
+   KyotoTycoonClient client(conn);
+
+   int i = 0;
+   client.cache(std::string("expiry_live"), 1, 3600);
+   BOOST_REQUIRE(client.get(std::string("expiry_live"), i));
+   BOOST_REQUIRE_EQUAL(1, i);
+
+   client.cache(std::string("expiry_dead"), 1, -10);
+   BOOST_REQUIRE(!client.get(std::string("expiry_dead"), i));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,253 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+#include <stdexcept>
+#include <sstream>
+#include <string>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "../../include/moost/kvstore/kyoto_tycoon_connection_pool.hpp"
+#include "../../include/moost/kvstore/mock_connection.hpp"
+
+using namespace moost::kvstore;
+
+BOOST_AUTO_TEST_SUITE( kvstore_pool_test )
+
+namespace {
+
+class FailingAccessPolicy
+{
+public:
+   template <class StoreT>
+   static boost::shared_array<char> get(StoreT& store, const char* pkey, size_t ksize, size_t& vsize)
+   {
+      return store.get(std::string(pkey, ksize), vsize);
+   }
+
+   template <class StoreT>
+   static void set(StoreT& store, const char* pkey, size_t ksize, const char* pval, size_t vsize)
+   {
+      std::string key(pkey, ksize);
+      if ("fail" == key) { throw std::runtime_error("set failed"); }
+      store.set(key, pval, vsize);
+   }
+
+   template <class StoreT>
+   static void cache(StoreT& store, const char* pkey, size_t ksize, const char* pval, size_t vsize, boost::int64_t expirySecs)
+   {
+      std::string key(pkey, ksize);
+      if ("fail" == key) { throw std::runtime_error("cache failed"); }
+      store.cache(key, pval, vsize, expirySecs);
+   }
+};
+
+typedef MockKyotoTycoonConnection<FailingAccessPolicy> connection_t;
+typedef KyotoTycoonConnectionPool<connection_t> pool_t;
+
+struct Fixture
+{
+   Fixture()
+   {
+      connection_t::set_round_trip_latency_us(0);
+      connection_t::set_unhealthy(false);
+      connection_t::reset_round_trips();
+   }
+
+   ~Fixture()
+   {
+      connection_t::set_round_trip_latency_us(0);
+      connection_t::set_unhealthy(false);
+   }
+
+   static void make_records(const std::string& prefix, size_t count,
+                            IKyotoTycoonConnection::record_map_t& recs,
+                            IKyotoTycoonConnection::key_list_t& keys)
+   {
+      for (size_t i = 0; i < count; ++i)
+      {
+         std::ostringstream oss;
+         oss << prefix << i;
+         recs[oss.str()] = oss.str() + "_value";
+         keys.push_back(oss.str());
+      }
+   }
+};
+
+// Boost.Test assertions aren't thread safe, so just count mismatches
+void use_pool(pool_t& pool, const std::string& prefix, boost::atomic<int>& mismatches)
+{
+   IKyotoTycoonConnection::record_map_t recs, out;
+   IKyotoTycoonConnection::key_list_t keys;
+   Fixture::make_records(prefix, 50, recs, keys);
+
+   for (int i = 0; i < 20; ++i)
+   {
+      pool.set_bulk(recs);
+      out.clear();
+      if (pool.get_bulk(keys, out) != recs.size() || recs != out)
+         ++mismatches;
+   }
+}
+
+}
+
+BOOST_FIXTURE_TEST_CASE( test_pool_bulk, Fixture )
+{
+   pool_t pool("", 0, 0, 4, -1, 10);
+
+   IKyotoTycoonConnection::record_map_t recs, out;
+   IKyotoTycoonConnection::key_list_t keys;
+   make_records("pool_bulk_", 95, recs, keys);
+
+   pool.set_bulk(recs);
+   // one round trip per batch of 10
+   BOOST_CHECK_EQUAL(10u, connection_t::round_trips());
+
+   keys.push_back("pool_bulk_missing");
+   BOOST_CHECK_EQUAL(recs.size(), pool.get_bulk(keys, out));
+   BOOST_CHECK(recs == out);
+
+   BOOST_CHECK_EQUAL(recs.size(), pool.remove_bulk(keys));
+   out.clear();
+   BOOST_CHECK_EQUAL(0u, pool.get_bulk(keys, out));
+   BOOST_CHECK(out.empty());
+
+   // connections are opened lazily and then reused
+   BOOST_CHECK(pool.connects() <= pool.size());
+
+   keys.clear();
+   BOOST_CHECK_EQUAL(0u, pool.get_bulk(keys, out));
+}
+
+BOOST_FIXTURE_TEST_CASE( test_pool_batches_overlap, Fixture )
+{
+   pool_t pool("", 0, 0, 8, -1, 10);
+
+   IKyotoTycoonConnection::record_map_t recs, out;
+   IKyotoTycoonConnection::key_list_t keys;
+   make_records("pool_overlap_", 80, recs, keys);
+   pool.set_bulk(recs);
+
+   // 8 batches with 20ms each would take 160ms if issued one after the other
+   connection_t::set_round_trip_latency_us(20000);
+
+   boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+   BOOST_CHECK_EQUAL(recs.size(), pool.get_bulk(keys, out));
+   boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+
+   BOOST_CHECK(recs == out);
+   BOOST_CHECK_LT(elapsed.total_milliseconds(), 120);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_pool_scoped_connection, Fixture )
+{
+   pool_t pool("", 0, 0, 1, 0);
+
+   {
+      pool_t::ScopedConnection conn(pool);
+      std::string key("pool_scoped"), val("value");
+      conn->set(key.data(), key.size(), val.data(), val.size());
+   }
+
+   BOOST_CHECK_EQUAL(1u, pool.connects());
+
+   // healthy connections survive the health check
+   boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+   {
+      pool_t::ScopedConnection conn(pool);
+   }
+   BOOST_CHECK_EQUAL(1u, pool.connects());
+   BOOST_CHECK_EQUAL(0u, pool.failed_health_checks());
+
+   // broken ones are reopened
+   connection_t::set_unhealthy(true);
+   boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+   {
+      pool_t::ScopedConnection conn(pool);
+      size_t vsize;
+      std::string key("pool_scoped");
+      BOOST_CHECK(conn->get(key.data(), key.size(), vsize));
+   }
+   BOOST_CHECK_EQUAL(2u, pool.connects());
+   BOOST_CHECK_EQUAL(1u, pool.failed_health_checks());
+
+   connection_t::set_unhealthy(false);
+   {
+      pool_t::ScopedConnection conn(pool);
+      conn.invalidate();
+   }
+   {
+      pool_t::ScopedConnection conn(pool);
+   }
+   BOOST_CHECK_EQUAL(3u, pool.connects());
+}
+
+BOOST_FIXTURE_TEST_CASE( test_pool_errors, Fixture )
+{
+   pool_t pool("", 0, 0, 1, -1, 2);
+
+   IKyotoTycoonConnection::record_map_t recs;
+   IKyotoTycoonConnection::key_list_t keys;
+   make_records("pool_errors_", 6, recs, keys);
+   recs["fail"] = "x";
+
+   BOOST_CHECK_THROW(pool.set_bulk(recs), std::runtime_error);
+
+   // the failed connection was invalidated and is reopened on demand
+   recs.erase("fail");
+   pool.set_bulk(recs);
+   BOOST_CHECK_EQUAL(2u, pool.connects());
+
+   BOOST_CHECK_THROW(pool_t("", 0, 0, 0), std::runtime_error);
+}
+
+BOOST_FIXTURE_TEST_CASE( test_pool_concurrent, Fixture )
+{
+   pool_t pool("", 0, 0, 3, 0, 7);
+
+   boost::atomic<int> mismatches(0);
+   boost::thread_group threads;
+   for (int i = 0; i < 4; ++i)
+   {
+      std::ostringstream oss;
+      oss << "pool_concurrent_" << i << "_";
+      threads.create_thread(boost::bind(&use_pool, boost::ref(pool), oss.str(), boost::ref(mismatches)));
+   }
+   threads.join_all();
+
+   BOOST_CHECK_EQUAL(0, mismatches.load());
+
+   BOOST_CHECK(pool.connects() <= pool.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,336 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <sstream>
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "../../include/moost/logging/logger.hpp"
+
+#include "capture_appender.h"
+
+using namespace moost::logging;
+
+namespace {
+
+struct Fixture
+{
+   Fixture()
+      : logger(MLOG_NAMED_LOGGER("moost.async_logger.test"))
+      , app(new capture_appender)
+   {
+      logger->removeAllAppenders();
+      logger->setAdditivity(false);
+      logger->setLevel(log4cxx::Level::getTrace());
+      logger->addAppender(log4cxx::AppenderPtr(app));
+   }
+
+   ~Fixture()
+   {
+      async_logger_singleton::instance().stop();
+      logger->removeAllAppenders();
+   }
+
+   log4cxx::LoggerPtr logger;
+   capture_appender * app;
+};
+
+void log_sequence(log4cxx::LoggerPtr logger, int thread, int count)
+{
+   for (int i = 0; i < count; ++i)
+      MLOG_INFO(logger, thread << ":" << i);
+}
+
+std::string log_and_return(log4cxx::LoggerPtr logger, std::string const & msg)
+{
+   MLOG_INFO(logger, "inner " << msg);
+   return msg;
+}
+
+void log_debug(log4cxx::LoggerPtr logger, int count)
+{
+   for (int i = 0; i < count; ++i)
+      MLOG_DEBUG(logger, "debug " << i);
+}
+
+}
+
+BOOST_FIXTURE_TEST_SUITE(async_logger_test, Fixture)
+
+BOOST_AUTO_TEST_CASE(test_synchronous_when_not_started)
+{
+   BOOST_REQUIRE(!async_logger_singleton::instance().is_running());
+
+   MLOG_INFO(logger, "value " << 42);
+   MLOG_TRACE(logger, "trace");
+
+   std::vector<std::string> messages = app->messages();
+   BOOST_REQUIRE_EQUAL(messages.size(), 2u);
+   BOOST_CHECK_EQUAL(messages[0], "value 42");
+   BOOST_CHECK(app->threads()[0] == boost::this_thread::get_id());
+}
+
+BOOST_AUTO_TEST_CASE(test_disabled_level_is_not_formatted)
+{
+   async_logger_singleton::instance().start();
+   logger->setLevel(log4cxx::Level::getWarn());
+
+   int evaluated = 0;
+   MLOG_INFO(logger, "not logged " << ++evaluated);
+   MLOG_WARN(logger, "logged " << ++evaluated);
+
+   BOOST_REQUIRE(async_logger_singleton::instance().flush(5000));
+   BOOST_CHECK_EQUAL(evaluated, 1);
+   BOOST_REQUIRE_EQUAL(app->count(), 1u);
+   BOOST_CHECK_EQUAL(app->messages()[0], "logged 1");
+}
+
+BOOST_AUTO_TEST_CASE(test_appenders_run_on_dispatcher)
+{
+   async_logger_singleton::instance().start();
+
+   MLOG_INFO(logger, "hello " << std::hex << 255);
+   MLOG_INFO(logger, 255);   // formatting isn't carried over between records
+
+   BOOST_REQUIRE(async_logger_singleton::instance().flush(5000));
+
+   std::vector<std::string> messages = app->messages();
+   BOOST_REQUIRE_EQUAL(messages.size(), 2u);
+   BOOST_CHECK_EQUAL(messages[0], "hello ff");
+   BOOST_CHECK_EQUAL(messages[1], "255");
+   BOOST_CHECK(app->threads()[0] != boost::this_thread::get_id());
+}
+
+BOOST_AUTO_TEST_CASE(test_nested_log_in_message)
+{
+   async_logger_singleton::instance().start();
+
+   // leave an earlier record's bytes in the ring slots the next pushes swap with
+   for (int i = 0; i < 4; ++i)
+      MLOG_INFO(logger, "earlier record " << i);
+   BOOST_REQUIRE(async_logger_singleton::instance().flush(5000));
+
+   MLOG_INFO(logger, "outer " << log_and_return(logger, "a") << " " << log_and_return(logger, "b"));
+   MLOG_INFO(logger, "after");
+
+   BOOST_REQUIRE(async_logger_singleton::instance().flush(5000));
+
+   // the inner calls are logged synchronously, before the outer record
+   std::vector<std::string> messages = app->messages();
+   BOOST_REQUIRE_EQUAL(messages.size(), 8u);
+   BOOST_CHECK_EQUAL(messages[4], "inner a");
+   BOOST_CHECK_EQUAL(messages[5], "inner b");
+   BOOST_CHECK_EQUAL(messages[6], "outer a b");
+   BOOST_CHECK_EQUAL(messages[7], "after");
+   BOOST_CHECK(app->threads()[4] == boost::this_thread::get_id());
+   BOOST_CHECK(app->threads()[6] != boost::this_thread::get_id());
+}
+
+BOOST_AUTO_TEST_CASE(test_per_thread_order)
+{
+   const int threads = 4;
+   const int count = 5000;
+
+   async_logger_singleton::instance().start(1024, async_overflow_policy::BLOCK);
+
+   boost::thread_group group;
+   for (int t = 0; t < threads; ++t)
+      group.create_thread(boost::bind(&log_sequence, logger, t, count));
+   group.join_all();
+
+   BOOST_REQUIRE(async_logger_singleton::instance().flush(10000));
+
+   std::vector<std::string> messages = app->messages();
+   BOOST_REQUIRE_EQUAL(messages.size(), size_t(threads * count));
+
+   std::vector<int> next(threads, 0);
+   size_t out_of_order = 0;
+   for (size_t i = 0; i < messages.size(); ++i)
+   {
+      size_t colon = messages[i].find(':');
+      int t = boost::lexical_cast<int>(messages[i].substr(0, colon));
+      int n = boost::lexical_cast<int>(messages[i].substr(colon + 1));
+      if (n != next[t]++)
+         ++out_of_order;
+   }
+   BOOST_CHECK_EQUAL(out_of_order, 0u);
+
+   async_logger_stats stats = async_logger_singleton::instance().stats();
+   BOOST_CHECK_EQUAL(stats.dropped, 0u);
+   BOOST_CHECK_GE(stats.written, size_t(threads * count));
+}
+
+BOOST_AUTO_TEST_CASE(test_block_policy_loses_nothing)
+{
+   app->set_delay_us(20);
+   async_logger_singleton::instance().start(16, async_overflow_policy::BLOCK);
+
+   async_logger_stats before = async_logger_singleton::instance().stats();
+   boost::thread producer(boost::bind(&log_debug, logger, 500));
+   producer.join();
+   BOOST_REQUIRE(async_logger_singleton::instance().flush(10000));
+
+   async_logger_stats after = async_logger_singleton::instance().stats();
+   BOOST_CHECK_EQUAL(app->count(), 500u);
+   BOOST_CHECK_GT(after.blocked, before.blocked);
+   BOOST_CHECK_EQUAL(after.dropped, before.dropped);
+}
+
+BOOST_AUTO_TEST_CASE(test_drop_policy)
+{
+   app->set_delay_us(200);
+   async_logger_singleton::instance().start(16, async_overflow_policy::DROP);
+
+   async_logger_stats before = async_logger_singleton::instance().stats();
+   boost::thread producer(boost::bind(&log_debug, logger, 500));
+   producer.join();
+
+   // errors are never dropped
+   MLOG_ERROR(logger, "important");
+
+   BOOST_REQUIRE(async_logger_singleton::instance().flush(10000));
+
+   async_logger_stats after = async_logger_singleton::instance().stats();
+   size_t dropped = after.dropped - before.dropped;
+   BOOST_CHECK_GT(dropped, 0u);
+   BOOST_CHECK_EQUAL(app->count() + dropped, 501u);
+   std::vector<std::string> messages = app->messages();
+   BOOST_CHECK(std::find(messages.begin(), messages.end(), "important") != messages.end());
+}
+
+BOOST_AUTO_TEST_CASE(test_sample_policy)
+{
+   app->set_delay_us(200);
+   async_logger_singleton::instance().start(64, async_overflow_policy::SAMPLE, 4);
+
+   async_logger_stats before = async_logger_singleton::instance().stats();
+   boost::thread producer(boost::bind(&log_debug, logger, 500));
+   producer.join();
+   BOOST_REQUIRE(async_logger_singleton::instance().flush(10000));
+
+   async_logger_stats after = async_logger_singleton::instance().stats();
+   size_t sampled_out = after.sampled_out - before.sampled_out;
+   size_t dropped = after.dropped - before.dropped;
+   BOOST_CHECK_GT(sampled_out, 0u);
+   BOOST_CHECK_EQUAL(app->count() + sampled_out + dropped, 500u);
+}
+
+BOOST_AUTO_TEST_CASE(test_fatal_is_written_before_returning)
+{
+   app->set_delay_us(100);
+   async_logger_singleton::instance().start();
+
+   for (int i = 0; i < 50; ++i)
+      MLOG_INFO(logger, "info " << i);
+   MLOG_FATAL(logger, "fatal");
+
+   BOOST_CHECK_EQUAL(app->count(), 51u);
+}
+
+BOOST_AUTO_TEST_CASE(test_disable_flushes)
+{
+   app->set_delay_us(100);
+   async_logger_singleton::instance().start();
+
+   for (int i = 0; i < 50; ++i)
+      MLOG_INFO(logger, "info " << i);
+
+   global_singleton::instance().disable();
+   BOOST_CHECK_EQUAL(app->count(), 50u);
+}
+
+BOOST_AUTO_TEST_CASE(test_stop_writes_everything)
+{
+   app->set_delay_us(100);
+   async_logger_singleton::instance().start();
+
+   for (int i = 0; i < 50; ++i)
+      MLOG_INFO(logger, "info " << i);
+
+   async_logger_singleton::instance().stop();
+   BOOST_CHECK_EQUAL(app->count(), 50u);
+
+   // and carries on synchronously
+   MLOG_INFO(logger, "after");
+   BOOST_CHECK_EQUAL(app->count(), 51u);
+   BOOST_CHECK(app->threads().back() == boost::this_thread::get_id());
+}
+
+BOOST_AUTO_TEST_CASE(test_fatal_signal_flushes)
+{
+   int fds[2];
+   BOOST_REQUIRE_EQUAL(::pipe(fds), 0);
+
+   pid_t pid = ::fork();
+   BOOST_REQUIRE(pid >= 0);
+
+   if (pid == 0)
+   {
+      ::close(fds[0]);
+      ::signal(SIGSEGV, SIG_DFL);   // rather than the test framework's handler
+      app->set_fd(fds[1]);
+      app->set_delay_us(200);
+      async_logger_singleton::instance().start(8192, async_overflow_policy::BLOCK, 10, true);
+      for (int i = 0; i < 100; ++i)
+         MLOG_INFO(logger, "info " << i);
+      ::raise(SIGSEGV);
+      ::_exit(0);
+   }
+
+   ::close(fds[1]);
+
+   std::string output;
+   char buf[4096];
+   for (ssize_t n; (n = ::read(fds[0], buf, sizeof(buf))) > 0; )
+      output.append(buf, n);
+   ::close(fds[0]);
+
+   int status = 0;
+   ::waitpid(pid, &status, 0);
+
+   BOOST_CHECK(WIFSIGNALED(status));
+   if (WIFSIGNALED(status))
+      BOOST_CHECK_EQUAL(WTERMSIG(status), SIGSEGV);
+
+   size_t lines = 0;
+   for (size_t i = 0; i < output.size(); ++i)
+      if (output[i] == '\n')
+         ++lines;
+   BOOST_CHECK_EQUAL(lines, 100u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,104 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOOST_TEST_LOGGING_CAPTURE_APPENDER_H__
+#define MOOST_TEST_LOGGING_CAPTURE_APPENDER_H__
+
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+#include <log4cxx/appenderskeleton.h>
+#include <log4cxx/helpers/pool.h>
+#include <log4cxx/spi/loggingevent.h>
+
+// remembers what was logged, and on which thread, or writes it to a file descriptor
+class capture_appender : public log4cxx::AppenderSkeleton
+{
+public:
+   capture_appender()
+      : delay_us_(0)
+      , fd_(-1)
+   {
+   }
+
+   void append(log4cxx::spi::LoggingEventPtr const & event, log4cxx::helpers::Pool &)
+   {
+      if (delay_us_ > 0)
+         boost::this_thread::sleep(boost::posix_time::microseconds(delay_us_));
+
+      std::string message(event->getMessage().begin(), event->getMessage().end());
+
+      if (fd_ >= 0)
+      {
+         message += '\n';
+         ssize_t rv = ::write(fd_, message.data(), message.size());
+         (void) rv;
+         return;
+      }
+
+      boost::mutex::scoped_lock lock(mutex_);
+      messages_.push_back(message);
+      threads_.push_back(boost::this_thread::get_id());
+   }
+
+   void close() {}
+   bool requiresLayout() const { return false; }
+
+   void set_delay_us(int us) { delay_us_ = us; }
+   void set_fd(int fd) { fd_ = fd; }
+
+   std::vector<std::string> messages() const
+   {
+      boost::mutex::scoped_lock lock(mutex_);
+      return messages_;
+   }
+
+   std::vector<boost::thread::id> threads() const
+   {
+      boost::mutex::scoped_lock lock(mutex_);
+      return threads_;
+   }
+
+   size_t count() const
+   {
+      boost::mutex::scoped_lock lock(mutex_);
+      return messages_.size();
+   }
+
+private:
+   mutable boost::mutex mutex_;
+   std::vector<std::string> messages_;
+   std::vector<boost::thread::id> threads_;
+   int delay_us_;
+   int fd_;
+};
+
+#endif
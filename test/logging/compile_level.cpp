@@ -0,0 +1,75 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+
+// only this translation unit leaves out everything below INFO
+#define MLOG_COMPILE_LEVEL MLOG_COMPILE_LEVEL_INFO
+
+#include "../../include/moost/logging/logger.hpp"
+
+#include "capture_appender.h"
+
+namespace {
+
+int lookups = 0;
+
+log4cxx::LoggerPtr const & counted(log4cxx::LoggerPtr const & logger)
+{
+   ++lookups;
+   return logger;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(test_compile_level)
+{
+   log4cxx::LoggerPtr logger = MLOG_NAMED_LOGGER("moost.compile_level.test");
+   capture_appender * app = new capture_appender;
+   logger->removeAllAppenders();
+   logger->setAdditivity(false);
+   logger->setLevel(log4cxx::Level::getTrace());
+   logger->addAppender(log4cxx::AppenderPtr(app));
+
+   int evaluated = 0;
+
+   MLOG_TRACE(counted(logger), "trace " << ++evaluated);
+   MLOG_DEBUG(counted(logger), "debug " << ++evaluated);
+   MLOG_FMT_DEBUG(counted(logger), moost::logging::log_format("debug {}") % ++evaluated);
+   MLOG_INFO(counted(logger), "info " << ++evaluated);
+   MLOG_FMT_WARN(counted(logger), moost::logging::log_format("warn {}") % ++evaluated);
+
+   BOOST_CHECK_EQUAL(evaluated, 2);
+   BOOST_CHECK_EQUAL(lookups, 2);
+
+   std::vector<std::string> messages = app->messages();
+   BOOST_REQUIRE_EQUAL(messages.size(), 2u);
+   BOOST_CHECK_EQUAL(messages[0], "info 1");
+   BOOST_CHECK_EQUAL(messages[1], "warn 2");
+
+   logger->removeAllAppenders();
+}
@@ -0,0 +1,188 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+
+#include "../../include/moost/logging/logger.hpp"
+#include "../../include/moost/logging/class_logger.hpp"
+#include "../../include/moost/logging/function_logger.hpp"
+
+#include "capture_appender.h"
+
+using namespace moost::logging;
+
+namespace {
+
+struct point
+{
+   int x, y;
+};
+
+std::ostream & operator<<(std::ostream & os, point const & p)
+{
+   return os << "(" << p.x << ", " << p.y << ")";
+}
+
+struct Fixture
+{
+   Fixture()
+      : logger(MLOG_NAMED_LOGGER("moost.log_format.test"))
+      , app(new capture_appender)
+   {
+      logger->removeAllAppenders();
+      logger->setAdditivity(false);
+      logger->setLevel(log4cxx::Level::getTrace());
+      logger->addAppender(log4cxx::AppenderPtr(app));
+   }
+
+   ~Fixture()
+   {
+      async_logger_singleton::instance().stop();
+      logger->removeAllAppenders();
+   }
+
+   log4cxx::LoggerPtr logger;
+   capture_appender * app;
+};
+
+class base_logging
+{
+public:
+   virtual ~base_logging() {}
+
+   log4cxx::LoggerPtr const * logger() const
+   {
+      return &MLOG_CLASS_LOGGER();
+   }
+};
+
+class derived_logging : public base_logging
+{
+};
+
+log4cxx::LoggerPtr const * function_logger()
+{
+   return &MLOG_FUNC_LOGGER();
+}
+
+}
+
+BOOST_FIXTURE_TEST_SUITE(log_format_test, Fixture)
+
+BOOST_AUTO_TEST_CASE(test_render)
+{
+   std::string s("str");
+
+   BOOST_CHECK_EQUAL((log_format("a {} b {} c {} d {} e {}") % 1 % -2L % 3u % 2.5 % s).str(),
+                     "a 1 b -2 c 3 d 2.5 e str");
+   BOOST_CHECK_EQUAL((log_format("{} {} {} {}") % true % 'x' % "lit" % 1e100).str(),
+                     "true x lit 1e+100");
+   BOOST_CHECK_EQUAL((log_format("{}") % static_cast<unsigned long>(-1)).str(),
+                     "18446744073709551615");
+   BOOST_CHECK_EQUAL((log_format("{}") % static_cast<char const *>(0)).str(), "(null)");
+   BOOST_CHECK_EQUAL(log_format("no arguments").str(), "no arguments");
+}
+
+BOOST_AUTO_TEST_CASE(test_braces_and_mismatched_arguments)
+{
+   BOOST_CHECK_EQUAL((log_format("{{{}}}") % 7).str(), "{7}");
+   BOOST_CHECK_EQUAL((log_format("{} and {}") % 1).str(), "1 and {}");
+   BOOST_CHECK_EQUAL((log_format("only {}") % 1 % 2 % "three").str(), "only 1 2 three");
+}
+
+BOOST_AUTO_TEST_CASE(test_other_types_use_stream_operator)
+{
+   point p = { 3, 4 };
+   BOOST_CHECK_EQUAL((log_format("at {}") % p).str(), "at (3, 4)");
+}
+
+BOOST_AUTO_TEST_CASE(test_large_messages)
+{
+   std::string big(1000, 'z');
+   log_format f("{}:{}");
+   f % big % 42;
+
+   log_format copy(f);
+   BOOST_CHECK_EQUAL(copy.str(), big + ":42");
+   BOOST_CHECK_GT(copy.size(), big.size());
+}
+
+BOOST_AUTO_TEST_CASE(test_stream_operator)
+{
+   MLOG_INFO(logger, "[" << (log_format("{}+{}") % 1 % 2) << "]");
+   BOOST_REQUIRE_EQUAL(app->count(), 1u);
+   BOOST_CHECK_EQUAL(app->messages()[0], "[1+2]");
+}
+
+BOOST_AUTO_TEST_CASE(test_fmt_macros)
+{
+   int evaluated = 0;
+   logger->setLevel(log4cxx::Level::getInfo());
+
+   MLOG_FMT_DEBUG(logger, log_format("debug {}") % ++evaluated);
+   MLOG_FMT_INFO(logger, log_format("sync {}") % ++evaluated);
+
+   async_logger_singleton::instance().start();
+   MLOG_FMT_DEBUG(logger, log_format("debug {}") % ++evaluated);
+   MLOG_FMT_WARN(logger, log_format("async {} {}") % ++evaluated % 0.5);
+   MLOG_INFO(logger, "stream " << ++evaluated);
+   BOOST_REQUIRE(async_logger_singleton::instance().flush(5000));
+
+   BOOST_CHECK_EQUAL(evaluated, 3);
+
+   std::vector<std::string> messages = app->messages();
+   BOOST_REQUIRE_EQUAL(messages.size(), 3u);
+   BOOST_CHECK_EQUAL(messages[0], "sync 1");
+   BOOST_CHECK_EQUAL(messages[1], "async 2 0.5");
+   BOOST_CHECK_EQUAL(messages[2], "stream 3");
+   BOOST_CHECK(app->threads()[0] == boost::this_thread::get_id());
+   BOOST_CHECK(app->threads()[1] != boost::this_thread::get_id());
+}
+
+BOOST_AUTO_TEST_CASE(test_class_logger_cache)
+{
+   base_logging b;
+   derived_logging d;
+
+   BOOST_CHECK(b.logger() == b.logger());
+   BOOST_CHECK(d.logger() == d.logger());
+   BOOST_CHECK(b.logger() != d.logger());
+
+   // the dynamic type names the logger, as before
+   BOOST_CHECK((*d.logger())->getName().find("derived_logging") != std::string::npos);
+   BOOST_CHECK(*b.logger() == log4cxx::Logger::getLogger(DEMANGLE_NAME(typeid(b).name())));
+}
+
+BOOST_AUTO_TEST_CASE(test_function_logger_cache)
+{
+   BOOST_CHECK(function_logger() == function_logger());
+   BOOST_CHECK((*function_logger())->getName().find("function_logger") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
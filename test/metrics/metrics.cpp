@@ -0,0 +1,272 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "../../include/moost/metrics.hpp"
+
+using namespace moost::metrics;
+
+BOOST_AUTO_TEST_SUITE(metrics_test)
+
+namespace {
+
+void count_up(counter& c, histogram& h, int n)
+{
+   for (int i = 0; i < n; ++i)
+   {
+      ++c;
+      h.record(i % 100);
+   }
+}
+
+bool contains(const std::string& haystack, const std::string& needle)
+{
+   return haystack.find(needle) != std::string::npos;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(test_counter)
+{
+   counter c;
+
+   BOOST_CHECK_EQUAL(c.value(), 0);
+   ++c;
+   c += 41;
+   c.add(-2);
+   BOOST_CHECK_EQUAL(c.value(), 40);
+
+   c.reset();
+   BOOST_CHECK_EQUAL(c.value(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_counter_threads)
+{
+   counter c;
+   histogram h;
+   boost::thread_group threads;
+
+   for (int i = 0; i < 24; ++i)
+   {
+      threads.create_thread(boost::bind(&count_up, boost::ref(c), boost::ref(h), 10000));
+   }
+
+   threads.join_all();
+
+   BOOST_CHECK_EQUAL(c.value(), 240000);
+
+   histogram_snapshot snap;
+   h.snapshot(snap);
+   BOOST_CHECK_EQUAL(snap.count, 240000U);
+   BOOST_CHECK_EQUAL(snap.sum, 24U*100U*(99U*100U/2U));
+}
+
+BOOST_AUTO_TEST_CASE(test_gauge)
+{
+   gauge g;
+
+   g.set(10);
+   g.add(5);
+   g.sub();
+   BOOST_CHECK_EQUAL(g.value(), 14);
+
+   // gauges describe the current state and aren't reset
+   g.reset();
+   BOOST_CHECK_EQUAL(g.value(), 14);
+}
+
+BOOST_AUTO_TEST_CASE(test_histogram_buckets)
+{
+   BOOST_CHECK_EQUAL(histogram::bucket(0), 0U);
+   BOOST_CHECK_EQUAL(histogram::bucket(1), 1U);
+   BOOST_CHECK_EQUAL(histogram::bucket(2), 2U);
+   BOOST_CHECK_EQUAL(histogram::bucket(3), 2U);
+   BOOST_CHECK_EQUAL(histogram::bucket(4), 3U);
+   BOOST_CHECK_EQUAL(histogram::bucket(1023), 10U);
+   BOOST_CHECK_EQUAL(histogram::bucket(1024), 11U);
+   BOOST_CHECK_EQUAL(histogram::bucket(~boost::uint64_t(0)), 64U);
+
+   for (size_t k = 1; k < histogram::num_buckets; ++k)
+   {
+      BOOST_CHECK_EQUAL(histogram::bucket(histogram_snapshot::bucket_lower(k)), k);
+      BOOST_CHECK_EQUAL(histogram::bucket(histogram_snapshot::bucket_upper(k)), k);
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_histogram_percentiles)
+{
+   histogram h("us");
+   histogram_snapshot snap;
+
+   h.snapshot(snap);
+   BOOST_CHECK_EQUAL(snap.count, 0U);
+   BOOST_CHECK_EQUAL(snap.percentile(0.5), 0.0);
+   BOOST_CHECK_EQUAL(snap.max(), 0U);
+
+   for (boost::uint64_t v = 1; v <= 1000; ++v)
+   {
+      h.record(v);
+   }
+
+   h.snapshot(snap);
+   BOOST_CHECK_EQUAL(snap.count, 1000U);
+   BOOST_CHECK_EQUAL(snap.sum, 500500U);
+   BOOST_CHECK_CLOSE(snap.mean(), 500.5, 0.001);
+   BOOST_CHECK_EQUAL(snap.max(), 1023U);
+
+   // power-of-two buckets are coarse, but a uniform distribution
+   // should still come out roughly right
+   BOOST_CHECK_CLOSE(snap.percentile(0.5), 500.0, 5.0);
+   BOOST_CHECK_CLOSE(snap.percentile(0.9), 900.0, 5.0);
+   BOOST_CHECK(snap.percentile(0.99) <= 1023.0);
+   BOOST_CHECK(snap.percentile(0.1) <= snap.percentile(0.5));
+
+   h.reset();
+   h.snapshot(snap);
+   BOOST_CHECK_EQUAL(snap.count, 0U);
+   BOOST_CHECK_EQUAL(snap.sum, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_scoped_timer)
+{
+   histogram h;
+
+   {
+      scoped_timer t(h);
+      boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+   }
+
+   histogram_snapshot snap;
+   h.snapshot(snap);
+   BOOST_CHECK_EQUAL(snap.count, 1U);
+   BOOST_CHECK_GE(snap.sum, 20000U);
+}
+
+BOOST_AUTO_TEST_CASE(test_make_name)
+{
+   BOOST_CHECK_EQUAL(make_name("mq.stream", "/topic/foo bar"), "mq.stream./topic/foo_bar");
+   BOOST_CHECK_EQUAL(make_name("kvds", "users\"db\""), "kvds.users_db_");
+   BOOST_CHECK_EQUAL(make_name("", "x"), "x");
+   BOOST_CHECK_EQUAL(make_name("x", ""), "x");
+}
+
+BOOST_AUTO_TEST_CASE(test_registry)
+{
+   registry reg;
+
+   counter& c = reg.get_counter("test.requests");
+   BOOST_CHECK_EQUAL(&c, &reg.get_counter("test.requests"));
+
+   reg.get_gauge("test.queue");
+   reg.get_histogram("test.latency_us");
+   reg.get_counter("other.requests");
+
+   BOOST_CHECK_THROW(reg.get_gauge("test.requests"), std::runtime_error);
+   BOOST_CHECK_THROW(reg.get_histogram("test.queue"), std::runtime_error);
+
+   BOOST_CHECK(reg.find("test.queue"));
+   BOOST_CHECK(!reg.find("test.nothing"));
+
+   registry::metric_map sel;
+   reg.select(sel, "test.");
+   BOOST_CHECK_EQUAL(sel.size(), 3U);
+
+   c += 5;
+   BOOST_CHECK_EQUAL(reg.reset("other."), 1U);
+   BOOST_CHECK_EQUAL(c.value(), 5);
+   BOOST_CHECK_EQUAL(reg.reset(), 4U);
+   BOOST_CHECK_EQUAL(c.value(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_registry_output)
+{
+   registry reg;
+
+   reg.get_counter("a.count") += 3;
+   reg.get_gauge("a.gauge").set(-7);
+   reg.get_histogram("b.size", "bytes").record(100);
+
+   std::ostringstream list;
+   reg.write_list(list);
+   BOOST_CHECK_EQUAL(list.str(), "a.count counter\na.gauge gauge\nb.size histogram\n");
+
+   std::ostringstream text;
+   reg.write_text(text, "a.");
+   BOOST_CHECK_EQUAL(text.str(), "a.count 3\na.gauge -7\n");
+
+   std::ostringstream hist;
+   reg.write_text(hist, "b.");
+   BOOST_CHECK(contains(hist.str(), "b.size count=1 "));
+   BOOST_CHECK(contains(hist.str(), " bytes\n"));
+
+   std::ostringstream json;
+   reg.write_json(json);
+   BOOST_CHECK(contains(json.str(), "{\"a.count\":{\"type\":\"counter\",\"value\":3},"));
+   BOOST_CHECK(contains(json.str(), "\"a.gauge\":{\"type\":\"gauge\",\"value\":-7},"));
+   BOOST_CHECK(contains(json.str(), "\"b.size\":{\"type\":\"histogram\",\"unit\":\"bytes\",\"count\":1,\"sum\":100,"));
+   BOOST_CHECK(contains(json.str(), "\"buckets\":{\"127\":1}}}\n"));
+}
+
+BOOST_AUTO_TEST_CASE(test_shell_commands)
+{
+   registry reg;
+   shell_commands sh(reg);
+   std::string rv;
+
+   reg.get_counter("svc.requests") += 2;
+   reg.get_counter("svc.errors");
+
+   BOOST_CHECK(!sh.handle_command(rv, "level", "info"));
+   BOOST_CHECK(contains(sh.show_help(), "metrics"));
+
+   BOOST_CHECK(sh.handle_command(rv, "metrics", ""));
+   BOOST_CHECK_EQUAL(rv, "svc.errors counter\nsvc.requests counter\n");
+
+   BOOST_CHECK(sh.handle_command(rv, "metrics", "svc.req"));
+   BOOST_CHECK_EQUAL(rv, "svc.requests counter\n");
+
+   BOOST_CHECK(sh.handle_command(rv, "metrics", "dump  svc.requests "));
+   BOOST_CHECK_EQUAL(rv, "svc.requests 2\n");
+
+   BOOST_CHECK(sh.handle_command(rv, "metrics", "json svc.requests"));
+   BOOST_CHECK_EQUAL(rv, "{\"svc.requests\":{\"type\":\"counter\",\"value\":2}}\n");
+
+   BOOST_CHECK(sh.handle_command(rv, "metrics", "reset"));
+   BOOST_CHECK_EQUAL(rv, "reset 2 metric(s)\n");
+   BOOST_CHECK_EQUAL(reg.get_counter("svc.requests").value(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,381 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "../../include/moost/nagios/nsca_async_sender.hpp"
+
+using namespace moost::nagios;
+using boost::asio::ip::tcp;
+
+BOOST_AUTO_TEST_SUITE( nsca_async_sender_test )
+
+namespace {
+
+struct received
+{
+   std::string host;
+   std::string desc;
+   int state;
+   std::string output;
+   bool crc_ok;
+};
+
+// A local stand-in for an nsca daemon. Connections are handled one at a
+// time: the server sends the initialisation packet, then decrypts data
+// packets until the client disconnects (or close_after packets were read).
+class nsca_stub_server
+{
+public:
+   nsca_stub_server(size_t close_after = 0)
+      : acceptor_(io_service_, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0))
+      , close_after_(close_after)
+      , connections_(0)
+      , stop_(false)
+   {
+      thread_.reset(new boost::thread(boost::bind(&nsca_stub_server::run, this)));
+   }
+
+   ~nsca_stub_server()
+   {
+      {
+         boost::mutex::scoped_lock lock(mutex_);
+         stop_ = true;
+      }
+
+      // wake up the accept
+      try
+      {
+         boost::asio::io_service io_service;
+         tcp::socket sock(io_service);
+         sock.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port()));
+      }
+      catch (...)
+      {
+      }
+
+      thread_->join();
+   }
+
+   unsigned short port() const
+   {
+      return acceptor_.local_endpoint().port();
+   }
+
+   std::vector<received> packets() const
+   {
+      boost::mutex::scoped_lock lock(mutex_);
+      return packets_;
+   }
+
+   size_t connections() const
+   {
+      boost::mutex::scoped_lock lock(mutex_);
+      return connections_;
+   }
+
+   nsca_config config() const
+   {
+      return nsca_config("127.0.0.1", port(), 1000, 1000, nsca_enctype("xor"), nsca_encpass("secret"));
+   }
+
+private:
+   void run()
+   {
+      for (;;)
+      {
+         tcp::socket sock(io_service_);
+         acceptor_.accept(sock);
+
+         {
+            boost::mutex::scoped_lock lock(mutex_);
+            if (stop_)
+               return;
+            ++connections_;
+         }
+
+         try
+         {
+            handle(sock);
+         }
+         catch (...)
+         {
+            // client went away
+         }
+      }
+   }
+
+   void handle(tcp::socket & sock)
+   {
+      using namespace boost::asio::detail::socket_ops;
+
+      nsca_init_packet init;
+      for (size_t i = 0; i < sizeof(init.iv); ++i)
+         init.iv[i] = static_cast<char>(i * 7 + 3);
+      init.timestamp = host_to_network_long(static_cast<boost::uint32_t>(time(0)));
+      boost::asio::write(sock, boost::asio::buffer(&init, sizeof(init)));
+
+      nsca_crypto crypto(init.iv, nsca_enctype("xor"), "secret");
+
+      for (size_t n = 0; close_after_ == 0 || n < close_after_; ++n)
+      {
+         nsca_data_packet packet;
+         boost::asio::read(sock, boost::asio::buffer(&packet, sizeof(packet)));
+         crypto.decrypt(packet);
+
+         received r;
+         boost::uint32_t const crc = network_to_host_long(packet.crc32_value);
+         packet.crc32_value = 0;
+         r.crc_ok = (crc == crc32_.calculate(packet));
+         r.host = packet.host_name;
+         r.desc = packet.svc_description;
+         r.state = network_to_host_short(packet.return_code);
+         r.output = packet.plugin_output;
+
+         boost::mutex::scoped_lock lock(mutex_);
+         packets_.push_back(r);
+      }
+   }
+
+   boost::asio::io_service io_service_;
+   tcp::acceptor acceptor_;
+   size_t const close_after_;
+   nsca_crc32 crc32_;
+
+   mutable boost::mutex mutex_;
+   std::vector<received> packets_;
+   size_t connections_;
+   bool stop_;
+
+   boost::scoped_ptr<boost::thread> thread_;
+};
+
+class error_counting_sender : public nsca_async_sender
+{
+public:
+   error_counting_sender(nsca_config const & cfg, size_t max_queue, int min_resend_interval_ms = 0)
+      : nsca_async_sender(cfg, max_queue, min_resend_interval_ms)
+      , errors_(0)
+   {
+   }
+
+   ~error_counting_sender()
+   {
+      stop();
+   }
+
+   size_t errors() const
+   {
+      boost::mutex::scoped_lock lock(mutex_);
+      return errors_;
+   }
+
+protected:
+   void report_error(std::exception const &)
+   {
+      boost::mutex::scoped_lock lock(mutex_);
+      ++errors_;
+   }
+
+private:
+   mutable boost::mutex mutex_;
+   size_t errors_;
+};
+
+}
+
+BOOST_AUTO_TEST_CASE( test_send_batch_single_connection )
+{
+   nsca_stub_server server;
+
+   {
+      nsca_async_sender sender(server.config());
+
+      // queued faster than a connection can be made, so these go out together
+      for (int i = 0; i < 20; ++i)
+         sender.send("host", "svc", nsca_client::service_state::WARNING, "warning " + boost::lexical_cast<std::string>(i));
+
+      BOOST_REQUIRE(sender.flush(5000));
+
+      nsca_async_sender_stats st;
+      sender.stats(st);
+      BOOST_CHECK_EQUAL(20u, st.enqueued);
+      BOOST_CHECK_EQUAL(20u, st.sent);
+      BOOST_CHECK_EQUAL(0u, st.failed);
+      BOOST_CHECK_EQUAL(0u, st.dropped);
+   }
+
+   std::vector<received> packets = server.packets();
+   BOOST_REQUIRE_EQUAL(20u, packets.size());
+   for (size_t i = 0; i < packets.size(); ++i)
+   {
+      BOOST_CHECK(packets[i].crc_ok);
+      BOOST_CHECK_EQUAL("host", packets[i].host);
+      BOOST_CHECK_EQUAL("svc", packets[i].desc);
+      BOOST_CHECK_EQUAL(int(nsca_client::service_state::WARNING), packets[i].state);
+      BOOST_CHECK_EQUAL("warning " + boost::lexical_cast<std::string>(i), packets[i].output);
+   }
+
+   // the connection is reused for later batches
+   BOOST_CHECK_EQUAL(1u, server.connections());
+}
+
+BOOST_AUTO_TEST_CASE( test_coalesce_and_suppress )
+{
+   nsca_stub_server server;
+
+   {
+      nsca_async_sender sender(server.config(), 100, 60000);
+
+      for (int i = 0; i < 10; ++i)
+         sender.send("host", "svc", nsca_client::service_state::CRITICAL, "disk full");
+      BOOST_REQUIRE(sender.flush(5000));
+
+      sender.send("host", "svc", nsca_client::service_state::CRITICAL, "disk full");
+      sender.send("host", "svc", nsca_client::service_state::OK, "disk fine");
+      BOOST_REQUIRE(sender.flush(5000));
+
+      nsca_async_sender_stats st;
+      sender.stats(st);
+      BOOST_CHECK_EQUAL(12u, st.enqueued);
+      BOOST_CHECK_EQUAL(2u, st.sent);
+      BOOST_CHECK_EQUAL(st.coalesced + st.suppressed, 10u);
+      BOOST_CHECK_GE(st.suppressed, 1u);
+   }
+
+   std::vector<received> packets = server.packets();
+   BOOST_REQUIRE_EQUAL(2u, packets.size());
+   BOOST_CHECK_EQUAL("disk full", packets[0].output);
+   BOOST_CHECK_EQUAL("disk fine", packets[1].output);
+}
+
+BOOST_AUTO_TEST_CASE( test_failed_not_suppressed )
+{
+   unsigned short port;
+   {
+      nsca_stub_server server;
+      port = server.port();
+   }
+
+   nsca_config cfg("127.0.0.1", port);
+
+   // a result that couldn't be sent must not hold back the next one
+   error_counting_sender sender(cfg, 100, 60000);
+   for (int i = 0; i < 2; ++i)
+   {
+      sender.send("host", "svc", nsca_client::service_state::CRITICAL, "disk full");
+      BOOST_REQUIRE(sender.flush(5000));
+   }
+
+   nsca_async_sender_stats st;
+   sender.stats(st);
+   BOOST_CHECK_EQUAL(0u, st.sent);
+   BOOST_CHECK_EQUAL(0u, st.suppressed);
+   BOOST_CHECK_EQUAL(2u, st.failed);
+}
+
+BOOST_AUTO_TEST_CASE( test_drop_oldest )
+{
+   // nothing listens on this port once the server is gone
+   unsigned short port;
+   {
+      nsca_stub_server server;
+      port = server.port();
+   }
+
+   nsca_config cfg("127.0.0.1", port);
+
+   error_counting_sender sender(cfg, 5);
+   for (int i = 0; i < 1000; ++i)
+      sender.send("host", "svc", nsca_client::service_state::WARNING, boost::lexical_cast<std::string>(i));
+   BOOST_REQUIRE(sender.flush(5000));
+
+   nsca_async_sender_stats st;
+   sender.stats(st);
+   BOOST_CHECK_EQUAL(1000u, st.enqueued);
+   BOOST_CHECK_EQUAL(0u, st.sent);
+   BOOST_CHECK_EQUAL(1000u, st.dropped + st.failed);
+   BOOST_CHECK_GT(st.dropped, 0u);
+   BOOST_CHECK_GE(sender.errors(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE( test_reconnect_after_server_close )
+{
+   nsca_stub_server server(1);
+
+   {
+      nsca_async_sender sender(server.config());
+
+      for (int i = 0; i < 3; ++i)
+      {
+         sender.send("host", "svc", nsca_client::service_state::OK, boost::lexical_cast<std::string>(i));
+         BOOST_REQUIRE(sender.flush(5000));
+         // give the server time to close the connection
+         boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+      }
+
+      nsca_async_sender_stats st;
+      sender.stats(st);
+      BOOST_CHECK_EQUAL(3u, st.sent);
+      BOOST_CHECK_EQUAL(3u, st.connects);
+   }
+
+   BOOST_CHECK_EQUAL(3u, server.packets().size());
+}
+
+BOOST_AUTO_TEST_CASE( test_output_truncated )
+{
+   nsca_stub_server server;
+
+   {
+      nsca_async_sender sender(server.config());
+      sender.send("host", "svc", nsca_client::service_state::OK, std::string(2000, 'x') + "\nsecond line");
+      sender.send(std::string(200, 'h'), "svc", nsca_client::service_state::OK, "host name too long");
+      BOOST_REQUIRE(sender.flush(5000));
+
+      nsca_async_sender_stats st;
+      sender.stats(st);
+      BOOST_CHECK_EQUAL(1u, st.sent);
+      BOOST_CHECK_EQUAL(1u, st.failed);
+   }
+
+   std::vector<received> packets = server.packets();
+   BOOST_REQUIRE_EQUAL(1u, packets.size());
+   BOOST_CHECK_EQUAL(std::string(nsca_const::MAX_PLUGINOUTPUT_LENGTH - 1, 'x'), packets[0].output);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
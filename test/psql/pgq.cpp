@@ -0,0 +1,229 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * These tests need a PostgreSQL database with PgQ installed. Point
+ * MOOST_TEST_PGQ_DBCONN at it, e.g. "dbname=test", to run them; they're
+ * skipped otherwise. They create and drop a queue of their own.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <cstdlib>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include "../../include/moost/psql/pgq.hpp"
+
+using namespace moost::psql;
+
+BOOST_AUTO_TEST_SUITE(pgq_test)
+
+namespace {
+
+char const * const queue_name = "moost_pgq_test";
+char const * const consumer_name = "moost_pgq_test_consumer";
+
+struct pgq_fixture
+{
+   pgq_fixture()
+   {
+      char const * env = std::getenv("MOOST_TEST_PGQ_DBCONN");
+      dbconn = env ? env : "";
+
+      if (enabled())
+      {
+         drop_queue();
+         exec(std::string("select pgq.create_queue('") + queue_name + "');");
+      }
+   }
+
+   ~pgq_fixture()
+   {
+      if (enabled())
+      {
+         drop_queue();
+      }
+   }
+
+   bool enabled() const
+   {
+      if (dbconn.empty())
+      {
+         BOOST_TEST_MESSAGE("MOOST_TEST_PGQ_DBCONN not set, skipping");
+      }
+
+      return !dbconn.empty();
+   }
+
+   void exec(std::string const & query) const
+   {
+      pqxx::connection conn(dbconn);
+      pqxx::work transaction(conn, "PgqTest");
+      transaction.exec(query);
+      transaction.commit();
+   }
+
+   void drop_queue() const
+   {
+      pqxx::connection conn(dbconn);
+      pqxx::work transaction(conn, "PgqTestDrop");
+      pqxx::result res = transaction.exec(std::string("select 1 from pgq.get_queue_info() where queue_name = '") + queue_name + "';");
+
+      if (!res.empty())
+      {
+         transaction.exec(std::string("select pgq.unregister_consumer(queue_name, consumer_name) from pgq.get_consumer_info() where queue_name = '") + queue_name + "';");
+         transaction.exec(std::string("select pgq.drop_queue('") + queue_name + "');");
+      }
+
+      transaction.commit();
+   }
+
+   /// inserts events with data 1 .. count and ends the batch with a tick
+   void insert_events(int count) const
+   {
+      std::stringstream query;
+      query << "select pgq.insert_event('" << queue_name << "', 'test', i::text) from generate_series(1, " << count << ") i;";
+      exec(query.str());
+      exec(std::string("select pgq.ticker('") + queue_name + "');");
+   }
+
+   std::string dbconn;
+};
+
+struct collector
+{
+   collector() : chunks(0), max_chunk(0), fail_on(-1) {}
+
+   mutable boost::mutex mutex;
+   mutable std::multiset<int> events;
+   mutable size_t chunks;
+   mutable size_t max_chunk;
+   int fail_on;
+
+   void operator()(pqxx::result const & res) const
+   {
+      boost::mutex::scoped_lock lock(mutex);
+
+      ++chunks;
+      max_chunk = std::max(max_chunk, static_cast<size_t>(res.size()));
+
+      for (pqxx::result::size_type i = 0; i < res.size(); ++i)
+      {
+         int event;
+         res[i][0].to(event);
+
+         if (event == fail_on)
+         {
+            throw std::runtime_error("failed to process event");
+         }
+
+         events.insert(event);
+      }
+   }
+};
+
+}
+
+BOOST_FIXTURE_TEST_CASE(test_poll, pgq_fixture)
+{
+   if (!enabled())
+   {
+      return;
+   }
+
+   pgq_consumer consumer(dbconn, queue_name, consumer_name);
+   BOOST_CHECK(consumer.register_consumer());
+   BOOST_CHECK(consumer.is_registered());
+
+   insert_events(100);
+
+   collector c;
+   consumer.poll("ev_data", c);
+
+   BOOST_CHECK_EQUAL(c.events.size(), 100U);
+   BOOST_CHECK_EQUAL(c.chunks, 1U);
+
+   BOOST_CHECK(consumer.unregister_consumer());
+   BOOST_CHECK(!consumer.is_registered());
+}
+
+BOOST_FIXTURE_TEST_CASE(test_stream, pgq_fixture)
+{
+   if (!enabled())
+   {
+      return;
+   }
+
+   pgq_consumer consumer(dbconn, queue_name, consumer_name);
+   consumer.register_consumer();
+
+   for (size_t threads = 1; threads <= 4; threads *= 2)
+   {
+      insert_events(1000);
+
+      collector c;
+      consumer.stream("ev_data", c, 64, threads);
+
+      BOOST_CHECK_EQUAL(c.events.size(), 1000U);
+      BOOST_CHECK_EQUAL(*c.events.begin(), 1);
+      BOOST_CHECK_EQUAL(*c.events.rbegin(), 1000);
+      BOOST_CHECK_EQUAL(c.chunks, 16U);
+      BOOST_CHECK_EQUAL(c.max_chunk, 64U);
+
+      // the batch was finished, nothing is delivered again
+      collector again;
+      consumer.stream("ev_data", again);
+      BOOST_CHECK(again.events.empty());
+   }
+}
+
+BOOST_FIXTURE_TEST_CASE(test_stream_failure, pgq_fixture)
+{
+   if (!enabled())
+   {
+      return;
+   }
+
+   pgq_consumer consumer(dbconn, queue_name, consumer_name);
+   consumer.register_consumer();
+
+   insert_events(500);
+
+   collector failing;
+   failing.fail_on = 250;
+   BOOST_CHECK_THROW(consumer.stream("ev_data", failing, 50, 4), std::runtime_error);
+
+   // the batch wasn't finished, so all of it comes back
+   collector c;
+   consumer.stream("ev_data", c, 50, 4);
+   BOOST_CHECK_EQUAL(c.events.size(), 500U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
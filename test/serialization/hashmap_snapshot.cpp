@@ -0,0 +1,211 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/serialization/string.hpp>
+
+#include <fstream>
+#include <string>
+
+#include "../../include/moost/serialization/hashmap_snapshot.hpp"
+#include "../../include/moost/io/tempdir.hpp"
+#include "../../include/moost/container/sparse_hash_map.hpp"
+#include "../../include/moost/container/dense_hash_map.hpp"
+
+using namespace moost::serialization;
+
+BOOST_AUTO_TEST_SUITE(hashmap_snapshot_test)
+
+namespace {
+
+typedef moost::container::sparse_hash_map<boost::uint64_t, boost::uint32_t> sparse_map_t;
+typedef moost::container::dense_hash_map<int, double> dense_map_t;
+
+struct scoped_tempfile
+{
+   explicit scoped_tempfile(const std::string& name)
+      : path((dir / name).string())
+   {
+   }
+
+   moost::io::tempdir dir;
+   const std::string path;
+};
+
+void fill(sparse_map_t& map, size_t count)
+{
+   for (size_t i = 0; i < count; ++i)
+   {
+      map[i*7919] = static_cast<boost::uint32_t>(i);
+   }
+}
+
+void corrupt_byte(const std::string& path, std::streamoff offset)
+{
+   std::fstream f(path.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+   f.seekg(offset);
+   char c = static_cast<char>(f.get());
+   f.seekp(offset);
+   f.put(static_cast<char>(c ^ 0x40));
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(test_round_trip)
+{
+   scoped_tempfile tmp("map.snap");
+   sparse_map_t map, loaded;
+
+   fill(map, 100000);
+
+   save_hash_map_snapshot(map, tmp.path, 1000, 4);
+   load_hash_map_snapshot(loaded, tmp.path, 4);
+
+   BOOST_REQUIRE_EQUAL(loaded.size(), map.size());
+
+   for (sparse_map_t::const_iterator it = map.begin(); it != map.end(); ++it)
+   {
+      sparse_map_t::const_iterator found = loaded.find(it->first);
+      BOOST_REQUIRE(found != loaded.end());
+      BOOST_REQUIRE_EQUAL(found->second, it->second);
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_empty_and_dense)
+{
+   scoped_tempfile tmp("map.snap");
+
+   dense_map_t map, loaded;
+   map.set_empty_key(-1);
+   loaded.set_empty_key(-1);
+
+   save_hash_map_snapshot(map, tmp.path);
+   load_hash_map_snapshot(loaded, tmp.path);
+   BOOST_CHECK(loaded.empty());
+
+   map[1] = 0.5;
+   map[2] = 1.5;
+
+   save_hash_map_snapshot(map, tmp.path);
+   load_hash_map_snapshot(loaded, tmp.path);
+   BOOST_CHECK_EQUAL(loaded.size(), 2U);
+   BOOST_CHECK_EQUAL(loaded[2], 1.5);
+}
+
+BOOST_AUTO_TEST_CASE(test_view)
+{
+   scoped_tempfile tmp("map.snap");
+   sparse_map_t map;
+
+   fill(map, 5000);
+   save_hash_map_snapshot(map, tmp.path, 64);
+
+   hash_map_snapshot_view<boost::uint64_t, boost::uint32_t> view(tmp.path);
+
+   BOOST_CHECK_EQUAL(view.size(), map.size());
+   BOOST_CHECK_EQUAL(size_t(view.end() - view.begin()), map.size());
+
+   for (size_t i = 0; i < 5000; ++i)
+   {
+      const boost::uint32_t *val = view.find(i*7919);
+      BOOST_REQUIRE(val);
+      BOOST_REQUIRE_EQUAL(*val, i);
+   }
+
+   BOOST_CHECK(!view.find(1));
+   BOOST_CHECK_EQUAL(view.count(7919), 1U);
+   BOOST_CHECK_EQUAL(view.count(7920), 0U);
+
+   BOOST_CHECK_THROW((hash_map_snapshot_view<boost::uint32_t, boost::uint32_t>(tmp.path)), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_corruption)
+{
+   scoped_tempfile tmp("map.snap");
+   sparse_map_t map, loaded;
+
+   fill(map, 1000);
+   save_hash_map_snapshot(map, tmp.path, 100);
+
+   boost::uintmax_t size = boost::filesystem::file_size(tmp.path);
+
+   corrupt_byte(tmp.path, static_cast<std::streamoff>(size - 1));
+   BOOST_CHECK_THROW(load_hash_map_snapshot(loaded, tmp.path), std::runtime_error);
+   BOOST_CHECK(loaded.empty());
+
+   // not verifying lets the view open the file regardless
+   hash_map_snapshot_view<boost::uint64_t, boost::uint32_t> view(tmp.path, false);
+   BOOST_CHECK_EQUAL(view.size(), 1000U);
+   BOOST_CHECK_THROW((hash_map_snapshot_view<boost::uint64_t, boost::uint32_t>(tmp.path)), std::runtime_error);
+
+   save_hash_map_snapshot(map, tmp.path, 100);
+   corrupt_byte(tmp.path, 20);
+   BOOST_CHECK_THROW(load_hash_map_snapshot(loaded, tmp.path), std::runtime_error);
+
+   save_hash_map_snapshot(map, tmp.path, 100);
+   boost::filesystem::resize_file(tmp.path, size - 8);
+   BOOST_CHECK_THROW(load_hash_map_snapshot(loaded, tmp.path), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_archive_fallback)
+{
+   scoped_tempfile tmp("map.snap");
+   sparse_map_t map, loaded;
+
+   fill(map, 1000);
+
+   {
+      std::ofstream out(tmp.path.c_str(), std::ios::binary);
+      boost::archive::binary_oarchive ar(out);
+      ar << map;
+   }
+
+   load_hash_map_snapshot(loaded, tmp.path);
+   BOOST_CHECK_EQUAL(loaded.size(), 1000U);
+   BOOST_CHECK_EQUAL(loaded[999*7919], 999U);
+}
+
+BOOST_AUTO_TEST_CASE(test_non_pod)
+{
+   scoped_tempfile tmp("map.snap");
+   moost::container::sparse_hash_map<int, std::string> map, loaded;
+
+   map[1] = "one";
+   map[2] = "two";
+
+   BOOST_CHECK((!detail::is_snapshot_map<moost::container::sparse_hash_map<int, std::string> >::value));
+   BOOST_CHECK((detail::is_snapshot_map<moost::container::sparse_hash_map<int, std::pair<char, int> > >::value));
+
+   save_hash_map_snapshot(map, tmp.path);
+   load_hash_map_snapshot(loaded, tmp.path);
+
+   BOOST_CHECK_EQUAL(loaded.size(), 2U);
+   BOOST_CHECK_EQUAL(loaded[2], "two");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
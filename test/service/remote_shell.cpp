@@ -0,0 +1,194 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "../../include/moost/service/remote_shell.h"
+#include "../../include/moost/metrics/registry.hpp"
+
+using namespace moost::service;
+using boost::asio::ip::tcp;
+
+BOOST_AUTO_TEST_SUITE(remote_shell_test)
+
+namespace {
+
+class test_handler
+{
+public:
+   bool handle_command(std::string& rv, const std::string& cmd, const std::string&)
+   {
+      if (cmd == "ping")
+      {
+         rv = "pong";
+         return true;
+      }
+
+      return false;
+   }
+
+   std::string get_prompt() const
+   {
+      return "test> ";
+   }
+
+   std::string show_help() const
+   {
+      return "";
+   }
+};
+
+typedef remote_shell<test_handler> test_shell;
+
+unsigned short test_port()
+{
+   return static_cast<unsigned short>(42000 + ::getpid() % 1000);
+}
+
+void connect(tcp::socket& sock, int rcvbuf = 0)
+{
+   sock.open(tcp::v4());
+
+   if (rcvbuf > 0)
+   {
+      sock.set_option(boost::asio::socket_base::receive_buffer_size(rcvbuf));
+   }
+
+   // don't wait forever if the shell doesn't answer
+   struct timeval tv = { 5, 0 };
+   ::setsockopt(sock.native_handle(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+   tcp::endpoint ep(boost::asio::ip::address_v4::loopback(), test_port());
+
+   for (int retry = 0; retry < 100; ++retry)
+   {
+      boost::system::error_code ec;
+
+      if (!sock.connect(ep, ec))
+      {
+         return;
+      }
+
+      sock.close();
+      sock.open(tcp::v4());
+      boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+   }
+
+   throw std::runtime_error("failed to connect to remote shell");
+}
+
+bool read_until(tcp::socket& sock, const std::string& what)
+{
+   std::string data;
+   char buf[4096];
+
+   while (data.find(what) == std::string::npos)
+   {
+      boost::system::error_code ec;
+      size_t len = sock.read_some(boost::asio::buffer(buf), ec);
+
+      if (ec)
+      {
+         return false;
+      }
+
+      data.append(buf, len);
+   }
+
+   return true;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(test_stuck_client)
+{
+   moost::metrics::counter& dropped = moost::metrics::get_counter("service.shell.output_dropped");
+   dropped.reset();
+
+   test_handler hdl;
+   test_shell shell(hdl);
+
+   shell.set_listen_port(test_port());
+   shell.set_num_threads(2);
+   shell.set_session_buffer_size(64*1024);
+
+   boost::thread runner(boost::bind(&test_shell::run, &shell));
+
+   boost::asio::io_service ios;
+
+   // a client that connects, but never reads anything
+   tcp::socket stuck(ios);
+   connect(stuck, 4096);
+
+   // the shell must keep draining stdout no matter what
+   std::vector<char> line(4096, 'x');
+   line.back() = '\n';
+
+   boost::posix_time::ptime t0 = boost::posix_time::microsec_clock::universal_time();
+
+   for (int i = 0; i < 4096; ++i)
+   {
+      fwrite(&line[0], 1, line.size(), stdout);
+   }
+
+   fflush(stdout);
+
+   boost::posix_time::time_duration flood = boost::posix_time::microsec_clock::universal_time() - t0;
+
+   // other sessions are still served
+   tcp::socket other(ios);
+   connect(other);
+   bool prompt = read_until(other, "test> ");
+   boost::asio::write(other, boost::asio::buffer(std::string("ping\n")));
+   bool pong = read_until(other, "pong");
+
+   // and a stuck client can't hold up the shutdown either
+   shell.stop("test done");
+   bool stopped = runner.timed_join(boost::posix_time::seconds(10));
+
+   BOOST_CHECK_LT(flood.total_seconds(), 10);
+   BOOST_CHECK(prompt);
+   BOOST_CHECK(pong);
+   BOOST_CHECK_GT(dropped.value(), 0);
+   BOOST_REQUIRE(stopped);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
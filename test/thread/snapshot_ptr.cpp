@@ -0,0 +1,135 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "../../include/moost/thread/snapshot_ptr.hpp"
+
+using namespace moost::thread;
+
+BOOST_AUTO_TEST_SUITE( snapshot_ptr_test )
+
+namespace {
+
+struct counted
+{
+   static boost::atomic<int> live;
+   int value;
+   counted(int v) : value(v) { ++live; }
+   ~counted() { --live; }
+};
+
+boost::atomic<int> counted::live(0);
+
+void reader(const snapshot_ptr<counted> & sp, const boost::atomic<bool> & done, bool & ok)
+{
+   int last = 0;
+   while (!done.load())
+   {
+      boost::shared_ptr<counted> p = sp.get_shared();
+      // snapshots are published in increasing order, so a reader should
+      // never see time go backwards
+      if (!p || p->value < last)
+         ok = false;
+      else
+         last = p->value;
+   }
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( test_empty )
+{
+   snapshot_ptr<int> sp;
+   BOOST_CHECK(!sp.get_shared());
+}
+
+BOOST_AUTO_TEST_CASE( test_publish )
+{
+   snapshot_ptr<int> sp(boost::shared_ptr<int>(new int(1)));
+   boost::shared_ptr<int> first = sp.get_shared();
+   BOOST_REQUIRE(first);
+   BOOST_CHECK_EQUAL(*first, 1);
+
+   sp.publish(boost::shared_ptr<int>(new int(2)));
+   BOOST_CHECK_EQUAL(*sp.get_shared(), 2);
+   BOOST_CHECK_EQUAL(*first, 1); // old snapshot is unaffected
+
+   sp = boost::shared_ptr<int>(new int(3));
+   BOOST_CHECK_EQUAL(*sp.get_shared(), 3);
+
+   sp.reset();
+   BOOST_CHECK(!sp.get_shared());
+}
+
+BOOST_AUTO_TEST_CASE( test_old_snapshot_released )
+{
+   {
+      snapshot_ptr<counted> sp(boost::shared_ptr<counted>(new counted(1)));
+      BOOST_CHECK_EQUAL(counted::live.load(), 1);
+      sp.publish(boost::shared_ptr<counted>(new counted(2)));
+      BOOST_CHECK_EQUAL(counted::live.load(), 1);
+      sp.publish(boost::shared_ptr<counted>(new counted(3)));
+      BOOST_CHECK_EQUAL(counted::live.load(), 1);
+   }
+   BOOST_CHECK_EQUAL(counted::live.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_concurrent_readers )
+{
+   const int num_readers = 4;
+   snapshot_ptr<counted> sp(boost::shared_ptr<counted>(new counted(0)));
+   boost::atomic<bool> done(false);
+   bool ok[num_readers];
+
+   boost::thread_group readers;
+   for (int i = 0; i < num_readers; ++i)
+   {
+      ok[i] = true;
+      readers.create_thread(boost::bind(&reader, boost::cref(sp), boost::cref(done), boost::ref(ok[i])));
+   }
+
+   for (int v = 1; v <= 10000; ++v)
+      sp.publish(boost::shared_ptr<counted>(new counted(v)));
+
+   done = true;
+   readers.join_all();
+
+   for (int i = 0; i < num_readers; ++i)
+      BOOST_CHECK(ok[i]);
+   BOOST_CHECK_EQUAL(sp.get_shared()->value, 10000);
+   BOOST_CHECK_EQUAL(counted::live.load(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,135 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "../../include/moost/thread/worker_group.hpp"
+
+using namespace moost::thread;
+
+BOOST_AUTO_TEST_SUITE(worker_group_test)
+
+namespace {
+
+void job(boost::atomic<int>& done)
+{
+   boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+   ++done;
+}
+
+void add_jobs(worker_group& wg, boost::atomic<int>& done, boost::atomic<int>& added)
+{
+   for (int i = 0; i < 1000; ++i)
+   {
+      if (wg.add_job(boost::bind(&job, boost::ref(done))))
+      {
+         ++added;
+      }
+   }
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(test_worker_group)
+{
+   boost::atomic<int> done(0);
+
+   {
+      worker_group wg(4);
+      BOOST_CHECK_EQUAL(wg.size(), 4U);
+
+      for (int i = 0; i < 100; ++i)
+      {
+         BOOST_CHECK(wg.add_job(boost::bind(&job, boost::ref(done))));
+      }
+
+      wg.stop();
+      BOOST_CHECK(!wg.running());
+      BOOST_CHECK(!wg.add_job(boost::bind(&job, boost::ref(done))));
+   }
+
+   BOOST_CHECK_EQUAL(done.load(), 100);
+}
+
+BOOST_AUTO_TEST_CASE(test_worker_group_metrics)
+{
+   moost::metrics::registry_singleton::instance().reset("thread.test_pool.");
+
+   boost::atomic<int> done(0);
+
+   {
+      worker_group wg(2, "test pool");
+
+      for (int i = 0; i < 50; ++i)
+      {
+         wg.add_job(boost::bind(&job, boost::ref(done)));
+      }
+
+      wg.stop();
+   }
+
+   BOOST_CHECK_EQUAL(done.load(), 50);
+   BOOST_CHECK_EQUAL(moost::metrics::get_counter("thread.test_pool.jobs").value(), 50);
+   BOOST_CHECK_EQUAL(moost::metrics::get_gauge("thread.test_pool.queued").value(), 0);
+
+   moost::metrics::histogram_snapshot run;
+   moost::metrics::get_histogram("thread.test_pool.run_us").snapshot(run);
+   BOOST_CHECK_EQUAL(run.count, 50U);
+   BOOST_CHECK_GE(run.sum, 50U*1000U);
+
+   moost::metrics::histogram_snapshot wait;
+   moost::metrics::get_histogram("thread.test_pool.wait_us").snapshot(wait);
+   BOOST_CHECK_EQUAL(wait.count, 50U);
+}
+
+BOOST_AUTO_TEST_CASE(test_worker_group_stop_while_adding)
+{
+   moost::metrics::registry_singleton::instance().reset("thread.test_stop_pool.");
+
+   boost::atomic<int> done(0);
+   boost::atomic<int> added(0);
+
+   {
+      worker_group wg(2, "test stop pool");
+      boost::thread adder(boost::bind(&add_jobs, boost::ref(wg), boost::ref(done), boost::ref(added)));
+
+      boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+      wg.stop();
+      adder.join();
+   }
+
+   // jobs that were refused never count as queued
+   BOOST_CHECK_EQUAL(done.load(), added.load());
+   BOOST_CHECK_EQUAL(moost::metrics::get_gauge("thread.test_stop_pool.queued").value(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,224 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+#include <map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstring>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "../../include/moost/utils/perf_profiler.hpp"
+
+using namespace moost;
+using namespace moost::utils;
+
+BOOST_AUTO_TEST_SUITE( perf_profiler_test )
+
+namespace {
+
+void run_scopes(perf_profiler& prof, int n)
+{
+   for (int i = 0; i < n; ++i)
+   {
+      perf_profiler::scope outer(prof, "outer");
+
+      {
+         perf_profiler::scope inner(prof, "inner");
+      }
+   }
+}
+
+}
+
+BOOST_AUTO_TEST_CASE( test_wall_clock_only )
+{
+   perf_profiler prof(false);
+
+   for (int i = 0; i < 3; ++i)
+   {
+      perf_profiler::scope s(prof, "sleep");
+      boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+   }
+
+   {
+      perf_profiler::scope s(prof, "stopped");
+      s.stop();
+      boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+   }
+
+   std::map<std::string, perf_scope_stats> stats;
+   prof.snapshot(stats);
+
+   BOOST_REQUIRE_EQUAL(stats.size(), 2U);
+   BOOST_CHECK_EQUAL(stats["sleep"].count, 3U);
+   BOOST_CHECK_EQUAL(stats["sleep"].measured, 0U);
+   BOOST_CHECK_GE(stats["sleep"].wall_ns, 6000000U);
+   BOOST_CHECK_GE(stats["sleep"].wall_us(), 2000.0);
+   BOOST_CHECK_EQUAL(stats["stopped"].count, 1U);
+   BOOST_CHECK_LT(stats["stopped"].wall_ns, 20000000U);
+
+   for (size_t e = 0; e < perf_counters::num_events; ++e)
+   {
+      BOOST_CHECK(!prof.available(e));
+      BOOST_CHECK(!stats["sleep"].available[e]);
+      BOOST_CHECK_EQUAL(stats["sleep"].value[e], 0U);
+   }
+
+   std::ostringstream os;
+   prof.write_text(os);
+   BOOST_CHECK(os.str().find("page_faults") != std::string::npos);
+   BOOST_CHECK(os.str().find("sleep") != std::string::npos);
+   BOOST_CHECK(os.str().find(" -") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE( test_counters )
+{
+   perf_profiler prof;
+   const size_t size = 16 << 20;
+
+   {
+      perf_profiler::scope s(prof, "touch");
+      std::vector<char> mem(size);
+      std::memset(&mem[0], 1, size);
+   }
+
+   std::map<std::string, perf_scope_stats> stats;
+   prof.snapshot(stats);
+   const perf_scope_stats& touch = stats["touch"];
+
+   BOOST_CHECK_EQUAL(touch.count, 1U);
+
+   // counters may legitimately be unavailable, but if they are,
+   // touching 16MB of fresh memory must have caused page faults
+   if (prof.available(perf_counters::page_faults))
+   {
+      BOOST_CHECK_EQUAL(touch.measured, 1U);
+      BOOST_CHECK(touch.available[perf_counters::page_faults]);
+      BOOST_CHECK_GE(touch.value[perf_counters::page_faults], 100U);
+   }
+   else
+   {
+      BOOST_TEST_MESSAGE("page fault counter not available");
+   }
+
+   if (prof.available(perf_counters::instructions))
+   {
+      BOOST_CHECK_GE(touch.value[perf_counters::instructions], size/64);
+   }
+   else
+   {
+      BOOST_TEST_MESSAGE("instruction counter not available");
+   }
+}
+
+BOOST_AUTO_TEST_CASE( test_threads )
+{
+   perf_profiler prof;
+   boost::thread_group threads;
+
+   for (int i = 0; i < 4; ++i)
+   {
+      threads.create_thread(boost::bind(&run_scopes, boost::ref(prof), 500));
+   }
+
+   run_scopes(prof, 100);
+   threads.join_all();
+
+   // the threads are gone, but their totals must still be there
+   std::map<std::string, perf_scope_stats> stats;
+   prof.snapshot(stats);
+
+   BOOST_CHECK_EQUAL(stats["outer"].count, 2100U);
+   BOOST_CHECK_EQUAL(stats["inner"].count, 2100U);
+   BOOST_CHECK_GE(stats["outer"].wall_ns, stats["inner"].wall_ns);
+   BOOST_CHECK_LE(stats["outer"].measured, 2100U);
+}
+
+BOOST_AUTO_TEST_CASE( test_multi_timer )
+{
+   multi_timer timers;
+   perf_profiler prof(false, 256, &timers);
+
+   for (int i = 0; i < 5; ++i)
+   {
+      perf_profiler::scope s(prof, "request");
+   }
+
+   BOOST_CHECK_EQUAL(timers["request"].count(), 5U);
+   BOOST_CHECK_GE(timers["request"].min_time(), 0);
+}
+
+BOOST_AUTO_TEST_CASE( test_update_metrics )
+{
+   perf_profiler prof;
+
+   run_scopes(prof, 3);
+   prof.update_metrics("test_perf");
+
+   BOOST_CHECK_EQUAL(metrics::get_gauge("test_perf.outer.calls").value(), 3);
+   BOOST_CHECK_EQUAL(metrics::get_gauge("test_perf.inner.calls").value(), 3);
+
+   metrics::registry::metric_map counters;
+   metrics::registry_singleton::instance().select(counters, "test_perf.outer.");
+
+   for (size_t e = 0; e < perf_counters::num_events; ++e)
+   {
+      bool published = counters.count(std::string("test_perf.outer.") + perf_counters::name(e)) > 0;
+      BOOST_CHECK_EQUAL(published, prof.available(e));
+   }
+
+   if (prof.available(perf_counters::instructions))
+   {
+      BOOST_CHECK_GT(metrics::get_gauge("test_perf.outer.instructions").value(), 0);
+   }
+}
+
+BOOST_AUTO_TEST_CASE( test_max_scopes )
+{
+   perf_profiler prof(false, 2);
+
+   {
+      perf_profiler::scope a(prof, "a");
+      perf_profiler::scope b(prof, "b");
+      perf_profiler::scope a2(prof, "a");
+   }
+
+   BOOST_CHECK_THROW(perf_profiler::scope c(prof, "c"), std::runtime_error);
+
+   std::map<std::string, perf_scope_stats> stats;
+   prof.snapshot(stats);
+   BOOST_CHECK_EQUAL(stats.size(), 2U);
+   BOOST_CHECK_EQUAL(stats["a"].count, 2U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,342 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+#include <vector>
+#include <set>
+
+#include "../../include/moost/transaction/batch_handler.hpp"
+#include "../../include/moost/transaction/queue.hpp"
+#include "../../include/moost/io/tempdir.hpp"
+
+using namespace moost::transaction;
+
+BOOST_AUTO_TEST_SUITE(batch_handler_test)
+
+namespace {
+
+typedef NonePersistedTQ<int> queue_t;
+
+// A sink that can be told to fail, and remembers what it committed
+struct sink_state
+{
+   sink_state() : fail(false), failEvery(0), calls(0), maxBatch(0) {}
+
+   boost::mutex mtx;
+   bool fail;
+   size_t failEvery;
+   size_t calls;
+   size_t maxBatch;
+   std::multiset<int> attempted;
+   std::multiset<int> committed;
+   std::vector<boost::uint64_t> callTimes;
+};
+
+struct sink
+{
+   explicit sink(sink_state & state) : state(&state) {}
+
+   size_t operator()(std::vector<int> const & batch)
+   {
+      boost::mutex::scoped_lock l(state->mtx);
+
+      ++state->calls;
+      state->maxBatch = std::max(state->maxBatch, batch.size());
+      state->callTimes.push_back(moost::metrics::monotonic_us());
+      state->attempted.insert(batch.begin(), batch.end());
+
+      if(state->fail)
+      {
+         throw std::runtime_error("sink unavailable");
+      }
+
+      size_t count = batch.size();
+
+      // fail part of the batch now and again
+      if(state->failEvery > 0 && state->calls % state->failEvery == 0)
+      {
+         count /= 2;
+      }
+
+      state->committed.insert(batch.begin(), batch.begin() + count);
+
+      return count;
+   }
+
+   sink_state * state;
+};
+
+struct item_sink
+{
+   explicit item_sink(std::vector<int> & items) : items(&items) {}
+
+   bool operator()(int const & item)
+   {
+      if(item < 0) { return false; }
+      items->push_back(item);
+      return true;
+   }
+
+   std::vector<int> * items;
+};
+
+struct dead_letters
+{
+   boost::mutex mtx;
+   std::vector<int> items;
+   std::vector<size_t> attempts;
+
+   void add(int const & item, size_t attempts)
+   {
+      boost::mutex::scoped_lock l(mtx);
+      items.push_back(item);
+      this->attempts.push_back(attempts);
+   }
+};
+
+template <typename handlerT>
+bool wait_for_empty(handlerT const & handler, int timeout_ms = 5000)
+{
+   for(int i = 0 ; i < timeout_ms && handler.size() > 0 ; ++i)
+   {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+   }
+
+   return handler.size() == 0;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(test_commit_in_batches)
+{
+   sink_state state;
+   queue_t queue;
+
+   for(int i = 0 ; i < 10 ; ++i)
+   {
+      queue.push_back(i);
+   }
+
+   {
+      BatchTransactionHandler<queue_t, sink> handler(queue, sink(state), 4, 16, RetryPolicy(0, 1, 10));
+
+      for(int i = 10 ; i < 5000 ; ++i)
+      {
+         handler.post(i);
+      }
+
+      BOOST_CHECK(wait_for_empty(handler));
+   }
+
+   BOOST_CHECK(queue.empty());
+   BOOST_CHECK_EQUAL(state.committed.size(), 5000U);
+   BOOST_CHECK_EQUAL(*state.committed.begin(), 0);
+   BOOST_CHECK_EQUAL(*state.committed.rbegin(), 4999);
+   BOOST_CHECK_LE(state.maxBatch, 16U);
+   BOOST_CHECK_LT(state.calls, 5000U);
+}
+
+BOOST_AUTO_TEST_CASE(test_partial_batches_are_retried)
+{
+   sink_state state;
+   state.failEvery = 3;
+   queue_t queue;
+
+   {
+      BatchTransactionHandler<queue_t, sink> handler(queue, sink(state), 2, 10, RetryPolicy(0, 1, 2));
+
+      for(int i = 0 ; i < 1000 ; ++i)
+      {
+         handler.post(i);
+      }
+
+      BOOST_CHECK(wait_for_empty(handler));
+   }
+
+   BOOST_CHECK(queue.empty());
+   BOOST_CHECK_EQUAL(state.committed.size(), 1000U);
+
+   for(int i = 0 ; i < 1000 ; ++i)
+   {
+      BOOST_REQUIRE_EQUAL(state.committed.count(i), 1U);
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_backoff)
+{
+   sink_state state;
+   state.fail = true;
+   queue_t queue;
+
+   BatchTransactionHandler<queue_t, sink> handler(queue, sink(state), 1, 10, RetryPolicy(0, 10, 40, 0.0));
+
+   handler.post(1);
+
+   // 0, 10, 30, 70, 110, 150ms: a handful of attempts, not a hot loop
+   boost::this_thread::sleep(boost::posix_time::milliseconds(170));
+
+   {
+      boost::mutex::scoped_lock l(state.mtx);
+      BOOST_CHECK_GE(state.calls, 4U);
+      BOOST_CHECK_LE(state.calls, 7U);
+
+      for(size_t i = 1 ; i < state.callTimes.size() ; ++i)
+      {
+         BOOST_CHECK_GE(state.callTimes[i] - state.callTimes[i - 1], 9000U);
+      }
+
+      state.fail = false;
+   }
+
+   BOOST_CHECK(wait_for_empty(handler));
+   BOOST_CHECK_EQUAL(state.committed.count(1), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(test_retry_policy)
+{
+   RetryPolicy policy(0, 100, 1000);
+
+   BOOST_CHECK_EQUAL(policy.BackoffUs(1), 100000U);
+   BOOST_CHECK_EQUAL(policy.BackoffUs(2), 200000U);
+   BOOST_CHECK_EQUAL(policy.BackoffUs(4), 800000U);
+   BOOST_CHECK_EQUAL(policy.BackoffUs(5), 1000000U);
+   BOOST_CHECK_EQUAL(policy.BackoffUs(1000), 1000000U);
+}
+
+BOOST_AUTO_TEST_CASE(test_dead_letters)
+{
+   std::vector<int> items;
+   dead_letters dead;
+   queue_t queue;
+
+   {
+      BatchTransactionHandler<queue_t, PerItemCommit<item_sink> > handler(
+         queue, PerItemCommit<item_sink>(item_sink(items)), 1, 10, RetryPolicy(3, 1, 1),
+         boost::bind(&dead_letters::add, &dead, _1, _2), "test dead letters");
+
+      handler.post(1);
+      handler.post(-2);
+      handler.post(3);
+
+      BOOST_CHECK(wait_for_empty(handler));
+   }
+
+   BOOST_CHECK(queue.empty());
+   BOOST_REQUIRE_EQUAL(items.size(), 2U);
+   BOOST_CHECK_EQUAL(items[0], 1);
+   BOOST_CHECK_EQUAL(items[1], 3);
+   BOOST_REQUIRE_EQUAL(dead.items.size(), 1U);
+   BOOST_CHECK_EQUAL(dead.items[0], -2);
+   BOOST_CHECK_EQUAL(dead.attempts[0], 3U);
+
+   BOOST_CHECK_EQUAL(moost::metrics::get_counter("transaction.test_dead_letters.committed").value(), 2);
+   BOOST_CHECK_GE(moost::metrics::get_counter("transaction.test_dead_letters.retried").value(), 2);
+   BOOST_CHECK_EQUAL(moost::metrics::get_counter("transaction.test_dead_letters.dead_letters").value(), 1);
+   BOOST_CHECK_EQUAL(moost::metrics::get_gauge("transaction.test_dead_letters.queued").value(), 0);
+   BOOST_CHECK_EQUAL(moost::metrics::get_gauge("transaction.test_dead_letters.backoff").value(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_held_behind_failing_item)
+{
+   BOOST_CHECK_GT(RetryPolicy().maxAttempts, 0U);
+
+   std::vector<int> items;
+   queue_t queue;
+
+   {
+      // retried forever, so the failing item holds back the ones after it
+      BatchTransactionHandler<queue_t, PerItemCommit<item_sink> > handler(
+         queue, PerItemCommit<item_sink>(item_sink(items)), 1, 10, RetryPolicy(0, 1, 1),
+         BatchTransactionHandler<queue_t, PerItemCommit<item_sink> >::dead_letter_sink_t(), "test held");
+
+      handler.post(1);
+      handler.post(-2);
+      handler.post(3);
+      handler.post(4);
+
+      for(int i = 0 ; i < 5000 && moost::metrics::get_gauge("transaction.test_held.held").value() < 2 ; ++i)
+      {
+         boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+      }
+
+      BOOST_CHECK_EQUAL(moost::metrics::get_gauge("transaction.test_held.held").value(), 2);
+      BOOST_CHECK_EQUAL(moost::metrics::get_gauge("transaction.test_held.queued").value(), 1);
+      BOOST_CHECK_EQUAL(handler.size(), 3U);
+   }
+
+   BOOST_CHECK_EQUAL(queue.size(), 3U);
+}
+
+BOOST_AUTO_TEST_CASE(test_failed_items_stay_persisted)
+{
+   moost::io::tempdir dir;
+
+   typedef FullyPersistedTQ<int> persisted_queue_t;
+   sink_state state;
+   state.fail = true;
+
+   {
+      persisted_queue_t queue(dir.string(), "test");
+      BatchTransactionHandler<persisted_queue_t, sink> handler(queue, sink(state), 2, 10, RetryPolicy(0, 10000, 10000),
+         BatchTransactionHandler<persisted_queue_t, sink>::dead_letter_sink_t(), "test persisted");
+
+      for(int i = 0 ; i < 20 ; ++i)
+      {
+         handler.post(i);
+      }
+
+      // wait for everything to have failed once
+      while(moost::metrics::get_gauge("transaction.test_persisted.backoff").value() < 20)
+      {
+         boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+      }
+   }
+
+   // every item was tried again on shutdown, regardless of backoff
+   for(int i = 0 ; i < 20 ; ++i)
+   {
+      BOOST_REQUIRE_EQUAL(state.attempted.count(i), 2U);
+   }
+
+   state.fail = false;
+
+   {
+      persisted_queue_t queue(dir.string(), "test");
+      BOOST_CHECK_EQUAL(queue.size(), 20U);
+
+      BatchTransactionHandler<persisted_queue_t, sink> handler(queue, sink(state), 2, 10);
+      BOOST_CHECK(wait_for_empty(handler));
+   }
+
+   BOOST_CHECK_EQUAL(state.committed.size(), 20U);
+   BOOST_CHECK(boost::filesystem::is_empty(dir));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,318 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+#include <fstream>
+#include <string>
+
+#include "../../include/moost/transaction/log_queue.hpp"
+#include "../../include/moost/transaction/handler.hpp"
+#include "../../include/moost/io/tempdir.hpp"
+
+using namespace moost::transaction;
+
+BOOST_AUTO_TEST_SUITE(log_queue_test)
+
+namespace {
+
+typedef LogPersistedTQ<int> queue_t;
+
+struct string_serializer
+{
+   void Serialise(std::string const & data, std::string & record) const
+   {
+      record = data;
+   }
+
+   bool Deserialise(char const * record, size_t size, std::string & data) const
+   {
+      data.assign(record, size);
+      return true;
+   }
+};
+
+size_t count_files(moost::io::tempdir const & dir)
+{
+   size_t count = 0;
+
+   for(boost::filesystem::directory_iterator it(dir) ; it != boost::filesystem::directory_iterator() ; ++it)
+   {
+      ++count;
+   }
+
+   return count;
+}
+
+struct counting_commit
+{
+   explicit counting_commit(boost::atomic<int> & sum) : sum(&sum) {}
+
+   bool operator()(int const & item)
+   {
+      *sum += item;
+      return true;
+   }
+
+   boost::atomic<int> * sum;
+};
+
+}
+
+BOOST_AUTO_TEST_CASE(test_push_pop_replay)
+{
+   moost::io::tempdir dir;
+
+   {
+      queue_t queue(dir.string(), "test");
+      BOOST_CHECK(queue.empty());
+
+      for(int i = 0 ; i < 100 ; ++i)
+      {
+         queue.push_back(i);
+      }
+
+      BOOST_CHECK_EQUAL(queue.size(), 100U);
+
+      for(int i = 0 ; i < 30 ; ++i)
+      {
+         BOOST_REQUIRE_EQUAL(queue.front(), i);
+         queue.pop_front();
+      }
+   }
+
+   {
+      queue_t queue(dir.string(), "test");
+      BOOST_REQUIRE_EQUAL(queue.size(), 70U);
+      BOOST_CHECK_EQUAL(queue.front(), 30);
+
+      queue.push_back(100);
+
+      while(queue.size() > 1)
+      {
+         queue.pop_front();
+      }
+   }
+
+   {
+      queue_t queue(dir.string(), "test");
+      BOOST_REQUIRE_EQUAL(queue.size(), 1U);
+      BOOST_CHECK_EQUAL(queue.front(), 100);
+
+      queue.pop_front();
+   }
+
+   {
+      queue_t queue(dir.string(), "test");
+      BOOST_CHECK(queue.empty());
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_segments_are_recycled)
+{
+   moost::io::tempdir dir;
+
+   {
+      // 64 byte segments hold 4 records
+      queue_t queue(dir.string(), "test", 64, 10, 1000);
+      int next = 0;
+
+      for(int i = 0 ; i < 1000 ; ++i)
+      {
+         queue.push_back(i);
+
+         // pop two items for every three pushed
+         if(i % 3 == 2)
+         {
+            for(int j = 0 ; j < 2 ; ++j)
+            {
+               BOOST_REQUIRE_EQUAL(queue.front(), next++);
+               queue.pop_front();
+            }
+         }
+      }
+
+      BOOST_CHECK_GT(queue.segments(), 50U);
+
+      while(!queue.empty())
+      {
+         queue.pop_front();
+      }
+
+      BOOST_CHECK_EQUAL(queue.segments(), 1U);
+   }
+
+   // one segment, two spares and the checkpoint
+   BOOST_CHECK_EQUAL(count_files(dir), 4U);
+
+   size_t segments = 0;
+
+   {
+      queue_t queue(dir.string(), "test", 64);
+      BOOST_CHECK(queue.empty());
+
+      for(int i = 0 ; i < 10 ; ++i)
+      {
+         queue.push_back(i);
+      }
+
+      segments = queue.segments();
+   }
+
+   // the spares were used up first
+   BOOST_CHECK_GE(segments, 3U);
+   BOOST_CHECK_EQUAL(count_files(dir), segments + 1);
+
+   {
+      queue_t queue(dir.string(), "test", 64);
+      BOOST_REQUIRE_EQUAL(queue.size(), 10U);
+
+      for(int i = 0 ; i < 10 ; ++i)
+      {
+         BOOST_REQUIRE_EQUAL(queue.front(), i);
+         queue.pop_front();
+      }
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_torn_tail)
+{
+   moost::io::tempdir dir;
+   std::string segment;
+
+   {
+      queue_t queue(dir.string(), "test");
+
+      for(int i = 0 ; i < 10 ; ++i)
+      {
+         queue.push_back(i);
+      }
+   }
+
+   for(boost::filesystem::directory_iterator it(dir) ; it != boost::filesystem::directory_iterator() ; ++it)
+   {
+      if(it->path().extension() == ".log")
+      {
+         segment = it->path().string();
+      }
+   }
+
+   BOOST_REQUIRE(!segment.empty());
+
+   // cut the last record in half
+   boost::filesystem::resize_file(segment, boost::filesystem::file_size(segment) - 2);
+
+   {
+      queue_t queue(dir.string(), "test");
+      BOOST_REQUIRE_EQUAL(queue.size(), 9U);
+
+      // the torn record is overwritten
+      queue.push_back(42);
+   }
+
+   {
+      // and garbage after the end is ignored
+      std::ofstream out(segment.c_str(), std::ios::binary | std::ios::app);
+      out << "some garbage that isn't a record";
+   }
+
+   {
+      queue_t queue(dir.string(), "test");
+      BOOST_REQUIRE_EQUAL(queue.size(), 10U);
+
+      for(int i = 0 ; i < 9 ; ++i)
+      {
+         queue.pop_front();
+      }
+
+      BOOST_CHECK_EQUAL(queue.front(), 42);
+   }
+}
+
+BOOST_AUTO_TEST_CASE(test_custom_serializer)
+{
+   moost::io::tempdir dir;
+
+   {
+      LogPersistedTQ<std::string, string_serializer> queue(dir.string(), "strings", 1024, 1, 0);
+
+      queue.push_back("hello");
+      queue.push_back(std::string());
+      queue.push_back(std::string(2000, 'x'));
+   }
+
+   {
+      LogPersistedTQ<std::string, string_serializer> queue(dir.string(), "strings", 1024);
+      BOOST_REQUIRE_EQUAL(queue.size(), 3U);
+      BOOST_CHECK_EQUAL(queue.front(), "hello");
+      queue.pop_front();
+      BOOST_CHECK_EQUAL(queue.front(), "");
+      queue.pop_front();
+      BOOST_CHECK_EQUAL(queue.front().size(), 2000U);
+   }
+
+   // queues with different ids share a directory
+   queue_t other(dir.string(), "other");
+   BOOST_CHECK(other.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_transaction_handler)
+{
+   moost::io::tempdir dir;
+   boost::atomic<int> sum(0);
+
+   {
+      queue_t queue(dir.string(), "test");
+
+      for(int i = 1 ; i <= 10 ; ++i)
+      {
+         queue.push_back(i);
+      }
+
+      TransactionHandler<ITransactionQueue<int>, counting_commit> handler(queue, counting_commit(sum));
+
+      for(int i = 11 ; i <= 100 ; ++i)
+      {
+         handler.post(i);
+      }
+
+      for(int i = 0 ; i < 5000 && sum < 5050 ; ++i)
+      {
+         boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+      }
+   }
+
+   BOOST_CHECK_EQUAL(sum.load(), 5050);
+
+   queue_t queue(dir.string(), "test");
+   BOOST_CHECK(queue.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
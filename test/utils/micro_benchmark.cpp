@@ -0,0 +1,291 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <cmath>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include "../../include/moost/utils/micro_benchmark.hpp"
+
+using namespace moost::utils;
+
+BOOST_AUTO_TEST_SUITE(moost_utils_micro_benchmark)
+
+namespace {
+
+void spin_us(boost::uint64_t us, boost::uint64_t n)
+{
+   for (boost::uint64_t i = 0; i < n; ++i)
+   {
+      boost::uint64_t start = monotonic_clock::now_ns();
+
+      while (monotonic_clock::now_ns() - start < 1000*us)
+      {
+      }
+   }
+}
+
+void count(boost::uint64_t *total, boost::uint64_t n)
+{
+   *total += n;
+}
+
+void setup_counting(std::vector<std::string> *setups, boost::uint64_t *total, micro_benchmark::suite& s)
+{
+   setups->push_back("counting");
+   s.add("one", boost::bind(&count, total, _1));
+   s.add("two", boost::bind(&count, total, _1));
+}
+
+void setup_broken(std::vector<std::string> *setups, micro_benchmark::suite&)
+{
+   setups->push_back("broken");
+   throw std::runtime_error("no backend");
+}
+
+micro_benchmark_options quick_options()
+{
+   micro_benchmark_options opt;
+   opt.warmup_ms = 0.0;
+   opt.min_sample_ms = 1.0;
+   opt.samples = 5;
+   return opt;
+}
+
+bool contains(const std::string& haystack, const std::string& needle)
+{
+   return haystack.find(needle) != std::string::npos;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(micro_benchmark_median)
+{
+   std::vector<double> v;
+   BOOST_CHECK_EQUAL(micro_benchmark_stats::median(v), 0.0);
+
+   v.push_back(5.0);
+   v.push_back(1.0);
+   v.push_back(3.0);
+   BOOST_CHECK_EQUAL(micro_benchmark_stats::median(v), 3.0);
+
+   v.push_back(10.0);
+   BOOST_CHECK_EQUAL(micro_benchmark_stats::median(v), 4.0);
+
+   // the argument is taken by value, the caller's order stays put
+   BOOST_CHECK_EQUAL(v[0], 5.0);
+   BOOST_CHECK_EQUAL(v[3], 10.0);
+}
+
+BOOST_AUTO_TEST_CASE(micro_benchmark_t_critical)
+{
+   BOOST_CHECK_CLOSE(micro_benchmark_stats::t_critical_95(1), 12.706, 0.001);
+   BOOST_CHECK_CLOSE(micro_benchmark_stats::t_critical_95(19), 2.093, 0.001);
+   BOOST_CHECK_CLOSE(micro_benchmark_stats::t_critical_95(100000), 1.960, 0.001);
+
+   for (size_t dof = 1; dof < 2000; ++dof)
+   {
+      BOOST_CHECK_GE(micro_benchmark_stats::t_critical_95(dof), micro_benchmark_stats::t_critical_95(dof + 1));
+   }
+}
+
+BOOST_AUTO_TEST_CASE(micro_benchmark_summarise)
+{
+   std::vector<double> samples;
+   samples.push_back(10.0);
+   samples.push_back(11.0);
+   samples.push_back(9.0);
+   samples.push_back(10.0);
+   samples.push_back(1000.0);
+   samples.push_back(10.0);
+
+   micro_benchmark_result r;
+   micro_benchmark_stats::summarise(samples, 3.0, r);
+
+   BOOST_CHECK_EQUAL(r.samples, 6U);
+   BOOST_CHECK_EQUAL(r.outliers, 1U);
+   BOOST_CHECK_EQUAL(samples.size(), 5U);
+   BOOST_CHECK_CLOSE(r.mean_ns, 10.0, 0.001);
+   BOOST_CHECK_CLOSE(r.median_ns, 10.0, 0.001);
+   BOOST_CHECK_EQUAL(r.min_ns, 9.0);
+   BOOST_CHECK_EQUAL(r.max_ns, 11.0);
+   BOOST_CHECK_CLOSE(r.stddev_ns, std::sqrt(0.5), 0.001);
+
+   // mean +/- t(4) * s/sqrt(5)
+   BOOST_CHECK_CLOSE(r.ci_high_ns - r.mean_ns, 2.776*std::sqrt(0.5)/std::sqrt(5.0), 0.001);
+   BOOST_CHECK_CLOSE(r.mean_ns - r.ci_low_ns, r.ci_high_ns - r.mean_ns, 0.001);
+   BOOST_CHECK_CLOSE(r.ops_per_sec(), 1e8, 0.001);
+}
+
+BOOST_AUTO_TEST_CASE(micro_benchmark_summarise_no_spread)
+{
+   std::vector<double> samples(8, 42.0);
+
+   micro_benchmark_result r;
+   micro_benchmark_stats::summarise(samples, 3.0, r);
+
+   // no spread means nothing can be called an outlier
+   BOOST_CHECK_EQUAL(r.outliers, 0U);
+   BOOST_CHECK_EQUAL(r.mean_ns, 42.0);
+   BOOST_CHECK_EQUAL(r.stddev_ns, 0.0);
+   BOOST_CHECK_EQUAL(r.ci_low_ns, 42.0);
+   BOOST_CHECK_EQUAL(r.ci_high_ns, 42.0);
+
+   // a threshold of 0 keeps everything
+   samples.push_back(1000.0);
+   micro_benchmark_stats::summarise(samples, 0.0, r);
+   BOOST_CHECK_EQUAL(r.outliers, 0U);
+   BOOST_CHECK_EQUAL(r.max_ns, 1000.0);
+}
+
+BOOST_AUTO_TEST_CASE(micro_benchmark_scaling)
+{
+   micro_benchmark mb(quick_options());
+   micro_benchmark_result r;
+   std::vector<double> samples;
+
+   // 100us per iteration need at least 10 iterations to fill 1ms
+   mb.measure(boost::bind(&spin_us, 100, _1), r, samples);
+
+   BOOST_CHECK_GE(r.iterations, 10U);
+   BOOST_CHECK_LE(r.iterations, 100U);
+   BOOST_CHECK_EQUAL(r.samples, 5U);
+   BOOST_CHECK_EQUAL(samples.size(), r.samples - r.outliers);
+   BOOST_CHECK_GE(r.min_ns, 100000.0);
+   BOOST_CHECK_LE(r.ci_low_ns, r.mean_ns);
+   BOOST_CHECK_GE(r.ci_high_ns, r.mean_ns);
+
+   // cheap cases are capped at max_iterations
+   micro_benchmark_options opt = quick_options();
+   opt.min_sample_ms = 1000.0;
+   opt.max_iterations = 64;
+   micro_benchmark capped(opt);
+   boost::uint64_t total = 0;
+   capped.measure(boost::bind(&count, &total, _1), r, samples);
+   BOOST_CHECK_EQUAL(r.iterations, 64U);
+}
+
+BOOST_AUTO_TEST_CASE(micro_benchmark_run)
+{
+   micro_benchmark mb(quick_options());
+   std::vector<std::string> setups;
+   boost::uint64_t total = 0;
+
+   mb.add_suite("counting", boost::bind(&setup_counting, &setups, &total, _1));
+   mb.add_suite("broken", boost::bind(&setup_broken, &setups, _1));
+
+   std::vector<std::string> names;
+   mb.suites(names);
+   BOOST_REQUIRE_EQUAL(names.size(), 2U);
+   BOOST_CHECK_EQUAL(names[0], "counting");
+   BOOST_CHECK_EQUAL(names[1], "broken");
+
+   std::vector<micro_benchmark_result> results;
+   std::ostringstream log;
+   BOOST_CHECK_EQUAL(mb.run(std::vector<std::string>(), "", results, &log), 1U);
+   BOOST_CHECK_EQUAL(setups.size(), 2U);
+   BOOST_CHECK(contains(log.str(), "broken: setup failed: no backend"));
+   BOOST_REQUIRE_EQUAL(results.size(), 2U);
+   BOOST_CHECK_EQUAL(results[0].suite, "counting");
+   BOOST_CHECK_EQUAL(results[0].name, "one");
+   BOOST_CHECK_EQUAL(results[1].name, "two");
+   BOOST_CHECK_GE(total, 5*(results[0].iterations + results[1].iterations));
+
+   // suites that aren't selected aren't set up
+   setups.clear();
+   results.clear();
+   std::vector<std::string> only(1, "counting");
+   benchmark timings("test");
+   BOOST_CHECK_EQUAL(mb.run(only, "ing/tw", results, 0, &timings), 0U);
+   BOOST_CHECK_EQUAL(setups.size(), 1U);
+   BOOST_REQUIRE_EQUAL(results.size(), 1U);
+   BOOST_CHECK_EQUAL(results[0].name, "two");
+
+   std::ostringstream hist;
+   timings.output(hist);
+   BOOST_CHECK(contains(hist.str(), "counting/two"));
+}
+
+BOOST_AUTO_TEST_CASE(micro_benchmark_output)
+{
+   std::vector<micro_benchmark_result> results(1);
+   results[0].suite = "lru";
+   results[0].name = "get \"hit\"";
+   results[0].iterations = 1000;
+   results[0].samples = 20;
+   results[0].outliers = 2;
+   results[0].mean_ns = 12.5;
+   results[0].ci_low_ns = 12.0;
+   results[0].ci_high_ns = 13.0;
+
+   std::ostringstream table;
+   micro_benchmark::write_table(table, results);
+   BOOST_CHECK(contains(table.str(), "lru/get \"hit\""));
+   BOOST_CHECK(contains(table.str(), "12.50"));
+   BOOST_CHECK(contains(table.str(), "4.0%"));
+   BOOST_CHECK(contains(table.str(), "80000000"));
+
+   micro_benchmark mb;
+   std::ostringstream json;
+   mb.write_json(json, results);
+   BOOST_CHECK(contains(json.str(), "{\"clock\":\"monotonic\","));
+   BOOST_CHECK(contains(json.str(), "\"results\":[{\"suite\":\"lru\",\"name\":\"get \\\"hit\\\"\",\"iterations\":1000,\"samples\":20,\"outliers\":2,\"mean_ns\":12.500000,"));
+   BOOST_CHECK(contains(json.str(), "\"ci_low_ns\":12.000000,\"ci_high_ns\":13.000000,\"ops_per_sec\":80000000.000000}]}"));
+}
+
+BOOST_AUTO_TEST_CASE(benchmark_clock_types)
+{
+   BOOST_CHECK_EQUAL(benchmark_clock::parse("monotonic"), benchmark_clock::monotonic);
+   BOOST_CHECK_EQUAL(benchmark_clock::parse("tsc"), benchmark_clock::tsc);
+   BOOST_CHECK_THROW(benchmark_clock::parse("wall"), std::runtime_error);
+
+   std::vector<benchmark_clock::type> types;
+   types.push_back(benchmark_clock::monotonic);
+
+   if (tsc_clock::available())
+   {
+      types.push_back(benchmark_clock::tsc);
+   }
+
+   for (size_t i = 0; i < types.size(); ++i)
+   {
+      benchmark_clock clock(types[i]);
+      boost::uint64_t t0 = clock.ticks();
+      spin_us(2000, 1);
+      double ns = clock.elapsed_ns(t0, clock.ticks());
+
+      BOOST_CHECK_GE(ns, 1.5e6);
+      BOOST_CHECK_LE(ns, 1e9);
+   }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
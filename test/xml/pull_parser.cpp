@@ -0,0 +1,228 @@
+/* vim:set ts=3 sw=3 sts=3 et: */
+/**
+ * Copyright © 2008-2013 Last.fm Limited
+ *
+ * This file is part of libmoost.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <boost/test/test_tools.hpp>
+
+#include <string>
+#include <fstream>
+#include <sstream>
+
+#include "../../include/moost/testing/test_directory_creator.hpp"
+#include "../../include/moost/xml/pull_parser.hpp"
+
+using namespace moost::xml;
+
+// -----------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_SUITE( pull_parser_test )
+
+namespace
+{
+
+   // returns a compact trace of all events, e.g. "<base>[1]</base>"
+   std::string trace(const std::string& xml)
+   {
+      pull_parser parser(xml.data(), xml.size());
+      std::ostringstream oss;
+
+      for (;;)
+      {
+         switch ( parser.next() )
+         {
+         case pull_parser::START_TAG:
+            oss << "<" << parser.name();
+            if ( !parser.attributes().empty() )
+               oss << " {" << parser.attributes() << "}";
+            oss << ">";
+            break;
+
+         case pull_parser::END_TAG:
+            oss << "</" << parser.name() << ">";
+            break;
+
+         case pull_parser::TEXT:
+            oss << "[" << parser.text() << "]";
+            break;
+
+         case pull_parser::END_DOCUMENT:
+            return oss.str();
+         }
+      }
+   }
+
+   char const NESTED_XML[] = {
+      "<?xml version=\"1.0\"?>\n"
+      "<!DOCTYPE base>\n"
+      "<base>\n"
+      "  <node id=\"1\">\n"
+      "    <foo>1</foo>\n"
+      "    <bar/>\n"
+      "  </node>\n"
+      "  <node id=\"a>b\" >\n"
+      "    <foo>3</foo>\n"
+      "  </node >\n"
+      "</base>\n"
+   };
+
+}
+
+// -----------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE( test_events )
+{
+   BOOST_CHECK_EQUAL( trace(""), "" );
+   BOOST_CHECK_EQUAL( trace("  \n "), "" );
+   BOOST_CHECK_EQUAL( trace(NESTED_XML),
+                      "<base><node {id=\"1\"}><foo>[1]</foo><bar></bar></node>"
+                      "<node {id=\"a>b\"}><foo>[3]</foo></node></base>" );
+}
+
+// -----------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE( test_text )
+{
+   // leading whitespace is skipped, just like with simple_parser
+   BOOST_CHECK_EQUAL( trace("<a>  hello world \n</a>"), "<a>[hello world \n]</a>" );
+   BOOST_CHECK_EQUAL( trace("<a>1<!-- <b>2</b> -->3</a>"), "<a>[1][3]</a>" );
+   BOOST_CHECK_EQUAL( trace("<a><![CDATA[<b>&amp;</b>]]></a>"), "<a>[<b>&amp;</b>]</a>" );
+   BOOST_CHECK_EQUAL( trace("<a>&lt;</a>"), "<a>[&lt;]</a>" );
+}
+
+// -----------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE( test_depth )
+{
+   std::string xml(NESTED_XML);
+   pull_parser parser(xml.data(), xml.size());
+
+   BOOST_CHECK_EQUAL( parser.depth(), 0U );
+   BOOST_REQUIRE( parser.next() == pull_parser::START_TAG );
+   BOOST_CHECK_EQUAL( parser.depth(), 1U );
+   BOOST_REQUIRE( parser.next() == pull_parser::START_TAG );
+   BOOST_CHECK_EQUAL( parser.depth(), 2U );
+   BOOST_REQUIRE( parser.next() == pull_parser::START_TAG );
+   BOOST_CHECK_EQUAL( parser.depth(), 3U );
+   BOOST_REQUIRE( parser.next() == pull_parser::TEXT );
+   BOOST_CHECK_EQUAL( parser.depth(), 3U );
+   BOOST_REQUIRE( parser.next() == pull_parser::END_TAG );
+   BOOST_CHECK_EQUAL( parser.depth(), 3U );
+   BOOST_REQUIRE( parser.next() == pull_parser::START_TAG );
+   BOOST_CHECK_EQUAL( parser.name(), "bar" );
+   BOOST_CHECK_EQUAL( parser.depth(), 3U );
+   BOOST_REQUIRE( parser.next() == pull_parser::END_TAG );
+   BOOST_CHECK_EQUAL( parser.name(), "bar" );
+   BOOST_CHECK_EQUAL( parser.depth(), 3U );
+   BOOST_REQUIRE( parser.next() == pull_parser::END_TAG );
+   BOOST_CHECK_EQUAL( parser.name(), "node" );
+   BOOST_CHECK_EQUAL( parser.depth(), 2U );
+}
+
+// -----------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE( test_skip )
+{
+   std::string xml(NESTED_XML);
+   pull_parser parser(xml.data(), xml.size());
+
+   BOOST_REQUIRE( parser.next() == pull_parser::START_TAG );
+   BOOST_REQUIRE( parser.next() == pull_parser::START_TAG );
+   BOOST_CHECK_EQUAL( parser.attributes(), "id=\"1\"" );
+
+   parser.skip();
+   BOOST_CHECK( parser.event() == pull_parser::END_TAG );
+   BOOST_CHECK_EQUAL( parser.name(), "node" );
+
+   BOOST_REQUIRE( parser.next() == pull_parser::START_TAG );
+   BOOST_CHECK_EQUAL( parser.attributes(), "id=\"a>b\"" );
+
+   parser.skip();
+   BOOST_REQUIRE( parser.next() == pull_parser::END_TAG );
+   BOOST_CHECK_EQUAL( parser.name(), "base" );
+   BOOST_CHECK( parser.next() == pull_parser::END_DOCUMENT );
+   BOOST_CHECK_THROW( parser.skip(), std::runtime_error );
+}
+
+// -----------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE( test_errors )
+{
+   BOOST_CHECK_THROW( trace("<a><b>1</b>"), std::runtime_error );
+   BOOST_CHECK_THROW( trace("<a><b>1<b></a>"), std::runtime_error );
+   BOOST_CHECK_THROW( trace("<a><b>1</c></a>"), std::runtime_error );
+   BOOST_CHECK_THROW( trace("</a>"), std::runtime_error );
+   BOOST_CHECK_THROW( trace("<a><b</a>"), std::runtime_error );
+   BOOST_CHECK_THROW( trace("<a><!-- </a>"), std::runtime_error );
+   BOOST_CHECK_THROW( trace("<a>< ></a>"), std::runtime_error );
+
+   try
+   {
+      trace("<a>\n  <b>1</c>\n</a>");
+      BOOST_ERROR( "expected an exception" );
+   }
+   catch (const std::runtime_error& e)
+   {
+      BOOST_CHECK_EQUAL( std::string(e.what()),
+                         "xml error at line 2: cannot find closing tag for <b>, found </c> instead" );
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE( test_file )
+{
+   moost::testing::test_directory_creator tdc("PullParserTest_Directory");
+
+   BOOST_CHECK_THROW( file_pull_parser parser(tdc.GetFilePath("unexisting_file.xml")), std::exception );
+
+   std::string const& emptyFilename = tdc.GetFilePath("empty.xml");
+   std::ofstream(emptyFilename.c_str());
+
+   file_pull_parser empty(emptyFilename);
+   BOOST_CHECK( empty.next() == pull_parser::END_DOCUMENT );
+
+   std::string const& filename = tdc.GetFilePath("nested.xml");
+   {
+      std::ofstream ofs(filename.c_str());
+      ofs << NESTED_XML;
+   }
+
+   file_pull_parser parser(filename);
+   size_t tags = 0;
+
+   while ( parser.next() != pull_parser::END_DOCUMENT )
+   {
+      if ( parser.event() == pull_parser::START_TAG )
+         ++tags;
+   }
+
+   BOOST_CHECK_EQUAL( tags, 6U );
+}
+
+// -----------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -125,6 +125,15 @@ namespace
       "</base>\n"
    };
 
+   char const PROLOG_XML[] = {
+      "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      "<base version=\"2\">\n"
+      "  <foo>1</foo>\n"
+      "  <empty/>\n"
+      "  <bar>2</bar>\n"
+      "</base>\n"
+   };
+
    char const TO_LOWERCASE_XML[] = {
       "<BASE>\n"
       "  <FOO>one</FOO>\n"
@@ -284,6 +293,34 @@ BOOST_FIXTURE_TEST_CASE( test_comment, Fixture )
 
 // -----------------------------------------------------------------------------
 
+BOOST_FIXTURE_TEST_CASE( test_prolog_and_attributes, Fixture )
+{
+   std::string const& sProxyFilename = m_tdc.GetFilePath("parser_test_prolog.xml");
+   std::string sCfg(PROLOG_XML);
+   {
+      std::ofstream ofs(sProxyFilename.c_str());
+      ofs << sCfg;
+   }
+
+   m_parser.load(sProxyFilename);
+   const simple_parser::tree_branch_t& root = m_parser.get_root();
+
+   BOOST_REQUIRE( root.size() == 1 ); // the head
+   BOOST_CHECK_EQUAL( root.front()->header, "base" );
+
+   simple_parser::tree_branch_t& leaves = root.front()->leaves;
+   BOOST_REQUIRE( leaves.size() == 3 );
+
+   BOOST_CHECK_EQUAL( leaves[0]->header, "foo" );
+   BOOST_CHECK_EQUAL( leaves[0]->value, "1" );
+   BOOST_CHECK_EQUAL( leaves[1]->header, "empty" );
+   BOOST_CHECK( leaves[1]->value.empty() );
+   BOOST_CHECK_EQUAL( leaves[2]->header, "bar" );
+   BOOST_CHECK_EQUAL( leaves[2]->value, "2" );
+}
+
+// -----------------------------------------------------------------------------
+
 BOOST_FIXTURE_TEST_CASE( test_to_lowercase_1, Fixture )
 {
    std::string const& sProxyFilename = m_tdc.GetFilePath("parser_test_to_lowercase_1.xml");